@@ -4,6 +4,9 @@
 *
 *   - Implement the C function I2C_transaction to provide low level I2C access.
 *   - Use read_property<PropertyId>() to read properties from the ODrive.
+*   - Use read_properties() to read several consecutive properties at once.
+*   - Use read_batch<endpoint<PropertyId, Axis>...>() to read a compile-time
+*     list of properties in one transaction.
 *   - Use write_property<PropertyId>() to modify properties on the ODrive.
 *   - Use trigger<PropertyId>() to trigger a function (such as reboot or save_configuration)
 *   - Use endpoint_type_t<PropertyId> to retrieve the underlying type
@@ -127,6 +130,118 @@ namespace odrive {
         return true;
     }
 
+    /* @brief Read several consecutive endpoints in one I2C transaction.
+    * The values are returned back to back in buffer, use read_le() to decode
+    * them. Only properties can be read this way.
+    *
+    * Usage example:
+    *   uint8_t buf[8];
+    *   success = odrive::read_properties(0, odrive::AXIS__ENCODER__POS_ESTIMATE, 2, buf, sizeof(buf));
+    *   float pos_estimate = odrive::read_le<float>(buf);
+    *   float pos_cpr = odrive::read_le<float>(buf + 4);
+    *
+    * @param num Selects the ODrive. For instance the value 4 selects
+    * the ODrive that has [A2, A1, A0] connected to [VCC, GND, GND].
+    * @param length The combined size of the values in bytes.
+    * @return true if the I2C transaction succeeded, false otherwise
+    */
+    bool read_properties(uint8_t num, uint16_t address, uint8_t count, uint8_t* buffer, size_t length) {
+        uint8_t i2c_tx_buffer[5];
+        write_le<uint16_t>(i2c_tx_buffer, address);
+        i2c_tx_buffer[2] = count;
+        write_le<uint16_t>(i2c_tx_buffer + sizeof(i2c_tx_buffer) - 2, json_crc);
+        return I2C_transaction(i2c_addr + num,
+            i2c_tx_buffer, sizeof(i2c_tx_buffer),
+            buffer, length);
+    }
+
+    /* @brief Selects an endpoint for read_batch().
+    * For axis specific endpoints IAxis selects the axis.
+    */
+    template<int IPropertyId, unsigned int IAxis = 0>
+    struct endpoint {
+        using type = endpoint_type_t<IPropertyId>;
+        static constexpr const uint16_t address = IPropertyId + IAxis * per_axis_offset;
+    };
+
+    template<typename... TEndpoints>
+    struct batch;
+
+    template<>
+    struct batch<> {
+        static constexpr const size_t size = 0;
+        static void unpack(const uint8_t buffer[]) {}
+    };
+
+    template<typename TEndpoint, typename... TRest>
+    struct batch<TEndpoint, TRest...> {
+        using type = typename TEndpoint::type;
+        static constexpr const size_t size = byte_width<type>::value + batch<TRest...>::size;
+
+        static void unpack(const uint8_t buffer[], type* value, typename TRest::type*... rest) {
+            if (value)
+                *value = read_le<type>(buffer);
+            batch<TRest...>::unpack(buffer + byte_width<type>::value, rest...);
+        }
+    };
+
+    /* @brief Read several endpoints on the ODrive in one I2C transaction.
+    * The response size and the value types are resolved at compile time.
+    * Runs of consecutive endpoints are requested together, so listing
+    * endpoints in the order of their IDs gives a shorter request.
+    *
+    * Usage example:
+    *   float pos0, pos1, vel0, vel1;
+    *   uint8_t state0, state1;
+    *   success = odrive::read_batch<
+    *       odrive::endpoint<odrive::AXIS__ENCODER__POS_ESTIMATE, 0>,
+    *       odrive::endpoint<odrive::AXIS__ENCODER__PLL_VEL, 0>,
+    *       odrive::endpoint<odrive::AXIS__CURRENT_STATE, 0>,
+    *       odrive::endpoint<odrive::AXIS__ENCODER__POS_ESTIMATE, 1>,
+    *       odrive::endpoint<odrive::AXIS__ENCODER__PLL_VEL, 1>,
+    *       odrive::endpoint<odrive::AXIS__CURRENT_STATE, 1>
+    *   >(0, &pos0, &vel0, &state0, &pos1, &vel1, &state1);
+    *
+    * The request takes up to 3 bytes per endpoint plus 2 bytes and the
+    * response the combined size of the values. Both must fit into the
+    * buffers of the I2C library (32 bytes for the Arduino Wire library).
+    *
+    * @param num Selects the ODrive. For instance the value 4 selects
+    * the ODrive that has [A2, A1, A0] connected to [VCC, GND, GND].
+    * @return true if the I2C transaction succeeded, false otherwise
+    */
+    template<typename... TEndpoints>
+    bool read_batch(uint8_t num, typename TEndpoints::type*... values) {
+        static_assert(sizeof...(TEndpoints) > 0, "empty batch");
+        const uint16_t addresses[] = { TEndpoints::address... };
+
+        // Request: id (uint16), count (uint8) for every run of consecutive
+        // endpoints, followed by the json_crc
+        uint8_t i2c_tx_buffer[3 * sizeof...(TEndpoints) + 2];
+        size_t tx_length = 0;
+        size_t count_pos = 0;
+        for (size_t i = 0; i < sizeof...(TEndpoints); ++i) {
+            if (i && addresses[i] == addresses[i - 1] + 1 && i2c_tx_buffer[count_pos] < UINT8_MAX) {
+                i2c_tx_buffer[count_pos]++;
+            } else {
+                write_le<uint16_t>(i2c_tx_buffer + tx_length, addresses[i]);
+                count_pos = tx_length + 2;
+                i2c_tx_buffer[count_pos] = 1;
+                tx_length += 3;
+            }
+        }
+        write_le<uint16_t>(i2c_tx_buffer + tx_length, json_crc);
+        tx_length += 2;
+
+        uint8_t i2c_rx_buffer[batch<TEndpoints...>::size];
+        if (!I2C_transaction(i2c_addr + num,
+            i2c_tx_buffer, tx_length,
+            i2c_rx_buffer, sizeof(i2c_rx_buffer)))
+            return false;
+        batch<TEndpoints...>::unpack(i2c_rx_buffer, values...);
+        return true;
+    }
+
     /* @brief Write to an endpoint on the ODrive.
     * To write to an axis specific endpoint use write_axis_property() instead.
     *
@@ -38,7 +38,9 @@ void ODriveArduino::TrapezoidalMove(int motor_number, float position) {
 }
 
 float ODriveArduino::readFloat() {
-    return readString().toFloat();
+    char buffer[32];
+    readLine(buffer, sizeof(buffer));
+    return atof(buffer);
 }
 
 float ODriveArduino::GetVelocity(int motor_number) {
@@ -52,7 +54,9 @@ float ODriveArduino::GetPosition(int motor_number) {
 }
 
 int32_t ODriveArduino::readInt() {
-    return readString().toInt();
+    char buffer[32];
+    readLine(buffer, sizeof(buffer));
+    return atol(buffer);
 }
 
 bool ODriveArduino::run_state(int axis, int requested_state, bool wait_for_idle, float timeout) {
@@ -68,20 +72,192 @@ bool ODriveArduino::run_state(int axis, int requested_state, bool wait_for_idle,
     return timeout_ctr > 0;
 }
 
-String ODriveArduino::readString() {
-    String str = "";
+// Reads one line (without the newline) into buffer, blocking for up to one
+// second. Characters beyond the buffer size are dropped.
+size_t ODriveArduino::readLine(char* buffer, size_t length) {
+    size_t pos = 0;
     static const unsigned long timeout = 1000;
     unsigned long timeout_start = millis();
     for (;;) {
         while (!serial_.available()) {
             if (millis() - timeout_start >= timeout) {
-                return str;
+                buffer[pos] = '\0';
+                return pos;
             }
         }
         char c = serial_.read();
         if (c == '\n')
             break;
-        str += c;
+        if (pos < length - 1)
+            buffer[pos++] = c;
+    }
+    buffer[pos] = '\0';
+    return pos;
+}
+
+void ODriveArduino::poll() {
+    if (pending_ != PENDING_NONE && millis() - pending_since_ms_ >= kRequestTimeoutMs) {
+        pending_ = PENDING_NONE;
+    }
+
+    // Only consume what has arrived, never wait for more
+    int available = serial_.available();
+    while (available-- > 0) {
+        char c = serial_.read();
+        if (c == '\r') {
+            continue;
+        }
+        if (c != '\n') {
+            if (line_length_ < sizeof(line_) - 1) {
+                line_[line_length_++] = c;
+            } else {
+                line_overflow_ = true;
+            }
+            continue;
+        }
+
+        line_[line_length_] = '\0';
+        if (line_overflow_) {
+            rx_errors_++;
+        } else if (line_length_) {
+            processLine(line_);
+        }
+        line_length_ = 0;
+        line_overflow_ = false;
+    }
+}
+
+bool ODriveArduino::startRequest(Pending pending) {
+    if (pending_ != PENDING_NONE) {
+        return false;
+    }
+    pending_ = pending;
+    pending_since_ms_ = millis();
+    return true;
+}
+
+bool ODriveArduino::RequestFeedback(int motor_number) {
+    if (motor_number < 0 || motor_number >= kNumAxes || !startRequest(PENDING_FEEDBACK)) {
+        return false;
+    }
+    pending_axis_ = motor_number;
+    serial_ << "f " << motor_number << '\n';
+    return true;
+}
+
+bool ODriveArduino::RequestProperty(const char* path) {
+    if (!startRequest(PENDING_PROPERTY)) {
+        return false;
+    }
+    property_available_ = false;
+    serial_ << "r " << path << '\n';
+    return true;
+}
+
+bool ODriveArduino::PropertyAvailable(float* value) {
+    if (!property_available_) {
+        return false;
+    }
+    property_available_ = false;
+    if (value) {
+        *value = property_value_;
+    }
+    return true;
+}
+
+void ODriveArduino::StartFeedbackStream(unsigned int period_ms, uint8_t axes, uint8_t fields) {
+    stream_axes_ = axes;
+    stream_fields_ = fields;
+    serial_ << "fs " << period_ms << ' ' << axes << ' ' << fields << '\n';
+}
+
+void ODriveArduino::StopFeedbackStream() {
+    serial_ << "fs 0\n";
+    stream_axes_ = 0;
+}
+
+bool ODriveArduino::NewFeedback(int motor_number) {
+    uint8_t mask = 1 << motor_number;
+    if (!(new_feedback_ & mask)) {
+        return false;
+    }
+    new_feedback_ &= ~mask;
+    return true;
+}
+
+// Parses count whitespace separated floats. Fails if there are fewer or more.
+bool ODriveArduino::parseFloats(char* str, float* values, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        char* end;
+        values[i] = strtod(str, &end);
+        if (end == str) {
+            return false;
+        }
+        str = end;
+    }
+    while (*str == ' ') {
+        str++;
+    }
+    return *str == '\0';
+}
+
+void ODriveArduino::processLine(char* line) {
+    unsigned long now = millis();
+
+    // Feedback stream: "F" followed by the selected fields of every selected axis
+    if (line[0] == 'F' && (line[1] == ' ' || line[1] == '\0')) {
+        float values[kNumAxes * 3];
+        size_t count = 0;
+        for (int axis = 0; axis < kNumAxes; ++axis) {
+            if (stream_axes_ & (1 << axis)) {
+                for (uint8_t field = FEEDBACK_POS; field <= FEEDBACK_IQ; field <<= 1) {
+                    count += (stream_fields_ & field) ? 1 : 0;
+                }
+            }
+        }
+        if (!count || !parseFloats(line + 1, values, count)) {
+            rx_errors_++;
+            return;
+        }
+        const float* value = values;
+        for (int axis = 0; axis < kNumAxes; ++axis) {
+            if (!(stream_axes_ & (1 << axis))) {
+                continue;
+            }
+            ODriveFeedback& feedback = feedback_[axis];
+            if (stream_fields_ & FEEDBACK_POS)
+                feedback.pos = *value++;
+            if (stream_fields_ & FEEDBACK_VEL)
+                feedback.vel = *value++;
+            if (stream_fields_ & FEEDBACK_IQ)
+                feedback.iq = *value++;
+            feedback.timestamp_ms = now;
+            new_feedback_ |= 1 << axis;
+        }
+        return;
+    }
+
+    // Anything else is the response to the outstanding request
+    Pending pending = pending_;
+    pending_ = PENDING_NONE;
+    if (pending == PENDING_FEEDBACK) {
+        float values[2];
+        if (!parseFloats(line, values, 2)) {
+            rx_errors_++;
+            return;
+        }
+        ODriveFeedback& feedback = feedback_[pending_axis_];
+        feedback.pos = values[0];
+        feedback.vel = values[1];
+        feedback.timestamp_ms = now;
+        new_feedback_ |= 1 << pending_axis_;
+    } else if (pending == PENDING_PROPERTY) {
+        if (!parseFloats(line, &property_value_, 1)) {
+            rx_errors_++;
+            return;
+        }
+        property_available_ = true;
+    } else {
+        rx_errors_++;
     }
-    return str;
 }
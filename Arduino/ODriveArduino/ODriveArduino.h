@@ -5,8 +5,27 @@
 #include "Arduino.h"
 #include "ODriveEnums.h"
 
+// Latest feedback of one axis
+struct ODriveFeedback {
+    float pos = 0.0f;           // [turns]
+    float vel = 0.0f;           // [turns/s]
+    float iq = 0.0f;            // [A], only from a feedback stream that includes it
+    unsigned long timestamp_ms = 0; // millis() when the values arrived, 0 if they never did
+};
+
 class ODriveArduino {
 public:
+    static const int kNumAxes = 2;
+    static const size_t kLineBufferSize = 96;
+    static const unsigned long kRequestTimeoutMs = 1000;
+
+    // Field bits of StartFeedbackStream(), see the "fs" command of the ASCII protocol
+    enum FeedbackField : uint8_t {
+        FEEDBACK_POS = 1,
+        FEEDBACK_VEL = 2,
+        FEEDBACK_IQ = 4,
+    };
+
     ODriveArduino(Stream& serial);
 
     // Commands
@@ -17,7 +36,8 @@ public:
     void SetVelocity(int motor_number, float velocity, float current_feedforward);
     void SetCurrent(int motor_number, float current);
     void TrapezoidalMove(int motor_number, float position);
-    // Getters
+    // Getters. These block until the response arrives, use the non-blocking
+    // API below in a control loop.
     float GetVelocity(int motor_number);
     float GetPosition(int motor_number);
     // General params
@@ -26,10 +46,73 @@ public:
 
     // State helper
     bool run_state(int axis, int requested_state, bool wait_for_idle, float timeout = 10.0f);
+
+    // Non-blocking API
+    //
+    // The requests only send a command. poll() must be called regularly (e.g.
+    // every loop iteration), it consumes the bytes that arrived so far and
+    // never waits for more. Only one request can be outstanding at a time, a
+    // request returns false while another one is pending. Don't mix this with
+    // the blocking getters.
+    void poll();
+
+    // Requests the position and velocity of an axis ("f" command). The
+    // result shows up in GetFeedback().
+    bool RequestFeedback(int motor_number);
+    // Requests the value of a property, such as "vbus_voltage". Once the
+    // response arrived PropertyAvailable() returns true.
+    bool RequestProperty(const char* path);
+    bool PropertyAvailable(float* value);
+    bool RequestPending() const { return pending_ != PENDING_NONE; }
+
+    // Makes the ODrive send the feedback of the selected axes every
+    // period_ms without further requests ("fs" command).
+    void StartFeedbackStream(unsigned int period_ms, uint8_t axes = (1 << kNumAxes) - 1,
+                             uint8_t fields = FEEDBACK_POS | FEEDBACK_VEL);
+    void StopFeedbackStream();
+
+    // Latest feedback of an axis from RequestFeedback() or the stream.
+    const ODriveFeedback& GetFeedback(int motor_number) const { return feedback_[motor_number]; }
+    // Returns true once for every feedback update of the axis
+    bool NewFeedback(int motor_number);
+
+    // Lines that were dropped because they didn't fit into the line buffer
+    // or couldn't be parsed
+    uint16_t rx_errors() const { return rx_errors_; }
+
 private:
-    String readString();
+    enum Pending : uint8_t {
+        PENDING_NONE,
+        PENDING_FEEDBACK,
+        PENDING_PROPERTY,
+    };
+
+    size_t readLine(char* buffer, size_t length);
+    bool startRequest(Pending pending);
+    void processLine(char* line);
+    bool parseFloats(char* str, float* values, size_t count);
 
     Stream& serial_;
+
+    // Line parser
+    char line_[kLineBufferSize];
+    size_t line_length_ = 0;
+    bool line_overflow_ = false;
+    uint16_t rx_errors_ = 0;
+
+    // Outstanding request
+    Pending pending_ = PENDING_NONE;
+    uint8_t pending_axis_ = 0;
+    unsigned long pending_since_ms_ = 0;
+    float property_value_ = 0.0f;
+    bool property_available_ = false;
+
+    // Feedback stream layout
+    uint8_t stream_axes_ = 0;
+    uint8_t stream_fields_ = 0;
+
+    ODriveFeedback feedback_[kNumAxes];
+    uint8_t new_feedback_ = 0; // bit mask of the axes
 };
 
 #endif //ODriveArduino_h
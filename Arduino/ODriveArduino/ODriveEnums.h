@@ -33,6 +33,7 @@ enum StreamProtocolType {
     STREAM_PROTOCOL_TYPE_ASCII               = 1,
     STREAM_PROTOCOL_TYPE_STDOUT              = 2,
     STREAM_PROTOCOL_TYPE_ASCII_AND_STDOUT    = 3,
+    STREAM_PROTOCOL_TYPE_SIMPLE              = 4,
 };
 
 // ODrive.Can.Protocol
@@ -0,0 +1,218 @@
+
+#include "Arduino.h"
+#include "ODriveUartSimple.h"
+
+static void writeU32(uint8_t* buffer, uint32_t value) {
+    for (size_t i = 0; i < 4; ++i)
+        buffer[i] = (value >> (i * 8)) & 0xff;
+}
+
+static void writeFloat(uint8_t* buffer, float value) {
+    uint32_t raw;
+    memcpy(&raw, &value, sizeof(raw));
+    writeU32(buffer, raw);
+}
+
+static void writeI16(uint8_t* buffer, int16_t value) {
+    buffer[0] = (uint16_t)value & 0xff;
+    buffer[1] = (uint16_t)value >> 8;
+}
+
+static uint32_t readU32(const uint8_t* buffer) {
+    uint32_t value = 0;
+    for (size_t i = 0; i < 4; ++i)
+        value |= (uint32_t)buffer[i] << (i * 8);
+    return value;
+}
+
+static float readFloat(const uint8_t* buffer) {
+    uint32_t raw = readU32(buffer);
+    float value;
+    memcpy(&value, &raw, sizeof(value));
+    return value;
+}
+
+// Scales a feedforward term to the int16 encoding of Set_Input_Pos (0.001 per LSB)
+static int16_t toFixed(float value) {
+    float scaled = value * 1000.0f;
+    if (scaled > 32767.0f)
+        return 32767;
+    if (scaled < -32768.0f)
+        return -32768;
+    return (int16_t)(scaled + (scaled < 0.0f ? -0.5f : 0.5f));
+}
+
+ODriveUartSimple::ODriveUartSimple(Stream& serial)
+    : serial_(serial) {}
+
+void ODriveUartSimple::SetPosition(uint8_t node_id, float position, float velocity_feedforward, float torque_feedforward) {
+    uint8_t data[8];
+    writeFloat(data, position);
+    writeI16(data + 4, toFixed(velocity_feedforward));
+    writeI16(data + 6, toFixed(torque_feedforward));
+    Send((node_id << 5) | MSG_SET_INPUT_POS, false, data, sizeof(data));
+}
+
+void ODriveUartSimple::SetVelocity(uint8_t node_id, float velocity, float torque_feedforward) {
+    uint8_t data[8];
+    writeFloat(data, velocity);
+    writeFloat(data + 4, torque_feedforward);
+    Send((node_id << 5) | MSG_SET_INPUT_VEL, false, data, sizeof(data));
+}
+
+void ODriveUartSimple::SetTorque(uint8_t node_id, float torque) {
+    uint8_t data[4];
+    writeFloat(data, torque);
+    Send((node_id << 5) | MSG_SET_INPUT_TORQUE, false, data, sizeof(data));
+}
+
+void ODriveUartSimple::SetRequestedState(uint8_t node_id, uint32_t requested_state) {
+    uint8_t data[4];
+    writeU32(data, requested_state);
+    Send((node_id << 5) | MSG_SET_AXIS_REQUESTED_STATE, false, data, sizeof(data));
+}
+
+void ODriveUartSimple::ClearErrors(uint8_t node_id) {
+    Send((node_id << 5) | MSG_CLEAR_ERRORS, false, nullptr, 0);
+}
+
+uint8_t ODriveUartSimple::crc8(uint8_t crc, const uint8_t* data, size_t len) {
+    while (len--) {
+        crc ^= *data++;
+        for (uint8_t bit = 8; bit; --bit)
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x37 : (crc << 1);
+    }
+    return crc;
+}
+
+bool ODriveUartSimple::Send(uint16_t id, bool rtr, const uint8_t* data, uint8_t len) {
+    if (id > 0x7ff || len > 8 || (rtr && len)) {
+        return false;
+    }
+
+    uint8_t raw[kMaxRawSize];
+    size_t raw_len = 0;
+    uint16_t raw_id = id | (rtr ? 0x8000 : 0);
+    raw[raw_len++] = raw_id & 0xff;
+    raw[raw_len++] = raw_id >> 8;
+    for (uint8_t i = 0; i < len; ++i)
+        raw[raw_len++] = data[i];
+    raw[raw_len] = crc8(0x42, raw, raw_len);
+    raw_len++;
+
+    // COBS encoding: every zero byte is replaced by the distance to the next
+    // one, the first byte holds the distance to the first zero byte
+    uint8_t frame[kMaxEncodedSize + 1];
+    size_t code_pos = 0;
+    size_t pos = 1;
+    uint8_t code = 1;
+    for (size_t i = 0; i < raw_len; ++i) {
+        if (raw[i]) {
+            frame[pos++] = raw[i];
+            code++;
+        } else {
+            frame[code_pos] = code;
+            code_pos = pos++;
+            code = 1;
+        }
+    }
+    frame[code_pos] = code;
+    frame[pos++] = 0;
+
+    return serial_.write(frame, pos) == pos;
+}
+
+void ODriveUartSimple::poll() {
+    int available = serial_.available();
+    while (available-- > 0) {
+        uint8_t c = serial_.read();
+        if (c) {
+            if (frame_length_ < sizeof(frame_)) {
+                frame_[frame_length_++] = c;
+            } else {
+                frame_overflow_ = true;
+            }
+            continue;
+        }
+
+        // Delimiter. Empty frames are padding.
+        if (frame_overflow_) {
+            rx_errors_++;
+        } else if (frame_length_) {
+            processFrame();
+        }
+        frame_length_ = 0;
+        frame_overflow_ = false;
+    }
+}
+
+void ODriveUartSimple::processFrame() {
+    // COBS decoding in place
+    size_t raw_len = 0;
+    for (size_t i = 0; i < frame_length_;) {
+        uint8_t code = frame_[i++];
+        if (i + code - 1 > frame_length_) {
+            rx_errors_++;
+            return;
+        }
+        for (uint8_t j = 1; j < code; ++j)
+            frame_[raw_len++] = frame_[i++];
+        if (code != 0xff && i < frame_length_)
+            frame_[raw_len++] = 0;
+    }
+
+    if (raw_len < 3 || raw_len > kMaxRawSize
+            || crc8(0x42, frame_, raw_len - 1) != frame_[raw_len - 1]) {
+        rx_errors_++;
+        return;
+    }
+
+    uint16_t id = frame_[0] | (frame_[1] << 8);
+    if (id & 0x8000) {
+        return; // the ODrive doesn't send requests
+    }
+    handleMessage(id, frame_ + 2, raw_len - 3);
+}
+
+void ODriveUartSimple::handleMessage(uint16_t id, const uint8_t* data, uint8_t len) {
+    uint8_t node_id = id >> 5;
+    if (node_id >= kMaxNodes) {
+        return;
+    }
+    NodeState& node = nodes_[node_id];
+    unsigned long now = millis();
+
+    switch (id & 0x1f) {
+        case MSG_ODRIVE_HEARTBEAT:
+            if (len >= 5) {
+                node.axis_error = readU32(data);
+                node.axis_state = data[4];
+                node.heartbeat_ms = now;
+            }
+            break;
+        case MSG_GET_ENCODER_ESTIMATES:
+            if (len >= 8) {
+                node.feedback.pos = readFloat(data);
+                node.feedback.vel = readFloat(data + 4);
+                node.feedback.timestamp_ms = now;
+                new_feedback_ |= 1 << node_id;
+            }
+            break;
+        case MSG_GET_IQ:
+            if (len >= 8) {
+                node.feedback.iq = readFloat(data + 4); // measured, after the setpoint
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+bool ODriveUartSimple::NewFeedback(uint8_t node_id) {
+    uint8_t mask = 1 << node_id;
+    if (node_id >= kMaxNodes || !(new_feedback_ & mask)) {
+        return false;
+    }
+    new_feedback_ &= ~mask;
+    return true;
+}
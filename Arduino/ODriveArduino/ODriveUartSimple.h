@@ -0,0 +1,86 @@
+
+#ifndef ODriveUartSimple_h
+#define ODriveUartSimple_h
+
+#include "Arduino.h"
+#include "ODriveArduino.h"
+
+// Talks to an ODrive whose UART runs STREAM_PROTOCOL_TYPE_SIMPLE, i.e. the
+// CANSimple messages in COBS encoded frames (see the UART documentation).
+// Axes are addressed by their axis.config.can.node_id.
+//
+// Nothing blocks: the commands are queued in the serial TX buffer and poll()
+// consumes the frames that arrived so far. There is no dynamic allocation.
+class ODriveUartSimple {
+public:
+    static const uint8_t kMaxNodes = 4; // node IDs 0 to kMaxNodes-1 are tracked
+
+    // CANSimple command IDs
+    enum CmdId : uint8_t {
+        MSG_ODRIVE_HEARTBEAT = 0x001,
+        MSG_SET_AXIS_REQUESTED_STATE = 0x007,
+        MSG_GET_ENCODER_ESTIMATES = 0x009,
+        MSG_SET_INPUT_POS = 0x00C,
+        MSG_SET_INPUT_VEL = 0x00D,
+        MSG_SET_INPUT_TORQUE = 0x00E,
+        MSG_GET_IQ = 0x014,
+        MSG_CLEAR_ERRORS = 0x018,
+    };
+
+    struct NodeState {
+        ODriveFeedback feedback;   // from MSG_GET_ENCODER_ESTIMATES and MSG_GET_IQ
+        uint32_t axis_error = 0;   // from the heartbeat
+        uint8_t axis_state = 0;    // from the heartbeat
+        unsigned long heartbeat_ms = 0;
+    };
+
+    ODriveUartSimple(Stream& serial);
+
+    // Commands
+    void SetPosition(uint8_t node_id, float position, float velocity_feedforward = 0.0f, float torque_feedforward = 0.0f);
+    void SetVelocity(uint8_t node_id, float velocity, float torque_feedforward = 0.0f);
+    void SetTorque(uint8_t node_id, float torque);
+    void SetRequestedState(uint8_t node_id, uint32_t requested_state);
+    void ClearErrors(uint8_t node_id);
+
+    // Requests. The responses are picked up by poll().
+    void RequestEncoderEstimates(uint8_t node_id) { sendRtr(node_id, MSG_GET_ENCODER_ESTIMATES); }
+    void RequestIq(uint8_t node_id) { sendRtr(node_id, MSG_GET_IQ); }
+    void RequestHeartbeat(uint8_t node_id) { sendRtr(node_id, MSG_ODRIVE_HEARTBEAT); }
+
+    // Sends any CANSimple message (11 bit ID, up to 8 data bytes)
+    bool Send(uint16_t id, bool rtr, const uint8_t* data, uint8_t len);
+
+    // Consumes the received bytes without waiting for more
+    void poll();
+
+    const NodeState& GetState(uint8_t node_id) const { return nodes_[node_id]; }
+    // Returns true once for every encoder estimate update of the node
+    bool NewFeedback(uint8_t node_id);
+
+    // Frames that were dropped because they were corrupted
+    uint16_t rx_errors() const { return rx_errors_; }
+
+    // CRC8 of the frames (same as the native stream protocol)
+    static uint8_t crc8(uint8_t crc, const uint8_t* data, size_t len);
+
+private:
+    static const size_t kMaxRawSize = 2 + 8 + 1;          // ID, data, CRC
+    static const size_t kMaxEncodedSize = kMaxRawSize + 1; // COBS code byte, without the delimiter
+
+    void sendRtr(uint8_t node_id, uint8_t cmd_id) { Send((node_id << 5) | cmd_id, true, nullptr, 0); }
+    void processFrame();
+    void handleMessage(uint16_t id, const uint8_t* data, uint8_t len);
+
+    Stream& serial_;
+
+    uint8_t frame_[kMaxEncodedSize];
+    size_t frame_length_ = 0;
+    bool frame_overflow_ = false;
+    uint16_t rx_errors_ = 0;
+
+    NodeState nodes_[kMaxNodes];
+    uint8_t new_feedback_ = 0; // bit mask of the nodes
+};
+
+#endif //ODriveUartSimple_h
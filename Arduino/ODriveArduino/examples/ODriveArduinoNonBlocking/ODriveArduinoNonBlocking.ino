@@ -0,0 +1,49 @@
+// includes
+#include <HardwareSerial.h>
+#include <ODriveArduino.h>
+
+// Printing with stream operator helper functions
+template<class T> inline Print& operator <<(Print &obj,     T arg) { obj.print(arg);    return obj; }
+template<>        inline Print& operator <<(Print &obj, float arg) { obj.print(arg, 4); return obj; }
+
+// See the ODriveArduinoTest example for other serial port options
+HardwareSerial& odrive_serial = Serial1;
+
+// ODrive object
+ODriveArduino odrive(odrive_serial);
+
+void setup() {
+  // ODrive uses 115200 baud
+  odrive_serial.begin(115200);
+
+  // Serial to PC
+  Serial.begin(115200);
+  while (!Serial) ; // wait for Arduino Serial Monitor to open
+
+  // Position and velocity of both axes every 10ms
+  odrive.StartFeedbackStream(10);
+}
+
+void loop() {
+  // Consumes whatever arrived from the ODrive, never waits
+  odrive.poll();
+
+  for (int axis = 0; axis < 2; ++axis) {
+    if (odrive.NewFeedback(axis)) {
+      const ODriveFeedback& feedback = odrive.GetFeedback(axis);
+      Serial << "axis" << axis << ": " << feedback.pos << '\t' << feedback.vel << '\n';
+    }
+  }
+
+  // Read the bus voltage once per second without blocking the loop
+  static unsigned long last_request = 0;
+  if (millis() - last_request >= 1000 && odrive.RequestProperty("vbus_voltage")) {
+    last_request = millis();
+  }
+  float vbus;
+  if (odrive.PropertyAvailable(&vbus)) {
+    Serial << "Vbus voltage: " << vbus << '\n';
+  }
+
+  // ... run the control loop here ...
+}
@@ -90,10 +90,13 @@
 #if defined(__ICCARM__) || defined(__CC_ARM) || defined(__GNUC__)
     #include <stdint.h>
     extern uint32_t SystemCoreClock;
+    extern void thread_switched_out(uint32_t slot);
+    extern void thread_switched_in(uint32_t slot);
+    extern void thread_made_ready(uint32_t slot);
 #endif
 
 #define configUSE_PREEMPTION                     1
-#define configSUPPORT_STATIC_ALLOCATION          0
+#define configSUPPORT_STATIC_ALLOCATION          1
 #define configSUPPORT_DYNAMIC_ALLOCATION         1
 #define configUSE_IDLE_HOOK                      1
 #define configUSE_TICK_HOOK                      0
@@ -101,13 +104,16 @@
 #define configTICK_RATE_HZ                       ((TickType_t)1000)
 #define configMAX_PRIORITIES                     ( 7 )
 #define configMINIMAL_STACK_SIZE                 ((uint16_t)128)
-#define configTOTAL_HEAP_SIZE                    ((size_t)65536)
+// All kernel objects are allocated statically, so nothing uses the heap at
+// the moment. system_stats.min_heap_space shows if that changes.
+#define configTOTAL_HEAP_SIZE                    ((size_t)1024)
 #define configMAX_TASK_NAME_LEN                  ( 16 )
 #define configUSE_16_BIT_TICKS                   0
 #define configUSE_MUTEXES                        1
 #define configQUEUE_REGISTRY_SIZE                8
 #define configCHECK_FOR_STACK_OVERFLOW           1
 #define configUSE_PORT_OPTIMISED_TASK_SELECTION  1
+#define configUSE_TRACE_FACILITY                 1
 
 /* Co-routine definitions. */
 #define configUSE_CO_ROUTINES                    0
@@ -124,6 +130,7 @@ to exclude the API function. */
 #define INCLUDE_vTaskDelay                  1
 #define INCLUDE_xTaskGetSchedulerState      1
 #define INCLUDE_uxTaskGetStackHighWaterMark 1
+#define INCLUDE_xTaskGetIdleTaskHandle      1
 
 /* Cortex-M specific definitions. */
 #ifdef __NVIC_PRIO_BITS
@@ -168,6 +175,15 @@ standard names. */
 /* USER CODE BEGIN Defines */   	      
 /* Section where parameter definitions can be added (for instance, to override default ones in FreeRTOS.h) */
 #define configAPPLICATION_ALLOCATED_HEAP 1 // ucHeap allocated in freertos.c
+
+/* Per thread CPU time for odrv.system_stats_. The task number selects the
+counter of the thread, see thread_switched_in() in main.cpp. The kernel's own
+run time stats are not used because their 32-bit counters overflow. */
+#define traceTASK_SWITCHED_OUT() thread_switched_out(pxCurrentTCB->uxTaskNumber)
+#define traceTASK_SWITCHED_IN() thread_switched_in(pxCurrentTCB->uxTaskNumber)
+/* Start of the wake latency of odrv.thread_wake_latencies_, see
+thread_made_ready() in main.cpp */
+#define traceMOVED_TASK_TO_READY_STATE(pxTCB) thread_made_ready((pxTCB)->uxTaskNumber)
 /* USER CODE END Defines */ 
 
 #endif /* FREERTOS_CONFIG_H */
@@ -67,14 +67,24 @@
 
 #define TIM_TIME_BASE TIM14
 
+// PWM timer settings in effect. TIM_1_8_PERIOD_CLOCKS and TIM_1_8_RCR are
+// only the defaults. The actual values are set from the user configuration
+// by apply_pwm_timing() at boot.
+extern uint32_t tim_1_8_period_clocks;
+extern uint32_t tim_1_8_rcr;
+
+// Highest control loop rate apply_pwm_timing() accepts. Above this, one
+// iteration of both axes doesn't reliably fit into a control loop period.
+#define MAX_CONTROL_LOOP_HZ 16000
+
 // Run control loop at the same frequency as the current measurements.
-#define CONTROL_TIMER_PERIOD_TICKS  (2 * TIM_1_8_PERIOD_CLOCKS * (TIM_1_8_RCR + 1))
+#define CONTROL_TIMER_PERIOD_TICKS  (2 * tim_1_8_period_clocks * (tim_1_8_rcr + 1))
 
-#define TIM1_INIT_COUNT (TIM_1_8_PERIOD_CLOCKS / 2 - 1 * 128) // TODO: explain why this offset
+#define TIM1_INIT_COUNT (tim_1_8_period_clocks / 2 - 1 * 128) // TODO: explain why this offset
 
 // The delta from the control loop timestamp to the current sense timestamp is
 // exactly 0 for M0 and TIM1_INIT_COUNT for M1.
-#define MAX_CONTROL_LOOP_UPDATE_TO_CURRENT_UPDATE_DELTA (TIM_1_8_PERIOD_CLOCKS / 2 + 1 * 128)
+#define MAX_CONTROL_LOOP_UPDATE_TO_CURRENT_UPDATE_DELTA (tim_1_8_period_clocks / 2 + 1 * 128)
 
 #ifdef __cplusplus
 #include <Drivers/DRV8301/drv8301.hpp>
@@ -96,7 +106,26 @@ extern Encoder encoders[AXIS_COUNT];
 extern Stm32Gpio gpios[GPIO_COUNT];
 
 struct GpioFunction { int mode = 0; uint8_t alternate_function = 0xff; };
-extern std::array<GpioFunction, 3> alternate_functions[GPIO_COUNT];
+
+// Raw ADC readings of one current measurement event, as captured at the entry
+// of the control loop interrupt.
+struct AdcSample_t {
+    uint32_t timestamp;
+    uint16_t vbus;
+    uint16_t phB[AXIS_COUNT];
+    uint16_t phC[AXIS_COUNT];
+};
+
+// Must be a power of two
+#define ADC_SAMPLE_RING_SIZE 8
+
+// Written only by the control loop interrupts. Other consumers (telemetry,
+// scope) can read the most recent entries without touching ADC registers.
+extern AdcSample_t adc_sample_ring[ADC_SAMPLE_RING_SIZE];
+extern volatile uint32_t adc_sample_ring_head; // total number of samples written (wraps)
+extern std::array<GpioFunction, 4> alternate_functions[GPIO_COUNT];
+// Timer that counts the rising edges on a GPIO in GPIO_MODE_STEP_COUNTER (TI1 input)
+extern TIM_TypeDef* step_counter_timers[GPIO_COUNT];
 
 extern USBD_HandleTypeDef& usb_dev_handle;
 
@@ -110,12 +139,10 @@ extern PwmInput pwm0_input;
 #endif
 
 // Period in [s]
-#define CURRENT_MEAS_PERIOD ( (float)2*TIM_1_8_PERIOD_CLOCKS*(TIM_1_8_RCR+1) / (float)TIM_1_8_CLOCK_HZ )
-static const float current_meas_period = CURRENT_MEAS_PERIOD;
+extern float current_meas_period;
 
 // Frequency in [Hz]
-#define CURRENT_MEAS_HZ ( (float)(TIM_1_8_CLOCK_HZ) / (float)(2*TIM_1_8_PERIOD_CLOCKS*(TIM_1_8_RCR+1)) )
-static const int current_meas_hz = CURRENT_MEAS_HZ;
+extern int current_meas_hz;
 
 #if HW_VERSION_VOLTAGE >= 48
 #define VBUS_S_DIVIDER_RATIO 19.0f
@@ -137,7 +164,9 @@ static inline void board_clear_config() { }
 static inline bool board_apply_config() { return true; }
 
 void system_init();
+bool apply_pwm_timing(uint32_t pwm_frequency, uint32_t control_loop_decimation);
 bool board_init();
+bool init_sync();
 void start_timers();
 
 #endif // __BOARD_CONFIG_H
@@ -78,6 +78,9 @@
 /* USER CODE BEGIN EXPORTED_DEFINES */
 /* Define size for the receive and transmit buffer over CDC */
 /* It's up to user to redefine and/or remove those define */
+/* These are the packet buffers of the endpoint streams. ODrive v3 (STM32F405)
+ * only has a full speed PHY. A board with a high speed PHY sets them to 512
+ * (CDC_DATA_HS_MAX_PACKET_SIZE) together with FIBRE_LEGACY_MAX_PACKET_SIZE. */
 #define USB_RX_DATA_SIZE  64
 #define USB_TX_DATA_SIZE  64
 #define APP_RX_DATA_SIZE  USB_RX_DATA_SIZE
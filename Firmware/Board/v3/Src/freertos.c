@@ -77,7 +77,7 @@
 /* USER CODE BEGIN Variables */
 /* USER CODE END Variables */
 osThreadId defaultTaskHandle;
-const uint32_t stack_size_default_task = 2048; // Bytes
+extern const uint32_t stack_size_default_task; // defined in main.cpp
 
 /* Private function prototypes -----------------------------------------------*/
 /* USER CODE BEGIN FunctionPrototypes */
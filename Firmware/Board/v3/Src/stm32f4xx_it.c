@@ -39,6 +39,7 @@
 
 /* USER CODE BEGIN 0 */
 #include <Drivers/STM32/stm32_system.h>
+#include <communication/interface_uart.h>
 /* USER CODE END 0 */
 
 /* External variables --------------------------------------------------------*/
@@ -220,9 +221,11 @@ void DMA1_Stream0_IRQHandler(void)
 {
   /* USER CODE BEGIN DMA1_Stream0_IRQn 0 */
   COUNT_IRQ(DMA1_Stream0_IRQn);
+  TRACE_IRQ_ENTER(DMA1_Stream0_IRQn);
   /* USER CODE END DMA1_Stream0_IRQn 0 */
   HAL_DMA_IRQHandler(&hdma_spi3_rx);
   /* USER CODE BEGIN DMA1_Stream0_IRQn 1 */
+  TRACE_IRQ_EXIT(DMA1_Stream0_IRQn);
 
   /* USER CODE END DMA1_Stream0_IRQn 1 */
 }
@@ -290,9 +293,11 @@ void DMA1_Stream7_IRQHandler(void)
 {
   /* USER CODE BEGIN DMA1_Stream7_IRQn 0 */
   COUNT_IRQ(DMA1_Stream7_IRQn);
+  TRACE_IRQ_ENTER(DMA1_Stream7_IRQn);
   /* USER CODE END DMA1_Stream7_IRQn 0 */
   HAL_DMA_IRQHandler(&hdma_spi3_tx);
   /* USER CODE BEGIN DMA1_Stream7_IRQn 1 */
+  TRACE_IRQ_EXIT(DMA1_Stream7_IRQn);
 
   /* USER CODE END DMA1_Stream7_IRQn 1 */
 }
@@ -304,9 +309,11 @@ void CAN1_TX_IRQHandler(void)
 {
   /* USER CODE BEGIN CAN1_TX_IRQn 0 */
   COUNT_IRQ(CAN1_TX_IRQn);
+  TRACE_IRQ_ENTER(CAN1_TX_IRQn);
   /* USER CODE END CAN1_TX_IRQn 0 */
   HAL_CAN_IRQHandler(&hcan1);
   /* USER CODE BEGIN CAN1_TX_IRQn 1 */
+  TRACE_IRQ_EXIT(CAN1_TX_IRQn);
 
   /* USER CODE END CAN1_TX_IRQn 1 */
 }
@@ -318,9 +325,11 @@ void CAN1_RX0_IRQHandler(void)
 {
   /* USER CODE BEGIN CAN1_RX0_IRQn 0 */
   COUNT_IRQ(CAN1_RX0_IRQn);
+  TRACE_IRQ_ENTER(CAN1_RX0_IRQn);
   /* USER CODE END CAN1_RX0_IRQn 0 */
   HAL_CAN_IRQHandler(&hcan1);
   /* USER CODE BEGIN CAN1_RX0_IRQn 1 */
+  TRACE_IRQ_EXIT(CAN1_RX0_IRQn);
 
   /* USER CODE END CAN1_RX0_IRQn 1 */
 }
@@ -332,9 +341,11 @@ void CAN1_RX1_IRQHandler(void)
 {
   /* USER CODE BEGIN CAN1_RX1_IRQn 0 */
   COUNT_IRQ(CAN1_RX1_IRQn);
+  TRACE_IRQ_ENTER(CAN1_RX1_IRQn);
   /* USER CODE END CAN1_RX1_IRQn 0 */
   HAL_CAN_IRQHandler(&hcan1);
   /* USER CODE BEGIN CAN1_RX1_IRQn 1 */
+  TRACE_IRQ_EXIT(CAN1_RX1_IRQn);
 
   /* USER CODE END CAN1_RX1_IRQn 1 */
 }
@@ -346,9 +357,11 @@ void CAN1_SCE_IRQHandler(void)
 {
   /* USER CODE BEGIN CAN1_SCE_IRQn 0 */
   COUNT_IRQ(CAN1_SCE_IRQn);
+  TRACE_IRQ_ENTER(CAN1_SCE_IRQn);
   /* USER CODE END CAN1_SCE_IRQn 0 */
   HAL_CAN_IRQHandler(&hcan1);
   /* USER CODE BEGIN CAN1_SCE_IRQn 1 */
+  TRACE_IRQ_EXIT(CAN1_SCE_IRQn);
 
   /* USER CODE END CAN1_SCE_IRQn 1 */
 }
@@ -359,7 +372,7 @@ void CAN1_SCE_IRQHandler(void)
 void USART2_IRQHandler(void)
 {
   /* USER CODE BEGIN USART2_IRQn 0 */
-
+  uart_irq_handler(&huart2);
   /* USER CODE END USART2_IRQn 0 */
   HAL_UART_IRQHandler(&huart2);
   /* USER CODE BEGIN USART2_IRQn 1 */
@@ -389,9 +402,11 @@ void SPI3_IRQHandler(void)
 {
   /* USER CODE BEGIN SPI3_IRQn 0 */
   COUNT_IRQ(SPI3_IRQn);
+  TRACE_IRQ_ENTER(SPI3_IRQn);
   /* USER CODE END SPI3_IRQn 0 */
   HAL_SPI_IRQHandler(&hspi3);
   /* USER CODE BEGIN SPI3_IRQn 1 */
+  TRACE_IRQ_EXIT(SPI3_IRQn);
 
   /* USER CODE END SPI3_IRQn 1 */
 }
@@ -403,6 +418,7 @@ void UART4_IRQHandler(void)
 {
   /* USER CODE BEGIN UART4_IRQn 0 */
   COUNT_IRQ(UART4_IRQn);
+  uart_irq_handler(&huart4);
   /* USER CODE END UART4_IRQn 0 */
   HAL_UART_IRQHandler(&huart4);
   /* USER CODE BEGIN UART4_IRQn 1 */
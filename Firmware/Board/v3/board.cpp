@@ -15,9 +15,17 @@
 #include <usart.h>
 #include <freertos_vars.h>
 
+#include <algorithm>
+#include <cmath>
+
 // this should technically be in task_timer.cpp but let's not make a one-line file
 bool TaskTimer::enabled = false;
 
+uint32_t tim_1_8_period_clocks = TIM_1_8_PERIOD_CLOCKS;
+uint32_t tim_1_8_rcr = TIM_1_8_RCR;
+float current_meas_period = (float)(2 * TIM_1_8_PERIOD_CLOCKS * (TIM_1_8_RCR + 1)) / (float)TIM_1_8_CLOCK_HZ;
+int current_meas_hz = TIM_1_8_CLOCK_HZ / (2 * TIM_1_8_PERIOD_CLOCKS * (TIM_1_8_RCR + 1));
+
 extern "C" void SystemClock_Config(void); // defined in main.c generated by CubeMX
 
 #define ControlLoop_IRQHandler OTG_HS_IRQHandler
@@ -50,6 +58,11 @@ Drv8301 m1_gate_driver{
     {nFAULT_GPIO_Port, nFAULT_Pin} // nFAULT pin (shared between both motors)
 };
 
+static void nfault_cb(void*) {
+    m0_gate_driver.nfault_cb();
+    m1_gate_driver.nfault_cb();
+}
+
 const float fet_thermistor_poly_coeffs[] =
     {363.93910201f, -462.15369634f, 307.55129571f, -27.72569531f};
 const size_t fet_thermistor_num_coeffs = sizeof(fet_thermistor_poly_coeffs)/sizeof(fet_thermistor_poly_coeffs[1]);
@@ -97,6 +110,7 @@ Encoder encoders[AXIS_COUNT] = {
     {
         &htim3, // timer
         {M0_ENC_Z_GPIO_Port, M0_ENC_Z_Pin}, // index_gpio
+        TIM_CHANNEL_4, GPIO_AF2_TIM3, // index_capture_channel, index_capture_af (PC9 = TIM3_CH4)
         {M0_ENC_A_GPIO_Port, M0_ENC_A_Pin}, // hallA_gpio
         {M0_ENC_B_GPIO_Port, M0_ENC_B_Pin}, // hallB_gpio
         {M0_ENC_Z_GPIO_Port, M0_ENC_Z_Pin}, // hallC_gpio
@@ -105,6 +119,7 @@ Encoder encoders[AXIS_COUNT] = {
     {
         &htim4, // timer
         {M1_ENC_Z_GPIO_Port, M1_ENC_Z_Pin}, // index_gpio
+        0, 0, // index_capture_channel, index_capture_af (PC15 has no timer function)
         {M1_ENC_A_GPIO_Port, M1_ENC_A_Pin}, // hallA_gpio
         {M1_ENC_B_GPIO_Port, M1_ENC_B_Pin}, // hallB_gpio
         {M1_ENC_Z_GPIO_Port, M1_ENC_Z_Pin}, // hallC_gpio
@@ -226,20 +241,20 @@ Stm32Gpio gpios[GPIO_COUNT] = {
 #error "unknown GPIOs"
 #endif
 
-std::array<GpioFunction, 3> alternate_functions[GPIO_COUNT] = {
+std::array<GpioFunction, 4> alternate_functions[GPIO_COUNT] = {
     /* GPIO0 (inexistent): */ {{}},
 
 #if HW_VERSION_MINOR >= 3
-    /* GPIO1: */ {{{ODrive::GPIO_MODE_UART_A, GPIO_AF8_UART4}, {ODrive::GPIO_MODE_PWM, GPIO_AF2_TIM5}}},
-    /* GPIO2: */ {{{ODrive::GPIO_MODE_UART_A, GPIO_AF8_UART4}, {ODrive::GPIO_MODE_PWM, GPIO_AF2_TIM5}}},
-    /* GPIO3: */ {{{ODrive::GPIO_MODE_UART_B, GPIO_AF7_USART2}, {ODrive::GPIO_MODE_PWM, GPIO_AF2_TIM5}}},
+    /* GPIO1: */ {{{ODrive::GPIO_MODE_UART_A, GPIO_AF8_UART4}, {ODrive::GPIO_MODE_PWM, GPIO_AF2_TIM5}, {ODrive::GPIO_MODE_STEP_COUNTER, GPIO_AF2_TIM5}, {ODrive::GPIO_MODE_SYNC, GPIO_AF2_TIM5}}},
+    /* GPIO2: */ {{{ODrive::GPIO_MODE_UART_A, GPIO_AF8_UART4}, {ODrive::GPIO_MODE_PWM, GPIO_AF2_TIM5}, {ODrive::GPIO_MODE_SYNC, GPIO_AF2_TIM5}}},
+    /* GPIO3: */ {{{ODrive::GPIO_MODE_UART_B, GPIO_AF7_USART2}, {ODrive::GPIO_MODE_PWM, GPIO_AF2_TIM5}, {ODrive::GPIO_MODE_STEP_COUNTER, GPIO_AF3_TIM9}, {ODrive::GPIO_MODE_SYNC, GPIO_AF2_TIM5}}},
 #else
     /* GPIO1: */ {{}},
     /* GPIO2: */ {{}},
     /* GPIO3: */ {{}},
 #endif
 
-    /* GPIO4: */ {{{ODrive::GPIO_MODE_UART_B, GPIO_AF7_USART2}, {ODrive::GPIO_MODE_PWM, GPIO_AF2_TIM5}}},
+    /* GPIO4: */ {{{ODrive::GPIO_MODE_UART_B, GPIO_AF7_USART2}, {ODrive::GPIO_MODE_PWM, GPIO_AF2_TIM5}, {ODrive::GPIO_MODE_SYNC, GPIO_AF2_TIM5}}},
     /* GPIO5: */ {{}},
     /* GPIO6: */ {{}},
     /* GPIO7: */ {{}},
@@ -254,6 +269,15 @@ std::array<GpioFunction, 3> alternate_functions[GPIO_COUNT] = {
     /* CAN_D: */ {{{ODrive::GPIO_MODE_CAN_A, GPIO_AF9_CAN1}, {ODrive::GPIO_MODE_I2C_A, GPIO_AF4_I2C1}}},
 };
 
+TIM_TypeDef* step_counter_timers[GPIO_COUNT] = {
+#if HW_VERSION_MINOR >= 3
+    nullptr, // GPIO0 (inexistent)
+    TIM5, // GPIO1 (shared with PWM input)
+    nullptr, // GPIO2
+    TIM9, // GPIO3
+#endif
+};
+
 #if HW_VERSION_MINOR <= 2
 PwmInput pwm0_input{&htim5, {0, 0, 0, 4}}; // 0 means not in use
 #else
@@ -289,7 +313,72 @@ void system_init() {
     }
 }
 
+/**
+ * @brief Sets the PWM frequency and the number of PWM periods per control loop
+ * iteration.
+ *
+ * This must be called before any component derives its gains from
+ * current_meas_period and before board_init(). Changes therefore only take
+ * effect after a reboot.
+ *
+ * @param pwm_frequency: PWM frequency in Hz.
+ * @param control_loop_decimation: Must be odd so that the timer update events
+ *        keep alternating between the top and bottom of the PWM triangle.
+ * @returns false if the combination is out of range. The previous timing
+ *          stays in effect then.
+ */
+bool apply_pwm_timing(uint32_t pwm_frequency, uint32_t control_loop_decimation) {
+    if (!pwm_frequency || !(control_loop_decimation & 1) || (control_loop_decimation > 256)) {
+        return false;
+    }
+
+    uint32_t period_clocks = TIM_1_8_CLOCK_HZ / (2 * pwm_frequency);
+
+    // The ADC trigger offset (TIM1_INIT_COUNT) needs some room and the timer
+    // is only 16 bits wide.
+    if (period_clocks < 1024 || period_clocks > 0xffff) {
+        return false;
+    }
+
+    // TIM13 times the control loop on the APB1 clock and is only 16 bits
+    // wide, which bounds the loop period from above. The loop rate is bounded
+    // by the time one iteration of both axes takes.
+    uint64_t control_period_ticks = 2ULL * period_clocks * control_loop_decimation;
+    uint64_t tim13_period = control_period_ticks * TIM_APB1_CLOCK_HZ / TIM_1_8_CLOCK_HZ;
+    uint64_t control_loop_hz = TIM_1_8_CLOCK_HZ / control_period_ticks;
+    if (tim13_period > 0x10000 || control_loop_hz > MAX_CONTROL_LOOP_HZ) {
+        return false;
+    }
+
+    tim_1_8_period_clocks = period_clocks;
+    tim_1_8_rcr = control_loop_decimation - 1;
+    current_meas_period = (float)CONTROL_TIMER_PERIOD_TICKS / (float)TIM_1_8_CLOCK_HZ;
+    current_meas_hz = TIM_1_8_CLOCK_HZ / CONTROL_TIMER_PERIOD_TICKS;
+    return true;
+}
+
+// Overrides the compile-time defaults that CubeMX put into the timer init code.
+static void apply_pwm_timing_to_timers() {
+    for (TIM_HandleTypeDef* htim : {&htim1, &htim8}) {
+        htim->Init.Period = tim_1_8_period_clocks;
+        htim->Init.RepetitionCounter = tim_1_8_rcr;
+        htim->Instance->ARR = tim_1_8_period_clocks;
+        htim->Instance->RCR = tim_1_8_rcr;
+        htim->Instance->EGR = TIM_EGR_UG; // load the shadow registers
+    }
+
+    htim13.Init.Period = CONTROL_TIMER_PERIOD_TICKS * ((float)TIM_APB1_CLOCK_HZ / (float)TIM_1_8_CLOCK_HZ) - 1;
+    htim13.Instance->ARR = htim13.Init.Period;
+    htim13.Instance->EGR = TIM_EGR_UG;
+
+    __HAL_TIM_CLEAR_IT(&htim1, TIM_IT_UPDATE);
+    __HAL_TIM_CLEAR_IT(&htim8, TIM_IT_UPDATE);
+    __HAL_TIM_CLEAR_IT(&htim13, TIM_IT_UPDATE);
+}
+
 bool board_init() {
+    trace_init();
+
     // Initialize all configured peripherals
     MX_GPIO_Init();
     MX_DMA_Init();
@@ -304,6 +393,8 @@ bool board_init() {
     MX_TIM2_Init();
     MX_TIM5_Init();
     MX_TIM13_Init();
+    __HAL_RCC_TIM9_CLK_ENABLE(); // step counter, configured on demand by the axis
+    apply_pwm_timing_to_timers();
 
     // External interrupt lines are individually enabled in stm32_gpio.cpp
     HAL_NVIC_SetPriority(EXTI0_IRQn, 1, 0);
@@ -321,9 +412,32 @@ bool board_init() {
     HAL_NVIC_SetPriority(EXTI15_10_IRQn, 1, 0);
     HAL_NVIC_EnableIRQ(EXTI15_10_IRQn);
 
+    // Latch gate driver faults in the EXTI interrupt rather than polling
+    // nFAULT in the control loop. If a digital GPIO needs the same EXTI line
+    // (e.g. for step input), the gate drivers keep polling the pin.
+    Stm32Gpio nfault_gpio = {nFAULT_GPIO_Port, nFAULT_Pin};
+    bool nfault_line_free = true;
+    for (size_t i = 0; i < GPIO_COUNT; ++i) {
+        ODriveIntf::GpioMode mode = odrv.config_.gpio_modes[i];
+        if (get_gpio(i) && get_gpio(i).get_pin_number() == nfault_gpio.get_pin_number()
+                && (mode == ODriveIntf::GPIO_MODE_DIGITAL || mode == ODriveIntf::GPIO_MODE_DIGITAL_PULL_UP
+                 || mode == ODriveIntf::GPIO_MODE_DIGITAL_PULL_DOWN)) {
+            nfault_line_free = false;
+        }
+    }
+    if (nfault_line_free && nfault_gpio.subscribe(false, true, nfault_cb, nullptr)) {
+        m0_gate_driver.set_nfault_irq_enabled(true);
+        m1_gate_driver.set_nfault_irq_enabled(true);
+    }
+
     HAL_NVIC_SetPriority(ControlLoop_IRQn, 5, 0);
     HAL_NVIC_EnableIRQ(ControlLoop_IRQn);
 
+    // Must be the same priority as the control loop so that the second stage
+    // of the control loop never preempts the first stage.
+    HAL_NVIC_SetPriority(ADC_IRQn, 5, 0);
+    HAL_NVIC_EnableIRQ(ADC_IRQn);
+
     HAL_NVIC_SetPriority(TIM8_UP_TIM13_IRQn, 0, 0);
     HAL_NVIC_EnableIRQ(TIM8_UP_TIM13_IRQn);
 
@@ -351,6 +465,10 @@ bool board_init() {
         MX_I2C1_Init(i2c_stats_.addr);
     }
 
+    if (!init_sync()) {
+        odrv.misconfigured_ = true;
+    }
+
     if (odrv.config_.enable_can_a) {
         // The CAN initialization will (and must) init its own GPIOs before the
         // GPIO modes are initialized. Therefore we ensure that the later GPIO
@@ -372,7 +490,10 @@ bool board_init() {
     drv_enable_gpio.write(false);
     delay_us(40); // mimumum pull-down time for full reset: 20us
     drv_enable_gpio.write(true);
-    delay_us(20000); // mimumum pull-down time for full reset: 20us
+    // Their SPI interfaces come up while the rest of the startup runs,
+    // Drv8301::init() waits for whatever is left of t_spi_ready.
+    m0_gate_driver.notify_reset();
+    m1_gate_driver.notify_reset();
 
     return true;
 }
@@ -396,6 +517,10 @@ void start_timers() {
             {TIM1_INIT_COUNT, 0, TIM1_INIT_COUNT / 2 /* TIM13 is on a clock that's only have as fast as TIM1 */}
         );
 
+        // Used by the bus ripple minimization (TIM1 = M0, TIM8 = M1)
+        motors[0].pwm_state_.phase = (float)TIM1_INIT_COUNT / (float)(2 * tim_1_8_period_clocks);
+        motors[1].pwm_state_.phase = 0.0f;
+
         hadc1.Instance->CR2 |= (ADC_EXTERNALTRIGINJECCONVEDGE_RISING);
         hadc2.Instance->CR2 |= (ADC_EXTERNALTRIGCONVEDGE_RISING | ADC_EXTERNALTRIGINJECCONVEDGE_RISING);
         hadc3.Instance->CR2 |= (ADC_EXTERNALTRIGCONVEDGE_RISING | ADC_EXTERNALTRIGINJECCONVEDGE_RISING);
@@ -415,38 +540,94 @@ void start_timers() {
     }
 }
 
-static bool fetch_and_reset_adcs(
-        std::optional<Iph_ABC_t>* current0,
-        std::optional<Iph_ABC_t>* current1) {
+AdcSample_t adc_sample_ring[ADC_SAMPLE_RING_SIZE];
+volatile uint32_t adc_sample_ring_head = 0;
+
+/**
+ * @brief Per-axis description of the current sensing and PWM timing.
+ * The control loop stages iterate over this table so that they don't need to
+ * know how many axes the board has.
+ *
+ * The table and the gate drivers are known at compile time. Since the loops
+ * over the axes are unrolled, the stages access the registers and the gate
+ * driver state directly instead of going through the Motor objects.
+ */
+struct AxisPipeline_t {
+    volatile uint32_t* adc_phB; // data register holding the phase B current
+    volatile uint32_t* adc_phC; // data register holding the phase C current
+    TIM_TypeDef* timer; // PWM timer, same as motors[i].timer_
+    Drv8301* gate_driver; // same as motors[i].gate_driver_
+    bool shifted_by_init_count; // true if the axis' timer leads the control timer by TIM1_INIT_COUNT
+};
+
+static const AxisPipeline_t axis_pipelines[AXIS_COUNT] = {
+    {&ADC2->JDR1, &ADC3->JDR1, TIM1, &m0_gate_driver, true}, // M0
+    {&ADC2->DR, &ADC3->DR, TIM8, &m1_gate_driver, false}, // M1
+};
+
+// Returns the offset between the control loop timestamp and the sampling
+// events of the specified axis.
+static inline uint32_t axis_timestamp_offset(size_t axis) {
+    return axis_pipelines[axis].shifted_by_init_count ? TIM1_INIT_COUNT : 0;
+}
+
+static void disarm_all_motors(Motor::Error error) {
+    for (size_t i = 0; i < AXIS_COUNT; ++i) {
+        motors[i].disarm_with_error(error);
+    }
+}
+
+/**
+ * @brief Snapshots all ADC data registers that belong to one current
+ * measurement event into the next slot of adc_sample_ring and clears the ADC
+ * status flags. This is kept to the bare register accesses so that the time
+ * spent between ISR entry and releasing the ADCs is minimal.
+ *
+ * The injected data registers (M0, vbus) are not DMA-capable on STM32F4 and
+ * the DMA stream of ADC1 is taken by the general purpose ADC, hence the
+ * capture is done by the CPU.
+ */
+static AdcSample_t* capture_adcs(uint32_t timestamp) {
     bool all_adcs_done = (ADC1->SR & ADC_SR_JEOC) == ADC_SR_JEOC
         && (ADC2->SR & (ADC_SR_EOC | ADC_SR_JEOC)) == (ADC_SR_EOC | ADC_SR_JEOC)
         && (ADC3->SR & (ADC_SR_EOC | ADC_SR_JEOC)) == (ADC_SR_EOC | ADC_SR_JEOC);
     if (!all_adcs_done) {
-        return false;
+        return nullptr;
     }
 
-    vbus_sense_adc_cb(ADC1->JDR1);
-
-    if (m0_gate_driver.is_ready()) {
-        std::optional<float> phB = motors[0].phase_current_from_adcval(ADC2->JDR1);
-        std::optional<float> phC = motors[0].phase_current_from_adcval(ADC3->JDR1);
-        if (phB.has_value() && phC.has_value()) {
-            *current0 = {-*phB - *phC, *phB, *phC};
-        }
+    uint32_t head = adc_sample_ring_head;
+    AdcSample_t* sample = &adc_sample_ring[head & (ADC_SAMPLE_RING_SIZE - 1)];
+    sample->timestamp = timestamp;
+    sample->vbus = ADC1->JDR1;
+    for (size_t i = 0; i < AXIS_COUNT; ++i) {
+        sample->phB[i] = *axis_pipelines[i].adc_phB;
+        sample->phC[i] = *axis_pipelines[i].adc_phC;
     }
 
-    if (m1_gate_driver.is_ready()) {
-        std::optional<float> phB = motors[1].phase_current_from_adcval(ADC2->DR);
-        std::optional<float> phC = motors[1].phase_current_from_adcval(ADC3->DR);
-        if (phB.has_value() && phC.has_value()) {
-            *current1 = {-*phB - *phC, *phB, *phC};
-        }
-    }
-    
     ADC1->SR = ~(ADC_SR_JEOC);
     ADC2->SR = ~(ADC_SR_EOC | ADC_SR_JEOC | ADC_SR_OVR);
     ADC3->SR = ~(ADC_SR_EOC | ADC_SR_JEOC | ADC_SR_OVR);
 
+    adc_sample_ring_head = head + 1;
+    return sample;
+}
+
+static bool fetch_and_reset_adcs(
+        uint32_t timestamp,
+        std::optional<Iph_ABC_t> (&currents)[AXIS_COUNT]) {
+    const AdcSample_t* sample = capture_adcs(timestamp);
+    if (!sample) {
+        return false;
+    }
+
+    vbus_sense_adc_cb(sample->vbus);
+
+    for (size_t i = 0; i < AXIS_COUNT; ++i) {
+        if (axis_pipelines[i].gate_driver->is_ready()) {
+            currents[i] = motors[i].phase_currents_from_adcvals(sample->phB[i], sample->phC[i]);
+        }
+    }
+
     return true;
 }
 
@@ -471,37 +652,228 @@ void TIM5_IRQHandler(void) {
     pwm0_input.on_capture();
 }
 
+/*
+ * Control loop sync between boards.
+ *
+ * The pulse runs on the TIM5 channel of the GPIO in GPIO_MODE_SYNC (GPIO1...4
+ * = TIM5_CH1...4). TIM5 counts freely at the APB1 timer clock, which is half
+ * the clock of TIM1 and TIM8.
+ *  - Master: The channel toggles the pin in hardware at the TIM8 update event
+ *    that starts every sync_divider-th control loop period.
+ *  - Slave: The channel captures both edges. The phase error is the time from
+ *    the edge to the same update event of the local TIM8. A PI controller
+ *    trims the PWM periods of the next control loop period to correct it.
+ * Both sides get the TIM5 count at the update event from TIM8_CNT and TIM5_CNT
+ * read back to back at the entry of the update interrupt, so the skew between
+ * the two reads is the same on both sides and cancels out.
+ */
+
+#define TIM_1_8_TICKS_PER_TIM5_TICK (TIM_1_8_CLOCK_HZ / TIM_APB1_CLOCK_HZ)
+static_assert(TIM_1_8_TICKS_PER_TIM5_TICK * TIM_APB1_CLOCK_HZ == TIM_1_8_CLOCK_HZ, "TIM5 must run at an integer fraction of the TIM1/TIM8 clock");
+
+static constexpr int32_t kSyncMaxTrim = 32; // [TIM1/TIM8 ticks] per PWM period
+static constexpr float kSyncKp = 0.5f; // fraction of the phase error corrected per edge
+static constexpr float kSyncKi = 0.05f; // learns the clock frequency offset between the boards
+static constexpr float kSyncLockThreshold = 1e-6f; // [s]
+
+static volatile uint32_t* sync_ccr_ = nullptr; // capture/compare register of the channel, nullptr if sync is off
+static uint32_t sync_cc_flag_ = 0; // TIM_SR_CCxIF of the channel
+static uint32_t sync_periods_ = 0; // control loop periods since the last edge
+static float sync_integrator_ = 0.0f; // [TIM5 ticks] per edge
+static bool sync_trim_pending_ = false; // TIM1/TIM8 period to be restored at the next update event
+static bool tim13_trim_pending_ = false; // TIM13 period to be restored at the next control loop period
+
+/**
+ * @brief Sets up the TIM5 channel of the sync GPIO according to
+ * config.sync_mode. Must run before start_timers().
+ * @returns false if the sync is enabled but can't run with this configuration.
+ */
+bool init_sync() {
+    if (odrv.config_.sync_mode == ODriveIntf::SYNC_MODE_DISABLED) {
+        return true;
+    }
+
+    size_t gpio = 1;
+    while (gpio <= 4 && odrv.config_.gpio_modes[gpio] != ODriveIntf::GPIO_MODE_SYNC) {
+        gpio++;
+    }
+    if (gpio > 4 || !odrv.config_.sync_divider) {
+        return false;
+    }
+
+    // The channel must not be used by the PWM input, and the step counter on
+    // GPIO1 would stop TIM5 from counting freely.
+    if (fibre::is_endpoint_ref_valid(odrv.config_.pwm_mappings[gpio - 1].endpoint)
+            || odrv.config_.gpio_modes[1] == ODriveIntf::GPIO_MODE_STEP_COUNTER) {
+        return false;
+    }
+
+    static const uint32_t channels[] = {TIM_CHANNEL_1, TIM_CHANNEL_2, TIM_CHANNEL_3, TIM_CHANNEL_4};
+    uint32_t channel = channels[gpio - 1];
+
+    if (odrv.config_.sync_mode == ODriveIntf::SYNC_MODE_MASTER) {
+        TIM_OC_InitTypeDef sConfigOC = {};
+        sConfigOC.OCMode = TIM_OCMODE_TOGGLE;
+        sConfigOC.Pulse = 0;
+        sConfigOC.OCPolarity = TIM_OCPOLARITY_HIGH;
+        sConfigOC.OCFastMode = TIM_OCFAST_DISABLE;
+        if (HAL_TIM_OC_ConfigChannel(&htim5, &sConfigOC, channel) != HAL_OK) {
+            return false;
+        }
+    } else {
+        TIM_IC_InitTypeDef sConfigIC = {};
+        sConfigIC.ICPolarity = TIM_INPUTCHANNELPOLARITY_BOTHEDGE;
+        sConfigIC.ICSelection = TIM_ICSELECTION_DIRECTTI;
+        sConfigIC.ICPrescaler = TIM_ICPSC_DIV1;
+        sConfigIC.ICFilter = 2; // N=4 at f_CK_INT, a constant delay for all slaves
+        if (HAL_TIM_IC_ConfigChannel(&htim5, &sConfigIC, channel) != HAL_OK) {
+            return false;
+        }
+    }
+
+    sync_ccr_ = &TIM5->CCR1 + (gpio - 1);
+    sync_cc_flag_ = TIM_SR_CC1IF << (gpio - 1);
+    TIM_CCxChannelCmd(TIM5, channel, TIM_CCx_ENABLE);
+    TIM5->CR1 |= TIM_CR1_CEN;
+    return true;
+}
+
+/**
+ * @brief Runs at the start of every control loop period.
+ * @param tim5_at_update: TIM5 count at the update event that started the
+ * period.
+ */
+static void sync_update(uint32_t tim5_at_update) {
+    // The TIM13 trim is in effect until its reload, which coincides with the
+    // TIM1 update event before this one.
+    if (tim13_trim_pending_) {
+        TIM13->ARR = htim13.Init.Period;
+        tim13_trim_pending_ = false;
+    }
+
+    if (!sync_ccr_) {
+        return;
+    }
+
+    SyncStatus& status = odrv.sync_;
+    const int32_t period = CONTROL_TIMER_PERIOD_TICKS / TIM_1_8_TICKS_PER_TIM5_TICK;
+    sync_periods_++;
+
+    if (odrv.config_.sync_mode == ODriveIntf::SYNC_MODE_MASTER) {
+        if (sync_periods_ >= odrv.config_.sync_divider) {
+            *sync_ccr_ = tim5_at_update + period; // toggles at the start of the next period
+            sync_periods_ = 0;
+            status.n_edges++;
+            status.locked = true;
+        }
+        return;
+    }
+
+    if (!(TIM5->SR & sync_cc_flag_)) {
+        if (sync_periods_ > 2 * odrv.config_.sync_divider) {
+            status.locked = false;
+        }
+        return;
+    }
+    uint32_t edge = *sync_ccr_; // clears CCxIF
+    TIM5->SR = ~(sync_cc_flag_ << 8); // CCxOF, edges that were overwritten don't matter
+    sync_periods_ = 0;
+    status.n_edges++;
+
+    int32_t error = (int32_t)(tim5_at_update - edge) % period;
+    if (error > period / 2) {
+        error -= period;
+    } else if (error < -period / 2) {
+        error += period;
+    }
+
+    // A trim of k ticks raises the top of each of the (rcr + 2) / 2 triangles
+    // until the next update event by k, which delays all events of TIM1 and
+    // TIM8 by 2 * k ticks per triangle. TIM13 is delayed by the same time.
+    const int32_t n_tops = (tim_1_8_rcr + 2) / 2;
+    const float tim5_ticks_per_trim = (float)(2 * n_tops) / (float)TIM_1_8_TICKS_PER_TIM5_TICK;
+    float correction = kSyncKp * (float)error + sync_integrator_; // [TIM5 ticks] to advance
+    int32_t trim = (int32_t)lroundf(-correction / tim5_ticks_per_trim);
+    if (trim > kSyncMaxTrim || trim < -kSyncMaxTrim) {
+        trim = std::clamp(trim, -kSyncMaxTrim, kSyncMaxTrim);
+    } else {
+        sync_integrator_ += kSyncKi * (float)error;
+    }
+
+    if (trim) {
+        TIM1->ARR = (int32_t)tim_1_8_period_clocks + trim;
+        TIM8->ARR = (int32_t)tim_1_8_period_clocks + trim;
+        TIM13->ARR = (int32_t)htim13.Init.Period + trim * 2 * n_tops / (int32_t)TIM_1_8_TICKS_PER_TIM5_TICK;
+        sync_trim_pending_ = true;
+        tim13_trim_pending_ = true;
+    }
+
+    float phase_error = (float)error / (float)TIM_APB1_CLOCK_HZ;
+    if (status.locked) {
+        status.max_phase_error = std::max(status.max_phase_error, std::abs(phase_error));
+    }
+    status.phase_error = phase_error;
+    status.locked = std::abs(phase_error) < kSyncLockThreshold;
+}
+
 volatile uint32_t timestamp_ = 0;
 volatile bool counting_down_ = false;
 
+static void tim8_update_cb(uint32_t tim8_cnt, uint32_t tim5_cnt);
+static uint32_t control_loop_trigger_cycles_ = 0;
+
 void TIM8_UP_TIM13_IRQHandler(void) {
+    // The counter runs at HCLK. It was at zero (counting up) or at the reload
+    // value (counting down) at the update event.
+    uint32_t cnt = TIM8->CNT;
+    uint32_t tim5_cnt = TIM5->CNT; // see sync_update()
+    uint32_t latency = (TIM8->CR1 & TIM_CR1_DIR) ? TIM8->ARR - cnt : cnt;
+    odrv.irq_latencies_.timer_update.record(latency);
+
     COUNT_IRQ(TIM8_UP_TIM13_IRQn);
-    
+    TRACE_IRQ_ENTER(TIM8_UP_TIM13_IRQn);
+    tim8_update_cb(cnt, tim5_cnt);
+    TRACE_IRQ_EXIT(TIM8_UP_TIM13_IRQn);
+}
+
+static void tim8_update_cb(uint32_t tim8_cnt, uint32_t tim5_cnt) {
     // Entry into this function happens at 21-23 clock cycles after the timer
     // update event.
     __HAL_TIM_CLEAR_IT(&htim8, TIM_IT_UPDATE);
 
     // If the corresponding timer is counting up, we just sampled in SVM vector 0, i.e. real current
     // If we are counting down, we just sampled in SVM vector 7, with zero current
+    // Note that this board uses low-side shunts, so the down-count sample can
+    // only ever be used for DC calibration, never for current control. To run
+    // FOC at the PWM rate set config.control_loop_decimation to 1 instead.
     bool counting_down = TIM8->CR1 & TIM_CR1_DIR;
 
     bool timer_update_missed = (counting_down_ == counting_down);
     if (timer_update_missed) {
-        motors[0].disarm_with_error(Motor::ERROR_TIMER_UPDATE_MISSED);
-        motors[1].disarm_with_error(Motor::ERROR_TIMER_UPDATE_MISSED);
+        disarm_all_motors(Motor::ERROR_TIMER_UPDATE_MISSED);
         return;
     }
     counting_down_ = counting_down;
 
-    timestamp_ += TIM_1_8_PERIOD_CLOCKS * (TIM_1_8_RCR + 1);
+    timestamp_ += tim_1_8_period_clocks * (tim_1_8_rcr + 1);
 
     if (!counting_down) {
+        // Before the next top of TIM1, see sync_update()
+        sync_update(tim5_cnt - tim8_cnt / TIM_1_8_TICKS_PER_TIM5_TICK);
+
         TaskTimer::enabled = odrv.task_timers_armed_;
         // Run sampling handlers and kick off control tasks when TIM8 is
         // counting up.
-        odrv.sampling_cb();
+        odrv.sampling_cb(timestamp_);
+        control_loop_trigger_cycles_ = DWT->CYCCNT;
         NVIC->STIR = ControlLoop_IRQn;
     } else {
+        if (sync_trim_pending_) {
+            TIM1->ARR = tim_1_8_period_clocks;
+            TIM8->ARR = tim_1_8_period_clocks;
+            sync_trim_pending_ = false;
+        }
+
         // Tentatively reset all PWM outputs to 50% duty cycles. If the control
         // loop handler finishes in time then these values will be overridden
         // before they go into effect.
@@ -511,69 +883,115 @@ void TIM8_UP_TIM13_IRQHandler(void) {
         TIM8->CCR1 =
         TIM8->CCR2 =
         TIM8->CCR3 =
-            TIM_1_8_PERIOD_CLOCKS / 2;
+            tim_1_8_period_clocks / 2;
     }
 }
 
-void ControlLoop_IRQHandler(void) {
+static uint32_t control_loop_timestamp_ = 0;
+static uint32_t dc_calib_wait_start_ = 0;
+
+static void control_loop_first_stage();
+
+RAMFUNC void ControlLoop_IRQHandler(void) {
+    odrv.irq_latencies_.control_loop.record(DWT->CYCCNT - control_loop_trigger_cycles_);
+
     COUNT_IRQ(ControlLoop_IRQn);
+    TRACE_IRQ_ENTER(ControlLoop_IRQn);
+    control_loop_first_stage();
+    TRACE_IRQ_EXIT(ControlLoop_IRQn);
+}
+
+RAMFUNC static void control_loop_first_stage() {
     uint32_t timestamp = timestamp_;
 
+    // If the second stage of the previous iteration is still pending then the
+    // ADC conversion never completed.
+    if (ADC2->CR1 & ADC_CR1_EOCIE) {
+        ADC2->CR1 &= ~ADC_CR1_EOCIE;
+        disarm_all_motors(Motor::ERROR_CONTROL_DEADLINE_MISSED);
+    }
+
     // Ensure that all the ADCs are done
-    std::optional<Iph_ABC_t> current0;
-    std::optional<Iph_ABC_t> current1;
+    std::optional<Iph_ABC_t> currents[AXIS_COUNT];
 
-    if (!fetch_and_reset_adcs(&current0, &current1)) {
-        motors[0].disarm_with_error(Motor::ERROR_BAD_TIMING);
-        motors[1].disarm_with_error(Motor::ERROR_BAD_TIMING);
+    if (!fetch_and_reset_adcs(timestamp, currents)) {
+        disarm_all_motors(Motor::ERROR_BAD_TIMING);
     }
 
-    // If the motor FETs are not switching then we can't measure the current
-    // because for this we need the low side FET to conduct.
-    // So for now we guess the current to be 0 (this is not correct shortly after
-    // disarming and when the motor spins fast in idle). Passing an invalid
-    // current reading would create problems with starting FOC.
-    if (!(TIM1->BDTR & TIM_BDTR_MOE_Msk)) {
-        current0 = {0.0f, 0.0f};
-    }
-    if (!(TIM8->BDTR & TIM_BDTR_MOE_Msk)) {
-        current1 = {0.0f, 0.0f};
+    for (size_t i = 0; i < AXIS_COUNT; ++i) {
+        // If the motor FETs are not switching then we can't measure the current
+        // because for this we need the low side FET to conduct.
+        // So for now we guess the current to be 0 (this is not correct shortly after
+        // disarming and when the motor spins fast in idle). Passing an invalid
+        // current reading would create problems with starting FOC.
+        if (!(axis_pipelines[i].timer->BDTR & TIM_BDTR_MOE_Msk)) {
+            currents[i] = {0.0f, 0.0f};
+        }
+        motors[i].current_meas_cb(timestamp - axis_timestamp_offset(i), currents[i]);
     }
 
-    motors[0].current_meas_cb(timestamp - TIM1_INIT_COUNT, current0);
-    motors[1].current_meas_cb(timestamp, current1);
-
     odrv.control_loop_cb(timestamp);
 
-    // By this time the ADCs for both M0 and M1 should have fired again. But
-    // let's wait for them just to be sure.
-    MEASURE_TIME(odrv.task_times_.dc_calib_wait) {
-        while (!(ADC2->SR & ADC_SR_EOC));
-    }
+    // The second stage runs in ADC_IRQHandler as soon as the ADCs for both M0
+    // and M1 have fired again. If they already did, the interrupt is pending
+    // and tail-chains right after this handler. Either way we don't burn CPU
+    // cycles waiting for them.
+    control_loop_timestamp_ = timestamp;
+    dc_calib_wait_start_ = odrv.task_times_.dc_calib_wait.start();
+    ADC2->CR1 |= ADC_CR1_EOCIE;
+}
+
+RAMFUNC static void control_loop_second_stage() {
+    uint32_t timestamp = control_loop_timestamp_;
+    odrv.task_times_.dc_calib_wait.stop(dc_calib_wait_start_);
 
-    if (!fetch_and_reset_adcs(&current0, &current1)) {
-        motors[0].disarm_with_error(Motor::ERROR_BAD_TIMING);
-        motors[1].disarm_with_error(Motor::ERROR_BAD_TIMING);
+    const uint32_t update_period = tim_1_8_period_clocks * (tim_1_8_rcr + 1);
+    std::optional<Iph_ABC_t> currents[AXIS_COUNT];
+
+    if (!fetch_and_reset_adcs(timestamp + update_period, currents)) {
+        disarm_all_motors(Motor::ERROR_BAD_TIMING);
     }
 
-    motors[0].dc_calib_cb(timestamp + TIM_1_8_PERIOD_CLOCKS * (TIM_1_8_RCR + 1) - TIM1_INIT_COUNT, current0);
-    motors[1].dc_calib_cb(timestamp + TIM_1_8_PERIOD_CLOCKS * (TIM_1_8_RCR + 1), current1);
+    for (size_t i = 0; i < AXIS_COUNT; ++i) {
+        motors[i].dc_calib_cb(timestamp + update_period - axis_timestamp_offset(i), currents[i]);
+    }
 
-    motors[0].pwm_update_cb(timestamp + 3 * TIM_1_8_PERIOD_CLOCKS * (TIM_1_8_RCR + 1) - TIM1_INIT_COUNT);
-    motors[1].pwm_update_cb(timestamp + 3 * TIM_1_8_PERIOD_CLOCKS * (TIM_1_8_RCR + 1));
+    // The output timestamp is the midpoint of the interval during which the
+    // new timings are in effect: They are loaded at the next update event and
+    // stay active for one control period (two update events).
+    for (size_t i = 0; i < AXIS_COUNT; ++i) {
+        motors[i].pwm_update_cb(timestamp + 3 * update_period - axis_timestamp_offset(i));
+    }
 
     // If we did everything right, the TIM8 update handler should have been
-    // called exactly once between the start of this function and now.
+    // called exactly once between the start of the first stage and now.
 
-    if (timestamp_ != timestamp + TIM_1_8_PERIOD_CLOCKS * (TIM_1_8_RCR + 1)) {
-        motors[0].disarm_with_error(Motor::ERROR_CONTROL_DEADLINE_MISSED);
-        motors[1].disarm_with_error(Motor::ERROR_CONTROL_DEADLINE_MISSED);
+    if (timestamp_ != timestamp + update_period) {
+        disarm_all_motors(Motor::ERROR_CONTROL_DEADLINE_MISSED);
     }
 
     odrv.task_timers_armed_ = odrv.task_timers_armed_ && !TaskTimer::enabled;
     TaskTimer::enabled = false;
 }
 
+void ADC_IRQHandler(void) {
+    COUNT_IRQ(ADC_IRQn);
+    TRACE_IRQ_ENTER(ADC_IRQn);
+
+    if ((ADC2->CR1 & ADC_CR1_EOCIE) && (ADC2->SR & ADC_SR_EOC)) {
+        ADC2->CR1 &= ~ADC_CR1_EOCIE;
+        control_loop_second_stage();
+    }
+
+    // ADC1 is serviced by DMA (see start_general_purpose_adc()). HAL enables
+    // its overrun interrupt but we never handled it, so keep it masked.
+    if (ADC1->CR1 & ADC_CR1_OVRIE) {
+        ADC1->CR1 &= ~ADC_CR1_OVRIE;
+    }
+
+    TRACE_IRQ_EXIT(ADC_IRQn);
+}
+
 void I2C1_EV_IRQHandler(void) {
     COUNT_IRQ(I2C1_EV_IRQn);
     HAL_I2C_EV_IRQHandler(&hi2c1);
@@ -587,7 +1005,9 @@ void I2C1_ER_IRQHandler(void) {
 extern PCD_HandleTypeDef hpcd_USB_OTG_FS; // defined in usbd_conf.c
 void OTG_FS_IRQHandler(void) {
     COUNT_IRQ(OTG_FS_IRQn);
+    TRACE_IRQ_ENTER(OTG_FS_IRQn);
     HAL_PCD_IRQHandler(&hpcd_USB_OTG_FS);
+    TRACE_IRQ_EXIT(OTG_FS_IRQn);
 }
 
 }
@@ -59,7 +59,11 @@ bool Drv8301::config(float requested_gain, float* actual_gain) {
     if (!regs_equal) {
         regs_ = new_config;
         state_ = kStateUninitialized;
-        enable_gpio_.write(false);
+        // Right after a reset the chip still has its default registers, so
+        // the next init() can configure it without resetting it again.
+        if (!reset_pending_) {
+            enable_gpio_.write(false);
+        }
     }
 
     return true;
@@ -72,13 +76,29 @@ bool Drv8301::init() {
         return true;
     }
 
+    // The reset below clears the status registers, so capture the cause of
+    // the last fault first.
+    diagnose();
+    while (__atomic_load_n(&diag_state_, __ATOMIC_SEQ_CST) == kDiagRunning) {
+        osDelay(1);
+    }
+
     // Reset DRV chip. The enable pin also controls the SPI interface, not only
     // the driver stages.
-    enable_gpio_.write(false);
-    delay_us(40); // mimumum pull-down time for full reset: 20us
     state_ = kStateUninitialized; // make is_ready() ignore transient errors before registers are set up
-    enable_gpio_.write(true);
-    osDelay(20); // t_spi_ready, max = 10ms
+    if (!reset_pending_) {
+        enable_gpio_.write(false);
+        delay_us(40); // mimumum pull-down time for full reset: 20us
+        enable_gpio_.write(true);
+        notify_reset();
+    }
+    reset_pending_ = false;
+
+    // t_spi_ready, max = 10ms. After the reset in board_init() this has
+    // usually passed already.
+    while (micros() - reset_time_ < 20000) {
+        osDelay(1);
+    }
 
     // Write current configuration
     bool wrote_regs = write_reg(kRegNameControl1, regs_.control_register_1)
@@ -101,14 +121,15 @@ bool Drv8301::init() {
         return false;
     }
 
-    if (get_error() != FaultType_NoFault) {
+    if (read_fault_registers() != FaultType_NoFault) {
         return false;
     }
 
     // There could have been an nFAULT edge meanwhile. In this case we shouldn't
-    // consider the driver ready.
+    // consider the driver ready. The interrupt only sees edges, so the level
+    // is checked as well.
     CRITICAL_SECTION() {
-        if (state_ == kStateStartupChecks) {
+        if (state_ == kStateStartupChecks && nfault_gpio_.read()) {
             state_ = kStateReady;
         }
     }
@@ -116,17 +137,38 @@ bool Drv8301::init() {
     return state_ == kStateReady;
 }
 
+void Drv8301::notify_reset() {
+    reset_time_ = micros();
+    reset_pending_ = true;
+}
+
 void Drv8301::do_checks() {
-    if (state_ != kStateUninitialized && !nfault_gpio_.read()) {
-        state_ = kStateUninitialized;
+    if (!nfault_irq_enabled_ && state_ != kStateUninitialized && !nfault_gpio_.read()) {
+        nfault_cb();
     }
 }
 
-bool Drv8301::is_ready() {
-    return state_ == kStateReady;
+void Drv8301::nfault_cb() {
+    if (state_ == kStateReady) {
+        __atomic_store_n(&diag_state_, kDiagPending, __ATOMIC_SEQ_CST);
+    }
+    state_ = kStateUninitialized;
+}
+
+void Drv8301::diagnose() {
+    uint8_t expected = kDiagPending;
+    if (__atomic_compare_exchange_n(&diag_state_, &expected, kDiagRunning, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+        last_fault_ = read_fault_registers();
+        __atomic_store_n(&diag_state_, kDiagIdle, __ATOMIC_SEQ_CST);
+    }
 }
 
 Drv8301::FaultType_e Drv8301::get_error() {
+    diagnose();
+    return last_fault_;
+}
+
+Drv8301::FaultType_e Drv8301::read_fault_registers() {
     uint16_t fault1, fault2;
 
     if (!read_reg(kRegNameStatus1, &fault1) ||
@@ -57,7 +57,17 @@ public:
     bool init();
 
     /**
-     * @brief Monitors the nFAULT pin.
+     * @brief Tells the driver that the enable pin was just pulsed low, which
+     * reset the chip.
+     *
+     * The next init() then doesn't reset the chip again but only waits for
+     * the rest of t_spi_ready, so the reset can overlap with other startup
+     * work.
+     */
+    void notify_reset();
+
+    /**
+     * @brief Monitors the nFAULT pin if it is not handled by nfault_cb().
      *
      * This must be run at an interval of <8ms from the moment the init()
      * functions starts to run, otherwise it's possible that a temporary power
@@ -66,11 +76,26 @@ public:
      */
     void do_checks();
 
+    /**
+     * @brief Latches a fault. Must be called on the falling edge of nFAULT
+     * after set_nfault_irq_enabled(true).
+     */
+    void nfault_cb();
+
+    void set_nfault_irq_enabled(bool enabled) { nfault_irq_enabled_ = enabled; }
+
+    /**
+     * @brief Reads the status registers if there was a fault since the last
+     * call. Runs in a low priority thread so that the SPI bus is only used
+     * by the gate driver after a fault.
+     */
+    void diagnose();
+
     /**
      * @brief Returns true if and only if the DRV8301 chip is in an initialized
      * state and ready to do switching and current sensor opamp operation.
      */
-    bool is_ready() final;
+    bool is_ready() final { return state_ == kStateReady; }
 
     /**
      * @brief This has no effect on this driver chip because the drive stages are
@@ -78,6 +103,10 @@ public:
      */
     bool set_enabled(bool enabled) final { return true; }
 
+    /**
+     * @brief Returns the status registers as read after the most recent
+     * fault. Only accesses the SPI bus if that fault was not yet diagnosed.
+     */
     FaultType_e get_error();
 
     float get_midpoint() final {
@@ -118,6 +147,8 @@ private:
     /** @brief Writes data to a DRV8301 register. There is no check if the write succeeded. */
     bool write_reg(const RegName_e regName, const uint16_t data);
 
+    FaultType_e read_fault_registers();
+
     static const SPI_InitTypeDef spi_config_;
 
     // Configuration
@@ -134,11 +165,26 @@ private:
     // a RAM section which cannot be used by DMA.
     uint16_t tx_buf_, rx_buf_;
 
-    enum {
+    volatile enum {
         kStateUninitialized,
         kStateStartupChecks,
         kStateReady,
     } state_ = kStateUninitialized;
+
+    bool nfault_irq_enabled_ = false;
+
+    bool reset_pending_ = false; // reset but not configured yet, see notify_reset()
+    uint32_t reset_time_ = 0; // [us] last rising edge of the enable pin
+
+    // A fault in ready state is diagnosed once. Only one thread at a time
+    // may move the state from pending to running.
+    enum : uint8_t {
+        kDiagIdle,
+        kDiagPending,
+        kDiagRunning,
+    };
+    uint8_t diag_state_ = kDiagIdle;
+    FaultType_e last_fault_ = FaultType_NoFault;
 };
 
 
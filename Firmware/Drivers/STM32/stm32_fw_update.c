@@ -0,0 +1,297 @@
+/*
+* Firmware update over the native protocol
+*
+* This file receives a new firmware image while the old one keeps running and
+* installs it with a single reboot, without going through the DFU bootloader.
+*
+* The image is written to a staging area in the flash sectors after the end of
+* the running image (the first 128kB sector that it doesn't use, up to the
+* sectors of the NVM). After all bytes arrived and the CRC-32 over them
+* matches, FW_UPDATE_commit() arms a descriptor in RAM that survives a
+* software reset. On the next boot FW_UPDATE_apply_pending() checks the
+* staging area again, erases the sectors of the running image and copies the
+* new image there. This runs from RAM with interrupts disabled and ends in
+* another reset, after which the new firmware boots.
+*
+* This only works if the new image fits both into the staging area and below
+* it, see FW_UPDATE_get_max_size(). A loss of power during the copy (a few
+* seconds) leaves the board without a valid image. It can then still be
+* recovered through the ROM bootloader by setting the DFU switch.
+*
+* Like an NVM erase (see stm32_nvm.c), erasing the staging area stalls the CPU
+* for a second or more per sector and programming a word stalls flash reads
+* for a few microseconds. The caller must make sure that no motor is armed.
+*/
+
+#include "stm32_fw_update.h"
+
+#include <string.h>
+
+#if defined(STM32F405xx)
+
+#include <stm32f405xx.h>
+#include <stm32f4xx_hal.h>
+
+// refer to page 75 of the reference manual (see stm32_nvm.c). Sectors 10 and
+// 11 are used by the NVM.
+#define APP_FLASH_END 0x80C0000UL
+#define LARGE_SECTOR_FIRST 5
+#define LARGE_SECTOR_BASE 0x8020000UL
+#define LARGE_SECTOR_SIZE 0x20000UL
+#define APP_SECTOR_LAST 9
+
+#define SRAM_END (SRAM1_BASE + 0x20000UL) // SRAM1 and SRAM2
+
+#define PENDING_MAGIC 0xF1A5F1A5UL
+
+// Defined by the linker script. The image ends with the initial values of the
+// .data section (including .ramfunc).
+extern const uint8_t _sidata[];
+extern uint8_t _sdata[];
+extern uint8_t _edata[];
+
+// Survives a software reset, see FW_UPDATE_apply_pending()
+typedef struct {
+    uint32_t magic;
+    uint32_t size;
+    uint32_t crc32;
+    uint32_t check; //!< ~(magic ^ size ^ crc32)
+} pending_t;
+
+static pending_t pending_ __attribute__ ((section (".noinit")));
+
+static bool active_ = false;
+static size_t size_;
+static uint32_t crc32_;
+static size_t received_;
+
+static const uint32_t FLASH_ERR_FLAGS =
+        FLASH_FLAG_EOP |
+        FLASH_FLAG_OPERR |
+        FLASH_FLAG_WRPERR |
+        FLASH_FLAG_PGAERR |
+        FLASH_FLAG_PGPERR |
+        FLASH_FLAG_PGSERR |
+        0;
+
+// @brief Returns the sector that contains the given address
+static uint32_t sector_of(uintptr_t addr) {
+    if (addr < 0x8010000UL)
+        return (addr - FLASH_BASE) / 0x4000UL;
+    if (addr < LARGE_SECTOR_BASE)
+        return 4;
+    return LARGE_SECTOR_FIRST + (addr - LARGE_SECTOR_BASE) / LARGE_SECTOR_SIZE;
+}
+
+// @brief Returns the start of the staging area: the first 128kB sector that
+// doesn't hold any part of the running image.
+static uintptr_t get_staging_base(void) {
+    uintptr_t image_end = (uintptr_t)_sidata + (size_t)(_edata - _sdata);
+    if (image_end <= LARGE_SECTOR_BASE)
+        return LARGE_SECTOR_BASE;
+    size_t n = (image_end - LARGE_SECTOR_BASE + LARGE_SECTOR_SIZE - 1) / LARGE_SECTOR_SIZE;
+    return LARGE_SECTOR_BASE + n * LARGE_SECTOR_SIZE;
+}
+
+// @brief CRC-32 as used by zlib (reflected 0x04C11DB7, init and final XOR
+// 0xffffffff). The CRC unit of the STM32 computes a different variant.
+static uint32_t calc_crc32(const volatile uint8_t *data, size_t length) {
+    uint32_t crc = 0xffffffffUL;
+    for (size_t i = 0; i < length; ++i) {
+        crc ^= data[i];
+        for (size_t bit = 0; bit < 8; ++bit)
+            crc = (crc >> 1) ^ (0xEDB88320UL & (0UL - (crc & 1)));
+    }
+    return ~crc;
+}
+
+// @brief Checks the CRC and the vector table of the staged image
+static bool is_image_valid(size_t size, uint32_t crc32) {
+    const volatile uint32_t *vectors = (const volatile uint32_t*)get_staging_base();
+    uint32_t sp = vectors[0];
+    uint32_t reset_handler = vectors[1] & ~1UL;
+    return (sp > SRAM1_BASE) && (sp <= SRAM_END)
+        && (reset_handler >= FLASH_BASE) && (reset_handler < FLASH_BASE + size)
+        && (calc_crc32((const volatile uint8_t*)vectors, size) == crc32);
+}
+
+// @brief Erases sectors 0...last_sector, copies the image to the start of the
+// flash and resets the chip.
+// This runs from RAM with interrupts disabled and therefore can't use the
+// HAL, which lives in the sectors that are erased.
+__attribute__((section(".ramfunc"), noinline, long_call, noreturn))
+static void install_image(const volatile uint32_t *src, size_t n_words, uint32_t last_sector) {
+    __disable_irq();
+
+    FLASH->KEYR = FLASH_KEY1;
+    FLASH->KEYR = FLASH_KEY2;
+    FLASH->SR = FLASH_ERR_FLAGS;
+
+    for (uint32_t sector = 0; sector <= last_sector; ++sector) {
+        while (FLASH->SR & FLASH_SR_BSY) {}
+        FLASH->CR = FLASH_PSIZE_WORD | FLASH_CR_SER | (sector << FLASH_CR_SNB_Pos);
+        FLASH->CR |= FLASH_CR_STRT;
+        while (FLASH->SR & FLASH_SR_BSY) {}
+    }
+
+    volatile uint32_t *dst = (volatile uint32_t*)FLASH_BASE;
+    FLASH->CR = FLASH_PSIZE_WORD | FLASH_CR_PG;
+    for (size_t i = 0; i < n_words; ++i) {
+        dst[i] = src[i];
+        while (FLASH->SR & FLASH_SR_BSY) {}
+    }
+    FLASH->CR = FLASH_CR_LOCK;
+
+    // Same as NVIC_SystemReset() but without calling back into flash
+    __DSB();
+    SCB->AIRCR = (0x5FAUL << SCB_AIRCR_VECTKEY_Pos)
+               | (SCB->AIRCR & SCB_AIRCR_PRIGROUP_Msk)
+               | SCB_AIRCR_SYSRESETREQ_Msk;
+    __DSB();
+    for (;;) {}
+}
+
+// @brief Returns the largest image that can be installed with the running
+// firmware. It must fit into the staging area and must not reach into it
+// once installed.
+size_t FW_UPDATE_get_max_size(void) {
+    uintptr_t staging_base = get_staging_base();
+    if (staging_base >= APP_FLASH_END)
+        return 0;
+    size_t staging_size = APP_FLASH_END - staging_base;
+    size_t below = staging_base - FLASH_BASE;
+    return staging_size < below ? staging_size : below;
+}
+
+// @brief Erases enough of the staging area for an image of the given size and
+// starts to receive it. Any previous update that wasn't committed is dropped.
+// @param size: Image size in bytes
+// @param crc32: CRC-32 (zlib) over the image
+// @returns 0 on success or a non-zero error code otherwise
+int FW_UPDATE_begin(size_t size, uint32_t crc32) {
+    active_ = false;
+    if (!size || size > FW_UPDATE_get_max_size())
+        return -1;
+
+    uintptr_t staging_base = get_staging_base();
+    FLASH_EraseInitTypeDef erase_struct = {
+        .TypeErase = FLASH_TYPEERASE_SECTORS,
+        .Sector = sector_of(staging_base),
+        .NbSectors = sector_of(staging_base + size - 1) - sector_of(staging_base) + 1,
+        .VoltageRange = FLASH_VOLTAGE_RANGE_3
+    };
+    HAL_FLASH_Unlock();
+    __HAL_FLASH_CLEAR_FLAG(FLASH_ERR_FLAGS);
+    uint32_t sector_error;
+    if (HAL_FLASHEx_Erase(&erase_struct, &sector_error) != HAL_OK) {
+        HAL_FLASH_Lock();
+        return HAL_FLASH_GetError(); // non-zero
+    }
+    HAL_FLASH_Lock();
+
+    size_ = size;
+    crc32_ = crc32;
+    received_ = 0;
+    active_ = true;
+    return 0;
+}
+
+bool FW_UPDATE_is_active(void) {
+    return active_;
+}
+
+// @brief Writes the next chunk of the image to the staging area.
+// Chunks must arrive in order. A chunk at a different offset than
+// FW_UPDATE_get_received() is rejected so that the client can resend from
+// there.
+// @returns 0 on success or a non-zero error code otherwise
+int FW_UPDATE_write(size_t offset, const uint8_t *data, size_t length) {
+    if (!active_ || offset != received_ || length > size_ - offset)
+        return -1;
+    uintptr_t addr = get_staging_base() + offset;
+
+    HAL_FLASH_Unlock();
+    __HAL_FLASH_CLEAR_FLAG(FLASH_ERR_FLAGS);
+
+    // handle unaligned start
+    for (; (addr & 0x3) && length; ++data, ++addr, ++received_, --length)
+        if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_BYTE, addr, *data) != HAL_OK)
+            goto fail;
+
+    for (; length >= 4; data += 4, addr += 4, received_ += 4, length -= 4) {
+        uint32_t word;
+        memcpy(&word, data, sizeof(word));
+        if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, addr, word) != HAL_OK)
+            goto fail;
+    }
+
+    // handle unaligned end
+    for (; length; ++data, ++addr, ++received_, --length)
+        if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_BYTE, addr, *data) != HAL_OK)
+            goto fail;
+
+    HAL_FLASH_Lock();
+    return 0;
+fail:
+    // The flash at this offset is no longer erased, so the image can't be
+    // completed.
+    active_ = false;
+    HAL_FLASH_Lock();
+    return HAL_FLASH_GetError(); // non-zero
+}
+
+size_t FW_UPDATE_get_received(void) {
+    return received_;
+}
+
+// @brief Verifies the complete image and arms its installation on the next
+// reset. The caller should reset the chip right away.
+// @returns 0 on success or a non-zero error code otherwise
+int FW_UPDATE_commit(void) {
+    if (!active_ || received_ != size_)
+        return -1;
+    if (!is_image_valid(size_, crc32_))
+        return -2;
+    active_ = false;
+    pending_ = (pending_t){
+        .magic = PENDING_MAGIC,
+        .size = size_,
+        .crc32 = crc32_,
+        .check = ~(PENDING_MAGIC ^ size_ ^ crc32_)
+    };
+    return 0;
+}
+
+void FW_UPDATE_abort(void) {
+    active_ = false;
+}
+
+// @brief Installs an image that was committed before the last reset.
+// Must be called early during startup, while all peripherals are still in
+// their reset state. Returns if there is no valid pending image. Otherwise
+// it doesn't return but resets the chip once the image is installed.
+void FW_UPDATE_apply_pending(void) {
+    pending_t pending = pending_;
+    pending_.magic = 0;
+    if (pending.magic != PENDING_MAGIC
+            || pending.check != ~(pending.magic ^ pending.size ^ pending.crc32)
+            || !pending.size || pending.size > FW_UPDATE_get_max_size()
+            || !is_image_valid(pending.size, pending.crc32))
+        return;
+
+    install_image((const volatile uint32_t*)get_staging_base(),
+                  (pending.size + 3) / 4, sector_of(FLASH_BASE + pending.size - 1));
+}
+
+#else
+
+size_t FW_UPDATE_get_max_size(void) { return 0; }
+int FW_UPDATE_begin(size_t size, uint32_t crc32) { return -1; }
+bool FW_UPDATE_is_active(void) { return false; }
+int FW_UPDATE_write(size_t offset, const uint8_t *data, size_t length) { return -1; }
+size_t FW_UPDATE_get_received(void) { return 0; }
+int FW_UPDATE_commit(void) { return -1; }
+void FW_UPDATE_abort(void) {}
+void FW_UPDATE_apply_pending(void) {}
+
+#endif
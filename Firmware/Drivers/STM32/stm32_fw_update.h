@@ -0,0 +1,33 @@
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __FW_UPDATE_H
+#define __FW_UPDATE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Exported types ------------------------------------------------------------*/
+/* Exported constants --------------------------------------------------------*/
+/* Exported variables --------------------------------------------------------*/
+/* Exported macro ------------------------------------------------------------*/
+/* Exported functions --------------------------------------------------------*/
+
+size_t FW_UPDATE_get_max_size(void);
+int FW_UPDATE_begin(size_t size, uint32_t crc32);
+bool FW_UPDATE_is_active(void);
+int FW_UPDATE_write(size_t offset, const uint8_t *data, size_t length);
+size_t FW_UPDATE_get_received(void);
+int FW_UPDATE_commit(void);
+void FW_UPDATE_abort(void);
+void FW_UPDATE_apply_pending(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //__FW_UPDATE_H
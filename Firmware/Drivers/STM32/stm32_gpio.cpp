@@ -42,7 +42,7 @@ static inline IRQn_Type get_irq_number(uint16_t pin_number) {
 #define GPIO_OUTPUT_TYPE      0x00000010U
 
 
-bool Stm32Gpio::config(uint32_t mode, uint32_t pull, uint32_t speed) {
+bool Stm32Gpio::config(uint32_t mode, uint32_t pull, uint32_t speed, uint32_t alternate) {
     if (port_ == GPIOA) {
         __HAL_RCC_GPIOA_CLK_ENABLE();
     } else if (port_ == GPIOB) {
@@ -67,6 +67,14 @@ bool Stm32Gpio::config(uint32_t mode, uint32_t pull, uint32_t speed) {
 
     // The following code is mostly taken from HAL_GPIO_Init
 
+    /* In case of Alternate function mode selection */
+    if ((mode == GPIO_MODE_AF_PP) || (mode == GPIO_MODE_AF_OD)) {
+        uint32_t temp = port_->AFR[position >> 3U];
+        temp &= ~(0xFU << ((position & 0x07U) * 4U));
+        temp |= (alternate << ((position & 0x07U) * 4U));
+        port_->AFR[position >> 3U] = temp;
+    }
+
     /* Configure IO Direction mode (Input, Output, Alternate or Analog) */
     uint32_t temp = port_->MODER;
     temp &= ~(GPIO_MODER_MODER0 << (position * 2U));
@@ -158,7 +166,7 @@ void Stm32Gpio::unsubscribe() {
         return; // the subscription was not for this GPIO
     }
 
-    EXTI->IMR |= (uint32_t)pin_mask_;
+    EXTI->IMR &= ~((uint32_t)pin_mask_);
     __HAL_GPIO_EXTI_CLEAR_IT(pin_mask_);
 
     // At this point no more interrupts will be triggered for this GPIO
@@ -18,8 +18,11 @@ public:
      * This can be done regardless of the current state of the GPIO.
      * 
      * If any subscription is in place, it is not disabled by this function.
+     *
+     * @param alternate: Alternate function (GPIO_AFx_...) if mode is
+     *        GPIO_MODE_AF_PP or GPIO_MODE_AF_OD.
      */
-    bool config(uint32_t mode, uint32_t pull, uint32_t speed = GPIO_SPEED_FREQ_LOW);
+    bool config(uint32_t mode, uint32_t pull, uint32_t speed = GPIO_SPEED_FREQ_LOW, uint32_t alternate = 0);
 
     void write(bool state) {
         if (port_) {
@@ -11,23 +11,30 @@
 *
 * We consider each sector as an array of 64-bit fields except the first N bytes, which we
 * instead use as an allocation block. The allocation block is a compact bit-field (2 bit per entry)
-* that keeps track of the state of each field (erased, invalid, valid).
+* that keeps track of the state of each field (erased, invalid, valid, retired).
 *
-* One sector is always considered the valid (read) sector and the other one is the
-* target for the next write access: they can be considered to be ping-pong or double buffred.
-*
-* When writing a block of data, instead of always erasing the whole writable sector the
-* new data is appended in the erased area. This presumably increases flash life span.
-* The writable sector is only erased if there is not enough space for the new data.
-*
-* On startup, if there is exactly one sector
-* whose last non-erased value has the state "valid" that sector is considered
-* the valid sector. In any other case the selection is undefined.
+* The NVM is a log: the active sector holds the committed blocks in the order
+* they were written and readers see all of them (NVM_read(), NVM_is_valid()).
+* A block can either be appended to the active sector or written to the other
+* sector as a replacement of the whole log (compaction). In that case the other
+* sector becomes the active one and the old active sector gets a "retired"
+* marker after its last field. A sector's log starts after its last retired
+* marker, so a sector is only erased when there is no space left in it.
 *
+* On startup, the sector that has valid fields after its last retired marker
+* is the active sector. If both have (only possible with data from an older
+* firmware), the selection is undefined.
 *
 * To write a new block of data atomically we first mark all associated fields
 * as "invalid" (in the allocation table) then write the data and then mark the
-* fields as "valid" (in the direction of increasing address).
+* fields as "valid" (in the direction of increasing address). Fields of blocks
+* that were never committed stay invalid and are skipped by readers.
+*
+* Programming a word stalls flash reads (and therefore interrupts that run from
+* flash) for a few microseconds, so writes can run with interrupts enabled. An
+* erase stalls the CPU for a second or more. NVM_write_needs_erase() tells if
+* the next write has to erase a sector and NVM_prepare_write() does the erase
+* ahead of time.
 */
 
 #include "stm32_nvm.h"
@@ -69,11 +76,13 @@
 typedef enum {
     VALID = 0,
     INVALID = 1,
+    RETIRED = 2,
     ERASED = 3
 } field_state_t;
 
 typedef struct {
     size_t index;               //!< next field to be written to (can be equal to n_data)
+    size_t log_start;           //!< first field after the last retired marker
     const uint32_t sector_id;   //!< HAL ID of this sector
     const size_t n_data;        //!< number of 64-bit fields in this sector
     const size_t n_reserved;    //!< number of 64-bit fields in this sector that are reserved for the allocation table
@@ -95,9 +104,9 @@ sector_t sectors[] = { {
     .data = (uint64_t *)FLASH_SECTOR_B_BASE
 }};
 
-uint8_t read_sector_; // 0 or 1 to indicate which sector to read from and which to write to
+uint8_t read_sector_; // 0 or 1 to indicate the active sector
 size_t n_staging_area_; // number of 64-bit values that were reserved using NVM_start_write
-size_t n_valid_; // number of 64-bit fields that can be read
+uint8_t staging_sector_; // sector of the staging area
 
 static const uint32_t FLASH_ERR_FLAGS =
 #if defined(FLASH_FLAG_EOP)
@@ -144,6 +153,7 @@ int erase(sector_t *sector) {
     if (HAL_FLASHEx_Erase(&erase_struct, &sector_error) != HAL_OK)
         goto fail;
     sector->index = sector->n_reserved;
+    sector->log_start = sector->n_reserved;
 
     HAL_FLASH_Lock();
     return 0;
@@ -235,7 +245,47 @@ size_t scan_allocation_table(sector_t *sector, size_t max_index, field_state_t r
     return index;
 }
 
-// Loads the head of the NVM data.
+static field_state_t get_allocation_state(const sector_t *sector, size_t index) {
+    return (sector->alloc_table[index >> 2] >> ((index & 0x3) << 1)) & 0x3;
+}
+
+// @brief Returns the next field of a sector that a write can use, after the
+// fields of a write that was started but not committed.
+static size_t next_free_index(const sector_t *sector) {
+    return sector->index + ((sector == &sectors[staging_sector_]) ? n_staging_area_ : 0);
+}
+
+// @brief Sets sector->log_start and returns true if the log contains any valid
+// fields.
+static bool scan_log(sector_t *sector) {
+    bool any_valid = false;
+    sector->log_start = sector->n_reserved;
+    for (size_t i = sector->n_reserved; i < sector->index; ++i) {
+        field_state_t state = get_allocation_state(sector, i);
+        if (state == RETIRED) {
+            sector->log_start = i + 1;
+            any_valid = false;
+        } else if (state == VALID) {
+            any_valid = true;
+        }
+    }
+    return any_valid;
+}
+
+// @brief Appends a retired marker to a sector so that its log ends, or erases
+// it if there is no space left.
+static int retire(sector_t *sector) {
+    if (sector->index + 1 < sector->n_data) {
+        int status = set_allocation_state(sector, sector->index, 1, RETIRED);
+        sector->index += 1;
+        sector->log_start = sector->index;
+        return status;
+    } else {
+        return erase(sector);
+    }
+}
+
+// Loads the state of the NVM.
 // If this function fails subsequent calls to NVM functions (other than NVM_init or NVM_erase)
 // cause undefined behavior.
 // @returns 0 on success or a non-zero error code otherwise
@@ -245,33 +295,16 @@ int NVM_init(void) {
                 ERASED, &sector0_state);
     sectors[1].index = scan_allocation_table(&sectors[1], sectors[1].n_data,
                 ERASED, &sector1_state);
-    //printf("sector states: %02x, %02x\r\n", sector0_state, sector1_state); osDelay(5);
+    (void)sector0_state;
+    (void)sector1_state;
 
-    // Select valid sector on a best effort basis
-    // (in unfortunate cases valid_sector might actually point
-    // to an invalid or erased sector)
-    read_sector_ = 0;
-    if (sector1_state == VALID)
-        read_sector_ = 1;
-    
-    // count the number of valid fields
-    sector_t *read_sector = &sectors[read_sector_];
-    uint8_t first_nonvalid_state;
-    size_t min_valid_index = scan_allocation_table(read_sector, read_sector->index,
-        VALID, &first_nonvalid_state);
-    n_valid_ = read_sector->index - min_valid_index;
-    
-    n_staging_area_ = 0;
+    // Select the active sector on a best effort basis
+    bool sector0_active = scan_log(&sectors[0]);
+    bool sector1_active = scan_log(&sectors[1]);
+    read_sector_ = (sector1_active && !sector0_active) ? 1 : 0;
 
-    int status = 0;
-    /*// bring non-valid sectors into a known state
-    this is not absolutely required
-    if (sector0_state != VALID)
-        status |= erase(&sectors[0]);
-    if (sector1_state != VALID)
-        status |= erase(&sectors[1]);
-    */
-    return status;
+    n_staging_area_ = 0;
+    return 0;
 }
 
 // @brief Erases all data in the NVM.
@@ -283,8 +316,7 @@ int NVM_init(void) {
 // @returns 0 on success or a non-zero error code otherwise
 int NVM_erase(void) {
     read_sector_ = 0;
-    sectors[0].index = sectors[0].n_reserved;
-    sectors[1].index = sectors[1].n_reserved;
+    n_staging_area_ = 0;
 
     int state = 0;
     state |= erase(&sectors[0]);
@@ -292,52 +324,119 @@ int NVM_erase(void) {
     return state;
 }
 
-// @brief Returns the maximum number of bytes that can be read using NVM_read.
-// This holds until NVM_commit is called.
-size_t NVM_get_max_read_length(void) {
-    return n_valid_ << 3;
+// @brief Returns the length of the log in the active sector in bytes. Not all
+// of it is valid, see NVM_is_valid().
+size_t NVM_get_read_length(void) {
+    sector_t *read_sector = &sectors[read_sector_];
+    return (read_sector->index - read_sector->log_start) << 3;
 }
 
-// @brief Returns the maximum length (in bytes) that can passed to NVM_start_write.
-// This holds until NVM_commit is called.
-size_t NVM_get_max_write_length(void) {
-    sector_t *target = &sectors[1 - read_sector_];
-    return (target->n_data - target->n_reserved) << 3;
+// @brief Returns true if the 64-bit field at `offset` of the log belongs to a
+// committed block.
+bool NVM_is_valid(size_t offset) {
+    sector_t *read_sector = &sectors[read_sector_];
+    size_t index = read_sector->log_start + (offset >> 3);
+    return (index < read_sector->index) && (get_allocation_state(read_sector, index) == VALID);
 }
 
-// @brief Reads from the latest committed block in the non-volatile memory.
+// @brief Reads from the log of the active sector.
 // The function either succeeds or leaves the provided buffer unmodified.
-// @param offset: offset in bytes (0 meaning the beginning of the valid area)
+// @param offset: offset in bytes (0 meaning the beginning of the log)
 // @param data: buffer to write to
 // @param length: length in bytes (if (offset + length) is out of range, the function fails)
 // @returns 0 on success or a non-zero error code otherwise
 int NVM_read(size_t offset, uint8_t *data, size_t length) {
-    if (offset + length > (n_valid_ << 3))
+    if (offset + length > NVM_get_read_length())
         return -1;
     sector_t *read_sector = &sectors[read_sector_];
-    const uint8_t *src_ptr = ((const uint8_t *)&read_sector->data[read_sector->index - n_valid_]) + offset;
+    const uint8_t *src_ptr = ((const uint8_t *)&read_sector->data[read_sector->log_start]) + offset;
     memcpy(data, src_ptr, length);
     return 0;
 }
 
+// @brief Returns the maximum length (in bytes) that can passed to
+// NVM_start_write() with the same `append` argument.
+// An append is limited by the free space of the active sector, a compaction
+// by the size of a sector.
+size_t NVM_get_max_write_length(bool append) {
+    sector_t *sector = append ? &sectors[read_sector_] : &sectors[1 - read_sector_];
+    size_t start = append ? next_free_index(sector) : sector->n_reserved + 1;
+    return start + 1 < sector->n_data ? (sector->n_data - start - 1) << 3 : 0;
+}
+
+// @brief Returns true if writing a block of `length` bytes (NVM_start_write()
+// and NVM_commit()) would erase a sector. Appends never erase.
+bool NVM_write_needs_erase(size_t length, bool append) {
+    if (append)
+        return false;
+    sector_t *read_sector = &sectors[read_sector_];
+    sector_t *target = &sectors[1 - read_sector_];
+    length = (length + 7) >> 3;
+    // One more field for the retired marker of each sector
+    return (next_free_index(target) + 1 + length >= target->n_data)
+        || (read_sector->index + 1 >= read_sector->n_data);
+}
+
+// @brief Erases the target sector of the next compaction if a block of `length`
+// bytes wouldn't fit anymore. Call this while a CPU stall is harmless, e.g.
+// at startup.
+// @returns 0 on success or a non-zero error code otherwise
+int NVM_prepare_write(size_t length) {
+    sector_t *target = &sectors[1 - read_sector_];
+    length = (length + 7) >> 3;
+    if (next_free_index(target) + 1 + length < target->n_data)
+        return 0;
+    if (staging_sector_ == 1 - read_sector_)
+        n_staging_area_ = 0;
+    return erase(target);
+}
+
+// @brief Returns the staging block opened by NVM_start_write(), for reading
+// back what was written.
+const uint8_t* NVM_get_staging_area(void) {
+    sector_t *target = &sectors[staging_sector_];
+    return (const uint8_t*)&target->data[target->index];
+}
+
 // @brief Starts an atomic write operation.
 //
-// The most recent valid NVM data is not modified or invalidated until NVM_commit is called.
-// The length must be at most equal to the size indicated by NVM_get_max_write_length().
-//
-// @param length: Length of the staging block that should be created
-int NVM_start_write(size_t length) {
+// The log is not modified or invalidated until NVM_commit is called.
+// @param length: Length of the staging block that should be created, at most
+//        NVM_get_max_write_length(append).
+// @param append: true to append the block to the log of the active sector,
+//        false to replace the whole log with the block.
+int NVM_start_write(size_t length, bool append) {
     int status = 0;
-    sector_t *target = &sectors[1 - read_sector_];
+
+    // skip the fields of a write that was never committed, they are marked
+    // invalid already
+    sectors[staging_sector_].index += n_staging_area_;
+    n_staging_area_ = 0;
+
+    staging_sector_ = append ? read_sector_ : 1 - read_sector_;
+    sector_t *target = &sectors[staging_sector_];
 
     length = (length + 7) >> 3; // round to multiple of 64 bit
-    if (length > target->n_data - target->n_reserved)
+    if (length == 0)
         return -1;
 
-    // make room for the new data
-    if (length > target->n_data - target->index)
-        if ((status = erase(target)))
-            return status;
+    if (append) {
+        if (target->index + length >= target->n_data)
+            return -1;
+    } else {
+        if (length + 1 >= target->n_data - target->n_reserved)
+            return -1;
+
+        // make room for the new data
+        if (target->index + 1 + length >= target->n_data)
+            if ((status = erase(target)))
+                return status;
+
+        // end the old log of the target sector
+        if (target->log_start < target->index)
+            if ((status = retire(target)))
+                return status;
+    }
 
     // invalidate the fields we're about to write
     status = set_allocation_state(target, target->index, length, INVALID);
@@ -351,17 +450,17 @@ int NVM_start_write(size_t length) {
 // @brief Writes to the current data block that was opened with NVM_start_write.
 //
 // The operation fails if (offset + length) is larger than the length passed to NVM_start_write.
-// The most recent valid NVM data is not modified or invalidated until NVM_commit is called.
+// The log is not modified or invalidated until NVM_commit is called.
 // Warning: Writing different data to the same area multiple times during a single transaction
 // will cause data corruption.
 //
 // @param offset: The offset in bytes, 0 being the beginning of the staging block.
 // @param data: Pointer to the data that should be written
 // @param length: Data length in bytes
-int NVM_write(size_t offset, uint8_t *data, size_t length) {
+int NVM_write(size_t offset, const uint8_t *data, size_t length) {
     if (offset + length > (n_staging_area_ << 3))
         return -1;
-    sector_t *target = &sectors[1 - read_sector_];
+    sector_t *target = &sectors[staging_sector_];
 
     HAL_FLASH_Unlock();
     HAL_FLASH_ClearError();
@@ -373,10 +472,13 @@ int NVM_write(size_t offset, uint8_t *data, size_t length) {
             goto fail;
 
     // write 32-bit values (64-bit doesn't work)
-    for (; length >= 4; data += 4, offset += 4, length -=4)
+    for (; length >= 4; data += 4, offset += 4, length -=4) {
+        uint32_t word;
+        memcpy(&word, data, sizeof(word));
         if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD,
-                ((uintptr_t)&target->data[target->index]) + offset, *(uint32_t*)data) != HAL_OK)
+                ((uintptr_t)&target->data[target->index]) + offset, word) != HAL_OK)
             goto fail;
+    }
 
     // handle unaligned end
     for (; length; ++data, ++offset, --length)
@@ -394,27 +496,26 @@ fail:
 // @brief Commits the new data to NVM atomically.
 int NVM_commit(void) {
     sector_t *read_sector = &sectors[read_sector_];
-    sector_t *write_sector = &sectors[1 - read_sector_];
+    sector_t *write_sector = &sectors[staging_sector_];
 
     // mark the newly-written fields as valid
     int status = set_allocation_state(write_sector, write_sector->index, n_staging_area_, VALID);
     if (status)
         return status;
 
+    if (write_sector == read_sector) {
+        write_sector->index += n_staging_area_;
+        n_staging_area_ = 0;
+        return 0;
+    }
+
+    write_sector->log_start = write_sector->index;
     write_sector->index += n_staging_area_;
-    n_valid_ = n_staging_area_;
     n_staging_area_ = 0;
-    read_sector_ = 1 - read_sector_;
-
-    // invalidate the other sector
-    if (read_sector->index < read_sector->n_data) {
-        status = set_allocation_state(read_sector, read_sector->index, 1, INVALID);
-        read_sector->index += 1;
-    } else {
-        status = erase(read_sector);
-    }
+    read_sector_ = staging_sector_;
 
-    return status;
+    // end the log of the previous active sector
+    return retire(read_sector);
 }
 
 
@@ -461,7 +562,7 @@ void NVM_demo(void) {
         goto fail;
     
     // load bytes from NVM and print them
-    size_t available = NVM_get_max_read_length();
+    size_t available = NVM_get_read_length();
     if (available) {
         printf("NVM contains %d valid bytes:\r\n", available); osDelay(5);
         uint8_t buf[available];
@@ -482,7 +583,7 @@ void NVM_demo(void) {
     printf("write 0x%02x, ..., 0x%02x to NVM\r\n", seed, seed + len - 1); osDelay(5);
     for (size_t i = 0; i < len; i++)
         data[i] = seed++;
-    if (progress++, NVM_start_write(len) != 0)
+    if (progress++, NVM_start_write(len, false) != 0)
         goto fail;
     if (progress++, NVM_write(0, data, len / 2))
         goto fail;
@@ -7,6 +7,7 @@ extern "C" {
 #endif
 
 /* Includes ------------------------------------------------------------------*/
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 
@@ -18,11 +19,15 @@ extern "C" {
 
 int NVM_init(void);
 int NVM_erase(void);
-size_t NVM_get_max_read_length(void);
-size_t NVM_get_max_write_length(void);
+size_t NVM_get_read_length(void);
+bool NVM_is_valid(size_t offset);
 int NVM_read(size_t offset, uint8_t *data, size_t length);
-int NVM_start_write(size_t length);
-int NVM_write(size_t offset, uint8_t *data, size_t length);
+size_t NVM_get_max_write_length(bool append);
+bool NVM_write_needs_erase(size_t length, bool append);
+int NVM_prepare_write(size_t length);
+const uint8_t* NVM_get_staging_area(void);
+int NVM_start_write(size_t length, bool append);
+int NVM_write(size_t offset, const uint8_t *data, size_t length);
 int NVM_commit(void);
 void NVM_demo(void);
 
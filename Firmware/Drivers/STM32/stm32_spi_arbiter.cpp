@@ -26,104 +26,211 @@ void Stm32SpiArbiter::release_task(SpiTask* task) {
     task->is_in_use = false;
 }
 
-bool Stm32SpiArbiter::start() {
-    if (!task_list_) {
-        return false;
-    }
-
-    SpiTask& task = *task_list_;
-    if (!equals(task.config, hspi_->Init)) {
+bool Stm32SpiArbiter::start(SpiTask* task) {
+    if (!equals(task->config, hspi_->Init)) {
         HAL_SPI_DeInit(hspi_);
-        hspi_->Init = task.config;
+        hspi_->Init = task->config;
         HAL_SPI_Init(hspi_);
         __HAL_SPI_ENABLE(hspi_);
     }
-    task.ncs_gpio.write(false);
+    task->start_cycles = DWT->CYCCNT;
+    task->ncs_gpio.write(false);
     
     HAL_StatusTypeDef status = HAL_ERROR;
 
     if (hspi_->hdmatx->State != HAL_DMA_STATE_READY || hspi_->hdmarx->State != HAL_DMA_STATE_READY) {
         // This can happen if the DMA or interrupt priorities are not configured properly.
         status = HAL_BUSY;
-    } else if (task.tx_buf && task.rx_buf) {
-        status = HAL_SPI_TransmitReceive_DMA(hspi_, (uint8_t*)task.tx_buf, task.rx_buf, task.length);
-    } else if (task.tx_buf) {
-        status = HAL_SPI_Transmit_DMA(hspi_, (uint8_t*)task.tx_buf, task.length);
-    } else if (task.rx_buf) {
-        status = HAL_SPI_Receive_DMA(hspi_, task.rx_buf, task.length);
+    } else if (task->tx_buf && task->rx_buf) {
+        status = HAL_SPI_TransmitReceive_DMA(hspi_, (uint8_t*)task->tx_buf, task->rx_buf, task->length);
+    } else if (task->tx_buf) {
+        status = HAL_SPI_Transmit_DMA(hspi_, (uint8_t*)task->tx_buf, task->length);
+    } else if (task->rx_buf) {
+        status = HAL_SPI_Receive_DMA(hspi_, task->rx_buf, task->length);
     }
 
     if (status != HAL_OK) {
-        task.ncs_gpio.write(true);
+        task->ncs_gpio.write(true);
     }
 
     return status == HAL_OK;
 }
 
-void Stm32SpiArbiter::transfer_async(SpiTask* task) {
-    task->next = nullptr;
-    
-    // Append new task to task list.
-    // We could try to do this lock free but we could also use our time for useful things.
-    SpiTask** ptr = &task_list_;
-    CRITICAL_SECTION() {
-        while (*ptr)
-            ptr = &(*ptr)->next;
-        *ptr = task;
-    }
-
-    // If the list was empty before, kick off the SPI arbiter now
-    if (ptr == &task_list_) {
-        if (!start()) {
-            if (task->on_complete) {
-                (*task->on_complete)(task->on_complete_ctx, false);
+/**
+ * @brief Removes the oldest task from the specified queue.
+ *
+ * Must only be called by the owner of the bus. Producers only ever modify the
+ * head of the list, so everything behind the head can be unlinked without
+ * atomics.
+ */
+Stm32SpiArbiter::SpiTask* Stm32SpiArbiter::pop_oldest(SpiTask** queue) {
+    for (;;) {
+        SpiTask* head = __atomic_load_n(queue, __ATOMIC_ACQUIRE);
+        if (!head) {
+            return nullptr;
+        }
+        if (!head->next) {
+            if (__atomic_compare_exchange_n(queue, &head, nullptr, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                return head;
+            }
+            continue; // a task was pushed in the meantime
+        }
+        SpiTask* prev = head;
+        while (prev->next->next) {
+            prev = prev->next;
+        }
+        SpiTask* oldest = prev->next;
+        prev->next = nullptr;
+        return oldest;
+    }
+}
+
+bool Stm32SpiArbiter::has_pending() {
+    for (size_t i = 0; i < N_PRIORITIES; ++i) {
+        if (__atomic_load_n(&queues_[i], __ATOMIC_ACQUIRE)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Starts the first task of the specified batch that can be started
+ * and fails the ones before it. Returns false if none could be started.
+ */
+bool Stm32SpiArbiter::start_batch(SpiTask* task) {
+    while (task) {
+        SpiTask* batch_next = task->batch_next;
+        active_task_ = task;
+        if (start(task)) {
+            return true;
+        }
+        active_task_ = nullptr;
+        if (task->on_complete) {
+            (*task->on_complete)(task->on_complete_ctx, false);
+        }
+        task = batch_next;
+    }
+    return false;
+}
+
+/**
+ * @brief Starts the highest priority pending batch or releases the bus if
+ * there is none. Must only be called by the owner of the bus.
+ */
+void Stm32SpiArbiter::start_next() {
+    for (;;) {
+        SpiTask* task = nullptr;
+        for (size_t i = 0; i < N_PRIORITIES && !task; ++i) {
+            task = pop_oldest(&queues_[i]);
+        }
+
+        if (!task) {
+            active_task_ = nullptr;
+            __atomic_store_n(&busy_, false, __ATOMIC_RELEASE);
+            // A task might have been pushed after we checked the queues but
+            // before we released the bus. In this case its producer saw the
+            // bus busy and left it to us.
+            if (!has_pending() || __atomic_exchange_n(&busy_, true, __ATOMIC_ACQUIRE)) {
+                return;
             }
+            continue;
+        }
+
+        if (start_batch(task)) {
+            return;
         }
     }
 }
 
-// TODO: this currently only works when called in a CMSIS thread.
+void Stm32SpiArbiter::enqueue(SpiTask* task) {
+    SpiTask** queue = &queues_[task->priority];
+    SpiTask* head = __atomic_load_n(queue, __ATOMIC_RELAXED);
+    do {
+        task->next = head;
+    } while (!__atomic_compare_exchange_n(queue, &head, task, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    // If the bus is idle, take ownership and kick off the SPI arbiter now
+    if (!__atomic_exchange_n(&busy_, true, __ATOMIC_ACQUIRE)) {
+        start_next();
+    }
+}
+
+void Stm32SpiArbiter::transfer_async(SpiTask* task) {
+    task->batch_next = nullptr;
+    enqueue(task);
+}
+
+void Stm32SpiArbiter::transfer_async_batch(SpiTask* const* tasks, size_t n_tasks) {
+    if (!n_tasks) {
+        return;
+    }
+    for (size_t i = 0; i < n_tasks; ++i) {
+        tasks[i]->batch_next = (i + 1 < n_tasks) ? tasks[i + 1] : nullptr;
+    }
+    enqueue(tasks[0]);
+}
+
 bool Stm32SpiArbiter::transfer(SPI_InitTypeDef config, Stm32Gpio ncs_gpio, const uint8_t* tx_buf, uint8_t* rx_buf, size_t length, uint32_t timeout_ms) {
-    volatile uint8_t result = 0xff;
-
-    SpiTask task = {
-        .config = config,
-        .ncs_gpio = ncs_gpio,
-        .tx_buf = tx_buf,
-        .rx_buf = rx_buf,
-        .length = length,
-        .on_complete = [](void* ctx, bool success) { *(volatile uint8_t*)ctx = success ? 1 : 0; },
-        .on_complete_ctx = (void*)&result,
-        .is_in_use = false,
-        .next = nullptr
+    uint32_t deadline_ms = timeout_to_deadline(timeout_ms);
+
+    // Only one blocking transfer can be pending at a time. The task stays in
+    // use until its transfer finished, even if the caller timed out.
+    while (!acquire_task(&blocking_task_)) {
+        if (!is_in_the_future(deadline_ms)) {
+            return false;
+        }
+        osDelay(1);
+    }
+
+    if (!blocking_sem_) {
+        osSemaphoreStaticDef(blocking_sem, &blocking_sem_cb_);
+        blocking_sem_ = osSemaphoreCreate(osSemaphore(blocking_sem), 1);
+    }
+    // Consume the initial token or a token left by a transfer that timed out
+    osSemaphoreWait(blocking_sem_, 0);
+
+    blocking_task_.config = config;
+    blocking_task_.ncs_gpio = ncs_gpio;
+    blocking_task_.tx_buf = tx_buf;
+    blocking_task_.rx_buf = rx_buf;
+    blocking_task_.length = length;
+    blocking_task_.on_complete = [](void* ctx, bool success) {
+        Stm32SpiArbiter* arbiter = (Stm32SpiArbiter*)ctx;
+        arbiter->blocking_result_ = success;
+        osSemaphoreRelease(arbiter->blocking_sem_);
+        release_task(&arbiter->blocking_task_);
     };
+    blocking_task_.on_complete_ctx = this;
+    blocking_task_.priority = PRIORITY_LOW;
 
-    transfer_async(&task);
+    transfer_async(&blocking_task_);
 
-    while (result == 0xff) {
-        osDelay(1); // TODO: honor timeout
+    if (osSemaphoreWait(blocking_sem_, deadline_to_timeout(deadline_ms)) != osOK) {
+        return false;
     }
 
-    return result;
+    return blocking_result_;
 }
 
 void Stm32SpiArbiter::on_complete() {
-    if (!task_list_) {
+    SpiTask* task = active_task_;
+    if (!task) {
         return; // this should not happen
     }
 
+    // The callback may release the task for reuse so we fetch the rest of the
+    // batch first.
+    SpiTask* batch_next = task->batch_next;
+
     // Wrap up transfer
-    task_list_->ncs_gpio.write(true);
-    if (task_list_->on_complete) {
-        (*task_list_->on_complete)(task_list_->on_complete_ctx, true);
+    task->ncs_gpio.write(true);
+    if (task->on_complete) {
+        (*task->on_complete)(task->on_complete_ctx, true);
     }
 
-    // Start next task if any
-    SpiTask* next = nullptr;
-    CRITICAL_SECTION() {
-        next = task_list_ = task_list_->next;
-    }
-    if (next) {
-        start();
+    // Continue with the current batch or start the next one if any
+    if (!start_batch(batch_next)) {
+        start_next();
     }
 }
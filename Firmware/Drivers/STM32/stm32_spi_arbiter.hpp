@@ -4,9 +4,16 @@
 #include "stm32_gpio.hpp"
 
 #include <spi.h>
+#include <cmsis_os.h>
 
 class Stm32SpiArbiter {
 public:
+    enum Priority {
+        PRIORITY_HIGH = 0, // time critical transfers of the control loop (e.g. encoder reads)
+        PRIORITY_LOW = 1, // configuration and diagnostics (e.g. gate driver polling)
+        N_PRIORITIES
+    };
+
     struct SpiTask {
         SPI_InitTypeDef config;
         Stm32Gpio ncs_gpio;
@@ -16,7 +23,10 @@ public:
         void (*on_complete)(void*, bool);
         void* on_complete_ctx;
         bool is_in_use = false;
+        Priority priority = PRIORITY_LOW;
         struct SpiTask* next;
+        struct SpiTask* batch_next; // next task of the same batch (set by transfer_async_batch())
+        uint32_t start_cycles; // DWT cycle counter at the time the chip select was asserted
     };
 
     Stm32SpiArbiter(SPI_HandleTypeDef* hspi): hspi_(hspi) {}
@@ -49,8 +59,12 @@ public:
      * 
      * Once the transfer completes, fails or is aborted, the callback is invoked.
      * 
-     * This function is thread-safe with respect to all other public functions
-     * of this class.
+     * Pending tasks are started in order of their priority and in FIFO order
+     * within the same priority. A transfer that is already in progress is not
+     * interrupted.
+     * 
+     * This function is lock-free and thread-safe with respect to all other
+     * public functions of this class.
      * 
      * @param task: Contains all configuration data for this transfer.
      *        The struct pointed to by this argument must remain valid and
@@ -58,16 +72,34 @@ public:
      */
     void transfer_async(SpiTask* task);
 
+    /**
+     * @brief Enqueues several non-blocking transfers as one batch.
+     *
+     * The tasks of a batch are carried out back to back in the given order,
+     * each one started directly from the completion interrupt of the previous
+     * one. The SPI peripheral is only reconfigured between tasks whose
+     * configurations differ. The batch is scheduled with the priority of the
+     * first task.
+     *
+     * Apart from that the same rules as for transfer_async() apply to each
+     * task.
+     */
+    void transfer_async_batch(SpiTask* const* tasks, size_t n_tasks);
+
     /**
      * @brief Executes a blocking transfer.
      * 
      * If the SPI is busy this function waits until it becomes available or
-     * the specified timeout passes, whichever comes first.
+     * the specified timeout passes, whichever comes first. The transfer runs
+     * at PRIORITY_LOW.
      * 
-     * Returns true on successful transfer or false otherwise.
+     * Returns true on successful transfer or false otherwise. If the timeout
+     * expires after the transfer was enqueued it may still be carried out
+     * later, so the buffers must remain valid until the next call to this
+     * function returns.
      * 
-     * This function is thread-safe with respect to all other public functions
-     * of this class.
+     * Must be called from a CMSIS thread. This function is thread-safe with
+     * respect to all other public functions of this class.
      * 
      * @param config: The SPI configuration to apply for this transfer.
      * @param ncs_gpio: The active low GPIO to actuate during this transfer.
@@ -85,10 +117,26 @@ public:
     void on_complete();
 
 private:
-    bool start();
+    bool start(SpiTask* task);
+    bool start_batch(SpiTask* task);
+    void start_next();
+    void enqueue(SpiTask* task);
+    bool has_pending();
+    static SpiTask* pop_oldest(SpiTask** queue);
     
     SPI_HandleTypeDef* hspi_;
-    SpiTask* task_list_ = nullptr;
+
+    // One lock-free LIFO list per priority. Any context can push, only the
+    // owner of the bus (see busy_) pops.
+    SpiTask* queues_[N_PRIORITIES] = {nullptr};
+    SpiTask* active_task_ = nullptr;
+    bool busy_ = false;
+
+    // Used by transfer()
+    SpiTask blocking_task_;
+    osSemaphoreId blocking_sem_ = nullptr;
+    osStaticSemaphoreDef_t blocking_sem_cb_;
+    volatile bool blocking_result_ = false;
 };
 
 #endif // __STM32_SPI_ARBITER_HPP
\ No newline at end of file
@@ -2,3 +2,20 @@
 #include "stm32_system.h"
 
 uint32_t irq_counters[254]; // 14 core interrupts, 240 NVIC interrupts
+
+volatile bool trace_enabled = false;
+TraceEvent_t trace_buffer[TRACE_BUFFER_SIZE];
+uint32_t trace_head = 0;
+
+uint32_t irq_cycles = 0;
+uint32_t irq_nesting = 0;
+uint32_t irq_entry_cycles = 0;
+
+void trace_init(void) {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    // Keep HCLK running while the CPU sleeps in WFI (see vApplicationIdleHook()),
+    // otherwise the cycle counter stops and all DWT timestamps skew.
+    DBGMCU->CR |= DBGMCU_CR_DBG_SLEEP;
+}
@@ -9,6 +9,9 @@
 #error "unknown STM32 microcontroller"
 #endif
 
+#include <stdint.h>
+#include <stdbool.h>
+
 // C/C++ definitions
 
 #ifdef __cplusplus
@@ -19,6 +22,27 @@ extern "C" {
 // monitor the number of times each interrupt fires.
 //#define ENABLE_IRQ_COUNTER
 
+// Functions marked with RAMFUNC are executed from SRAM instead of flash if the
+// firmware is built with CONFIG_RAMFUNC_HOT_PATH=true. This removes flash wait
+// states and ART cache misses from the control loop. The code is copied to
+// RAM together with the .data section at startup.
+// Note that the CCM RAM of the STM32F405 is not connected to the instruction
+// bus so it can't be used for this.
+#ifdef RAMFUNC_HOT_PATH
+#define RAMFUNC __attribute__((section(".ramfunc"), noinline))
+#else
+#define RAMFUNC
+#endif
+
+// Places a variable in the CCM RAM of the STM32F405, which is only connected
+// to the CPU and therefore can't hold DMA buffers. Thread stacks and RTOS
+// objects go here.
+#if defined(STM32F405xx)
+#define CCMRAM __attribute__((section(".ccmram")))
+#else
+#define CCMRAM
+#endif
+
 #ifdef ENABLE_IRQ_COUNTER
 extern uint32_t irq_counters[];
 #define COUNT_IRQ(irqn) (++irq_counters[irqn + 14])
@@ -28,6 +52,38 @@ extern uint32_t irq_counters[];
 #define GET_IRQ_COUNTER(irqn) 0
 #endif
 
+// Cycle accurate event trace. Each event consists of the DWT cycle counter at
+// the time of the event and a tag. Tags below 256 are interrupt numbers
+// (offset by 14 like irq_counters), other tags are the address of the
+// TaskTimer of a MEASURE_TIME block. Exit events have TRACE_EXIT_FLAG set.
+// Events are written into a ring buffer which the host drains over the
+// protocol.
+#define TRACE_BUFFER_SIZE 512 // must be a power of two
+#define TRACE_EXIT_FLAG 0x80000000UL
+
+typedef struct {
+    uint32_t cycles;
+    uint32_t tag;
+} TraceEvent_t;
+
+extern volatile bool trace_enabled;
+extern TraceEvent_t trace_buffer[TRACE_BUFFER_SIZE];
+extern uint32_t trace_head; // total number of events written (wraps)
+
+void trace_init(void);
+
+// Safe to call from any interrupt priority. Entries are claimed with an
+// atomic increment so nested interrupts never overwrite each other.
+static inline void trace_event(uint32_t tag) {
+    if (trace_enabled) {
+        uint32_t cycles = DWT->CYCCNT;
+        uint32_t idx = __atomic_fetch_add(&trace_head, 1, __ATOMIC_RELAXED);
+        TraceEvent_t* evt = &trace_buffer[idx & (TRACE_BUFFER_SIZE - 1)];
+        evt->cycles = cycles;
+        evt->tag = tag;
+    }
+}
+
 static inline uint32_t cpu_enter_critical() {
     uint32_t primask = __get_PRIMASK();
     __disable_irq();
@@ -38,6 +94,42 @@ static inline void cpu_exit_critical(uint32_t priority_mask) {
     __set_PRIMASK(priority_mask);
 }
 
+// Time spent in the traced interrupts, counted from the entry of the
+// outermost one to its exit so that nested interrupts are counted once.
+// Threads are accounted on a clock that excludes this time, see
+// thread_clock().
+extern uint32_t irq_cycles; // [DWT cycles] total (wraps)
+extern uint32_t irq_nesting;
+extern uint32_t irq_entry_cycles;
+
+static inline void irq_time_enter(void) {
+    uint32_t mask = cpu_enter_critical();
+    if (irq_nesting++ == 0) {
+        irq_entry_cycles = DWT->CYCCNT;
+    }
+    cpu_exit_critical(mask);
+}
+
+static inline void irq_time_exit(void) {
+    uint32_t mask = cpu_enter_critical();
+    if (--irq_nesting == 0) {
+        irq_cycles += DWT->CYCCNT - irq_entry_cycles;
+    }
+    cpu_exit_critical(mask);
+}
+
+// @brief Cycle counter that stands still while a traced interrupt runs
+static inline uint32_t thread_clock(void) {
+    uint32_t mask = cpu_enter_critical();
+    uint32_t now = DWT->CYCCNT;
+    uint32_t result = now - irq_cycles - (irq_nesting ? now - irq_entry_cycles : 0);
+    cpu_exit_critical(mask);
+    return result;
+}
+
+#define TRACE_IRQ_ENTER(irqn) (irq_time_enter(), trace_event((uint32_t)((irqn) + 14)))
+#define TRACE_IRQ_EXIT(irqn) (trace_event((uint32_t)((irqn) + 14) | TRACE_EXIT_FLAG), irq_time_exit())
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,6 +1,5 @@
 
-#include "acim_estimator.hpp"
-#include <board.h>
+#include "odrive_main.h"
 
 /**
  * @brief Updates the AC Induction Motor rotor flux and phase estimates
@@ -9,6 +8,11 @@
  * AC induction motors. The estimator uses d-q axis currents and rotor
  * velocity to compute rotor flux magnitude, slip velocity, and stator
  * electrical phase angle.
+ *
+ * If `voltage_model_enable` is set, the phase of this current model is
+ * corrected by a closed loop voltage model observer above the crossover
+ * bandwidth, and the rotor time constant is identified from the
+ * difference between the two models.
  * 
  * @param timestamp Current time in HCLK ticks for delta-time calculation
  */
@@ -37,6 +41,11 @@ void AcimEstimator::update(uint32_t timestamp)  {
         // Prevents integration of garbage values and ensures clean startup
         rotor_flux_ = 0.0f;
         phase_offset_ = 0.0f;
+        slip_velocity_ = config_.slip_velocity;
+        angle_error_ = 0.0f;
+        observer_active_ = false;
+        flux_update_count_ = 0;
+        flux_update_dt_ = 0.0f;
         active_ = true;
         return;
     }
@@ -48,12 +57,19 @@ void AcimEstimator::update(uint32_t timestamp)  {
 
     // Update rotor flux estimate using exponential model: dψ/dt = (1/Tr) * (Lm*id - ψr)
     // Normalized to [A] units where rotor inductance is absorbed into slip_velocity gain
-    const float dflux_by_dt = config_.slip_velocity * (id - rotor_flux_);
-    rotor_flux_ += dflux_by_dt * dt;
+    // The flux changes with the rotor time constant, so a decimated update
+    // over the accumulated time step is sufficient
+    flux_update_dt_ += dt;
+    if (++flux_update_count_ >= std::max<uint32_t>(config_.flux_update_decimation, 1)) {
+        const float dflux_by_dt = slip_velocity_ * (id - rotor_flux_);
+        rotor_flux_ += dflux_by_dt * std::min(flux_update_dt_, 1.0f / slip_velocity_);
+        flux_update_count_ = 0;
+        flux_update_dt_ = 0.0f;
+    }
     
     // Calculate slip velocity from torque-producing current and rotor flux
     // slip_velocity = (1/Tr) * (iq / flux_r) where Tr is rotor time constant
-    float slip_velocity = config_.slip_velocity * (iq / rotor_flux_);
+    float slip_velocity = slip_velocity_ * (iq / rotor_flux_);
     
     // Clamp slip velocity to prevent numerical instability from small flux denominators
     // Limit to physically reasonable values based on maximum acceleration per time step
@@ -64,12 +80,64 @@ void AcimEstimator::update(uint32_t timestamp)  {
 
     // Compute stator electrical frequency and phase angle
     // Stator frequency = rotor mechanical frequency + slip frequency
-    stator_phase_vel_ = *rotor_phase_vel + slip_velocity;
+    float stator_phase_vel = *rotor_phase_vel + slip_velocity;
+    stator_phase_vel_ = stator_phase_vel;
     
     // Integrate slip velocity to track phase offset between rotor and stator
     // Wrapped to [-π, π] to prevent unbounded accumulation
     phase_offset_ = wrap_pm_pi(phase_offset_ + slip_velocity * dt);
     
     // Final stator electrical angle combines rotor mechanical angle with accumulated slip
-    stator_phase_ = wrap_pm_pi(*rotor_phase + phase_offset_);
+    float stator_phase = wrap_pm_pi(*rotor_phase + phase_offset_);
+
+    // Voltage model correction from the measured currents and the applied
+    // voltage, see AcimFluxObserver
+    Motor& motor = axis_->motor_;
+    Motor::Sample_t sample = motor.sample_.read();
+    bool use_voltage_model = config_.voltage_model_enable && config_.magnetizing_inductance > 0.0f
+                          && motor.is_armed_ && sample.current_meas.has_value();
+    if (use_voltage_model) {
+        float I_alpha = sample.current_meas->phA;
+        float I_beta = one_by_sqrt3 * (sample.current_meas->phB - sample.current_meas->phC);
+        float s, c;
+        our_arm_sin_cos_f32(stator_phase, &s, &c);
+        AcimFluxObserver::Params_t params = {
+            motor.config_.phase_resistance, motor.config_.phase_inductance,
+            config_.magnetizing_inductance, config_.crossover_bandwidth
+        };
+        if (observer_active_) {
+            // Like in the sensorless estimator, the voltage applied up to
+            // this measurement was reported with the previous one
+            observer_.update(params, V_alpha_beta_memory_[0], V_alpha_beta_memory_[1],
+                             I_alpha, I_beta, rotor_flux_ * c, rotor_flux_ * s, dt);
+        } else {
+            observer_.reset(params, rotor_flux_ * c, rotor_flux_ * s, I_alpha, I_beta);
+            observer_active_ = true;
+        }
+        V_alpha_beta_memory_[0] = sample.final_v_alpha;
+        V_alpha_beta_memory_[1] = sample.final_v_beta;
+
+        float flux_alpha = observer_.rotor_flux_alpha();
+        float flux_beta = observer_.rotor_flux_beta();
+        float flux_mag = std::sqrt(flux_alpha * flux_alpha + flux_beta * flux_beta);
+        if (flux_mag > 0.0f) {
+            // sin of the voltage model phase minus the current model phase
+            float sin_error = (c * flux_beta - s * flux_alpha) / flux_mag;
+            angle_error_ = sin_error;
+            stator_phase = fast_atan2(flux_beta, flux_alpha);
+
+            // Rotor time constant identification: a too low slip velocity
+            // makes the current model lag while motoring and lead while
+            // generating. Only at speed the voltage model is trustworthy.
+            if (config_.slip_adaptation_gain > 0.0f && std::abs(stator_phase_vel) >= config_.adaptation_min_vel) {
+                slip_velocity_ += config_.slip_adaptation_gain * sin_error * std::copysign(1.0f, iq) * dt;
+                slip_velocity_ = std::clamp(slip_velocity_, 0.1f * config_.slip_velocity, 10.0f * config_.slip_velocity);
+            }
+        }
+    } else {
+        observer_active_ = false;
+        angle_error_ = 0.0f;
+    }
+
+    stator_phase_ = stator_phase;
 }
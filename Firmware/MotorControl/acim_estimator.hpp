@@ -4,15 +4,26 @@
 #include <component.hpp>
 #include <cmath>
 #include <autogen/interfaces.hpp>
+#include "acim_flux_observer.hpp"
+
+class Axis;
 
 class AcimEstimator : public ComponentBase {
 public:
     struct Config_t {
-        float slip_velocity = 14.706f; // [rad/s electrical] = 1/rotor_tau
+        float slip_velocity = 14.706f; // [rad/s electrical] = 1/rotor_tau, initial value of slip_velocity_
+        uint32_t flux_update_decimation = 4; // control loop iterations per update of the rotor flux magnitude
+        bool voltage_model_enable = false; // correct the current model phase with the voltage model above the crossover
+        float magnetizing_inductance = 0.0f; // [H] Lm^2 / Lr, the leakage inductance is the motor's phase_inductance
+        float crossover_bandwidth = 20.0f; // [rad/s] the voltage model dominates above this electrical velocity
+        float slip_adaptation_gain = 0.0f; // [rad/s^2 per rad] rotor time constant identification, 0 disables it
+        float adaptation_min_vel = 100.0f; // [rad/s electrical] minimum stator velocity for the identification
     };
 
     void update(uint32_t timestamp) final;
 
+    Axis* axis_ = nullptr; // set by Axis constructor
+
     // Config
     Config_t config_;
 
@@ -26,6 +37,13 @@ public:
     uint32_t last_timestamp_ = 0;
     float rotor_flux_ = 0.0f; // [A]
     float phase_offset_ = 0.0f; // [A]
+    float slip_velocity_ = 14.706f; // [rad/s electrical] identified 1/rotor_tau
+    float angle_error_ = 0.0f; // [rad] voltage model phase minus current model phase
+    bool observer_active_ = false;
+    uint32_t flux_update_count_ = 0;
+    float flux_update_dt_ = 0.0f; // [s] time since the last rotor flux update
+    float V_alpha_beta_memory_[2] = {0.0f, 0.0f}; // [V]
+    AcimFluxObserver observer_;
 
     // Outputs
     OutputPort<float> slip_vel_ = 0.0f; // [rad/s electrical]
@@ -0,0 +1,69 @@
+#ifndef __ACIM_FLUX_OBSERVER_HPP
+#define __ACIM_FLUX_OBSERVER_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <algorithm>
+#include <cmath>
+
+/**
+ * @brief Closed loop rotor flux observer for induction motors that combines
+ * the voltage model with a current model estimate.
+ *
+ * The stator flux is integrated from v - R * i and pulled towards the stator
+ * flux of the current model with the crossover bandwidth. Below the
+ * crossover the current model dominates, above it the voltage model, which
+ * doesn't depend on the rotor time constant. The rotor flux follows from the
+ * stator flux as (psi_s - L_leak * i) / M, in units of magnetizing current
+ * [A] like the current model.
+ *
+ * L_leak is the transient (leakage) inductance sigma * Ls and M = Lm^2 / Lr.
+ */
+class AcimFluxObserver {
+public:
+    struct Params_t {
+        float resistance;           // [Ohm] stator resistance
+        float leakage_inductance;   // [H]
+        float magnetizing_inductance; // [H]
+        float bandwidth;            // [rad/s] crossover between the current and the voltage model
+    };
+
+    // @brief Starts at the current model estimate
+    void reset(const Params_t& params, float cm_flux_alpha, float cm_flux_beta,
+            float Ialpha, float Ibeta) {
+        stator_flux_[0] = params.magnetizing_inductance * cm_flux_alpha + params.leakage_inductance * Ialpha;
+        stator_flux_[1] = params.magnetizing_inductance * cm_flux_beta + params.leakage_inductance * Ibeta;
+        rotor_flux_[0] = cm_flux_alpha;
+        rotor_flux_[1] = cm_flux_beta;
+    }
+
+    /**
+     * @param Valpha, Vbeta: Voltage applied since the previous measurement [V]
+     * @param Ialpha, Ibeta: Current measurement [A]
+     * @param cm_flux_alpha, cm_flux_beta: Rotor flux of the current model [A]
+     */
+    void update(const Params_t& params, float Valpha, float Vbeta,
+            float Ialpha, float Ibeta, float cm_flux_alpha, float cm_flux_beta, float dt) {
+        float cm_stator_flux[2] = {
+            params.magnetizing_inductance * cm_flux_alpha + params.leakage_inductance * Ialpha,
+            params.magnetizing_inductance * cm_flux_beta + params.leakage_inductance * Ibeta
+        };
+        float V[2] = {Valpha, Vbeta};
+        float I[2] = {Ialpha, Ibeta};
+        float k = std::min(params.bandwidth * dt, 1.0f);
+        for (size_t i = 0; i < 2; ++i) {
+            stator_flux_[i] += dt * (V[i] - params.resistance * I[i])
+                             + k * (cm_stator_flux[i] - stator_flux_[i]);
+            rotor_flux_[i] = (stator_flux_[i] - params.leakage_inductance * I[i]) / params.magnetizing_inductance;
+        }
+    }
+
+    float rotor_flux_alpha() const { return rotor_flux_[0]; }
+    float rotor_flux_beta() const { return rotor_flux_[1]; }
+
+private:
+    float stator_flux_[2] = {0.0f, 0.0f};  // [Vs]
+    float rotor_flux_[2] = {0.0f, 0.0f};   // [A]
+};
+
+#endif // __ACIM_FLUX_OBSERVER_HPP
@@ -0,0 +1,104 @@
+/* ----------------------------------------------------------------------
+ * Project:      CMSIS DSP Library
+ * Title:        arm_sin_cos_f32.c
+ * Description:  Fast combined sine and cosine calculation for floating-point values
+ *
+ * $Date:        27. January 2017
+ * $Revision:    V.1.5.1
+ *
+ * Target Processor: Cortex-M cores
+ * -------------------------------------------------------------------- */
+/*
+ * Copyright (C) 2010-2017 ARM Limited or its affiliates. All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the License); you may
+ * not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <board.h>
+#include "arm_math.h"
+#include "arm_common_tables.h"
+
+/**
+ * @ingroup groupFastMath
+ */
+
+/**
+ * @addtogroup sin
+ * @{
+ */
+
+/**
+ * @brief  Fast approximation of sine and cosine of the same angle.
+ *
+ * Equivalent to calling our_arm_sin_f32() and our_arm_cos_f32() but the range
+ * reduction and the fractional index are computed only once. The cosine is
+ * read from the same table, a quarter period further along.
+ *
+ * @param[in]  x       input value in radians.
+ * @param[out] sin_val sin(x).
+ * @param[out] cos_val cos(x).
+ */
+
+void our_arm_sin_cos_f32(
+  float32_t x,
+  float32_t * sin_val,
+  float32_t * cos_val)
+{
+  float32_t fract, in;                           /* Temporary variables for input, output */
+  uint16_t index, index_cos;                     /* Index variables */
+  int32_t n;
+  float32_t findex;
+
+  /* input x is in radians */
+  /* Scale the input to [0 1] range from [0 2*PI] , divide input by 2*pi */
+  in = x * 0.159154943092f;
+
+  /* Calculation of floor value of input */
+  n = (int32_t) in;
+
+  /* Make negative values towards -infinity */
+  if (x < 0.0f)
+  {
+    n--;
+  }
+
+  /* Map input value to [0 1] */
+  in = in - (float32_t) n;
+
+  /* Calculation of index of the table */
+  findex = (float32_t)FAST_MATH_TABLE_SIZE * in;
+  index = (uint16_t)findex;
+
+  /* when "in" is exactly 1, we need to rotate the index down to 0 */
+  if (index >= FAST_MATH_TABLE_SIZE) {
+    index = 0;
+    findex -= (float32_t)FAST_MATH_TABLE_SIZE;
+  }
+
+  /* fractional value calculation (shared by sine and cosine) */
+  fract = findex - (float32_t) index;
+
+  /* cos(x) = sin(x + pi/2), i.e. a quarter of the table further */
+  index_cos = (index + FAST_MATH_TABLE_SIZE / 4) & (FAST_MATH_TABLE_SIZE - 1);
+
+  /* Linear interpolation between the two nearest table values */
+  *sin_val = (1.0f-fract)*sinTable_f32[index] + fract*sinTable_f32[index+1];
+  *cos_val = (1.0f-fract)*sinTable_f32[index_cos] + fract*sinTable_f32[index_cos+1];
+}
+
+/**
+ * @} end of sin group
+ */
@@ -1,11 +1,11 @@
 
 #include <stdlib.h>
-#include <functional>
 #include "gpio.h"
 
 #include "odrive_main.h"
 #include "utils.hpp"
 #include "communication/interface_can.hpp"
+#include "freertos_vars.h"
 
 Axis::Axis(int axis_num,
            uint16_t default_step_gpio_pin,
@@ -34,6 +34,9 @@ Axis::Axis(int axis_num,
 {
     encoder_.axis_ = this;
     sensorless_estimator_.axis_ = this;
+    fused_estimator_.axis_ = this;
+    hfi_estimator_.axis_ = this;
+    acim_estimator_.axis_ = this;
     controller_.axis_ = this;
     motor_.axis_ = this;
     trap_traj_.axis_ = this;
@@ -67,6 +70,7 @@ Axis::LockinConfig_t Axis::default_sensorless() {
     config.finish_on_vel = true;
     config.finish_on_distance = false;
     config.finish_on_enc_idx = false;
+    config.finish_on_sensorless_convergence = true;
     return config;
 }
 
@@ -74,8 +78,13 @@ static void step_cb_wrapper(void* ctx) {
     reinterpret_cast<Axis*>(ctx)->step_cb();
 }
 
+static void dir_cb_wrapper(void* ctx) {
+    reinterpret_cast<Axis*>(ctx)->dir_cb();
+}
+
 bool Axis::apply_config() {
     config_.parent = this;
+    config_.can.parent = this;
     decode_step_dir_pins();
     watchdog_feed();
     return true;
@@ -88,6 +97,10 @@ void Axis::clear_config() {
     config_.can.node_id = axis_num_;
 }
 
+void Axis::on_can_config_changed() {
+    odrv.can_.can_simple_.on_config_changed();
+}
+
 static void run_state_machine_loop_wrapper(void* ctx) {
     reinterpret_cast<Axis*>(ctx)->run_state_machine_loop();
     reinterpret_cast<Axis*>(ctx)->thread_id_valid_ = false;
@@ -95,24 +108,107 @@ static void run_state_machine_loop_wrapper(void* ctx) {
 
 // @brief Starts run_state_machine_loop in a new thread
 void Axis::start_thread() {
-    osThreadDef(thread_def, run_state_machine_loop_wrapper, thread_priority_, 0, stack_size_ / sizeof(StackType_t));
+    CCMRAM static StackType_t stacks[AXIS_COUNT][stack_size_ / sizeof(StackType_t)];
+    CCMRAM static osStaticThreadDef_t thread_cbs[AXIS_COUNT];
+    osThreadStaticDef(thread_def, run_state_machine_loop_wrapper, thread_priority_, 0, stack_size_ / sizeof(StackType_t), stacks[axis_num_], &thread_cbs[axis_num_]);
     thread_id_ = osThreadCreate(osThread(thread_def), this);
     thread_id_valid_ = true;
 }
 
 /**
- * @brief Blocks until at least one complete control loop has been executed.
+ * @brief Blocks until at least n complete control loop iterations have been
+ * executed.
+ *
+ * The control loop only signals the axis thread when the requested number of
+ * iterations has elapsed, so waiting for many iterations costs a single
+ * context switch.
  */
-bool Axis::wait_for_control_iteration() {
-    osSignalWait(0x0001, osWaitForever); // this might return instantly
-    osSignalWait(0x0001, osWaitForever); // this might be triggered at the
-                                         // end of a control loop iteration
-                                         // which was started before we entered
-                                         // this function
-    osSignalWait(0x0001, osWaitForever);
+bool Axis::wait_for_control_iterations(uint32_t n) {
+    // Consume a signal that may still be pending from an earlier wait
+    osSignalWait(SIGNAL_CONTROL_ITERATION, 0);
+    // The iteration that is currently running (if any) started before we
+    // entered this function so it doesn't count.
+    wakeup_countdown_ = n + 1;
+    // Any signal ends the wait, including SIGNAL_STATE_EVENT
+    while (!(osSignalWait(SIGNAL_CONTROL_ITERATION, osWaitForever).value.signals & SIGNAL_CONTROL_ITERATION)) {}
     return true;
 }
 
+/**
+ * @brief Blocks until a new state is requested, the motor is disarmed or the
+ * timeout elapses, whichever happens first.
+ *
+ * The loops of the steady states wait here instead of polling their exit
+ * conditions, so that transitions start right away. The caller must check
+ * the conditions again after every return.
+ */
+void Axis::wait_for_state_event(uint32_t timeout_ms) {
+    osSignalWait(SIGNAL_STATE_EVENT, timeout_ms);
+}
+
+/**
+ * @brief Requests a new state and wakes up the axis thread to process it.
+ */
+void Axis::request_state(AxisState state) {
+    requested_state_ = state;
+    if (thread_id_) {
+        osSignalSet(thread_id_, SIGNAL_STATE_EVENT);
+    }
+}
+
+/**
+ * @brief Called by the control loop at the end of every iteration.
+ */
+void Axis::control_iteration_done_cb() {
+    detect_events();
+
+    // A disarm ends closed loop control and homing
+    bool armed = motor_.is_armed_;
+    if (was_armed_ && !armed && thread_id_) {
+        osSignalSet(thread_id_, SIGNAL_STATE_EVENT);
+    }
+    was_armed_ = armed;
+
+    uint32_t countdown = wakeup_countdown_;
+    if (countdown) {
+        wakeup_countdown_ = --countdown;
+        if (!countdown && thread_id_) {
+            osSignalSet(thread_id_, SIGNAL_CONTROL_ITERATION);
+        }
+    }
+}
+
+/**
+ * @brief Latches the rising edges of the event conditions and wakes up the
+ * CAN thread, which sends them without waiting for the next heartbeat.
+ */
+void Axis::detect_events() {
+    uint32_t events = 0;
+
+    bool trajectory_done = controller_.trajectory_done_;
+    if (trajectory_done && !can_.event_trajectory_done) {
+        events |= EVENT_TRAJECTORY_DONE;
+    }
+    can_.event_trajectory_done = trajectory_done;
+
+    AxisState state = current_state_;
+    if (state != can_.event_state) {
+        events |= EVENT_STATE_CHANGED;
+    }
+    can_.event_state = state;
+
+    bool error = error_ || motor_.error_ || encoder_.error_ || controller_.error_;
+    if (error && !can_.event_error) {
+        events |= EVENT_ERROR;
+    }
+    can_.event_error = error;
+
+    if (events && config_.can.enable_events) {
+        can_.pending_events = can_.pending_events | events;
+        osSemaphoreRelease(sem_can);
+    }
+}
+
 // step/direction interface
 void Axis::step_cb() {
     if (step_dir_active_) {
@@ -126,18 +222,79 @@ void Axis::decode_step_dir_pins() {
     dir_gpio_ = get_gpio(config_.dir_gpio_pin);
 }
 
+// @brief Sets the count direction of the hardware step counter from the dir
+// GPIO. Called on every edge of the dir GPIO, which is rare compared to steps.
+void Axis::dir_cb() {
+    if (dir_gpio_.read()) {
+        step_counter_->CR1 &= ~TIM_CR1_DIR;
+    } else {
+        step_counter_->CR1 |= TIM_CR1_DIR;
+    }
+}
+
+// @brief Configures the timer of a GPIO in GPIO_MODE_STEP_COUNTER to count
+// the rising edges on its TI1 input.
+bool Axis::start_step_counter() {
+    TIM_TypeDef* tim = step_counter_timers[config_.step_gpio_pin];
+    if (!tim || (tim == TIM5 && std::any_of(std::begin(odrv.config_.pwm_mappings), std::end(odrv.config_.pwm_mappings),
+            [](auto& mapping) { return fibre::is_endpoint_ref_valid(mapping.endpoint); }))) {
+        return false;
+    }
+
+    tim->CR1 = 0;
+    tim->SMCR = 0;
+    tim->DIER = 0;
+    tim->CCER = 0; // non-inverted: rising edges
+    tim->CCMR1 = TIM_CCMR1_CC1S_0 | (3 << TIM_CCMR1_IC1F_Pos); // IC1 on TI1, filter N=8 at f_CK_INT
+    tim->PSC = 0;
+    tim->ARR = 0xffff; // step_counter_last_ handles the wrap of the 16-bit count
+    tim->EGR = TIM_EGR_UG;
+    tim->CNT = 0;
+    tim->SMCR = TIM_SMCR_TS_2 | TIM_SMCR_TS_0 // trigger TI1FP1
+              | TIM_SMCR_SMS_2 | TIM_SMCR_SMS_1 | TIM_SMCR_SMS_0; // external clock mode 1
+    step_counter_last_ = 0;
+    step_counter_ = tim;
+    dir_cb();
+    tim->CR1 |= TIM_CR1_CEN;
+
+    // The direction is sampled at the edges of the dir GPIO
+    return dir_gpio_.subscribe(true, true, dir_cb_wrapper, this);
+}
+
+void Axis::stop_step_counter() {
+    if (step_counter_) {
+        dir_gpio_.unsubscribe();
+        step_counter_->CR1 = 0;
+        step_counter_->SMCR = 0;
+        step_counter_ = nullptr;
+    }
+}
+
 // @brief (de)activates step/dir input
 void Axis::set_step_dir_active(bool active) {
+    bool hw_counter = config_.step_gpio_pin < GPIO_COUNT
+                   && odrv.config_.gpio_modes[config_.step_gpio_pin] == ODriveIntf::GPIO_MODE_STEP_COUNTER;
+
     if (active) {
-        // Subscribe to rising edges of the step GPIO
-        if (!step_gpio_.subscribe(true, false, step_cb_wrapper, this)) {
-            odrv.misconfigured_ = true;
+        if (hw_counter) {
+            // Read once per control loop iteration by Controller::update()
+            if (!step_counter_ && !start_step_counter()) {
+                stop_step_counter();
+                odrv.misconfigured_ = true;
+            }
+        } else {
+            // Subscribe to rising edges of the step GPIO
+            if (!step_gpio_.subscribe(true, false, step_cb_wrapper, this)) {
+                odrv.misconfigured_ = true;
+            }
         }
 
         step_dir_active_ = true;
     } else {
         step_dir_active_ = false;
 
+        stop_step_counter();
+
         // Unsubscribe from step GPIO
         // TODO: if we change the GPIO while the subscription is active and then
         // unsubscribe then the unsubscribe is for the wrong pin.
@@ -147,19 +304,25 @@ void Axis::set_step_dir_active(bool active) {
 
 // @brief Do axis level checks and call subcomponent do_checks
 // Returns true if everything is ok.
+// The checks of inputs that are only sampled in a slow slot of the control
+// loop run in that slot instead (see check_endstops() and
+// Motor::check_thermistors()). Their errors are seen here.
 bool Axis::do_checks(uint32_t timestamp) {
     // Sub-components should use set_error which will propegate to this error_
     motor_.effective_current_lim();
     motor_.do_checks(timestamp);
 
-    // Check for endstop presses
+    return check_for_errors();
+}
+
+// @brief Checks for endstop presses. Must run right after the endstops were
+// updated, since rose() only holds until the next update.
+void Axis::check_endstops() {
     if (min_endstop_.config_.enabled && min_endstop_.rose() && !(current_state_ == AXIS_STATE_HOMING)) {
         error_ |= ERROR_MIN_ENDSTOP_PRESSED;
     } else if (max_endstop_.config_.enabled && max_endstop_.rose() && !(current_state_ == AXIS_STATE_HOMING)) {
         error_ |= ERROR_MAX_ENDSTOP_PRESSED;
     }
-
-    return check_for_errors();
 }
 
 // @brief Feed the watchdog to prevent watchdog timeouts.
@@ -181,8 +344,30 @@ bool Axis::watchdog_check() {
     }
 }
 
+bool Axis::open_loop_controller_in_use() {
+    FieldOrientedController& cc = motor_.current_control_;
+    return cc.Idq_setpoint_src_.is_connected_to(open_loop_controller_.Idq_setpoint_)
+        || cc.Vdq_setpoint_src_.is_connected_to(open_loop_controller_.Vdq_setpoint_)
+        || cc.phase_src_.is_connected_to(open_loop_controller_.phase_)
+        || acim_estimator_.rotor_phase_src_.is_connected_to(open_loop_controller_.phase_);
+}
+
+// The lock-in spin checks the observer for convergence and measures the
+// flux linkage with it, so it counts as a consumer.
+bool Axis::sensorless_estimator_in_use() {
+    return fused_estimator_.active_ || hfi_estimator_.active_ || open_loop_controller_in_use()
+        || controller_.vel_estimate_src_.is_connected_to(sensorless_estimator_.vel_estimate_)
+        || motor_.current_control_.phase_src_.is_connected_to(sensorless_estimator_.phase_)
+        || acim_estimator_.rotor_phase_src_.is_connected_to(sensorless_estimator_.phase_);
+}
+
+bool Axis::acim_estimator_in_use() {
+    return motor_.current_control_.phase_src_.is_connected_to(acim_estimator_.stator_phase_)
+        || motor_.phase_vel_src_.is_connected_to(acim_estimator_.stator_phase_vel_);
+}
+
 bool Axis::run_lockin_spin(const LockinConfig_t &lockin_config, bool remain_armed,
-        std::function<bool(bool)> loop_cb) {
+        fibre::Callback<bool, bool> loop_cb) {
     CRITICAL_SECTION() {
         // Reset state variables
         open_loop_controller_.Idq_setpoint_ = {0.0f, 0.0f};
@@ -208,6 +393,10 @@ bool Axis::run_lockin_spin(const LockinConfig_t &lockin_config, bool remain_arme
         motor_.phase_vel_src_.connect_to(&open_loop_controller_.phase_vel_);
         motor_.current_control_.phase_vel_src_.connect_to(&open_loop_controller_.phase_vel_);
         acim_estimator_.rotor_phase_vel_src_.connect_to(&open_loop_controller_.phase_vel_);
+
+        if (lockin_config.finish_on_sensorless_convergence) {
+            sensorless_estimator_.reset();
+        }
     }
     wait_for_control_iteration();
 
@@ -221,10 +410,18 @@ bool Axis::run_lockin_spin(const LockinConfig_t &lockin_config, bool remain_arme
         bool reached_target_vel = std::abs(open_loop_controller_.phase_vel_.any().value_or(0.0f) - lockin_config.vel) <= std::numeric_limits<float>::epsilon();
         bool reached_target_dist = open_loop_controller_.total_distance_.any().value_or(0.0f) * dir >= lockin_config.finish_distance * dir;
 
+        // The rotor follows the lock-in if the observer agrees on the speed
+        float lockin_vel = open_loop_controller_.phase_vel_.any().value_or(0.0f);
+        float observer_vel = sensorless_estimator_.phase_vel_.any().value_or(0.0f);
+        bool sensorless_converged = sensorless_estimator_.converged_
+                                 && std::abs(lockin_vel) >= 0.1f * std::abs(lockin_config.vel)
+                                 && std::abs(observer_vel - lockin_vel) <= 0.1f * std::abs(lockin_vel);
+
         // Check if terminal condition is reached
         bool terminal_condition = (reached_target_vel && lockin_config.finish_on_vel)
                                || (reached_target_dist && lockin_config.finish_on_distance)
-                               || (encoder_.index_found_ && lockin_config.finish_on_enc_idx);
+                               || (encoder_.index_found_ && lockin_config.finish_on_enc_idx)
+                               || (sensorless_converged && lockin_config.finish_on_sensorless_convergence);
         if (terminal_condition) {
             success = true;
             break;
@@ -237,9 +434,8 @@ bool Axis::run_lockin_spin(const LockinConfig_t &lockin_config, bool remain_arme
             subscribed_to_idx_once = true;
         }
 
-        if (loop_cb)
-            if (!loop_cb(reached_target_vel))
-                break;
+        if (loop_cb && !loop_cb.invoke(reached_target_vel))
+            break;
 
         // TODO: use new sync function instead
         asm volatile ("" ::: "memory");
@@ -253,11 +449,106 @@ bool Axis::run_lockin_spin(const LockinConfig_t &lockin_config, bool remain_arme
     return success;
 }
 
+// @brief Spins the motor with the sensorless lock-in and measures
+// sensorless_estimator_.config_.pm_flux_linkage at the final velocity.
+bool Axis::run_flux_linkage_calibration() {
+    constexpr uint32_t settle_ms = 200;
+    constexpr uint32_t measure_ms = 500;
+
+    // Run until the callback ends the spin
+    LockinConfig_t lockin_config = config_.sensorless_ramp;
+    lockin_config.finish_on_vel = false;
+    lockin_config.finish_on_distance = false;
+    lockin_config.finish_on_enc_idx = false;
+    lockin_config.finish_on_sensorless_convergence = false;
+
+    SensorlessEstimator& estimator = sensorless_estimator_;
+    uint32_t ticks_at_vel = 0;
+    bool done = false;
+    run_lockin_spin(lockin_config, false, [&](bool reached_target_vel) {
+        if (!reached_target_vel) {
+            return true;
+        }
+        ++ticks_at_vel;
+        if (ticks_at_vel == settle_ms) {
+            CRITICAL_SECTION() {
+                estimator.flux_linkage_measurement_.reset();
+                estimator.flux_linkage_measurement_active_ = true;
+            }
+        } else if (ticks_at_vel >= settle_ms + measure_ms) {
+            estimator.flux_linkage_measurement_active_ = false;
+            done = true;
+            return false;
+        }
+        return true;
+    });
+    estimator.flux_linkage_measurement_active_ = false;
+
+    if (!done) {
+        return false;
+    }
+
+    float flux_linkage = estimator.flux_linkage_measurement_.result(
+            motor_.config_.phase_resistance, motor_.config_.phase_inductance);
+    if (!(flux_linkage > 0.0f) || !std::isfinite(flux_linkage)) {
+        estimator.error_ |= SensorlessEstimator::ERROR_FLUX_LINKAGE_OUT_OF_RANGE;
+        error_ |= ERROR_SENSORLESS_ESTIMATOR_FAILED;
+        return false;
+    }
+    estimator.config_.pm_flux_linkage = flux_linkage;
+    return true;
+}
+
+// @brief Arms the motor at standstill and runs the startup of the HFI
+// estimator. The motor remains armed on success.
+bool Axis::run_hfi_startup() {
+    if (!hfi_estimator_.start()) {
+        return false;
+    }
+
+    CRITICAL_SECTION() {
+        motor_.current_control_.enable_current_control_src_ = true;
+        motor_.current_control_.average_current_pairs_ = true;
+        motor_.current_control_.Idq_setpoint_src_.connect_to(&hfi_estimator_.Idq_setpoint_);
+        motor_.current_control_.Vdq_setpoint_src_.connect_to(&hfi_estimator_.Vdq_setpoint_);
+
+        motor_.current_control_.phase_src_.connect_to(&hfi_estimator_.phase_);
+        acim_estimator_.rotor_phase_src_.connect_to(&hfi_estimator_.phase_);
+
+        motor_.phase_vel_src_.connect_to(&hfi_estimator_.phase_vel_);
+        motor_.current_control_.phase_vel_src_.connect_to(&hfi_estimator_.phase_vel_);
+        acim_estimator_.rotor_phase_vel_src_.connect_to(&hfi_estimator_.phase_vel_);
+    }
+    wait_for_control_iteration();
+
+    motor_.arm(&motor_.current_control_);
+
+    while ((requested_state_ == AXIS_STATE_UNDEFINED) && motor_.is_armed_
+            && hfi_estimator_.active_ && !hfi_estimator_.startup_done()) {
+        osDelay(1);
+    }
+
+    if (!hfi_estimator_.startup_done() || !motor_.is_armed_) {
+        hfi_estimator_.stop();
+        motor_.current_control_.average_current_pairs_ = false;
+        motor_.disarm();
+        return false;
+    }
+
+    return true;
+}
+
 
 bool Axis::start_closed_loop_control() {
     bool sensorless_mode = config_.enable_sensorless_mode;
+    bool hfi_mode = sensorless_mode && config_.enable_hfi;
+    bool fused_mode = !sensorless_mode && config_.enable_sensor_fusion;
 
-    if (sensorless_mode) {
+    if (hfi_mode) {
+        if (!run_hfi_startup()) {
+            return false;
+        }
+    } else if (sensorless_mode) {
         // TODO: restart if desired
         if (!run_lockin_spin(config_.sensorless_ramp, true)) {
             return false;
@@ -265,27 +556,62 @@ bool Axis::start_closed_loop_control() {
     }
 
     // Hook up the data paths between the components
+    bool dual_loop_active = false;
     CRITICAL_SECTION() {
-        if (sensorless_mode) {
+        if (hfi_mode) {
+            controller_.pos_estimate_circular_src_.connect_to(&hfi_estimator_.pos_circular_);
+            controller_.pos_wrap_src_.connect_to(&controller_.config_.circular_setpoint_range);
+            controller_.pos_estimate_linear_src_.connect_to(&hfi_estimator_.pos_estimate_);
+            controller_.pos_estimate_split_src_.disconnect();
+            controller_.vel_estimate_src_.connect_to(&hfi_estimator_.vel_estimate_);
+        } else if (sensorless_mode) {
             controller_.pos_estimate_linear_src_.disconnect();
+            controller_.pos_estimate_split_src_.disconnect();
             controller_.pos_estimate_circular_src_.disconnect();
             controller_.pos_wrap_src_.disconnect();
             controller_.vel_estimate_src_.connect_to(&sensorless_estimator_.vel_estimate_);
+        } else if (fused_mode && controller_.config_.load_encoder_axis == axis_num_) {
+            controller_.pos_estimate_circular_src_.connect_to(&fused_estimator_.pos_circular_);
+            controller_.pos_wrap_src_.connect_to(&controller_.config_.circular_setpoint_range);
+            controller_.pos_estimate_linear_src_.connect_to(&fused_estimator_.pos_estimate_);
+            controller_.pos_estimate_split_src_.disconnect();
+            controller_.vel_estimate_src_.connect_to(&fused_estimator_.vel_estimate_);
         } else if (controller_.config_.load_encoder_axis < AXIS_COUNT) {
             Axis* ax = &axes[controller_.config_.load_encoder_axis];
             controller_.pos_estimate_circular_src_.connect_to(&ax->encoder_.pos_circular_);
             controller_.pos_wrap_src_.connect_to(&controller_.config_.circular_setpoint_range);
             controller_.pos_estimate_linear_src_.connect_to(&ax->encoder_.pos_estimate_);
-            controller_.vel_estimate_src_.connect_to(&ax->encoder_.vel_estimate_);
+            controller_.pos_estimate_split_src_.connect_to(&ax->encoder_.pos_estimate_split_);
+            // Dual loop: position from the load encoder, velocity from the motor encoder
+            dual_loop_active = controller_.config_.dual_loop && ax != this;
+            controller_.vel_estimate_src_.connect_to(dual_loop_active ? &encoder_.vel_estimate_ : &ax->encoder_.vel_estimate_);
         } else {
             controller_.pos_estimate_circular_src_.disconnect();
             controller_.pos_estimate_linear_src_.disconnect();
+            controller_.pos_estimate_split_src_.disconnect();
             controller_.pos_wrap_src_.disconnect();
             controller_.vel_estimate_src_.disconnect();
             controller_.set_error(Controller::ERROR_INVALID_LOAD_ENCODER);
             return false;
         }
 
+        controller_.dual_loop_active_ = dual_loop_active;
+        if (dual_loop_active && !(std::abs(controller_.config_.gear_ratio) > 0.0f)) {
+            controller_.set_error(Controller::ERROR_INVALID_LOAD_ENCODER);
+            return false;
+        }
+
+        // Torque sharing: the controller also drives the motor of the slave,
+        // which must be another axis that doesn't share its own torque
+        uint8_t share_axis = controller_.config_.torque_share_axis;
+        Axis* slave = share_axis < AXIS_COUNT ? &axes[share_axis] : nullptr;
+        if (slave && (slave == this || slave->controller_.torque_share_slave_
+                      || !(std::abs(controller_.config_.torque_share_ratio) <= 1.0f))) {
+            controller_.set_error(Controller::ERROR_INVALID_TORQUE_SHARE);
+            return false;
+        }
+        controller_.torque_share_slave_ = slave;
+
         // To avoid any transient on startup, we intialize the setpoint to be the current position
         controller_.control_mode_updated();
         controller_.input_pos_updated();
@@ -293,7 +619,11 @@ bool Axis::start_closed_loop_control() {
         // Avoid integrator windup issues
         controller_.vel_integrator_torque_ = 0.0f;
 
-        motor_.torque_setpoint_src_.connect_to(&controller_.torque_output_);
+        if (fused_mode) {
+            fused_estimator_.start();
+        }
+
+        motor_.torque_setpoint_src_.connect_to(slave ? &controller_.own_torque_output_ : &controller_.torque_output_);
         motor_.direction_ = sensorless_mode ? 1.0f : encoder_.config_.direction;
 
         motor_.current_control_.enable_current_control_src_ = motor_.config_.motor_type != Motor::MOTOR_TYPE_GIMBAL;
@@ -302,21 +632,27 @@ bool Axis::start_closed_loop_control() {
 
         bool is_acim = motor_.config_.motor_type == Motor::MOTOR_TYPE_ACIM;
         // phase
-        OutputPort<float>* phase_src = sensorless_mode ? &sensorless_estimator_.phase_ : &encoder_.phase_;
+        OutputPort<float>* phase_src = hfi_mode ? &hfi_estimator_.phase_
+                                     : sensorless_mode ? &sensorless_estimator_.phase_
+                                     : fused_mode ? &fused_estimator_.phase_ : &encoder_.phase_;
         acim_estimator_.rotor_phase_src_.connect_to(phase_src);
         OutputPort<float>* stator_phase_src = is_acim ? &acim_estimator_.stator_phase_ : phase_src;
         motor_.current_control_.phase_src_.connect_to(stator_phase_src);
         // phase vel
-        OutputPort<float>* phase_vel_src = sensorless_mode ? &sensorless_estimator_.phase_vel_ : &encoder_.phase_vel_;
+        OutputPort<float>* phase_vel_src = hfi_mode ? &hfi_estimator_.phase_vel_
+                                         : sensorless_mode ? &sensorless_estimator_.phase_vel_
+                                         : fused_mode ? &fused_estimator_.phase_vel_ : &encoder_.phase_vel_;
         acim_estimator_.rotor_phase_vel_src_.connect_to(phase_vel_src);
         OutputPort<float>* stator_phase_vel_src = is_acim ? &acim_estimator_.stator_phase_vel_ : phase_vel_src;
         motor_.phase_vel_src_.connect_to(stator_phase_vel_src);
         motor_.current_control_.phase_vel_src_.connect_to(stator_phase_vel_src);
         
-        if (sensorless_mode) {
+        if (sensorless_mode && !hfi_mode) {
             // Make the final velocity of the loĉk-in spin the setpoint of the
-            // closed loop controller to allow for smooth transition.
-            float vel = config_.sensorless_ramp.vel / (2.0f * M_PI * motor_.config_.pole_pairs);
+            // closed loop controller to allow for smooth transition. The
+            // lock-in may have ended early on observer convergence.
+            float lockin_vel = open_loop_controller_.phase_vel_.any().value_or(config_.sensorless_ramp.vel);
+            float vel = lockin_vel / (2.0f * M_PI * motor_.config_.pole_pairs);
             controller_.input_vel_ = vel;
             controller_.vel_setpoint_ = vel;
         }
@@ -333,6 +669,11 @@ bool Axis::start_closed_loop_control() {
 
 bool Axis::stop_closed_loop_control() {
     motor_.disarm();
+    // The slave has no torque without this controller and disarms as well
+    controller_.torque_share_slave_ = nullptr;
+    fused_estimator_.stop();
+    hfi_estimator_.stop();
+    motor_.current_control_.average_current_pairs_ = false;
     return check_for_errors();
 }
 
@@ -340,8 +681,10 @@ bool Axis::run_closed_loop_control_loop() {
     start_closed_loop_control();
     set_step_dir_active(config_.enable_step_dir);
 
+    // Nothing to do here until one of the exit conditions is signalled. The
+    // timeout is only a fallback.
     while ((requested_state_ == AXIS_STATE_UNDEFINED) && motor_.is_armed_) {
-        osDelay(1);
+        wait_for_state_event(100);
     }
 
     set_step_dir_active(config_.enable_step_dir && config_.step_dir_always_on);
@@ -378,7 +721,7 @@ bool Axis::run_homing() {
 
     // Driving toward the endstop
     while ((requested_state_ == AXIS_STATE_UNDEFINED) && motor_.is_armed_ && !(done = min_endstop_.get_state())) {
-        osDelay(1);
+        wait_for_state_event(1);
     }
 
     stop_closed_loop_control();
@@ -402,8 +745,10 @@ bool Axis::run_homing() {
     // Initialize closed loop control, and then set the desired location.
     start_closed_loop_control();
     
-    controller_.input_pos_ = pos_estimate_local.value() + min_endstop_.config_.offset;
-    controller_.pos_setpoint_ = pos_estimate_local.value();
+    // With edge timing the home position doesn't depend on how far the axis
+    // travelled while the endstop was debounced
+    controller_.input_pos_ = min_endstop_.pos_at_edge_.value_or(pos_estimate_local.value()) + min_endstop_.config_.offset;
+    controller_.pos_setpoint_ = SplitPos::from_float(pos_estimate_local.value());
     controller_.vel_setpoint_ = 0.0f;
     controller_.input_pos_updated();
 
@@ -412,7 +757,7 @@ bool Axis::run_homing() {
     controller_.trajectory_done_ = false; 
     
     while ((requested_state_ == AXIS_STATE_UNDEFINED) && motor_.is_armed_ && !(done = controller_.trajectory_done_)) {
-        osDelay(1);
+        wait_for_state_event(1);
     }
 
     stop_closed_loop_control();
@@ -428,7 +773,7 @@ bool Axis::run_homing() {
         axes[load_encoder_axis].encoder_.set_linear_count(0);
     }
     controller_.input_pos_ = 0.0f;
-    controller_.pos_setpoint_ = 0.0f;
+    controller_.pos_setpoint_ = SplitPos{};
     controller_.vel_setpoint_ = 0.0f;
     controller_.input_pos_updated();
 
@@ -446,23 +791,177 @@ bool Axis::run_idle_loop() {
     set_step_dir_active(config_.enable_step_dir && config_.step_dir_always_on);
     while (requested_state_ == AXIS_STATE_UNDEFINED) {
         motor_.setup();
-        osDelay(1);
+        wait_for_state_event(1);
     }
     return check_for_errors();
 }
 
+/**
+ * @brief Checks the stored motor and encoder calibration with a short probe
+ * instead of running the calibrations again.
+ *
+ * A current is driven along the d axis according to the encoder. With the
+ * right offset this produces no torque, otherwise the rotor turns towards the
+ * current by about the offset error (unless friction or a load hold it). The
+ * voltage that drives the current gives the phase resistance.
+ *
+ * The values that fail the check are invalidated. Their calibrations run next
+ * if the corresponding startup flags are set, otherwise closed loop control
+ * can't be entered.
+ */
+bool Axis::run_calibration_check() {
+    const CalibrationCheckConfig_t& cfg = config_.calibration_check;
+    calibration_check_ = {};
+
+    // Without a usable encoder the direction of the probe doesn't matter
+    std::optional<float> phase_before = encoder_.is_ready_ ? encoder_.phase_.any() : std::nullopt;
+
+    float resistance = motor_.probe_resistance(cfg.current, phase_before.value_or(0.0f), cfg.duration);
+    if (is_nan(resistance)) {
+        return false; // disarmed by an error or a new state was requested
+    }
+    calibration_check_.resistance = resistance;
+    calibration_check_.motor_passed = std::abs(resistance / motor_.config_.phase_resistance - 1.0f) <= cfg.max_resistance_error;
+
+    std::optional<float> phase_after = encoder_.phase_.any();
+    if (phase_before.has_value() && phase_after.has_value()) {
+        calibration_check_.offset_error = std::abs(wrap_pm_pi(*phase_after - *phase_before));
+        calibration_check_.encoder_passed = encoder_.is_ready_
+                && calibration_check_.offset_error <= cfg.max_offset_error;
+    }
+
+    AxisState fallback[2];
+    size_t n_fallback = 0;
+    if (!calibration_check_.motor_passed) {
+        motor_.is_calibrated_ = false;
+        if (config_.startup_motor_calibration)
+            fallback[n_fallback++] = AXIS_STATE_MOTOR_CALIBRATION;
+    }
+    if (!calibration_check_.encoder_passed) {
+        encoder_.is_ready_ = false;
+        if (config_.startup_encoder_offset_calibration)
+            fallback[n_fallback++] = AXIS_STATE_ENCODER_OFFSET_CALIBRATION;
+    }
+
+    // Run the fallbacks right after this state
+    std::copy_backward(task_chain_.begin() + 1, task_chain_.end() - n_fallback, task_chain_.end());
+    std::copy(fallback, fallback + n_fallback, task_chain_.begin() + 1);
+    return true;
+}
+
+// @brief Returns a rough upper bound of the DC bus current that the given state
+// draws [A], or 0 if it is not a calibration state.
+// The calibration states are dominated by resistive losses at low speed.
+// Note that phase currents are amplitudes, hence the factor 3/2 for the power.
+float Axis::calibration_bus_current(AxisState state) {
+    float vbus = std::max(vbus_voltage_filtered, 1.0f);
+    switch (state) {
+        case AXIS_STATE_MOTOR_CALIBRATION: {
+            // The measurement voltage is limited to resistance_calib_max_voltage
+            return 1.5f * motor_.config_.calibration_current * motor_.config_.resistance_calib_max_voltage / vbus;
+        }
+        case AXIS_STATE_ENCODER_INDEX_SEARCH:
+        case AXIS_STATE_ENCODER_DIR_FIND:
+        case AXIS_STATE_ENCODER_OFFSET_CALIBRATION:
+        case AXIS_STATE_ENCODER_HALL_POLARITY_CALIBRATION:
+        case AXIS_STATE_ENCODER_HALL_PHASE_CALIBRATION:
+        case AXIS_STATE_ENCODER_ECCENTRICITY_CALIBRATION:
+        case AXIS_STATE_ENCODER_SINCOS_CALIBRATION: {
+            float current = config_.calibration_lockin.current;
+            return 1.5f * current * current * motor_.config_.phase_resistance / vbus;
+        }
+        case AXIS_STATE_FLUX_LINKAGE_CALIBRATION: {
+            float current = config_.sensorless_ramp.current;
+            return 1.5f * current * current * motor_.config_.phase_resistance / vbus;
+        }
+        case AXIS_STATE_CALIBRATION_CHECK: {
+            float current = config_.calibration_check.current;
+            return 1.5f * current * current * motor_.config_.phase_resistance / vbus;
+        }
+        default: {
+            return 0.0f;
+        }
+    }
+}
+
+// @brief Blocks until the bus current of a calibration state can be reserved.
+// Returns false if a new state was requested in the meantime.
+bool Axis::wait_for_calibration_bus_current(float bus_current) {
+    if (bus_current <= 0.0f) {
+        return true;
+    }
+
+    uint32_t start_us = micros();
+    while (!odrv.reserve_calibration_bus_current(bus_current)) {
+        if (requested_state_ != AXIS_STATE_UNDEFINED) {
+            return false;
+        }
+        wait_for_state_event(1);
+    }
+    calibration_times_.bus_current_wait = (float)(micros() - start_us) * 1e-6f;
+    return true;
+}
+
+void Axis::record_calibration_time(AxisState state, float duration) {
+    switch (state) {
+        case AXIS_STATE_MOTOR_CALIBRATION: calibration_times_.motor_calibration = duration; break;
+        case AXIS_STATE_ENCODER_INDEX_SEARCH: calibration_times_.encoder_index_search = duration; break;
+        case AXIS_STATE_ENCODER_OFFSET_CALIBRATION: calibration_times_.encoder_offset_calibration = duration; break;
+        case AXIS_STATE_ENCODER_HALL_POLARITY_CALIBRATION: calibration_times_.encoder_hall_polarity_calibration = duration; break;
+        case AXIS_STATE_ENCODER_HALL_PHASE_CALIBRATION: calibration_times_.encoder_hall_phase_calibration = duration; break;
+        case AXIS_STATE_ENCODER_DIR_FIND: calibration_times_.encoder_dir_find = duration; break;
+        case AXIS_STATE_ENCODER_ECCENTRICITY_CALIBRATION: calibration_times_.encoder_eccentricity_calibration = duration; break;
+        case AXIS_STATE_ENCODER_SINCOS_CALIBRATION: calibration_times_.encoder_sincos_calibration = duration; break;
+        case AXIS_STATE_FLUX_LINKAGE_CALIBRATION: calibration_times_.flux_linkage_calibration = duration; break;
+        case AXIS_STATE_CALIBRATION_CHECK: calibration_times_.calibration_check = duration; break;
+        default: break;
+    }
+}
+
+// @brief Waits for up to 2s for all motors to become ready to allow for
+// error-free startup. This delay gives the current sensor calibration time to
+// converge. If the DRV chip is unpowered, the motor will not become ready but
+// we still enter idle state.
+void Axis::wait_for_current_meas() {
+    for (size_t i = 0; i < 2000; ++i) {
+        bool motors_ready = std::all_of(axes.begin(), axes.end(), [](auto& axis) {
+            return axis.motor_.sample_.read().current_meas.has_value();
+        });
+        if (motors_ready) {
+            break;
+        }
+        osDelay(1);
+    }
+
+    sensorless_estimator_.error_ &= ~SensorlessEstimator::ERROR_UNKNOWN_CURRENT_MEASUREMENT;
+
+    BootTimes_t& boot = odrv.system_stats_.boot;
+    CRITICAL_SECTION() {
+        if (!boot.current_meas_ready) {
+            boot.current_meas_ready = micros();
+        }
+    }
+}
+
 // Infinite loop that does calibration and enters main control loop as appropriate
 void Axis::run_state_machine_loop() {
+    wait_for_current_meas();
+
     for (;;) {
         // Load the task chain if a specific request is pending
         if (requested_state_ != AXIS_STATE_UNDEFINED) {
             size_t pos = 0;
             if (requested_state_ == AXIS_STATE_STARTUP_SEQUENCE) {
-                if (config_.startup_motor_calibration)
+                // With the check, the calibrations of pre-calibrated values
+                // only run if the check fails (see run_calibration_check())
+                bool check = config_.startup_calibration_check;
+                if (config_.startup_motor_calibration && !(check && motor_.is_calibrated_))
                     task_chain_[pos++] = AXIS_STATE_MOTOR_CALIBRATION;
                 if (config_.startup_encoder_index_search && encoder_.config_.use_index)
                     task_chain_[pos++] = AXIS_STATE_ENCODER_INDEX_SEARCH;
-                if (config_.startup_encoder_offset_calibration)
+                if (check)
+                    task_chain_[pos++] = AXIS_STATE_CALIBRATION_CHECK;
+                else if (config_.startup_encoder_offset_calibration)
                     task_chain_[pos++] = AXIS_STATE_ENCODER_OFFSET_CALIBRATION;
                 if (config_.startup_homing)
                     task_chain_[pos++] = AXIS_STATE_HOMING;
@@ -489,9 +988,19 @@ void Axis::run_state_machine_loop() {
 
         // Note that current_state is a reference to task_chain_[0]
 
+        // Calibration states of several axes may run at the same time as long
+        // as their combined bus current stays within the budget.
+        bool status;
+        float bus_current = calibration_bus_current(current_state_);
+        if (!wait_for_calibration_bus_current(bus_current)) {
+            status = false; // a new state was requested while waiting
+            goto state_done_label;
+        }
+        uint32_t state_start_us;
+        state_start_us = micros();
+
         // Run the specified state
         // Handlers should exit if requested_state != AXIS_STATE_UNDEFINED
-        bool status;
         switch (current_state_) {
             case AXIS_STATE_MOTOR_CALIBRATION: {
                 // These error checks are a hacky way to force legacy behavior
@@ -535,12 +1044,35 @@ void Axis::run_state_machine_loop() {
                 if (!motor_.is_calibrated_)
                     goto invalid_state_label;
 
-                if (!encoder_.config_.hall_polarity_calibrated) {
-                    encoder_.set_error(ODriveIntf::EncoderIntf::ERROR_HALL_NOT_CALIBRATED_YET);
+                status = encoder_.run_hall_phase_calibration();
+            } break;
+
+            case AXIS_STATE_ENCODER_ECCENTRICITY_CALIBRATION: {
+                if (!motor_.is_calibrated_)
                     goto invalid_state_label;
-                }
 
-                status = encoder_.run_hall_phase_calibration();
+                status = encoder_.run_eccentricity_calibration();
+            } break;
+
+            case AXIS_STATE_ENCODER_SINCOS_CALIBRATION: {
+                if (!motor_.is_calibrated_)
+                    goto invalid_state_label;
+
+                status = encoder_.run_sincos_calibration();
+            } break;
+
+            case AXIS_STATE_FLUX_LINKAGE_CALIBRATION: {
+                if (!motor_.is_calibrated_)
+                    goto invalid_state_label;
+
+                status = run_flux_linkage_calibration();
+            } break;
+
+            case AXIS_STATE_CALIBRATION_CHECK: {
+                if (!motor_.is_calibrated_)
+                    goto invalid_state_label;
+
+                status = run_calibration_check();
             } break;
 
             case AXIS_STATE_HOMING: {
@@ -575,6 +1107,9 @@ void Axis::run_state_machine_loop() {
                 if (!motor_.is_calibrated_ || (encoder_.config_.direction==0 && !config_.enable_sensorless_mode))
                     goto invalid_state_label;
                 watchdog_feed();
+                if (!odrv.system_stats_.boot.closed_loop) {
+                    odrv.system_stats_.boot.closed_loop = micros();
+                }
                 status = run_closed_loop_control_loop();
             } break;
 
@@ -590,6 +1125,12 @@ void Axis::run_state_machine_loop() {
                 break;
         }
 
+        if (bus_current > 0.0f) {
+            odrv.release_calibration_bus_current(bus_current);
+            record_calibration_time(current_state_, (float)(micros() - state_start_us) * 1e-6f);
+        }
+
+    state_done_label:
         // If the state failed, go to idle, else advance task chain
         if (!status) {
             std::fill(task_chain_.begin(), task_chain_.end(), AXIS_STATE_UNDEFINED);
@@ -6,9 +6,12 @@ class Axis;
 #include "encoder.hpp"
 #include "acim_estimator.hpp"
 #include "sensorless_estimator.hpp"
+#include "fused_estimator.hpp"
+#include "hfi_estimator.hpp"
 #include "controller.hpp"
 #include "open_loop_controller.hpp"
 #include "trapTraj.hpp"
+#include "scurve_traj.hpp"
 #include "endstop.hpp"
 #include "mechanical_brake.hpp"
 #include "low_level.h"
@@ -16,6 +19,7 @@ class Axis;
 #include "task_timer.hpp"
 
 #include <array>
+#include <fibre/callback.hpp>
 
 class Axis : public ODriveIntf::AxisIntf {
 public:
@@ -29,15 +33,21 @@ public:
         bool finish_on_vel = false;
         bool finish_on_distance = false;
         bool finish_on_enc_idx = false;
+        bool finish_on_sensorless_convergence = false; // at least at 10% of vel and in sync with the sensorless estimator
     };
 
     struct TaskTimes {
         TaskTimer thermistor_update;
         TaskTimer encoder_update;
         TaskTimer sensorless_estimator_update;
+        TaskTimer fused_estimator_update;
+        TaskTimer hfi_estimator_update;
         TaskTimer endstop_update;
         TaskTimer can_heartbeat;
         TaskTimer controller_update;
+        TaskTimer controller_update_position; // part of controller_update in each control mode
+        TaskTimer controller_update_velocity;
+        TaskTimer controller_update_torque; // also voltage control
         TaskTimer open_loop_controller_update;
         TaskTimer acim_estimator_update;
         TaskTimer motor_update;
@@ -47,6 +57,37 @@ public:
         TaskTimer pwm_update;
     };
 
+    // Durations of the calibration states the last time they ran [s]
+    struct CalibrationTimes_t {
+        float motor_calibration = 0.0f;
+        float encoder_index_search = 0.0f;
+        float encoder_offset_calibration = 0.0f;
+        float encoder_hall_polarity_calibration = 0.0f;
+        float encoder_hall_phase_calibration = 0.0f;
+        float encoder_dir_find = 0.0f;
+        float encoder_eccentricity_calibration = 0.0f;
+        float encoder_sincos_calibration = 0.0f;
+        float flux_linkage_calibration = 0.0f;
+        float calibration_check = 0.0f;
+        float bus_current_wait = 0.0f; // spent waiting for the combined calibration bus current budget
+    };
+
+    // Probe of AXIS_STATE_CALIBRATION_CHECK
+    struct CalibrationCheckConfig_t {
+        float current = 5.0f;              // [A] along the d axis according to the encoder
+        float duration = 0.1f;             // [s]
+        float max_resistance_error = 0.3f; // relative to motor.config.phase_resistance
+        float max_offset_error = 0.2f;     // [rad] electrical rotor movement during the probe
+    };
+
+    // Result of the last AXIS_STATE_CALIBRATION_CHECK
+    struct CalibrationCheck_t {
+        float resistance = NAN;   // [Ohm]
+        float offset_error = NAN; // [rad] NAN if the encoder wasn't ready
+        bool motor_passed = false;
+        bool encoder_passed = false;
+    };
+
     static LockinConfig_t default_calibration();
     static LockinConfig_t default_sensorless();
     static LockinConfig_t default_lockin();
@@ -64,6 +105,22 @@ public:
         uint32_t iq_rate_ms = 0;
         uint32_t sensorless_rate_ms = 0;
         uint32_t bus_vi_rate_ms = 0;
+        bool enable_events = false;  // send an event message when a trajectory finishes, the state changes or an error occurs
+
+        // custom setters that update the CAN schedule
+        Axis* parent = nullptr;
+        void set_node_id(uint32_t value) { node_id = value; parent->on_can_config_changed(); }
+        void set_is_extended(bool value) { is_extended = value; parent->on_can_config_changed(); }
+        void set_heartbeat_rate_ms(uint32_t value) { heartbeat_rate_ms = value; parent->on_can_config_changed(); }
+        void set_encoder_rate_ms(uint32_t value) { encoder_rate_ms = value; parent->on_can_config_changed(); }
+        void set_motor_error_rate_ms(uint32_t value) { motor_error_rate_ms = value; parent->on_can_config_changed(); }
+        void set_encoder_error_rate_ms(uint32_t value) { encoder_error_rate_ms = value; parent->on_can_config_changed(); }
+        void set_controller_error_rate_ms(uint32_t value) { controller_error_rate_ms = value; parent->on_can_config_changed(); }
+        void set_sensorless_error_rate_ms(uint32_t value) { sensorless_error_rate_ms = value; parent->on_can_config_changed(); }
+        void set_encoder_count_rate_ms(uint32_t value) { encoder_count_rate_ms = value; parent->on_can_config_changed(); }
+        void set_iq_rate_ms(uint32_t value) { iq_rate_ms = value; parent->on_can_config_changed(); }
+        void set_sensorless_rate_ms(uint32_t value) { sensorless_rate_ms = value; parent->on_can_config_changed(); }
+        void set_bus_vi_rate_ms(uint32_t value) { bus_vi_rate_ms = value; parent->on_can_config_changed(); }
     };
 
     struct Config_t {
@@ -73,6 +130,7 @@ public:
         bool startup_encoder_offset_calibration = false; //<! run encoder offset calibration after startup, skip otherwise
         bool startup_closed_loop_control = false; //<! enable closed loop control after calibration/startup
         bool startup_homing = false; //<! enable homing after calibration/startup
+        bool startup_calibration_check = false; //<! check the pre-calibrated values at startup and only calibrate what failed
 
         bool enable_step_dir = false; //<! enable step/dir input after calibration
                                     //   For M0 this has no effect if enable_uart is true
@@ -82,6 +140,8 @@ public:
                                          //<! into idle or out of closed loop control.
 
         bool enable_sensorless_mode = false;
+        bool enable_sensor_fusion = false; //<! blend the encoder with the sensorless estimator at high speed
+        bool enable_hfi = false; //<! in sensorless mode, start with high frequency injection instead of the lock-in spin
 
         float watchdog_timeout = 0.0f; // [s]
         bool enable_watchdog = false;
@@ -93,6 +153,7 @@ public:
         LockinConfig_t calibration_lockin = default_calibration();
         LockinConfig_t sensorless_ramp = default_sensorless();
         LockinConfig_t general_lockin;
+        CalibrationCheckConfig_t calibration_check;
 
         CANConfig_t can;
 
@@ -107,16 +168,18 @@ public:
     };
 
     struct CAN_t {
-        uint32_t last_heartbeat = 0;
-        uint32_t last_encoder = 0;
-        uint32_t last_motor_error = 0;
-        uint32_t last_encoder_error = 0;
-        uint32_t last_controller_error = 0;
-        uint32_t last_sensorless_error = 0;
-        uint32_t last_encoder_count = 0;
-        uint32_t last_iq = 0;
-        uint32_t last_sensorless = 0;
-        uint32_t last_bus_vi = 0;
+        // Set by the control loop, taken by the CAN thread
+        volatile uint32_t pending_events = 0;
+        // Conditions of the previous control loop iteration
+        bool event_trajectory_done = true;
+        bool event_error = false;
+        AxisState event_state = AXIS_STATE_UNDEFINED;
+    };
+
+    enum Event_t : uint32_t {
+        EVENT_TRAJECTORY_DONE = 1 << 0,
+        EVENT_STATE_CHANGED = 1 << 1,
+        EVENT_ERROR = 1 << 2,
     };
 
     Axis(int axis_num,
@@ -136,17 +199,48 @@ public:
     void clear_config();
 
     void start_thread();
-    bool wait_for_control_iteration();
+    bool wait_for_control_iteration() { return wait_for_control_iterations(1); }
+    bool wait_for_control_iterations(uint32_t n);
+    void wait_for_state_event(uint32_t timeout_ms);
+    void request_state(AxisState state);
+    void control_iteration_done_cb();
+    void detect_events();
 
     void step_cb();
+    void dir_cb();
+    bool start_step_counter();
+    void stop_step_counter();
     void set_step_dir_active(bool enable);
     void decode_step_dir_pins();
+    void on_can_config_changed();
 
     bool do_checks(uint32_t timestamp);
+    void check_endstops();
 
     void watchdog_feed();
     bool watchdog_check();
 
+    // Components that only need to run while one of their outputs is wired
+    // to a consumer. Evaluated every control loop iteration from the current
+    // connections, so they follow every state and mode change.
+    bool sensorless_estimator_in_use();
+    bool open_loop_controller_in_use();
+    bool acim_estimator_in_use();
+
+    // @brief Adds the steps counted by the hardware step counter since the
+    // last call to steps_.
+    void read_step_counter() {
+        if (step_counter_) {
+            uint16_t count = (uint16_t)step_counter_->CNT;
+            int16_t delta = (int16_t)(count - step_counter_last_);
+            step_counter_last_ = count;
+            if (delta) {
+                steps_ += delta;
+                controller_.input_pos_updated();
+            }
+        }
+    }
+
     // True if there are no errors
     bool inline check_for_errors() {
         return error_ == ERROR_NONE;
@@ -155,12 +249,19 @@ public:
     bool start_closed_loop_control();
     bool stop_closed_loop_control();
     bool run_lockin_spin(const LockinConfig_t &lockin_config, bool remain_armed,
-                std::function<bool(bool)> loop_cb = {} );
+                fibre::Callback<bool, bool> loop_cb = nullptr);
+    bool run_hfi_startup();
+    bool run_flux_linkage_calibration();
     bool run_closed_loop_control_loop();
     bool run_homing();
     bool run_idle_loop();
+    bool run_calibration_check();
+    float calibration_bus_current(AxisState state);
+    bool wait_for_calibration_bus_current(float bus_current);
+    void wait_for_current_meas();
+    void record_calibration_time(AxisState state, float duration);
 
-    constexpr uint32_t get_watchdog_reset() {
+    uint32_t get_watchdog_reset() {
         return static_cast<uint32_t>(std::clamp<float>(config_.watchdog_timeout, 0, UINT32_MAX / (current_meas_hz + 1)) * current_meas_hz);
     }
 
@@ -176,23 +277,41 @@ public:
     Encoder& encoder_;
     AcimEstimator acim_estimator_;
     SensorlessEstimator& sensorless_estimator_;
+    FusedEstimator fused_estimator_;
+    HfiEstimator hfi_estimator_;
     Controller& controller_;
     OpenLoopController open_loop_controller_;
     Motor& motor_;
     TrapezoidalTrajectory& trap_traj_;
+    SCurveTrajectory scurve_traj_;
     Endstop& min_endstop_;
     Endstop& max_endstop_;
     MechanicalBrake& mechanical_brake_;
     TaskTimes task_times_;
+    CalibrationTimes_t calibration_times_;
+    CalibrationCheck_t calibration_check_;
 
     osThreadId thread_id_ = 0;
-    const uint32_t stack_size_ = 2048; // Bytes
+    static constexpr uint32_t stack_size_ = 2048; // Bytes
     volatile bool thread_id_valid_ = false;
+    // Number of control loop iterations that still need to finish before the
+    // axis thread is signalled. 0 means the thread is not waiting. Only set
+    // by the axis thread while it is 0 and only decremented by the control
+    // loop while it is non-zero.
+    volatile uint32_t wakeup_countdown_ = 0;
+    bool was_armed_ = false; // only used by control_iteration_done_cb()
+    bool sensorless_estimator_running_ = false; // only used by the control loop
+
+    // Thread signals of the axis thread
+    static constexpr int32_t SIGNAL_CONTROL_ITERATION = 0x0001; // see wait_for_control_iterations()
+    static constexpr int32_t SIGNAL_STATE_EVENT = 0x0002; // see wait_for_state_event()
 
     // variables exposed on protocol
     Error error_ = ERROR_NONE;
     bool step_dir_active_ = false; // auto enabled after calibration, based on config.enable_step_dir
     int64_t steps_ = 0; // Steps counted at interface
+    TIM_TypeDef* step_counter_ = nullptr; // timer counting the steps if the step GPIO is in GPIO_MODE_STEP_COUNTER
+    uint16_t step_counter_last_ = 0; // count at the last read_step_counter()
     uint32_t last_drv_fault_ = 0;
 
     // updated from config in constructor, and on protocol hook
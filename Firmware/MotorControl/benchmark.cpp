@@ -0,0 +1,223 @@
+
+#include "odrive_main.h"
+#include "foc.hpp"
+#include "trap_tracker.hpp"
+
+// Upper bound for the number of runs, which block the calling protocol thread
+static constexpr uint32_t kMaxBenchmarkRuns = 100000;
+
+// @brief Forces the compiler to materialize v at this point, such that the
+// computation of a kernel can't move out of the measured interval.
+template<typename T>
+static inline void benchmark_barrier(T& v) {
+    static_assert(sizeof(T) <= 4, "only scalars");
+    asm volatile("" : "+r"(v));
+}
+
+// @brief Cheap pseudo random inputs in [-1, 1), so that the kernels don't
+// always take the same branches
+static inline float next_input(uint32_t& state) {
+    state = state * 1664525UL + 1013904223UL;
+    return (float)(int32_t)state * (1.0f / 2147483648.0f);
+}
+
+/**
+ * @brief Runs one of the hot path kernels n times and measures each run with
+ * the DWT cycle counter.
+ *
+ * Every run executes with interrupts disabled, so the numbers don't include
+ * preemption by the control loop. The cost of the measurement itself is
+ * subtracted. The inputs change from run to run, and for FOC they are those
+ * of a running motor in current control mode.
+ *
+ * @returns {min, mean, max} [cycles], all zero for an invalid request.
+ */
+std::tuple<uint32_t, uint32_t, uint32_t> ODrive::run_benchmark(BenchmarkKernel kernel, uint32_t n) {
+    // TRAP_TRACK is the last value of the enum
+    if (!n || n > kMaxBenchmarkRuns || kernel < BENCHMARK_KERNEL_SVM || kernel > BENCHMARK_KERNEL_TRAP_TRACK) {
+        return {0, 0, 0};
+    }
+
+    static FieldOrientedController foc; // static because the protocol threads have small stacks
+    if (kernel == BENCHMARK_KERNEL_FOC) {
+        foc.reset();
+        foc.pi_gains_ = {0.05f, 50.0f};
+        foc.enable_current_control_ = true;
+        foc.Idq_setpoint_ = {0.0f, 5.0f};
+        foc.Vdq_setpoint_ = {0.0f, 1.0f};
+        foc.phase_vel_ = 1000.0f;
+        foc.vbus_voltage_measured_ = 24.0f;
+        foc.ctrl_timestamp_ = 0;
+        foc.i_timestamp_ = 0;
+    }
+
+    // Planned with the default limits of the axis config, the evaluation
+    // kernels sample the whole move
+    static TrapezoidalTrajectory trap;
+    static SCurveTrajectory scurve;
+    const TrapezoidalTrajectory::Config_t limits;
+    if (kernel == BENCHMARK_KERNEL_TRAP_EVAL) {
+        trap.planTrapezoidal(1.0f, 0.0f, 0.0f, limits.vel_limit, limits.accel_limit, limits.decel_limit);
+    } else if (kernel == BENCHMARK_KERNEL_SCURVE_EVAL) {
+        scurve.plan(1.0f, 0.0f, 0.0f, limits.vel_limit, limits.accel_limit, limits.decel_limit, limits.jerk_limit);
+    }
+
+    // Cost of an empty measurement
+    uint32_t overhead = UINT32_MAX;
+    for (size_t i = 0; i < 16; ++i) {
+        CRITICAL_SECTION() {
+            uint32_t start = DWT->CYCCNT;
+            overhead = std::min(overhead, DWT->CYCCNT - start);
+        }
+    }
+
+    uint32_t min = UINT32_MAX;
+    uint32_t max = 0;
+    uint64_t sum = 0;
+    uint32_t rng = 1;
+
+    for (uint32_t i = 0; i < n; ++i) {
+        float x = next_input(rng);
+        float y = next_input(rng);
+        uint32_t cycles = 0;
+
+        CRITICAL_SECTION() {
+            switch (kernel) {
+                case BENCHMARK_KERNEL_SVM: {
+                    x *= 0.5f; // within the linear range
+                    y *= 0.5f;
+                    uint32_t start = DWT->CYCCNT;
+                    benchmark_barrier(x);
+                    benchmark_barrier(y);
+                    auto [tA, tB, tC, success] = SVM(x, y);
+                    benchmark_barrier(tA);
+                    benchmark_barrier(tB);
+                    benchmark_barrier(tC);
+                    benchmark_barrier(success);
+                    cycles = DWT->CYCCNT - start;
+                } break;
+
+                case BENCHMARK_KERNEL_FAST_ATAN2: {
+                    uint32_t start = DWT->CYCCNT;
+                    benchmark_barrier(x);
+                    benchmark_barrier(y);
+                    float result = fast_atan2(y, x);
+                    benchmark_barrier(result);
+                    cycles = DWT->CYCCNT - start;
+                } break;
+
+                case BENCHMARK_KERNEL_SIN: {
+                    x *= (float)M_PI;
+                    uint32_t start = DWT->CYCCNT;
+                    benchmark_barrier(x);
+                    float result = our_arm_sin_f32(x);
+                    benchmark_barrier(result);
+                    cycles = DWT->CYCCNT - start;
+                } break;
+
+                case BENCHMARK_KERNEL_COS: {
+                    x *= (float)M_PI;
+                    uint32_t start = DWT->CYCCNT;
+                    benchmark_barrier(x);
+                    float result = our_arm_cos_f32(x);
+                    benchmark_barrier(result);
+                    cycles = DWT->CYCCNT - start;
+                } break;
+
+                case BENCHMARK_KERNEL_SIN_COS: {
+                    x *= (float)M_PI;
+                    float s, c;
+                    uint32_t start = DWT->CYCCNT;
+                    benchmark_barrier(x);
+                    our_arm_sin_cos_f32(x, &s, &c);
+                    benchmark_barrier(s);
+                    benchmark_barrier(c);
+                    cycles = DWT->CYCCNT - start;
+                } break;
+
+                case BENCHMARK_KERNEL_FOC: {
+                    foc.phase_ = x * (float)M_PI;
+                    foc.Ialpha_beta_measured_ = float2D{5.0f * y, 5.0f * x};
+                    std::optional<float2D> mod_alpha_beta;
+                    std::optional<float> ibus;
+                    uint32_t start = DWT->CYCCNT;
+                    bool ok = foc.get_alpha_beta_output(0, &mod_alpha_beta, &ibus) == Motor::ERROR_NONE;
+                    benchmark_barrier(ok);
+                    cycles = DWT->CYCCNT - start;
+                } break;
+
+                case BENCHMARK_KERNEL_TRAP_PLAN: {
+                    // Goals and initial velocities in both directions, which
+                    // yields triangles, trapezoids and overspeed moves
+                    float goal = 2.0f * x;
+                    float vel = limits.vel_limit * y;
+                    uint32_t start = DWT->CYCCNT;
+                    benchmark_barrier(goal);
+                    benchmark_barrier(vel);
+                    trap.planTrapezoidal(goal, 0.0f, vel, limits.vel_limit, limits.accel_limit, limits.decel_limit);
+                    benchmark_barrier(trap.Tf_);
+                    cycles = DWT->CYCCNT - start;
+                } break;
+
+                case BENCHMARK_KERNEL_TRAP_EVAL: {
+                    float t = (0.5f * x + 0.5f) * trap.Tf_;
+                    uint32_t start = DWT->CYCCNT;
+                    benchmark_barrier(t);
+                    TrapezoidalTrajectory::Step_t step = trap.eval(t);
+                    benchmark_barrier(step.Y);
+                    benchmark_barrier(step.Yd);
+                    benchmark_barrier(step.Ydd);
+                    cycles = DWT->CYCCNT - start;
+                } break;
+
+                case BENCHMARK_KERNEL_SCURVE_PLAN: {
+                    float goal = 2.0f * x;
+                    float vel = limits.vel_limit * y;
+                    uint32_t start = DWT->CYCCNT;
+                    benchmark_barrier(goal);
+                    benchmark_barrier(vel);
+                    scurve.plan(goal, 0.0f, vel, limits.vel_limit, limits.accel_limit, limits.decel_limit, limits.jerk_limit);
+                    benchmark_barrier(scurve.Tf_);
+                    cycles = DWT->CYCCNT - start;
+                } break;
+
+                case BENCHMARK_KERNEL_SCURVE_EVAL: {
+                    // Random times defeat the segment cache, so this is the
+                    // worst case of the search
+                    float t = (0.5f * x + 0.5f) * scurve.Tf_;
+                    uint32_t start = DWT->CYCCNT;
+                    benchmark_barrier(t);
+                    SCurveTrajectory::Step_t step = scurve.eval(t);
+                    benchmark_barrier(step.Y);
+                    benchmark_barrier(step.Yd);
+                    benchmark_barrier(step.Ydd);
+                    cycles = DWT->CYCCNT - start;
+                } break;
+
+                case BENCHMARK_KERNEL_TRAP_TRACK: {
+                    // Same inputs as TRAP_PLAN, to be compared per update
+                    float goal = 2.0f * x;
+                    float vel = limits.vel_limit * y;
+                    uint32_t start = DWT->CYCCNT;
+                    benchmark_barrier(goal);
+                    benchmark_barrier(vel);
+                    TrapTracker::Step_t step = TrapTracker::step(goal, vel, limits.vel_limit, limits.accel_limit,
+                                                                 limits.decel_limit, current_meas_period);
+                    benchmark_barrier(step.dY);
+                    benchmark_barrier(step.Yd);
+                    benchmark_barrier(step.Ydd);
+                    cycles = DWT->CYCCNT - start;
+                } break;
+
+                default: break;
+            }
+        }
+
+        cycles = cycles > overhead ? cycles - overhead : 0;
+        min = std::min(min, cycles);
+        max = std::max(max, cycles);
+        sum += cycles;
+    }
+
+    return {min, (uint32_t)(sum / n), max};
+}
@@ -0,0 +1,78 @@
+#ifndef __BIQUAD_HPP
+#define __BIQUAD_HPP
+
+#include <cmath>
+
+/**
+ * @brief Second order IIR filter section in transposed direct form II.
+ *
+ * The coefficients follow the bilinear transform designs of the "Audio EQ
+ * Cookbook" and are normalized such that a0 = 1. The default section passes
+ * its input through unchanged.
+ */
+struct Biquad {
+    float b0 = 1.0f;
+    float b1 = 0.0f;
+    float b2 = 0.0f;
+    float a1 = 0.0f;
+    float a2 = 0.0f;
+
+    float z1 = 0.0f;
+    float z2 = 0.0f;
+
+    float process(float x) {
+        float y = b0 * x + z1;
+        z1 = b1 * x - a1 * y + z2;
+        z2 = b2 * x - a2 * y;
+        return y;
+    }
+
+    void reset() {
+        z1 = 0.0f;
+        z2 = 0.0f;
+    }
+
+    // @brief Starts in the steady state for a constant input x. Only valid
+    // for sections with unity DC gain.
+    void reset(float x) {
+        z2 = (b2 - a2) * x;
+        z1 = (b1 - a1) * x + z2;
+    }
+
+    // @brief Designs a section. Returns false if f0 is not below Nyquist or
+    // q is not positive.
+    static bool design_lowpass(float f0, float q, float fs, Biquad* out) {
+        float c, alpha;
+        if (!prewarp(f0, q, fs, &c, &alpha)) {
+            return false;
+        }
+        normalize((1.0f - c) * 0.5f, 1.0f - c, (1.0f - c) * 0.5f, 1.0f + alpha, -2.0f * c, 1.0f - alpha, out);
+        return true;
+    }
+
+    static bool design_notch(float f0, float q, float fs, Biquad* out) {
+        float c, alpha;
+        if (!prewarp(f0, q, fs, &c, &alpha)) {
+            return false;
+        }
+        normalize(1.0f, -2.0f * c, 1.0f, 1.0f + alpha, -2.0f * c, 1.0f - alpha, out);
+        return true;
+    }
+
+private:
+    static bool prewarp(float f0, float q, float fs, float* c, float* alpha) {
+        if (!(f0 > 0.0f) || !(f0 < 0.5f * fs) || !(q > 0.0f)) {
+            return false;
+        }
+        float w0 = 2.0f * (float)M_PI * f0 / fs;
+        *c = std::cos(w0);
+        *alpha = std::sin(w0) / (2.0f * q);
+        return true;
+    }
+
+    static void normalize(float b0, float b1, float b2, float a0, float a1, float a2, Biquad* out) {
+        *out = {b0 / a0, b1 / a0, b2 / a0, a1 / a0, a2 / a0};
+    }
+};
+
+#endif // __BIQUAD_HPP
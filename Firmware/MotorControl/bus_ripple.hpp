@@ -0,0 +1,138 @@
+#ifndef __BUS_RIPPLE_HPP
+#define __BUS_RIPPLE_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <algorithm>
+#include <cmath>
+#include <initializer_list>
+
+/**
+ * @brief Model of the DC link current that a center aligned PWM inverter
+ * draws during one PWM period, used to place the zero vectors of several
+ * inverters on the same DC link such that their current pulses overlap as
+ * little as possible.
+ *
+ * Time is in units of one PWM period (one full up-down count of the timer)
+ * starting at the bottom of the timer's triangle. A phase with the rising
+ * edge timing t as returned by SVM() is high from t / 2 to 1 - t / 2. The
+ * inverter draws the sum of the currents of the high phases, which gives
+ * two active vector segments on each side of the all-high zero vector.
+ *
+ * The capacitor RMS current is the RMS of the sum of all inverter currents
+ * minus its mean. Adding a common mode shift to the timings of one inverter
+ * moves its segments without changing their length, so neither the mean nor
+ * the inverter's own mean square change. Only the cross term with the other
+ * inverters does.
+ */
+struct InverterPwm_t {
+    float timings[3] = {0.5f, 0.5f, 0.5f}; // rising edge timings (0.0 - 1.0)
+    float currents[3] = {0.0f, 0.0f, 0.0f}; // [A] phase currents
+    float phase = 0.0f; // [PWM periods] lead of this inverter's triangle
+    bool active = false;
+};
+
+struct BusCurrentSegment_t {
+    float start; // [PWM periods] in [0, 1)
+    float end;   // [PWM periods] start + length
+    float current; // [A]
+};
+
+/**
+ * @brief Returns the four active vector segments of an inverter with the
+ * specified common mode shift subtracted from its timings, in the common
+ * time frame of all inverters.
+ */
+inline void inverter_bus_current_segments(const InverterPwm_t& inv, float shift,
+        BusCurrentSegment_t (&segments)[4]) {
+    // Order the phases by rising edge
+    size_t i0 = 0, i1 = 1, i2 = 2;
+    if (inv.timings[i1] < inv.timings[i0]) std::swap(i0, i1);
+    if (inv.timings[i2] < inv.timings[i1]) std::swap(i1, i2);
+    if (inv.timings[i1] < inv.timings[i0]) std::swap(i0, i1);
+    float t0 = 0.5f * (inv.timings[i0] - shift);
+    float t1 = 0.5f * (inv.timings[i1] - shift);
+    float t2 = 0.5f * (inv.timings[i2] - shift);
+    float I_first = inv.currents[i0];
+    float I_first_two = inv.currents[i0] + inv.currents[i1];
+
+    auto wrap = [&](float t) {
+        t -= inv.phase;
+        return t - std::floor(t);
+    };
+    segments[0] = {wrap(t0), wrap(t0) + (t1 - t0), I_first};
+    segments[1] = {wrap(t1), wrap(t1) + (t2 - t1), I_first_two};
+    segments[2] = {wrap(1.0f - t2), wrap(1.0f - t2) + (t2 - t1), I_first_two};
+    segments[3] = {wrap(1.0f - t1), wrap(1.0f - t1) + (t1 - t0), I_first};
+}
+
+/**
+ * @brief Returns the mean over one PWM period of the product of the DC link
+ * currents of two inverters [A^2]. The shift is applied to the first one.
+ */
+inline float inverter_bus_current_correlation(const InverterPwm_t& a, float shift, const InverterPwm_t& b) {
+    BusCurrentSegment_t seg_a[4];
+    BusCurrentSegment_t seg_b[4];
+    inverter_bus_current_segments(a, shift, seg_a);
+    inverter_bus_current_segments(b, 0.0f, seg_b);
+
+    float result = 0.0f;
+    for (const BusCurrentSegment_t& sa : seg_a) {
+        for (const BusCurrentSegment_t& sb : seg_b) {
+            // Both segments are shorter than one period, so the overlap on
+            // the circle is covered by these three wraps
+            float overlap = 0.0f;
+            for (float k : {-1.0f, 0.0f, 1.0f}) {
+                overlap += std::max(std::min(sa.end, sb.end + k) - std::max(sa.start, sb.start + k), 0.0f);
+            }
+            result += overlap * sa.current * sb.current;
+        }
+    }
+    return result;
+}
+
+/**
+ * @brief Returns the common mode shift that minimizes the DC link capacitor
+ * RMS current when subtracted from the timings of `self`, given the other
+ * inverters on the same DC link.
+ *
+ * The shift keeps both zero vectors at least `min_margin` long (in PWM
+ * periods), because the current sensors need them. If the timings already
+ * violate this, the shift is zero.
+ *
+ * @param n_candidates: Number of evenly spaced shifts that are evaluated.
+ */
+inline float best_zero_vector_shift(const InverterPwm_t& self,
+        const InverterPwm_t* others, size_t n_others, float min_margin, size_t n_candidates) {
+    float t_min = std::min({self.timings[0], self.timings[1], self.timings[2]});
+    float t_max = std::max({self.timings[0], self.timings[1], self.timings[2]});
+    float shift_max = t_min - min_margin;         // all-low zero vector
+    float shift_min = t_max - 1.0f + min_margin;  // all-high zero vector
+    if (!(shift_min <= 0.0f && shift_max >= 0.0f) || n_candidates < 2) {
+        return 0.0f;
+    }
+
+    auto cost = [&](float shift) {
+        float sum = 0.0f;
+        for (size_t i = 0; i < n_others; ++i) {
+            if (others[i].active) {
+                sum += inverter_bus_current_correlation(self, shift, others[i]);
+            }
+        }
+        return sum;
+    };
+
+    float best_shift = 0.0f;
+    float best_cost = cost(0.0f);
+    for (size_t i = 0; i < n_candidates; ++i) {
+        float shift = shift_min + (shift_max - shift_min) * (float)i / (float)(n_candidates - 1);
+        float c = cost(shift);
+        if (c < best_cost) {
+            best_cost = c;
+            best_shift = shift;
+        }
+    }
+    return best_shift;
+}
+
+#endif // __BUS_RIPPLE_HPP
@@ -0,0 +1,68 @@
+#ifndef __CAM_TABLE_HPP
+#define __CAM_TABLE_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <cmath>
+
+/**
+ * @brief Follower position over one period of a master position.
+ *
+ * The n points are spaced evenly over the master period, point i being the
+ * follower position at master position i * period / n. Between the points
+ * the follower moves along a Catmull-Rom spline, so the velocity is
+ * continuous. Beyond one period the table repeats, shifted by `rise` per
+ * period. A rise of zero gives a cyclic cam, other values give a gearing
+ * with a superimposed profile.
+ *
+ * The lookup doesn't search, so it takes the same time for any master
+ * position and table length.
+ */
+struct CamTable {
+    struct Output_t {
+        float pos;          // follower position
+        float slope;        // d(follower) / d(master)
+        float curvature;    // d^2(follower) / d(master)^2
+    };
+
+    static bool valid(size_t n, float period) {
+        return n >= 2 && period > 0.0f && std::isfinite(period);
+    }
+
+    static Output_t eval(const float* points, size_t n, float period, float rise, float master) {
+        float cycles = std::floor(master / period);
+        float x = (master - cycles * period) * ((float)n / period);
+        size_t i = (size_t)x;
+        if (i >= n) { // rounding at the end of the period
+            i = n - 1;
+        }
+        float s = x - (float)i;
+
+        // Neighbours across the ends of the period are shifted by the rise
+        auto point = [&](ptrdiff_t j) {
+            if (j < 0) {
+                return points[j + n] - rise;
+            } else if ((size_t)j >= n) {
+                return points[j - n] + rise;
+            }
+            return points[j];
+        };
+        float p0 = point((ptrdiff_t)i - 1);
+        float p1 = point((ptrdiff_t)i);
+        float p2 = point((ptrdiff_t)i + 1);
+        float p3 = point((ptrdiff_t)i + 2);
+
+        // Catmull-Rom: p1 + s*c1 + s^2*c2 + s^3*c3
+        float c1 = 0.5f * (p2 - p0);
+        float c2 = p0 - 2.5f * p1 + 2.0f * p2 - 0.5f * p3;
+        float c3 = 0.5f * (p3 - p0) + 1.5f * (p1 - p2);
+        float h = period / (float)n; // master distance between points
+        return {
+            p1 + s * (c1 + s * (c2 + s * c3)) + cycles * rise,
+            (c1 + s * (2.0f * c2 + s * 3.0f * c3)) / h,
+            (2.0f * c2 + s * 6.0f * c3) / (h * h)
+        };
+    }
+};
+
+#endif // __CAM_TABLE_HPP
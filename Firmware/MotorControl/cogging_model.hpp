@@ -0,0 +1,114 @@
+#ifndef __COGGING_MODEL_HPP
+#define __COGGING_MODEL_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <cmath>
+
+/**
+ * @brief Compact harmonic model of the cogging torque over one turn.
+ *
+ * The cogging torque of a motor is periodic with the mechanical angle and
+ * dominated by a few harmonics, typically multiples of the least common
+ * multiple of the slot and pole count. Instead of a table with hundreds or
+ * thousands of bins the model keeps only the strongest harmonics of a
+ * calibrated map:
+ *
+ *   torque(pos) = offset + sum(a * cos(2*pi*order*pos) + b * sin(2*pi*order*pos))
+ *
+ * with pos in turns.
+ */
+namespace cogging_model {
+
+static constexpr size_t MAX_HARMONICS = 16;
+
+struct Harmonic_t {
+    uint32_t order; // [1/turn]
+    float a;        // [Nm] cosine coefficient
+    float b;        // [Nm] sine coefficient
+};
+
+/**
+ * @brief Fits the max_count strongest harmonics to a map.
+ *
+ * Computes the discrete Fourier coefficients of every order up to the Nyquist
+ * order of the map. The sines and cosines of each order are generated by a
+ * rotation recurrence, so this takes map_size^2 / 2 multiply-adds. It is meant
+ * to run once after the calibration and not in the control loop.
+ *
+ * @param get: Callable that returns the torque of bin i in [0, map_size).
+ * @param harmonics: Receives the harmonics ordered by decreasing amplitude.
+ * @param offset: Receives the mean of the map.
+ * @returns The number of harmonics written, at most max_count.
+ */
+template<typename TGet>
+size_t fit(TGet get, uint32_t map_size, Harmonic_t* harmonics, size_t max_count, float* offset) {
+    if (map_size == 0) {
+        *offset = 0.0f;
+        return 0;
+    }
+
+    float sum = 0.0f;
+    for (uint32_t i = 0; i < map_size; ++i) {
+        sum += get(i);
+    }
+    *offset = sum / (float)map_size;
+
+    size_t count = 0;
+    for (uint32_t order = 1; order <= map_size / 2; ++order) {
+        float step = 2.0f * (float)M_PI * (float)order / (float)map_size;
+        float step_c = std::cos(step);
+        float step_s = std::sin(step);
+        float c = 1.0f, s = 0.0f;
+        float a = 0.0f, b = 0.0f;
+        for (uint32_t i = 0; i < map_size; ++i) {
+            float v = get(i);
+            a += v * c;
+            b += v * s;
+            float c_next = c * step_c - s * step_s;
+            s = s * step_c + c * step_s;
+            c = c_next;
+        }
+        a *= 2.0f / (float)map_size;
+        b *= 2.0f / (float)map_size;
+
+        // Insert into the list sorted by decreasing amplitude
+        float amplitude_sq = a * a + b * b;
+        size_t pos = count;
+        while (pos > 0 && amplitude_sq > harmonics[pos - 1].a * harmonics[pos - 1].a + harmonics[pos - 1].b * harmonics[pos - 1].b) {
+            if (pos < max_count) {
+                harmonics[pos] = harmonics[pos - 1];
+            }
+            pos--;
+        }
+        if (pos < max_count) {
+            harmonics[pos] = {order, a, b};
+            if (count < max_count) {
+                count++;
+            }
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Evaluates the model at pos_frac [turn] in [0, 1).
+ * @param sin_cos: Callable with the signature of our_arm_sin_cos_f32().
+ */
+template<typename TSinCos>
+float eval(const Harmonic_t* harmonics, size_t count, float offset, float pos_frac, TSinCos sin_cos) {
+    float torque = offset;
+    for (size_t i = 0; i < count; ++i) {
+        // Reduce before scaling to radians to keep the precision for high orders
+        float x = (float)harmonics[i].order * pos_frac;
+        x -= (float)(uint32_t)x;
+        float s, c;
+        sin_cos(2.0f * (float)M_PI * x, &s, &c);
+        torque += harmonics[i].a * c + harmonics[i].b * s;
+    }
+    return torque;
+}
+
+}
+
+#endif // __COGGING_MODEL_HPP
@@ -3,7 +3,6 @@
 
 #include <stdint.h>
 #include <optional>
-#include <variant>
 
 class ComponentBase {
 public:
@@ -104,6 +103,8 @@ public:
     }
     
 private:
+    friend class InputPort<T>;
+
     uint32_t age_ = 2; // Age in number of control loop iterations
     T content_;
 };
@@ -117,65 +118,68 @@ private:
  *  - an external OutputPort (referenced by a pointer)
  *  - none (all queries will return std::nullopt)
  * 
+ * The kind of source is resolved once in connect_to() into a value pointer and
+ * an age pointer, so that present() and any() don't need to dispatch on the
+ * source type in the control loop. Raw pointers and the internal value use a
+ * static age that is always fresh.
+ * 
  * Member functions of this class are not thread-safe unless otherwise noted.
  */
 template<typename T>
 class InputPort {
 public:
     void connect_to(OutputPort<T>* input_port) {
-        content_ = input_port;
+        if (input_port) {
+            value_ptr_ = &input_port->content_;
+            age_ptr_ = &input_port->age_;
+        } else {
+            disconnect();
+        }
     }
 
     void connect_to(T* input_ptr) {
-        content_ = input_ptr;
+        if (input_ptr) {
+            value_ptr_ = input_ptr;
+            age_ptr_ = &fresh_age_;
+        } else {
+            disconnect();
+        }
     }
 
     void disconnect() {
-        content_ = (OutputPort<T>*)nullptr;
+        value_ptr_ = nullptr;
+        age_ptr_ = &disconnected_age_;
+    }
+
+    bool is_connected_to(const OutputPort<T>& output_port) const {
+        return age_ptr_ == &output_port.age_;
     }
 
     std::optional<T> present() {
-        if (content_.index() == 2) {
-            OutputPort<T>* ptr = std::get<2>(content_);
-            return ptr ? ptr->present() : std::nullopt;
-        } else if (content_.index() == 1) {
-            T* ptr = std::get<1>(content_);
-            return ptr ? std::make_optional(*ptr) : std::nullopt;
-        } else {
-            return std::get<0>(content_);
+        if (*age_ptr_ != 0) {
+            return std::nullopt;
         }
+        return value_ptr_ ? *value_ptr_ : content_;
     }
 
     // TODO: probably it makes sense to let the application define that it's
     // ok for this input port to fetch the value from the last iteration.
     // This would provide a general way to resolve same-iteration data path cycles.
 
-    //std::optional<T> previous() {
-    //    if (content_.index() == 2) {
-    //        OutputPort<T>* ptr = std::get<2>(content_);
-    //        return ptr ? ptr->previous() : std::nullopt;
-    //    } else if (content_.index() == 1) {
-    //        T* ptr = std::get<1>(content_);
-    //        return ptr ? std::make_optional(*ptr) : std::nullopt;
-    //    } else {
-    //        return std::get<0>(content_);
-    //    }
-    //}
-
     std::optional<T> any() {
-        if (content_.index() == 2) {
-            OutputPort<T>* ptr = std::get<2>(content_);
-            return ptr ? ptr->any() : std::nullopt;
-        } else if (content_.index() == 1) {
-            T* ptr = std::get<1>(content_);
-            return ptr ? std::make_optional(*ptr) : std::nullopt;
-        } else {
-            return std::get<0>(content_);
+        if (age_ptr_ == &disconnected_age_) {
+            return std::nullopt;
         }
+        return value_ptr_ ? *value_ptr_ : content_;
     }
     
 private:
-    std::variant<T, T*, OutputPort<T>*> content_;
+    static inline const uint32_t fresh_age_ = 0;
+    static inline const uint32_t disconnected_age_ = UINT32_MAX;
+
+    const T* value_ptr_ = nullptr; // nullptr: use the internally stored value
+    const uint32_t* age_ptr_ = &fresh_age_;
+    T content_ = {};
 };
 
 
@@ -0,0 +1,62 @@
+#ifndef __CONFIG_FIELD_LISTS_HPP
+#define __CONFIG_FIELD_LISTS_HPP
+
+#include "nvm_config.hpp"
+
+// Field lists of the config structs with calibration tables that the interface
+// doesn't expose as single fields. TGenerated is the list of the fields in
+// odrive-interface.yaml (autogen/config_fields.hpp). interface_generator.py
+// fails if a member of a stored config struct is on neither list.
+
+template<typename TGenerated>
+struct EncoderConfigFields {
+    template<typename TConfig, typename TVisitor>
+    static void visit(TConfig& config, TVisitor&& visitor) {
+        TGenerated::visit(config, visitor);
+        visitor(config_field_tag("hall_edge_phcnt"), config.hall_edge_phcnt);
+        visitor(config_field_tag("eccentricity_table"), config.eccentricity_table);
+    }
+};
+
+template<typename TGenerated>
+struct MotorConfigFields {
+    template<typename TConfig, typename TVisitor>
+    static void visit(TConfig& config, TVisitor&& visitor) {
+        TGenerated::visit(config, visitor);
+        visitor(config_field_tag("id_table"), config.id_table);
+        visitor(config_field_tag("inductance_map"), config.inductance_map);
+    }
+};
+
+// Filled by set_gain_schedule_point(), set_cam_points(),
+// fit_anticogging_harmonics() and the ripple identification
+template<typename TGenerated>
+struct ControllerConfigFields {
+    template<typename TConfig, typename TVisitor>
+    static void visit(TConfig& config, TVisitor&& visitor) {
+        TGenerated::visit(config, visitor);
+        visitor(config_field_tag("gain_schedule.pos_gain"), config.gain_schedule.pos_gain);
+        visitor(config_field_tag("gain_schedule.vel_gain"), config.gain_schedule.vel_gain);
+        visitor(config_field_tag("gain_schedule.vel_integrator_gain"), config.gain_schedule.vel_integrator_gain);
+        visitor(config_field_tag("cam.points"), config.cam.points);
+        visitor(config_field_tag("anticogging.harmonics"), config.anticogging.harmonics);
+        visitor(config_field_tag("ripple.harmonics"), config.ripple.harmonics);
+    }
+};
+
+// The calibration lock-in only exposes its ramp, the conditions that end it
+// come from default_calibration()
+template<typename TGenerated>
+struct AxisConfigFields {
+    template<typename TConfig, typename TVisitor>
+    static void visit(TConfig& config, TVisitor&& visitor) {
+        TGenerated::visit(config, visitor);
+        visitor(config_field_tag("calibration_lockin.finish_distance"), config.calibration_lockin.finish_distance);
+        visitor(config_field_tag("calibration_lockin.finish_on_vel"), config.calibration_lockin.finish_on_vel);
+        visitor(config_field_tag("calibration_lockin.finish_on_distance"), config.calibration_lockin.finish_on_distance);
+        visitor(config_field_tag("calibration_lockin.finish_on_enc_idx"), config.calibration_lockin.finish_on_enc_idx);
+        visitor(config_field_tag("calibration_lockin.finish_on_sensorless_convergence"), config.calibration_lockin.finish_on_sensorless_convergence);
+    }
+};
+
+#endif // __CONFIG_FIELD_LISTS_HPP
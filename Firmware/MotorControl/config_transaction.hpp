@@ -0,0 +1,95 @@
+#ifndef __CONFIG_TRANSACTION_HPP
+#define __CONFIG_TRANSACTION_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define CONFIG_TRANSACTION_SIZE 48 // distinct recomputations that can be deferred
+
+/**
+ * @brief Defers the recomputations that config setters trigger, so that a
+ * client writing many values applies each of them only once.
+ *
+ * Setters call config_changed() instead of their recomputation (for example
+ * Motor::update_current_controller_gains()). Without an open transaction it
+ * runs right away. Between begin() and commit() it is queued once per object
+ * and function, however often it is requested, and commit() runs the queue in
+ * the order of the first requests. Components whose config wasn't written
+ * aren't touched.
+ *
+ * If the queue is full the recomputation runs right away, so a transaction
+ * never drops one.
+ *
+ * The calls must be serialized by the caller (see defer_config_apply()).
+ */
+class ConfigTransaction {
+public:
+    using Apply = void (*)(void* obj);
+
+    struct Entry_t {
+        void* obj;
+        Apply apply;
+    };
+
+    void begin() { open_ = true; }
+    bool is_open() const { return open_; }
+
+    /**
+     * @brief Queues apply(obj) if a transaction is open.
+     * @returns false if the caller must run it right away.
+     */
+    bool defer(void* obj, Apply apply) {
+        if (!open_) {
+            return false;
+        }
+        for (size_t i = 0; i < n_pending_; ++i) {
+            if (pending_[i].obj == obj && pending_[i].apply == apply) {
+                return true;
+            }
+        }
+        if (n_pending_ >= CONFIG_TRANSACTION_SIZE) {
+            return false;
+        }
+        pending_[n_pending_++] = {obj, apply};
+        return true;
+    }
+
+    /**
+     * @brief Closes the transaction and moves the queued recomputations to
+     * `out` so that they can be run outside of the lock.
+     * @returns The number of entries in `out`.
+     */
+    size_t close(Entry_t (&out)[CONFIG_TRANSACTION_SIZE]) {
+        size_t n = n_pending_;
+        for (size_t i = 0; i < n; ++i) {
+            out[i] = pending_[i];
+        }
+        n_pending_ = 0;
+        open_ = false;
+        return n;
+    }
+
+    size_t get_n_pending() const { return n_pending_; }
+
+private:
+    bool open_ = false;
+    size_t n_pending_ = 0;
+    Entry_t pending_[CONFIG_TRANSACTION_SIZE];
+};
+
+// Defined in main.cpp. Takes the lock of the firmware's ConfigTransaction.
+bool defer_config_apply(void* obj, ConfigTransaction::Apply apply);
+
+/**
+ * @brief Runs F on obj now, or once when the open config transaction is
+ * committed. F is a member function of T. Its return value is discarded.
+ */
+template<auto F, typename T>
+void config_changed(T* obj) {
+    ConfigTransaction::Apply apply = [](void* p) { (static_cast<T*>(p)->*F)(); };
+    if (!defer_config_apply(obj, apply)) {
+        apply(obj);
+    }
+}
+
+#endif // __CONFIG_TRANSACTION_HPP
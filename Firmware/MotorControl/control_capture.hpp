@@ -0,0 +1,116 @@
+#ifndef __CONTROL_CAPTURE_HPP
+#define __CONTROL_CAPTURE_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <optional>
+#include <fibre/bufptr.hpp>
+#include <fibre/simple_serdes.hpp>
+
+#define CONTROL_CAPTURE_FRAME_TAG 0xff01
+#define CONTROL_CAPTURE_RECORD_SIZE 26
+
+/**
+ * @brief Raw inputs of one control loop iteration of one axis, as streamed by
+ * Telemetry::start_capture().
+ *
+ * These are the values before any processing, so that a host can feed them
+ * through the same code again and get bit-identical results.
+ *
+ * Frame layout (little endian), sharing the header of the telemetry frames:
+ *  - uint16 CONTROL_CAPTURE_FRAME_TAG
+ *  - uint16 sequence number, incremented for every frame including dropped
+ *    ones
+ *  - uint8 axis number
+ *  - uint8 number of records
+ *  - the records, CONTROL_CAPTURE_RECORD_SIZE bytes each in the order of the
+ *    fields below
+ */
+struct ControlInputRecord_t {
+    uint32_t timestamp;   // [HCLK ticks] of the current measurement
+    uint16_t adc_vbus;    // raw ADC value, as passed to vbus_sense_adc_cb()
+    uint16_t adc_phB;     // raw ADC values, as passed to Motor::phase_currents_from_adcvals()
+    uint16_t adc_phC;
+    int32_t encoder_raw;  // see Encoder::raw_sample()
+    float input_pos;      // [turn]
+    float input_vel;      // [turn/s]
+    float input_torque;   // [Nm]
+
+    size_t encode(uint8_t* buf) const {
+        buf += write_le<uint32_t>(timestamp, buf);
+        buf += write_le<uint16_t>(adc_vbus, buf);
+        buf += write_le<uint16_t>(adc_phB, buf);
+        buf += write_le<uint16_t>(adc_phC, buf);
+        buf += write_le<int32_t>(encoder_raw, buf);
+        buf += write_le<float>(input_pos, buf);
+        buf += write_le<float>(input_vel, buf);
+        buf += write_le<float>(input_torque, buf);
+        return CONTROL_CAPTURE_RECORD_SIZE;
+    }
+
+    static ControlInputRecord_t decode(const uint8_t* buf) {
+        ControlInputRecord_t record;
+        buf += read_le<uint32_t>(&record.timestamp, buf);
+        buf += read_le<uint16_t>(&record.adc_vbus, buf);
+        buf += read_le<uint16_t>(&record.adc_phB, buf);
+        buf += read_le<uint16_t>(&record.adc_phC, buf);
+        buf += read_le<int32_t>(&record.encoder_raw, buf);
+        buf += read_le<float>(&record.input_pos, buf);
+        buf += read_le<float>(&record.input_vel, buf);
+        buf += read_le<float>(&record.input_torque, buf);
+        return record;
+    }
+};
+
+/**
+ * @brief Splits a stream of capture frames back into records.
+ *
+ * A dropped frame breaks the sequence of control loop iterations, so the
+ * first record after a gap is passed with contiguous = false. A replay must
+ * reset its state there.
+ */
+class ControlCaptureReader {
+public:
+    /**
+     * @brief Decodes one frame and calls on_record(record, contiguous) for
+     * each record in it.
+     * @returns false if this isn't a valid capture frame. It is ignored then.
+     */
+    template<typename TFn>
+    bool feed(const uint8_t* frame, size_t length, TFn&& on_record) {
+        constexpr size_t header_size = 6;
+        uint16_t tag, seq;
+        if (length < header_size) {
+            return false;
+        }
+        read_le<uint16_t>(&tag, frame);
+        read_le<uint16_t>(&seq, frame + 2);
+        size_t n_records = frame[5];
+        if (tag != CONTROL_CAPTURE_FRAME_TAG || length < header_size + n_records * CONTROL_CAPTURE_RECORD_SIZE) {
+            return false;
+        }
+
+        bool contiguous = last_seq_.has_value() && (uint16_t)(*last_seq_ + 1) == seq;
+        if (last_seq_.has_value() && !contiguous) {
+            n_gaps_++;
+        }
+        last_seq_ = seq;
+        axis_ = frame[4];
+
+        for (size_t i = 0; i < n_records; ++i) {
+            on_record(ControlInputRecord_t::decode(frame + header_size + i * CONTROL_CAPTURE_RECORD_SIZE), contiguous);
+            contiguous = true;
+            n_records_++;
+        }
+        return true;
+    }
+
+    uint32_t n_gaps_ = 0;
+    uint32_t n_records_ = 0;
+    uint8_t axis_ = 0; // axis of the last frame
+
+private:
+    std::optional<uint16_t> last_seq_;
+};
+
+#endif // __CONTROL_CAPTURE_HPP
@@ -1,14 +1,96 @@
 
 #include "odrive_main.h"
+#include "trap_tracker.hpp"
+#include "torque_share.hpp"
 #include <algorithm>
 #include <numeric>
 
+uint8_t* Controller::cogging_map_store_ = nullptr;
+size_t Controller::cogging_map_store_size_ = 0;
+
 bool Controller::apply_config() {
     config_.parent = this;
+    for (FilterSection_t& section : config_.filters) {
+        section.parent = this;
+    }
     update_filter_gains();
+    update_filters();
+    update_input_shaper();
+
+    size_t offset = cogging_map_offset(axis_->axis_num_);
+    cogging_map_size_ = 0;
+    cogging_map_f32_ = nullptr;
+    cogging_map_i16_ = nullptr;
+    if (offset + cogging_map_bytes() > cogging_map_store_size_) {
+        anticogging_valid_ = false;
+        return false;
+    }
+    if (config_.anticogging.quantized) {
+        cogging_map_i16_ = reinterpret_cast<int16_t*>(cogging_map_store_ + offset);
+    } else {
+        cogging_map_f32_ = reinterpret_cast<float*>(cogging_map_store_ + offset);
+    }
+    cogging_map_size_ = config_.anticogging.map_size;
     return true;
 }
 
+// @brief Offset of the cogging map of an axis in the store [bytes]. The maps
+// of the lower numbered axes come first.
+size_t Controller::cogging_map_offset(size_t axis_num) {
+    size_t offset = 0;
+    for (size_t i = 0; i < axis_num; ++i) {
+        offset += axes[i].controller_.cogging_map_bytes();
+    }
+    // Keep float slices aligned
+    return (offset + sizeof(float) - 1) / sizeof(float) * sizeof(float);
+}
+
+// @brief Size of the store that the configured maps of all axes need [bytes]
+size_t Controller::cogging_map_store_bytes() {
+    size_t end = 0;
+    for (size_t i = 0; i < AXIS_COUNT; ++i) {
+        end = std::max(end, cogging_map_offset(i) + axes[i].controller_.cogging_map_bytes());
+    }
+    return end;
+}
+
+// @brief Recomputes the coefficients of the biquad sections from config_.filters
+void Controller::update_filters() {
+    const float fs = 1.0f / current_meas_period;
+    Biquad designs[N_FILTERS];
+    bool valid[N_FILTERS];
+    for (size_t i = 0; i < N_FILTERS; ++i) {
+        const FilterSection_t& section = config_.filters[i];
+        switch (section.type) {
+            case FILTER_TYPE_LOWPASS: valid[i] = Biquad::design_lowpass(section.frequency, section.q, fs, &designs[i]); break;
+            case FILTER_TYPE_NOTCH: valid[i] = Biquad::design_notch(section.frequency, section.q, fs, &designs[i]); break;
+            default: valid[i] = false; break;
+        }
+    }
+
+    // Start every section in the steady state of its signal to avoid a bump
+    CRITICAL_SECTION() {
+        float torque = torque_output_.any().value_or(0.0f);
+        for (size_t i = 0; i < N_FILTERS; ++i) {
+            biquads_[i] = designs[i];
+            biquads_[i].reset(config_.filters[i].on_vel_estimate ? vel_estimate_filtered_ : torque);
+            filter_valid_[i] = valid[i];
+        }
+    }
+}
+
+// @brief Recomputes the impulse train of the input shaper from the config
+void Controller::update_input_shaper() {
+    size_t n_impulses = (config_.input_shaper_type == INPUT_SHAPER_TYPE_ZV) ? 2
+                      : (config_.input_shaper_type == INPUT_SHAPER_TYPE_ZVD) ? 3 : 0;
+    CRITICAL_SECTION() {
+        // An invalid configuration disables the shaper
+        input_shaper_.configure(n_impulses, config_.input_shaper_frequency,
+                                config_.input_shaper_damping, current_meas_period);
+        input_shaper_active_ = false;
+    }
+}
+
 void Controller::reset() {
     // pos_setpoint is initialized in start_closed_loop_control
     vel_setpoint_ = 0.0f;
@@ -20,6 +102,7 @@ void Controller::reset() {
 
 void Controller::set_error(Error error) {
     error_ |= error;
+    event_log.track(DWT->CYCCNT, axis_event_source(ODrive::EVENT_SOURCE_CONTROLLER0, axis_->axis_num_), error_);
     last_error_time_ = odrv.n_evt_control_loop_ * current_meas_period;
 }
 
@@ -29,11 +112,25 @@ void Controller::set_error(Error error) {
 
 
 void Controller::move_to_pos(float goal_point) {
-    axis_->trap_traj_.planTrapezoidal(goal_point, pos_setpoint_, vel_setpoint_,
-                                 axis_->trap_traj_.config_.vel_limit,
-                                 axis_->trap_traj_.config_.accel_limit,
-                                 axis_->trap_traj_.config_.decel_limit);
-    axis_->trap_traj_.t_ = 0.0f;
+    const TrapezoidalTrajectory::Config_t& limits = axis_->trap_traj_.config_;
+    float distance = SplitPos::from_float(goal_point) - pos_setpoint_;
+    trajectory_origin_ = pos_setpoint_;
+    if (config_.input_mode == INPUT_MODE_SCURVE_TRAJ) {
+        if (!axis_->scurve_traj_.plan(distance, 0.0f, vel_setpoint_,
+                                      limits.vel_limit, limits.accel_limit,
+                                      limits.decel_limit, limits.jerk_limit)) {
+            set_error(ERROR_INVALID_INPUT_MODE);
+            return;
+        }
+        // The current setpoint is t = 0, this cycle already goes one further
+        axis_->scurve_traj_.t_ = current_meas_period;
+    } else {
+        axis_->trap_traj_.planTrapezoidal(distance, 0.0f, vel_setpoint_,
+                                     limits.vel_limit,
+                                     limits.accel_limit,
+                                     limits.decel_limit);
+        axis_->trap_traj_.t_ = current_meas_period;
+    }
     trajectory_done_ = false;
 }
 
@@ -41,7 +138,7 @@ void Controller::move_incremental(float displacement, bool from_input_pos = true
     if(from_input_pos){
         input_pos_ += displacement;
     } else{
-        input_pos_ = pos_setpoint_ + displacement;
+        input_pos_ = pos_setpoint_.to_float() + displacement;
     }
 
     input_pos_updated();
@@ -49,20 +146,84 @@ void Controller::move_incremental(float displacement, bool from_input_pos = true
 
 void Controller::start_anticogging_calibration() {
     // Ensure the cogging map was correctly allocated earlier and that the motor is capable of calibrating
-    if (axis_->error_ == Axis::ERROR_NONE) {
+    if (axis_->error_ == Axis::ERROR_NONE && cogging_map_size_ > 0) {
+        // The holding torque can't exceed what the motor can deliver
+        float max_torque = axis_->motor_.max_available_torque();
+        config_.anticogging.scale = (max_torque > 0.0f) ? max_torque / (float)INT16_MAX : 1.0f / (float)INT16_MAX;
+        config_.anticogging.index = 0;
+        sweep_state_ = SWEEP_START;
+        anticogging_progress_ = 0.0f;
+        // The feedforward of the old map would be recorded as zero cogging
+        anticogging_valid_ = false;
         config_.anticogging.calib_anticogging = true;
     }
 }
 
+void Controller::set_cogging_bin(uint32_t index, float torque) {
+    if (index >= cogging_map_size_) {
+        return;
+    }
+    if (cogging_map_i16_) {
+        float lsb = std::round(torque / config_.anticogging.scale);
+        cogging_map_i16_[index] = (int16_t)std::clamp(lsb, (float)INT16_MIN, (float)INT16_MAX);
+    } else {
+        cogging_map_f32_[index] = torque;
+    }
+}
+
+// @brief Cogging torque at pos [turn] according to the map or the harmonic model
+float Controller::get_cogging_torque(float pos) {
+    float pos_frac = fmodf_pos(pos, 1.0f);
+    if (config_.anticogging.use_harmonic_model) {
+        return cogging_model::eval(config_.anticogging.harmonics, config_.anticogging.harmonic_count,
+                                   config_.anticogging.harmonic_offset, pos_frac, our_arm_sin_cos_f32);
+    }
+    if (cogging_map_size_ == 0) {
+        return 0.0f;
+    }
+    float bin_pos = pos_frac * (float)cogging_map_size_;
+    uint32_t bin = std::min((uint32_t)bin_pos, cogging_map_size_ - 1);
+    float value = get_cogging_bin(bin);
+    if (config_.anticogging.interpolate) {
+        // Bin i was calibrated at i / map_size, so the map wraps around between the last and first bin
+        uint32_t next = (bin + 1 < cogging_map_size_) ? bin + 1 : 0;
+        value += (bin_pos - (float)bin) * (get_cogging_bin(next) - value);
+    }
+    return value;
+}
+
+bool Controller::fit_anticogging_harmonics(uint32_t count) {
+    if (!anticogging_valid_ || config_.anticogging.calib_anticogging || cogging_map_size_ == 0) {
+        return false;
+    }
+    cogging_model::Harmonic_t harmonics[cogging_model::MAX_HARMONICS];
+    float offset;
+    size_t n = cogging_model::fit([this](uint32_t i) { return get_cogging_bin(i); }, cogging_map_size_,
+                                  harmonics, std::min<size_t>(count, cogging_model::MAX_HARMONICS), &offset);
+
+    // The control loop may be evaluating the old model
+    CRITICAL_SECTION() {
+        std::copy(harmonics, harmonics + n, config_.anticogging.harmonics);
+        config_.anticogging.harmonic_count = n;
+        config_.anticogging.harmonic_offset = offset;
+    }
+    return true;
+}
+
 float Controller::remove_anticogging_bias()
 {
-    auto& cogmap = config_.anticogging.cogging_map;
-    
-    auto sum = std::accumulate(std::begin(cogmap), std::end(cogmap), 0.0f);
-    auto average = sum / std::size(cogmap);
+    if (cogging_map_size_ == 0) {
+        return 0.0f;
+    }
 
-    for(auto& val : cogmap) {
-        val -= average;
+    float sum = 0.0f;
+    for (uint32_t i = 0; i < cogging_map_size_; ++i) {
+        sum += get_cogging_bin(i);
+    }
+    float average = sum / (float)cogging_map_size_;
+
+    for (uint32_t i = 0; i < cogging_map_size_; ++i) {
+        set_cogging_bin(i, get_cogging_bin(i) - average);
     }
 
     return average;
@@ -80,11 +241,12 @@ bool Controller::anticogging_calibration(float pos_estimate, float vel_estimate)
     float pos_err = input_pos_ - pos_estimate;
     if (std::abs(pos_err) <= config_.anticogging.calib_pos_threshold / (float)axis_->encoder_.config_.cpr &&
         std::abs(vel_estimate) < config_.anticogging.calib_vel_threshold / (float)axis_->encoder_.config_.cpr) {
-        config_.anticogging.cogging_map[std::clamp<uint32_t>(config_.anticogging.index++, 0, 3600)] = vel_integrator_torque_;
+        set_cogging_bin(config_.anticogging.index++, vel_integrator_torque_);
     }
-    if (config_.anticogging.index < 3600) {
+    anticogging_progress_ = (float)config_.anticogging.index / (float)cogging_map_size_;
+    if (config_.anticogging.index < cogging_map_size_) {
         config_.control_mode = CONTROL_MODE_POSITION_CONTROL;
-        input_pos_ = config_.anticogging.index * axis_->encoder_.getCoggingRatio();
+        input_pos_ = (float)config_.anticogging.index / (float)cogging_map_size_;
         input_vel_ = 0.0f;
         input_torque_ = 0.0f;
         input_pos_updated();
@@ -102,6 +264,216 @@ bool Controller::anticogging_calibration(float pos_estimate, float vel_estimate)
     }
 }
 
+/*
+ * The sweep calibration moves at a constant low velocity over one turn in each
+ * direction. The torque is averaged over the samples that fall into each bin.
+ * Friction adds to the torque in one direction and subtracts from it in the
+ * other, so the mean of both directions leaves the cogging torque.
+ *
+ * anticogging_sweep_calibration() advances the setpoint before the controller
+ * runs and anticogging_sweep_sample() records the resulting torque.
+ */
+bool Controller::anticogging_sweep_calibration(float pos_estimate) {
+    float vel = std::abs(config_.anticogging.calib_sweep_vel);
+
+    switch (sweep_state_) {
+        case SWEEP_START: {
+            sweep_setpoint_ = pos_estimate;
+            sweep_leadin_end_ = pos_estimate + SWEEP_LEADIN;
+            sweep_state_ = SWEEP_FORWARD_LEADIN;
+        } break;
+        case SWEEP_FORWARD_LEADIN:
+        case SWEEP_REVERSE_LEADIN: {
+            bool forward = sweep_state_ == SWEEP_FORWARD_LEADIN;
+            if (forward ? (pos_estimate >= sweep_leadin_end_) : (pos_estimate <= sweep_leadin_end_)) {
+                sweep_bin_ = std::min((uint32_t)(fmodf_pos(pos_estimate, 1.0f) * (float)cogging_map_size_), cogging_map_size_ - 1);
+                sweep_bins_done_ = 0;
+                sweep_samples_ = 0;
+                sweep_torque_sum_ = 0.0f;
+                sweep_state_ = forward ? SWEEP_FORWARD : SWEEP_REVERSE;
+            }
+        } break;
+        default: break;
+    }
+
+    bool forward = sweep_state_ == SWEEP_FORWARD_LEADIN || sweep_state_ == SWEEP_FORWARD;
+    sweep_setpoint_ += (forward ? vel : -vel) * current_meas_period;
+
+    config_.control_mode = CONTROL_MODE_POSITION_CONTROL;
+    input_pos_ = sweep_setpoint_;
+    input_vel_ = forward ? vel : -vel;
+    input_torque_ = 0.0f;
+    input_pos_updated();
+    return false;
+}
+
+void Controller::anticogging_sweep_sample(float pos_estimate, float torque) {
+    if (sweep_state_ != SWEEP_FORWARD && sweep_state_ != SWEEP_REVERSE) {
+        return;
+    }
+    bool forward = sweep_state_ == SWEEP_FORWARD;
+    uint32_t n = cogging_map_size_;
+    uint32_t bin = std::min((uint32_t)(fmodf_pos(pos_estimate, 1.0f) * (float)n), n - 1);
+
+    // Bins behind the current one (noise, overshoot) count towards the current one
+    uint32_t ahead = forward ? (bin + n - sweep_bin_) % n : (sweep_bin_ + n - bin) % n;
+    if (ahead == 0 || ahead > n / 2) {
+        sweep_torque_sum_ += torque;
+        sweep_samples_++;
+        return;
+    }
+
+    // Finish the current bin and any bins skipped in between
+    float mean = sweep_samples_ ? sweep_torque_sum_ / (float)sweep_samples_ : torque;
+    for (uint32_t i = 0; i < ahead && sweep_bins_done_ < n; ++i, ++sweep_bins_done_) {
+        uint32_t idx = forward ? (sweep_bin_ + i) % n : (sweep_bin_ + n - i) % n;
+        set_cogging_bin(idx, forward ? mean : 0.5f * (get_cogging_bin(idx) + mean));
+    }
+    sweep_bin_ = bin;
+    sweep_torque_sum_ = torque;
+    sweep_samples_ = 1;
+    anticogging_progress_ = (forward ? 0.0f : 0.5f) + 0.5f * (float)sweep_bins_done_ / (float)n;
+
+    if (sweep_bins_done_ < n) {
+        return;
+    }
+    if (forward) {
+        sweep_leadin_end_ = pos_estimate - SWEEP_LEADIN;
+        sweep_state_ = SWEEP_REVERSE_LEADIN;
+    } else {
+        sweep_state_ = SWEEP_START;
+        config_.control_mode = CONTROL_MODE_POSITION_CONTROL;
+        input_pos_ = sweep_setpoint_; // stop where we are
+        input_vel_ = 0.0f;
+        input_torque_ = 0.0f;
+        input_pos_updated();
+        anticogging_progress_ = 1.0f;
+        anticogging_valid_ = true;
+        config_.anticogging.calib_anticogging = false;
+    }
+}
+
+// @brief Starts a frequency response measurement of the loop selected by
+// config_.control_mode. See INPUT_MODE_SYSID.
+bool Controller::start_sysid() {
+    bool success;
+    CRITICAL_SECTION() {
+        success = sysid_.start(current_meas_period);
+        if (success) {
+            config_.input_mode = INPUT_MODE_SYSID;
+        }
+    }
+    return success;
+}
+
+// @brief Starts the identification of inertia and friction in velocity
+// control. The results are written to config_ when the script completes.
+bool Controller::start_identification() {
+    bool success;
+    CRITICAL_SECTION() {
+        success = identification_.start();
+        if (success) {
+            config_.control_mode = CONTROL_MODE_VELOCITY_CONTROL;
+            config_.input_mode = INPUT_MODE_PASSTHROUGH;
+            input_vel_ = 0.0f;
+            input_torque_ = 0.0f;
+        }
+    }
+    return success;
+}
+
+// @brief Starts the identification of config_.ripple for the orders that are
+// set. The coefficients are written to config_.ripple when the sweep
+// completes.
+bool Controller::start_ripple_identification() {
+    std::optional<float> pos_estimate = axis_->encoder_.pos_estimate_.present();
+    if (!pos_estimate.has_value()) {
+        return false;
+    }
+    uint32_t count = std::min<uint32_t>(config_.ripple.harmonic_count, ripple_model::MAX_HARMONICS);
+    bool success;
+    CRITICAL_SECTION() {
+        success = ripple_identification_.start(config_.ripple.harmonics, count, config_.ripple.period, *pos_estimate);
+        if (success) {
+            config_.control_mode = CONTROL_MODE_POSITION_CONTROL;
+            config_.input_mode = INPUT_MODE_PASSTHROUGH;
+            input_pos_ = *pos_estimate;
+            input_vel_ = 0.0f;
+            input_torque_ = 0.0f;
+            input_pos_updated();
+        }
+    }
+    return success;
+}
+
+bool Controller::set_ripple_harmonic(uint32_t index, uint32_t order, float a, float b, float a_friction, float b_friction) {
+    if (index >= ripple_model::MAX_HARMONICS) {
+        return false;
+    }
+    // The control loop must not see a partially updated harmonic
+    CRITICAL_SECTION() {
+        config_.ripple.harmonics[index] = {order, a, b, a_friction, b_friction};
+    }
+    return true;
+}
+
+// @brief Writes four consecutive points of the cam table, which keeps the
+// number of calls for uploading a table low
+bool Controller::set_cam_points(uint32_t index, float p0, float p1, float p2, float p3) {
+    if (index > Cam_t::MAX_POINTS - 4) {
+        return false;
+    }
+    CRITICAL_SECTION() {
+        config_.cam.points[index] = p0;
+        config_.cam.points[index + 1] = p1;
+        config_.cam.points[index + 2] = p2;
+        config_.cam.points[index + 3] = p3;
+    }
+    return true;
+}
+
+bool Controller::set_gain_schedule_point(uint32_t index, float pos_gain, float vel_gain, float vel_integrator_gain) {
+    if (index >= GainSchedule_t::MAX_POINTS) {
+        return false;
+    }
+    // The control loop must not see a partially updated point
+    CRITICAL_SECTION() {
+        config_.gain_schedule.pos_gain[index] = pos_gain;
+        config_.gain_schedule.vel_gain[index] = vel_gain;
+        config_.gain_schedule.vel_integrator_gain[index] = vel_integrator_gain;
+    }
+    return true;
+}
+
+// @brief Evaluates the gain schedule at x and updates the gain multipliers
+void Controller::update_gain_schedule(float x) {
+    const GainSchedule_t& schedule = config_.gain_schedule;
+    uint32_t n = std::min<uint32_t>(schedule.n_points, GainSchedule_t::MAX_POINTS);
+    if (n == 0) {
+        pos_gain_multiplier_ = vel_gain_multiplier_ = vel_integrator_gain_multiplier_ = 1.0f;
+        return;
+    }
+
+    uint32_t i = 0;
+    float frac = 0.0f;
+    if (n > 1 && schedule.x_max > schedule.x_min) {
+        float pos = std::clamp((x - schedule.x_min) * (float)(n - 1) / (schedule.x_max - schedule.x_min), 0.0f, (float)(n - 1));
+        i = std::min((uint32_t)pos, n - 2);
+        frac = pos - (float)i;
+    }
+    uint32_t next = std::min(i + 1, n - 1);
+    pos_gain_multiplier_ = schedule.pos_gain[i] + frac * (schedule.pos_gain[next] - schedule.pos_gain[i]);
+    vel_gain_multiplier_ = schedule.vel_gain[i] + frac * (schedule.vel_gain[next] - schedule.vel_gain[i]);
+    vel_integrator_gain_multiplier_ = schedule.vel_integrator_gain[i] + frac * (schedule.vel_integrator_gain[next] - schedule.vel_integrator_gain[i]);
+}
+
+void Controller::clear_waypoints() {
+    // step() must not run while the queue is cleared
+    CRITICAL_SECTION() {
+        waypoints_.clear();
+    }
+}
+
 void Controller::set_input_pos_and_steps(float const pos) {
     input_pos_ = pos;
     if (config_.circular_setpoints) {
@@ -110,9 +482,12 @@ void Controller::set_input_pos_and_steps(float const pos) {
     } else {
         axis_->steps_ = (int64_t)(pos * config_.steps_per_circular_range);
     }
+    // The count jumped, the step rate is meaningless
+    step_interpolator_.reset();
 }
 
 bool Controller::control_mode_updated() {
+    pos_loop_countdown_ = 0;
     if (config_.control_mode >= CONTROL_MODE_POSITION_CONTROL) {
         std::optional<float> estimate = (config_.circular_setpoints ?
                                 pos_estimate_circular_src_ :
@@ -121,7 +496,9 @@ bool Controller::control_mode_updated() {
             return false;
         }
 
-        pos_setpoint_ = *estimate;
+        std::optional<SplitPos> estimate_split = pos_estimate_split_src_.any();
+        pos_setpoint_ = (!config_.circular_setpoints && estimate_split.has_value())
+                      ? *estimate_split : SplitPos::from_float(*estimate);
         set_input_pos_and_steps(*estimate);
     }
     return true;
@@ -140,25 +517,190 @@ static float limitVel(const float vel_limit, const float vel_estimate, const flo
     return std::clamp(torque, Tmin, Tmax);
 }
 
-bool Controller::update() {
-    std::optional<float> pos_estimate_linear = pos_estimate_linear_src_.present();
-    std::optional<float> pos_estimate_circular = pos_estimate_circular_src_.present();
-    std::optional<float> pos_wrap = pos_wrap_src_.present();
+// @brief Selects the update path for the current control mode. Only called
+// from update(), so the pointer is never written while it's in use.
+void Controller::select_update_fn() {
+    Axis::TaskTimes& timers = axis_->task_times_;
+    switch (config_.control_mode) {
+        case CONTROL_MODE_POSITION_CONTROL: {
+            update_fn_ = [](Controller* ctrl) { return ctrl->update_impl<CONTROL_MODE_POSITION_CONTROL>(); };
+            update_fn_timer_ = &timers.controller_update_position;
+        } break;
+        case CONTROL_MODE_VELOCITY_CONTROL: {
+            update_fn_ = [](Controller* ctrl) { return ctrl->update_impl<CONTROL_MODE_VELOCITY_CONTROL>(); };
+            update_fn_timer_ = &timers.controller_update_velocity;
+        } break;
+        default: {
+            update_fn_ = [](Controller* ctrl) { return ctrl->update_impl<CONTROL_MODE_TORQUE_CONTROL>(); };
+            update_fn_timer_ = &timers.controller_update_torque;
+        } break;
+    }
+    update_fn_mode_ = config_.control_mode;
+}
+
+/**
+ * @brief Records the arrival of a new input setpoint for
+ * odrv.setpoint_latencies. Must be called from the context that received it.
+ *
+ * If several setpoints arrive within one control loop period, the latency is
+ * measured from the last one.
+ */
+void Controller::tag_input() {
+    if (!odrv.setpoint_latencies_.enabled) {
+        return;
+    }
+    LatencyStats* stats = odrv.get_setpoint_latency_stats();
+    uint32_t cycles = DWT->CYCCNT;
+    CRITICAL_SECTION() {
+        input_tag_ = {cycles, stats};
+    }
+}
+
+/**
+ * @brief Applies the setpoints that arrived from the CAN RX interrupt since
+ * the last call, like the corresponding CANSimple callbacks would.
+ *
+ * The RX interrupt has a lower priority than the control loop and can be
+ * preempted while it publishes, so a failed read is left for the next cycle
+ * instead of retried.
+ */
+RAMFUNC void Controller::apply_fast_inputs() {
+    uint32_t n;
+    FastInputPos_t pos;
+    if (fast_input_pos_.try_read(pos, n) && n != fast_input_pos_seen_) {
+        fast_input_pos_seen_ = n;
+        set_input_pos_and_steps(pos.pos);
+        input_vel_ = pos.vel_ff;
+        input_torque_ = pos.torque_ff;
+        input_pos_updated();
+    }
+    FastInputVel_t vel;
+    if (fast_input_vel_.try_read(vel, n) && n != fast_input_vel_seen_) {
+        fast_input_vel_seen_ = n;
+        input_vel_ = vel.vel;
+        input_torque_ = vel.torque_ff;
+    }
+    float torque;
+    if (fast_input_torque_.try_read(torque, n) && n != fast_input_torque_seen_) {
+        fast_input_torque_seen_ = n;
+        input_torque_ = torque;
+    }
+}
+
+// @brief True if the controller of another axis drives the motor of this
+// axis, see config_.torque_share_axis.
+bool Controller::is_torque_share_slave() {
+    for (size_t i = 0; i < AXIS_COUNT; ++i) {
+        if (axes[i].controller_.torque_share_slave_ == axis_) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// @brief Limit of the torque command. While a slave shares the torque, this is
+// the combined limit of both motors.
+float Controller::torque_limit() {
+    float own_limit = axis_->motor_.max_available_torque();
+    if (!torque_share_slave_ || !torque_share_slave_->motor_.is_armed_) {
+        return own_limit;
+    }
+    return torque_share::limit(own_limit, torque_share_slave_->motor_.max_available_torque(),
+                               config_.torque_share_ratio, config_.torque_share_preload);
+}
+
+RAMFUNC bool Controller::update() {
+    // The master writes the torque of the slave in its own update
+    if (is_torque_share_slave()) {
+        return true;
+    }
+
+    apply_fast_inputs();
+
+    // The outputs of this iteration are the first ones that use the setpoint
+    if (input_tag_.stats) {
+        applied_input_tag_ = input_tag_;
+        input_tag_.stats = nullptr;
+    }
+
+    // Several places assign config_.control_mode directly, so check here
+    // instead of relying on control_mode_updated(). A change of the mode
+    // from within the update takes effect in the next cycle.
+    if (!update_fn_ || config_.control_mode != update_fn_mode_) {
+        select_update_fn();
+    }
+    bool result;
+    MEASURE_TIME(*update_fn_timer_) {
+        result = update_fn_(this);
+    }
+    return result;
+}
+
+// The control mode is a template parameter so that each mode only contains
+// the stages and estimate queries it needs.
+template<Controller::ControlMode kMode>
+RAMFUNC bool Controller::update_impl() {
+    std::optional<float> pos_estimate_linear;
+    std::optional<SplitPos> pos_estimate_split;
+    std::optional<float> pos_estimate_circular;
+    if constexpr (kMode >= CONTROL_MODE_POSITION_CONTROL) {
+        pos_estimate_linear = pos_estimate_linear_src_.present();
+        pos_estimate_split = pos_estimate_split_src_.present();
+        pos_estimate_circular = pos_estimate_circular_src_.present();
+    }
+    std::optional<float> pos_wrap = config_.circular_setpoints ? pos_wrap_src_.present() : std::nullopt;
     std::optional<float> vel_estimate = vel_estimate_src_.present();
 
-    std::optional<float> anticogging_pos_estimate = axis_->encoder_.pos_estimate_.present();
-    std::optional<float> anticogging_vel_estimate = axis_->encoder_.vel_estimate_.present();
+    std::optional<float> anticogging_pos_estimate;
+    std::optional<float> anticogging_vel_estimate;
+    // Also the position of the ripple model
+    if (config_.anticogging.calib_anticogging || (anticogging_valid_ && config_.anticogging.anticogging_enabled)
+            || config_.ripple.enabled || ripple_identification_.active) {
+        anticogging_pos_estimate = axis_->encoder_.pos_estimate_.present();
+        anticogging_vel_estimate = axis_->encoder_.vel_estimate_.present();
+    }
+
+    if (vel_estimate.has_value()) {
+        // The motor encoder velocity in load units
+        float vel = dual_loop_active_ ? *vel_estimate / config_.gear_ratio : *vel_estimate;
+        for (size_t i = 0; i < N_FILTERS; ++i) {
+            if (filter_valid_[i] && config_.filters[i].on_vel_estimate) {
+                vel = biquads_[i].process(vel);
+            }
+        }
+        vel_estimate_filtered_ = vel;
+        vel_estimate = vel;
+    }
 
     if (axis_->step_dir_active_) {
+        axis_->read_step_counter();
+        // Whole steps and the position between them
+        int64_t steps = axis_->steps_;
+        float step_frac = 0.0f;
+        if (config_.step_interpolation_bandwidth > 0.0f) {
+            step_interpolator_.update(steps, config_.step_interpolation_bandwidth, current_meas_period);
+            steps = step_interpolator_.base();
+            step_frac = step_interpolator_.frac();
+        } else {
+            step_interpolator_.reset();
+        }
+        float turns_per_step;
         if (config_.circular_setpoints) {
             if (!pos_wrap.has_value()) {
                 set_error(ERROR_INVALID_CIRCULAR_RANGE);
                 return false;
             }
-            input_pos_ = (float)(axis_->steps_ % config_.steps_per_circular_range) * (*pos_wrap / (float)(config_.steps_per_circular_range));
+            turns_per_step = *pos_wrap / (float)(config_.steps_per_circular_range);
+            input_pos_ = ((float)(steps % config_.steps_per_circular_range) + step_frac) * turns_per_step;
         } else {
-            input_pos_ = (float)(axis_->steps_) / (float)(config_.steps_per_circular_range);
+            turns_per_step = 1.0f / (float)(config_.steps_per_circular_range);
+            input_pos_ = ((float)steps + step_frac) / (float)(config_.steps_per_circular_range);
         }
+        if (config_.step_interpolation_bandwidth > 0.0f) {
+            input_vel_ = step_interpolator_.vel() * turns_per_step;
+        }
+    } else {
+        step_interpolator_.reset();
     }
 
     if (config_.anticogging.calib_anticogging) {
@@ -167,7 +709,45 @@ bool Controller::update() {
             return false;
         }
         // non-blocking
-        anticogging_calibration(*anticogging_pos_estimate, *anticogging_vel_estimate);
+        if (config_.anticogging.calib_sweep) {
+            anticogging_sweep_calibration(*anticogging_pos_estimate);
+        } else {
+            anticogging_calibration(*anticogging_pos_estimate, *anticogging_vel_estimate);
+        }
+    }
+
+    if (identification_.active) {
+        if (!vel_estimate.has_value()) {
+            set_error(ERROR_INVALID_ESTIMATE);
+            return false;
+        }
+        // non-blocking
+        float torque_applied = torque_output_.any().value_or(0.0f);
+        input_vel_ = identification_.step(*vel_estimate, torque_applied, current_meas_period).vel;
+        if (!identification_.active && identification_.valid) {
+            config_.inertia = identification_.inertia;
+            config_.friction_coulomb = identification_.coulomb;
+            config_.friction_viscous = identification_.viscous;
+        }
+    }
+
+    if (ripple_identification_.active) {
+        if (!anticogging_pos_estimate.has_value()) {
+            set_error(ERROR_INVALID_ESTIMATE);
+            return false;
+        }
+        // non-blocking
+        auto setpoint = ripple_identification_.step(*anticogging_pos_estimate, ripple_identification_torque_,
+                                                    current_meas_period, our_arm_sin_cos_f32);
+        input_pos_ = setpoint.pos;
+        input_vel_ = setpoint.vel;
+        input_pos_updated();
+        if (!ripple_identification_.active && ripple_identification_.valid) {
+            std::copy(ripple_identification_.harmonics(), ripple_identification_.harmonics() + ripple_identification_.count(),
+                      config_.ripple.harmonics);
+            config_.ripple.coulomb_pos = ripple_identification_.coulomb_pos;
+            config_.ripple.coulomb_neg = ripple_identification_.coulomb_neg;
+        }
     }
 
     // TODO also enable circular deltas for 2nd order filter, etc.
@@ -179,13 +759,17 @@ bool Controller::update() {
         input_pos_ = fmodf_pos(input_pos_, *pos_wrap);
     }
 
+    if (config_.input_mode != INPUT_MODE_WAYPOINTS) {
+        waypoints_active_ = false;
+    }
+
     // Update inputs
     switch (config_.input_mode) {
         case INPUT_MODE_INACTIVE: {
             // do nothing
         } break;
         case INPUT_MODE_PASSTHROUGH: {
-            pos_setpoint_ = input_pos_;
+            pos_setpoint_ = SplitPos::from_float(input_pos_);
             vel_setpoint_ = input_vel_;
             torque_setpoint_ = input_torque_; 
         } break;
@@ -206,7 +790,7 @@ bool Controller::update() {
         } break;
         case INPUT_MODE_POS_FILTER: {
             // 2nd order pos tracking filter
-            float delta_pos = input_pos_ - pos_setpoint_; // Pos error
+            float delta_pos = SplitPos::from_float(input_pos_) - pos_setpoint_; // Pos error
             if (config_.circular_setpoints) {
                 if (!pos_wrap.has_value()) {
                     set_error(ERROR_INVALID_CIRCULAR_RANGE);
@@ -231,7 +815,7 @@ bool Controller::update() {
                     return false;
                 }
 
-                pos_setpoint_ = *other_pos * config_.mirror_ratio;
+                pos_setpoint_ = SplitPos::from_float(*other_pos * config_.mirror_ratio);
                 vel_setpoint_ = *other_vel * config_.mirror_ratio;
                 torque_setpoint_ = *other_torque * config_.torque_mirror_ratio;
             } else {
@@ -239,10 +823,63 @@ bool Controller::update() {
                 return false;
             }
         } break;
+        case INPUT_MODE_CAM: {
+            const Cam_t& cam = config_.cam;
+            if (cam.n_points > Cam_t::MAX_POINTS || !CamTable::valid(cam.n_points, cam.master_period)) {
+                set_error(ERROR_INVALID_CAM_TABLE);
+                return false;
+            }
+
+            std::optional<float> master_pos;
+            std::optional<float> master_vel;
+            if (cam.master_source == CAM_MASTER_SOURCE_INPUT) {
+                master_pos = input_pos_;
+                master_vel = input_vel_;
+            } else if (config_.axis_to_mirror < AXIS_COUNT) {
+                master_pos = axes[config_.axis_to_mirror].encoder_.pos_estimate_.present();
+                master_vel = axes[config_.axis_to_mirror].encoder_.vel_estimate_.present();
+            } else {
+                set_error(ERROR_INVALID_MIRROR_AXIS);
+                return false;
+            }
+            if (!master_pos.has_value() || !master_vel.has_value()) {
+                set_error(ERROR_INVALID_ESTIMATE);
+                return false;
+            }
+
+            CamTable::Output_t out = CamTable::eval(cam.points, cam.n_points, cam.master_period, cam.rise, *master_pos);
+            pos_setpoint_ = SplitPos::from_float(out.pos);
+            vel_setpoint_ = out.slope * *master_vel;
+            torque_setpoint_ = out.curvature * *master_vel * *master_vel * config_.inertia;
+        } break;
         // case INPUT_MODE_MIX_CHANNELS: {
         //     // NOT YET IMPLEMENTED
         // } break;
         case INPUT_MODE_TRAP_TRAJ: {
+            if (axis_->trap_traj_.config_.online) {
+                if (input_pos_updated_) {
+                    trajectory_done_ = false;
+                    input_pos_updated_ = false;
+                }
+                if (trajectory_done_)
+                    break;
+
+                const TrapezoidalTrajectory::Config_t& limits = axis_->trap_traj_.config_;
+                TrapTracker::Step_t traj_step = TrapTracker::step(
+                        SplitPos::from_float(input_pos_) - pos_setpoint_, vel_setpoint_,
+                        limits.vel_limit, limits.accel_limit, limits.decel_limit, current_meas_period);
+                pos_setpoint_ += traj_step.dY;
+                vel_setpoint_ = traj_step.Yd;
+                torque_setpoint_ = traj_step.Ydd * config_.inertia;
+                if (traj_step.done) {
+                    // Same as the end of a planned trajectory
+                    config_.control_mode = CONTROL_MODE_POSITION_CONTROL;
+                    torque_setpoint_ = 0.0f;
+                    trajectory_done_ = true;
+                }
+                anticogging_pos_estimate = pos_setpoint_.to_float(); // FF the position setpoint instead of the pos_estimate
+                break;
+            }
             if(input_pos_updated_){
                 move_to_pos(input_pos_);
                 input_pos_updated_ = false;
@@ -254,27 +891,92 @@ bool Controller::update() {
             if (axis_->trap_traj_.t_ > axis_->trap_traj_.Tf_) {
                 // Drop into position control mode when done to avoid problems on loop counter delta overflow
                 config_.control_mode = CONTROL_MODE_POSITION_CONTROL;
-                pos_setpoint_ = axis_->trap_traj_.Xf_;
+                pos_setpoint_ = trajectory_origin_ + axis_->trap_traj_.Xf_;
                 vel_setpoint_ = 0.0f;
                 torque_setpoint_ = 0.0f;
                 trajectory_done_ = true;
             } else {
                 TrapezoidalTrajectory::Step_t traj_step = axis_->trap_traj_.eval(axis_->trap_traj_.t_);
-                pos_setpoint_ = traj_step.Y;
+                pos_setpoint_ = trajectory_origin_ + traj_step.Y;
                 vel_setpoint_ = traj_step.Yd;
                 torque_setpoint_ = traj_step.Ydd * config_.inertia;
                 axis_->trap_traj_.t_ += current_meas_period;
             }
-            anticogging_pos_estimate = pos_setpoint_; // FF the position setpoint instead of the pos_estimate
+            anticogging_pos_estimate = pos_setpoint_.to_float(); // FF the position setpoint instead of the pos_estimate
+        } break;
+        case INPUT_MODE_SCURVE_TRAJ: {
+            if(input_pos_updated_){
+                move_to_pos(input_pos_);
+                input_pos_updated_ = false;
+            }
+            // Avoid updating uninitialized trajectory
+            if (trajectory_done_)
+                break;
+
+            SCurveTrajectory& traj = axis_->scurve_traj_;
+            if (traj.t_ > traj.Tf_) {
+                // Drop into position control mode when done to avoid problems on loop counter delta overflow
+                config_.control_mode = CONTROL_MODE_POSITION_CONTROL;
+                pos_setpoint_ = trajectory_origin_ + traj.Xf_;
+                vel_setpoint_ = 0.0f;
+                torque_setpoint_ = 0.0f;
+                trajectory_done_ = true;
+            } else {
+                SCurveTrajectory::Step_t traj_step = traj.eval(traj.t_);
+                pos_setpoint_ = trajectory_origin_ + traj_step.Y;
+                vel_setpoint_ = traj_step.Yd;
+                torque_setpoint_ = traj_step.Ydd * config_.inertia;
+                traj.t_ += current_meas_period;
+            }
+            anticogging_pos_estimate = pos_setpoint_.to_float(); // FF the position setpoint instead of the pos_estimate
+        } break;
+        case INPUT_MODE_WAYPOINTS: {
+            if (!waypoints_active_) {
+                waypoints_.restart(pos_setpoint_.to_float(), vel_setpoint_, 0.0f);
+                waypoints_active_ = true;
+            }
+            WaypointQueue<WAYPOINT_QUEUE_SIZE>::Setpoint_t setpoint = waypoints_.step(current_meas_period);
+            pos_setpoint_ = SplitPos::from_float(setpoint.pos);
+            vel_setpoint_ = setpoint.vel;
+            torque_setpoint_ = setpoint.torque_ff + setpoint.acc * config_.inertia;
+            anticogging_pos_estimate = pos_setpoint_.to_float(); // FF the position setpoint instead of the pos_estimate
         } break;
         case INPUT_MODE_TUNING: {
             autotuning_phase_ = wrap_pm_pi(autotuning_phase_ + (2.0f * M_PI * autotuning_.frequency * current_meas_period));
-            float c = our_arm_cos_f32(autotuning_phase_);
-            float s = our_arm_sin_f32(autotuning_phase_);
-            pos_setpoint_ = input_pos_ + autotuning_.pos_amplitude * s; // + pos_amp_c * c
+            float c, s;
+            our_arm_sin_cos_f32(autotuning_phase_, &s, &c);
+            pos_setpoint_ = SplitPos::from_float(input_pos_) + autotuning_.pos_amplitude * s; // + pos_amp_c * c
             vel_setpoint_ = input_vel_ + autotuning_.vel_amplitude * c;
             torque_setpoint_ = input_torque_ + autotuning_.torque_amplitude * -s;
         } break;
+        case INPUT_MODE_SYSID: {
+            // The response is taken relative to the input to keep the
+            // correlation sums small
+            std::optional<float> response;
+            if constexpr (kMode >= CONTROL_MODE_POSITION_CONTROL) {
+                response = pos_estimate_linear.has_value() ? std::make_optional(*pos_estimate_linear - input_pos_) : std::nullopt;
+            } else if constexpr (kMode >= CONTROL_MODE_VELOCITY_CONTROL) {
+                response = vel_estimate.has_value() ? std::make_optional(*vel_estimate - input_vel_) : std::nullopt;
+            } else {
+                response = vel_estimate;
+            }
+            if (!response.has_value()) {
+                set_error(ERROR_INVALID_ESTIMATE);
+                return false;
+            }
+
+            float excitation = sysid_.step(*response, our_arm_sin_cos_f32);
+            pos_setpoint_ = SplitPos::from_float(input_pos_);
+            vel_setpoint_ = input_vel_;
+            torque_setpoint_ = input_torque_;
+            if constexpr (kMode >= CONTROL_MODE_POSITION_CONTROL) {
+                pos_setpoint_ += excitation;
+            } else if constexpr (kMode >= CONTROL_MODE_VELOCITY_CONTROL) {
+                vel_setpoint_ += excitation;
+            } else {
+                torque_setpoint_ += excitation;
+            }
+        } break;
         default: {
             set_error(ERROR_INVALID_INPUT_MODE);
             return false;
@@ -286,35 +988,113 @@ bool Controller::update() {
     if(config_.enable_vel_limit) {
         vel_setpoint_ = std::clamp(vel_setpoint_, -config_.vel_limit, config_.vel_limit);
     }
-    const float Tlim = axis_->motor_.max_available_torque();
+    const float Tlim = torque_limit();
     torque_setpoint_ = std::clamp(torque_setpoint_, -Tlim, Tlim);
 
+    // Input shaping of the position reference. The shaper is linear, so
+    // shaping the output of the input filter or the trajectory planner is the
+    // same as shaping their input, but leaves their state untouched. Wrapping
+    // setpoints can't be convolved, hence not with circular_setpoints.
+    // ref.pos is relative to ref_origin_, which follows the setpoint in steps
+    // of more than a turn to keep the shaped positions small.
+    bool shaped_mode = config_.input_mode == INPUT_MODE_PASSTHROUGH
+                    || config_.input_mode == INPUT_MODE_POS_FILTER
+                    || config_.input_mode == INPUT_MODE_TRAP_TRAJ
+                    || config_.input_mode == INPUT_MODE_SCURVE_TRAJ;
+    InputShaper::Sample_t ref = {0.0f, vel_setpoint_, torque_setpoint_};
+    if (input_shaper_.enabled() && shaped_mode && !config_.circular_setpoints) {
+        if (!input_shaper_active_) {
+            ref_origin_ = pos_setpoint_;
+            input_shaper_.reset(ref);
+            input_shaper_active_ = true;
+        }
+        ref.pos = pos_setpoint_ - ref_origin_;
+        if (std::abs(ref.pos) > 1.0f) {
+            ref_origin_ += ref.pos;
+            input_shaper_.shift(ref.pos);
+            ref.pos = pos_setpoint_ - ref_origin_;
+        }
+        ref = input_shaper_.shape(ref);
+    } else {
+        ref_origin_ = pos_setpoint_;
+        input_shaper_active_ = false;
+    }
+
+    // Gain schedule tables
+    if (config_.gain_schedule.source == GAIN_SCHEDULE_SOURCE_NONE) {
+        pos_gain_multiplier_ = vel_gain_multiplier_ = vel_integrator_gain_multiplier_ = 1.0f;
+    } else {
+        std::optional<float> gain_schedule_x;
+        if (config_.gain_schedule.source == GAIN_SCHEDULE_SOURCE_POSITION) {
+            gain_schedule_x = (config_.circular_setpoints ? pos_estimate_circular_src_ : pos_estimate_linear_src_).present();
+        } else if (config_.gain_schedule.source == GAIN_SCHEDULE_SOURCE_VELOCITY) {
+            gain_schedule_x = vel_estimate;
+        } else {
+            gain_schedule_x = gain_schedule_input_;
+        }
+        if (!gain_schedule_x.has_value()) {
+            set_error(ERROR_INVALID_ESTIMATE);
+            return false;
+        }
+        update_gain_schedule(*gain_schedule_x);
+    }
+
     // Position control
     // TODO Decide if we want to use encoder or pll position here
-    float gain_scheduling_multiplier = 1.0f;
-    float vel_des = vel_setpoint_;
-    if (config_.control_mode >= CONTROL_MODE_POSITION_CONTROL) {
-        float pos_err;
+    [[maybe_unused]] float gain_scheduling_multiplier = 1.0f;
+    float vel_des = ref.vel;
 
-        if (config_.circular_setpoints) {
-            if (!pos_estimate_circular.has_value() || !pos_wrap.has_value()) {
-                set_error(ERROR_INVALID_ESTIMATE);
-                return false;
+    // Backlash compensation: on reversal the motor crosses the gap at
+    // backlash_comp_vel and then leads the load by half the gap
+    if (config_.backlash > 0.0f) {
+        if (ref.vel != 0.0f) {
+            backlash_dir_ = std::copysign(1.0f, ref.vel);
+        }
+        float max_step = config_.backlash_comp_vel * current_meas_period;
+        float step = std::clamp(0.5f * config_.backlash * backlash_dir_ - backlash_offset_, -max_step, max_step);
+        backlash_offset_ += step;
+        vel_des += step * current_meas_hz;
+    } else {
+        backlash_offset_ = 0.0f;
+    }
+
+    if constexpr (kMode >= CONTROL_MODE_POSITION_CONTROL) {
+        // The position loop may run slower than the velocity loop, for
+        // example to keep a compliant load side loop stable
+        if (pos_loop_countdown_ == 0) {
+            pos_loop_countdown_ = std::max<uint32_t>(config_.position_loop_divider, 1) - 1;
+            float pos_err;
+            if (config_.circular_setpoints) {
+                if (!pos_estimate_circular.has_value() || !pos_wrap.has_value()) {
+                    set_error(ERROR_INVALID_ESTIMATE);
+                    return false;
+                }
+                // Keep pos setpoint from drifting
+                pos_setpoint_ = SplitPos::from_float(fmodf_pos(pos_setpoint_.to_float(), *pos_wrap));
+                // Circular delta
+                pos_err = pos_setpoint_.to_float() - *pos_estimate_circular;
+                pos_err = wrap_pm(pos_err, *pos_wrap);
+            } else {
+                if (!pos_estimate_linear.has_value()) {
+                    set_error(ERROR_INVALID_ESTIMATE);
+                    return false;
+                }
+                // The large parts cancel in the split difference
+                SplitPos estimate = pos_estimate_split.has_value()
+                                  ? *pos_estimate_split : SplitPos::from_float(*pos_estimate_linear);
+                pos_err = (ref_origin_ - estimate) + ref.pos;
             }
-            // Keep pos setpoint from drifting
-            pos_setpoint_ = fmodf_pos(pos_setpoint_, *pos_wrap);
-            // Circular delta
-            pos_err = pos_setpoint_ - *pos_estimate_circular;
-            pos_err = wrap_pm(pos_err, *pos_wrap);
-        } else {
-            if (!pos_estimate_linear.has_value()) {
-                set_error(ERROR_INVALID_ESTIMATE);
-                return false;
+            // With the load encoder in the loop the gap closes by itself
+            if (!dual_loop_active_) {
+                pos_err += backlash_offset_;
             }
-            pos_err = pos_setpoint_ - *pos_estimate_linear;
+            pos_loop_err_ = pos_err;
+        } else {
+            pos_loop_countdown_--;
         }
+        float pos_err = pos_loop_err_;
 
-        vel_des += config_.pos_gain * pos_err;
+        vel_des += (config_.pos_gain * pos_gain_multiplier_) * pos_err;
         // V-shaped gain shedule based on position error
         float abs_pos_err = std::abs(pos_err);
         if (config_.enable_gain_scheduling && abs_pos_err <= config_.gain_scheduling_width) {
@@ -342,8 +1122,8 @@ bool Controller::update() {
 
     // TODO: Change to controller working in torque units
     // Torque per amp gain scheduling (ACIM)
-    float vel_gain = config_.vel_gain;
-    float vel_integrator_gain = config_.vel_integrator_gain;
+    float vel_gain = config_.vel_gain * vel_gain_multiplier_;
+    float vel_integrator_gain = config_.vel_integrator_gain * vel_integrator_gain_multiplier_;
     if (axis_->motor_.config_.motor_type == Motor::MOTOR_TYPE_ACIM) {
         float effective_flux = axis_->acim_estimator_.rotor_flux_;
         float minflux = axis_->motor_.config_.acim_gain_min_flux;
@@ -356,7 +1136,8 @@ bool Controller::update() {
     }
 
     // Velocity control
-    float torque = torque_setpoint_;
+    float torque = ref.torque;
+    float model_torque = 0.0f; // sum of the model feedforwards, which the ripple identification removes again
 
     // Anti-cogging is enabled after calibration
     // We get the current position and apply a current feed-forward
@@ -366,12 +1147,58 @@ bool Controller::update() {
             set_error(ERROR_INVALID_ESTIMATE);
             return false;
         }
-        float anticogging_pos = *anticogging_pos_estimate / axis_->encoder_.getCoggingRatio();
-        torque += config_.anticogging.cogging_map[std::clamp(mod((int)anticogging_pos, 3600), 0, 3600)];
+        model_torque += get_cogging_torque(*anticogging_pos_estimate);
+    }
+
+    // Transmission ripple and friction. The friction terms follow the sign of
+    // the velocity setpoint like friction_coulomb.
+    if (config_.ripple.enabled && !ripple_identification_.active) {
+        if (!anticogging_pos_estimate.has_value()) {
+            set_error(ERROR_INVALID_ESTIMATE);
+            return false;
+        }
+        float dir = 0.0f;
+        if constexpr (kMode >= CONTROL_MODE_VELOCITY_CONTROL) {
+            dir = (ref.vel > 0.0f) ? 1.0f : (ref.vel < 0.0f) ? -1.0f : 0.0f;
+        }
+        float pos_frac = (config_.ripple.period > 0.0f)
+                       ? fmodf_pos(*anticogging_pos_estimate, config_.ripple.period) / config_.ripple.period : 0.0f;
+        model_torque += ripple_model::eval(config_.ripple.harmonics,
+                                           std::min<uint32_t>(config_.ripple.harmonic_count, ripple_model::MAX_HARMONICS),
+                                           config_.ripple.coulomb_pos, config_.ripple.coulomb_neg,
+                                           pos_frac, dir, our_arm_sin_cos_f32);
+    }
+
+    // Friction feedforward on the velocity reference
+    if constexpr (kMode >= CONTROL_MODE_VELOCITY_CONTROL) {
+        if (ref.vel != 0.0f) {
+            model_torque += std::copysign(config_.friction_coulomb, ref.vel);
+        }
+        model_torque += config_.friction_viscous * ref.vel;
+    }
+
+    // Disturbance observer. It is fed the applied torque without the model
+    // feedforwards, so it only estimates what the friction, cogging and
+    // ripple models miss instead of compensating them a second time.
+    float dob_bandwidth = std::min(config_.disturbance_observer_bandwidth, 0.25f * current_meas_hz);
+    if (dob_bandwidth > 0.0f && config_.inertia > 0.0f && vel_estimate.has_value()) {
+        if (!dob_active_) {
+            dob_.reset(*vel_estimate, config_.inertia, dob_bandwidth);
+            dob_active_ = true;
+        } else {
+            float torque_applied = torque_output_.any().value_or(0.0f) - model_ff_torque_;
+            dob_.update(*vel_estimate, torque_applied, config_.inertia, dob_bandwidth, current_meas_period);
+        }
+    } else {
+        dob_active_ = false;
+        dob_.estimate_ = 0.0f;
     }
+    model_ff_torque_ = model_torque;
+
+    [[maybe_unused]] float v_err = 0.0f;
+    if constexpr (kMode >= CONTROL_MODE_VELOCITY_CONTROL) {
+        model_torque -= dob_.estimate_;
 
-    float v_err = 0.0f;
-    if (config_.control_mode >= CONTROL_MODE_VELOCITY_CONTROL) {
         if (!vel_estimate.has_value()) {
             set_error(ERROR_INVALID_ESTIMATE);
             return false;
@@ -383,14 +1210,24 @@ bool Controller::update() {
         // Velocity integral action before limiting
         torque += vel_integrator_torque_;
     }
+    torque += model_torque;
 
     // Velocity limiting in current mode
-    if (config_.control_mode < CONTROL_MODE_VELOCITY_CONTROL && config_.enable_torque_mode_vel_limit) {
-        if (!vel_estimate.has_value()) {
-            set_error(ERROR_INVALID_ESTIMATE);
-            return false;
+    if constexpr (kMode < CONTROL_MODE_VELOCITY_CONTROL) {
+        if (config_.enable_torque_mode_vel_limit) {
+            if (!vel_estimate.has_value()) {
+                set_error(ERROR_INVALID_ESTIMATE);
+                return false;
+            }
+            torque = limitVel(config_.vel_limit, *vel_estimate, vel_gain, torque);
+        }
+    }
+
+    // Notch out resonances before limiting so the filters can't exceed the limit
+    for (size_t i = 0; i < N_FILTERS; ++i) {
+        if (filter_valid_[i] && !config_.filters[i].on_vel_estimate) {
+            torque = biquads_[i].process(torque);
         }
-        torque = limitVel(config_.vel_limit, *vel_estimate, vel_gain, torque);
     }
 
     // Torque limiting
@@ -405,7 +1242,7 @@ bool Controller::update() {
     }
 
     // Velocity integrator (behaviour dependent on limiting)
-    if (config_.control_mode < CONTROL_MODE_VELOCITY_CONTROL) {
+    if constexpr (kMode < CONTROL_MODE_VELOCITY_CONTROL) {
         // reset integral if not in use
         vel_integrator_torque_ = 0.0f;
     } else {
@@ -421,14 +1258,16 @@ bool Controller::update() {
 
     float ideal_electrical_power = 0.0f;
     if (axis_->motor_.config_.motor_type != Motor::MOTOR_TYPE_GIMBAL) {
+        Motor::Sample_t sample = axis_->motor_.sample_.read();
         ideal_electrical_power = axis_->motor_.current_control_.power_ - \
-            SQ(axis_->motor_.current_control_.Iq_measured_) * 1.5f * axis_->motor_.config_.phase_resistance - \
-            SQ(axis_->motor_.current_control_.Id_measured_) * 1.5f * axis_->motor_.config_.phase_resistance;
+            SQ(sample.Iq_measured) * 1.5f * axis_->motor_.config_.phase_resistance - \
+            SQ(sample.Id_measured) * 1.5f * axis_->motor_.config_.phase_resistance;
     }
     else {
         ideal_electrical_power = axis_->motor_.current_control_.power_;
     }
-    mechanical_power_ += config_.mechanical_power_bandwidth * current_meas_period * (torque * *vel_estimate * M_PI * 2.0f - mechanical_power_);
+    float motor_vel = dual_loop_active_ ? *vel_estimate * config_.gear_ratio : *vel_estimate;
+    mechanical_power_ += config_.mechanical_power_bandwidth * current_meas_period * (torque * motor_vel * M_PI * 2.0f - mechanical_power_);
     electrical_power_ += config_.electrical_power_bandwidth * current_meas_period * (ideal_electrical_power - electrical_power_);
 
     // Spinout check
@@ -440,7 +1279,22 @@ bool Controller::update() {
         return false;
     }
 
+    if (config_.anticogging.calib_anticogging && config_.anticogging.calib_sweep) {
+        anticogging_sweep_sample(*anticogging_pos_estimate, torque);
+    }
+
+    ripple_identification_torque_ = torque - model_torque;
     torque_output_ = torque;
+    // The motors share the torque in the same iteration. Until the slave is
+    // armed, the own motor applies all of it.
+    if (torque_share_slave_) {
+        torque_share::Split_t split = {torque, 0.0f};
+        if (torque_share_slave_->motor_.is_armed_) {
+            split = torque_share::split(torque, config_.torque_share_ratio, config_.torque_share_preload);
+        }
+        own_torque_output_ = split.own;
+        torque_share_slave_->controller_.torque_output_ = split.other;
+    }
 
     // TODO: this is inconsistent with the other errors which are sticky.
     // However if we make ERROR_INVALID_ESTIMATE sticky then it will be
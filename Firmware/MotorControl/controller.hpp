@@ -1,19 +1,106 @@
 #ifndef __CONTROLLER_HPP
 #define __CONTROLLER_HPP
 
+#include <array>
+
+#include "cogging_model.hpp"
+#include "ripple_model.hpp"
+#include "waypoint_queue.hpp"
+#include "freq_response.hpp"
+#include "biquad.hpp"
+#include "input_shaper.hpp"
+#include "disturbance_observer.hpp"
+#include "cam_table.hpp"
+#include "snapshot.hpp"
+#include "config_transaction.hpp"
+#include "latency_histogram.hpp"
+#include "split_pos.hpp"
+#include "step_interpolator.hpp"
+#include "task_timer.hpp"
+
 class Controller : public ODriveIntf::ControllerIntf {
 public:
     struct Anticogging_t {
         uint32_t index = 0;
-        float cogging_map[3600];
+        uint32_t map_size = 3600;   // number of bins per turn. Takes effect after reboot.
+        bool quantized = true;      // store the map as int16 in units of `scale`. Takes effect after reboot.
+        float scale = 0.0f;         // [Nm/LSB] set by the calibration if quantized
         bool pre_calibrated = false;
         bool calib_anticogging = false;
         float calib_pos_threshold = 1.0f;
         float calib_vel_threshold = 1.0f;
         float cogging_ratio = 1.0f;
+        bool calib_sweep = false;           // sweep at calib_sweep_vel in both directions instead of stepping through the bins
+        float calib_sweep_vel = 0.2f;       // [turn/s]
         bool anticogging_enabled = true;
+        bool interpolate = true;            // interpolate linearly between the bins of the map
+        bool use_harmonic_model = false;    // use the harmonics from fit_anticogging_harmonics() instead of the map
+        uint32_t harmonic_count = 0;
+        float harmonic_offset = 0.0f;       // [Nm]
+        cogging_model::Harmonic_t harmonics[cogging_model::MAX_HARMONICS] = {};
+    };
+
+    // Torque ripple and friction feedforward of a transmission, see
+    // ripple_model. The harmonics are set with set_ripple_harmonic() or
+    // identified by start_ripple_identification().
+    struct Ripple_t {
+        bool enabled = false;
+        float period = 1.0f;                // [turn] of the motor encoder that the orders refer to
+        float coulomb_pos = 0.0f;           // [Nm] while the velocity setpoint is positive
+        float coulomb_neg = 0.0f;           // [Nm] while the velocity setpoint is negative
+        uint32_t harmonic_count = 0;
+        ripple_model::Harmonic_t harmonics[ripple_model::MAX_HARMONICS] = {};
+    };
+
+    // Piecewise linear multipliers of the gains over a scheduling variable.
+    // The points are spaced evenly from x_min to x_max so the lookup takes
+    // constant time.
+    struct GainSchedule_t {
+        static constexpr size_t MAX_POINTS = 16;
+        GainScheduleSource source = GAIN_SCHEDULE_SOURCE_NONE;
+        float x_min = 0.0f;
+        float x_max = 1.0f;
+        uint32_t n_points = 0;
+        // Points that were never written leave the gains unchanged
+        std::array<float, MAX_POINTS> pos_gain = unity();
+        std::array<float, MAX_POINTS> vel_gain = unity();
+        std::array<float, MAX_POINTS> vel_integrator_gain = unity();
+
+        static constexpr std::array<float, MAX_POINTS> unity() {
+            std::array<float, MAX_POINTS> table{};
+            for (float& multiplier : table) {
+                multiplier = 1.0f;
+            }
+            return table;
+        }
+    };
+
+    // Cam table of INPUT_MODE_CAM, see CamTable
+    struct Cam_t {
+        static constexpr size_t MAX_POINTS = 256;
+        CamMasterSource master_source = CAM_MASTER_SOURCE_ENCODER;
+        float master_period = 1.0f;     // [turn] of the master
+        float rise = 0.0f;              // [turn] follower advance per master period
+        uint32_t n_points = 0;
+        float points[MAX_POINTS] = {};  // [turn]
+    };
+
+    struct FilterSection_t {
+        FilterType type = FILTER_TYPE_NONE;
+        float frequency = 100.0f;       // [Hz] cutoff or notch frequency
+        float q = 0.707f;
+        bool on_vel_estimate = false;   // filter the velocity estimate instead of the torque command
+
+        // custom setters
+        Controller* parent;
+        void set_type(FilterType value) { type = value; config_changed<&Controller::update_filters>(parent); }
+        void set_frequency(float value) { frequency = value; config_changed<&Controller::update_filters>(parent); }
+        void set_q(float value) { q = value; config_changed<&Controller::update_filters>(parent); }
+        void set_on_vel_estimate(bool value) { on_vel_estimate = value; config_changed<&Controller::update_filters>(parent); }
     };
 
+    static constexpr size_t N_FILTERS = 4;
+
     struct Autotuning_t {
         float frequency = 0.0f;
         float pos_amplitude = 0.0f;
@@ -36,10 +123,21 @@ public:
         bool circular_setpoints = false;
         float circular_setpoint_range = 1.0f;    // Circular range when circular_setpoints is true. [turn]
         uint32_t steps_per_circular_range = 1024;
+        float step_interpolation_bandwidth = 0.0f; // [rad/s] 0 to use the step count as it is
         float inertia = 0.0f;                    // [Nm/(turn/s^2)]
+        float friction_coulomb = 0.0f;           // [Nm]
+        float friction_viscous = 0.0f;           // [Nm/(turn/s)]
+        float disturbance_observer_bandwidth = 0.0f; // [rad/s] 0 to disable
         float input_filter_bandwidth = 2.0f;     // [1/s]
         float homing_speed = 0.25f;              // [turn/s]
         Anticogging_t anticogging;
+        Ripple_t ripple;
+        GainSchedule_t gain_schedule;
+        Cam_t cam;
+        FilterSection_t filters[N_FILTERS];
+        InputShaperType input_shaper_type = INPUT_SHAPER_TYPE_NONE;
+        float input_shaper_frequency = 10.0f;   // [Hz] damped resonance frequency to cancel
+        float input_shaper_damping = 0.05f;     // damping ratio of the resonance
         float gain_scheduling_width = 10.0f;
         bool enable_gain_scheduling = false;
         bool enable_vel_limit = true;
@@ -48,7 +146,15 @@ public:
         uint8_t axis_to_mirror = -1;
         float mirror_ratio = 1.0f;
         float torque_mirror_ratio = 0.0f;
+        uint8_t torque_share_axis = -1;  // second motor on the same load, driven by this controller. -1 to disable.
+        float torque_share_ratio = 0.5f; // share of the torque for torque_share_axis, negative if it turns the load backwards
+        float torque_share_preload = 0.0f; // [Nm] bias between the two motors, see torque_share.hpp
         uint8_t load_encoder_axis = -1;  // default depends on Axis number and is set in load_configuration(). Set to -1 to select sensorless estimator.
+        bool dual_loop = false;          // velocity loop on this axis' encoder if load_encoder_axis is another axis
+        float gear_ratio = 1.0f;         // [turn/turn] motor encoder turns per load encoder turn for dual_loop
+        uint32_t position_loop_divider = 1; // the position loop runs every n-th control loop cycle
+        float backlash = 0.0f;           // [turn] of the load
+        float backlash_comp_vel = 1.0f;  // [turn/s] rate at which the backlash gap is crossed on reversal
         float mechanical_power_bandwidth = 20.0f; // [rad/s] filter cutoff for mechanical power for spinout detction
         float electrical_power_bandwidth = 20.0f; // [rad/s] filter cutoff for electrical power for spinout detection
         float spinout_electrical_power_threshold = 10.0f; // [W] electrical power threshold for spinout detection
@@ -56,9 +162,12 @@ public:
 
         // custom setters
         Controller* parent;
-        void set_input_filter_bandwidth(float value) { input_filter_bandwidth = value; parent->update_filter_gains(); }
+        void set_input_filter_bandwidth(float value) { input_filter_bandwidth = value; config_changed<&Controller::update_filter_gains>(parent); }
         void set_steps_per_circular_range(uint32_t value) { steps_per_circular_range = value > 0 ? value : steps_per_circular_range; }
         void set_control_mode(ControlMode value) { control_mode = value; parent->control_mode_updated(); }
+        void set_input_shaper_type(InputShaperType value) { input_shaper_type = value; config_changed<&Controller::update_input_shaper>(parent); }
+        void set_input_shaper_frequency(float value) { input_shaper_frequency = value; config_changed<&Controller::update_input_shaper>(parent); }
+        void set_input_shaper_damping(float value) { input_shaper_damping = value; config_changed<&Controller::update_input_shaper>(parent); }
     };
 
     
@@ -78,18 +187,108 @@ public:
     // Trajectory-Planned control
     void move_to_pos(float goal_point);
     void move_incremental(float displacement, bool from_goal_point);
+    float get_pos_setpoint() const { return pos_setpoint_.to_float(); }
     
     // TODO: make this more similar to other calibration loops
     void start_anticogging_calibration();
     float remove_anticogging_bias();
     bool anticogging_calibration(float pos_estimate, float vel_estimate);
+    bool anticogging_sweep_calibration(float pos_estimate);
+    void anticogging_sweep_sample(float pos_estimate, float torque);
     
     float get_anticogging_value(uint32_t index) {
-        return (index < 3600) ? config_.anticogging.cogging_map[index] : 0.0f;
+        return (index < cogging_map_size_) ? get_cogging_bin(index) : 0.0f;
+    }
+
+    float get_cogging_bin(uint32_t index) {
+        return cogging_map_i16_ ? (float)cogging_map_i16_[index] * config_.anticogging.scale
+                                : cogging_map_f32_[index];
+    }
+    void set_cogging_bin(uint32_t index, float torque);
+    float get_cogging_torque(float pos);
+    bool fit_anticogging_harmonics(uint32_t count);
+    uint32_t get_anticogging_harmonic_order(uint32_t index) {
+        return (index < config_.anticogging.harmonic_count) ? config_.anticogging.harmonics[index].order : 0;
+    }
+    float get_anticogging_harmonic_amplitude(uint32_t index) {
+        return (index < config_.anticogging.harmonic_count)
+            ? std::hypot(config_.anticogging.harmonics[index].a, config_.anticogging.harmonics[index].b) : 0.0f;
+    }
+    size_t cogging_map_bytes() const {
+        return config_.anticogging.map_size * (config_.anticogging.quantized ? sizeof(int16_t) : sizeof(float));
+    }
+
+    static size_t cogging_map_offset(size_t axis_num);
+    static size_t cogging_map_store_bytes();
+
+    // Backing store of the cogging maps, at the start of the RAM arena (see
+    // partition_ram_arena() in main.cpp). Each axis uses a slice that starts
+    // after the slices of the lower numbered axes. The store is saved to NVM
+    // separately from Config_t.
+    static uint8_t* cogging_map_store_;
+    static size_t cogging_map_store_size_; // [bytes]
+
+    bool push_waypoint(float dt, float pos, float vel, float torque_ff) {
+        return waypoints_.push({dt, pos, vel, torque_ff});
+    }
+    void clear_waypoints();
+    uint32_t get_waypoint_count() { return waypoints_.size(); }
+
+    bool start_sysid();
+    float get_sysid_frequency(uint32_t index) {
+        return (index < sysid_.n_done) ? sysid_.points_[index].frequency : 0.0f;
+    }
+    float get_sysid_gain(uint32_t index) {
+        return (index < sysid_.n_done) ? sysid_.points_[index].gain : 0.0f;
+    }
+    float get_sysid_phase(uint32_t index) {
+        return (index < sysid_.n_done) ? sysid_.points_[index].phase : 0.0f;
+    }
+
+    bool start_identification();
+    bool start_ripple_identification();
+    bool set_ripple_harmonic(uint32_t index, uint32_t order, float a, float b, float a_friction, float b_friction);
+    uint32_t get_ripple_harmonic_order(uint32_t index) {
+        return (index < ripple_model::MAX_HARMONICS) ? config_.ripple.harmonics[index].order : 0;
+    }
+    float get_ripple_harmonic_a(uint32_t index) {
+        return (index < ripple_model::MAX_HARMONICS) ? config_.ripple.harmonics[index].a : 0.0f;
+    }
+    float get_ripple_harmonic_b(uint32_t index) {
+        return (index < ripple_model::MAX_HARMONICS) ? config_.ripple.harmonics[index].b : 0.0f;
+    }
+    float get_ripple_harmonic_a_friction(uint32_t index) {
+        return (index < ripple_model::MAX_HARMONICS) ? config_.ripple.harmonics[index].a_friction : 0.0f;
+    }
+    float get_ripple_harmonic_b_friction(uint32_t index) {
+        return (index < ripple_model::MAX_HARMONICS) ? config_.ripple.harmonics[index].b_friction : 0.0f;
+    }
+
+    bool set_cam_points(uint32_t index, float p0, float p1, float p2, float p3);
+    float get_cam_point(uint32_t index) {
+        return (index < Cam_t::MAX_POINTS) ? config_.cam.points[index] : 0.0f;
+    }
+
+    void update_gain_schedule(float x);
+    bool set_gain_schedule_point(uint32_t index, float pos_gain, float vel_gain, float vel_integrator_gain);
+    float get_gain_schedule_pos_gain(uint32_t index) {
+        return (index < GainSchedule_t::MAX_POINTS) ? config_.gain_schedule.pos_gain[index] : 0.0f;
+    }
+    float get_gain_schedule_vel_gain(uint32_t index) {
+        return (index < GainSchedule_t::MAX_POINTS) ? config_.gain_schedule.vel_gain[index] : 0.0f;
+    }
+    float get_gain_schedule_vel_integrator_gain(uint32_t index) {
+        return (index < GainSchedule_t::MAX_POINTS) ? config_.gain_schedule.vel_integrator_gain[index] : 0.0f;
     }
 
     void update_filter_gains();
+    void update_filters();
+    void update_input_shaper();
+    void select_update_fn();
     bool update();
+    template<ControlMode kMode> bool update_impl();
+    bool is_torque_share_slave();
+    float torque_limit();
 
     Config_t config_;
     Axis* axis_ = nullptr; // set by Axis constructor
@@ -99,11 +298,12 @@ public:
 
     // Inputs
     InputPort<float> pos_estimate_linear_src_;
+    InputPort<SplitPos> pos_estimate_split_src_; // pos_estimate_linear_src_ at full resolution, if the source has it
     InputPort<float> pos_estimate_circular_src_;
     InputPort<float> vel_estimate_src_;
     InputPort<float> pos_wrap_src_; 
 
-    float pos_setpoint_ = 0.0f; // [turns]
+    SplitPos pos_setpoint_; // [turns]
     float vel_setpoint_ = 0.0f; // [turn/s]
     // float vel_setpoint = 800.0f; <sensorless example>
     float vel_integrator_torque_ = 0.0f;    // [Nm]
@@ -115,22 +315,116 @@ public:
     float input_filter_kp_ = 0.0f;
     float input_filter_ki_ = 0.0f;
 
+    float gain_schedule_input_ = 0.0f; // scheduling variable for GAIN_SCHEDULE_SOURCE_INPUT
+    float pos_gain_multiplier_ = 1.0f;
+    float vel_gain_multiplier_ = 1.0f;
+    float vel_integrator_gain_multiplier_ = 1.0f;
+
     Autotuning_t autotuning_;
+    FrequencyResponse sysid_;
+    InertiaFrictionId identification_;
+    ripple_model::RippleId ripple_identification_;
+    float ripple_identification_torque_ = 0.0f; // [Nm] torque of the last cycle without the model feedforwards
+
+    StepInterpolator step_interpolator_; // used while config_.step_interpolation_bandwidth > 0
+
+    DisturbanceObserver dob_;
+    bool dob_active_ = false;   // dob_ was reset for the current configuration
+    float model_ff_torque_ = 0.0f; // [Nm] friction, cogging and ripple feedforward of the last cycle, not seen by dob_
+
+    // Runtime state of config_.filters. Invalid sections pass their input through.
+    Biquad biquads_[N_FILTERS];
+    bool filter_valid_[N_FILTERS] = {};
+    float vel_estimate_filtered_ = 0.0f; // [turn/s]
+
+    // Runtime state of the input shaper. The shaped setpoints only feed the
+    // control law, so pos_setpoint_ etc. stay the unshaped reference.
+    InputShaper input_shaper_;
+    bool input_shaper_active_ = false; // history filled with the current setpoint
+    SplitPos ref_origin_; // [turn] the shaper works on positions relative to this
     float autotuning_phase_ = 0.0f;
     
+    // Specialized update path, only set by update() through select_update_fn()
+    bool (*update_fn_)(Controller* ctrl) = nullptr;
+    ControlMode update_fn_mode_ = CONTROL_MODE_POSITION_CONTROL;
+    TaskTimer* update_fn_timer_ = nullptr; // one of axis_->task_times_.controller_update_*
+
+    bool dual_loop_active_ = false;     // set when the estimates are connected
+    Axis* torque_share_slave_ = nullptr; // set from config_.torque_share_axis when the estimates are connected
+    uint32_t pos_loop_countdown_ = 0;   // cycles until the next position loop update
+    float pos_loop_err_ = 0.0f;         // [turn] position error of the last position loop update
+    float backlash_offset_ = 0.0f;      // [turn] lead of the motor over the load
+    float backlash_dir_ = 1.0f;
+
     bool input_pos_updated_ = false;
+
+    // Input setpoints published by the CAN RX interrupt, see
+    // CANSimple::try_fast_setpoint(). They are applied at the start of the
+    // next update() in the order pos, vel, torque.
+    struct FastInputPos_t { float pos; float vel_ff; float torque_ff; };
+    struct FastInputVel_t { float vel; float torque_ff; };
+    Snapshot<FastInputPos_t> fast_input_pos_;
+    Snapshot<FastInputVel_t> fast_input_vel_;
+    Snapshot<float> fast_input_torque_;
+    uint32_t fast_input_pos_seen_ = 0; // get_n_published() of the last applied value
+    uint32_t fast_input_vel_seen_ = 0;
+    uint32_t fast_input_torque_seen_ = 0;
+    void apply_fast_inputs();
+
+    // Arrival of the latest input setpoint for odrv.setpoint_latencies, see
+    // tag_input(). update() moves it to applied_input_tag_ and
+    // Motor::pwm_update_cb() records it.
+    struct InputTag_t {
+        uint32_t cycles; // DWT cycle counter at the arrival
+        LatencyStats* stats; // nullptr if there is none
+    };
+    InputTag_t input_tag_ = {0, nullptr};
+    InputTag_t applied_input_tag_ = {0, nullptr};
+    void tag_input();
     
     bool trajectory_done_ = true;
+    // The trajectories are planned relative to the setpoint they start from,
+    // so that their float positions stay small on long axes
+    SplitPos trajectory_origin_; // [turn]
+
+    static constexpr size_t WAYPOINT_QUEUE_SIZE = 64;
+    WaypointQueue<WAYPOINT_QUEUE_SIZE> waypoints_;
+    bool waypoints_active_ = false; // playback started from the current setpoint
 
     bool anticogging_valid_ = false;
+    float anticogging_progress_ = 0.0f; // fraction of the calibration done
+
+    enum SweepState_t : uint8_t {
+        SWEEP_START,
+        SWEEP_FORWARD_LEADIN,
+        SWEEP_FORWARD,
+        SWEEP_REVERSE_LEADIN,
+        SWEEP_REVERSE,
+    };
+    static constexpr float SWEEP_LEADIN = 0.05f; // [turn] distance to settle at the sweep velocity before recording
+    SweepState_t sweep_state_ = SWEEP_START;
+    float sweep_setpoint_ = 0.0f;       // [turn]
+    float sweep_leadin_end_ = 0.0f;     // [turn]
+    uint32_t sweep_bin_ = 0;            // bin the samples are currently accumulated for
+    uint32_t sweep_bins_done_ = 0;      // bins completed in the current direction
+    uint32_t sweep_samples_ = 0;
+    float sweep_torque_sum_ = 0.0f;     // [Nm]
+    // Slice of cogging_map_store_ assigned by apply_config(). Exactly one of
+    // the pointers is set if cogging_map_size_ > 0.
+    uint32_t cogging_map_size_ = 0;
+    float* cogging_map_f32_ = nullptr;
+    int16_t* cogging_map_i16_ = nullptr;
     float mechanical_power_ = 0.0f; // [W]
     float electrical_power_ = 0.0f; // [W]
 
     // Outputs
     OutputPort<float> torque_output_ = 0.0f;
+    OutputPort<float> own_torque_output_ = 0.0f; // share of torque_output_ for the own motor while torque_share_slave_ is set
 
     // custom setters
-    void set_input_pos(float value) { set_input_pos_and_steps(value); input_pos_updated(); }
+    void set_input_pos(float value) { set_input_pos_and_steps(value); input_pos_updated(); tag_input(); }
+    void set_input_vel(float value) { input_vel_ = value; tag_input(); }
+    void set_input_torque(float value) { input_torque_ = value; tag_input(); }
 };
 
 #endif // __CONTROLLER_HPP
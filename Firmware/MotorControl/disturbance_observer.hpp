@@ -0,0 +1,189 @@
+#ifndef __DISTURBANCE_OBSERVER_HPP
+#define __DISTURBANCE_OBSERVER_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <cmath>
+
+/**
+ * @brief Estimates the load torque from the velocity and the applied torque.
+ *
+ * With the rigid body model J * dv/dt = torque + disturbance the estimate is
+ * the disturbance J * dv/dt - torque low-pass filtered with the bandwidth L.
+ * The filter is implemented on q = estimate - L * J * v, which avoids
+ * differentiating the velocity.
+ */
+class DisturbanceObserver {
+public:
+    // @brief Starts with a zero estimate at velocity vel
+    void reset(float vel, float inertia, float bandwidth) {
+        q_ = -bandwidth * inertia * vel;
+        estimate_ = 0.0f;
+    }
+
+    /**
+     * @param vel: Velocity estimate of this cycle [turn/s]
+     * @param torque: Torque applied during the previous cycle [Nm]
+     * @param inertia: [Nm/(turn/s^2)]
+     * @param bandwidth: [rad/s] must be below 2 / dt for stability
+     * @returns the estimated disturbance torque [Nm]
+     */
+    float update(float vel, float torque, float inertia, float bandwidth, float dt) {
+        float p = bandwidth * inertia * vel;
+        q_ -= dt * bandwidth * (q_ + p + torque);
+        estimate_ = q_ + p;
+        return estimate_;
+    }
+
+    float estimate_ = 0.0f; // [Nm]
+
+private:
+    float q_ = 0.0f;
+};
+
+/**
+ * @brief Identifies inertia, Coulomb friction and viscous friction by running
+ * a velocity script and fitting torque = J * a + Fc * sign(v) + B * v.
+ *
+ * The script ramps with `accel` to half of `vel`, to `vel`, to the same two
+ * velocities in reverse and back to standstill, holding each velocity for
+ * `hold_time`. The two velocity levels separate the Coulomb and viscous
+ * terms, the ramps give the inertia. The acceleration regressor is the
+ * commanded acceleration, which doesn't need a derivative of the noisy
+ * velocity estimate but assumes that the velocity loop tracks the ramps.
+ * Samples below a fifth of `vel` are ignored where the sign of the velocity
+ * is uncertain.
+ */
+class InertiaFrictionId {
+public:
+    struct Setpoint_t {
+        float vel;  // [turn/s]
+        float acc;  // [turn/s^2]
+    };
+
+    // @brief Starts the script. Returns false if the parameters are invalid.
+    bool start() {
+        if (!(vel > 0.0f) || !(accel > 0.0f) || !(hold_time >= 0.0f)) {
+            return false;
+        }
+        for (size_t i = 0; i < 3; ++i) {
+            xy_[i] = 0.0f;
+            for (size_t j = 0; j < 3; ++j) {
+                xx_[i][j] = 0.0f;
+            }
+        }
+        segment_ = 0;
+        holding_ = false;
+        t_ = 0.0f;
+        vel_sp_ = 0.0f;
+        acc_sp_ = 0.0f;
+        valid = false;
+        active = true;
+        return true;
+    }
+
+    void stop() {
+        active = false;
+    }
+
+    /**
+     * @brief Records the response to the previous setpoint and returns the
+     * next one. At the end of the script the result is fitted and active is
+     * cleared.
+     * @param vel_estimate: Velocity estimate of this cycle [turn/s]
+     * @param torque: Torque applied during the previous cycle [Nm]
+     */
+    Setpoint_t step(float vel_estimate, float torque, float dt) {
+        if (!active) {
+            return {0.0f, 0.0f};
+        }
+
+        if (std::abs(vel_estimate) >= 0.2f * vel) {
+            float x[3] = {acc_sp_, std::copysign(1.0f, vel_estimate), vel_estimate};
+            for (size_t i = 0; i < 3; ++i) {
+                xy_[i] += x[i] * torque;
+                for (size_t j = 0; j < 3; ++j) {
+                    xx_[i][j] += x[i] * x[j];
+                }
+            }
+        }
+
+        const float targets[N_SEGMENTS] = {0.5f * vel, vel, -0.5f * vel, -vel, 0.0f};
+        float target = targets[segment_];
+        if (!holding_) {
+            float step = accel * dt;
+            if (std::abs(target - vel_sp_) <= step) {
+                vel_sp_ = target;
+                acc_sp_ = 0.0f;
+                holding_ = true;
+                t_ = 0.0f;
+            } else {
+                acc_sp_ = std::copysign(accel, target - vel_sp_);
+                vel_sp_ += acc_sp_ * dt;
+            }
+        } else if ((t_ += dt) >= hold_time) {
+            holding_ = false;
+            if (++segment_ >= N_SEGMENTS) {
+                active = false;
+                valid = fit();
+                return {0.0f, 0.0f};
+            }
+        }
+        return {vel_sp_, acc_sp_};
+    }
+
+    // Parameters
+    float vel = 2.0f;           // [turn/s]
+    float accel = 10.0f;        // [turn/s^2]
+    float hold_time = 1.0f;     // [s]
+
+    // State
+    bool active = false;
+    bool valid = false;         // the results are from a completed script
+    float inertia = 0.0f;       // [Nm/(turn/s^2)]
+    float coulomb = 0.0f;       // [Nm]
+    float viscous = 0.0f;       // [Nm/(turn/s)]
+
+private:
+    static constexpr size_t N_SEGMENTS = 5;
+
+    // Solves the normal equations with Cramer's rule
+    bool fit() {
+        auto det3 = [](const float m[3][3]) {
+            return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+                 - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+                 + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+        };
+        float det = det3(xx_);
+        if (!(std::abs(det) > 0.0f)) {
+            return false;
+        }
+        float result[3];
+        for (size_t k = 0; k < 3; ++k) {
+            float m[3][3];
+            for (size_t i = 0; i < 3; ++i) {
+                for (size_t j = 0; j < 3; ++j) {
+                    m[i][j] = (j == k) ? xy_[i] : xx_[i][j];
+                }
+            }
+            result[k] = det3(m) / det;
+        }
+        if (!std::isfinite(result[0]) || !std::isfinite(result[1]) || !std::isfinite(result[2])) {
+            return false;
+        }
+        inertia = result[0];
+        coulomb = result[1];
+        viscous = result[2];
+        return true;
+    }
+
+    float xx_[3][3] = {};
+    float xy_[3] = {};
+    size_t segment_ = 0;
+    bool holding_ = false;
+    float t_ = 0.0f;            // [s] time in the current hold
+    float vel_sp_ = 0.0f;
+    float acc_sp_ = 0.0f;
+};
+
+#endif // __DISTURBANCE_OBSERVER_HPP
@@ -1,25 +1,52 @@
 
 #include "odrive_main.h"
 #include <Drivers/STM32/stm32_system.h>
-#include <bitset>
 
 Encoder::Encoder(TIM_HandleTypeDef* timer, Stm32Gpio index_gpio,
+                 uint32_t index_capture_channel, uint8_t index_capture_af,
                  Stm32Gpio hallA_gpio, Stm32Gpio hallB_gpio, Stm32Gpio hallC_gpio,
                  Stm32SpiArbiter* spi_arbiter) :
         timer_(timer), index_gpio_(index_gpio),
+        index_capture_channel_(index_capture_channel), index_capture_af_(index_capture_af),
         hallA_gpio_(hallA_gpio), hallB_gpio_(hallB_gpio), hallC_gpio_(hallC_gpio),
         spi_arbiter_(spi_arbiter)
 {
+    select_update_fn();
 }
 
 static void enc_index_cb_wrapper(void* ctx) {
     reinterpret_cast<Encoder*>(ctx)->enc_index_cb();
 }
 
+static void hall_edge_cb_wrapper(void* ctx) {
+    reinterpret_cast<Encoder*>(ctx)->hall_edge_cb();
+}
+
+static void mt_edge_cb_wrapper(void* ctx) {
+    reinterpret_cast<Encoder*>(ctx)->mt_edge_cb();
+}
+
 bool Encoder::apply_config(ODriveIntf::MotorIntf::MotorType motor_type) {
     config_.parent = this;
 
     update_pll_gains();
+    select_abs_spi_decoder();
+
+    if (config_.mode == MODE_SPI_ABS_BISS_C || config_.mode == MODE_SPI_ABS_SSI) {
+        size_t n_data_bits = config_.serial_multiturn_bits + config_.serial_singleturn_bits;
+        size_t n_words = (config_.mode == MODE_SPI_ABS_BISS_C)
+                ? serial_abs::biss_c_frame_words(n_data_bits)
+                : serial_abs::ssi_frame_words(n_data_bits);
+        if (n_data_bits > serial_abs::MAX_DATA_BITS || n_words > ABS_SPI_MAX_WORDS
+                || config_.serial_singleturn_bits > 30) {
+            return false;
+        }
+        abs_spi_frame_words_ = n_words;
+        abs_spi_data_bits_ = n_data_bits;
+        abs_spi_singleturn_mask_ = (1ull << config_.serial_singleturn_bits) - 1;
+    } else {
+        abs_spi_frame_words_ = 1;
+    }
 
     if (config_.pre_calibrated) {
         if (config_.mode == Encoder::MODE_HALL && config_.hall_polarity_calibrated)
@@ -38,12 +65,14 @@ void Encoder::setup() {
     set_idx_subscribe();
 
     mode_ = config_.mode;
+    select_update_fn();
+    set_hall_edge_subscribe();
 
     spi_task_.config = {
         .Mode = SPI_MODE_MASTER,
         .Direction = SPI_DIRECTION_2LINES,
         .DataSize = SPI_DATASIZE_16BIT,
-        .CLKPolarity = (mode_ == MODE_SPI_ABS_AEAT || mode_ == MODE_SPI_ABS_MA732) ? SPI_POLARITY_HIGH : SPI_POLARITY_LOW,
+        .CLKPolarity = (mode_ == MODE_SPI_ABS_AEAT || mode_ == MODE_SPI_ABS_MA732 || mode_ == MODE_SPI_ABS_BISS_C || mode_ == MODE_SPI_ABS_SSI) ? SPI_POLARITY_HIGH : SPI_POLARITY_LOW,
         .CLKPhase = SPI_PHASE_2EDGE,
         .NSS = SPI_NSS_SOFT,
         .BaudRatePrescaler = SPI_BAUDRATEPRESCALER_16,
@@ -70,7 +99,11 @@ void Encoder::set_error(Error error) {
     vel_estimate_valid_ = false;
     pos_estimate_valid_ = false;
     error_ |= error;
-    axis_->error_ |= Axis::ERROR_ENCODER_FAILED;
+    // The fused estimator raises the axis error itself once it can no
+    // longer continue on the sensorless estimate.
+    if (!axis_->fused_estimator_.can_take_over()) {
+        axis_->error_ |= Axis::ERROR_ENCODER_FAILED;
+    }
 }
 
 bool Encoder::do_checks(){
@@ -84,49 +117,187 @@ bool Encoder::do_checks(){
 // Triggered when an encoder passes over the "Index" pin
 // TODO: only arm index edge interrupt when we know encoder has powered up
 // (maybe by attaching the interrupt on start search, synergistic with following)
+// This only takes the timer count at the pulse, update() applies it. With the
+// capture channel the count is latched by the timer at the edge, so the
+// interrupt latency doesn't matter. Otherwise it is read here.
 void Encoder::enc_index_cb() {
+    TIM_TypeDef* tim = timer_->Instance;
+    uint32_t capture_flag = TIM_SR_CC1IF << (index_capture_channel_ / TIM_CHANNEL_2);
+    int16_t cnt;
+    if (index_capture_active_ && (tim->SR & capture_flag)) {
+        cnt = (int16_t)__HAL_TIM_GET_COMPARE(timer_, index_capture_channel_); // clears the flag
+    } else {
+        cnt = (int16_t)tim->CNT;
+    }
+
     if (config_.use_index) {
-        set_circular_count(0, false);
-        if (config_.use_index_offset)
-            set_linear_count((int32_t)(config_.index_offset * config_.cpr));
-        if (config_.pre_calibrated) {
-            is_ready_ = true;
-            if(axis_->controller_.config_.anticogging.pre_calibrated){
-                axis_->controller_.anticogging_valid_ = true;
-            }
-        } else {
-            // We can't use the update_offset facility in set_circular_count because
-            // we also set the linear count before there is a chance to update. Therefore:
-            // Invalidate offset calibration that may have happened before idx search
-            is_ready_ = false;
+        index_cnt_.publish(cnt);
+    }
+
+    // Stay subscribed to check the following pulses
+    if (!config_.use_index || !(config_.index_check_tolerance > 0)) {
+        index_gpio_.unsubscribe();
+    }
+}
+
+// @brief Applies an index pulse at the given timer count. Runs in update()
+// before the count is advanced.
+void Encoder::apply_index(int16_t index_cnt) {
+    // Counts from the pulse to the position that count_in_cpr_ refers to.
+    // Other modes don't have the timer count, there the pulse counts as now.
+    int32_t from_index = (mode_ == MODE_INCREMENTAL) ? (int32_t)(int16_t)(tim_cnt_last_ - index_cnt) : 0;
+
+    if (index_found_) {
+        // Lost or extra counts move the index away from count 0
+        index_error_ = mod(count_in_cpr_ - from_index + config_.cpr / 2, config_.cpr) - config_.cpr / 2;
+        if (config_.index_check_tolerance > 0 && std::abs(index_error_) > config_.index_check_tolerance) {
+            set_error(ERROR_INDEX_MISMATCH);
         }
-        index_found_ = true;
+        return;
     }
 
-    // Disable interrupt
-    index_gpio_.unsubscribe();
+    // The position at the pulse becomes 0 (circular) and index_offset
+    // (linear). The estimates move by the same amount, so the velocity
+    // estimate doesn't see a jump.
+    int32_t old_count_in_cpr = count_in_cpr_;
+    count_in_cpr_ = mod(from_index, config_.cpr);
+    pos_cpr_counts_ = fmodf_pos(pos_cpr_counts_ + (float)(count_in_cpr_ - old_count_in_cpr), (float)config_.cpr);
+    if (config_.use_index_offset) {
+        int64_t old_shadow_count = shadow_count_;
+        shadow_count_ = (int64_t)(config_.index_offset * config_.cpr) + from_index;
+        shift_pos_estimate(shadow_count_ - old_shadow_count);
+    }
+
+    if (config_.pre_calibrated) {
+        is_ready_ = true;
+        if(axis_->controller_.config_.anticogging.pre_calibrated){
+            axis_->controller_.anticogging_valid_ = true;
+        }
+    } else {
+        // We can't use the update_offset facility in set_circular_count because
+        // we also set the linear count before there is a chance to update. Therefore:
+        // Invalidate offset calibration that may have happened before idx search
+        is_ready_ = false;
+    }
+    index_found_ = true;
 }
 
 void Encoder::set_idx_subscribe(bool override_enable) {
     if (config_.use_index && (override_enable || !config_.find_idx_on_lockin_only)) {
+        set_index_capture(config_.mode == MODE_INCREMENTAL);
         if (!index_gpio_.subscribe(true, false, enc_index_cb_wrapper, this)) {
             odrv.misconfigured_ = true;
         }
     } else if (!config_.use_index || config_.find_idx_on_lockin_only) {
         index_gpio_.unsubscribe();
+        set_index_capture(false);
+    }
+
+    // The index pin doubles as hall C input, so the above may have dropped
+    // the hall edge subscription.
+    set_hall_edge_subscribe();
+}
+
+// @brief Routes the index pin to the input capture channel of the encoder
+// timer, if the board has one, which latches CNT on the rising edge. The
+// EXTI still triggers enc_index_cb() since it sees the pin in alternate
+// function mode too.
+void Encoder::set_index_capture(bool enable) {
+    if (!index_capture_af_ || enable == index_capture_active_) {
+        return;
+    }
+    TIM_TypeDef* tim = timer_->Instance;
+    if (enable) {
+        TIM_IC_InitTypeDef ic_config;
+        ic_config.ICPolarity = TIM_ICPOLARITY_RISING;
+        ic_config.ICSelection = TIM_ICSELECTION_DIRECTTI;
+        ic_config.ICPrescaler = TIM_ICPSC_DIV1;
+        ic_config.ICFilter = 4; // same as the A and B inputs
+        HAL_TIM_IC_ConfigChannel(timer_, &ic_config, index_capture_channel_);
+        tim->CCER |= TIM_CCER_CC1E << index_capture_channel_;
+        index_gpio_.config(GPIO_MODE_AF_PP, GPIO_NOPULL, GPIO_SPEED_FREQ_LOW, index_capture_af_);
+    } else {
+        index_gpio_.config(GPIO_MODE_INPUT, GPIO_NOPULL);
+        tim->CCER &= ~(TIM_CCER_CC1E << index_capture_channel_);
+    }
+    index_capture_active_ = enable;
+}
+
+// Triggered on every edge of any of the hall sensors
+void Encoder::hall_edge_cb() {
+    uint32_t cycles = DWT->CYCCNT;
+    HallEdge_t edge;
+    edge.cycles = cycles;
+    edge.interval = cycles - hall_edge_last_cycles_;
+    hall_edge_last_cycles_ = cycles;
+    hall_edge_.publish(edge);
+}
+
+// Triggered on rising edges of the A channel of an incremental encoder while
+// the M/T velocity estimator is armed
+void Encoder::mt_edge_cb() {
+    MtEdge_t edge;
+    edge.cycles = DWT->CYCCNT;
+    edge.count = (int16_t)timer_->Instance->CNT;
+    mt_edge_.publish(edge);
+}
+
+void Encoder::set_hall_edge_subscribe() {
+    if (mode_ != MODE_HALL) {
+        return; // the pins may be used for other purposes (e.g. index)
+    }
+
+    hallA_gpio_.unsubscribe();
+    hallB_gpio_.unsubscribe();
+    hallC_gpio_.unsubscribe();
+    if (config_.use_hall_edge_timing) {
+        if (!hallA_gpio_.subscribe(true, true, hall_edge_cb_wrapper, this)
+                || !hallB_gpio_.subscribe(true, true, hall_edge_cb_wrapper, this)
+                || !hallC_gpio_.subscribe(true, true, hall_edge_cb_wrapper, this)) {
+            odrv.misconfigured_ = true;
+        }
     }
 }
 
 void Encoder::update_pll_gains() {
-    pll_kp_ = 2.0f * config_.bandwidth;  // basic conversion to discrete time
-    pll_ki_ = 0.25f * (pll_kp_ * pll_kp_); // Critically damped
+    set_pll_bandwidth(config_.bandwidth);
+
+    kalman_load_accel_counts_ = 0.0f;
+    if (config_.use_kalman_filter) {
+        if (!compute_kalman_tracker_gains(config_.kalman_accel_noise * (float)config_.cpr, config_.kalman_meas_noise,
+                                          current_meas_period, &kalman_gains_)) {
+            kalman_gains_ = {};
+            set_error(ERROR_UNSTABLE_GAIN);
+        }
+        return;
+    }
 
     // Check that we don't get problems with discrete time approximation
-    if (!(current_meas_period * pll_kp_ < 1.0f)) {
+    float max_bandwidth = config_.enable_adaptive_bandwidth ? std::max(config_.bandwidth, config_.bandwidth_high) : config_.bandwidth;
+    if (!(current_meas_period * 2.0f * max_bandwidth < 1.0f)) {
         set_error(ERROR_UNSTABLE_GAIN);
     }
 }
 
+void Encoder::set_pll_bandwidth(float bandwidth) {
+    pll_kp_ = 2.0f * bandwidth;  // basic conversion to discrete time
+    pll_ki_ = 0.25f * (pll_kp_ * pll_kp_); // Critically damped
+}
+
+// @brief Schedules the PLL bandwidth on the speed: config_.bandwidth up to
+// adaptive_vel_low for noise rejection, ramping up to bandwidth_high at
+// adaptive_vel_high for tracking.
+void Encoder::update_adaptive_bandwidth() {
+    float abs_vel = std::abs(vel_estimate_counts_) / (float)config_.cpr;
+    float span = config_.adaptive_vel_high - config_.adaptive_vel_low;
+    float x;
+    if (span > 0.0f)
+        x = std::clamp((abs_vel - config_.adaptive_vel_low) / span, 0.0f, 1.0f);
+    else
+        x = (abs_vel >= config_.adaptive_vel_high) ? 1.0f : 0.0f;
+    set_pll_bandwidth(config_.bandwidth + x * (config_.bandwidth_high - config_.bandwidth));
+}
+
 void Encoder::check_pre_calibrated() {
     // TODO: restoring config from python backup is fragile here (ACIM motor type must be set first)
     if (axis_->motor_.config_.motor_type != Motor::MOTOR_TYPE_ACIM) {
@@ -144,8 +315,12 @@ void Encoder::set_linear_count(int32_t count) {
 
     // Update states
     shadow_count_ = count;
-    pos_estimate_counts_ = (float)count;
+    pos_estimate_base_counts_ = 0;
+    pos_estimate_turns_ = 0;
+    pos_estimate_counts_ = 0.0f;
+    shift_pos_estimate(count);
     tim_cnt_sample_ = count;
+    tim_cnt_last_ = count;
 
     //Write hardware last
     timer_->Instance->CNT = count;
@@ -181,7 +356,7 @@ bool Encoder::run_index_search() {
 }
 
 bool Encoder::run_direction_find() {
-    int32_t init_enc_val = shadow_count_;
+    int64_t init_enc_val = shadow_count_;
 
     Axis::LockinConfig_t lockin_config = axis_->config_.calibration_lockin;
     lockin_config.finish_distance = lockin_config.vel * 3.0f; // run for 3 seconds
@@ -207,121 +382,221 @@ bool Encoder::run_direction_find() {
 }
 
 
-bool Encoder::run_hall_polarity_calibration() {
+// @brief Spins the rotor in lockin and feeds the hall states to
+// hall_calibration_ once it turns at constant velocity.
+// @param duration: [s] at the calibration lockin velocity
+bool Encoder::run_hall_calibration_spin(float duration) {
     Axis::LockinConfig_t lockin_config = axis_->config_.calibration_lockin;
-    lockin_config.finish_distance = lockin_config.vel * 3.0f; // run for 3 seconds
+    lockin_config.finish_distance = lockin_config.vel * duration;
     lockin_config.finish_on_distance = true;
     lockin_config.finish_on_enc_idx = false;
     lockin_config.finish_on_vel = false;
 
     auto loop_cb = [this](bool const_vel) {
         if (const_vel)
-            sample_hall_states_ = true;
+            sample_hall_ = true;
         // No need to cancel early
         return true;
     };
 
+    // TODO: There is a race condition here with the execution in Encoder::update.
+    // We should evaluate making thread execution synchronous with the control loops
+    // at least optionally.
+    // Perhaps the new loop_sync feature will give a loose timing guarantee that may be sufficient
     config_.hall_polarity_calibrated = false;
-    states_seen_count_.fill(0);
+    hall_calibration_.reset();
+    calibrate_hall_ = true;
+    select_update_fn();
     bool success = axis_->run_lockin_spin(lockin_config, false, loop_cb);
-    sample_hall_states_ = false;
+    calibrate_hall_ = false;
+    sample_hall_ = false;
+    select_update_fn();
+    if (error_ & ERROR_ILLEGAL_HALL_STATE)
+        success = false;
+    return success;
+}
+
+bool Encoder::run_hall_polarity_calibration() {
+    if (!run_hall_calibration_spin(3.0f))
+        return false;
+
+    uint8_t hall_polarity;
+    if (hall_calibration_.get_polarity(&hall_polarity) != HallCalibration::kOk) {
+        set_error(ERROR_ILLEGAL_HALL_STATE);
+        return false;
+    }
+    config_.hall_polarity = hall_polarity;
+    config_.hall_polarity_calibrated = true;
+    return true;
+}
+
+// @brief Calibrates the hall polarity and the edge offsets in the same spin,
+// so it doesn't need to run after run_hall_polarity_calibration().
+bool Encoder::run_hall_phase_calibration() {
+    bool success = run_hall_calibration_spin(30.0f);
 
     if (success) {
-        std::bitset<8> state_seen;
-        std::bitset<8> state_confirmed;
-        for (int i = 0; i < 8; i++) {
-            if (states_seen_count_[i] > 0)
-                state_seen[i] = true;
-            if (states_seen_count_[i] > 50)
-                state_confirmed[i] = true;
-        }
-        if (!(state_seen == state_confirmed)) {
+        uint8_t hall_polarity;
+        std::array<float, 6> hall_edge_phcnt;
+        int32_t direction;
+        HallCalibration::Result_t result = hall_calibration_.get_edges(&hall_polarity, &hall_edge_phcnt, &direction);
+        if (result == HallCalibration::kIllegalState) {
             set_error(ERROR_ILLEGAL_HALL_STATE);
-            return false;
+            success = false;
+        } else {
+            // The polarity is valid even if the edges aren't
+            config_.hall_polarity = hall_polarity;
+            config_.hall_polarity_calibrated = true;
+        }
+        if (result == HallCalibration::kEdgesInconsistent) {
+            set_error(ERROR_HALL_EDGES_INCONSISTENT);
+            success = false;
         }
+        if (success) {
+            config_.hall_edge_phcnt = hall_edge_phcnt;
+            config_.direction = direction;
+        }
+    }
 
-        // Hall effect sensors can be arranged at 60 or 120 electrical degrees.
-        // Out of 8 possible states, 120 and 60 deg arrangements each miss 2 states.
-        // ODrive assumes 120 deg separation - if a 60 deg setup is used, it can
-        // be converted to 120 deg states by flipping the polarity of one sensor.
-        uint8_t states = state_seen.to_ulong();
-        uint8_t hall_polarity = 0;
-        auto flip_detect = [](uint8_t states, unsigned int idx)->bool {
-            return (~states & 0xFF) == (1<<(0+idx) | 1<<(7-idx));
-        };
-        if (flip_detect(states, 0)) {
-            hall_polarity = 0b000;
-        } else if (flip_detect(states, 1)) {
-            hall_polarity = 0b001;
-        } else if (flip_detect(states, 2)) {
-            hall_polarity = 0b010;
-        } else if (flip_detect(states, 3)) {
-            hall_polarity = 0b100;
-        } else {
-            set_error(ERROR_ILLEGAL_HALL_STATE);
+    if (!success)
+        config_.hall_edge_phcnt = hall_edge_defaults;
+    return success;
+}
+
+// @brief Spins the rotor in lockin at constant velocity for a few revolutions
+// and fits offset, amplitude and quadrature error of the sin/cos signals.
+// The moments are taken over whole revolutions, so the encoder must output
+// an integer number of signal periods per revolution.
+bool Encoder::run_sincos_calibration() {
+    constexpr float n_revolutions = 3.0f;
+    constexpr float min_amplitude = 0.05f; // [relative to ADC full scale]
+    constexpr float max_sin_phase = 0.9f; // beyond this the signals are hardly in quadrature
+
+    if (mode_ != MODE_SINCOS) {
+        set_error(ERROR_UNSUPPORTED_ENCODER_MODE);
+        return false;
+    }
+
+    Axis::LockinConfig_t lockin_config = axis_->config_.calibration_lockin;
+    lockin_config.finish_distance = std::copysign(n_revolutions * 2.0f * M_PI * axis_->motor_.config_.pole_pairs, lockin_config.vel);
+    lockin_config.finish_on_distance = true;
+    lockin_config.finish_on_enc_idx = false;
+    lockin_config.finish_on_vel = false;
+
+    auto loop_cb = [this](bool const_vel) {
+        if (const_vel && !sample_sincos_) {
+            sample_sincos_ = true;
+            select_update_fn();
+        }
+        // No need to cancel early
+        return true;
+    };
+
+    sincos_calib_sums_ = {};
+    bool success = axis_->run_lockin_spin(lockin_config, false, loop_cb);
+    sample_sincos_ = false;
+    select_update_fn();
+
+    if (success) {
+        // The samples are taken relative to the old offsets, which keeps
+        // the sums small and the float accumulation accurate.
+        const SincosCalibSums_t& sums = sincos_calib_sums_;
+        if (sums.n == 0) {
+            set_error(ERROR_NO_RESPONSE);
             return false;
         }
-        config_.hall_polarity = hall_polarity;
-        config_.hall_polarity_calibrated = true;
+        float n = (float)sums.n;
+        float mean_s = sums.s / n;
+        float mean_c = sums.c / n;
+        // The variance of a sinusoid is half its squared amplitude
+        float amplitude_s = std::sqrt(std::max(2.0f * (sums.ss / n - mean_s * mean_s), 0.0f));
+        float amplitude_c = std::sqrt(std::max(2.0f * (sums.cc / n - mean_c * mean_c), 0.0f));
+        if (amplitude_s < min_amplitude || amplitude_c < min_amplitude) {
+            set_error(ERROR_NO_RESPONSE);
+            return false;
+        }
+        // mean(sin(x) * cos(x + phi)) = -sin(phi) / 2
+        float covariance = sums.sc / n - mean_s * mean_c;
+        float sin_phase = std::clamp(-2.0f * covariance / (amplitude_s * amplitude_c), -max_sin_phase, max_sin_phase);
+
+        config_.sincos_sin_offset += mean_s;
+        config_.sincos_cos_offset += mean_c;
+        config_.sincos_sin_amplitude = amplitude_s;
+        config_.sincos_cos_amplitude = amplitude_c;
+        config_.sincos_phase = std::asin(sin_phase);
     }
 
     return success;
 }
 
-bool Encoder::run_hall_phase_calibration() {
+// @brief Spins the rotor in lockin at constant velocity for a few revolutions
+// and records the deviation of the encoder position from the commanded
+// position. The periodic part of this deviation (e.g. from an eccentrically
+// mounted magnet) is stored as correction table.
+bool Encoder::run_eccentricity_calibration() {
+    constexpr float n_revolutions = 3.0f;
+    constexpr uint16_t min_samples_per_bin = 4;
+
+    if (config_.direction == 0) {
+        set_error(ERROR_CPR_POLEPAIRS_MISMATCH);
+        return false;
+    }
+
     Axis::LockinConfig_t lockin_config = axis_->config_.calibration_lockin;
-    lockin_config.finish_distance = lockin_config.vel * 30.0f; // run for 30 seconds
+    lockin_config.finish_distance = std::copysign(n_revolutions * 2.0f * M_PI * axis_->motor_.config_.pole_pairs, lockin_config.vel);
     lockin_config.finish_on_distance = true;
     lockin_config.finish_on_enc_idx = false;
     lockin_config.finish_on_vel = false;
 
     auto loop_cb = [this](bool const_vel) {
         if (const_vel)
-            sample_hall_phase_ = true;
+            sample_eccentricity_ = true;
         // No need to cancel early
         return true;
     };
 
-    // TODO: There is a race condition here with the execution in Encoder::update.
-    // We should evaluate making thread execution synchronous with the control loops
-    // at least optionally.
-    // Perhaps the new loop_sync feature will give a loose timing guarantee that may be sufficient
-    calibrate_hall_phase_ = true;
-    config_.hall_edge_phcnt.fill(0.0f);
-    hall_phase_calib_seen_count_.fill(0);
+    eccentricity_calib_sum_.fill(0.0f);
+    eccentricity_calib_n_.fill(0);
     bool success = axis_->run_lockin_spin(lockin_config, false, loop_cb);
-    if (error_ & ERROR_ILLEGAL_HALL_STATE)
-        success = false;
+    sample_eccentricity_ = false;
 
     if (success) {
-        // Check deltas to dicern rotation direction
-        float delta_phase = 0.0f;
-        for (int i = 0; i < 6; i++) {
-            int next_i = (i == 5) ? 0 : i+1;
-            delta_phase += wrap_pm_pi(config_.hall_edge_phcnt[next_i] - config_.hall_edge_phcnt[i]);
-        }
-        // Correct reverse rotation
-        if (delta_phase < 0.0f) {
-            config_.direction = -1;
-            for (int i = 0; i < 6; i++)
-                config_.hall_edge_phcnt[i] = wrap_pm_pi(-config_.hall_edge_phcnt[i]);
-        } else {
-            config_.direction = 1;
+        float avg[ECCENTRICITY_TABLE_SIZE];
+        float mean = 0.0f;
+        for (size_t i = 0; i < ECCENTRICITY_TABLE_SIZE; ++i) {
+            if (eccentricity_calib_n_[i] < min_samples_per_bin) {
+                set_error(ERROR_NO_RESPONSE);
+                return false;
+            }
+            avg[i] = eccentricity_calib_sum_[i] / (float)eccentricity_calib_n_[i];
+            mean += avg[i] / (float)ECCENTRICITY_TABLE_SIZE;
         }
-        // Normalize edge timing to 1st edge in sequence, and change units to counts
-        float offset = config_.hall_edge_phcnt[0];
-        for (int i = 0; i < 6; i++) {
-            float& phcnt = config_.hall_edge_phcnt[i];
-            phcnt = fmodf_pos((6.0f / (2.0f * M_PI)) * (phcnt - offset), 6.0f);
+
+        // The mean error contains the lockin lag and the unknown offset
+        // between commanded and measured position, only the periodic part is
+        // of interest.
+        for (size_t i = 0; i < ECCENTRICITY_TABLE_SIZE; ++i) {
+            float correction = (mean - avg[i]) / ECCENTRICITY_TABLE_SCALE;
+            config_.eccentricity_table[i] = (int16_t)std::clamp(correction, (float)INT16_MIN, (float)INT16_MAX);
         }
-    } else {
-        config_.hall_edge_phcnt = hall_edge_defaults;
+        config_.use_eccentricity_compensation = true;
     }
 
-    calibrate_hall_phase_ = false;
     return success;
 }
 
+// @brief Returns the correction to add to the specified raw position, linearly
+// interpolated from the eccentricity table.
+float Encoder::eccentricity_correction(int32_t count_in_cpr) {
+    float idx_float = (float)count_in_cpr * ((float)ECCENTRICITY_TABLE_SIZE / (float)config_.cpr);
+    size_t idx = std::min((size_t)idx_float, ECCENTRICITY_TABLE_SIZE - 1);
+    size_t next_idx = (idx + 1 == ECCENTRICITY_TABLE_SIZE) ? 0 : idx + 1;
+    float frac = idx_float - (float)idx;
+    float lower = (float)config_.eccentricity_table[idx];
+    float upper = (float)config_.eccentricity_table[next_idx];
+    return (lower + frac * (upper - lower)) * ECCENTRICITY_TABLE_SCALE;
+}
+
 // @brief Turns the motor in one direction for a bit and then in the other
 // direction in order to find the offset between the electrical phase 0
 // and the encoder state 0.
@@ -388,7 +663,7 @@ bool Encoder::run_offset_calibration() {
     }
 
 
-    int32_t init_enc_val = shadow_count_;
+    int64_t init_enc_val = shadow_count_;
     uint32_t num_steps = 0;
     int64_t encvaluesum = 0;
 
@@ -462,31 +737,35 @@ bool Encoder::run_offset_calibration() {
     return true;
 }
 
-static bool decode_hall(uint8_t hall_state, int32_t* hall_cnt) {
-    switch (hall_state) {
-        case 0b001: *hall_cnt = 0; return true;
-        case 0b011: *hall_cnt = 1; return true;
-        case 0b010: *hall_cnt = 2; return true;
-        case 0b110: *hall_cnt = 3; return true;
-        case 0b100: *hall_cnt = 4; return true;
-        case 0b101: *hall_cnt = 5; return true;
-        default: return false;
-    }
-}
-
-void Encoder::sample_now() {
+/**
+ * @brief Selects the sample and update functions for the current mode and
+ * calibration so the control loop doesn't dispatch on them every iteration.
+ *
+ * Must be called whenever mode_, calibrate_hall_ or sample_sincos_
+ * change. The functions are assigned as plain function pointers, which are
+ * written atomically with respect to the control loop.
+ */
+void Encoder::select_update_fn() {
     switch (mode_) {
         case MODE_INCREMENTAL: {
-            tim_cnt_sample_ = (int16_t)timer_->Instance->CNT;
+            sample_fn_ = [](Encoder* enc, uint32_t timestamp) { enc->sample_incremental(timestamp); };
+            update_fn_ = [](Encoder* enc, uint32_t timestamp) { return enc->update_incremental(timestamp); };
         } break;
 
         case MODE_HALL: {
-            // do nothing: samples already captured in general GPIO capture
+            sample_fn_ = [](Encoder* enc, uint32_t timestamp) { enc->sample_hall(timestamp); };
+            if (calibrate_hall_)
+                update_fn_ = [](Encoder* enc, uint32_t timestamp) { return enc->update_hall_calibration(timestamp); };
+            else
+                update_fn_ = [](Encoder* enc, uint32_t timestamp) { return enc->update_hall(timestamp); };
         } break;
 
         case MODE_SINCOS: {
-            sincos_sample_s_ = get_adc_relative_voltage(get_gpio(config_.sincos_gpio_pin_sin)) - 0.5f;
-            sincos_sample_c_ = get_adc_relative_voltage(get_gpio(config_.sincos_gpio_pin_cos)) - 0.5f;
+            sample_fn_ = [](Encoder* enc, uint32_t timestamp) { enc->sample_sincos(timestamp); };
+            if (sample_sincos_)
+                update_fn_ = [](Encoder* enc, uint32_t timestamp) { return enc->update_sincos_calibration(timestamp); };
+            else
+                update_fn_ = [](Encoder* enc, uint32_t timestamp) { return enc->update_sincos(timestamp); };
         } break;
 
         case MODE_SPI_ABS_AMS:
@@ -494,49 +773,98 @@ void Encoder::sample_now() {
         case MODE_SPI_ABS_AEAT:
         case MODE_SPI_ABS_RLS:
         case MODE_SPI_ABS_MA732:
-        {
-            abs_spi_start_transaction();
-            // Do nothing
+        case MODE_SPI_ABS_BISS_C:
+        case MODE_SPI_ABS_SSI: {
+            sample_fn_ = [](Encoder* enc, uint32_t timestamp) { enc->sample_abs_spi(timestamp); };
+            update_fn_ = [](Encoder* enc, uint32_t timestamp) { return enc->update_abs_spi(timestamp); };
         } break;
 
         default: {
-           set_error(ERROR_UNSUPPORTED_ENCODER_MODE);
+            sample_fn_ = [](Encoder* enc, uint32_t) { enc->set_error(ERROR_UNSUPPORTED_ENCODER_MODE); };
+            update_fn_ = [](Encoder* enc, uint32_t) { enc->set_error(ERROR_UNSUPPORTED_ENCODER_MODE); return false; };
         } break;
     }
+}
 
-    // Sample all GPIO digital input data registers, used for HALL sensors for example.
-    for (size_t i = 0; i < sizeof(ports_to_sample) / sizeof(ports_to_sample[0]); ++i) {
-        port_samples_[i] = ports_to_sample[i]->IDR;
-    }
+void Encoder::sample_now(uint32_t timestamp) {
+    sample_fn_(this, timestamp);
 }
 
-bool Encoder::read_sampled_gpio(Stm32Gpio gpio) {
-    for (size_t i = 0; i < sizeof(ports_to_sample) / sizeof(ports_to_sample[0]); ++i) {
-        if (ports_to_sample[i] == gpio.port_) {
-            return port_samples_[i] & gpio.pin_mask_;
-        }
+/**
+ * @brief Returns the latest reading of the sensor before any processing: the
+ * timer count (incremental), the hall state or the decoded position of the
+ * last SPI transfer (absolute SPI). Zero for the other modes.
+ */
+int32_t Encoder::raw_sample() const {
+    switch (mode_) {
+        case MODE_INCREMENTAL: return tim_cnt_sample_;
+        case MODE_HALL: return hall_state_;
+        case MODE_SPI_ABS_AMS:
+        case MODE_SPI_ABS_CUI:
+        case MODE_SPI_ABS_AEAT:
+        case MODE_SPI_ABS_RLS:
+        case MODE_SPI_ABS_MA732:
+        case MODE_SPI_ABS_BISS_C:
+        case MODE_SPI_ABS_SSI: return pos_abs_;
+        default: return 0;
     }
-    return false;
+}
+
+void Encoder::sample_incremental(uint32_t timestamp) {
+    tim_cnt_sample_ = (int16_t)timer_->Instance->CNT;
+    sample_timestamp_ = timestamp;
+    sample_cycles_ = DWT->CYCCNT;
+}
+
+void Encoder::sample_hall(uint32_t timestamp) {
+    sample_timestamp_ = timestamp;
+    sample_cycles_ = DWT->CYCCNT;
+    // The GPIO ports were sampled by ODrive::sampling_cb() just before,
+    // decode_hall_samples() reads them in update()
+}
+
+void Encoder::sample_sincos(uint32_t timestamp) {
+    // The ADC scans all channels continuously in the background. The
+    // average of the last few scans corresponds to the middle of
+    // their window.
+    uint32_t n_scans = std::clamp((uint32_t)config_.sincos_averaging, (uint32_t)1, (uint32_t)ADC_SCAN_COUNT);
+    sincos_sample_s_ = get_adc_relative_voltage_avg(get_gpio(config_.sincos_gpio_pin_sin), n_scans);
+    sincos_sample_c_ = get_adc_relative_voltage_avg(get_gpio(config_.sincos_gpio_pin_cos), n_scans);
+    sample_timestamp_ = timestamp - (n_scans - 1) * ADC_SCAN_PERIOD_CLOCKS / 2;
+}
+
+void Encoder::sample_abs_spi(uint32_t timestamp) {
+    // The encoder latches its position when the transaction starts.
+    // If the transaction fails, the previous position and its
+    // timestamp remain in effect.
+    abs_spi_start_timestamp_ = timestamp;
+    abs_spi_start_cycles_ = DWT->CYCCNT;
+    abs_spi_prepare_transaction();
 }
 
 void Encoder::decode_hall_samples() {
-    hall_state_ = (read_sampled_gpio(hallA_gpio_) ? 1 : 0)
-                | (read_sampled_gpio(hallB_gpio_) ? 2 : 0)
-                | (read_sampled_gpio(hallC_gpio_) ? 4 : 0);
+    hall_state_ = (odrv.read_sampled_gpio(hallA_gpio_) ? 1 : 0)
+                | (odrv.read_sampled_gpio(hallB_gpio_) ? 2 : 0)
+                | (odrv.read_sampled_gpio(hallC_gpio_) ? 4 : 0);
 }
 
-bool Encoder::abs_spi_start_transaction() {
+/**
+ * @brief Prepares the SPI read of an absolute encoder. The task is submitted
+ * by ODrive::sampling_cb() together with the reads of the other axes.
+ */
+bool Encoder::abs_spi_prepare_transaction() {
     if (mode_ & MODE_FLAG_ABS){
         if (Stm32SpiArbiter::acquire_task(&spi_task_)) {
             spi_task_.ncs_gpio = abs_spi_cs_gpio_;
             spi_task_.tx_buf = (uint8_t*)abs_spi_dma_tx_;
             spi_task_.rx_buf = (uint8_t*)abs_spi_dma_rx_;
-            spi_task_.length = 1;
+            spi_task_.length = abs_spi_frame_words_;
             spi_task_.on_complete = [](void* ctx, bool success) { ((Encoder*)ctx)->abs_spi_cb(success); };
             spi_task_.on_complete_ctx = this;
+            spi_task_.priority = Stm32SpiArbiter::PRIORITY_HIGH;
             spi_task_.next = nullptr;
-            
-            spi_arbiter_->transfer_async(&spi_task_);
+            spi_task_pending_ = true;
+            abs_spi_retried_ = false;
         } else {
             return false;
         }
@@ -544,68 +872,107 @@ bool Encoder::abs_spi_start_transaction() {
     return true;
 }
 
-uint8_t ams_parity(uint16_t v) {
-    v ^= v >> 8;
-    v ^= v >> 4;
-    v ^= v >> 2;
-    v ^= v >> 1;
-    return v & 1;
-}
-
-uint8_t cui_parity(uint16_t v) {
-    v ^= v >> 8;
-    v ^= v >> 4;
-    v ^= v >> 2;
-    return ~v & 3;
+// @brief Returns the SPI task prepared by the last call to sample_now(), if any.
+Stm32SpiArbiter::SpiTask* Encoder::take_spi_task() {
+    if (!spi_task_pending_) {
+        return nullptr;
+    }
+    spi_task_pending_ = false;
+    return &spi_task_;
 }
 
-void Encoder::abs_spi_cb(bool success) {
-    uint16_t pos;
-
-    if (!success) {
-        goto done;
-    }
+/**
+ * @brief Selects the decoder that abs_spi_cb() runs on the received frame.
+ *
+ * The completion interrupt preempts the control loop, so everything that
+ * only depends on the configuration is resolved here. The single word formats
+ * share one decoder that only applies the masks of serial_abs::WordFormat.
+ */
+void Encoder::select_abs_spi_decoder() {
+    abs_spi_decode_fn_ = [](Encoder* enc, int32_t* pos) {
+        return serial_abs::decode_word(enc->abs_spi_word_format_, enc->abs_spi_dma_rx_[0], pos);
+    };
 
-    switch (mode_) {
-        case MODE_SPI_ABS_AMS: {
-            uint16_t rawVal = abs_spi_dma_rx_[0];
-            // check if parity is correct (even) and error flag clear
-            if (ams_parity(rawVal) || ((rawVal >> 14) & 1)) {
-                goto done;
-            }
-            pos = rawVal & 0x3fff;
+    switch (config_.mode) {
+        // AEAT-9922 uses the same frame format as the AS5047P
+        case MODE_SPI_ABS_AMS:
+        case MODE_SPI_ABS_AEAT: abs_spi_word_format_ = serial_abs::AMS_WORD_FORMAT; break;
+        case MODE_SPI_ABS_CUI: abs_spi_word_format_ = serial_abs::CUI_WORD_FORMAT; break;
+        case MODE_SPI_ABS_RLS: abs_spi_word_format_ = serial_abs::RLS_WORD_FORMAT; break;
+        case MODE_SPI_ABS_MA732: abs_spi_word_format_ = serial_abs::MA732_WORD_FORMAT; break;
+
+        case MODE_SPI_ABS_BISS_C: {
+            abs_spi_decode_fn_ = [](Encoder* enc, int32_t* pos) {
+                uint64_t data;
+                if (!serial_abs::decode_biss_c(enc->abs_spi_dma_rx_, enc->abs_spi_frame_words_, enc->abs_spi_data_bits_, &data)) {
+                    return false;
+                }
+                *pos = (int32_t)(data & enc->abs_spi_singleturn_mask_);
+                return true;
+            };
         } break;
 
-        case MODE_SPI_ABS_CUI: {
-            uint16_t rawVal = abs_spi_dma_rx_[0];
-            // check if parity is correct
-            if (cui_parity(rawVal)) {
-                goto done;
-            }
-            pos = rawVal & 0x3fff;
+        case MODE_SPI_ABS_SSI: {
+            abs_spi_decode_fn_ = [](Encoder* enc, int32_t* pos) {
+                uint64_t data;
+                if (!serial_abs::decode_ssi(enc->abs_spi_dma_rx_, enc->abs_spi_frame_words_, enc->abs_spi_data_bits_, enc->config_.ssi_gray_code, &data)) {
+                    return false;
+                }
+                *pos = (int32_t)(data & enc->abs_spi_singleturn_mask_);
+                return true;
+            };
         } break;
 
-        case MODE_SPI_ABS_RLS: {
-            uint16_t rawVal = abs_spi_dma_rx_[0];
-            pos = (rawVal >> 2) & 0x3fff;
+        default: {
+            abs_spi_decode_fn_ = [](Encoder* enc, int32_t*) {
+                enc->set_error(ERROR_UNSUPPORTED_ENCODER_MODE);
+                return false;
+            };
         } break;
+    }
+}
 
-        case MODE_SPI_ABS_MA732: {
-            uint16_t rawVal = abs_spi_dma_rx_[0];
-            pos = (rawVal >> 2) & 0x3fff;
-        } break;
+// @brief Returns true if a repeated transfer can still complete before the
+// control loop consumes the sample of this cycle.
+bool Encoder::abs_spi_retry_in_time() {
+    uint32_t now = DWT->CYCCNT;
+    uint32_t elapsed = now - abs_spi_start_cycles_;
+    uint32_t transfer_duration = now - spi_task_.start_cycles;
+    return elapsed + transfer_duration < abs_spi_deadline_cycles_;
+}
 
-        default: {
-           set_error(ERROR_UNSUPPORTED_ENCODER_MODE);
-           goto done;
-        } break;
+void Encoder::abs_spi_cb(bool success) {
+    int32_t pos;
+
+    if (!success || !abs_spi_decode_fn_(this, &pos)) {
+        goto fail;
     }
 
+    // The transfer may have been queued behind other SPI traffic, so the
+    // position was captured at the time the chip select went low rather than
+    // at the sampling event. HCLK and the cycle counter run at the same rate.
+    {
+        AbsSpiSample_t sample;
+        sample.pos = pos;
+        sample.timestamp = abs_spi_start_timestamp_ + (spi_task_.start_cycles - abs_spi_start_cycles_);
+        abs_spi_sample_.publish(sample);
+    }
     pos_abs_ = pos;
-    abs_spi_pos_updated_ = true;
     if (config_.pre_calibrated) {
         is_ready_ = true;
     }
+    goto done;
+
+fail:
+    abs_spi_bad_frames_++;
+    // Repeat the transfer once if the result can still be used in this
+    // cycle. The task remains acquired until the retry completes.
+    if (!abs_spi_retried_ && abs_spi_retry_in_time()) {
+        abs_spi_retried_ = true;
+        abs_spi_retries_++;
+        spi_arbiter_->transfer_async(&spi_task_);
+        return;
+    }
 
 done:
     Stm32SpiArbiter::release_task(&spi_task_);
@@ -626,6 +993,120 @@ void Encoder::abs_spi_cs_pin_init(){
     abs_spi_cs_gpio_.write(true);
 }
 
+// @brief Distance between the calibrated edges below and above the given count [counts]
+float Encoder::hall_segment_length(int32_t count) {
+    int pos_idx = mod(count, 6);
+    int next_i = (pos_idx == 5) ? 0 : pos_idx+1;
+    float length = fmodf_pos(config_.hall_edge_phcnt[next_i] - config_.hall_edge_phcnt[pos_idx], 6.0f);
+    return (length > 0.0f) ? length : 1.0f;
+}
+
+// @brief Updates the velocity estimate that is derived from the time between
+// hall edges.
+// At low speed the hall count only changes every few control iterations,
+// which leaves the PLL with a coarse, lagging velocity estimate. The EXTI
+// timestamps give the exact time of each edge instead.
+// @param delta_enc: hall counts since the previous update, after count_in_cpr_
+// has been advanced by it
+void Encoder::update_hall_edge_timing(int32_t delta_enc) {
+    if (delta_enc == 0) {
+        hall_edge_age_ += current_meas_period;
+        return;
+    }
+
+    int32_t dir = (delta_enc > 0) ? 1 : -1;
+    HallEdge_t edge = hall_edge_.read();
+    int32_t edge_age = (int32_t)(sample_cycles_ - edge.cycles);
+
+    if (std::abs(delta_enc) > 1 || edge_age < 0) {
+        // Either several edges since the last update, in which case the PLL
+        // is accurate enough, or the last edge came after the GPIOs were
+        // sampled and the edge that caused this count is lost.
+        hall_edge_dir_ = 0;
+        hall_edge_vel_valid_ = false;
+        return;
+    }
+
+    // The rotor traversed the segment of the count it just left
+    hall_edge_vel_valid_ = (dir == hall_edge_dir_) && (edge.interval > 0);
+    if (hall_edge_vel_valid_) {
+        hall_edge_vel_counts_ = hall_segment_length(count_in_cpr_ - delta_enc) * (float)TIM_1_8_CLOCK_HZ / (float)edge.interval;
+    }
+    hall_edge_dir_ = dir;
+    hall_edge_age_ = (float)edge_age / (float)TIM_1_8_CLOCK_HZ;
+}
+
+// @brief Measures the velocity of an incremental encoder from the time between
+// edges (M/T method) and blends it with the PLL estimate.
+// The PLL only sees a few counts per control iteration at low speed, which
+// makes its estimate noisy unless the bandwidth is lowered for all speeds.
+// Instead, the number of counts between two rising edges of the A channel is
+// divided by their exact time difference. The edge interrupt is only armed
+// below config_.mt_vel_max to bound its load.
+// @param pll_vel_counts: velocity estimate of the PLL [counts/s]
+// @returns the blended velocity estimate [counts/s]
+float Encoder::update_mt_velocity(float pll_vel_counts) {
+    constexpr float counts_per_edge = 4.0f; // rising edges of A are one quadrature period apart
+    constexpr float rearm_ratio = 0.9f;
+
+    float abs_vel = std::abs(pll_vel_counts);
+    if (mt_armed_ && (config_.mt_vel_max <= 0.0f || abs_vel > config_.mt_vel_max)) {
+        hallA_gpio_.unsubscribe();
+        mt_armed_ = false;
+    } else if (!mt_armed_ && abs_vel < rearm_ratio * config_.mt_vel_max) {
+        if (!hallA_gpio_.subscribe(true, false, mt_edge_cb_wrapper, this)) {
+            odrv.misconfigured_ = true;
+            config_.mt_vel_max = 0.0f; // don't retry on every iteration
+            return pll_vel_counts;
+        }
+        mt_armed_ = true;
+        mt_last_edge_valid_ = false;
+        mt_n_consumed_ = mt_edge_.get_n_published();
+    }
+    if (!mt_armed_) {
+        return pll_vel_counts;
+    }
+
+    uint32_t n_published = mt_edge_.get_n_published();
+    if (n_published != mt_n_consumed_) {
+        mt_n_consumed_ = n_published;
+        MtEdge_t edge = mt_edge_.read();
+        if (mt_last_edge_valid_) {
+            int16_t delta_count = edge.count - mt_last_edge_.count;
+            uint32_t delta_cycles = edge.cycles - mt_last_edge_.cycles;
+            if (delta_cycles > 0)
+                mt_vel_counts_ = (float)delta_count * (float)TIM_1_8_CLOCK_HZ / (float)delta_cycles;
+        }
+        mt_last_edge_ = edge;
+        if (!mt_last_edge_valid_) {
+            mt_last_edge_valid_ = true;
+            return pll_vel_counts; // the first interval is not complete yet
+        }
+    } else if (!mt_last_edge_valid_) {
+        return pll_vel_counts;
+    }
+
+    // Without a new edge the rotor can't have covered a full period since
+    // the last one, which bounds the velocity as it slows down.
+    int32_t edge_age = (int32_t)(sample_cycles_ - mt_last_edge_.cycles);
+    float mt_vel_counts = mt_vel_counts_;
+    if (edge_age < 0) {
+        // the edge came after the sample, the last interval is still valid
+    } else if ((float)edge_age > EDGE_TIMING_TIMEOUT * (float)TIM_1_8_CLOCK_HZ) {
+        // The bound below decays as 1/t and never reaches zero, so the rotor
+        // counts as stopped after the timeout. Cleared for good, because the
+        // edge age wraps around after a few seconds.
+        mt_vel_counts_ = 0.0f;
+        mt_vel_counts = 0.0f;
+    } else if (std::abs(mt_vel_counts) * (float)edge_age > counts_per_edge * (float)TIM_1_8_CLOCK_HZ) {
+        mt_vel_counts = std::copysign(counts_per_edge * (float)TIM_1_8_CLOCK_HZ / (float)edge_age, mt_vel_counts);
+    }
+
+    // Hand over to the PLL linearly between half and full mt_vel_max
+    float pll_weight = std::clamp(2.0f * abs_vel / config_.mt_vel_max - 1.0f, 0.0f, 1.0f);
+    return pll_weight * pll_vel_counts + (1.0f - pll_weight) * mt_vel_counts;
+}
+
 // Note that this may return counts +1 or -1 without any wrapping
 int32_t Encoder::hall_model(float internal_pos) {
     int32_t base_cnt = (int32_t)std::floor(internal_pos);
@@ -648,157 +1129,311 @@ int32_t Encoder::hall_model(float internal_pos) {
     return base_cnt;
 }
 
-bool Encoder::update() {
-    // update internal encoder state.
-    int32_t delta_enc = 0;
-    int32_t pos_abs_latched = pos_abs_; //LATCH
+RAMFUNC bool Encoder::update(uint32_t timestamp) {
+    int16_t index_cnt;
+    uint32_t n_published;
+    if (index_cnt_.try_read(index_cnt, n_published) && n_published != index_n_applied_) {
+        index_n_applied_ = n_published;
+        apply_index(index_cnt);
+    }
+    return update_fn_(this, timestamp);
+}
 
-    switch (mode_) {
-        case MODE_INCREMENTAL: {
-            //TODO: use count_in_cpr_ instead as shadow_count_ can overflow
-            //or use 64 bit
-            int16_t delta_enc_16 = (int16_t)tim_cnt_sample_ - (int16_t)shadow_count_;
-            delta_enc = (int32_t)delta_enc_16; //sign extend
-        } break;
+// @brief Moves the linear position estimate by a whole number of counts
+// without losing its fraction. Not for the control loop, it divides in 64 bit.
+void Encoder::shift_pos_estimate(int64_t counts) {
+    int64_t turns = counts / config_.cpr;
+    int64_t rest = counts % config_.cpr;
+    if (rest < 0) {
+        rest += config_.cpr;
+        turns--;
+    }
+    pos_estimate_turns_ += turns;
+    pos_estimate_base_counts_ += turns * config_.cpr;
+    pos_estimate_counts_ += (float)rest;
+    rebase_pos_estimate();
+}
 
-        case MODE_HALL: {
-            decode_hall_samples();
-            if (sample_hall_states_) {
-                states_seen_count_[hall_state_]++;
-            }
-            if (config_.hall_polarity_calibrated) {
-                int32_t hall_cnt;
-                if (decode_hall((hall_state_ ^ config_.hall_polarity), &hall_cnt)) {
-                    if (calibrate_hall_phase_) {
-                        if (sample_hall_phase_ && last_hall_cnt_.has_value()) {
-                            int mod_hall_cnt = mod(hall_cnt - last_hall_cnt_.value(), 6);
-                            size_t edge_idx;
-                            if (mod_hall_cnt == 0) { goto skip; } // no count - do nothing
-                            else if (mod_hall_cnt == 1) { // counted up
-                                edge_idx = hall_cnt;
-                            } else if (mod_hall_cnt == 5) { // counted down
-                                edge_idx = last_hall_cnt_.value();
-                            } else {
-                                set_error(ERROR_ILLEGAL_HALL_STATE);
-                                return false;
-                            }
-
-                            auto maybe_phase = axis_->open_loop_controller_.phase_.any();
-                            if (maybe_phase) {
-                                float phase = maybe_phase.value();
-                                // Early increment to get the right divisor in recursive average
-                                hall_phase_calib_seen_count_[edge_idx]++;
-                                float& edge_phase = config_.hall_edge_phcnt[edge_idx];
-                                if (hall_phase_calib_seen_count_[edge_idx] == 1)
-                                    edge_phase = phase;
-                                else {
-                                    // circularly wrapped recursive average
-                                    edge_phase += (phase - edge_phase) / hall_phase_calib_seen_count_[edge_idx];
-                                    edge_phase = wrap_pm_pi(edge_phase);
-                                }
-                            }
-                        }
-                    skip:
-                        last_hall_cnt_ = hall_cnt;
-
-                        return true; // Skip all velocity and phase estimation
-                    }
-
-                    delta_enc = hall_cnt - count_in_cpr_;
-                    delta_enc = mod(delta_enc, 6);
-                    if (delta_enc > 3)
-                        delta_enc -= 6;
-                } else {
-                    if (!config_.ignore_illegal_hall_state) {
-                        set_error(ERROR_ILLEGAL_HALL_STATE);
-                        return false;
-                    }
-                }
-            }
-        } break;
+// @brief Keeps pos_estimate_counts_ within [0, cpr) by moving whole turns to
+// pos_estimate_turns_, so that its float resolution doesn't depend on the
+// distance travelled.
+inline void Encoder::rebase_pos_estimate() {
+    float cpr = (float)config_.cpr;
+    if (pos_estimate_counts_ >= cpr || pos_estimate_counts_ < 0.0f) {
+        int32_t turns = (int32_t)std::floor(pos_estimate_counts_ / cpr);
+        pos_estimate_counts_ -= (float)turns * cpr;
+        pos_estimate_turns_ += turns;
+        pos_estimate_base_counts_ += (int64_t)turns * config_.cpr;
+    }
+}
 
-        case MODE_SINCOS: {
-            float phase = fast_atan2(sincos_sample_s_, sincos_sample_c_);
-            int fake_count = (int)(1000.0f * phase);
-            //CPR = 6283 = 2pi * 1k
-
-            delta_enc = fake_count - count_in_cpr_;
-            delta_enc = mod(delta_enc, 6283);
-            if (delta_enc > 6283/2)
-                delta_enc -= 6283;
-        } break;
-        
-        case MODE_SPI_ABS_RLS:
-        case MODE_SPI_ABS_AMS:
-        case MODE_SPI_ABS_CUI: 
-        case MODE_SPI_ABS_AEAT:
-        case MODE_SPI_ABS_MA732: {
-            if (abs_spi_pos_updated_ == false) {
-                // Low pass filter the error
-                spi_error_rate_ += current_meas_period * (1.0f - spi_error_rate_);
-                if (spi_error_rate_ > 0.05f) {
-                    set_error(ERROR_ABS_SPI_COM_FAIL);
-                    return false;
-                }
-            } else {
-                // Low pass filter the error
-                spi_error_rate_ += current_meas_period * (0.0f - spi_error_rate_);
-            }
+// @brief Applies the movement measured by the mode specific update function.
+inline void Encoder::advance_count(int32_t delta_enc) {
+    shadow_count_ += delta_enc;
+    count_in_cpr_ += delta_enc;
+    count_in_cpr_ = mod(count_in_cpr_, config_.cpr);
+}
+
+RAMFUNC bool Encoder::update_incremental(uint32_t timestamp) {
+    // The counts since the last sample, independent of shadow_count_ so that
+    // apply_index() and calibrations can move the count without touching CNT
+    int16_t delta_enc_16 = (int16_t)(tim_cnt_sample_ - tim_cnt_last_);
+    tim_cnt_last_ = tim_cnt_sample_;
+    int32_t delta_enc = (int32_t)delta_enc_16; //sign extend
+    advance_count(delta_enc);
+    return update_estimates<MODE_INCREMENTAL>(timestamp, delta_enc);
+}
 
-            abs_spi_pos_updated_ = false;
-            delta_enc = pos_abs_latched - count_in_cpr_; //LATCH
-            delta_enc = mod(delta_enc, config_.cpr);
-            if (delta_enc > config_.cpr/2) {
-                delta_enc -= config_.cpr;
+RAMFUNC bool Encoder::update_hall(uint32_t timestamp) {
+    int32_t delta_enc = 0;
+    decode_hall_samples();
+    if (config_.hall_polarity_calibrated) {
+        int32_t hall_cnt;
+        if (decode_hall((hall_state_ ^ config_.hall_polarity), &hall_cnt)) {
+            delta_enc = hall_cnt - count_in_cpr_;
+            delta_enc = mod(delta_enc, 6);
+            if (delta_enc > 3)
+                delta_enc -= 6;
+        } else {
+            if (!config_.ignore_illegal_hall_state) {
+                set_error(ERROR_ILLEGAL_HALL_STATE);
+                return false;
             }
+        }
+    }
+    advance_count(delta_enc);
+    return update_estimates<MODE_HALL>(timestamp, delta_enc);
+}
 
-        }break;
-        default: {
-            set_error(ERROR_UNSUPPORTED_ENCODER_MODE);
+// @brief Replaces update_hall() during the hall calibration spins. Feeds the
+// hall state and the lockin phase at its edges to hall_calibration_ and skips
+// all velocity and phase estimation.
+bool Encoder::update_hall_calibration(uint32_t timestamp) {
+    auto maybe_phase = axis_->open_loop_controller_.phase_.any();
+    if (!sample_hall_ || !maybe_phase) {
+        return update_hall(timestamp);
+    }
+    decode_hall_samples();
+
+    // An edge happened somewhere within the last iteration. The EXTI
+    // timestamps tell exactly when, otherwise assume the middle.
+    float edge_age = 0.5f * current_meas_period;
+    if (config_.use_hall_edge_timing) {
+        int32_t age = (int32_t)(sample_cycles_ - hall_edge_.read().cycles);
+        if (age >= 0 && (float)age < current_meas_period * (float)TIM_1_8_CLOCK_HZ)
+            edge_age = (float)age / (float)TIM_1_8_CLOCK_HZ;
+    }
+    float phase_vel = axis_->open_loop_controller_.phase_vel_.any().value_or(0.0f);
+
+    if (!hall_calibration_.add_sample(hall_state_, maybe_phase.value() - phase_vel * edge_age)) {
+        set_error(ERROR_ILLEGAL_HALL_STATE);
+        return false;
+    }
+    return true;
+}
+
+RAMFUNC bool Encoder::update_sincos(uint32_t timestamp) {
+    float s = sincos_sample_s_ - config_.sincos_sin_offset;
+    float c = sincos_sample_c_ - config_.sincos_cos_offset;
+
+    // Normalize the amplitudes and remove the quadrature error:
+    // c = cos(x + phi) = cos(x)cos(phi) - sin(x)sin(phi)
+    s /= config_.sincos_sin_amplitude;
+    c /= config_.sincos_cos_amplitude;
+    float sin_phi, cos_phi;
+    our_arm_sin_cos_f32(config_.sincos_phase, &sin_phi, &cos_phi);
+    c = (c + s * sin_phi) / cos_phi;
+
+    // Resolve the angle to cpr counts per signal period. The sub-count
+    // part is a true measurement and goes into the phase detector
+    // and the interpolation.
+    float pos = fmodf_pos(fast_atan2(s, c), 2.0f * M_PI) * (float)config_.cpr / (2.0f * M_PI);
+    int32_t count = std::min((int32_t)pos, config_.cpr - 1);
+    sincos_frac_ = pos - (float)count;
+
+    int32_t delta_enc = count - count_in_cpr_;
+    delta_enc = mod(delta_enc, config_.cpr);
+    if (delta_enc > config_.cpr/2)
+        delta_enc -= config_.cpr;
+    advance_count(delta_enc);
+    return update_estimates<MODE_SINCOS>(timestamp, delta_enc);
+}
+
+// @brief Replaces update_sincos() during run_sincos_calibration() and
+// accumulates the moments of the signals.
+bool Encoder::update_sincos_calibration(uint32_t timestamp) {
+    float s = sincos_sample_s_ - config_.sincos_sin_offset;
+    float c = sincos_sample_c_ - config_.sincos_cos_offset;
+    sincos_calib_sums_.n++;
+    sincos_calib_sums_.s += s;
+    sincos_calib_sums_.c += c;
+    sincos_calib_sums_.ss += s * s;
+    sincos_calib_sums_.cc += c * c;
+    sincos_calib_sums_.sc += s * c;
+    return update_sincos(timestamp);
+}
+
+RAMFUNC bool Encoder::update_abs_spi(uint32_t timestamp) {
+    // Latch the newest sample that completed so far, even if it belongs
+    // to an earlier sampling event. Its timestamp accounts for the age.
+    int32_t pos_abs_latched = pos_abs_; //LATCH
+    uint32_t n_published = abs_spi_sample_.get_n_published();
+    AbsSpiSample_t sample = abs_spi_sample_.read();
+    bool abs_spi_pos_updated = n_published != abs_spi_n_consumed_;
+    abs_spi_n_consumed_ = n_published;
+    // A retried transfer is only useful if it completes before this point
+    abs_spi_deadline_cycles_ = DWT->CYCCNT - abs_spi_start_cycles_;
+
+    if (!abs_spi_pos_updated) {
+        abs_spi_stale_cycles_++;
+        // Low pass filter the error
+        spi_error_rate_ += current_meas_period * (1.0f - spi_error_rate_);
+        if (spi_error_rate_ > 0.05f) {
+            set_error(ERROR_ABS_SPI_COM_FAIL);
             return false;
-        } break;
+        }
+    } else {
+        pos_abs_latched = sample.pos;
+        sample_timestamp_ = sample.timestamp;
+        // Low pass filter the error
+        spi_error_rate_ += current_meas_period * (0.0f - spi_error_rate_);
     }
 
-    shadow_count_ += delta_enc;
-    count_in_cpr_ += delta_enc;
-    count_in_cpr_ = mod(count_in_cpr_, config_.cpr);
+    int32_t delta_enc = pos_abs_latched - count_in_cpr_; //LATCH
+    delta_enc = mod(delta_enc, config_.cpr);
+    if (delta_enc > config_.cpr/2) {
+        delta_enc -= config_.cpr;
+    }
+    advance_count(delta_enc);
+    count_in_cpr_ = pos_abs_latched;
+    return update_estimates<MODE_FLAG_ABS>(timestamp, delta_enc);
+}
+
+/**
+ * @brief Runs the PLL, the interpolation and the phase computation common to
+ * all modes. It is instantiated once per mode (MODE_FLAG_ABS for all absolute
+ * encoders) so the mode specific branches are resolved at compile time.
+ */
+template <uint32_t mode>
+RAMFUNC bool Encoder::update_estimates(uint32_t timestamp, int32_t delta_enc) {
+    if (sample_eccentricity_) {
+        auto total_distance = axis_->open_loop_controller_.total_distance_.any();
+        if (total_distance.has_value()) {
+            float expected_counts = *total_distance * (float)config_.direction * (float)config_.cpr / (2.0f * M_PI * axis_->motor_.config_.pole_pairs);
+            size_t bin = std::min((size_t)((uint64_t)count_in_cpr_ * ECCENTRICITY_TABLE_SIZE / config_.cpr), ECCENTRICITY_TABLE_SIZE - 1);
+            eccentricity_calib_sum_[bin] += (float)shadow_count_ - expected_counts;
+            eccentricity_calib_n_[bin]++;
+        }
+    }
 
-    if(mode_ & MODE_FLAG_ABS)
-        count_in_cpr_ = pos_abs_latched;
+    // Correction of periodic position errors, applied before the PLL
+    float correction = config_.use_eccentricity_compensation ? eccentricity_correction(count_in_cpr_) : 0.0f;
 
     // Memory for pos_circular
     float pos_cpr_counts_last = pos_cpr_counts_;
 
+    if (config_.enable_adaptive_bandwidth)
+        update_adaptive_bandwidth();
+
+    // Acceleration from the torque applied during the last iteration
+    float accel_counts = 0.0f;
+    float inertia = axis_->controller_.config_.inertia;
+    if ((config_.use_accel_feedforward || config_.use_kalman_filter) && inertia > 0.0f) {
+        std::optional<float> torque = axis_->controller_.torque_output_.previous();
+        if (torque.has_value())
+            accel_counts = (*torque / inertia) * (float)config_.cpr;
+    }
+
     //// run pll (for now pll is in units of encoder counts)
     // Predict current pos
-    pos_estimate_counts_ += current_meas_period * vel_estimate_counts_;
-    pos_cpr_counts_      += current_meas_period * vel_estimate_counts_;
+    if (config_.use_kalman_filter) {
+        // The Kalman filter also predicts from the load acceleration. The
+        // torque acceleration enters the position as well, so the estimate
+        // has no static error under load.
+        accel_counts += kalman_load_accel_counts_;
+        float delta = current_meas_period * vel_estimate_counts_ + 0.5f * current_meas_period * current_meas_period * accel_counts;
+        pos_estimate_counts_ += delta;
+        pos_cpr_counts_      += delta;
+        vel_estimate_counts_ += current_meas_period * accel_counts;
+    } else {
+        pos_estimate_counts_ += current_meas_period * vel_estimate_counts_;
+        pos_cpr_counts_      += current_meas_period * vel_estimate_counts_;
+        // Predict the velocity change from the torque, so the phase detector
+        // only has to correct for the load.
+        vel_estimate_counts_ += current_meas_period * accel_counts;
+    }
     // Encoder model
     auto encoder_model = [this](float internal_pos)->int32_t {
-        if (config_.mode == MODE_HALL)
+        if constexpr (mode == MODE_HALL)
             return hall_model(internal_pos);
         else
             return (int32_t)std::floor(internal_pos);
     };
     // discrete phase detector
-    float delta_pos_counts = (float)(shadow_count_ - encoder_model(pos_estimate_counts_));
-    float delta_pos_cpr_counts = (float)(count_in_cpr_ - encoder_model(pos_cpr_counts_));
+    // Both sides of the linear comparison are relative to pos_estimate_base_counts_
+    int32_t shadow_count_rel = (int32_t)(shadow_count_ - pos_estimate_base_counts_);
+    float delta_pos_counts = (float)(shadow_count_rel - encoder_model(pos_estimate_counts_)) + correction;
+    float delta_pos_cpr_counts = (float)(count_in_cpr_ - encoder_model(pos_cpr_counts_)) + correction;
+    // Encoders that resolve the position within a count compare it as well
+    if constexpr (mode == MODE_SINCOS) {
+        delta_pos_counts += sincos_frac_ - (pos_estimate_counts_ - std::floor(pos_estimate_counts_));
+        delta_pos_cpr_counts += sincos_frac_ - (pos_cpr_counts_ - std::floor(pos_cpr_counts_));
+    }
     delta_pos_cpr_counts = wrap_pm(delta_pos_cpr_counts, (float)(config_.cpr));
     delta_pos_cpr_counts_ += 0.1f * (delta_pos_cpr_counts - delta_pos_cpr_counts_); // for debug
-    // pll feedback
-    pos_estimate_counts_ += current_meas_period * pll_kp_ * delta_pos_counts;
-    pos_cpr_counts_ += current_meas_period * pll_kp_ * delta_pos_cpr_counts;
+    // pll feedback, or the Kalman update with the same structure
+    float pos_gain = config_.use_kalman_filter ? kalman_gains_.pos : current_meas_period * pll_kp_; // [1]
+    float vel_gain = config_.use_kalman_filter ? kalman_gains_.vel : current_meas_period * pll_ki_; // [1/s]
+    pos_estimate_counts_ += pos_gain * delta_pos_counts;
+    rebase_pos_estimate();
+    pos_cpr_counts_ += pos_gain * delta_pos_cpr_counts;
     pos_cpr_counts_ = fmodf_pos(pos_cpr_counts_, (float)(config_.cpr));
-    vel_estimate_counts_ += current_meas_period * pll_ki_ * delta_pos_cpr_counts;
+    vel_estimate_counts_ += vel_gain * delta_pos_cpr_counts;
+    if (config_.use_kalman_filter)
+        kalman_load_accel_counts_ += kalman_gains_.acc * delta_pos_cpr_counts;
     bool snap_to_zero_vel = false;
-    if (std::abs(vel_estimate_counts_) < 0.5f * current_meas_period * pll_ki_) {
+    if (std::abs(vel_estimate_counts_) < 0.5f * vel_gain) {
         vel_estimate_counts_ = 0.0f;  //align delta-sigma on zero to prevent jitter
         snap_to_zero_vel = true;
     }
 
+    // Hall edge timing overrides the PLL velocity at low speed. The PLL
+    // integrator continues from this value, so handing back is seamless.
+    bool use_hall_edge_timing = (mode == MODE_HALL) && config_.use_hall_edge_timing;
+    float hall_edge_vel_counts = 0.0f;
+    float hall_edge_travelled = 0.0f; // [counts] since the last edge
+    if (use_hall_edge_timing) {
+        update_hall_edge_timing(delta_enc);
+        use_hall_edge_timing = hall_edge_vel_valid_;
+    }
+    if (use_hall_edge_timing) {
+        // Without a new edge the rotor can't have covered the current
+        // segment yet, which bounds the velocity as it slows down.
+        float segment = hall_segment_length(count_in_cpr_);
+        hall_edge_vel_counts = hall_edge_vel_counts_;
+        if (hall_edge_vel_counts * hall_edge_age_ > segment)
+            hall_edge_vel_counts = segment / hall_edge_age_;
+        hall_edge_travelled = std::min(hall_edge_age_ * hall_edge_vel_counts, 1.0f);
+        // The bound decays as 1/t and never reaches zero, so the rotor counts
+        // as stopped after the timeout. The phase stays where the bound left it.
+        if (hall_edge_age_ > EDGE_TIMING_TIMEOUT)
+            hall_edge_vel_counts = 0.0f;
+        vel_estimate_counts_ = (float)hall_edge_dir_ * hall_edge_vel_counts;
+        snap_to_zero_vel = false;
+    }
+
+    float vel_estimate_counts = vel_estimate_counts_;
+    if (mode == MODE_INCREMENTAL && (config_.mt_vel_max > 0.0f || mt_armed_)) {
+        vel_estimate_counts = update_mt_velocity(vel_estimate_counts_);
+    }
+
     // Outputs from Encoder for Controller
-    pos_estimate_ = pos_estimate_counts_ / (float)config_.cpr;
-    vel_estimate_ = vel_estimate_counts_ / (float)config_.cpr;
+    SplitPos pos_estimate_split;
+    pos_estimate_split.turns = pos_estimate_turns_;
+    pos_estimate_split += pos_estimate_counts_ / (float)config_.cpr;
+    pos_estimate_split_ = pos_estimate_split;
+    pos_estimate_ = pos_estimate_split.to_float();
+    vel_estimate_ = vel_estimate_counts / (float)config_.cpr;
     
     // TODO: we should strictly require that this value is from the previous iteration
     // to avoid spinout scenarios. However that requires a proper way to reset
@@ -810,9 +1445,15 @@ bool Encoder::update() {
 
     //// run encoder count interpolation
     int32_t corrected_enc = count_in_cpr_ - config_.phase_offset;
+    // the position within the count is measured
+    if (mode == MODE_SINCOS) {
+        interpolation_ = sincos_frac_;
     // if we are stopped, make sure we don't randomly drift
-    if (snap_to_zero_vel || !config_.enable_phase_interpolation) {
+    } else if (snap_to_zero_vel || !config_.enable_phase_interpolation) {
         interpolation_ = 0.5f;
+    // the distance travelled since the edge is known from its timestamp
+    } else if (use_hall_edge_timing) {
+        interpolation_ = (hall_edge_dir_ > 0) ? hall_edge_travelled : 1.0f - hall_edge_travelled;
     // reset interpolation if encoder edge comes
     // TODO: This isn't correct. At high velocities the first phase in this count may very well not be at the edge.
     } else if (delta_enc > 0) {
@@ -826,7 +1467,7 @@ bool Encoder::update() {
         if (interpolation_ > 1.0f) interpolation_ = 1.0f;
         if (interpolation_ < 0.0f) interpolation_ = 0.0f;
     }
-    float interpolated_enc = corrected_enc + interpolation_;
+    float interpolated_enc = corrected_enc + interpolation_ + correction;
 
     //// compute electrical phase
     //TODO avoid recomputing elec_rad_per_enc every time
@@ -834,8 +1475,13 @@ bool Encoder::update() {
     float ph = elec_rad_per_enc * (interpolated_enc - config_.phase_offset_float);
     
     if (is_ready_) {
-        phase_ = wrap_pm_pi(ph) * config_.direction;
-        phase_vel_ = (2*M_PI) * *vel_estimate_.present() * axis_->motor_.config_.pole_pairs * config_.direction;
+        float phase_vel = (2*M_PI) * *vel_estimate_.present() * axis_->motor_.config_.pole_pairs * config_.direction;
+        // Project the phase from the time the position was sampled to the
+        // time of this control loop iteration. This compensates for SPI
+        // transactions that completed late and for sensor internal delays.
+        float sample_age = (float)(int32_t)(timestamp - sample_timestamp_) / (float)TIM_1_8_CLOCK_HZ + config_.sample_delay;
+        phase_ = wrap_pm_pi(ph * config_.direction + phase_vel * sample_age);
+        phase_vel_ = phase_vel;
     }
 
     return true;
@@ -8,6 +8,12 @@ class Encoder;
 #include "utils.hpp"
 #include <autogen/interfaces.hpp>
 #include "component.hpp"
+#include "snapshot.hpp"
+#include "serial_abs_frame.hpp"
+#include "kalman_tracker.hpp"
+#include "split_pos.hpp"
+#include "config_transaction.hpp"
+#include "hall_calibration.hpp"
 
 
 class Encoder : public ODriveIntf::EncoderIntf {
@@ -15,6 +21,9 @@ public:
     static constexpr uint32_t MODE_FLAG_ABS = 0x100;
     static constexpr std::array<float, 6> hall_edge_defaults = 
         {0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f};
+    static constexpr size_t ECCENTRICITY_TABLE_SIZE = 128; // entries per encoder revolution
+    static constexpr float ECCENTRICITY_TABLE_SCALE = 1.0f / 256.0f; // [counts/LSB]
+    static constexpr float EDGE_TIMING_TIMEOUT = 0.2f; // [s] two edges at the slowest trusted edge rate (10/s), then edge timing reports standstill
 
     struct Config_t {
         Mode mode = MODE_INCREMENTAL;
@@ -41,20 +50,51 @@ public:
         bool hall_polarity_calibrated = false;
         std::array<float, 6> hall_edge_phcnt = hall_edge_defaults;
         uint16_t abs_spi_cs_gpio_pin = 1;
+        uint8_t serial_singleturn_bits = 24; // BiSS-C and SSI only
+        uint8_t serial_multiturn_bits = 0; // BiSS-C and SSI only, skipped
+        int32_t index_check_tolerance = 0; // [counts] Check every index pulse after the first one, 0 to disable
+        bool ssi_gray_code = false;
         uint16_t sincos_gpio_pin_sin = 3;
         uint16_t sincos_gpio_pin_cos = 4;
+        uint16_t sincos_averaging = 1; // number of most recent ADC scans averaged per sample, 1 to ADC_SCAN_COUNT
+        float sincos_sin_offset = 0.5f; // [relative to ADC full scale] set by run_sincos_calibration()
+        float sincos_cos_offset = 0.5f; // [relative to ADC full scale]
+        float sincos_sin_amplitude = 1.0f; // [relative to ADC full scale]
+        float sincos_cos_amplitude = 1.0f; // [relative to ADC full scale]
+        float sincos_phase = 0.0f; // [rad] quadrature error, the cos channel measures cos(x + sincos_phase)
+        float sample_delay = 0.0f; // [s] sensor internal delay between the actual position and the sampled value
+        bool use_eccentricity_compensation = false; // set by run_eccentricity_calibration()
+        std::array<int16_t, ECCENTRICITY_TABLE_SIZE> eccentricity_table = {0}; // correction to add to count_in_cpr [ECCENTRICITY_TABLE_SCALE counts]
+        bool enable_adaptive_bandwidth = false; // Schedule the PLL bandwidth between bandwidth and bandwidth_high on the speed
+        float bandwidth_high = 3000.0f; // [rad/s] PLL bandwidth from adaptive_vel_high upwards
+        float adaptive_vel_low = 2.0f; // [turn/s] speed up to which bandwidth is used
+        float adaptive_vel_high = 10.0f; // [turn/s] speed from which bandwidth_high is used
+        bool use_accel_feedforward = false; // Feed the acceleration from torque_output / controller.config.inertia into the PLL
+        bool use_hall_edge_timing = false; // Estimate low speed velocity and phase from the time between hall edges
+        float mt_vel_max = 0.0f; // [counts/s] Speed below which incremental encoder edges are timestamped (M/T method), 0 to disable
+        bool use_kalman_filter = false; // Replace the PLL by a steady-state Kalman filter with the torque as an input
+        float kalman_accel_noise = 400.0f; // [turn/s^3/sqrt(Hz)] random walk of the load acceleration
+        float kalman_meas_noise = 0.3f; // [count] standard deviation of the position measurement
 
 
         // custom setters
         Encoder* parent = nullptr;
         void set_use_index(bool value) { use_index = value; parent->set_idx_subscribe(); }
         void set_find_idx_on_lockin_only(bool value) { find_idx_on_lockin_only = value; parent->set_idx_subscribe(); }
+        void set_index_check_tolerance(int32_t value) { index_check_tolerance = value; parent->set_idx_subscribe(); }
         void set_abs_spi_cs_gpio_pin(uint16_t value) { abs_spi_cs_gpio_pin = value; parent->abs_spi_cs_pin_init(); }
         void set_pre_calibrated(bool value) { pre_calibrated = value; parent->check_pre_calibrated(); }
-        void set_bandwidth(float value) { bandwidth = value; parent->update_pll_gains(); }
+        void set_bandwidth(float value) { bandwidth = value; config_changed<&Encoder::update_pll_gains>(parent); }
+        void set_bandwidth_high(float value) { bandwidth_high = value; config_changed<&Encoder::update_pll_gains>(parent); }
+        void set_enable_adaptive_bandwidth(bool value) { enable_adaptive_bandwidth = value; config_changed<&Encoder::update_pll_gains>(parent); }
+        void set_use_kalman_filter(bool value) { use_kalman_filter = value; config_changed<&Encoder::update_pll_gains>(parent); }
+        void set_kalman_accel_noise(float value) { kalman_accel_noise = value; config_changed<&Encoder::update_pll_gains>(parent); }
+        void set_kalman_meas_noise(float value) { kalman_meas_noise = value; config_changed<&Encoder::update_pll_gains>(parent); }
+        void set_use_hall_edge_timing(bool value) { use_hall_edge_timing = value; parent->set_hall_edge_subscribe(); }
     };
 
     Encoder(TIM_HandleTypeDef* timer, Stm32Gpio index_gpio,
+            uint32_t index_capture_channel, uint8_t index_capture_af,
             Stm32Gpio hallA_gpio, Stm32Gpio hallB_gpio, Stm32Gpio hallC_gpio,
             Stm32SpiArbiter* spi_arbiter);
     
@@ -65,26 +105,58 @@ public:
 
     void enc_index_cb();
     void set_idx_subscribe(bool override_enable = false);
+    void set_index_capture(bool enable);
+    void apply_index(int16_t index_cnt);
+    void hall_edge_cb();
+    void mt_edge_cb();
+    void set_hall_edge_subscribe();
     void update_pll_gains();
+    void set_pll_bandwidth(float bandwidth);
+    void update_adaptive_bandwidth();
     void check_pre_calibrated();
 
     void set_linear_count(int32_t count);
+    void shift_pos_estimate(int64_t counts);
+    void rebase_pos_estimate();
+    float get_pos_estimate_counts() const { return (float)pos_estimate_base_counts_ + pos_estimate_counts_; }
     void set_circular_count(int32_t count, bool update_offset);
     bool calib_enc_offset(float voltage_magnitude);
 
     bool run_index_search();
     bool run_direction_find();
+    bool run_hall_calibration_spin(float duration);
     bool run_hall_polarity_calibration();
     bool run_hall_phase_calibration();
     bool run_offset_calibration();
-    void sample_now();
-    bool read_sampled_gpio(Stm32Gpio gpio);
+    bool run_eccentricity_calibration();
+    bool run_sincos_calibration();
+    float eccentricity_correction(int32_t count_in_cpr);
+    void select_update_fn();
+    void sample_now(uint32_t timestamp);
+    int32_t raw_sample() const;
+    void sample_incremental(uint32_t timestamp);
+    void sample_hall(uint32_t timestamp);
+    void sample_sincos(uint32_t timestamp);
+    void sample_abs_spi(uint32_t timestamp);
     void decode_hall_samples();
     int32_t hall_model(float internal_pos);
-    bool update();
+    float hall_segment_length(int32_t count);
+    void update_hall_edge_timing(int32_t delta_enc);
+    float update_mt_velocity(float pll_vel_counts);
+    bool update(uint32_t timestamp);
+    void advance_count(int32_t delta_enc);
+    bool update_incremental(uint32_t timestamp);
+    bool update_hall(uint32_t timestamp);
+    bool update_hall_calibration(uint32_t timestamp);
+    bool update_sincos(uint32_t timestamp);
+    bool update_sincos_calibration(uint32_t timestamp);
+    bool update_abs_spi(uint32_t timestamp);
+    template <uint32_t mode> bool update_estimates(uint32_t timestamp, int32_t delta_enc);
 
     TIM_HandleTypeDef* timer_;
     Stm32Gpio index_gpio_;
+    uint32_t index_capture_channel_; // channel of timer_ that can latch CNT at the index pulse
+    uint8_t index_capture_af_; // alternate function of index_gpio_ for that channel, 0 if there is none
     Stm32Gpio hallA_gpio_;
     Stm32Gpio hallB_gpio_;
     Stm32Gpio hallC_gpio_;
@@ -96,22 +168,30 @@ public:
     Error error_ = ERROR_NONE;
     bool index_found_ = false;
     bool is_ready_ = false;
-    int32_t shadow_count_ = 0;
+    int64_t shadow_count_ = 0;
     int32_t count_in_cpr_ = 0;
     float interpolation_ = 0.0f;
     OutputPort<float> phase_ = 0.0f;     // [rad]
     OutputPort<float> phase_vel_ = 0.0f; // [rad/s]
+    // Linear position estimate: pos_estimate_base_counts_ + pos_estimate_counts_,
+    // with pos_estimate_counts_ in [0, cpr) and the base a multiple of cpr
+    // (pos_estimate_turns_ turns)
     float pos_estimate_counts_ = 0.0f;  // [count]
+    int64_t pos_estimate_base_counts_ = 0; // [count]
+    int64_t pos_estimate_turns_ = 0;
     float pos_cpr_counts_ = 0.0f;  // [count]
     float delta_pos_cpr_counts_ = 0.0f;  // [count] phase detector result for debug
     float vel_estimate_counts_ = 0.0f;  // [count/s]
     float pll_kp_ = 0.0f;   // [count/s / count]
     float pll_ki_ = 0.0f;   // [(count/s^2) / count]
+    KalmanTrackerGains kalman_gains_; // set by update_pll_gains() if config_.use_kalman_filter
+    float kalman_load_accel_counts_ = 0.0f; // [count/s^2] acceleration not explained by the torque
     float calib_scan_response_ = 0.0f; // debug report from offset calib
     int32_t pos_abs_ = 0;
     float spi_error_rate_ = 0.0f;
 
     OutputPort<float> pos_estimate_ = 0.0f; // [turn]
+    OutputPort<SplitPos> pos_estimate_split_ = SplitPos{}; // [turn] pos_estimate_ at full resolution
     OutputPort<float> vel_estimate_ = 0.0f; // [turn/s]
     OutputPort<float> pos_circular_ = 0.0f; // [turn]
 
@@ -119,35 +199,96 @@ public:
     bool vel_estimate_valid_ = false;
 
     int16_t tim_cnt_sample_ = 0; // 
-    static const constexpr GPIO_TypeDef* ports_to_sample[] = { GPIOA, GPIOB, GPIOC };
-    uint16_t port_samples_[sizeof(ports_to_sample) / sizeof(ports_to_sample[0])];
+    int16_t tim_cnt_last_ = 0; // tim_cnt_sample_ of the last update_incremental()
+    bool index_capture_active_ = false;
+    Snapshot<int16_t> index_cnt_; // timer count at the last index pulse, published by enc_index_cb()
+    uint32_t index_n_applied_ = 0; // index_cnt_.get_n_published() at the last apply_index()
+    int32_t index_error_ = 0; // [counts] offset of the index from count 0 at the last checked pulse
+    uint32_t sample_timestamp_ = 0; // [HCLK ticks] time at which the position used by the last update() was sampled
+    uint32_t sample_cycles_ = 0; // DWT cycle counter at the last sample_now() of an incremental or hall encoder
     // Updated by low_level pwm_adc_cb
     uint8_t hall_state_ = 0x0; // bit[0] = HallA, .., bit[2] = HallC
-    std::optional<uint8_t> last_hall_cnt_ = std::nullopt; // Used to find hall edges for calibration
-    bool calibrate_hall_phase_ = false;
-    bool sample_hall_states_ = false;
-    bool sample_hall_phase_ = false;
-    std::array<int, 8> states_seen_count_; // for hall polarity calibration
-    std::array<int, 6> hall_phase_calib_seen_count_;
+    bool calibrate_hall_ = false; // a hall calibration spin is in progress
+    bool sample_hall_ = false; // the spin reached constant velocity
+    HallCalibration hall_calibration_;
+    // Time of the most recent hall edge and the time since the edge before.
+    // Published by the EXTI interrupt and read by update().
+    struct HallEdge_t {
+        uint32_t cycles;   // DWT cycle counter at the edge
+        uint32_t interval; // [cycles] time since the previous edge
+    };
+    Snapshot<HallEdge_t> hall_edge_;
+    uint32_t hall_edge_last_cycles_ = 0; // only accessed by hall_edge_cb()
+    int32_t hall_edge_dir_ = 0; // direction of the last counted edge, 0 if its timing is unknown
+    bool hall_edge_vel_valid_ = false; // the last two counted edges went in the same direction
+    float hall_edge_vel_counts_ = 0.0f; // [counts/s] unsigned velocity between the last two edges
+    float hall_edge_age_ = 0.0f; // [s] time between the last counted edge and the last GPIO sample
+    // Time and timer count at the most recent rising edge of the A channel of
+    // an incremental encoder. Published by the EXTI interrupt.
+    struct MtEdge_t {
+        uint32_t cycles; // DWT cycle counter at the edge
+        int16_t count;   // encoder timer count right after the edge
+    };
+    Snapshot<MtEdge_t> mt_edge_;
+    MtEdge_t mt_last_edge_; // edge at the start of the current measurement interval
+    uint32_t mt_n_consumed_ = 0; // number of edges seen by update()
+    bool mt_armed_ = false; // the EXTI of the A channel is subscribed
+    bool mt_last_edge_valid_ = false;
+    float mt_vel_counts_ = 0.0f; // [counts/s] velocity over the last interval between edges
+    bool sample_eccentricity_ = false;
+    std::array<float, ECCENTRICITY_TABLE_SIZE> eccentricity_calib_sum_; // [counts]
+    std::array<uint16_t, ECCENTRICITY_TABLE_SIZE> eccentricity_calib_n_;
 
-    float sincos_sample_s_ = 0.0f;
-    float sincos_sample_c_ = 0.0f;
+    float sincos_sample_s_ = 0.0f; // [relative to ADC full scale]
+    float sincos_sample_c_ = 0.0f; // [relative to ADC full scale]
+    float sincos_frac_ = 0.0f; // [counts] sub-count part of the last sin/cos position
+    bool sample_sincos_ = false;
+    // Raw moments of the sin/cos samples for run_sincos_calibration()
+    struct SincosCalibSums_t {
+        uint32_t n;
+        float s, c, ss, cc, sc;
+    };
+    SincosCalibSums_t sincos_calib_sums_;
 
-    bool abs_spi_start_transaction();
+    bool abs_spi_prepare_transaction();
+    Stm32SpiArbiter::SpiTask* take_spi_task();
     void abs_spi_cb(bool success);
+    void select_abs_spi_decoder();
+    bool abs_spi_retry_in_time();
     void abs_spi_cs_pin_init();
-    bool abs_spi_pos_updated_ = false;
+    // Position and capture time of the most recent successful SPI read.
+    // Published by the SPI completion interrupt and latched by update().
+    struct AbsSpiSample_t {
+        int32_t pos;
+        uint32_t timestamp; // [HCLK ticks] time at which the chip select was asserted
+    };
+    Snapshot<AbsSpiSample_t> abs_spi_sample_;
+    uint32_t abs_spi_n_consumed_ = 0; // number of samples seen by update()
+    uint32_t abs_spi_start_timestamp_ = 0; // [HCLK ticks] timestamp of the sampling event that requested the transfer
+    uint32_t abs_spi_start_cycles_ = 0; // DWT cycle counter at the same sampling event
     Mode mode_ = MODE_INCREMENTAL;
+    // Mode specific parts of sample_now() and update(), set by select_update_fn()
+    void (*sample_fn_)(Encoder* enc, uint32_t timestamp) = nullptr;
+    bool (*update_fn_)(Encoder* enc, uint32_t timestamp) = nullptr;
     Stm32Gpio abs_spi_cs_gpio_;
     uint32_t abs_spi_cr1;
     uint32_t abs_spi_cr2;
-    uint16_t abs_spi_dma_tx_[1] = {0xFFFF};
-    uint16_t abs_spi_dma_rx_[1];
+    static constexpr size_t ABS_SPI_MAX_WORDS = 4; // longest frame (BiSS-C and SSI)
+    uint16_t abs_spi_dma_tx_[ABS_SPI_MAX_WORDS] = {0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF};
+    uint16_t abs_spi_dma_rx_[ABS_SPI_MAX_WORDS];
+    size_t abs_spi_frame_words_ = 1;
+    // Set by select_abs_spi_decoder(), returns false if the frame is invalid
+    bool (*abs_spi_decode_fn_)(Encoder* enc, int32_t* pos) = nullptr;
+    serial_abs::WordFormat abs_spi_word_format_ = serial_abs::AMS_WORD_FORMAT; // single word formats
+    size_t abs_spi_data_bits_ = 0; // BiSS-C and SSI
+    uint64_t abs_spi_singleturn_mask_ = 0; // BiSS-C and SSI
     Stm32SpiArbiter::SpiTask spi_task_;
-
-    constexpr float getCoggingRatio(){
-        return 1.0f / 3600.0f;
-    }
+    bool spi_task_pending_ = false; // spi_task_ is prepared but not yet submitted
+    bool abs_spi_retried_ = false; // the transfer of this cycle was already repeated once
+    uint32_t abs_spi_deadline_cycles_ = 0; // [cycles] time from the sampling event to update()
+    uint32_t abs_spi_bad_frames_ = 0; // failed transfers and frames with parity/CRC/status errors
+    uint32_t abs_spi_retries_ = 0; // transfers repeated within the same cycle
+    uint32_t abs_spi_stale_cycles_ = 0; // control loop iterations without a new position
 
 };
 
@@ -1,5 +1,8 @@
 #include <odrive_main.h>
 
+static void endstop_edge_cb_wrapper(void* ctx) {
+    reinterpret_cast<Endstop*>(ctx)->edge_cb();
+}
 
 void Endstop::update() {
     debounceTimer_.update();
@@ -7,26 +10,91 @@ void Endstop::update() {
     if (config_.enabled) {
         bool last_pin_state = pin_state_;
 
-        pin_state_ = get_gpio(config_.gpio_num).read();
+        // Sampled with the control loop, so the debounce time is exact
+        pin_state_ = odrv.read_sampled_gpio(get_gpio(config_.gpio_num));
 
         // If the pin state has changed, reset the timer
         if (pin_state_ != last_pin_state)
             debounceTimer_.reset();
 
-        if (debounceTimer_.expired())
+        // The first edge after a stable period is where a change starts, the
+        // following ones are bounces
+        uint32_t n_edges, first_edge_cycles;
+        CRITICAL_SECTION() {
+            n_edges = n_edges_;
+            first_edge_cycles = first_edge_cycles_;
+            n_edges_ = 0;
+        }
+        if (n_edges && !candidate_valid_) {
+            candidate_valid_ = true;
+            candidate_cycles_ = first_edge_cycles;
+        }
+        // An edge after the GPIO sample belongs to the next sample
+        bool candidate_sampled = candidate_valid_ && (int32_t)(odrv.sample_cycles_ - candidate_cycles_) >= 0;
+
+        if (debounceTimer_.expired()) {
             endstop_state_ = config_.is_active_high ? pin_state_ : !pin_state_;  // endstop_state is the logical state
+            if (endstop_state_ != last_state_) {
+                pos_at_edge_ = candidate_sampled ? pos_at(candidate_cycles_) : std::nullopt;
+            }
+            // The change is done or it was a glitch
+            if (candidate_sampled) {
+                candidate_valid_ = false;
+            }
+        }
     } else {
         endstop_state_ = false;
+        candidate_valid_ = false;
+        pos_at_edge_ = std::nullopt;
+    }
+}
+
+// Triggered on both edges of the endstop GPIO if config_.use_edge_timing is set
+void Endstop::edge_cb() {
+    uint32_t cycles = DWT->CYCCNT;
+    if (n_edges_++ == 0) {
+        first_edge_cycles_ = cycles;
     }
 }
 
+/**
+ * @brief Encoder position [turn] at the given time, extrapolated from the
+ * estimate of the last control loop iteration with its velocity.
+ * Must run before the output ports of the encoder are reset. The time is at
+ * most a few control loop periods off, during which the velocity of a homing
+ * move is constant.
+ */
+std::optional<float> Endstop::pos_at(uint32_t cycles) const {
+    std::optional<float> pos = axis_->encoder_.pos_estimate_.any();
+    std::optional<float> vel = axis_->encoder_.vel_estimate_.any();
+    if (!pos.has_value() || !vel.has_value()) {
+        return std::nullopt;
+    }
+    int32_t dt = (int32_t)(odrv.loop_sample_cycles_ - cycles);
+    return *pos - *vel * ((float)dt / (float)TIM_1_8_CLOCK_HZ);
+}
+
 bool Endstop::apply_config() {
+    config_.parent = this;
     debounceTimer_.reset();
     if (config_.enabled) {
         debounceTimer_.start();
     } else {
         debounceTimer_.stop();
     }
-    debounceTimer_.setIncrement(config_.debounce_ms * 0.001f);
+    debounceTimer_.setTimeout(config_.debounce_ms * 0.001f);
+    debounceTimer_.setIncrement(schedule::endstop_update.period());
+
+    edge_gpio_.unsubscribe();
+    edge_gpio_ = Stm32Gpio{};
+    candidate_valid_ = false;
+    pos_at_edge_ = std::nullopt;
+    if (config_.enabled && config_.use_edge_timing) {
+        edge_gpio_ = get_gpio(config_.gpio_num);
+        if (!edge_gpio_.subscribe(true, true, endstop_edge_cb_wrapper, this)) {
+            edge_gpio_ = Stm32Gpio{};
+            odrv.misconfigured_ = true;
+        }
+    }
     return true;
 }
@@ -1,7 +1,10 @@
 #ifndef __ENDSTOP_HPP
 #define __ENDSTOP_HPP
 
+#include <optional>
 #include "timer.hpp"
+#include "config_transaction.hpp"
+
 class Endstop {
    public:
     struct Config_t {
@@ -10,12 +13,14 @@ class Endstop {
         uint16_t gpio_num = 0;
         bool enabled = false;
         bool is_active_high = false;
+        bool use_edge_timing = false; // Timestamp the edges of the GPIO, see pos_at_edge_
 
         // custom setters
         Endstop* parent = nullptr;
-        void set_gpio_num(uint16_t value) { gpio_num = value; parent->apply_config(); }
-        void set_enabled(uint32_t value) { enabled = value; parent->apply_config(); }
-        void set_debounce_ms(uint32_t value) { debounce_ms = value; parent->apply_config(); }
+        void set_gpio_num(uint16_t value) { gpio_num = value; config_changed<&Endstop::apply_config>(parent); }
+        void set_enabled(uint32_t value) { enabled = value; config_changed<&Endstop::apply_config>(parent); }
+        void set_debounce_ms(uint32_t value) { debounce_ms = value; config_changed<&Endstop::apply_config>(parent); }
+        void set_use_edge_timing(bool value) { use_edge_timing = value; config_changed<&Endstop::apply_config>(parent); }
     };
 
 
@@ -25,6 +30,8 @@ class Endstop {
     bool apply_config();
 
     void update();
+    void edge_cb();
+
     constexpr bool get_state(){
         return endstop_state_;
     }
@@ -38,11 +45,22 @@ class Endstop {
     }
 
     bool endstop_state_ = false;
+    // [turn] encoder position at the GPIO edge where the last change of
+    // endstop_state_ started. nullopt if config_.use_edge_timing is off.
+    std::optional<float> pos_at_edge_;
 
    private:
+    std::optional<float> pos_at(uint32_t cycles) const;
+
     bool last_state_ = false;
     bool pin_state_ = false;
     float pos_when_pressed_ = 0.0f;
     Timer<float> debounceTimer_;
+
+    Stm32Gpio edge_gpio_; // GPIO that edge_cb() is subscribed to
+    uint32_t n_edges_ = 0; // edges since the last update(), written by edge_cb()
+    uint32_t first_edge_cycles_ = 0; // DWT cycle counter at the first of these edges
+    bool candidate_valid_ = false; // a change that is being debounced started at candidate_cycles_
+    uint32_t candidate_cycles_ = 0;
 };
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,108 @@
+#ifndef __EVENT_LOG_HPP
+#define __EVENT_LOG_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define EVENT_LOG_SIZE 64 // must be a power of two
+#define EVENT_LOG_MAX_SOURCES 16
+#define EVENT_LOG_MAGIC 0xE7E71064
+
+/**
+ * @brief Ring buffer of timestamped error events that can be written from any
+ * context, including nested interrupts.
+ *
+ * Entries are claimed with an atomic increment like the trace buffer. Each
+ * entry carries its event number + 1, which is written last and invalidated
+ * first, so that a reader can tell a valid entry from one that is being
+ * overwritten.
+ *
+ * The class has no constructor so that it can live in a section that
+ * survives a reboot. Call reset() if is_valid() is false.
+ */
+class EventLog {
+public:
+    struct Entry_t {
+        uint32_t seq; // event number + 1, 0 while invalid
+        uint32_t cycles; // [HCLK ticks]
+        uint32_t code;
+        uint8_t source;
+    };
+
+    bool is_valid() const { return magic_ == EVENT_LOG_MAGIC; }
+
+    // @brief Clears all events. Not safe against concurrent writers.
+    void reset() {
+        head_ = 0;
+        for (size_t i = 0; i < EVENT_LOG_SIZE; ++i) {
+            entries_[i].seq = 0;
+        }
+        for (size_t i = 0; i < EVENT_LOG_MAX_SOURCES; ++i) {
+            last_errors_[i] = 0;
+        }
+        magic_ = EVENT_LOG_MAGIC;
+    }
+
+    // @brief Forgets the error state of all sources, for instance after a
+    // reboot, but keeps the events.
+    void reset_sources() {
+        for (size_t i = 0; i < EVENT_LOG_MAX_SOURCES; ++i) {
+            __atomic_store_n(&last_errors_[i], 0, __ATOMIC_RELAXED);
+        }
+    }
+
+    void push(uint32_t cycles, uint8_t source, uint32_t code) {
+        uint32_t idx = __atomic_fetch_add(&head_, 1, __ATOMIC_RELAXED);
+        Entry_t& entry = entries_[idx & (EVENT_LOG_SIZE - 1)];
+        __atomic_store_n(&entry.seq, 0, __ATOMIC_RELAXED);
+        __atomic_signal_fence(__ATOMIC_SEQ_CST);
+        entry.cycles = cycles;
+        entry.code = code;
+        entry.source = source;
+        __atomic_store_n(&entry.seq, idx + 1, __ATOMIC_RELEASE);
+    }
+
+    /**
+     * @brief Logs the bits of `error` that were not set on the previous call
+     * for the same source. Cleared bits are forgotten, so they are logged
+     * again when they are set again.
+     */
+    void track(uint32_t cycles, uint8_t source, uint32_t error) {
+        if (source >= EVENT_LOG_MAX_SOURCES) {
+            return;
+        }
+        uint32_t prev = __atomic_exchange_n(&last_errors_[source], error, __ATOMIC_RELAXED);
+        if (uint32_t new_bits = error & ~prev) {
+            push(cycles, source, new_bits);
+        }
+    }
+
+    // @brief Total number of events since the last reset (wraps)
+    uint32_t head() const { return __atomic_load_n(&head_, __ATOMIC_RELAXED); }
+
+    /**
+     * @brief Reads the event with the specified event number. Fails if the
+     * event was overwritten or not written yet.
+     */
+    bool read(uint32_t index, Entry_t* entry) const {
+        if (head() - index - 1 >= EVENT_LOG_SIZE) {
+            return false;
+        }
+        const Entry_t& src = entries_[index & (EVENT_LOG_SIZE - 1)];
+        uint32_t seq = __atomic_load_n(&src.seq, __ATOMIC_ACQUIRE);
+        entry->seq = seq;
+        entry->cycles = src.cycles;
+        entry->code = src.code;
+        entry->source = src.source;
+        __atomic_signal_fence(__ATOMIC_SEQ_CST);
+        return seq == index + 1 && __atomic_load_n(&src.seq, __ATOMIC_RELAXED) == seq;
+    }
+
+private:
+    uint32_t magic_;
+    uint32_t head_;
+    Entry_t entries_[EVENT_LOG_SIZE];
+    uint32_t last_errors_[EVENT_LOG_MAX_SOURCES];
+};
+
+#endif // __EVENT_LOG_HPP
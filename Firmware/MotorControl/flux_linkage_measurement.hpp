@@ -0,0 +1,78 @@
+#ifndef __FLUX_LINKAGE_MEASUREMENT_HPP
+#define __FLUX_LINKAGE_MEASUREMENT_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <cmath>
+
+/**
+ * @brief Measures the permanent magnet flux linkage while the motor follows a
+ * current vector of constant magnitude that rotates at a known speed, for
+ * instance during a lock-in spin.
+ *
+ * With v = (R + j w L) i + e the back EMF follows from
+ * v * conj(i) - (R + j w L) |i|^2 = e * conj(i). The product doesn't depend
+ * on the reference frame, so no rotor angle is needed, and it is constant
+ * while the rotor is in sync with the current vector, so it can be averaged.
+ * The flux linkage is |e| / |w|.
+ */
+class FluxLinkageMeasurement {
+public:
+    void reset() {
+        vi_re_ = 0.0f;
+        vi_im_ = 0.0f;
+        ii_ = 0.0f;
+        w_ii_ = 0.0f;
+        n_samples_ = 0;
+        has_previous_ = false;
+    }
+
+    /**
+     * @param Valpha, Vbeta: Voltage applied since the previous measurement [V]
+     * @param Ialpha, Ibeta: Current measurement [A]
+     * @param phase_vel: Electrical velocity of the current vector [rad/s]
+     */
+    void add_sample(float Valpha, float Vbeta, float Ialpha, float Ibeta, float phase_vel) {
+        if (has_previous_) {
+            // Current in the middle of the interval in which V was applied
+            float Ia = 0.5f * (Ialpha + Ialpha_);
+            float Ib = 0.5f * (Ibeta + Ibeta_);
+            float i_sq = Ia * Ia + Ib * Ib;
+            vi_re_ += Valpha * Ia + Vbeta * Ib;
+            vi_im_ += Vbeta * Ia - Valpha * Ib;
+            ii_ += i_sq;
+            w_ii_ += phase_vel * i_sq;
+            n_samples_++;
+        }
+        Ialpha_ = Ialpha;
+        Ibeta_ = Ibeta;
+        has_previous_ = true;
+    }
+
+    uint32_t n_samples() const { return n_samples_; }
+
+    // @brief Returns the flux linkage [V/(rad/s)] or NaN without valid samples
+    float result(float phase_resistance, float phase_inductance) const {
+        if (!n_samples_ || !(ii_ > 0.0f) || !(std::abs(w_ii_) > 0.0f)) {
+            return NAN;
+        }
+        float ei_re = vi_re_ - phase_resistance * ii_;
+        float ei_im = vi_im_ - phase_inductance * w_ii_;
+        // sum(|e| |i|) / sqrt(N * sum(|i|^2)) is |e| for a constant |i|
+        float e = std::sqrt((ei_re * ei_re + ei_im * ei_im) / ((float)n_samples_ * ii_));
+        float mean_w = w_ii_ / ii_;
+        return e / std::abs(mean_w);
+    }
+
+private:
+    float vi_re_ = 0.0f;    // [VA]
+    float vi_im_ = 0.0f;    // [VA]
+    float ii_ = 0.0f;       // [A^2]
+    float w_ii_ = 0.0f;     // [A^2 rad/s]
+    uint32_t n_samples_ = 0;
+    bool has_previous_ = false;
+    float Ialpha_ = 0.0f;
+    float Ibeta_ = 0.0f;
+};
+
+#endif // __FLUX_LINKAGE_MEASUREMENT_HPP
@@ -20,7 +20,7 @@ Motor::Error AlphaBetaFrameController::on_measurement(
     return on_measurement(vbus_voltage, Ialpha_beta, input_timestamp);
 }
 
-Motor::Error AlphaBetaFrameController::get_output(
+RAMFUNC Motor::Error AlphaBetaFrameController::get_output(
             uint32_t output_timestamp, float (&pwm_timings)[3],
             std::optional<float>* ibus) {
     std::optional<float2D> mod_alpha_beta;
@@ -32,7 +32,7 @@ Motor::Error AlphaBetaFrameController::get_output(
         return Motor::ERROR_MODULATION_IS_NAN;
     }
 
-    auto [tA, tB, tC, success] = SVM(mod_alpha_beta->first, mod_alpha_beta->second);
+    auto [tA, tB, tC, success] = SVM(mod_alpha_beta->first, mod_alpha_beta->second, svm_overmodulation_);
     if (!success) {
         return Motor::ERROR_MODULATION_MAGNITUDE;
     }
@@ -50,9 +50,14 @@ void FieldOrientedController::reset() {
     vbus_voltage_measured_ = std::nullopt;
     Ialpha_beta_measured_ = std::nullopt;
     power_ = 0.0f;
+    mod_ratio_ = 0.0f;
+    last_V_d_ = 0.0f;
+    last_V_q_ = 0.0f;
+    last_Id_ = 0.0f;
+    last_Iq_ = 0.0f;
 }
 
-Motor::Error FieldOrientedController::on_measurement(
+RAMFUNC Motor::Error FieldOrientedController::on_measurement(
         std::optional<float> vbus_voltage, std::optional<float2D> Ialpha_beta,
         uint32_t input_timestamp) {
     // Store the measurements for later processing.
@@ -63,7 +68,7 @@ Motor::Error FieldOrientedController::on_measurement(
     return Motor::ERROR_NONE;
 }
 
-ODriveIntf::MotorIntf::Error FieldOrientedController::get_alpha_beta_output(
+RAMFUNC ODriveIntf::MotorIntf::Error FieldOrientedController::get_alpha_beta_output(
         uint32_t output_timestamp, std::optional<float2D>* mod_alpha_beta,
         std::optional<float>* ibus) {
 
@@ -95,11 +100,14 @@ ODriveIntf::MotorIntf::Error FieldOrientedController::get_alpha_beta_output(
     std::optional<float2D> Idq;
 
     // Park transform
+    // The phase estimate is valid at ctrl_timestamp_ (the sensors compensate
+    // for their own sampling latency), so it's projected to the time of the
+    // current measurement here and to the PWM midpoint below.
     if (Ialpha_beta_measured_.has_value()) {
         auto [Ialpha, Ibeta] = *Ialpha_beta_measured_;
         float I_phase = phase + phase_vel * ((float)(int32_t)(i_timestamp_ - ctrl_timestamp_) / (float)TIM_1_8_CLOCK_HZ);
-        float c_I = our_arm_cos_f32(I_phase);
-        float s_I = our_arm_sin_f32(I_phase);
+        float c_I, s_I;
+        our_arm_sin_cos_f32(I_phase, &s_I, &c_I);
         Idq = {
             c_I * Ialpha + s_I * Ibeta,
             c_I * Ibeta - s_I * Ialpha
@@ -131,23 +139,71 @@ ODriveIntf::MotorIntf::Error FieldOrientedController::get_alpha_beta_output(
         auto [p_gain, i_gain] = *pi_gains_;
         auto [Id, Iq] = *Idq;
         auto [Id_setpoint, Iq_setpoint] = *Idq_setpoint_;
+        if (average_current_pairs_) {
+            // Removes the response to an injection at half the control loop
+            // frequency from the feedback
+            float Id_last = last_Id_;
+            float Iq_last = last_Iq_;
+            last_Id_ = Id;
+            last_Iq_ = Iq;
+            Id = 0.5f * (Id + Id_last);
+            Iq = 0.5f * (Iq + Iq_last);
+        } else {
+            last_Id_ = Id;
+            last_Iq_ = Iq;
+        }
 
         float Ierr_d = Id_setpoint - Id;
         float Ierr_q = Iq_setpoint - Iq;
 
-        // Apply PI control (V{d,q}_setpoint act as feed-forward terms in this mode)
-        mod_d = V_to_mod * (Vd + v_current_control_integral_d_ + Ierr_d * p_gain);
-        mod_q = V_to_mod * (Vq + v_current_control_integral_q_ + Ierr_q * p_gain);
+        float V_d;
+        float V_q;
+        if (deadbeat_) {
+            // The voltage computed now is applied from the next measurement
+            // on, so first predict the current at that point from the voltage
+            // that is applied until then. Then choose the voltage that moves
+            // the predicted current by deadbeat_gain_ of its error within one
+            // period. The model replaces the V{d,q}_setpoint feed-forward.
+            float dt_by_L = current_meas_period / model_L_;
+            float bemf = phase_vel * model_flux_;
+            float Id_pred = Id + dt_by_L * (last_V_d_ - model_R_ * Id + phase_vel * model_L_ * Iq);
+            float Iq_pred = Iq + dt_by_L * (last_V_q_ - model_R_ * Iq - phase_vel * model_L_ * Id - bemf);
+            float k_db = deadbeat_gain_ / dt_by_L;
+            V_d = model_R_ * Id_pred - phase_vel * model_L_ * Iq_pred
+                + k_db * (Id_setpoint - Id_pred) + v_current_control_integral_d_;
+            V_q = model_R_ * Iq_pred + phase_vel * model_L_ * Id_pred + bemf
+                + k_db * (Iq_setpoint - Iq_pred) + v_current_control_integral_q_;
+        } else {
+            // Apply PI control (V{d,q}_setpoint act as feed-forward terms in this mode)
+            V_d = Vd + v_current_control_integral_d_ + Ierr_d * p_gain;
+            V_q = Vq + v_current_control_integral_q_ + Ierr_q * p_gain;
+        }
+        mod_d = V_to_mod * V_d;
+        mod_q = V_to_mod * V_q;
 
-        // Vector modulation saturation, lock integrator if saturated
-        // TODO make maximum modulation configurable
-        float mod_scalefactor = 0.80f * sqrt3_by_2 * 1.0f / std::sqrt(mod_d * mod_d + mod_q * mod_q);
-        if (mod_scalefactor < 1.0f) {
+        // Vector modulation saturation. A modulation of sqrt(3)/2 is the
+        // circle inscribed in the SVM hexagon; beyond it up to the hexagon
+        // corners SVM() has to overmodulate.
+        float mod_limit = max_modulation_ * sqrt3_by_2;
+        max_voltage_ = mod_limit * mod_to_V;
+        float mod_sq = mod_d * mod_d + mod_q * mod_q;
+        bool saturated = mod_sq > mod_limit * mod_limit;
+        mod_ratio_ = (mod_limit > 0.0f) ? std::sqrt(mod_sq) / mod_limit : 0.0f;
+        if (saturated) {
+            float mod_scalefactor = mod_limit / std::sqrt(mod_sq);
             mod_d *= mod_scalefactor;
             mod_q *= mod_scalefactor;
-            // TODO make decayfactor configurable
-            v_current_control_integral_d_ *= 0.99f;
-            v_current_control_integral_q_ *= 0.99f;
+        }
+
+        if (back_calculation_) {
+            // Feed the part of the command that was cut off back into the
+            // integrator with the time constant of the PI zero
+            float k_t = (p_gain > 0.0f) ? std::min(i_gain / p_gain * current_meas_period, 1.0f) : 0.0f;
+            v_current_control_integral_d_ += Ierr_d * (i_gain * current_meas_period) + k_t * (mod_to_V * mod_d - V_d);
+            v_current_control_integral_q_ += Ierr_q * (i_gain * current_meas_period) + k_t * (mod_to_V * mod_q - V_q);
+        } else if (saturated) {
+            v_current_control_integral_d_ *= integrator_decay_;
+            v_current_control_integral_q_ *= integrator_decay_;
         } else {
             v_current_control_integral_d_ += Ierr_d * (i_gain * current_meas_period);
             v_current_control_integral_q_ += Ierr_q * (i_gain * current_meas_period);
@@ -158,17 +214,39 @@ ODriveIntf::MotorIntf::Error FieldOrientedController::get_alpha_beta_output(
         mod_d = V_to_mod * Vd;
         mod_q = V_to_mod * Vq;
     }
+    last_V_d_ = mod_to_V * mod_d;
+    last_V_q_ = mod_to_V * mod_q;
 
-    // Inverse park transform
+    // Inverse park transform at the midpoint of the PWM cycle in which the
+    // output will be applied
     float pwm_phase = phase + phase_vel * ((float)(int32_t)(output_timestamp - ctrl_timestamp_) / (float)TIM_1_8_CLOCK_HZ);
-    float c_p = our_arm_cos_f32(pwm_phase);
-    float s_p = our_arm_sin_f32(pwm_phase);
+    float c_p, s_p;
+    our_arm_sin_cos_f32(pwm_phase, &s_p, &c_p);
     float mod_alpha = c_p * mod_d - s_p * mod_q;
     float mod_beta = c_p * mod_q + s_p * mod_d;
 
+    // Dead time and switch drops make the inverter apply less than the
+    // commanded voltage against the direction of each phase current
+    float drop_alpha = 0.0f;
+    float drop_beta = 0.0f;
+    if (inverter_drop_ > 0.0f) {
+        auto [Ialpha, Ibeta] = *Ialpha_beta_measured_;
+        std::tie(drop_alpha, drop_beta) = inverter_drop_alpha_beta(Ialpha, Ibeta, inverter_drop_, inverter_drop_band_);
+        if (inverter_drop_comp_) {
+            mod_alpha += V_to_mod * drop_alpha;
+            mod_beta += V_to_mod * drop_beta;
+            float mod_sq = mod_alpha * mod_alpha + mod_beta * mod_beta;
+            if (svm_overmodulation_ == SVM_OVERMODULATION_NONE && mod_sq > sqrt3_by_2 * sqrt3_by_2) {
+                float mod_scalefactor = sqrt3_by_2 / std::sqrt(mod_sq);
+                mod_alpha *= mod_scalefactor;
+                mod_beta *= mod_scalefactor;
+            }
+        }
+    }
+
     // Report final applied voltage in stationary frame (for sensorless estimator)
-    final_v_alpha_ = mod_to_V * mod_alpha;
-    final_v_beta_ = mod_to_V * mod_beta;
+    final_v_alpha_ = mod_to_V * mod_alpha - drop_alpha;
+    final_v_beta_ = mod_to_V * mod_beta - drop_beta;
 
     *mod_alpha_beta = {mod_alpha, mod_beta};
 
@@ -176,6 +254,14 @@ ODriveIntf::MotorIntf::Error FieldOrientedController::get_alpha_beta_output(
         auto [Id, Iq] = *Idq;
         *ibus = mod_d * Id + mod_q * Iq;
         power_ = vbus_voltage * (*ibus).value();
+        power_predicted_ = power_;
+    }
+
+    // In current control mode the current reaches the setpoint within the
+    // next PWM period, so the setpoint predicts the bus current of that period.
+    if (enable_current_control_) {
+        auto [Id_setpoint, Iq_setpoint] = *Idq_setpoint_;
+        power_predicted_ = vbus_voltage * (mod_d * Id_setpoint + mod_q * Iq_setpoint);
     }
     
     return Motor::ERROR_NONE;
@@ -29,6 +29,18 @@ public:
     // Config - these values are set while this controller is inactive
     std::optional<float2D> pi_gains_; // [V/A, V/As] should be auto set after resistance and inductance measurement
     float I_measured_report_filter_k_ = 1.0f;
+    float max_modulation_ = 0.80f;      // fraction of the linear modulation range, above 1 requires svm_overmodulation_
+    bool back_calculation_ = false;     // anti-windup: true: back-calculation, false: integrator decay
+    float integrator_decay_ = 0.99f;    // per cycle while the modulation saturates
+    float inverter_drop_ = 0.0f;        // [V] per phase voltage lost to dead time and switch drops
+    float inverter_drop_band_ = 0.5f;   // [A] phase current below which the drop is ramped down
+    bool inverter_drop_comp_ = false;   // add the drop to the output instead of only reporting it
+    bool deadbeat_ = false;             // predictive current control from the model below instead of the PI
+    float deadbeat_gain_ = 0.8f;        // fraction of the predicted current error removed per period
+    float model_R_ = 0.0f;              // [Ohm]
+    float model_L_ = 1.0f;              // [H]
+    float model_flux_ = 0.0f;           // [V/(rad/s)] flux linkage as seen by the q voltage
+    bool average_current_pairs_ = false; // feed back the mean of two consecutive measurements, set during HFI
 
     // Inputs
     bool enable_current_control_src_ = false;
@@ -60,7 +72,14 @@ public:
     //float ibus_ = 0.0f;
     float final_v_alpha_ = 0.0f; // [V]
     float final_v_beta_ = 0.0f; // [V]
+    float max_voltage_ = 0.0f; // [V] magnitude of Vdq at the modulation limit
+    float mod_ratio_ = 0.0f; // unsaturated modulation magnitude relative to the limit, drives field weakening
+    float last_V_d_ = 0.0f; // [V] output of the previous cycle, for the deadbeat prediction
+    float last_V_q_ = 0.0f; // [V]
+    float last_Id_ = 0.0f; // [A] measurement of the previous cycle, for average_current_pairs_
+    float last_Iq_ = 0.0f; // [A]
     float power_ = 0.0f; // [W] dot product of Vdq and Idq
+    float power_predicted_ = 0.0f; // [W] dot product of Vdq and the Idq setpoint, i.e. the power at the end of the next PWM period
 };
 
 #endif // __FOC_HPP
\ No newline at end of file
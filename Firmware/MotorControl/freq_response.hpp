@@ -0,0 +1,133 @@
+#ifndef __FREQ_RESPONSE_HPP
+#define __FREQ_RESPONSE_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <cmath>
+
+/**
+ * @brief On-line frequency response measurement with a stepped sine.
+ *
+ * The excitation steps through n_points logarithmically spaced frequencies
+ * from f_min to f_max. At each frequency it waits settle_periods for the
+ * transient to decay and then correlates the excitation and the response with
+ * the excitation frequency over measure_periods whole periods. This is one DFT
+ * bin per signal, so the memory needed doesn't depend on the measurement time.
+ * The ratio of the two bins gives one point of the Bode plot.
+ */
+class FrequencyResponse {
+public:
+    static constexpr size_t MAX_POINTS = 32;
+
+    struct Point_t {
+        float frequency;    // [Hz]
+        float gain;         // response amplitude / excitation amplitude
+        float phase;        // [rad] phase of the response relative to the excitation
+    };
+
+    /**
+     * @brief Starts a measurement with the current parameters.
+     * @param dt: Time between two calls to step() [s]
+     * @returns false if the parameters are invalid.
+     */
+    bool start(float dt) {
+        if (!(f_min > 0.0f) || !(f_max >= f_min) || !(f_max * dt <= 0.25f)
+                || n_points < 1 || n_points > MAX_POINTS || !(std::abs(amplitude) > 0.0f)
+                || !(measure_periods >= 1.0f) || !(settle_periods >= 0.0f)) {
+            return false;
+        }
+        dt_ = dt;
+        n_done = 0;
+        active = true;
+        start_point();
+        return true;
+    }
+
+    void stop() {
+        active = false;
+    }
+
+    /**
+     * @brief Records the response to the previous excitation sample and
+     * returns the next one.
+     * @param sin_cos: Callable with the signature of our_arm_sin_cos_f32().
+     */
+    template<typename TSinCos>
+    float step(float response, TSinCos sin_cos) {
+        if (!active) {
+            return 0.0f;
+        }
+
+        if (period_ >= (uint32_t)settle_periods) {
+            x_re_ += excitation_ * cos_;
+            x_im_ -= excitation_ * sin_;
+            y_re_ += response * cos_;
+            y_im_ -= response * sin_;
+        }
+
+        phase_ += frequency_ * dt_;
+        if (phase_ >= 1.0f) {
+            phase_ -= 1.0f;
+            if (++period_ >= (uint32_t)settle_periods + (uint32_t)measure_periods) {
+                finish_point();
+                if (!active) {
+                    return 0.0f;
+                }
+            }
+        }
+
+        sin_cos(2.0f * (float)M_PI * phase_, &sin_, &cos_);
+        excitation_ = amplitude * sin_;
+        return excitation_;
+    }
+
+    // Parameters
+    float f_min = 1.0f;             // [Hz]
+    float f_max = 100.0f;           // [Hz]
+    uint32_t n_points = 16;
+    float amplitude = 0.0f;         // in the unit of the setpoint it is added to
+    float settle_periods = 3.0f;
+    float measure_periods = 5.0f;
+
+    // State
+    bool active = false;
+    uint32_t n_done = 0;            // number of valid entries in points_
+    Point_t points_[MAX_POINTS] = {};
+
+private:
+    void start_point() {
+        float ratio = (n_points > 1) ? (float)n_done / (float)(n_points - 1) : 0.0f;
+        frequency_ = f_min * std::pow(f_max / f_min, ratio);
+        phase_ = 0.0f;
+        period_ = 0;
+        x_re_ = x_im_ = y_re_ = y_im_ = 0.0f;
+        sin_ = 0.0f;
+        cos_ = 1.0f;
+        excitation_ = 0.0f;
+    }
+
+    void finish_point() {
+        // Y / X
+        float x_sq = x_re_ * x_re_ + x_im_ * x_im_;
+        float h_re = (y_re_ * x_re_ + y_im_ * x_im_) / x_sq;
+        float h_im = (y_im_ * x_re_ - y_re_ * x_im_) / x_sq;
+        points_[n_done] = {frequency_, std::sqrt(h_re * h_re + h_im * h_im), std::atan2(h_im, h_re)};
+        if (++n_done >= n_points) {
+            active = false;
+        } else {
+            start_point();
+        }
+    }
+
+    float dt_ = 0.0f;
+    float frequency_ = 0.0f;
+    float phase_ = 0.0f;            // [turn] of the excitation
+    uint32_t period_ = 0;           // periods completed at the current frequency
+    float sin_ = 0.0f;
+    float cos_ = 1.0f;
+    float excitation_ = 0.0f;
+    float x_re_ = 0.0f, x_im_ = 0.0f;
+    float y_re_ = 0.0f, y_im_ = 0.0f;
+};
+
+#endif // __FREQ_RESPONSE_HPP
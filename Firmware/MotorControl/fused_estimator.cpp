@@ -0,0 +1,92 @@
+
+#include "odrive_main.h"
+
+void FusedEstimator::start() {
+    fallback_active_ = false;
+    weight_ = 0.0f;
+    pos_ = axis_->encoder_.pos_estimate_.any().value_or(0.0f);
+    pos_circular_state_ = axis_->encoder_.pos_circular_.any().value_or(0.0f);
+    active_ = true;
+}
+
+void FusedEstimator::stop() {
+    active_ = false;
+    fallback_active_ = false;
+}
+
+// @brief True if an encoder error should not fail the axis because the
+// sensorless estimator can take over.
+bool FusedEstimator::can_take_over() const {
+    return active_ && config_.enable_fallback
+        && axis_->sensorless_estimator_.error_ == SensorlessEstimator::ERROR_NONE
+        && std::abs(sensorless_vel_) >= config_.vel_low;
+}
+
+bool FusedEstimator::update() {
+    if (!active_) {
+        return true;
+    }
+
+    Encoder& encoder = axis_->encoder_;
+    SensorlessEstimator& sensorless = axis_->sensorless_estimator_;
+
+    std::optional<float> enc_phase = encoder.phase_.present();
+    std::optional<float> enc_phase_vel = encoder.phase_vel_.present();
+    std::optional<float> enc_vel = encoder.vel_estimate_.present();
+    std::optional<float> enc_pos = encoder.pos_estimate_.present();
+    std::optional<float> enc_pos_circular = encoder.pos_circular_.present();
+    std::optional<float> sl_phase_vel = sensorless.phase_vel_.present();
+    std::optional<float> sl_vel = sensorless.vel_estimate_.present();
+
+    // The observer estimates the electrical rotation while the encoder
+    // velocity is in the direction of the encoder counts.
+    bool sensorless_ok = sensorless.error_ == SensorlessEstimator::ERROR_NONE
+                      && sl_phase_vel.has_value() && sl_vel.has_value();
+    sensorless_vel_ = sensorless_ok ? (float)encoder.config_.direction * *sl_vel : 0.0f;
+
+    bool encoder_ok = !fallback_active_ && encoder.error_ == Encoder::ERROR_NONE
+                   && enc_phase.has_value() && enc_phase_vel.has_value()
+                   && enc_vel.has_value() && enc_pos.has_value() && enc_pos_circular.has_value();
+
+    if (!encoder_ok) {
+        if (!can_take_over()) {
+            // Encoder::set_error() didn't fail the axis while we could take over
+            stop();
+            axis_->error_ |= Axis::ERROR_ENCODER_FAILED;
+            return false;
+        }
+        fallback_active_ = true;
+        weight_ = 1.0f;
+        pos_ += current_meas_period * sensorless_vel_;
+        pos_circular_state_ = fmodf_pos(pos_circular_state_ + current_meas_period * sensorless_vel_,
+                                        axis_->controller_.config_.circular_setpoint_range);
+
+        phase_ = sensorless.pll_pos_;
+        phase_vel_ = *sl_phase_vel;
+        vel_estimate_ = sensorless_vel_;
+        pos_estimate_ = pos_;
+        pos_circular_ = pos_circular_state_;
+        return true;
+    }
+
+    float abs_vel = std::abs(*enc_vel);
+    float span = config_.vel_high - config_.vel_low;
+    float weight;
+    if (!sensorless_ok)
+        weight = 0.0f;
+    else if (span > 0.0f)
+        weight = std::clamp((abs_vel - config_.vel_low) / span, 0.0f, 1.0f);
+    else
+        weight = (abs_vel >= config_.vel_high) ? 1.0f : 0.0f;
+    weight_ = weight;
+
+    pos_ = *enc_pos;
+    pos_circular_state_ = *enc_pos_circular;
+
+    phase_ = wrap_pm_pi(*enc_phase + weight * wrap_pm_pi(sensorless.pll_pos_ - *enc_phase));
+    phase_vel_ = *enc_phase_vel + weight * (sl_phase_vel.value_or(*enc_phase_vel) - *enc_phase_vel);
+    vel_estimate_ = *enc_vel + weight * (sensorless_vel_ - *enc_vel);
+    pos_estimate_ = pos_;
+    pos_circular_ = pos_circular_state_;
+    return true;
+}
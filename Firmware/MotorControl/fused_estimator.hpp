@@ -0,0 +1,51 @@
+#ifndef __FUSED_ESTIMATOR_HPP
+#define __FUSED_ESTIMATOR_HPP
+
+class Axis;
+
+#include <component.hpp>
+#include <autogen/interfaces.hpp>
+
+/**
+ * @brief Blends the encoder with the sensorless estimator as a function of
+ * speed.
+ *
+ * Below config_.vel_low the encoder is used alone. Above config_.vel_high the
+ * flux observer is used alone, which avoids the quantization of low CPR
+ * encoders at high speed. In between the estimates are mixed linearly.
+ *
+ * If the encoder fails while the observer is trustworthy the estimator
+ * continues on the observer alone until the axis leaves closed loop control or
+ * slows down below vel_low.
+ */
+class FusedEstimator : public ODriveIntf::FusedEstimatorIntf {
+public:
+    struct Config_t {
+        float vel_low = 20.0f;  // [turn/s] encoder only below this speed
+        float vel_high = 40.0f; // [turn/s] sensorless only above this speed
+        bool enable_fallback = true;
+    };
+
+    void start();
+    void stop();
+    bool update();
+    bool can_take_over() const;
+
+    Axis* axis_ = nullptr; // set by Axis constructor
+    Config_t config_;
+
+    bool active_ = false;
+    bool fallback_active_ = false;
+    float weight_ = 0.0f; // 0: encoder, 1: sensorless
+    float sensorless_vel_ = 0.0f; // [turn/s] in the direction of the encoder
+    float pos_ = 0.0f; // [turn]
+    float pos_circular_state_ = 0.0f; // [turn]
+
+    OutputPort<float> phase_ = 0.0f;            // [rad]
+    OutputPort<float> phase_vel_ = 0.0f;        // [rad/s]
+    OutputPort<float> vel_estimate_ = 0.0f;     // [turn/s]
+    OutputPort<float> pos_estimate_ = 0.0f;     // [turn]
+    OutputPort<float> pos_circular_ = 0.0f;     // [turn]
+};
+
+#endif // __FUSED_ESTIMATOR_HPP
@@ -0,0 +1,191 @@
+#ifndef __HALL_CALIBRATION_HPP
+#define __HALL_CALIBRATION_HPP
+
+#include <stdint.h>
+#include <array>
+#include <bitset>
+#include "utils.hpp"
+
+// Position of a hall state in the sequence of a 120 degree arrangement, in
+// [0, 6).
+inline bool decode_hall(uint8_t hall_state, int32_t* hall_cnt) {
+    switch (hall_state) {
+        case 0b001: *hall_cnt = 0; return true;
+        case 0b011: *hall_cnt = 1; return true;
+        case 0b010: *hall_cnt = 2; return true;
+        case 0b110: *hall_cnt = 3; return true;
+        case 0b100: *hall_cnt = 4; return true;
+        case 0b101: *hall_cnt = 5; return true;
+        default: return false;
+    }
+}
+
+/**
+ * @brief Finds the polarity and the edge phases of hall sensors from one
+ * lockin spin.
+ *
+ * The polarity is only known once all states were seen, so the edges are
+ * recorded by the raw states on either side. An edge flips one sensor, the
+ * other two sensors pick one of four slots for each of the three sensors.
+ * Inverting sensors doesn't change which one flips, so once the polarity is
+ * known, each slot maps to one of the six edges of the sequence.
+ */
+class HallCalibration {
+public:
+    enum Result_t {
+        kOk,
+        kIllegalState, // the states don't form a 120 or 60 degree sequence
+        kEdgesInconsistent // an edge is missing or out of order
+    };
+
+    void reset() {
+        state_count_.fill(0);
+        edge_count_.fill(0);
+        edge_phase_.fill(0.0f);
+        has_last_state_ = false;
+    }
+
+    /**
+     * @brief Adds the hall state of one control loop iteration.
+     * @param edge_phase: Electrical phase of the lockin at the time the state
+     *        changed [rad]. Only used if it changed since the last sample.
+     * @returns false if more than one sensor changed since the last sample.
+     */
+    bool add_sample(uint8_t state, float edge_phase) {
+        state &= 0b111;
+        state_count_[state]++;
+        uint8_t last_state = last_state_;
+        bool has_last_state = has_last_state_;
+        last_state_ = state;
+        has_last_state_ = true;
+
+        uint8_t flipped = state ^ last_state;
+        if (!has_last_state || !flipped) {
+            return true;
+        }
+        if (flipped & (flipped - 1)) {
+            return false;
+        }
+
+        // Circularly wrapped recursive average
+        size_t slot = edge_slot(state, flipped);
+        int n = ++edge_count_[slot];
+        float& phase = edge_phase_[slot];
+        phase = (n == 1) ? edge_phase : wrap_pm_pi(phase + wrap_pm_pi(edge_phase - phase) / (float)n);
+        return true;
+    }
+
+    /**
+     * @brief Finds the polarity that turns the states into those of a 120
+     * degree arrangement. A 60 degree arrangement is converted to 120 degrees
+     * by flipping the polarity of one sensor.
+     */
+    Result_t get_polarity(uint8_t* polarity) const {
+        // States that were only seen a few times are noise
+        std::bitset<8> state_seen;
+        std::bitset<8> state_confirmed;
+        for (size_t i = 0; i < 8; i++) {
+            state_seen[i] = state_count_[i] > 0;
+            state_confirmed[i] = state_count_[i] > kMinStateCount;
+        }
+        if (state_seen != state_confirmed) {
+            return kIllegalState;
+        }
+
+        // Out of 8 possible states, 120 and 60 deg arrangements each miss 2 states
+        uint8_t missing = ~(uint8_t)state_seen.to_ulong();
+        auto flip_detect = [missing](unsigned int idx) {
+            return missing == (1 << (0 + idx) | 1 << (7 - idx));
+        };
+        if (flip_detect(0)) {
+            *polarity = 0b000;
+        } else if (flip_detect(1)) {
+            *polarity = 0b001;
+        } else if (flip_detect(2)) {
+            *polarity = 0b010;
+        } else if (flip_detect(3)) {
+            *polarity = 0b100;
+        } else {
+            return kIllegalState;
+        }
+        return kOk;
+    }
+
+    /**
+     * @brief Finds the polarity (see get_polarity()) and the phase of each of
+     * the six edges relative to the first one, in counts ([0, 6)).
+     * @param direction: Set to -1 if the hall count went down while the lockin
+     *        phase went up, 1 otherwise.
+     */
+    Result_t get_edges(uint8_t* polarity, std::array<float, 6>* edge_phcnt, int32_t* direction) const {
+        Result_t result = get_polarity(polarity);
+        if (result != kOk) {
+            return result;
+        }
+
+        // An edge is named after the count on its upper side
+        std::array<float, 6> phases;
+        std::array<int, 6> counts = {};
+        for (size_t slot = 0; slot < kNumSlots; slot++) {
+            uint8_t flipped = 1 << (slot / 4);
+            uint8_t low = (uint8_t)(((slot % 4) & (flipped - 1)) | (((slot % 4) & ~(flipped - 1)) << 1));
+            int32_t a, b;
+            if (!edge_count_[slot] || !decode_hall(low ^ *polarity, &a) || !decode_hall((low | flipped) ^ *polarity, &b)) {
+                continue;
+            }
+            size_t edge = (mod(b - a, 6) == 1) ? b : a;
+            phases[edge] = edge_phase_[slot];
+            counts[edge] = edge_count_[slot];
+        }
+        for (int count : counts) {
+            if (count < kMinEdgeCount) {
+                return kEdgesInconsistent;
+            }
+        }
+
+        // Check deltas to discern rotation direction
+        float delta_phase = 0.0f;
+        for (size_t i = 0; i < 6; i++) {
+            delta_phase += wrap_pm_pi(phases[(i + 1) % 6] - phases[i]);
+        }
+        *direction = (delta_phase < 0.0f) ? -1 : 1;
+
+        // Each edge must follow the previous one by roughly a sixth of a turn
+        for (size_t i = 0; i < 6; i++) {
+            float gap = (float)*direction * wrap_pm_pi(phases[(i + 1) % 6] - phases[i]);
+            if (gap <= 0.0f || gap >= kMaxEdgeGap) {
+                return kEdgesInconsistent;
+            }
+        }
+
+        // Normalize edge timing to 1st edge in sequence, and change units to counts
+        for (size_t i = 0; i < 6; i++) {
+            float phase = (float)*direction * (phases[i] - phases[0]);
+            (*edge_phcnt)[i] = fmodf_pos((6.0f / (2.0f * M_PI)) * phase, 6.0f);
+        }
+        return kOk;
+    }
+
+private:
+    static constexpr size_t kNumSlots = 12;
+    static constexpr int kMinStateCount = 50; // [samples]
+    static constexpr int kMinEdgeCount = 3;
+    static constexpr float kMaxEdgeGap = 2.0f * M_PI / 3.0f; // [rad] twice the nominal gap
+
+    // Slot of the edge between `state` and `state ^ flipped`
+    static size_t edge_slot(uint8_t state, uint8_t flipped) {
+        uint8_t others = state & ~flipped;
+        uint8_t below = others & (flipped - 1);
+        uint8_t above = (others & ~(flipped - 1)) >> 1;
+        size_t bit = (flipped == 0b001) ? 0 : (flipped == 0b010) ? 1 : 2;
+        return bit * 4 + (below | above);
+    }
+
+    std::array<int, 8> state_count_ = {};
+    std::array<int, kNumSlots> edge_count_ = {};
+    std::array<float, kNumSlots> edge_phase_ = {};
+    uint8_t last_state_ = 0;
+    bool has_last_state_ = false;
+};
+
+#endif // __HALL_CALIBRATION_HPP
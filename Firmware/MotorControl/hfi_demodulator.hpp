@@ -0,0 +1,93 @@
+#ifndef __HFI_DEMODULATOR_HPP
+#define __HFI_DEMODULATOR_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <cmath>
+
+/**
+ * @brief Extracts the rotor angle error from the response of a salient motor
+ * to a square wave voltage on the estimated d-axis.
+ *
+ * The second difference of the current removes the fundamental of the
+ * current, which changes slowly compared to the injection, and leaves
+ * T * L^-1 * (change of the applied voltage). In the estimated frame the
+ * inverse inductance is
+ *   sum * I + diff * [cos(2 err), sin(2 err); sin(2 err), -cos(2 err)]
+ * with sum = (1/Ld + 1/Lq) / 2 and diff = (1/Ld - 1/Lq) / 2, so a voltage
+ * change on the estimated d-axis moves the q-axis current proportional to
+ * sin(2 err). Normalized by the expected gain the error signal is
+ * sin(2 err) / 2, i.e. the angle error for small errors. Like any saliency
+ * based method it doesn't distinguish the north from the south pole.
+ *
+ * The d-axis response over the voltage change is the incremental admittance,
+ * which is higher when a d-axis current saturates the magnet path. This is
+ * used to resolve the polarity.
+ */
+class HfiDemodulator {
+public:
+    struct Output_t {
+        float angle_error;  // [rad] sin(2 err) / 2 where err = rotor - estimated angle
+        float admittance;   // [A/V] d-axis current change per d-axis voltage change
+    };
+
+    void reset() {
+        n_history_ = 0;
+    }
+
+    /**
+     * @param Ialpha, Ibeta: Current measurement [A]
+     * @param Valpha, Vbeta: Voltage applied since the previous measurement [V]
+     * @param phase: Estimated electrical angle [rad]
+     * @param inv_L_diff: (1/Ld - 1/Lq) / 2 [1/H], must not be zero
+     * @param min_dv: Changes of the d-axis voltage below this are not
+     *        demodulated, e.g. while the injection is faded out [V]
+     * @returns false if there is no output for this sample
+     */
+    bool update(float Ialpha, float Ibeta, float Valpha, float Vbeta,
+            float phase, float inv_L_diff, float min_dv, float dt, Output_t* out) {
+        float dIalpha = Ialpha - Ialpha_;
+        float dIbeta = Ibeta - Ibeta_;
+        float d2Ialpha = dIalpha - dIalpha_;
+        float d2Ibeta = dIbeta - dIbeta_;
+        float dValpha = Valpha - Valpha_;
+        float dVbeta = Vbeta - Vbeta_;
+
+        Ialpha_ = Ialpha;
+        Ibeta_ = Ibeta;
+        dIalpha_ = dIalpha;
+        dIbeta_ = dIbeta;
+        Valpha_ = Valpha;
+        Vbeta_ = Vbeta;
+
+        // The second difference needs three measurements
+        if (n_history_ < 3) {
+            ++n_history_;
+            return false;
+        }
+
+        float c = std::cos(phase);
+        float s = std::sin(phase);
+        float dVd = c * dValpha + s * dVbeta;
+        if (!(std::abs(dVd) >= min_dv)) {
+            return false;
+        }
+        float d2Id = c * d2Ialpha + s * d2Ibeta;
+        float d2Iq = c * d2Ibeta - s * d2Ialpha;
+
+        out->angle_error = d2Iq / (2.0f * dt * inv_L_diff * dVd);
+        out->admittance = d2Id / dVd;
+        return std::isfinite(out->angle_error);
+    }
+
+private:
+    uint32_t n_history_ = 0;
+    float Ialpha_ = 0.0f;
+    float Ibeta_ = 0.0f;
+    float dIalpha_ = 0.0f;
+    float dIbeta_ = 0.0f;
+    float Valpha_ = 0.0f;
+    float Vbeta_ = 0.0f;
+};
+
+#endif // __HFI_DEMODULATOR_HPP
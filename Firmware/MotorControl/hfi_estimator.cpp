@@ -0,0 +1,175 @@
+
+#include "odrive_main.h"
+
+bool HfiEstimator::start() {
+    const Motor::Config_t& motor_config = axis_->motor_.config_;
+    float Ld = motor_config.phase_inductance;
+    float Lq = Ld - motor_config.saliency_inductance;
+    if (!(Ld > 0.0f) || !(Lq > 0.0f) || !(motor_config.saliency_inductance != 0.0f)) {
+        set_error(ERROR_INVALID_SALIENCY);
+        return false;
+    }
+    if (motor_config.motor_type != Motor::MOTOR_TYPE_HIGH_CURRENT) {
+        set_error(ERROR_INVALID_MOTOR_TYPE);
+        return false;
+    }
+
+    demodulator_.reset();
+    Valpha_beta_memory_[0] = 0.0f;
+    Valpha_beta_memory_[1] = 0.0f;
+    injection_sign_ = 1.0f;
+    injection_voltage_ = 0.0f;
+    pll_pos_ = 0.0f;
+    pll_vel_ = 0.0f;
+    angle_error_ = 0.0f;
+    admittance_pos_ = 0.0f;
+    admittance_neg_ = 0.0f;
+    weight_ = 0.0f;
+    pos_ = 0.0f;
+    pos_circular_state_ = 0.0f;
+    last_phase_ = 0.0f;
+    state_ = STATE_CONVERGING;
+    state_time_ = 0.0f;
+    admittance_sum_ = 0.0f;
+    admittance_count_ = 0;
+    active_ = true;
+    return true;
+}
+
+void HfiEstimator::stop() {
+    active_ = false;
+    injection_voltage_ = 0.0f;
+}
+
+void HfiEstimator::set_error(Error error) {
+    error_ |= error;
+    axis_->error_ |= Axis::ERROR_SENSORLESS_ESTIMATOR_FAILED;
+    stop();
+}
+
+bool HfiEstimator::update() {
+    if (!active_) {
+        return true;
+    }
+
+    float pll_kp = 2.0f * config_.pll_bandwidth;
+    float pll_ki = 0.25f * (pll_kp * pll_kp);
+    if (!(current_meas_period * pll_kp < 1.0f)) {
+        set_error(ERROR_UNSTABLE_GAIN);
+        return false;
+    }
+
+    Motor& motor = axis_->motor_;
+    Motor::Sample_t sample = motor.sample_.read();
+    if (!sample.current_meas.has_value()) {
+        set_error(ERROR_UNKNOWN_CURRENT_MEASUREMENT);
+        return false;
+    }
+
+    // Like in the flux observer, the voltage that drove the current up to
+    // this measurement is the one reported with the previous measurement.
+    float Ialpha = sample.current_meas->phA;
+    float Ibeta = one_by_sqrt3 * (sample.current_meas->phB - sample.current_meas->phC);
+    float Ld = motor.phase_inductance_;
+    float Lq = Ld - motor.config_.saliency_inductance;
+    float inv_L_diff = 0.5f * (1.0f / Ld - 1.0f / Lq);
+    float injection = (1.0f - weight_) * config_.injection_voltage;
+    HfiDemodulator::Output_t demod;
+    bool demod_valid = demodulator_.update(Ialpha, Ibeta,
+            Valpha_beta_memory_[0], Valpha_beta_memory_[1], pll_pos_,
+            inv_L_diff, injection, current_meas_period, &demod)
+            && injection > 0.0f;
+    Valpha_beta_memory_[0] = sample.final_v_alpha;
+    Valpha_beta_memory_[1] = sample.final_v_beta;
+
+    angle_error_ = demod_valid ? std::clamp(demod.angle_error, -0.5f, 0.5f) : 0.0f;
+    pll_pos_ = wrap_pm_pi(pll_pos_ + current_meas_period * (pll_vel_ + pll_kp * angle_error_));
+    pll_vel_ += current_meas_period * pll_ki * angle_error_;
+
+    // Startup: converge, then test the polarity with a positive and a
+    // negative d-axis current. The second half of each pulse is averaged.
+    float Id = 0.0f;
+    state_time_ += current_meas_period;
+    if (state_ == STATE_CONVERGING) {
+        if (state_time_ >= config_.convergence_time) {
+            state_ = STATE_POLARITY_POSITIVE;
+            state_time_ = 0.0f;
+        }
+    } else if (state_ == STATE_POLARITY_POSITIVE || state_ == STATE_POLARITY_NEGATIVE) {
+        bool positive = state_ == STATE_POLARITY_POSITIVE;
+        Id = positive ? config_.polarity_current : -config_.polarity_current;
+        if (demod_valid && state_time_ >= 0.5f * config_.polarity_pulse_time) {
+            admittance_sum_ += demod.admittance;
+            admittance_count_++;
+        }
+        if (state_time_ >= config_.polarity_pulse_time) {
+            float admittance = admittance_count_ ? admittance_sum_ / (float)admittance_count_ : 0.0f;
+            admittance_sum_ = 0.0f;
+            admittance_count_ = 0;
+            state_time_ = 0.0f;
+            if (positive) {
+                admittance_pos_ = admittance;
+                state_ = STATE_POLARITY_NEGATIVE;
+            } else {
+                admittance_neg_ = admittance;
+                // A current along the magnet saturates the d-axis, so the
+                // response is larger in the direction of the north pole.
+                if (admittance_neg_ > admittance_pos_) {
+                    pll_pos_ = wrap_pm_pi(pll_pos_ + M_PI);
+                }
+                last_phase_ = pll_pos_;
+                state_ = STATE_RUNNING;
+            }
+        }
+    }
+
+    // Hand over to the flux observer with speed
+    SensorlessEstimator& sensorless = axis_->sensorless_estimator_;
+    std::optional<float> sl_phase_vel = sensorless.phase_vel_.present();
+    bool sensorless_ok = state_ == STATE_RUNNING
+                      && sensorless.error_ == SensorlessEstimator::ERROR_NONE
+                      && sl_phase_vel.has_value();
+    float pole_pairs = std::max((float)motor.config_.pole_pairs, 1.0f);
+    float abs_vel = std::abs(pll_vel_) / (2.0f * M_PI * pole_pairs);
+    if (weight_ >= 1.0f && sensorless_ok) {
+        // Without injection the HFI PLL follows the observer
+        pll_pos_ = sensorless.pll_pos_;
+        pll_vel_ = *sl_phase_vel;
+        abs_vel = std::abs(pll_vel_) / (2.0f * M_PI * pole_pairs);
+    }
+    float span = config_.vel_high - config_.vel_low;
+    if (!sensorless_ok)
+        weight_ = 0.0f;
+    else if (span > 0.0f)
+        weight_ = std::clamp((abs_vel - config_.vel_low) / span, 0.0f, 1.0f);
+    else
+        weight_ = (abs_vel >= config_.vel_high) ? 1.0f : 0.0f;
+
+    float phase = pll_pos_;
+    float phase_vel = pll_vel_;
+    if (sensorless_ok) {
+        phase = wrap_pm_pi(phase + weight_ * wrap_pm_pi(sensorless.pll_pos_ - phase));
+        phase_vel += weight_ * (*sl_phase_vel - phase_vel);
+    }
+
+    // The position is tracked from the end of the startup
+    if (state_ == STATE_RUNNING) {
+        float delta_pos = wrap_pm_pi(phase - last_phase_) / (2.0f * M_PI * pole_pairs);
+        pos_ += delta_pos;
+        pos_circular_state_ = fmodf_pos(pos_circular_state_ + delta_pos,
+                                        axis_->controller_.config_.circular_setpoint_range);
+    }
+    last_phase_ = phase;
+
+    injection_sign_ = -injection_sign_;
+    injection_voltage_ = injection_sign_ * (1.0f - weight_) * config_.injection_voltage;
+
+    phase_ = phase;
+    phase_vel_ = phase_vel;
+    vel_estimate_ = phase_vel / (2.0f * M_PI * pole_pairs);
+    pos_estimate_ = pos_;
+    pos_circular_ = pos_circular_state_;
+    Idq_setpoint_ = {Id, 0.0f};
+    Vdq_setpoint_ = {injection_voltage_, 0.0f};
+    return true;
+}
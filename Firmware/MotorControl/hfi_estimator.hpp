@@ -0,0 +1,80 @@
+#ifndef __HFI_ESTIMATOR_HPP
+#define __HFI_ESTIMATOR_HPP
+
+class Axis;
+
+#include <component.hpp>
+#include <autogen/interfaces.hpp>
+#include "hfi_demodulator.hpp"
+
+/**
+ * @brief Sensorless rotor angle estimator based on high frequency injection
+ * for salient motors, which works down to standstill.
+ *
+ * A square wave of config_.injection_voltage on the estimated d-axis is
+ * added to the FOC voltage feedforward, toggling every control loop
+ * iteration. A PLL drives the demodulated angle error to zero.
+ *
+ * On start() the estimator first converges, then resolves the pole polarity
+ * by comparing the response during a positive and a negative d-axis current
+ * pulse. During this startup it commands the currents itself, like the open
+ * loop controller during a lock-in spin.
+ *
+ * Between config_.vel_low and config_.vel_high the estimate is blended with
+ * the sensorless flux observer and the injection is faded out. Above
+ * vel_high the flux observer is used alone.
+ */
+class HfiEstimator : public ODriveIntf::HfiEstimatorIntf {
+public:
+    struct Config_t {
+        float injection_voltage = 2.0f;     // [V]
+        float pll_bandwidth = 200.0f;       // [rad/s]
+        float convergence_time = 0.1f;      // [s]
+        float polarity_current = 10.0f;     // [A]
+        float polarity_pulse_time = 0.02f;  // [s] per direction
+        float vel_low = 2.0f;               // [turn/s] HFI only below this speed
+        float vel_high = 4.0f;              // [turn/s] flux observer only above this speed
+    };
+
+    bool start();
+    void stop();
+    bool update();
+    bool startup_done() const { return active_ && state_ == STATE_RUNNING; }
+
+    Axis* axis_ = nullptr; // set by Axis constructor
+    Config_t config_;
+
+    Error error_ = ERROR_NONE;
+    bool active_ = false;
+    State state_ = STATE_CONVERGING;
+    float pll_pos_ = 0.0f;              // [rad]
+    float pll_vel_ = 0.0f;              // [rad/s]
+    float angle_error_ = 0.0f;          // [rad] last demodulated angle error
+    float admittance_pos_ = 0.0f;       // [A/V] average response during the positive polarity pulse
+    float admittance_neg_ = 0.0f;       // [A/V] average response during the negative polarity pulse
+    float weight_ = 0.0f;               // 0: HFI, 1: flux observer
+    float injection_voltage_ = 0.0f;    // [V] d-axis injection of the next PWM period, added by the motor
+    float pos_ = 0.0f;                  // [turn] relative to the start
+    float pos_circular_state_ = 0.0f;   // [turn]
+
+    OutputPort<float> phase_ = 0.0f;            // [rad]
+    OutputPort<float> phase_vel_ = 0.0f;        // [rad/s]
+    OutputPort<float> vel_estimate_ = 0.0f;     // [turn/s]
+    OutputPort<float> pos_estimate_ = 0.0f;     // [turn]
+    OutputPort<float> pos_circular_ = 0.0f;     // [turn]
+    OutputPort<float2D> Idq_setpoint_ = {{0.0f, 0.0f}}; // [A] only used during startup
+    OutputPort<float2D> Vdq_setpoint_ = {{0.0f, 0.0f}}; // [V] only used during startup
+
+private:
+    void set_error(Error error);
+
+    HfiDemodulator demodulator_;
+    float Valpha_beta_memory_[2] = {0.0f, 0.0f}; // [V]
+    float injection_sign_ = 1.0f;
+    float state_time_ = 0.0f;           // [s]
+    float admittance_sum_ = 0.0f;       // [A/V]
+    uint32_t admittance_count_ = 0;
+    float last_phase_ = 0.0f;           // [rad]
+};
+
+#endif // __HFI_ESTIMATOR_HPP
@@ -0,0 +1,153 @@
+#ifndef __INPUT_SHAPER_HPP
+#define __INPUT_SHAPER_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <algorithm>
+#include <cmath>
+
+/**
+ * @brief Convolves a setpoint stream with a zero vibration (ZV) or zero
+ * vibration and derivative (ZVD) impulse train.
+ *
+ * The impulses are spaced by half the damped period of the resonance, so the
+ * vibration excited by one impulse is cancelled by the next. ZVD has a third
+ * impulse and is less sensitive to errors in the frequency, at the cost of a
+ * delay of a whole damped period instead of half a period.
+ *
+ * The history is decimated such that the longest delay fits into N_SLOTS
+ * entries and delayed values are interpolated linearly between the entries.
+ */
+class InputShaper {
+public:
+    static constexpr size_t N_SLOTS = 256;
+    static constexpr size_t MAX_IMPULSES = 3;
+
+    struct Sample_t {
+        float pos;
+        float vel;
+        float torque;
+    };
+
+    void disable() {
+        n_impulses_ = 0;
+    }
+
+    // @brief Configures a ZV (n_impulses = 2) or ZVD (n_impulses = 3) shaper.
+    // Returns false if the parameters are invalid, in which case the shaper is
+    // disabled.
+    bool configure(size_t n_impulses, float frequency, float damping, float dt) {
+        n_impulses_ = 0;
+        if ((n_impulses != 2 && n_impulses != 3) || !(frequency > 0.0f) || !(dt > 0.0f)
+                || !(damping >= 0.0f) || !(damping < 1.0f)) {
+            return false;
+        }
+
+        float sqrt_1_zeta2 = std::sqrt(1.0f - damping * damping);
+        float K = std::exp(-damping * (float)M_PI / sqrt_1_zeta2);
+        float half_period = 0.5f / (frequency * sqrt_1_zeta2); // [s]
+        if (n_impulses == 2) {
+            amplitudes_[0] = 1.0f / (1.0f + K);
+            amplitudes_[1] = K / (1.0f + K);
+        } else {
+            float norm = 1.0f / ((1.0f + K) * (1.0f + K));
+            amplitudes_[0] = norm;
+            amplitudes_[1] = 2.0f * K * norm;
+            amplitudes_[2] = K * K * norm;
+        }
+        for (size_t i = 0; i < n_impulses; ++i) {
+            delays_[i] = (float)i * half_period / dt;
+        }
+
+        // The newest entry can be up to decimation_ - 1 cycles old and the
+        // interpolation needs the entry after the longest delay
+        float max_delay = delays_[n_impulses - 1];
+        decimation_ = std::max<uint32_t>(1, (uint32_t)std::ceil(max_delay / (float)(N_SLOTS - 2)));
+        n_impulses_ = n_impulses;
+        return true;
+    }
+
+    bool enabled() const {
+        return n_impulses_ > 0;
+    }
+
+    // @brief Duration of the impulse train [s]
+    float duration(float dt) const {
+        return n_impulses_ ? delays_[n_impulses_ - 1] * dt : 0.0f;
+    }
+
+    // @brief Fills the history with a constant input
+    void reset(const Sample_t& sample) {
+        for (Sample_t& slot : slots_) {
+            slot = sample;
+        }
+        newest_ = 0;
+        phase_ = 0;
+    }
+
+    // @brief Moves the origin of the positions by offset. The output doesn't
+    // change if the input is moved by the same offset.
+    void shift(float offset) {
+        for (Sample_t& slot : slots_) {
+            slot.pos -= offset;
+        }
+    }
+
+    // @brief Takes the input of this cycle and returns the shaped output.
+    // Must be called once per control loop cycle.
+    Sample_t shape(const Sample_t& input) {
+        if (!n_impulses_) {
+            return input;
+        }
+
+        if (++phase_ >= decimation_) {
+            phase_ = 0;
+            newest_ = (newest_ + 1) % N_SLOTS;
+            slots_[newest_] = input;
+        }
+
+        Sample_t out = {0.0f, 0.0f, 0.0f};
+        for (size_t i = 0; i < n_impulses_; ++i) {
+            Sample_t delayed = delayed_sample(input, delays_[i]);
+            out.pos += amplitudes_[i] * delayed.pos;
+            out.vel += amplitudes_[i] * delayed.vel;
+            out.torque += amplitudes_[i] * delayed.torque;
+        }
+        return out;
+    }
+
+private:
+    // @brief The input `delay` cycles ago
+    Sample_t delayed_sample(const Sample_t& input, float delay) const {
+        const Sample_t* a;
+        const Sample_t* b;
+        float frac;
+        if (delay <= (float)phase_) {
+            // Between the current input and the newest entry
+            a = &input;
+            b = &slots_[newest_];
+            frac = phase_ ? delay / (float)phase_ : 0.0f;
+        } else {
+            float k = (delay - (float)phase_) / (float)decimation_;
+            size_t i = std::min((size_t)k, N_SLOTS - 2);
+            frac = k - (float)i;
+            a = &slots_[(newest_ + N_SLOTS - i) % N_SLOTS];
+            b = &slots_[(newest_ + N_SLOTS - i - 1) % N_SLOTS];
+        }
+        return {
+            a->pos + frac * (b->pos - a->pos),
+            a->vel + frac * (b->vel - a->vel),
+            a->torque + frac * (b->torque - a->torque)
+        };
+    }
+
+    size_t n_impulses_ = 0;
+    float amplitudes_[MAX_IMPULSES] = {};
+    float delays_[MAX_IMPULSES] = {};   // [cycles]
+    uint32_t decimation_ = 1;           // cycles per history entry
+    uint32_t phase_ = 0;                // cycles since the newest entry
+    size_t newest_ = 0;
+    Sample_t slots_[N_SLOTS] = {};
+};
+
+#endif // __INPUT_SHAPER_HPP
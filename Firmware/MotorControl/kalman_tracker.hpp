@@ -0,0 +1,119 @@
+#ifndef __KALMAN_TRACKER_HPP
+#define __KALMAN_TRACKER_HPP
+
+#include <stddef.h>
+#include <cmath>
+
+/**
+ * @brief Steady-state gains of a Kalman filter that tracks position, velocity
+ * and load acceleration from a position measurement and a known acceleration
+ * input.
+ *
+ * Model, with the acceleration u from the torque command and the unknown load
+ * acceleration a following a random walk:
+ *
+ *   pos' = pos + dt * vel + dt^2 / 2 * (u + a)
+ *   vel' = vel + dt * (u + a)
+ *   a'   = a + w,  w: white jerk noise of density accel_noise^2
+ *   z    = pos + v, v: white noise of variance meas_noise^2
+ *
+ * The error covariance converges to the same value for any run of the filter,
+ * so the gains are computed once when the configuration changes and the
+ * per-cycle update costs about as much as a PLL:
+ *
+ *   residual = z - pos
+ *   pos += gains.pos * residual
+ *   vel += gains.vel * residual
+ *   a   += gains.acc * residual
+ *
+ * Only the ratio of the noises matters. A larger accel_noise tracks load
+ * changes faster and lets more measurement noise through.
+ */
+struct KalmanTrackerGains {
+    float pos = 0.0f;   // [1]
+    float vel = 0.0f;   // [1/s]
+    float acc = 0.0f;   // [1/s^2]
+};
+
+/**
+ * @brief Iterates the Riccati equation to its fixed point.
+ *
+ * The states are normalized to pos, vel * dt and a * dt^2, which keeps the
+ * covariance well scaled in float for typical control loop periods.
+ *
+ * @param accel_noise: [unit/s^3 / sqrt(Hz)] in the unit of the position
+ * @param meas_noise: [unit] standard deviation of the measurement
+ * @returns false if the parameters are invalid or the iteration didn't
+ * converge.
+ */
+inline bool compute_kalman_tracker_gains(float accel_noise, float meas_noise, float dt, KalmanTrackerGains* gains) {
+    if (!(accel_noise > 0.0f) || !(meas_noise > 0.0f) || !(dt > 0.0f)) {
+        return false;
+    }
+    float ratio = accel_noise / meas_noise;
+    float q = ratio * ratio * dt * dt * dt * dt * dt;
+    if (!(q > 0.0f) || !std::isfinite(q)) {
+        return false;
+    }
+    const float Q[3][3] = {
+        {q / 20.0f, q / 8.0f, q / 6.0f},
+        {q / 8.0f,  q / 3.0f, q / 2.0f},
+        {q / 6.0f,  q / 2.0f, q},
+    };
+    const float A[3][3] = {
+        {1.0f, 1.0f, 0.5f},
+        {0.0f, 1.0f, 1.0f},
+        {0.0f, 0.0f, 1.0f},
+    };
+
+    float P[3][3] = {{1.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f}, {0.0f, 0.0f, 1.0f}};
+    float K[3] = {0.0f, 0.0f, 0.0f};
+    for (size_t iteration = 0; iteration < 100000; ++iteration) {
+        // Prediction: P = A * P * A^T + Q
+        float AP[3][3];
+        for (size_t i = 0; i < 3; ++i) {
+            for (size_t j = 0; j < 3; ++j) {
+                AP[i][j] = A[i][0] * P[0][j] + A[i][1] * P[1][j] + A[i][2] * P[2][j];
+            }
+        }
+        for (size_t i = 0; i < 3; ++i) {
+            for (size_t j = 0; j < 3; ++j) {
+                P[i][j] = AP[i][0] * A[j][0] + AP[i][1] * A[j][1] + AP[i][2] * A[j][2] + Q[i][j];
+            }
+        }
+
+        // Update with the normalized measurement variance of 1
+        float s = P[0][0] + 1.0f;
+        float K_next[3] = {P[0][0] / s, P[1][0] / s, P[2][0] / s};
+        float P0[3] = {P[0][0], P[0][1], P[0][2]};
+        for (size_t i = 0; i < 3; ++i) {
+            for (size_t j = 0; j < 3; ++j) {
+                P[i][j] -= K_next[i] * P0[j];
+            }
+        }
+        // Keep the covariance symmetric against rounding
+        for (size_t i = 0; i < 3; ++i) {
+            for (size_t j = i + 1; j < 3; ++j) {
+                P[i][j] = P[j][i] = 0.5f * (P[i][j] + P[j][i]);
+            }
+        }
+
+        bool converged = true;
+        for (size_t i = 0; i < 3; ++i) {
+            converged = converged && std::abs(K_next[i] - K[i]) <= 1e-6f * std::abs(K_next[i]);
+            K[i] = K_next[i];
+        }
+        if (converged) {
+            if (!std::isfinite(K[0]) || !std::isfinite(K[1]) || !std::isfinite(K[2])) {
+                return false;
+            }
+            gains->pos = K[0];
+            gains->vel = K[1] / dt;
+            gains->acc = K[2] / (dt * dt);
+            return true;
+        }
+    }
+    return false;
+}
+
+#endif // __KALMAN_TRACKER_HPP
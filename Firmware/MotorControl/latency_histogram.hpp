@@ -0,0 +1,127 @@
+#ifndef __LATENCY_HISTOGRAM_HPP
+#define __LATENCY_HISTOGRAM_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <array>
+
+/**
+ * @brief Log-bucketed histogram of task execution times.
+ *
+ * Each power-of-two octave is split into 2^SUB_BITS linear sub-buckets, so the
+ * relative resolution is roughly 1/2^SUB_BITS independent of the magnitude.
+ * Values below 2^SUB_BITS get a bucket each. Values beyond the last octave are
+ * clamped into the last bucket.
+ *
+ * Recording a sample is a count-leading-zeros and an increment, which makes it
+ * cheap enough to run on every control loop iteration. At 8kHz the counters
+ * wrap after a few days, so long running statistics should be reset
+ * periodically.
+ */
+struct LatencyHistogram {
+    static constexpr size_t SUB_BITS = 2;
+    static constexpr size_t SUB_BUCKETS = 1 << SUB_BITS;
+    static constexpr size_t MAX_MSB = 15; // largest resolved value: 2^16 - 1 clocks
+    static constexpr size_t N_BUCKETS = (MAX_MSB - SUB_BITS + 2) * SUB_BUCKETS;
+
+    static size_t bucket_of(uint32_t val) {
+        if (val < SUB_BUCKETS) {
+            return val;
+        }
+        size_t msb = 31 - __builtin_clz(val);
+        if (msb > MAX_MSB) {
+            return N_BUCKETS - 1;
+        }
+        size_t sub = (val >> (msb - SUB_BITS)) & (SUB_BUCKETS - 1);
+        return (msb - SUB_BITS + 1) * SUB_BUCKETS + sub;
+    }
+
+    // Returns the largest value that maps into the specified bucket.
+    static uint32_t bucket_upper_bound(size_t bucket) {
+        if (bucket < SUB_BUCKETS) {
+            return bucket;
+        }
+        size_t msb = bucket / SUB_BUCKETS + SUB_BITS - 1;
+        size_t sub = bucket % SUB_BUCKETS;
+        uint32_t lower = (1UL << msb) | (sub << (msb - SUB_BITS));
+        return lower + (1UL << (msb - SUB_BITS)) - 1;
+    }
+
+    void record(uint32_t val) {
+        counts_[bucket_of(val)]++;
+        n_samples_++;
+    }
+
+    void reset() {
+        counts_.fill(0);
+        n_samples_ = 0;
+    }
+
+    /**
+     * @brief Returns an upper bound for the value below which the fraction
+     * `quantile` of all recorded samples lie (e.g. 0.99f for p99).
+     * Returns 0 if no samples were recorded yet.
+     */
+    uint32_t get_percentile(float quantile) const {
+        uint32_t n = n_samples_;
+        if (!n) {
+            return 0;
+        }
+        // Zero-based rank of the sample we're looking for
+        uint64_t rank = (uint64_t)(quantile * (float)n);
+        if (rank >= n) {
+            rank = n - 1;
+        }
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i < N_BUCKETS; ++i) {
+            cumulative += counts_[i];
+            if (cumulative > rank) {
+                return bucket_upper_bound(i);
+            }
+        }
+        return bucket_upper_bound(N_BUCKETS - 1);
+    }
+
+    std::array<uint32_t, N_BUCKETS> counts_ = {0};
+    uint32_t n_samples_ = 0;
+};
+
+/**
+ * @brief Last, min, max and histogram of a latency, for instance the time
+ * from an interrupt request to the entry into its handler.
+ *
+ * min_ is UINT32_MAX until the first sample is recorded.
+ */
+struct LatencyStats {
+    uint32_t last_ = 0;
+    uint32_t min_ = UINT32_MAX;
+    uint32_t max_ = 0;
+    LatencyHistogram histogram_;
+
+    void record(uint32_t val) {
+        last_ = val;
+        if (val < min_) {
+            min_ = val;
+        }
+        if (val > max_) {
+            max_ = val;
+        }
+        histogram_.record(val);
+    }
+
+    uint32_t get_percentile(float quantile) {
+        return histogram_.get_percentile(quantile);
+    }
+
+    uint32_t get_n_samples() {
+        return histogram_.n_samples_;
+    }
+
+    void reset() {
+        min_ = UINT32_MAX;
+        max_ = 0;
+        histogram_.reset();
+    }
+};
+
+#endif // __LATENCY_HISTOGRAM_HPP
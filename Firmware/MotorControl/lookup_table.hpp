@@ -0,0 +1,40 @@
+#ifndef __LOOKUP_TABLE_HPP
+#define __LOOKUP_TABLE_HPP
+
+#include <stddef.h>
+#include <algorithm>
+
+/**
+ * @brief Bilinear interpolation in a table of nx * ny points that are spaced
+ * evenly over [0, x_max] x [0, y_max].
+ *
+ * The table is stored row by row, the point (ix, iy) is table[ix * stride + iy]
+ * with stride >= ny, so a table can be shrunk without moving the points.
+ * Inputs outside of the range are clamped to it. The evenly spaced points
+ * make the lookup constant time.
+ */
+inline float interp2d(const float* table, size_t stride, size_t nx, size_t ny, float x_max, float y_max, float x, float y) {
+    auto index = [](size_t n, float max, float v, size_t* i, float* frac) {
+        float pos = (n > 1 && max > 0.0f) ? std::clamp(v / max, 0.0f, 1.0f) * (float)(n - 1) : 0.0f;
+        *i = std::min((size_t)pos, n > 1 ? n - 2 : 0);
+        *frac = (n > 1) ? pos - (float)*i : 0.0f;
+    };
+    size_t ix, iy;
+    float fx, fy;
+    index(nx, x_max, x, &ix, &fx);
+    index(ny, y_max, y, &iy, &fy);
+    size_t dx = (nx > 1) ? stride : 0;
+    size_t dy = (ny > 1) ? 1 : 0;
+
+    const float* p = &table[ix * stride + iy];
+    float v0 = p[0] + fy * (p[dy] - p[0]);
+    float v1 = p[dx] + fy * (p[dx + dy] - p[dx]);
+    return v0 + fx * (v1 - v0);
+}
+
+// @brief Linear interpolation in a table of n points spaced evenly over [0, x_max]
+inline float interp1d(const float* table, size_t n, float x_max, float x) {
+    return interp2d(table, n, 1, n, 0.0f, x_max, 0.0f, x);
+}
+
+#endif // __LOOKUP_TABLE_HPP
@@ -31,6 +31,9 @@ const uint32_t stack_size_analog_thread = 1024;  // Bytes
 // This value is updated by the DC-bus reading ADC.
 // Arbitrary non-zero inital value to avoid division by zero if ADC reading is late
 float vbus_voltage = 12.0f;
+float vbus_voltage_derivative = 0.0f; // [V/s] low-pass filtered, only used by the predictive brake
+float vbus_voltage_filtered = 12.0f; // [V] low-pass filtered with config_.vbus_filter_tau
+float vbus_voltage_modulation = 12.0f; // [V] filtered value plus the ripple feedforward, used to convert voltages to modulation
 float ibus_ = 0.0f; // exposed for monitoring only
 bool brake_resistor_armed = false;
 bool brake_resistor_saturated = false;
@@ -81,6 +84,7 @@ void safety_critical_arm_brake_resistor() {
     CRITICAL_SECTION() {
         for (size_t i = 0; i < AXIS_COUNT; ++i) {
             axes[i].motor_.I_bus_ = 0.0f;
+            axes[i].motor_.I_bus_predicted_ = 0.0f;
         }
         brake_resistor_armed = true;
 #if HW_VERSION_MAJOR == 3
@@ -145,7 +149,7 @@ void start_adc_pwm() {
 
     for (Motor& motor: motors) {
         // Init PWM
-        int half_load = TIM_1_8_PERIOD_CLOCKS / 2;
+        int half_load = tim_1_8_period_clocks / 2;
         motor.timer_->Instance->CCR1 = half_load;
         motor.timer_->Instance->CCR2 = half_load;
         motor.timer_->Instance->CCR3 = half_load;
@@ -184,14 +188,16 @@ void start_adc_pwm() {
 }
 
 // @brief ADC1 measurements are written to this buffer by DMA
-uint16_t adc_measurements_[ADC_CHANNEL_COUNT] = { 0 };
+uint16_t adc_measurements_[ADC_SCAN_COUNT][ADC_CHANNEL_COUNT] = { 0 };
 
 // @brief Starts the general purpose ADC on the ADC1 peripheral.
 // The measured ADC voltages can be read with get_adc_voltage().
 //
 // ADC1 is set up to continuously sample all channels 0 to 15 in a
 // round-robin fashion.
-// DMA is used to copy the measured 12-bit values to adc_measurements_.
+// DMA is used to copy the measured 12-bit values to adc_measurements_. The
+// buffer holds the last ADC_SCAN_COUNT scans such that readers can average
+// over several conversions of the same channel.
 //
 // The injected (high priority) channel of ADC1 is used to sample vbus_voltage.
 // This conversion is triggered by TIM1 at the frequency of the motor control loop.
@@ -227,7 +233,7 @@ void start_general_purpose_adc() {
         }
     }
 
-    HAL_ADC_Start_DMA(&hadc1, reinterpret_cast<uint32_t*>(adc_measurements_), ADC_CHANNEL_COUNT);
+    HAL_ADC_Start_DMA(&hadc1, reinterpret_cast<uint32_t*>(adc_measurements_), ADC_SCAN_COUNT * ADC_CHANNEL_COUNT);
 }
 
 // @brief Returns the ADC voltage associated with the specified pin.
@@ -239,12 +245,13 @@ void start_general_purpose_adc() {
 //  GPIO_1, GPIO_2, GPIO_3, GPIO_4 and some pins that are connected to
 //  on-board sensors (M0_TEMP, M1_TEMP, AUX_TEMP)
 //
-// The ADC values are sampled in background at ~30kHz without
+// The ADC values are sampled in background at ~45kHz without
 // any CPU involvement.
 //
-// Details: each of the 16 conversion takes (15+26) ADC clock
-// cycles and the ADC, so the update rate of the entire sequence is:
-//  21000kHz / (15+26) / 16 = 32kHz
+// Details: each of the 16 conversion takes (15+12) ADC clock
+// cycles (sample time + 12 bit conversion), so the update rate of the
+// entire sequence is:
+//  21000kHz / (15+12) / 16 = 48.6kHz
 // The true frequency is slightly lower because of the injected vbus
 // measurements
 float get_adc_voltage(Stm32Gpio gpio) {
@@ -256,6 +263,11 @@ float get_adc_relative_voltage(Stm32Gpio gpio) {
     return get_adc_relative_voltage_ch(channel);
 }
 
+float get_adc_relative_voltage_avg(Stm32Gpio gpio, uint32_t n_scans) {
+    const uint16_t channel = channel_from_gpio(gpio);
+    return get_adc_relative_voltage_ch_avg(channel, n_scans);
+}
+
 // @brief Given a GPIO_port and pin return the associated adc_channel.
 // returns UINT16_MAX if there is no adc_channel;
 uint16_t channel_from_gpio(Stm32Gpio gpio) {
@@ -302,10 +314,35 @@ uint16_t channel_from_gpio(Stm32Gpio gpio) {
 // @brief Given an adc channel return the voltage as a ratio of adc_ref_voltage
 // returns -1.0f if the channel is not valid.
 float get_adc_relative_voltage_ch(uint16_t channel) {
-    if (channel < ADC_CHANNEL_COUNT)
-        return (float)adc_measurements_[channel] / adc_full_scale;
-    else
+    return get_adc_relative_voltage_ch_avg(channel, 1);
+}
+
+// @brief Returns the average of the n_scans most recent conversions of the
+// given channel as a ratio of adc_ref_voltage.
+// n_scans is clamped to [1, ADC_SCAN_COUNT]. Returns -1.0f if the channel
+// is not valid.
+//
+// The averaged conversions span n_scans * ADC_SCAN_PERIOD_CLOCKS, so the
+// result corresponds to the middle of this window.
+float get_adc_relative_voltage_ch_avg(uint16_t channel, uint32_t n_scans) {
+    if (channel >= ADC_CHANNEL_COUNT)
         return -1.0f;
+    n_scans = std::clamp(n_scans, (uint32_t)1, (uint32_t)ADC_SCAN_COUNT);
+
+    // Index of the next conversion that the DMA will write
+    constexpr uint32_t n_total = ADC_SCAN_COUNT * ADC_CHANNEL_COUNT;
+    uint32_t write_idx = n_total - hadc1.DMA_Handle->Instance->NDTR;
+    if (write_idx >= n_total)
+        write_idx = 0;
+
+    // Most recent scan that contains a completed conversion of this channel
+    uint32_t scan = (write_idx + n_total - 1 - channel) % n_total / ADC_CHANNEL_COUNT;
+
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < n_scans; ++i) {
+        sum += adc_measurements_[(scan + ADC_SCAN_COUNT - i) % ADC_SCAN_COUNT][channel];
+    }
+    return (float)sum / ((float)n_scans * adc_full_scale);
 }
 
 //--------------------------------
@@ -314,7 +351,29 @@ float get_adc_relative_voltage_ch(uint16_t channel) {
 
 void vbus_sense_adc_cb(uint32_t adc_value) {
     constexpr float voltage_scale = adc_ref_voltage * VBUS_S_DIVIDER_RATIO / adc_full_scale;
-    vbus_voltage = adc_value * voltage_scale;
+    constexpr float derivative_tau = 0.002f; // [s]
+    static bool first_sample = true;
+
+    float voltage = adc_value * voltage_scale;
+
+    // The bus voltage is sampled twice per control loop period
+    float dt = 0.5f * current_meas_period;
+    if (!first_sample) {
+        float k = std::min(dt / derivative_tau, 1.0f);
+        vbus_voltage_derivative += k * ((voltage - vbus_voltage) / dt - vbus_voltage_derivative);
+        float k_filter = std::min(dt / odrv.config_.vbus_filter_tau, 1.0f);
+        vbus_voltage_filtered += k_filter * (voltage - vbus_voltage_filtered);
+    } else {
+        vbus_voltage_filtered = voltage;
+    }
+    first_sample = false;
+    vbus_voltage = voltage;
+
+    // The PWM switches the instantaneous bus voltage, so the ripple that the
+    // filter removes is fed forward again to the degree configured. Without
+    // it, measurement noise doesn't modulate the current controller gain.
+    vbus_voltage_modulation = vbus_voltage_filtered
+            + odrv.config_.vbus_ripple_feedforward * (voltage - vbus_voltage_filtered);
 }
 
 // @brief Sums up the Ibus contribution of each motor and updates the
@@ -335,8 +394,23 @@ void update_brake_current() {
             return;
         }
     
+        float Ibus_regen = Ibus_sum;
+        if (odrv.config_.enable_predictive_brake) {
+            // Brake for the larger of the current and the next cycle's regen
+            // and for the current that charges the bus capacitors because
+            // neither the power supply nor the brake resistor absorbs it.
+            float Ibus_predicted = 0.0f;
+            for (size_t i = 0; i < AXIS_COUNT; ++i) {
+                if (axes[i].motor_.is_armed_) {
+                    Ibus_predicted += axes[i].motor_.I_bus_predicted_;
+                }
+            }
+            float I_cap = odrv.config_.dc_bus_capacitance * vbus_voltage_derivative;
+            Ibus_regen = std::min(Ibus_sum, Ibus_predicted) - std::max(I_cap, 0.0f);
+        }
+
         // Don't start braking until -Ibus > regen_current_allowed
-        brake_current = -Ibus_sum - odrv.config_.max_regen_current;
+        brake_current = -Ibus_regen - odrv.config_.max_regen_current;
         brake_duty = brake_current * odrv.config_.brake_resistance / vbus_voltage;
         
         if (odrv.config_.enable_dc_bus_overvoltage_ramp && (odrv.config_.brake_resistance > 0.0f) && (odrv.config_.dc_bus_overvoltage_ramp_start < odrv.config_.dc_bus_overvoltage_ramp_end)) {
@@ -385,27 +459,37 @@ void update_brake_current() {
 
 /* Analog speed control input */
 
-static void update_analog_endpoint(const struct PWMMapping_t *map, int gpio)
-{
-    float fraction = get_adc_voltage(get_gpio(gpio)) / 3.3f;
-    float value = map->min + (fraction * (map->max - map->min));
-    fibre::set_endpoint_from_float(map->endpoint, value);
+static MappingFilter analog_filters[GPIO_COUNT];
+
+// The voltages come from the regular ADC scan that DMA keeps up to date, so
+// this only reads memory. Called from the control loop, see
+// schedule::input_mapping_update.
+void update_analog_mappings(float dt) {
+    for (int i = 0; i < GPIO_COUNT; i++) {
+        const PWMMapping_t& map = odrv.config_.analog_mappings[i];
+
+        if (fibre::is_endpoint_ref_valid(map.endpoint)) {
+            float fraction = get_adc_voltage(get_gpio(i)) / 3.3f;
+            fibre::set_endpoint_from_float(map.endpoint, analog_filters[i].update(map, fraction, dt));
+        }
+    }
 }
 
 static void analog_polling_thread(void *)
 {
     while (true) {
-        for (int i = 0; i < GPIO_COUNT; i++) {
-            struct PWMMapping_t *map = &odrv.config_.analog_mappings[i];
-
-            if (fibre::is_endpoint_ref_valid(map->endpoint))
-                update_analog_endpoint(map, i);
+        // Read the gate driver status registers after a fault, away from the
+        // control loop and the axis threads
+        for (size_t i = 0; i < AXIS_COUNT; ++i) {
+            motors[i].gate_driver_.diagnose();
         }
         osDelay(10);
     }
 }
 
 void start_analog_thread() {
-    osThreadDef(analog_thread_def, analog_polling_thread, osPriorityLow, 0, stack_size_analog_thread / sizeof(StackType_t));
+    CCMRAM static StackType_t stack[stack_size_analog_thread / sizeof(StackType_t)];
+    CCMRAM static osStaticThreadDef_t thread_cb;
+    osThreadStaticDef(analog_thread_def, analog_polling_thread, osPriorityLow, 0, stack_size_analog_thread / sizeof(StackType_t), stack, &thread_cb);
     analog_thread = osThreadCreate(osThread(analog_thread_def), NULL);
 }
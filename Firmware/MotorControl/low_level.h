@@ -14,15 +14,23 @@ extern "C" {
 /* Exported types ------------------------------------------------------------*/
 /* Exported constants --------------------------------------------------------*/
 #define ADC_CHANNEL_COUNT 16
+#define ADC_SCAN_COUNT 8 // number of consecutive scans of all channels kept in adc_measurements_
+// [HCLK ticks] approximate duration of one scan. Each conversion takes the
+// 15 cycle sample time plus 12 ADC clocks for the 12 bit conversion (STM32F4
+// reference manual, ADC timing). The ADC clock is PCLK2 / 4 = HCLK / 8.
+#define ADC_SCAN_PERIOD_CLOCKS (ADC_CHANNEL_COUNT * (15 + 12) * 8)
 extern const float adc_full_scale;
 extern const float adc_ref_voltage;
 /* Exported variables --------------------------------------------------------*/
 extern float vbus_voltage;
+extern float vbus_voltage_derivative;
+extern float vbus_voltage_filtered;
+extern float vbus_voltage_modulation;
 extern float ibus_;
 extern bool brake_resistor_armed;
 extern bool brake_resistor_saturated;
 extern float brake_resistor_current;
-extern uint16_t adc_measurements_[ADC_CHANNEL_COUNT];
+extern uint16_t adc_measurements_[ADC_SCAN_COUNT][ADC_CHANNEL_COUNT];
 extern osThreadId analog_thread;
 extern const uint32_t stack_size_analog_thread;
 /* Exported macro ------------------------------------------------------------*/
@@ -47,12 +55,15 @@ void sync_timers(TIM_HandleTypeDef* htim_a, TIM_HandleTypeDef* htim_b,
 void start_general_purpose_adc();
 void pwm_in_init();
 void start_analog_thread();
+void update_analog_mappings(float dt);
 
 // ADC getters
 uint16_t channel_from_gpio(Stm32Gpio gpio);
 float get_adc_voltage(Stm32Gpio gpio);
 float get_adc_relative_voltage(Stm32Gpio gpio);
 float get_adc_relative_voltage_ch(uint16_t channel);
+float get_adc_relative_voltage_avg(Stm32Gpio gpio, uint32_t n_scans);
+float get_adc_relative_voltage_ch_avg(uint16_t channel, uint32_t n_scans);
 
 void update_brake_current();
 
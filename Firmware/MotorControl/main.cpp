@@ -2,6 +2,12 @@
 #define __MAIN_CPP__
 #include "odrive_main.h"
 #include "nvm_config.hpp"
+#include "config_field_lists.hpp"
+#include "ram_arena.hpp"
+#include <autogen/config_fields.hpp>
+#include <Drivers/STM32/stm32_fw_update.h>
+#include <fibre/../../protocol.hpp>
+#include <fibre/simple_serdes.hpp>
 
 #include "usart.h"
 #include "freertos_vars.h"
@@ -16,13 +22,41 @@ osMessageQId uart_event_queue;
 osMessageQId usb_event_queue;
 osSemaphoreId sem_can;
 
-#if defined(STM32F405xx)
 // Place FreeRTOS heap in core coupled memory for better performance
-__attribute__((section(".ccmram")))
-#endif
-uint8_t ucHeap[configTOTAL_HEAP_SIZE];
+CCMRAM uint8_t ucHeap[configTOTAL_HEAP_SIZE];
+
+// Memory of the RTOS objects created in main(). All kernel objects are
+// allocated statically so that their memory use shows up at link time.
+const uint32_t stack_size_default_task = 2048; // Bytes
+CCMRAM static StackType_t default_task_stack[stack_size_default_task / sizeof(StackType_t)];
+CCMRAM static osStaticThreadDef_t default_task_cb;
+CCMRAM static StackType_t idle_task_stack[configMINIMAL_STACK_SIZE];
+CCMRAM static StaticTask_t idle_task_cb;
+CCMRAM static osStaticSemaphoreDef_t sem_usb_irq_cb;
+CCMRAM static osStaticSemaphoreDef_t sem_can_cb;
+CCMRAM static uint32_t uart_event_queue_buf[8];
+CCMRAM static osStaticMessageQDef_t uart_event_queue_cb;
+CCMRAM static uint32_t usb_event_queue_buf[12];
+CCMRAM static osStaticMessageQDef_t usb_event_queue_cb;
 
 uint32_t _reboot_cookie __attribute__ ((section (".noinit")));
+
+// Buffers whose size is configurable: the cogging maps, the oscilloscope and
+// the telemetry frames. See partition_ram_arena(). The defaults take 16 KiB for
+// the cogging maps, 16 KiB for the oscilloscope and 512 bytes for telemetry.
+static constexpr size_t kRamArenaSize = 33 * 1024;
+alignas(8) static uint8_t ram_arena_storage[kRamArenaSize];
+static RamArena ram_arena{ram_arena_storage, sizeof(ram_arena_storage)};
+
+// Current sensor offsets that survive a software reset, see retain_dc_calib()
+struct DcCalibRetention_t {
+    uint32_t magic;
+    Iph_ABC_t DC_calib[AXIS_COUNT];
+    uint32_t checksum;
+};
+static DcCalibRetention_t dc_calib_retention_ __attribute__ ((section (".noinit")));
+static constexpr uint32_t kDcCalibRetentionMagic = 0xDCCA1B00;
+EventLog event_log __attribute__ ((section (".noinit")));
 extern char _estack; // provided by the linker script
 
 
@@ -30,6 +64,15 @@ ODrive odrv{};
 
 
 ConfigManager config_manager;
+ConfigTransaction config_transaction;
+
+bool defer_config_apply(void* obj, ConfigTransaction::Apply apply) {
+    bool deferred;
+    CRITICAL_SECTION() {
+        deferred = config_transaction.defer(obj, apply);
+    }
+    return deferred;
+}
 
 class StatusLedController {
 public:
@@ -83,42 +126,68 @@ void StatusLedController::update() {
 #endif
 }
 
+// Field lists with the calibration tables, see config_field_lists.hpp
+using EncoderFields = EncoderConfigFields<ODriveEncoderConfigFields>;
+using MotorFields = MotorConfigFields<ODriveMotorConfigFields>;
+using ControllerFields = ControllerConfigFields<ODriveControllerConfigFields>;
+using AxisFields = AxisConfigFields<ODriveAxisConfigFields>;
+
+// The cogging maps are loaded before the controller configs that size them, so
+// they go straight to the start of the arena, where partition_ram_arena() puts
+// them again. A record that doesn't fit loads as zeros.
+static bool read_cogging_map_store() {
+    size_t length = 0;
+    return config_manager.read_bytes(ram_arena_storage, sizeof(ram_arena_storage), &length);
+}
+
+// The config structs are stored field by field, so that a firmware update
+// that changes them keeps the values of the fields that still exist (see
+// ConfigManager::read_fields()). The records are tagged by their position in
+// this sequence.
 static bool config_read_all() {
     bool success = board_read_config() &&
-           config_manager.read(&odrv.config_) &&
-           config_manager.read(&odrv.can_.config_);
+           config_manager.read_fields<ODrive3ConfigFields>(&odrv.config_) &&
+           config_manager.read_fields<ODriveCanConfigFields>(&odrv.can_.config_) &&
+           read_cogging_map_store();
     for (size_t i = 0; (i < AXIS_COUNT) && success; ++i) {
-        success = config_manager.read(&encoders[i].config_) &&
-                  config_manager.read(&axes[i].sensorless_estimator_.config_) &&
-                  config_manager.read(&axes[i].controller_.config_) &&
-                  config_manager.read(&axes[i].trap_traj_.config_) &&
-                  config_manager.read(&axes[i].min_endstop_.config_) &&
-                  config_manager.read(&axes[i].max_endstop_.config_) &&
-                  config_manager.read(&axes[i].mechanical_brake_.config_) &&
-                  config_manager.read(&motors[i].config_) &&
-                  config_manager.read(&motors[i].fet_thermistor_.config_) &&
-                  config_manager.read(&motors[i].motor_thermistor_.config_) &&
-                  config_manager.read(&axes[i].config_);
+        success = config_manager.read_fields<EncoderFields>(&encoders[i].config_) &&
+                  config_manager.read_fields<ODriveSensorlessEstimatorConfigFields>(&axes[i].sensorless_estimator_.config_) &&
+                  config_manager.read_fields<ODriveFusedEstimatorConfigFields>(&axes[i].fused_estimator_.config_) &&
+                  config_manager.read_fields<ODriveHfiEstimatorConfigFields>(&axes[i].hfi_estimator_.config_) &&
+                  config_manager.read_fields<ODriveAcimEstimatorConfigFields>(&axes[i].acim_estimator_.config_) &&
+                  config_manager.read_fields<ControllerFields>(&axes[i].controller_.config_) &&
+                  config_manager.read_fields<ODriveTrapezoidalTrajectoryConfigFields>(&axes[i].trap_traj_.config_) &&
+                  config_manager.read_fields<ODriveEndstopConfigFields>(&axes[i].min_endstop_.config_) &&
+                  config_manager.read_fields<ODriveEndstopConfigFields>(&axes[i].max_endstop_.config_) &&
+                  config_manager.read_fields<ODriveMechanicalBrakeConfigFields>(&axes[i].mechanical_brake_.config_) &&
+                  config_manager.read_fields<MotorFields>(&motors[i].config_) &&
+                  config_manager.read_fields<ODriveOnboardThermistorCurrentLimiterConfigFields>(&motors[i].fet_thermistor_.config_) &&
+                  config_manager.read_fields<ODriveOffboardThermistorCurrentLimiterConfigFields>(&motors[i].motor_thermistor_.config_) &&
+                  config_manager.read_fields<AxisFields>(&axes[i].config_);
     }
     return success;
 }
 
 static bool config_write_all() {
     bool success = board_write_config() &&
-           config_manager.write(&odrv.config_) &&
-           config_manager.write(&odrv.can_.config_);
+           config_manager.write_fields<ODrive3ConfigFields>(&odrv.config_) &&
+           config_manager.write_fields<ODriveCanConfigFields>(&odrv.can_.config_) &&
+           config_manager.write_bytes(Controller::cogging_map_store_, Controller::cogging_map_store_size_);
     for (size_t i = 0; (i < AXIS_COUNT) && success; ++i) {
-        success = config_manager.write(&encoders[i].config_) &&
-                  config_manager.write(&axes[i].sensorless_estimator_.config_) &&
-                  config_manager.write(&axes[i].controller_.config_) &&
-                  config_manager.write(&axes[i].trap_traj_.config_) &&
-                  config_manager.write(&axes[i].min_endstop_.config_) &&
-                  config_manager.write(&axes[i].max_endstop_.config_) &&
-                  config_manager.write(&axes[i].mechanical_brake_.config_) &&
-                  config_manager.write(&motors[i].config_) &&
-                  config_manager.write(&motors[i].fet_thermistor_.config_) &&
-                  config_manager.write(&motors[i].motor_thermistor_.config_) &&
-                  config_manager.write(&axes[i].config_);
+        success = config_manager.write_fields<EncoderFields>(&encoders[i].config_) &&
+                  config_manager.write_fields<ODriveSensorlessEstimatorConfigFields>(&axes[i].sensorless_estimator_.config_) &&
+                  config_manager.write_fields<ODriveFusedEstimatorConfigFields>(&axes[i].fused_estimator_.config_) &&
+                  config_manager.write_fields<ODriveHfiEstimatorConfigFields>(&axes[i].hfi_estimator_.config_) &&
+                  config_manager.write_fields<ODriveAcimEstimatorConfigFields>(&axes[i].acim_estimator_.config_) &&
+                  config_manager.write_fields<ControllerFields>(&axes[i].controller_.config_) &&
+                  config_manager.write_fields<ODriveTrapezoidalTrajectoryConfigFields>(&axes[i].trap_traj_.config_) &&
+                  config_manager.write_fields<ODriveEndstopConfigFields>(&axes[i].min_endstop_.config_) &&
+                  config_manager.write_fields<ODriveEndstopConfigFields>(&axes[i].max_endstop_.config_) &&
+                  config_manager.write_fields<ODriveMechanicalBrakeConfigFields>(&axes[i].mechanical_brake_.config_) &&
+                  config_manager.write_fields<MotorFields>(&motors[i].config_) &&
+                  config_manager.write_fields<ODriveOnboardThermistorCurrentLimiterConfigFields>(&motors[i].fet_thermistor_.config_) &&
+                  config_manager.write_fields<ODriveOffboardThermistorCurrentLimiterConfigFields>(&motors[i].motor_thermistor_.config_) &&
+                  config_manager.write_fields<AxisFields>(&axes[i].config_);
     }
     return success;
 }
@@ -126,9 +195,13 @@ static bool config_write_all() {
 static void config_clear_all() {
     odrv.config_ = {};
     odrv.can_.config_ = {};
+    std::fill_n(ram_arena_storage, sizeof(ram_arena_storage), 0);
     for (size_t i = 0; i < AXIS_COUNT; ++i) {
         encoders[i].config_ = {};
         axes[i].sensorless_estimator_.config_ = {};
+        axes[i].fused_estimator_.config_ = {};
+        axes[i].hfi_estimator_.config_ = {};
+        axes[i].acim_estimator_.config_ = {};
         axes[i].controller_.config_ = {};
         axes[i].controller_.config_.load_encoder_axis = i;
         axes[i].trap_traj_.config_ = {};
@@ -142,8 +215,47 @@ static void config_clear_all() {
     }
 }
 
+// @brief Hands out the RAM arena in this order: the cogging maps that the
+// controller configs need (all or nothing, at the start of the arena, where
+// they were loaded), the oscilloscope buffer and the telemetry frames. The
+// last two get what is left if the arena runs out.
+static void partition_ram_arena() {
+    odrv.oscilloscope_.set_buffer(nullptr, 0);
+    odrv.telemetry_.set_buffer(nullptr, 0);
+
+    ram_arena.reset();
+    size_t cogging_bytes = Controller::cogging_map_store_bytes();
+    Controller::cogging_map_store_ = (uint8_t*)ram_arena.allocate(cogging_bytes, sizeof(float));
+    Controller::cogging_map_store_size_ = Controller::cogging_map_store_ ? cogging_bytes : 0;
+
+    uint64_t scope_bytes = (uint64_t)odrv.config_.oscilloscope_depth
+                         * odrv.config_.oscilloscope_channels * sizeof(float);
+    size_t scope_granted = 0;
+    void* scope = ram_arena.allocate_up_to((size_t)std::min<uint64_t>(scope_bytes, kRamArenaSize),
+                                           sizeof(float), &scope_granted);
+    odrv.oscilloscope_.set_buffer(scope, scope_granted);
+
+    uint64_t telemetry_bytes = (uint64_t)odrv.config_.telemetry_frames * sizeof(Telemetry::Frame_t);
+    size_t telemetry_granted = 0;
+    void* telemetry = ram_arena.allocate_up_to((size_t)std::min<uint64_t>(telemetry_bytes, kRamArenaSize),
+                                               sizeof(Telemetry::Frame_t), &telemetry_granted);
+    odrv.telemetry_.set_buffer(telemetry, telemetry_granted);
+
+    odrv.ram_arena_.size = ram_arena.size();
+    odrv.ram_arena_.cogging_maps = Controller::cogging_map_store_size_;
+    odrv.ram_arena_.oscilloscope = scope_granted;
+    odrv.ram_arena_.telemetry = telemetry_granted;
+    odrv.ram_arena_.free = ram_arena.available();
+}
+
 static bool config_apply_all() {
-    bool success = odrv.can_.apply_config();
+    // The controllers pick their cogging maps from the arena
+    partition_ram_arena();
+
+    // Must come before the components since the gains of most of them depend
+    // on the control loop period.
+    bool success = apply_pwm_timing(odrv.config_.pwm_frequency, odrv.config_.control_loop_decimation)
+                && odrv.can_.apply_config();
     for (size_t i = 0; (i < AXIS_COUNT) && success; ++i) {
         success = encoders[i].apply_config(motors[i].config_.motor_type)
                && axes[i].controller_.apply_config()
@@ -156,20 +268,100 @@ static bool config_apply_all() {
     return success;
 }
 
+static uint32_t dc_calib_retention_checksum() {
+    uint32_t checksum = dc_calib_retention_.magic;
+    const uint32_t* words = reinterpret_cast<const uint32_t*>(dc_calib_retention_.DC_calib);
+    for (size_t i = 0; i < sizeof(dc_calib_retention_.DC_calib) / sizeof(uint32_t); ++i) {
+        checksum = (checksum << 5 | checksum >> 27) ^ words[i];
+    }
+    return checksum;
+}
+
+/**
+ * @brief Stores the settled current sensor offsets in RAM that is not
+ * initialized at startup, so that a warm restart doesn't have to wait for the
+ * calibration to settle again. Must be called right before a software reset.
+ */
+static void retain_dc_calib() {
+    dc_calib_retention_.magic = 0;
+    for (size_t i = 0; i < AXIS_COUNT; ++i) {
+        if (!motors[i].dc_calib_settled_) {
+            return;
+        }
+        dc_calib_retention_.DC_calib[i] = motors[i].DC_calib_;
+    }
+    dc_calib_retention_.magic = kDcCalibRetentionMagic;
+    dc_calib_retention_.checksum = dc_calib_retention_checksum();
+}
+
+/**
+ * @brief Hands the offsets stored by retain_dc_calib() to the motors if this
+ * is a warm restart. They are invalidated so that they are used only once.
+ */
+static void restore_dc_calib() {
+    if (dc_calib_retention_.magic == kDcCalibRetentionMagic
+            && dc_calib_retention_.checksum == dc_calib_retention_checksum()) {
+        for (size_t i = 0; i < AXIS_COUNT; ++i) {
+            motors[i].DC_calib_retained_ = dc_calib_retention_.DC_calib[i];
+        }
+    }
+    dc_calib_retention_.magic = 0;
+}
+
+void ODrive::reboot() {
+    CRITICAL_SECTION() {
+        retain_dc_calib();
+        NVIC_SystemReset();
+    }
+}
+
+/**
+ * @brief Saves the configuration.
+ *
+ * Usually the flash has room for the new configuration, which is then written
+ * with interrupts enabled and without a reboot, even with armed motors. Each
+ * programmed word only delays the interrupts by a few microseconds.
+ *
+ * If a flash sector must be erased first, the CPU stalls for a second or
+ * more. This is only done with all motors disarmed and followed by a reboot,
+ * as missed interrupts leave the encoders and step counters in an unknown
+ * state. main() erases the sector of the next save at startup when needed, so
+ * this is the exception.
+ */
 bool ODrive::save_configuration(void) {
-    bool success;
+    // The protocol servers can call this concurrently
+    static bool busy = false;
+    bool was_busy;
+    CRITICAL_SECTION() {
+        was_busy = busy;
+        busy = true;
+    }
+    if (was_busy) {
+        return false;
+    }
+
+    size_t config_size = 0;
+    bool success = config_manager.prepare_store()
+                && config_write_all();
+
+    if (success && !config_manager.store_needs_erase()) {
+        success = config_manager.start_store(&config_size)
+               && config_write_all()
+               && config_manager.finish_store();
+        busy = false;
+        return success;
+    }
 
     CRITICAL_SECTION() {
         bool any_armed = std::any_of(axes.begin(), axes.end(),
             [](auto& axis){ return axis.motor_.is_armed_; });
-        if (any_armed) {
+        if (!success || any_armed) {
+            config_manager.abort_store();
+            busy = false;
             return false;
         }
 
-        size_t config_size = 0;
-        success = config_manager.prepare_store()
-               && config_write_all()
-               && config_manager.start_store(&config_size)
+        success = config_manager.start_store(&config_size)
                && config_write_all()
                && config_manager.finish_store();
 
@@ -177,12 +369,30 @@ bool ODrive::save_configuration(void) {
         // because the CPU gets halted during a flash erase. Missing events
         // (encoder updates, step/dir steps) is not good so to be sure we just
         // reboot.
+        retain_dc_calib();
         NVIC_SystemReset();
     }
 
     return success;
 }
 
+void ODrive::begin_config_transaction() {
+    CRITICAL_SECTION() {
+        config_transaction.begin();
+    }
+}
+
+void ODrive::commit_config_transaction() {
+    ConfigTransaction::Entry_t pending[CONFIG_TRANSACTION_SIZE];
+    size_t n_pending;
+    CRITICAL_SECTION() {
+        n_pending = config_transaction.close(pending);
+    }
+    for (size_t i = 0; i < n_pending; ++i) {
+        pending[i].apply(pending[i].obj);
+    }
+}
+
 void ODrive::erase_configuration(void) {
     NVM_erase();
 
@@ -212,12 +422,66 @@ void ODrive::enter_dfu_mode() {
     }
 }
 
+static bool any_motor_armed() {
+    return std::any_of(axes.begin(), axes.end(),
+            [](auto& axis){ return axis.motor_.is_armed_; });
+}
+
+bool ODrive::begin_firmware_update(uint32_t size, uint32_t crc32) {
+    // The flash erase stalls the CPU and therefore the control loop
+    if (any_motor_armed()) {
+        return false;
+    }
+    return FW_UPDATE_begin(size, crc32) == 0;
+}
+
+bool ODrive::commit_firmware_update() {
+    if (any_motor_armed() || FW_UPDATE_commit() != 0) {
+        return false;
+    }
+    // The image is installed by early_start_checks() after the reset. Give
+    // the response some time to get out first.
+    osDelay(5);
+    __asm volatile ("CPSID I\n\t":::"memory"); // disable interrupts
+    NVIC_SystemReset();
+}
+
+uint32_t ODrive::get_firmware_update_received() {
+    return FW_UPDATE_get_received();
+}
+
+uint32_t ODrive::get_firmware_update_max_size() {
+    return FW_UPDATE_get_max_size();
+}
+
+// Chunks of a firmware image sent to FW_UPDATE_ENDPOINT_ID
+// (see begin_firmware_update()). The client streams the chunks without waiting
+// for responses, so they are processed right here instead of through the
+// generated endpoints.
+bool fibre::firmware_update_handler(cbufptr_t* input_buffer, bufptr_t* output_buffer) {
+    std::optional<uint32_t> offset = read_le<uint32_t>(input_buffer);
+    uint8_t status = 1;
+    if (offset.has_value()) {
+        if (any_motor_armed()) {
+            // Programming the flash stalls the control loop for a few us per word
+            FW_UPDATE_abort();
+        } else if (FW_UPDATE_write(*offset, input_buffer->begin(), input_buffer->size()) == 0) {
+            status = 0;
+        }
+        *input_buffer = input_buffer->skip(input_buffer->size());
+    }
+    write_le<uint8_t>(status, output_buffer);
+    write_le<uint32_t>(FW_UPDATE_get_received(), output_buffer);
+    return status == 0;
+}
+
 bool ODrive::any_error() {
     return error_ != ODrive::ERROR_NONE
         || std::any_of(axes.begin(), axes.end(), [](Axis& axis){
             return axis.error_ != Axis::ERROR_NONE
                 || axis.motor_.error_ != Motor::ERROR_NONE
                 || axis.sensorless_estimator_.error_ != SensorlessEstimator::ERROR_NONE
+                || axis.hfi_estimator_.error_ != HfiEstimator::ERROR_NONE
                 || axis.encoder_.error_ != Encoder::ERROR_NONE
                 || axis.controller_.error_ != Controller::ERROR_NONE;
         });
@@ -233,11 +497,278 @@ uint64_t ODrive::get_drv_fault() {
 #endif
 }
 
+uint64_t ODrive::get_trace_event(uint32_t index) {
+    const TraceEvent_t& evt = trace_buffer[index & (TRACE_BUFFER_SIZE - 1)];
+    return ((uint64_t)evt.tag << 32) | evt.cycles;
+}
+
+std::tuple<uint32_t, ODrive::EventSource, uint32_t> ODrive::get_event(uint32_t index) {
+    EventLog::Entry_t entry;
+    if (!::event_log.read(index, &entry)) {
+        return {0, EVENT_SOURCE_NONE, 0};
+    }
+    return {entry.cycles, (EventSource)entry.source, entry.code};
+}
+
+void ODrive::clear_event_log() {
+    CRITICAL_SECTION() {
+        ::event_log.reset();
+    }
+}
+
+/**
+ * @brief Logs the error bits that were set since the previous call. Errors
+ * that are set in interrupt context by the faulting component itself are
+ * already logged with a more accurate timestamp.
+ */
+// @brief Logs new error bits of all components.
+// Returns the same as ODrive::any_error(), from the error words that were
+// loaded for the log anyway.
+static bool log_errors() {
+    uint32_t cycles = DWT->CYCCNT;
+    uint64_t any = 0; // motor errors have 64 bits
+    auto track = [&](uint8_t source, uint64_t error) {
+        event_log.track(cycles, source, error);
+        any |= error;
+    };
+    track(ODrive::EVENT_SOURCE_SYSTEM, odrv.error_);
+    event_log.track(cycles, ODrive::EVENT_SOURCE_CAN, odrv.can_.error_); // not part of any_error()
+    for (size_t i = 0; i < AXIS_COUNT; ++i) {
+        Axis& axis = axes[i];
+        track(axis_event_source(ODrive::EVENT_SOURCE_AXIS0, i), axis.error_);
+        track(axis_event_source(ODrive::EVENT_SOURCE_MOTOR0, i), axis.motor_.error_);
+        track(axis_event_source(ODrive::EVENT_SOURCE_ENCODER0, i), axis.encoder_.error_);
+        track(axis_event_source(ODrive::EVENT_SOURCE_CONTROLLER0, i), axis.controller_.error_);
+        track(axis_event_source(ODrive::EVENT_SOURCE_SENSORLESS_ESTIMATOR0, i), axis.sensorless_estimator_.error_);
+        track(axis_event_source(ODrive::EVENT_SOURCE_HFI_ESTIMATOR0, i), axis.hfi_estimator_.error_);
+    }
+    return any != 0;
+}
+
+/**
+ * Slots of the threads in the CPU time accounting. The slot is stored as the
+ * FreeRTOS task number, threads that were not assigned a slot (and all of
+ * them before rtos_main() assigns the slots) fall into THREAD_SLOT_OTHER.
+ */
+enum ThreadSlot {
+    THREAD_SLOT_OTHER,
+    THREAD_SLOT_AXIS0,
+    THREAD_SLOT_USB = THREAD_SLOT_AXIS0 + AXIS_COUNT,
+    THREAD_SLOT_UART,
+    THREAD_SLOT_CAN,
+    THREAD_SLOT_ANALOG,
+    THREAD_SLOT_STARTUP,
+    THREAD_SLOT_IDLE,
+    THREAD_SLOT_COUNT
+};
+
+// Updated by the scheduler in PendSV, which can be preempted by the control
+// loop. [cycles] are on thread_clock() and wrap.
+static uint32_t thread_cycles[THREAD_SLOT_COUNT];
+static uint32_t thread_switches[THREAD_SLOT_COUNT];
+static uint32_t thread_switched_in_cycles = 0;
+static uint32_t current_thread_slot = THREAD_SLOT_OTHER;
+
+// DWT cycle count at which the thread in the slot became ready, 0 if it
+// wasn't made ready since it last ran.
+static volatile uint32_t thread_ready_cycles[THREAD_SLOT_COUNT];
+
+static LatencyStats* get_wake_latency(uint32_t slot) {
+    ThreadWakeLatencies& latencies = odrv.thread_wake_latencies_;
+    if (slot >= THREAD_SLOT_AXIS0 && slot < THREAD_SLOT_AXIS0 + AXIS_COUNT) {
+        return &latencies.axis;
+    }
+    switch (slot) {
+        case THREAD_SLOT_USB: return &latencies.usb;
+        case THREAD_SLOT_UART: return &latencies.uart;
+        case THREAD_SLOT_CAN: return &latencies.can;
+        default: return nullptr;
+    }
+}
+
+// @brief Returns the setpoint latency stats of the interface that the caller
+// serves, nullptr if it isn't a protocol thread. Setpoints that are written
+// from an interrupt come from the CAN RX interrupt.
+/**
+ * @brief Integrates the bus power of the motors and of the brake resistor over
+ * one control loop period.
+ * The currents are those of the last PWM update of each axis. With two axes
+ * the brake current changes at both updates, so the brake energy is that of
+ * the later one held for the whole period. That averages out over time.
+ */
+void ODrive::update_energy_counters() {
+    float I_motors = 0.0f;
+    for (auto& axis: axes) {
+        if (!axis.motor_.is_armed_) {
+            continue;
+        }
+        float power = vbus_voltage * axis.motor_.I_bus_;
+        if (power > 0.0f) {
+            axis.motor_.motoring_energy_.add(power, current_meas_period);
+        } else {
+            axis.motor_.regen_energy_.add(-power, current_meas_period);
+        }
+        I_motors += axis.motor_.I_bus_;
+    }
+
+    float brake_power = brake_resistor_armed ? vbus_voltage * brake_resistor_current : 0.0f;
+    energy_.brake_resistor.add(brake_power, current_meas_period);
+
+    float bus_power = vbus_voltage * I_motors + brake_power;
+    if (bus_power > 0.0f) {
+        energy_.bus_drawn.add(bus_power, current_meas_period);
+    } else {
+        energy_.bus_returned.add(-bus_power, current_meas_period);
+    }
+}
+
+void ODrive::reset_energy_counters() {
+    energy_.bus_drawn.reset();
+    energy_.bus_returned.reset();
+    energy_.brake_resistor.reset();
+    for (auto& axis: axes) {
+        axis.motor_.motoring_energy_.reset();
+        axis.motor_.regen_energy_.reset();
+    }
+}
+
+LatencyStats* ODrive::get_setpoint_latency_stats() {
+    if (__get_IPSR() != 0) {
+        return &setpoint_latencies_.can;
+    }
+    switch (current_thread_slot) {
+        case THREAD_SLOT_USB: return &setpoint_latencies_.usb;
+        case THREAD_SLOT_UART: return &setpoint_latencies_.uart;
+        case THREAD_SLOT_CAN: return &setpoint_latencies_.can;
+        default: return nullptr;
+    }
+}
+
+// Called by the kernel when a thread is unblocked, from any context. Only the
+// first call after the thread last ran counts, so the latency of a thread
+// that is woken several times is measured from the first event.
+extern "C" void thread_made_ready(uint32_t slot) {
+    if (slot < THREAD_SLOT_COUNT && !thread_ready_cycles[slot]) {
+        thread_ready_cycles[slot] = DWT->CYCCNT | 1; // 0 means not ready
+    }
+}
+
+extern "C" void thread_switched_out(uint32_t slot) {
+    if (slot >= THREAD_SLOT_COUNT) {
+        slot = THREAD_SLOT_OTHER;
+    }
+    thread_cycles[slot] += thread_clock() - thread_switched_in_cycles;
+}
+
+extern "C" void thread_switched_in(uint32_t slot) {
+    if (slot >= THREAD_SLOT_COUNT) {
+        slot = THREAD_SLOT_OTHER;
+    }
+    thread_switched_in_cycles = thread_clock();
+    current_thread_slot = slot;
+    thread_switches[slot]++;
+
+    uint32_t ready_cycles = thread_ready_cycles[slot];
+    if (ready_cycles) {
+        thread_ready_cycles[slot] = 0;
+        if (LatencyStats* latency = get_wake_latency(slot)) {
+            latency->record(DWT->CYCCNT - ready_cycles);
+        }
+    }
+}
+
+static void assign_thread_slots() {
+    // A null handle would refer to the calling thread
+    auto assign = [](TaskHandle_t thread, uint32_t slot) {
+        if (thread) {
+            vTaskSetTaskNumber(thread, slot);
+        }
+    };
+    for (size_t i = 0; i < AXIS_COUNT; ++i) {
+        assign(axes[i].thread_id_, THREAD_SLOT_AXIS0 + i);
+    }
+    assign(usb_thread, THREAD_SLOT_USB);
+    assign(uart_thread, THREAD_SLOT_UART); // not started if the UART is disabled
+    assign(odrv.can_.thread_id_, THREAD_SLOT_CAN); // same for CAN
+    assign(analog_thread, THREAD_SLOT_ANALOG);
+    assign(defaultTaskHandle, THREAD_SLOT_STARTUP);
+    assign(xTaskGetIdleTaskHandle(), THREAD_SLOT_IDLE);
+}
+
+/**
+ * @brief Updates the CPU load and context switch counts in system_stats_ from
+ * the time since the previous call. Must run at least once per DWT counter
+ * period (25s at 168MHz).
+ */
+static void update_thread_stats() {
+    static uint32_t last_cycles = 0;
+    static uint32_t last_thread_clock = 0;
+    static uint32_t last_thread_cycles[THREAD_SLOT_COUNT] = {};
+    static uint32_t last_thread_switches[THREAD_SLOT_COUNT] = {};
+
+    uint32_t cycles;
+    uint32_t now_thread_clock;
+    uint32_t now_thread_cycles[THREAD_SLOT_COUNT];
+    uint32_t now_thread_switches[THREAD_SLOT_COUNT];
+    CRITICAL_SECTION() {
+        cycles = DWT->CYCCNT;
+        now_thread_clock = thread_clock();
+        std::copy(std::begin(thread_cycles), std::end(thread_cycles), now_thread_cycles);
+        std::copy(std::begin(thread_switches), std::end(thread_switches), now_thread_switches);
+        // The interrupted thread has been running since it was switched in
+        now_thread_cycles[current_thread_slot] += now_thread_clock - thread_switched_in_cycles;
+    }
+
+    uint32_t period = cycles - last_cycles;
+    uint32_t load[THREAD_SLOT_COUNT];
+    uint32_t switches[THREAD_SLOT_COUNT];
+    for (size_t i = 0; i < THREAD_SLOT_COUNT; ++i) {
+        load[i] = now_thread_cycles[i] - last_thread_cycles[i];
+        switches[i] = now_thread_switches[i] - last_thread_switches[i];
+    }
+    uint32_t irq_load = period - (now_thread_clock - last_thread_clock);
+
+    last_cycles = cycles;
+    last_thread_clock = now_thread_clock;
+    std::copy(std::begin(now_thread_cycles), std::end(now_thread_cycles), last_thread_cycles);
+    std::copy(std::begin(now_thread_switches), std::end(now_thread_switches), last_thread_switches);
+
+    if (!period) {
+        return;
+    }
+    auto fraction = [period](uint32_t value) { return (float)value / (float)period; };
+    SystemStats_t& stats = odrv.system_stats_;
+    float axis_load = 0.0f;
+    uint32_t axis_switches = 0;
+    for (size_t i = 0; i < AXIS_COUNT; ++i) {
+        axis_load = std::max(axis_load, fraction(load[THREAD_SLOT_AXIS0 + i]));
+        axis_switches = std::max(axis_switches, switches[THREAD_SLOT_AXIS0 + i]);
+    }
+    stats.cpu_load_axis = axis_load;
+    stats.cpu_load_usb = fraction(load[THREAD_SLOT_USB]);
+    stats.cpu_load_uart = fraction(load[THREAD_SLOT_UART]);
+    stats.cpu_load_startup = fraction(load[THREAD_SLOT_STARTUP]);
+    stats.cpu_load_can = fraction(load[THREAD_SLOT_CAN]);
+    stats.cpu_load_analog = fraction(load[THREAD_SLOT_ANALOG]);
+    stats.cpu_load_other = fraction(load[THREAD_SLOT_OTHER]);
+    stats.cpu_load_idle = fraction(load[THREAD_SLOT_IDLE]);
+    stats.cpu_load_isr = fraction(irq_load);
+    stats.context_switches_axis = axis_switches;
+    stats.context_switches_usb = switches[THREAD_SLOT_USB];
+    stats.context_switches_uart = switches[THREAD_SLOT_UART];
+    stats.context_switches_startup = switches[THREAD_SLOT_STARTUP];
+    stats.context_switches_can = switches[THREAD_SLOT_CAN];
+    stats.context_switches_analog = switches[THREAD_SLOT_ANALOG];
+    stats.context_switches_other = switches[THREAD_SLOT_OTHER];
+    stats.context_switches_idle = switches[THREAD_SLOT_IDLE];
+}
+
 void ODrive::clear_errors() {
     for (auto& axis: axes) {
         axis.motor_.error_ = Motor::ERROR_NONE;
         axis.controller_.error_ = Controller::ERROR_NONE;
         axis.sensorless_estimator_.error_ = SensorlessEstimator::ERROR_NONE;
+        axis.hfi_estimator_.error_ = HfiEstimator::ERROR_NONE;
         axis.encoder_.error_ = Encoder::ERROR_NONE;
         axis.encoder_.spi_error_rate_ = 0.0f;
         axis.error_ = Axis::ERROR_NONE;
@@ -258,9 +789,20 @@ void vApplicationStackOverflowHook(xTaskHandle *pxTask, signed portCHAR *pcTaskN
     for (;;); // TODO: safe action
 }
 
+void vApplicationGetIdleTaskMemory(StaticTask_t **ppxIdleTaskTCBBuffer, StackType_t **ppxIdleTaskStackBuffer, uint32_t *pulIdleTaskStackSize) {
+    *ppxIdleTaskTCBBuffer = &idle_task_cb;
+    *ppxIdleTaskStackBuffer = idle_task_stack;
+    *pulIdleTaskStackSize = configMINIMAL_STACK_SIZE;
+}
+
 void vApplicationIdleHook(void) {
-    if (odrv.system_stats_.fully_booted) {
-        odrv.system_stats_.uptime = xTaskGetTickCount();
+    // The idle task runs again after every interrupt that doesn't wake a
+    // thread, so the bookkeeping is limited to once per tick.
+    static TickType_t last_tick = 0;
+    TickType_t tick = xTaskGetTickCount();
+    if (odrv.system_stats_.fully_booted && tick != last_tick) {
+        last_tick = tick;
+        odrv.system_stats_.uptime = tick;
         odrv.system_stats_.min_heap_space = xPortGetMinimumEverFreeHeapSize();
 
         uint32_t min_stack_space[AXIS_COUNT];
@@ -271,6 +813,9 @@ void vApplicationIdleHook(void) {
         odrv.system_stats_.max_stack_usage_startup = stack_size_default_task - uxTaskGetStackHighWaterMark(defaultTaskHandle) * sizeof(StackType_t);
         odrv.system_stats_.max_stack_usage_can = odrv.can_.stack_size_ - uxTaskGetStackHighWaterMark(odrv.can_.thread_id_) * sizeof(StackType_t);
         odrv.system_stats_.max_stack_usage_analog =  stack_size_analog_thread - uxTaskGetStackHighWaterMark(analog_thread) * sizeof(StackType_t);
+        if (i2c_thread) {
+            odrv.system_stats_.max_stack_usage_i2c = stack_size_i2c_thread - uxTaskGetStackHighWaterMark(i2c_thread) * sizeof(StackType_t);
+        }
 
         odrv.system_stats_.stack_size_axis = axes[0].stack_size_;
         odrv.system_stats_.stack_size_usb = stack_size_usb_thread;
@@ -278,6 +823,7 @@ void vApplicationIdleHook(void) {
         odrv.system_stats_.stack_size_startup = stack_size_default_task;
         odrv.system_stats_.stack_size_can = odrv.can_.stack_size_;
         odrv.system_stats_.stack_size_analog = stack_size_analog_thread;
+        odrv.system_stats_.stack_size_i2c = stack_size_i2c_thread;
 
         odrv.system_stats_.prio_axis = osThreadGetPriority(axes[0].thread_id_);
         odrv.system_stats_.prio_usb = osThreadGetPriority(usb_thread);
@@ -285,9 +831,19 @@ void vApplicationIdleHook(void) {
         odrv.system_stats_.prio_startup = osThreadGetPriority(defaultTaskHandle);
         odrv.system_stats_.prio_can = osThreadGetPriority(odrv.can_.thread_id_);
         odrv.system_stats_.prio_analog = osThreadGetPriority(analog_thread);
+        if (i2c_thread) {
+            odrv.system_stats_.prio_i2c = osThreadGetPriority(i2c_thread);
+        }
 
         status_led_controller.update();
     }
+
+    // Sleep until the next interrupt. An interrupt that wakes a thread pends
+    // PendSV, which also ends the sleep, so this never delays a thread.
+    if (odrv.config_.enable_idle_sleep) {
+        __DSB();
+        __WFI();
+    }
 }
 }
 
@@ -298,7 +854,9 @@ void vApplicationIdleHook(void) {
  * It should finish as quickly as possible.
  */
 void ODrive::do_fast_checks() {
-    if (!(vbus_voltage >= config_.dc_bus_undervoltage_trip_level))
+    // A sag of a few samples due to the cable inductance must not trip, a
+    // spike above the overvoltage level can damage the hardware
+    if (!(vbus_voltage_filtered >= config_.dc_bus_undervoltage_trip_level))
         disarm_with_error(ERROR_DC_BUS_UNDER_VOLTAGE);
     if (!(vbus_voltage <= config_.dc_bus_overvoltage_trip_level))
         disarm_with_error(ERROR_DC_BUS_OVER_VOLTAGE);
@@ -320,6 +878,95 @@ void ODrive::disarm_with_error(Error error) {
     }
 }
 
+// @brief Runs the full calibration sequence on all axes at the same time.
+// The axes only wait for each other where the combined bus current of their
+// calibration states would exceed config_.calibration_max_bus_current.
+void ODrive::start_concurrent_calibration() {
+    for (auto& axis: axes) {
+        axis.request_state(Axis::AXIS_STATE_FULL_CALIBRATION_SEQUENCE);
+    }
+}
+
+// @brief Reserves bus current for a calibration state of an axis.
+// An axis that runs alone is always allowed, even if it exceeds the budget
+// by itself, such that the calibration can't deadlock.
+bool ODrive::reserve_calibration_bus_current(float bus_current) {
+    bool reserved = false;
+    CRITICAL_SECTION() {
+        if (n_calibrating_axes_ == 0 || calibration_bus_current_ + bus_current <= config_.calibration_max_bus_current) {
+            calibration_bus_current_ += bus_current;
+            n_calibrating_axes_++;
+            reserved = true;
+        }
+    }
+    return reserved;
+}
+
+void ODrive::release_calibration_bus_current(float bus_current) {
+    CRITICAL_SECTION() {
+        n_calibrating_axes_--;
+        // Avoid accumulating rounding errors
+        calibration_bus_current_ = (n_calibrating_axes_ == 0) ? 0.0f : (calibration_bus_current_ - bus_current);
+    }
+}
+
+/**
+ * @brief Moves all axes to the given positions along a straight line in joint
+ * space. The trajectories start on the same control loop cycle and end at the
+ * same time.
+ *
+ * Every axis follows the same normalized trapezoid, scaled by its distance. The
+ * limits of the normalized trapezoid are the tightest of the per-axis limits
+ * divided by the distance of each axis.
+ *
+ * All axes must be in closed loop position control and at rest.
+ */
+bool ODrive::move_coordinated(float pos0, float pos1) {
+    static_assert(AXIS_COUNT == 2, "move_coordinated() takes one position per axis");
+    const float goals[AXIS_COUNT] = {pos0, pos1};
+
+    float vel_limit = INFINITY;
+    float accel_limit = INFINITY;
+    float decel_limit = INFINITY;
+    for (size_t i = 0; i < AXIS_COUNT; ++i) {
+        Controller& controller = axes[i].controller_;
+        if (axes[i].current_state_ != Axis::AXIS_STATE_CLOSED_LOOP_CONTROL
+                || controller.config_.control_mode != Controller::CONTROL_MODE_POSITION_CONTROL
+                || controller.vel_setpoint_ != 0.0f) {
+            return false;
+        }
+        float dist = std::abs(SplitPos::from_float(goals[i]) - controller.pos_setpoint_);
+        if (dist > 0.0f) {
+            const TrapezoidalTrajectory::Config_t& limits = axes[i].trap_traj_.config_;
+            vel_limit = std::min(vel_limit, limits.vel_limit / dist);
+            accel_limit = std::min(accel_limit, limits.accel_limit / dist);
+            decel_limit = std::min(decel_limit, limits.decel_limit / dist);
+        }
+    }
+
+    // The control loop must not pick up one trajectory without the others
+    CRITICAL_SECTION() {
+        for (size_t i = 0; i < AXIS_COUNT; ++i) {
+            Controller& controller = axes[i].controller_;
+            float distance = SplitPos::from_float(goals[i]) - controller.pos_setpoint_;
+            float dist = std::abs(distance);
+            controller.config_.input_mode = Controller::INPUT_MODE_TRAP_TRAJ;
+            controller.input_pos_ = goals[i];
+            controller.input_pos_updated_ = false;
+            if (dist > 0.0f) {
+                controller.trajectory_origin_ = controller.pos_setpoint_;
+                axes[i].trap_traj_.planTrapezoidal(distance, 0.0f, 0.0f,
+                                                   vel_limit * dist, accel_limit * dist, decel_limit * dist);
+                axes[i].trap_traj_.t_ = 0.0f;
+                controller.trajectory_done_ = false;
+            } else {
+                controller.trajectory_done_ = true;
+            }
+        }
+    }
+    return true;
+}
+
 /**
  * @brief Runs the periodic sampling tasks
  * 
@@ -338,12 +985,42 @@ void ODrive::disarm_with_error(Error error) {
  * Time consuming and undeterministic logic/arithmetic should live on
  * control_loop_cb() instead.
  */
-void ODrive::sampling_cb() {
+void ODrive::sampling_cb(uint32_t timestamp) {
     n_evt_sampling_++;
 
     MEASURE_TIME(task_times_.sampling) {
+        // One snapshot of all GPIOs for the hall sensors, the endstops and
+        // the protocols
+        sample_cycles_ = DWT->CYCCNT;
+        for (size_t i = 0; i < sizeof(ports_to_sample) / sizeof(ports_to_sample[0]); ++i) {
+            port_samples_[i] = ports_to_sample[i]->IDR;
+        }
+        uint32_t gpio_states = 0;
+        for (size_t i = 0; i < GPIO_COUNT; ++i) {
+            gpio_states |= (read_sampled_gpio(gpios[i]) ? 1UL : 0UL) << i;
+        }
+        gpio_states_ = gpio_states;
+
+        Stm32SpiArbiter::SpiTask* spi_tasks[AXIS_COUNT];
+        Stm32SpiArbiter* spi_arbiter = nullptr;
+        size_t n_spi_tasks = 0;
+
         for (auto& axis: axes) {
-            axis.encoder_.sample_now();
+            axis.encoder_.sample_now(timestamp);
+
+            // Absolute encoders on the same bus are read in a single batch
+            if (Stm32SpiArbiter::SpiTask* task = axis.encoder_.take_spi_task()) {
+                if (n_spi_tasks && spi_arbiter != axis.encoder_.spi_arbiter_) {
+                    spi_arbiter->transfer_async_batch(spi_tasks, n_spi_tasks);
+                    n_spi_tasks = 0;
+                }
+                spi_arbiter = axis.encoder_.spi_arbiter_;
+                spi_tasks[n_spi_tasks++] = task;
+            }
+        }
+
+        if (n_spi_tasks) {
+            spi_arbiter->transfer_async_batch(spi_tasks, n_spi_tasks);
         }
     }
 }
@@ -366,6 +1043,20 @@ void ODrive::control_loop_cb(uint32_t timestamp) {
     n_evt_control_loop_++;
 
     // TODO: use a configurable component list for most of the following things
+    // Slow tasks run at a fraction of the loop rate according to task_schedule.hpp
+
+    // Before the output ports are reset, because the endstops read the
+    // encoder estimates of the last iteration
+    for (auto& axis : axes) {
+        if (!schedule::endstop_update.is_due(n_evt_control_loop_, axis.axis_num_)) {
+            continue;
+        }
+        MEASURE_TIME(axis.task_times_.endstop_update) {
+            axis.min_endstop_.update();
+            axis.max_endstop_.update();
+            axis.check_endstops();
+        }
+    }
 
     MEASURE_TIME(task_times_.control_loop_misc) {
         // Reset all output ports so that we are certain about the freshness of
@@ -379,9 +1070,11 @@ void ODrive::control_loop_cb(uint32_t timestamp) {
             axis.acim_estimator_.stator_phase_vel_.reset();
             axis.acim_estimator_.stator_phase_.reset();
             axis.controller_.torque_output_.reset();
+            axis.controller_.own_torque_output_.reset();
             axis.encoder_.phase_.reset();
             axis.encoder_.phase_vel_.reset();
             axis.encoder_.pos_estimate_.reset();
+            axis.encoder_.pos_estimate_split_.reset();
             axis.encoder_.vel_estimate_.reset();
             axis.encoder_.pos_circular_.reset();
             axis.motor_.Vdq_setpoint_.reset();
@@ -394,16 +1087,18 @@ void ODrive::control_loop_cb(uint32_t timestamp) {
             axis.sensorless_estimator_.phase_.reset();
             axis.sensorless_estimator_.phase_vel_.reset();
             axis.sensorless_estimator_.vel_estimate_.reset();
-        }
-
-        uart_poll();
-        odrv.oscilloscope_.update();
-    }
-
-    for (auto& axis : axes) {
-        MEASURE_TIME(axis.task_times_.endstop_update) {
-            axis.min_endstop_.update();
-            axis.max_endstop_.update();
+            axis.fused_estimator_.phase_.reset();
+            axis.fused_estimator_.phase_vel_.reset();
+            axis.fused_estimator_.vel_estimate_.reset();
+            axis.fused_estimator_.pos_estimate_.reset();
+            axis.fused_estimator_.pos_circular_.reset();
+            axis.hfi_estimator_.phase_.reset();
+            axis.hfi_estimator_.phase_vel_.reset();
+            axis.hfi_estimator_.vel_estimate_.reset();
+            axis.hfi_estimator_.pos_estimate_.reset();
+            axis.hfi_estimator_.pos_circular_.reset();
+            axis.hfi_estimator_.Idq_setpoint_.reset();
+            axis.hfi_estimator_.Vdq_setpoint_.reset();
         }
     }
 
@@ -423,30 +1118,66 @@ void ODrive::control_loop_cb(uint32_t timestamp) {
 
     for (auto& axis: axes) {
         // Sub-components should use set_error which will propegate to this error_
-        MEASURE_TIME(axis.task_times_.thermistor_update) {
-            axis.motor_.fet_thermistor_.update();
-            axis.motor_.motor_thermistor_.update();
+        if (schedule::thermistor_update.is_due(n_evt_control_loop_, axis.axis_num_)) {
+            MEASURE_TIME(axis.task_times_.thermistor_update) {
+                axis.motor_.fet_thermistor_.update();
+                axis.motor_.motor_thermistor_.update();
+                axis.motor_.update_thermal_current_lim();
+                axis.motor_.check_thermistors();
+            }
         }
 
         MEASURE_TIME(axis.task_times_.encoder_update)
-            axis.encoder_.update();
+            axis.encoder_.update(timestamp);
     }
 
     // Controller of either axis might use the encoder estimate of the other
     // axis so we process both encoders before we continue.
+    // The estimators run as one stage over both axes as well, so that each
+    // stage runs its code for all axes back to back and a controller always
+    // finds the estimates of every axis from this iteration.
+    // The estimator state stays in the per-axis objects instead of arrays
+    // over the axes: every property is bound to a member of its object, and
+    // the F405 has no data cache that could thrash between the axes.
 
     for (auto& axis: axes) {
-        MEASURE_TIME(axis.task_times_.sensorless_estimator_update)
-            axis.sensorless_estimator_.update();
+        // Estimators without a consumer are skipped. The observer starts
+        // over when it is needed again, its old state is meaningless.
+        bool sensorless_in_use = axis.sensorless_estimator_in_use();
+        if (sensorless_in_use && !axis.sensorless_estimator_running_) {
+            axis.sensorless_estimator_.reset();
+        }
+        axis.sensorless_estimator_running_ = sensorless_in_use;
+        if (sensorless_in_use) {
+            MEASURE_TIME(axis.task_times_.sensorless_estimator_update)
+                axis.sensorless_estimator_.update();
+        }
 
+        MEASURE_TIME(axis.task_times_.fused_estimator_update)
+            axis.fused_estimator_.update();
+
+        MEASURE_TIME(axis.task_times_.hfi_estimator_update)
+            axis.hfi_estimator_.update();
+    }
+
+    // The controllers run before all motors as well, since a controller that
+    // shares its torque sets the torque of the other axis.
+    for (auto& axis: axes) {
         MEASURE_TIME(axis.task_times_.controller_update) {
             if (!axis.controller_.update()) { // uses position and velocity from encoder
                 axis.error_ |= Axis::ERROR_CONTROLLER_FAILED;
             }
         }
+    }
 
-        MEASURE_TIME(axis.task_times_.open_loop_controller_update)
-            axis.open_loop_controller_.update(timestamp);
+    for (auto& axis: axes) {
+        if (axis.open_loop_controller_in_use()) {
+            MEASURE_TIME(axis.task_times_.open_loop_controller_update)
+                axis.open_loop_controller_.update(timestamp);
+        } else {
+            // The ramps of the first iteration in use span one period
+            axis.open_loop_controller_.timestamp_ = timestamp;
+        }
 
         MEASURE_TIME(axis.task_times_.motor_update)
             axis.motor_.update(timestamp); // uses torque from controller and phase_vel from encoder
@@ -455,14 +1186,34 @@ void ODrive::control_loop_cb(uint32_t timestamp) {
             axis.motor_.current_control_.update(timestamp); // uses the output of controller_ or open_loop_contoller_ and encoder_ or sensorless_estimator_ or acim_estimator_
     }
 
-    // Tell the axis threads that the control loop has finished
-    for (auto& axis: axes) {
-        if (axis.thread_id_) {
-            osSignalSet(axis.thread_id_, 0x0001);
+    update_energy_counters();
+
+    // All channels are sampled here, after every component updated and before
+    // the output ports are reset in the next iteration
+    odrv.oscilloscope_.update();
+    odrv.telemetry_.update();
+
+    if (schedule::input_mapping_update.is_due(n_evt_control_loop_)) {
+        MEASURE_TIME(task_times_.input_mapping_update) {
+            pwm0_input.update(schedule::input_mapping_update.period());
+            update_analog_mappings(schedule::input_mapping_update.period());
         }
     }
 
-    get_gpio(odrv.config_.error_gpio_pin).write(odrv.any_error());
+    if (schedule::thread_stats_update.is_due(n_evt_control_loop_)) {
+        update_thread_stats();
+    }
+
+    // Wake up axis threads that are waiting for the control loop
+    for (auto& axis: axes) {
+        axis.control_iteration_done_cb();
+    }
+
+    bool any_error = log_errors();
+
+    get_gpio(odrv.config_.error_gpio_pin).write(any_error);
+
+    loop_sample_cycles_ = sample_cycles_;
 }
 
 
@@ -504,33 +1255,45 @@ uint32_t ODrive::get_dma_status(uint8_t stream_num) {
     return (is_reset ? 0 : 0x80000000) | ((channel & 0x7) << 2) | (priority & 0x3);
 }
 
-uint32_t ODrive::get_gpio_states() {
-    // TODO: get values that were sampled synchronously with the control loop
-    uint32_t val = 0;
-    for (size_t i = 0; i < GPIO_COUNT; ++i) {
-        val |= ((gpios[i].read() ? 1UL : 0UL) << i);
+/**
+ * @brief Returns the state of a GPIO at the last sampling_cb(). GPIOs that
+ * are not on a sampled port read as low.
+ */
+bool ODrive::read_sampled_gpio(Stm32Gpio gpio) const {
+    for (size_t i = 0; i < sizeof(ports_to_sample) / sizeof(ports_to_sample[0]); ++i) {
+        if (ports_to_sample[i] == gpio.port_) {
+            return port_samples_[i] & gpio.pin_mask_;
+        }
     }
-    return val;
+    return false;
 }
 
 /**
  * @brief Main thread started from main().
  */
+/**
+ * @brief Brings up the peripherals in an order that lets the slow parts
+ * overlap: USB enumerates in the background, the gate drivers were reset at
+ * the end of board_init() and the current sensor calibration settles while
+ * the communication is started. The axis threads wait for the calibration
+ * themselves (see Axis::wait_for_current_meas()).
+ */
 static void rtos_main(void*) {
-    // Init USB device
-    MX_USB_DEVICE_Init();
+    BootTimes_t& boot = odrv.system_stats_.boot;
 
+    // Init USB device. The host enumerates it while the rest starts up.
+    MX_USB_DEVICE_Init();
 
     // Start ADC for temperature measurements and user measurements
     start_general_purpose_adc();
 
-    //osDelay(100);
-    // Init communications (this requires the axis objects to be constructed)
-    init_communication();
-
-    // Start pwm-in compare modules
-    // must happen after communication is initialized
-    pwm0_input.init();
+    // Try to initialized gate drivers for fault-free startup.
+    // If this does not succeed, a fault will be raised and the idle loop will
+    // periodically attempt to reinit the gate driver.
+    for(auto& axis: axes){
+        axis.motor_.setup();
+    }
+    boot.gate_drivers_ready = micros();
 
     // Set up the CS pins for absolute encoders (TODO: move to GPIO init switch statement)
     for(auto& axis : axes){
@@ -539,50 +1302,42 @@ static void rtos_main(void*) {
         }
     }
 
-    // Try to initialized gate drivers for fault-free startup.
-    // If this does not succeed, a fault will be raised and the idle loop will
-    // periodically attempt to reinit the gate driver.
-    for(auto& axis: axes){
-        axis.motor_.setup();
-    }
-
     for(auto& axis: axes){
         axis.encoder_.setup();
     }
+    boot.encoders_ready = micros();
 
     for(auto& axis: axes){
         axis.acim_estimator_.idq_src_.connect_to(&axis.motor_.Idq_setpoint_);
     }
 
-    // Start PWM and enable adc interrupts/callbacks
+    // Offsets from before a warm restart let the motors become ready without
+    // waiting for the current sensor calibration to settle
+    restore_dc_calib();
+
+    // Start PWM and enable adc interrupts/callbacks. This starts the current
+    // sensor calibration, which needs the gate drivers (they contain the
+    // current sense amplifiers) and the encoders (used by the control loop).
     start_adc_pwm();
     start_analog_thread();
+    boot.adc_pwm_started = micros();
 
-    // Wait for up to 2s for motor to become ready to allow for error-free
-    // startup. This delay gives the current sensor calibration time to
-    // converge. If the DRV chip is unpowered, the motor will not become ready
-    // but we still enter idle state.
-    for (size_t i = 0; i < 2000; ++i) {
-        bool motors_ready = std::all_of(axes.begin(), axes.end(), [](auto& axis) {
-            return axis.motor_.current_meas_.has_value();
-        });
-        if (motors_ready) {
-            break;
-        }
-        osDelay(1);
-    }
+    // Init communications (this requires the axis objects to be constructed)
+    init_communication();
 
-    for (auto& axis: axes) {
-        axis.sensorless_estimator_.error_ &= ~SensorlessEstimator::ERROR_UNKNOWN_CURRENT_MEASUREMENT;
-    }
+    // Start pwm-in compare modules
+    // must happen after communication is initialized
+    pwm0_input.init();
+    boot.communication_ready = micros();
 
     // Start state machine threads. Each thread will go through various calibration
     // procedures and then run the actual controller loops.
-    // TODO: generalize for AXIS_COUNT != 2
     for (size_t i = 0; i < AXIS_COUNT; ++i) {
         axes[i].start_thread();
     }
 
+    assign_thread_slots();
+    boot.threads_started = micros();
     odrv.system_stats_.fully_booted = true;
 
     // Main thread finished starting everything and can delete itself now (yes this is legal).
@@ -595,6 +1350,9 @@ static void rtos_main(void*) {
  * This function gets called from the startup assembly code.
  */
 extern "C" void early_start_checks(void) {
+    // Doesn't return if a firmware image was committed before the reset
+    FW_UPDATE_apply_pending();
+
     if(_reboot_cookie == 0xDEADFE75) {
         /* The STM DFU bootloader enables internal pull-up resistors on PB10 (AUX_H)
         * and PB11 (AUX_L), thereby causing shoot-through on the brake resistor
@@ -675,6 +1433,15 @@ extern "C" int main(void) {
         config_apply_all();
     }
 
+    // Erase the flash for the next save_configuration() now if it needs it,
+    // while stalling the CPU doesn't matter yet
+    if (config_manager.prepare_store() && config_write_all()) {
+        config_manager.reserve_store();
+    } else {
+        config_manager.abort_store();
+    }
+    odrv.system_stats_.boot.config_loaded = micros();
+
     odrv.misconfigured_ = odrv.misconfigured_
             || (odrv.config_.enable_uart_a && !uart_a)
             || (odrv.config_.enable_uart_b && !uart_b)
@@ -684,6 +1451,17 @@ extern "C" int main(void) {
     if (!board_init()) {
         for (;;); // TODO: handle properly
     }
+    odrv.system_stats_.boot.board_init = micros();
+
+    // The event log survives warm restarts for post-mortem analysis. Each
+    // boot is logged with the reset cause flags, which are then cleared so
+    // that the next boot shows only its own cause.
+    if (!event_log.is_valid()) {
+        event_log.reset();
+    }
+    event_log.reset_sources();
+    event_log.push(DWT->CYCCNT, ODrive::EVENT_SOURCE_BOOT, RCC->CSR & 0xfe000000);
+    RCC->CSR |= RCC_CSR_RMVF;
 
     // Init GPIOs according to their configured mode
     for (size_t i = 0; i < GPIO_COUNT; ++i) {
@@ -784,6 +1562,19 @@ extern "C" int main(void) {
                 GPIO_InitStruct.Pull = GPIO_PULLDOWN;
                 GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_LOW;
             } break;
+            case ODriveIntf::GPIO_MODE_STEP_COUNTER: {
+                GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
+                GPIO_InitStruct.Pull = GPIO_PULLDOWN;
+                GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_LOW;
+            } break;
+            case ODriveIntf::GPIO_MODE_SYNC: {
+                GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
+                GPIO_InitStruct.Pull = GPIO_NOPULL;
+                GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_VERY_HIGH;
+                if (odrv.config_.sync_mode == ODriveIntf::SYNC_MODE_DISABLED) {
+                    odrv.misconfigured_ = true;
+                }
+            } break;
             case ODriveIntf::GPIO_MODE_ENC0: {
                 GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
                 GPIO_InitStruct.Pull = GPIO_NOPULL;
@@ -819,24 +1610,28 @@ extern "C" int main(void) {
     }
 
     // Init usb irq binary semaphore, and start with no tokens by removing the starting one.
-    osSemaphoreDef(sem_usb_irq);
+    osSemaphoreStaticDef(sem_usb_irq, &sem_usb_irq_cb);
     sem_usb_irq = osSemaphoreCreate(osSemaphore(sem_usb_irq), 1);
     osSemaphoreWait(sem_usb_irq, 0);
 
-    // Create an event queue for UART
-    osMessageQDef(uart_event_queue, 4, uint32_t);
+    // Create an event queue for UART. Every UART server has at most one RX
+    // and one TX event in the queue, plus one stdout event.
+    osMessageQStaticDef(uart_event_queue, 8, uint32_t, (uint8_t*)uart_event_queue_buf, &uart_event_queue_cb);
     uart_event_queue = osMessageCreate(osMessageQ(uart_event_queue), NULL);
 
     // Create an event queue for USB
-    osMessageQDef(usb_event_queue, 7, uint32_t);
+    // The endpoint streams post at most one event each (only when the thread
+    // waits for them) and the telemetry one, the rest is headroom for
+    // connect/disconnect and stdout events.
+    osMessageQStaticDef(usb_event_queue, 12, uint32_t, (uint8_t*)usb_event_queue_buf, &usb_event_queue_cb);
     usb_event_queue = osMessageCreate(osMessageQ(usb_event_queue), NULL);
 
-    osSemaphoreDef(sem_can);
+    osSemaphoreStaticDef(sem_can, &sem_can_cb);
     sem_can = osSemaphoreCreate(osSemaphore(sem_can), 1);
     osSemaphoreWait(sem_can, 0);
 
     // Create main thread
-    osThreadDef(defaultTask, rtos_main, osPriorityNormal, 0, stack_size_default_task / sizeof(StackType_t));
+    osThreadStaticDef(defaultTask, rtos_main, osPriorityNormal, 0, stack_size_default_task / sizeof(StackType_t), default_task_stack, &default_task_cb);
     defaultTaskHandle = osThreadCreate(osThread(defaultTask), NULL);
 
     // Start scheduler
@@ -3,6 +3,8 @@
 #include "axis.hpp"
 #include "low_level.h"
 #include "odrive_main.h"
+#include "lookup_table.hpp"
+#include "rl_identification.hpp"
 
 #include <algorithm>
 
@@ -78,16 +80,100 @@ struct ResistanceMeasurementControlLaw : AlphaBetaFrameController {
     std::optional<float> test_mod_ = NAN;
 };
 
+/**
+ * @brief Like ResistanceMeasurementControlLaw but along an arbitrary direction
+ * and starting at the expected voltage, so that the integrator only has to
+ * correct the deviation from the stored resistance. This settles within a few
+ * milliseconds. The voltage and current are averaged after settle_samples_.
+ */
+struct ResistanceProbeControlLaw : AlphaBetaFrameController {
+    void reset() final {
+        test_voltage_ = initial_voltage_;
+        test_mod_ = std::nullopt;
+        samples_ = 0;
+        sum_voltage_ = 0.0f;
+        sum_current_ = 0.0f;
+    }
+
+    ODriveIntf::MotorIntf::Error on_measurement(
+            std::optional<float> vbus_voltage,
+            std::optional<float2D> Ialpha_beta,
+            uint32_t input_timestamp) final {
+
+        if (Ialpha_beta.has_value()) {
+            actual_current_ = c_ * Ialpha_beta->first + s_ * Ialpha_beta->second;
+            test_voltage_ += (kI_ * current_meas_period) * (target_current_ - actual_current_);
+            if (++samples_ > settle_samples_) {
+                sum_voltage_ += test_voltage_;
+                sum_current_ += actual_current_;
+            }
+        } else {
+            actual_current_ = 0.0f;
+            test_voltage_ = initial_voltage_;
+        }
+
+        if (std::abs(test_voltage_) > max_voltage_) {
+            test_voltage_ = NAN;
+            return Motor::ERROR_PHASE_RESISTANCE_OUT_OF_RANGE;
+        } else if (!vbus_voltage.has_value()) {
+            return Motor::ERROR_UNKNOWN_VBUS_VOLTAGE;
+        } else {
+            float vfactor = 1.0f / ((2.0f / 3.0f) * *vbus_voltage);
+            test_mod_ = test_voltage_ * vfactor;
+            return Motor::ERROR_NONE;
+        }
+    }
+
+    ODriveIntf::MotorIntf::Error get_alpha_beta_output(
+            uint32_t output_timestamp,
+            std::optional<float2D>* mod_alpha_beta,
+            std::optional<float>* ibus) final {
+        if (!test_mod_.has_value()) {
+            return Motor::ERROR_CONTROLLER_INITIALIZING;
+        } else {
+            *mod_alpha_beta = {c_ * *test_mod_, s_ * *test_mod_};
+            *ibus = *test_mod_ * actual_current_;
+            return Motor::ERROR_NONE;
+        }
+    }
+
+    // @brief Mean voltage over mean current [Ohm], NAN without samples
+    float get_resistance() {
+        return (sum_current_ != 0.0f) ? sum_voltage_ / sum_current_ : NAN;
+    }
+
+    float c_ = 1.0f; // direction of the test current
+    float s_ = 0.0f;
+    float kI_ = 0.0f; // [(V/s)/A]
+    float max_voltage_ = 0.0f;
+    float initial_voltage_ = 0.0f;
+    float target_current_ = 0.0f;
+    uint32_t settle_samples_ = 0;
+
+    float actual_current_ = 0.0f;
+    float test_voltage_ = 0.0f;
+    std::optional<float> test_mod_ = NAN;
+    uint32_t samples_ = 0;
+    float sum_voltage_ = 0.0f;
+    float sum_current_ = 0.0f;
+};
+
 /**
  * @brief This control law toggles rapidly between positive and negative output
  * voltage. By measuring how large the current ripples are, the phase inductance
  * can be determined.
  * 
+ * With a bias current the toggling is superimposed on a DC voltage that is
+ * integrated to track it, which measures the incremental inductance of a
+ * saturated motor. The first settle_samples_ measurements are not evaluated.
+ *
  * TODO: this method assumes a certain synchronization between current measurement and output application
  */
 struct InductanceMeasurementControlLaw : AlphaBetaFrameController {
     void reset() final {
         attached_ = false;
+        samples_ = 0;
+        deltaI_ = 0.0f;
     }
 
     ODriveIntf::MotorIntf::Error on_measurement(
@@ -101,7 +187,16 @@ struct InductanceMeasurementControlLaw : AlphaBetaFrameController {
 
         float Ialpha = Ialpha_beta->first;
 
-        if (attached_) {
+        if (bias_current_ != 0.0f) {
+            bias_voltage_ += (kI * current_meas_period) * (bias_current_ - Ialpha);
+            if (std::abs(bias_voltage_) > max_voltage_) {
+                return Motor::ERROR_PHASE_INDUCTANCE_OUT_OF_RANGE;
+            }
+        }
+
+        if (samples_ < settle_samples_) {
+            samples_++;
+        } else if (attached_) {
             float sign = test_voltage_ >= 0.0f ? 1.0f : -1.0f;
             deltaI_ += -sign * (Ialpha - last_Ialpha_);
         } else {
@@ -121,7 +216,7 @@ struct InductanceMeasurementControlLaw : AlphaBetaFrameController {
     {
         test_voltage_ *= -1.0f;
         float vfactor = 1.0f / ((2.0f / 3.0f) * vbus_voltage);
-        *mod_alpha_beta = {test_voltage_ * vfactor, 0.0f};
+        *mod_alpha_beta = {(bias_voltage_ + test_voltage_) * vfactor, 0.0f};
         *ibus = 0.0f;
         return Motor::ERROR_NONE;
     }
@@ -135,10 +230,16 @@ struct InductanceMeasurementControlLaw : AlphaBetaFrameController {
 
     // Config
     float test_voltage_ = 0.0f;
+    float bias_current_ = 0.0f; // [A]
+    float max_voltage_ = INFINITY; // [V] limit of the bias voltage
+    uint32_t settle_samples_ = 0;
+    const float kI = 10.0f; // [(V/s)/A] bias current tracking
 
     // State
     bool attached_ = false;
     float sign_ = 0;
+    uint32_t samples_ = 0;
+    float bias_voltage_ = 0.0f; // [V] set to the expected value before arming
 
     // Outputs
     uint32_t start_timestamp_ = 0;
@@ -148,6 +249,105 @@ struct InductanceMeasurementControlLaw : AlphaBetaFrameController {
 };
 
 
+/**
+ * @brief This control law drives a bias current through the winding and
+ * superimposes a pseudo random voltage sequence, from which resistance and
+ * inductance are fitted in one pass.
+ *
+ * The excitation flips early when the current deviates more than ripple_
+ * from the bias, which keeps the phase currents from changing their sign.
+ * The first settle_samples_ measurements are not evaluated while the bias
+ * voltage settles.
+ */
+struct RLMeasurementControlLaw : AlphaBetaFrameController {
+    void reset() final {
+        identification_.reset();
+        prbs_ = Prbs7{};
+        samples_ = 0;
+        bias_voltage_ = 0.0f;
+        voltage_ = 0.0f;
+        sum_voltage_ = 0.0f;
+        sum_current_ = 0.0f;
+        test_mod_ = std::nullopt;
+    }
+
+    ODriveIntf::MotorIntf::Error on_measurement(
+            std::optional<float> vbus_voltage,
+            std::optional<float2D> Ialpha_beta,
+            uint32_t input_timestamp) final {
+        if (!Ialpha_beta.has_value()) {
+            return Motor::ERROR_UNKNOWN_CURRENT_MEASUREMENT;
+        } else if (!vbus_voltage.has_value()) {
+            return Motor::ERROR_UNKNOWN_VBUS_VOLTAGE;
+        }
+
+        actual_current_ = Ialpha_beta->first;
+        I_beta_ += (kIBetaFilt * current_meas_period) * (Ialpha_beta->second - I_beta_);
+        if (samples_ >= settle_samples_) {
+            identification_.add_sample(actual_current_, voltage_);
+            sum_voltage_ += voltage_;
+            sum_current_ += actual_current_;
+        }
+        samples_++;
+
+        bias_voltage_ += (kI * current_meas_period) * (target_current_ - actual_current_);
+        if (std::abs(bias_voltage_) > max_voltage_) {
+            return Motor::ERROR_PHASE_RESISTANCE_OUT_OF_RANGE;
+        }
+
+        float excitation = prbs_.next();
+        if (actual_current_ - target_current_ > ripple_) {
+            excitation = -1.0f;
+        } else if (actual_current_ - target_current_ < -ripple_) {
+            excitation = 1.0f;
+        }
+        voltage_ = bias_voltage_ + test_voltage_ * excitation;
+        test_mod_ = voltage_ / ((2.0f / 3.0f) * *vbus_voltage);
+        return Motor::ERROR_NONE;
+    }
+
+    ODriveIntf::MotorIntf::Error get_alpha_beta_output(
+            uint32_t output_timestamp,
+            std::optional<float2D>* mod_alpha_beta,
+            std::optional<float>* ibus) final {
+        if (!test_mod_.has_value()) {
+            return Motor::ERROR_CONTROLLER_INITIALIZING;
+        } else {
+            *mod_alpha_beta = {*test_mod_, 0.0f};
+            *ibus = *test_mod_ * actual_current_;
+            return Motor::ERROR_NONE;
+        }
+    }
+
+    // @brief Mean voltage and current of the evaluated samples
+    float2D get_operating_point() {
+        float n = (float)std::max<uint32_t>(samples_ - std::min(samples_, settle_samples_), 1);
+        return {sum_voltage_ / n, sum_current_ / n};
+    }
+
+    const float kI = 10.0f; // [(V/s)/A]
+    const float kIBetaFilt = 80.0f;
+
+    // Config
+    float target_current_ = 0.0f; // [A]
+    float test_voltage_ = 0.0f; // [V] excitation amplitude
+    float ripple_ = 0.0f; // [A]
+    float max_voltage_ = 0.0f; // [V] limit of the bias voltage
+    uint32_t settle_samples_ = 0;
+
+    // State
+    RLIdentification identification_;
+    Prbs7 prbs_;
+    uint32_t samples_ = 0;
+    float bias_voltage_ = 0.0f;
+    float voltage_ = 0.0f; // [V] applied until the next measurement
+    float actual_current_ = 0.0f;
+    float sum_voltage_ = 0.0f;
+    float sum_current_ = 0.0f;
+    float I_beta_ = 0.0f; // [A] low pass filtered Ibeta response
+    std::optional<float> test_mod_ = std::nullopt;
+};
+
 Motor::Motor(TIM_HandleTypeDef* timer,
              uint8_t current_sensor_mask,
              float shunt_conductance,
@@ -201,6 +401,7 @@ bool Motor::arm(PhaseControlLaw<3>* control_law) {
         // Reset controller states, integrators, setpoints, etc.
         axis_->controller_.reset();
         axis_->acim_estimator_.rotor_flux_ = 0.0f;
+        fw_id_ = 0.0f;
         if (control_law_) {
             control_law_->reset();
         }
@@ -299,6 +500,25 @@ void Motor::update_current_controller_gains() {
     float p_gain = config_.current_control_bandwidth * config_.phase_inductance;
     float plant_pole = config_.phase_resistance / config_.phase_inductance;
     current_control_.pi_gains_ = {p_gain, plant_pole * p_gain};
+
+    // Without overmodulation the output must stay in the linear range
+    float max_modulation = config_.svm_overmodulation == SVM_OVERMODULATION_NONE ? 1.0f : 2.0f / std::sqrt(3.0f);
+    current_control_.max_modulation_ = std::clamp(config_.max_modulation, 0.0f, max_modulation);
+    current_control_.back_calculation_ = config_.anti_windup == ANTI_WINDUP_BACK_CALCULATION;
+    current_control_.integrator_decay_ = std::clamp(config_.integrator_decay, 0.0f, 1.0f);
+    current_control_.svm_overmodulation_ = (SvmOvermodulation_t)config_.svm_overmodulation;
+    current_control_.inverter_drop_ = std::max(config_.inverter_drop, 0.0f);
+    current_control_.inverter_drop_band_ = std::max(config_.inverter_drop_band, 0.0f);
+    current_control_.inverter_drop_comp_ = config_.inverter_drop_comp_enable;
+    current_control_.deadbeat_ = config_.current_control_mode == CURRENT_CONTROL_MODE_DEADBEAT
+                              && config_.phase_inductance > 0.0f;
+    current_control_.deadbeat_gain_ = std::clamp(config_.deadbeat_gain, 0.0f, 1.0f);
+    current_control_.model_R_ = config_.phase_resistance;
+    current_control_.model_L_ = config_.phase_inductance;
+    // Same back EMF constant as the bEMF_FF_enable feedforward. The rotor flux
+    // of an induction motor isn't modelled, the integrator covers it.
+    current_control_.model_flux_ = (config_.motor_type == MOTOR_TYPE_ACIM || config_.pole_pairs == 0) ? 0.0f
+            : (2.0f / 3.0f) * (config_.torque_constant / config_.pole_pairs);
 }
 
 bool Motor::apply_config() {
@@ -312,6 +532,7 @@ bool Motor::apply_config() {
 bool Motor::setup() {
     fet_thermistor_.update();
     motor_thermistor_.update();
+    update_thermal_current_lim();
 
     // Solve for exact gain, then snap down to have equal or larger range as requested
     // or largest possible range otherwise
@@ -326,6 +547,7 @@ bool Motor::setup() {
 
     // Values for current controller
     phase_current_rev_gain_ = 1.0f / actual_gain;
+    update_adc_conversion();
     // Clip all current control to actual usable range
     max_allowed_current_ = max_unity_gain_current * phase_current_rev_gain_;
 
@@ -340,6 +562,9 @@ bool Motor::setup() {
 void Motor::disarm_with_error(Motor::Error error){
     error_ |= error;
     axis_->error_ |= Axis::ERROR_MOTOR_FAILED;
+    uint32_t cycles = DWT->CYCCNT;
+    event_log.track(cycles, axis_event_source(ODrive::EVENT_SOURCE_MOTOR0, axis_->axis_num_), error_);
+    event_log.track(cycles, axis_event_source(ODrive::EVENT_SOURCE_AXIS0, axis_->axis_num_), axis_->error_);
     last_error_time_ = odrv.n_evt_control_loop_ * current_meas_period;
     disarm();
 }
@@ -351,6 +576,13 @@ bool Motor::do_checks(uint32_t timestamp) {
         disarm_with_error(ERROR_DRV_FAULT);
         return false;
     }
+    return true;
+}
+
+// @brief Checks the temperature limits. The temperatures only change when the
+// thermistors are updated, so this runs right after that instead of on every
+// control loop iteration.
+bool Motor::check_thermistors() {
     if (!motor_thermistor_.do_checks()) {
         disarm_with_error(ERROR_MOTOR_THERMISTOR_OVER_TEMP);
         return false;
@@ -362,50 +594,102 @@ bool Motor::do_checks(uint32_t timestamp) {
     return true;
 }
 
+// @brief Evaluates the derating of the thermistor current limiters. Their
+// limits only change when the thermistors are updated, so this runs right
+// after that (see check_thermistors()) and the control loop only applies the
+// result in effective_current_lim().
+void Motor::update_thermal_current_lim() {
+    // The limiters scale their base limit, so a base of 1 gives the factor
+    thermal_current_lim_factor_ = std::min(motor_thermistor_.get_current_limit(1.0f),
+                                           fet_thermistor_.get_current_limit(1.0f));
+}
+
+// @brief Combines the configured, hardware and thermal current limits and
+// derives the torque limit from them. Runs once per control loop iteration
+// before the controller and the current controller, which read the results
+// from effective_current_lim_ and max_available_torque().
 float Motor::effective_current_lim() {
     // Configured limit
     float current_lim = config_.current_lim;
     // Hardware limit
     if (axis_->motor_.config_.motor_type == Motor::MOTOR_TYPE_GIMBAL) {
-        current_lim = std::min(current_lim, 0.98f*one_by_sqrt3*vbus_voltage); //gimbal motor is voltage control
+        current_lim = std::min(current_lim, 0.98f*one_by_sqrt3*vbus_voltage_filtered); //gimbal motor is voltage control
     } else {
         current_lim = std::min(current_lim, axis_->motor_.max_allowed_current_);
     }
 
     // Apply thermistor current limiters
-    current_lim = std::min(current_lim, motor_thermistor_.get_current_limit(config_.current_lim));
-    current_lim = std::min(current_lim, fet_thermistor_.get_current_limit(config_.current_lim));
+    current_lim = std::min(current_lim, config_.current_lim * thermal_current_lim_factor_);
     effective_current_lim_ = current_lim;
 
-    return effective_current_lim_;
-}
-
-//return the maximum available torque for the motor.
-//Note - for ACIM motors, available torque is allowed to be 0.
-float Motor::max_available_torque() {
+    //Note - for ACIM motors, available torque is allowed to be 0.
+    float max_torque = effective_current_lim_ * config_.torque_constant;
     if (config_.motor_type == Motor::MOTOR_TYPE_ACIM) {
-        float max_torque = effective_current_lim_ * config_.torque_constant * axis_->acim_estimator_.rotor_flux_;
-        max_torque = std::clamp(max_torque, 0.0f, config_.torque_lim);
-        return max_torque;
-    } else {
-        float max_torque = effective_current_lim_ * config_.torque_constant;
-        max_torque = std::clamp(max_torque, 0.0f, config_.torque_lim);
-        return max_torque;
+        max_torque *= axis_->acim_estimator_.rotor_flux_;
     }
+    max_available_torque_ = std::clamp(max_torque, 0.0f, config_.torque_lim);
+
+    return effective_current_lim_;
 }
 
-std::optional<float> Motor::phase_current_from_adcval(uint32_t ADCValue) {
-    // Make sure the measurements don't come too close to the current sensor's hardware limitations
-    if (ADCValue < CURRENT_ADC_LOWER_BOUND || ADCValue > CURRENT_ADC_UPPER_BOUND) {
+// @brief Converts the raw phase B and C ADC values to DC calibrated phase
+// currents with the scale and offsets from update_adc_conversion().
+std::optional<Iph_ABC_t> Motor::phase_currents_from_adcvals(uint32_t adc_phB, uint32_t adc_phC) {
+    // Make sure the measurements don't come too close to the current sensor's
+    // hardware limitations. The unsigned wrap-around checks both bounds at once.
+    constexpr uint32_t range = CURRENT_ADC_UPPER_BOUND - CURRENT_ADC_LOWER_BOUND;
+    if ((adc_phB - CURRENT_ADC_LOWER_BOUND) > range || (adc_phC - CURRENT_ADC_LOWER_BOUND) > range) {
         error_ |= ERROR_CURRENT_SENSE_SATURATION;
         return std::nullopt;
     }
 
-    int adcval_bal = (int)ADCValue - (1 << 11);
-    float amp_out_volt = (3.3f / (float)(1 << 12)) * (float)adcval_bal;
-    float shunt_volt = amp_out_volt * phase_current_rev_gain_;
-    float current = shunt_volt * shunt_conductance_;
-    return current;
+    float phB = ((float)adc_phB - adc_offset_phB_) * adc_to_amps_;
+    float phC = ((float)adc_phC - adc_offset_phC_) * adc_to_amps_;
+    return Iph_ABC_t{-phB - phC, phB, phC};
+}
+
+// @brief Replaces the shunt samples that fell into a too short low-side on
+// time, see config_.min_current_sense_window. The board has shunts on phases
+// B and C, so phase A is always reconstructed.
+Iph_ABC_t Motor::reconstruct_phase_currents(const Iph_ABC_t& measured) {
+    // The sampled zero vector straddles the update event at which the last
+    // timings were loaded
+    float windows[3];
+    for (size_t i = 0; i < 3; ++i) {
+        windows[i] = std::min(pwm_state_.timings[i], prev_pwm_timings_[i]);
+    }
+    float min_window = config_.min_current_sense_window
+            * (float)TIM_1_8_CLOCK_HZ / (float)(2 * tim_1_8_period_clocks);
+
+    // Prediction: the currents of the last period rotated by the electrical
+    // angle travelled since
+    float I_alpha = pwm_state_.currents[0];
+    float I_beta = one_by_sqrt3 * (pwm_state_.currents[1] - pwm_state_.currents[2]);
+    float c, s;
+    our_arm_sin_cos_f32(current_control_.phase_vel_.value_or(0.0f) * current_meas_period, &s, &c);
+    float I_alpha_next = c * I_alpha - s * I_beta;
+    float I_beta_next = s * I_alpha + c * I_beta;
+    float predicted[3] = {
+        I_alpha_next,
+        -0.5f * I_alpha_next + sqrt3_by_2 * I_beta_next,
+        -0.5f * I_alpha_next - sqrt3_by_2 * I_beta_next
+    };
+
+    const std::optional<float> shunts[3] = {std::nullopt, measured.phB, measured.phC};
+    float out[3];
+    if (::reconstruct_phase_currents(shunts, windows, min_window, predicted, out) < 2) {
+        n_predicted_current_samples_++;
+    }
+    return Iph_ABC_t{out[0], out[1], out[2]};
+}
+
+// @brief Folds the amplifier gain, the shunt and DC_calib_ into the scale and
+// offsets used by phase_currents_from_adcvals().
+void Motor::update_adc_conversion() {
+    adc_to_amps_ = (3.3f / (float)(1 << 12)) * phase_current_rev_gain_ * shunt_conductance_;
+    float amps_to_adc = (adc_to_amps_ != 0.0f) ? 1.0f / adc_to_amps_ : 0.0f;
+    adc_offset_phB_ = (float)(1 << 11) + DC_calib_.phB * amps_to_adc;
+    adc_offset_phC_ = (float)(1 << 11) + DC_calib_.phC * amps_to_adc;
 }
 
 //--------------------------------
@@ -487,17 +771,214 @@ bool Motor::measure_phase_inductance(float test_voltage) {
 }
 
 
+/**
+ * @brief Measures phase resistance and inductance in one pass, replacing
+ * measure_phase_resistance() and measure_phase_inductance().
+ *
+ * The fit only sees the winding, so the difference of the mean voltage to the
+ * resistive drop is the inverter drop (4/3 of it in alpha, see
+ * measure_inverter_drop()), which is stored if inverter_drop_calib_enable.
+ */
+bool Motor::measure_phase_resistance_inductance(float test_current, float max_voltage) {
+    RLMeasurementControlLaw control_law;
+    control_law.target_current_ = test_current;
+    control_law.test_voltage_ = 0.5f * max_voltage;
+    control_law.ripple_ = 0.25f * std::abs(test_current);
+    control_law.max_voltage_ = max_voltage;
+    control_law.settle_samples_ = (uint32_t)(0.1f * current_meas_hz);
+
+    arm(&control_law);
+
+    for (size_t i = 0; i < 300; ++i) {
+        if (!((axis_->requested_state_ == Axis::AXIS_STATE_UNDEFINED) && axis_->motor_.is_armed_)) {
+            break;
+        }
+        osDelay(1);
+    }
+
+    bool success = is_armed_;
+    disarm();
+    if (!success) {
+        return false;
+    }
+
+    RLIdentification& identification = control_law.identification_;
+    if (!identification.fit(current_meas_period)) {
+        disarm_with_error(ERROR_PHASE_RESISTANCE_OUT_OF_RANGE);
+        return false;
+    }
+    calibration_fit_quality_ = identification.quality;
+    if (!(identification.quality >= config_.fast_calibration_min_quality)) {
+        disarm_with_error(ERROR_POOR_CALIBRATION_FIT);
+        return false;
+    }
+    if (!(identification.inductance >= 2e-6f && identification.inductance <= 4000e-6f)) {
+        error_ |= ERROR_PHASE_INDUCTANCE_OUT_OF_RANGE;
+        return false;
+    }
+    if (is_nan(control_law.I_beta_) || (abs(control_law.I_beta_) / test_current) > 0.2f) {
+        disarm_with_error(ERROR_UNBALANCED_PHASES);
+        return false;
+    }
+
+    config_.phase_resistance = identification.resistance;
+    config_.phase_inductance = identification.inductance;
+    if (config_.inverter_drop_calib_enable) {
+        auto [V, I] = control_law.get_operating_point();
+        config_.inverter_drop = std::max(0.75f * (V - identification.resistance * I), 0.0f);
+    }
+    return true;
+}
+
+/**
+ * @brief Separates the inverter drop from the phase resistance.
+ *
+ * Must run after measure_phase_resistance(test_current, ...). Repeats the
+ * measurement at half the current. With phase A carrying the test current and
+ * B and C half of it in the other direction, all three phases outside of the
+ * blanking band, the alpha voltage is R * I + 4/3 * drop, so the two points
+ * give both. Updates phase_resistance and inverter_drop.
+ */
+bool Motor::measure_inverter_drop(float test_current, float max_voltage) {
+    float I1 = test_current;
+    float V1 = config_.phase_resistance * I1;
+    float I2 = 0.5f * test_current;
+
+    ResistanceMeasurementControlLaw control_law;
+    control_law.target_current_ = I2;
+    control_law.max_voltage_ = max_voltage;
+
+    arm(&control_law);
+
+    for (size_t i = 0; i < 3000; ++i) {
+        if (!((axis_->requested_state_ == Axis::AXIS_STATE_UNDEFINED) && axis_->motor_.is_armed_)) {
+            break;
+        }
+        osDelay(1);
+    }
+
+    bool success = is_armed_;
+    disarm();
+    if (!success) {
+        return false;
+    }
+
+    float V2 = control_law.get_resistance() * I2;
+    float R = (V1 - V2) / (I1 - I2);
+    if (is_nan(R) || R <= 0.0f) {
+        disarm_with_error(ERROR_PHASE_RESISTANCE_OUT_OF_RANGE);
+        return false;
+    }
+    config_.phase_resistance = R;
+    config_.inverter_drop = std::max(0.75f * (V1 - R * I1), 0.0f);
+    return true;
+}
+
+/**
+ * @brief Drives test_current along the electrical angle `phase` for `duration`
+ * and returns the phase resistance it measured, NAN if the motor disarmed.
+ *
+ * This is the quick plausibility check of a stored phase_resistance, see
+ * Axis::run_calibration_check(). The stored inverter drop is subtracted (with
+ * its alpha axis factor of 4/3, which is approximate in other directions).
+ */
+float Motor::probe_resistance(float test_current, float phase, float duration) {
+    constexpr float kBandwidth = 200.0f; // [rad/s] of the current integrator
+    float drop = (4.0f / 3.0f) * std::max(config_.inverter_drop, 0.0f);
+
+    ResistanceProbeControlLaw control_law;
+    control_law.c_ = our_arm_cos_f32(phase);
+    control_law.s_ = our_arm_sin_f32(phase);
+    control_law.kI_ = kBandwidth * config_.phase_resistance;
+    control_law.max_voltage_ = config_.resistance_calib_max_voltage;
+    control_law.initial_voltage_ = config_.phase_resistance * test_current + drop;
+    control_law.target_current_ = test_current;
+    control_law.settle_samples_ = (uint32_t)(0.5f * duration * current_meas_hz);
+
+    arm(&control_law);
+
+    for (uint32_t i = 0; i < (uint32_t)(duration * 1000.0f); ++i) {
+        if (!((axis_->requested_state_ == Axis::AXIS_STATE_UNDEFINED) && is_armed_)) {
+            break;
+        }
+        osDelay(1);
+    }
+
+    bool success = is_armed_;
+    disarm();
+    if (!success) {
+        return NAN;
+    }
+
+    return control_law.get_resistance() - drop / test_current;
+}
+
+/**
+ * @brief Measures the inductance at inductance_map_n currents from 0 to
+ * inductance_map_current_max and stores them in inductance_map.
+ *
+ * The bias current in alpha aligns the rotor's d axis with it, so this is the
+ * d axis inductance. It is used for both axes.
+ */
+bool Motor::measure_inductance_map(float test_voltage) {
+    size_t n = std::clamp<size_t>(config_.inductance_map_n, 2, INDUCTANCE_MAP_MAX_SIZE);
+    for (size_t k = 0; k < n; ++k) {
+        float current = config_.inductance_map_current_max * (float)k / (float)(n - 1);
+
+        InductanceMeasurementControlLaw control_law;
+        control_law.test_voltage_ = test_voltage;
+        control_law.bias_current_ = current;
+        control_law.bias_voltage_ = config_.phase_resistance * current;
+        control_law.max_voltage_ = 2.0f * std::abs(control_law.bias_voltage_) + test_voltage;
+        control_law.settle_samples_ = (uint32_t)(0.25f * current_meas_hz);
+
+        arm(&control_law);
+
+        for (size_t i = 0; i < 1500; ++i) {
+            if (!((axis_->requested_state_ == Axis::AXIS_STATE_UNDEFINED) && axis_->motor_.is_armed_)) {
+                break;
+            }
+            osDelay(1);
+        }
+
+        bool success = is_armed_;
+        disarm();
+        if (!success) {
+            return false;
+        }
+
+        float inductance = control_law.get_inductance();
+        if (!(inductance >= 2e-6f && inductance <= 4000e-6f)) {
+            error_ |= ERROR_PHASE_INDUCTANCE_OUT_OF_RANGE;
+            return false;
+        }
+        config_.inductance_map[k] = inductance;
+    }
+    config_.inductance_map_n = n;
+    return true;
+}
+
 // TODO: motor calibration should only be a utility function that's called from
 // the UI on explicit user request. It should take its parameters as input
 // arguments and return the measured results without modifying any config values.
 bool Motor::run_calibration() {
     float R_calib_max_voltage = config_.resistance_calib_max_voltage;
-    if (config_.motor_type == MOTOR_TYPE_HIGH_CURRENT
+    if ((config_.motor_type == MOTOR_TYPE_HIGH_CURRENT
+        || config_.motor_type == MOTOR_TYPE_ACIM) && config_.fast_calibration_enable) {
+        if (!measure_phase_resistance_inductance(config_.calibration_current, R_calib_max_voltage))
+            return false;
+        if (config_.inductance_map_calib_enable && !measure_inductance_map(R_calib_max_voltage))
+            return false;
+    } else if (config_.motor_type == MOTOR_TYPE_HIGH_CURRENT
         || config_.motor_type == MOTOR_TYPE_ACIM) {
         if (!measure_phase_resistance(config_.calibration_current, R_calib_max_voltage))
             return false;
+        if (config_.inverter_drop_calib_enable && !measure_inverter_drop(config_.calibration_current, R_calib_max_voltage))
+            return false;
         if (!measure_phase_inductance(R_calib_max_voltage))
             return false;
+        if (config_.inductance_map_calib_enable && !measure_inductance_map(R_calib_max_voltage))
+            return false;
     } else if (config_.motor_type == MOTOR_TYPE_GIMBAL) {
         // no calibration needed
     } else {
@@ -535,9 +1016,51 @@ void Motor::update(uint32_t timestamp) {
         id = std::clamp(id, -ilim*0.99f, ilim*0.99f); // 1% space reserved for Iq to avoid numerical issues
     }
 
+    bool use_id_table = config_.id_table_n_torque && config_.id_table_n_speed;
+    bool shape_id = (config_.motor_type == Motor::MOTOR_TYPE_HIGH_CURRENT)
+                 && (use_id_table || config_.field_weakening_enable);
+    if (shape_id) {
+        // Not the ACIM stator velocity, so it's valid before the estimator update
+        std::optional<float> phase_vel = phase_vel_src_.present();
+        if (use_id_table && !phase_vel.has_value()) {
+            error_ |= ERROR_UNKNOWN_PHASE_VEL;
+            return;
+        }
+
+        if (config_.field_weakening_enable) {
+            // The ratio is limited such that a transient in the current
+            // controller doesn't wind the loop up instantly
+            float excess = std::min(current_control_.mod_ratio_, 2.0f) - config_.field_weakening_threshold;
+            fw_id_ -= config_.field_weakening_gain * excess * current_meas_period;
+            fw_id_ = std::clamp(fw_id_, -std::abs(config_.field_weakening_max_id), 0.0f);
+        } else {
+            fw_id_ = 0.0f;
+        }
+
+        id = fw_id_;
+        if (use_id_table) {
+            id += interp2d(config_.id_table, ID_TABLE_MAX_SIZE,
+                    std::min<size_t>(config_.id_table_n_torque, ID_TABLE_MAX_SIZE),
+                    std::min<size_t>(config_.id_table_n_speed, ID_TABLE_MAX_SIZE),
+                    config_.id_table_torque_max, config_.id_table_speed_max,
+                    std::abs(torque), std::abs(*phase_vel));
+        }
+        id = std::clamp(id, -ilim*0.99f, ilim*0.99f);
+    } else if (config_.motor_type == Motor::MOTOR_TYPE_HIGH_CURRENT) {
+        // Release the Id of a table or loop that was disabled while running
+        fw_id_ = 0.0f;
+        id = 0.0f;
+    }
+
     // Convert requested torque to current
     if (axis_->motor_.config_.motor_type == Motor::MOTOR_TYPE_ACIM) {
         iq = torque / (axis_->motor_.config_.torque_constant * std::max(axis_->acim_estimator_.rotor_flux_, config_.acim_gain_min_flux));
+    } else if (shape_id) {
+        // Reluctance torque 3/2 * pole_pairs * (Ld - Lq) * Id * Iq. The floor
+        // keeps the conversion finite if the table overshoots.
+        float kt = config_.torque_constant;
+        float kt_eff = kt + 1.5f * (float)config_.pole_pairs * config_.saliency_inductance * id;
+        iq = torque / std::max(kt_eff, 0.1f * kt);
     } else {
         iq = torque / axis_->motor_.config_.torque_constant;
     }
@@ -551,13 +1074,34 @@ void Motor::update(uint32_t timestamp) {
         Idq_setpoint_ = {id, iq};
     }
 
+    // Schedule the current controller with the inductance at this current
+    float phase_inductance = config_.phase_inductance;
+    if (config_.inductance_map_enable && config_.inductance_map_n >= 2
+            && config_.motor_type != Motor::MOTOR_TYPE_GIMBAL) {
+        phase_inductance = interp1d(config_.inductance_map,
+                std::min<size_t>(config_.inductance_map_n, INDUCTANCE_MAP_MAX_SIZE),
+                config_.inductance_map_current_max, std::sqrt(SQ(id) + SQ(iq)));
+        float p_gain = config_.current_control_bandwidth * phase_inductance;
+        float i_gain = config_.current_control_bandwidth * config_.phase_resistance;
+        CRITICAL_SECTION() {
+            current_control_.pi_gains_ = {p_gain, i_gain};
+            current_control_.model_L_ = phase_inductance;
+        }
+    }
+    phase_inductance_ = phase_inductance;
+
     // This update call is in bit a weird position because it depends on the
     // Id,q setpoint but outputs the phase velocity that we depend on later
     // in this function.
     // A cleaner fix would be to take the feedforward calculation out of here
     // and turn it into a separate component.
-    MEASURE_TIME(axis_->task_times_.acim_estimator_update)
-        axis_->acim_estimator_.update(timestamp);
+    if (axis_->acim_estimator_in_use()) {
+        MEASURE_TIME(axis_->task_times_.acim_estimator_update)
+            axis_->acim_estimator_.update(timestamp);
+    } else {
+        // Same as missing inputs: initialize again on the next use
+        axis_->acim_estimator_.active_ = false;
+    }
 
     float vd = 0.0f;
     float vq = 0.0f;
@@ -570,8 +1114,8 @@ void Motor::update(uint32_t timestamp) {
             return;
         }
 
-        vd -= *phase_vel * config_.phase_inductance * iq;
-        vq += *phase_vel * config_.phase_inductance * id;
+        vd -= *phase_vel * phase_inductance * iq;
+        vq += *phase_vel * phase_inductance * id;
         vd += config_.phase_resistance * id;
         vq += config_.phase_resistance * iq;
     }
@@ -584,7 +1128,10 @@ void Motor::update(uint32_t timestamp) {
 
         vq += *phase_vel * (2.0f/3.0f) * (config_.torque_constant / config_.pole_pairs);
     }
-    
+
+    // Square wave of the HFI estimator, zero while it's inactive
+    vd += axis_->hfi_estimator_.injection_voltage_;
+
     if (axis_->motor_.config_.motor_type == Motor::MOTOR_TYPE_GIMBAL) {
         // reinterpret current as voltage
         Vdq_setpoint_ = {vd + id, vq + iq};
@@ -594,6 +1141,33 @@ void Motor::update(uint32_t timestamp) {
 }
 
 
+bool Motor::set_id_table_point(uint32_t torque_index, uint32_t speed_index, float id) {
+    if (torque_index >= ID_TABLE_MAX_SIZE || speed_index >= ID_TABLE_MAX_SIZE) {
+        return false;
+    }
+    config_.id_table[torque_index * ID_TABLE_MAX_SIZE + speed_index] = id;
+    return true;
+}
+
+float Motor::get_id_table_point(uint32_t torque_index, uint32_t speed_index) {
+    if (torque_index >= ID_TABLE_MAX_SIZE || speed_index >= ID_TABLE_MAX_SIZE) {
+        return 0.0f;
+    }
+    return config_.id_table[torque_index * ID_TABLE_MAX_SIZE + speed_index];
+}
+
+bool Motor::set_inductance_map_point(uint32_t index, float inductance) {
+    if (index >= INDUCTANCE_MAP_MAX_SIZE) {
+        return false;
+    }
+    config_.inductance_map[index] = inductance;
+    return true;
+}
+
+float Motor::get_inductance_map_point(uint32_t index) {
+    return index < INDUCTANCE_MAP_MAX_SIZE ? config_.inductance_map[index] : 0.0f;
+}
+
 /**
  * @brief Called when the underlying hardware timer triggers an update event.
  */
@@ -604,7 +1178,7 @@ void Motor::current_meas_cb(uint32_t timestamp, std::optional<Iph_ABC_t> current
 
     n_evt_current_measurement_++;
 
-    bool dc_calib_valid = (dc_calib_running_since_ >= config_.dc_calib_tau * 7.5f)
+    bool dc_calib_valid = dc_calib_settled_
                        && (abs(DC_calib_.phA) < max_dc_calib_)
                        && (abs(DC_calib_.phB) < max_dc_calib_)
                        && (abs(DC_calib_.phC) < max_dc_calib_);
@@ -613,11 +1187,11 @@ void Motor::current_meas_cb(uint32_t timestamp, std::optional<Iph_ABC_t> current
         current_meas_ = {0.0f, 0.0f, 0.0f};
         armed_state_ += 1;
     } else if (current.has_value() && dc_calib_valid) {
-        current_meas_ = {
-            current->phA - DC_calib_.phA,
-            current->phB - DC_calib_.phB,
-            current->phC - DC_calib_.phC
-        };
+        // DC_calib_ is already subtracted by the ADC conversion
+        current_meas_ = current;
+        if (config_.min_current_sense_window > 0.0f && pwm_state_.active) {
+            current_meas_ = reconstruct_phase_currents(*current);
+        }
     } else {
         current_meas_ = std::nullopt;
     }
@@ -650,7 +1224,7 @@ void Motor::current_meas_cb(uint32_t timestamp, std::optional<Iph_ABC_t> current
     }
 
     if (control_law_) {
-        Error err = control_law_->on_measurement(vbus_voltage,
+        Error err = control_law_->on_measurement(vbus_voltage_modulation,
                             current_meas_.has_value() ?
                                 std::make_optional(std::array<float, 3>{current_meas_->phA, current_meas_->phB, current_meas_->phC})
                                 : std::nullopt,
@@ -659,27 +1233,76 @@ void Motor::current_meas_cb(uint32_t timestamp, std::optional<Iph_ABC_t> current
             disarm_with_error(err);
         }
     }
+
+    // Publish a consistent view of this cycle for the control loop and the
+    // protocol which would otherwise risk reading half-updated values.
+    Sample_t sample;
+    sample.timestamp = timestamp;
+    sample.current_meas = current_meas_;
+    sample.Id_measured = current_control_.Id_measured_;
+    sample.Iq_measured = current_control_.Iq_measured_;
+    sample.final_v_alpha = current_control_.final_v_alpha_;
+    sample.final_v_beta = current_control_.final_v_beta_;
+    sample.I_bus = I_bus_;
+    sample_.publish(sample);
 }
 
 /**
  * @brief Called when the underlying hardware timer triggers an update event.
  */
 void Motor::dc_calib_cb(uint32_t timestamp, std::optional<Iph_ABC_t> current) {
-    const float dc_calib_period = static_cast<float>(2 * TIM_1_8_PERIOD_CLOCKS * (TIM_1_8_RCR + 1)) / TIM_1_8_CLOCK_HZ;
+    const float dc_calib_period = current_meas_period;
     TaskTimerContext tmr{axis_->task_times_.dc_calib};
 
     if (current.has_value()) {
-        const float calib_filter_k = std::min(dc_calib_period / config_.dc_calib_tau, 1.0f);
-        DC_calib_.phA += (current->phA - DC_calib_.phA) * calib_filter_k;
-        DC_calib_.phB += (current->phB - DC_calib_.phB) * calib_filter_k;
-        DC_calib_.phC += (current->phC - DC_calib_.phC) * calib_filter_k;
-        dc_calib_running_since_ += dc_calib_period;
+        if (dc_calib_running_since_ == 0.0f && DC_calib_retained_.has_value()) {
+            // Warm restart: continue tracking from the offsets before the reset
+            DC_calib_ = *DC_calib_retained_;
+            DC_calib_retained_ = std::nullopt;
+            dc_calib_running_since_ = config_.dc_calib_tau * kDcCalibSettlingTime;
+            update_adc_conversion();
+            return;
+        }
+
+        // The current is converted with the present DC_calib_ already
+        // subtracted, so it is the remaining offset.
+        // While armed this sample is taken when no current flows through the
+        // shunts. While disarmed this is only true if the motor doesn't spin
+        // fast enough to conduct through the body diodes.
+        bool plausible = is_armed_ || !dc_calib_settled_
+                      || ((std::abs(current->phA) < config_.dc_calib_max_residual)
+                       && (std::abs(current->phB) < config_.dc_calib_max_residual)
+                       && (std::abs(current->phC) < config_.dc_calib_max_residual));
+        if (plausible) {
+            const float calib_tau = dc_calib_settled_ ? config_.dc_calib_tracking_tau : config_.dc_calib_tau;
+            // Until one time constant has passed the offsets are the plain
+            // average of all samples so far. This is as precise as the filter
+            // but doesn't have to decay from the initial value of zero.
+            const float n_samples = dc_calib_running_since_ / dc_calib_period + 1.0f;
+            const float calib_filter_k = std::min(std::max(dc_calib_period / calib_tau, 1.0f / n_samples), 1.0f);
+            DC_calib_.phA += current->phA * calib_filter_k;
+            DC_calib_.phB += current->phB * calib_filter_k;
+            DC_calib_.phC += current->phC * calib_filter_k;
+            dc_calib_running_since_ += dc_calib_period;
+        }
     } else {
         DC_calib_.phA = 0.0f;
         DC_calib_.phB = 0.0f;
         DC_calib_.phC = 0.0f;
         dc_calib_running_since_ = 0.0f;
     }
+
+    bool settled = dc_calib_running_since_ >= config_.dc_calib_tau * kDcCalibSettlingTime;
+    if (settled && !dc_calib_settled_) {
+        DC_calib_settled_ = DC_calib_;
+    }
+    dc_calib_settled_ = settled;
+    dc_calib_drift_ = settled ? std::max({
+        std::abs(DC_calib_.phA - DC_calib_settled_.phA),
+        std::abs(DC_calib_.phB - DC_calib_settled_.phB),
+        std::abs(DC_calib_.phC - DC_calib_settled_.phC)}) : 0.0f;
+
+    update_adc_conversion();
 }
 
 
@@ -698,12 +1321,53 @@ void Motor::pwm_update_cb(uint32_t output_timestamp) {
 
     // Apply control law to calculate PWM duty cycles
     if (is_armed_ && control_law_status == ERROR_NONE) {
+        for (size_t i = 0; i < 3; ++i) {
+            prev_pwm_timings_[i] = pwm_state_.timings[i];
+        }
+        pwm_state_.timings[0] = pwm_timings[0];
+        pwm_state_.timings[1] = pwm_timings[1];
+        pwm_state_.timings[2] = pwm_timings[2];
+        if (current_meas_.has_value()) {
+            pwm_state_.currents[0] = current_meas_->phA;
+            pwm_state_.currents[1] = current_meas_->phB;
+            pwm_state_.currents[2] = current_meas_->phC;
+        }
+
+        // Move the zero vectors such that the active vectors of this motor
+        // overlap least with those of the other motors. The motors
+        // take turns, each one uses the latest timings of the others.
+        zero_vector_shift_ = 0.0f;
+        if (odrv.config_.enable_bus_ripple_minimization) {
+            InverterPwm_t others[AXIS_COUNT];
+            size_t n_others = 0;
+            for (size_t i = 0; i < AXIS_COUNT; ++i) {
+                if (&motors[i] != this) {
+                    others[n_others++] = motors[i].pwm_state_;
+                }
+            }
+            const float min_margin = odrv.config_.min_zero_vector_time
+                    * (float)TIM_1_8_CLOCK_HZ / (float)(2 * tim_1_8_period_clocks);
+            zero_vector_shift_ = best_zero_vector_shift(pwm_state_, others, n_others, min_margin, 5);
+            for (size_t i = 0; i < 3; ++i) {
+                pwm_timings[i] -= zero_vector_shift_;
+                pwm_state_.timings[i] = pwm_timings[i];
+            }
+        }
+        pwm_state_.active = true;
+
         uint16_t next_timings[] = {
-            (uint16_t)(pwm_timings[0] * (float)TIM_1_8_PERIOD_CLOCKS),
-            (uint16_t)(pwm_timings[1] * (float)TIM_1_8_PERIOD_CLOCKS),
-            (uint16_t)(pwm_timings[2] * (float)TIM_1_8_PERIOD_CLOCKS)
+            (uint16_t)(pwm_timings[0] * (float)tim_1_8_period_clocks),
+            (uint16_t)(pwm_timings[1] * (float)tim_1_8_period_clocks),
+            (uint16_t)(pwm_timings[2] * (float)tim_1_8_period_clocks)
         };
         apply_pwm_timings(next_timings, false);
+
+        // The timer loads the new compare values at its next update event,
+        // so the actual output changes up to one PWM period later.
+        Controller::InputTag_t& tag = axis_->controller_.applied_input_tag_;
+        if (tag.stats) {
+            tag.stats->record(DWT->CYCCNT - tag.cycles);
+        }
     } else if (is_armed_) {
         if (!(timer_->Instance->BDTR & TIM_BDTR_MOE) && (control_law_status == ERROR_CONTROLLER_INITIALIZING)) {
             // If the PWM output is armed in software but not yet in
@@ -714,9 +1378,12 @@ void Motor::pwm_update_cb(uint32_t output_timestamp) {
         }
     }
 
+    axis_->controller_.applied_input_tag_.stats = nullptr;
+
     if (!is_armed_) {
         // If something above failed, reset I_bus to 0A.
         i_bus = 0.0f;
+        pwm_state_.active = false;
     } else if (is_armed_ && !i_bus.has_value()) {
         // If the motor is armed then i_bus must be known
         disarm_with_error(ERROR_UNKNOWN_CURRENT_MEASUREMENT);
@@ -724,6 +1391,11 @@ void Motor::pwm_update_cb(uint32_t output_timestamp) {
     }
 
     I_bus_ = *i_bus;
+    if (is_armed_ && control_law_ == &current_control_ && vbus_voltage_modulation > 0.0f) {
+        I_bus_predicted_ = current_control_.power_predicted_ / vbus_voltage_modulation;
+    } else {
+        I_bus_predicted_ = I_bus_;
+    }
 
     if (*i_bus < config_.I_bus_hard_min || *i_bus > config_.I_bus_hard_max) {
         disarm_with_error(ERROR_I_BUS_OUT_OF_RANGE);
@@ -7,6 +7,10 @@ class Motor;
 #include <board.h>
 #include <autogen/interfaces.hpp>
 #include "foc.hpp"
+#include "snapshot.hpp"
+#include "bus_ripple.hpp"
+#include "phase_current_reconstruction.hpp"
+#include "config_transaction.hpp"
 
 class Motor : public ODriveIntf::MotorIntf {
 public:
@@ -14,6 +18,21 @@ public:
     // NOTE: for gimbal motors, all units of Nm are instead V.
     // example: vel_gain is [V/(turn/s)] instead of [Nm/(turn/s)]
     // example: current_lim and calibration_current will instead determine the maximum voltage applied to the motor.
+    // Per-cycle sensor state, published by current_meas_cb() for consumers
+    // outside of the current measurement interrupt.
+    struct Sample_t {
+        uint32_t timestamp = 0; // [HCLK ticks] timestamp of the current measurement
+        std::optional<Iph_ABC_t> current_meas; // [A] DC calibrated phase currents
+        float Id_measured = 0.0f; // [A] as reported by current_control_
+        float Iq_measured = 0.0f; // [A] as reported by current_control_
+        float final_v_alpha = 0.0f; // [V] voltage applied up to this measurement
+        float final_v_beta = 0.0f; // [V] voltage applied up to this measurement
+        float I_bus = 0.0f; // [A] bus current contribution up to this measurement
+    };
+
+    static constexpr size_t ID_TABLE_MAX_SIZE = 8;
+    static constexpr size_t INDUCTANCE_MAP_MAX_SIZE = 8;
+
     struct Config_t {
         bool pre_calibrated = false; // can be set to true to indicate that all values here are valid
         int32_t pole_pairs = 7;
@@ -47,7 +66,54 @@ public:
         float I_bus_hard_max = INFINITY;
         float I_leak_max = 0.1f;
 
-        float dc_calib_tau = 0.2f;
+        float dc_calib_tau = 0.2f;          // [s] initial settling of the current sensor offsets
+        float dc_calib_tracking_tau = 1.0f; // [s] offset tracking once settled
+        float dc_calib_max_residual = 0.5f; // [A] samples with a larger residual are ignored while disarmed
+
+        float max_modulation = 0.80f;       // fraction of the linear modulation range, up to 2/sqrt(3) with overmodulation
+        AntiWindup anti_windup = ANTI_WINDUP_DECAY;
+        float integrator_decay = 0.99f;     // per cycle for ANTI_WINDUP_DECAY
+        SvmOvermodulation svm_overmodulation = SVM_OVERMODULATION_NONE;
+        CurrentControlMode current_control_mode = CURRENT_CONTROL_MODE_PI;
+        float deadbeat_gain = 0.8f;         // fraction of the current error removed per period with CURRENT_CONTROL_MODE_DEADBEAT
+        float min_current_sense_window = 0.0f; // [s] shorter low-side on times don't give a valid shunt sample, 0: no check
+
+        // Field weakening: negative Id is integrated while the current
+        // controller asks for more than field_weakening_threshold of the
+        // modulation limit and released again below it.
+        bool field_weakening_enable = false;
+        float field_weakening_threshold = 0.95f;    // fraction of max_modulation
+        float field_weakening_gain = 1000.0f;       // [A/s] per unit of modulation ratio above the threshold
+        float field_weakening_max_id = 10.0f;       // [A] magnitude of the most negative Id
+
+        // Id setpoint table indexed by |torque| and |electrical velocity|, e.g.
+        // an MTPA curve for motors with saliency. Disabled if either size is 0.
+        // Point (torque i, speed j) is at id_table[i * ID_TABLE_MAX_SIZE + j].
+        uint32_t id_table_n_torque = 0;             // up to ID_TABLE_MAX_SIZE
+        uint32_t id_table_n_speed = 0;              // up to ID_TABLE_MAX_SIZE
+        float id_table_torque_max = 1.0f;           // [Nm] torque of the last row
+        float id_table_speed_max = 1000.0f;         // [rad/s] electrical velocity of the last column
+        float id_table[ID_TABLE_MAX_SIZE * ID_TABLE_MAX_SIZE] = {}; // [A]
+        float saliency_inductance = 0.0f;           // [H] Ld - Lq, adds the reluctance torque to the Id,q conversion
+
+        // Dead time and switch drop compensation
+        float inverter_drop = 0.0f;                 // [V] per phase, measured during calibration if inverter_drop_calib_enable
+        float inverter_drop_band = 0.5f;            // [A] blanking band around zero phase current
+        bool inverter_drop_comp_enable = false;
+        bool inverter_drop_calib_enable = false;
+
+        // Inductance against the current magnitude for motors that saturate.
+        // Point i is at inductance_map_current_max * i / (inductance_map_n - 1).
+        bool inductance_map_enable = false;         // schedule the current controller and R_wL_FF from the map
+        bool inductance_map_calib_enable = false;   // measure the map during calibration
+        uint32_t inductance_map_n = 5;              // 2 to INDUCTANCE_MAP_MAX_SIZE
+        float inductance_map_current_max = 20.0f;   // [A]
+        float inductance_map[INDUCTANCE_MAP_MAX_SIZE] = {}; // [H]
+
+        // Measure resistance and inductance in one pass with a pseudo random
+        // excitation instead of two consecutive measurements
+        bool fast_calibration_enable = false;
+        float fast_calibration_min_quality = 0.9f;  // coefficient of determination of the fit
 
         // custom property setters
         Motor* parent = nullptr;
@@ -55,9 +121,21 @@ public:
             pre_calibrated = value;
             parent->is_calibrated_ = parent->is_calibrated_ || parent->config_.pre_calibrated;
         }
-        void set_phase_inductance(float value) { phase_inductance = value; parent->update_current_controller_gains(); }
-        void set_phase_resistance(float value) { phase_resistance = value; parent->update_current_controller_gains(); }
-        void set_current_control_bandwidth(float value) { current_control_bandwidth = value; parent->update_current_controller_gains(); }
+        void set_pole_pairs(int32_t value) { pole_pairs = value; config_changed<&Motor::update_current_controller_gains>(parent); }
+        void set_torque_constant(float value) { torque_constant = value; config_changed<&Motor::update_current_controller_gains>(parent); }
+        void set_phase_inductance(float value) { phase_inductance = value; config_changed<&Motor::update_current_controller_gains>(parent); }
+        void set_phase_resistance(float value) { phase_resistance = value; config_changed<&Motor::update_current_controller_gains>(parent); }
+        void set_current_control_bandwidth(float value) { current_control_bandwidth = value; config_changed<&Motor::update_current_controller_gains>(parent); }
+        void set_max_modulation(float value) { max_modulation = value; config_changed<&Motor::update_current_controller_gains>(parent); }
+        void set_anti_windup(AntiWindup value) { anti_windup = value; config_changed<&Motor::update_current_controller_gains>(parent); }
+        void set_integrator_decay(float value) { integrator_decay = value; config_changed<&Motor::update_current_controller_gains>(parent); }
+        void set_svm_overmodulation(SvmOvermodulation value) { svm_overmodulation = value; config_changed<&Motor::update_current_controller_gains>(parent); }
+        void set_current_control_mode(CurrentControlMode value) { current_control_mode = value; config_changed<&Motor::update_current_controller_gains>(parent); }
+        void set_deadbeat_gain(float value) { deadbeat_gain = value; config_changed<&Motor::update_current_controller_gains>(parent); }
+        void set_inverter_drop(float value) { inverter_drop = value; config_changed<&Motor::update_current_controller_gains>(parent); }
+        void set_inverter_drop_band(float value) { inverter_drop_band = value; config_changed<&Motor::update_current_controller_gains>(parent); }
+        void set_inverter_drop_comp_enable(bool value) { inverter_drop_comp_enable = value; config_changed<&Motor::update_current_controller_gains>(parent); }
+        void set_inductance_map_enable(bool value) { inductance_map_enable = value; config_changed<&Motor::update_current_controller_gains>(parent); }
     };
 
     Motor(TIM_HandleTypeDef* timer,
@@ -77,13 +155,26 @@ public:
     void update_current_controller_gains();
     void disarm_with_error(Error error);
     bool do_checks(uint32_t timestamp);
+    bool check_thermistors();
+    void update_thermal_current_lim();
     float effective_current_lim();
-    float max_available_torque();
-    std::optional<float> phase_current_from_adcval(uint32_t ADCValue);
+    // Torque limit of this iteration, see effective_current_lim()
+    float max_available_torque() { return max_available_torque_; }
+    std::optional<Iph_ABC_t> phase_currents_from_adcvals(uint32_t adc_phB, uint32_t adc_phC);
+    Iph_ABC_t reconstruct_phase_currents(const Iph_ABC_t& measured);
+    void update_adc_conversion();
     bool measure_phase_resistance(float test_current, float max_voltage);
     bool measure_phase_inductance(float test_voltage);
+    bool measure_inverter_drop(float test_current, float max_voltage);
+    bool measure_phase_resistance_inductance(float test_current, float max_voltage);
+    bool measure_inductance_map(float test_voltage);
+    float probe_resistance(float test_current, float phase, float duration);
     bool run_calibration();
     void update(uint32_t timestamp);
+    bool set_id_table_point(uint32_t torque_index, uint32_t speed_index, float id);
+    float get_id_table_point(uint32_t torque_index, uint32_t speed_index);
+    bool set_inductance_map_point(uint32_t index, float inductance);
+    float get_inductance_map_point(uint32_t index);
 
     // These functions are called as appropriate from the board.cpp file.
     void current_meas_cb(uint32_t timestamp, std::optional<Iph_ABC_t> current);
@@ -115,15 +206,36 @@ public:
     bool is_armed_ = false;
     uint8_t armed_state_ = 0;
     bool is_calibrated_ = false; // Set in apply_config()
-    std::optional<Iph_ABC_t> current_meas_;
+    std::optional<Iph_ABC_t> current_meas_; // only valid inside the current measurement interrupt, use sample_ elsewhere
+    Snapshot<Sample_t> sample_;
     Iph_ABC_t DC_calib_ = {0.0f, 0.0f, 0.0f};
+    static constexpr float kDcCalibSettlingTime = 3.0f; // [dc_calib_tau] the average of the first samples needs no time to decay
     float dc_calib_running_since_ = 0.0f; // current sensor calibration needs some time to settle
+    bool dc_calib_settled_ = false;
+    Iph_ABC_t DC_calib_settled_ = {0.0f, 0.0f, 0.0f}; // [A] offsets at the time they settled
+    float dc_calib_drift_ = 0.0f; // [A] largest offset change since settling
+    std::optional<Iph_ABC_t> DC_calib_retained_; // [A] offsets from before a warm restart, see restore_dc_calib()
     float I_bus_ = 0.0f; // this motors contribution to the bus current
+    float I_bus_predicted_ = 0.0f; // [A] this motors contribution to the bus current at the end of the next PWM period
+    EnergyCounter motoring_energy_; // drawn from the DC bus, see ODrive::update_energy_counters()
+    EnergyCounter regen_energy_; // returned to the DC bus
     float phase_current_rev_gain_ = 0.0f; // Reverse gain for ADC to Amps (to be set by DRV8301_setup)
+    float adc_to_amps_ = 0.0f; // [A/count] set by update_adc_conversion()
+    float adc_offset_phB_ = (float)(1 << 11); // [count] mid scale plus DC_calib_
+    float adc_offset_phC_ = (float)(1 << 11); // [count]
     FieldOrientedController current_control_;
     float effective_current_lim_ = 10.0f; // [A]
+    float max_available_torque_ = 0.0f; // [Nm] set with effective_current_lim_
+    float thermal_current_lim_factor_ = 1.0f; // [1] derating of the thermistors, set by update_thermal_current_lim()
     float max_allowed_current_ = 0.0f; // [A] set in setup()
     float max_dc_calib_ = 0.0f; // [A] set in setup()
+    InverterPwm_t pwm_state_; // last applied timings and currents, phase set by the board
+    float prev_pwm_timings_[3] = {0.5f, 0.5f, 0.5f}; // timings before pwm_state_.timings, in effect for the first half of the sampled zero vector
+    uint32_t n_predicted_current_samples_ = 0;
+    float zero_vector_shift_ = 0.0f; // [PWM periods] common mode shift of the last timings, see enable_bus_ripple_minimization
+    float fw_id_ = 0.0f; // [A] Id contribution of the field weakening loop
+    float phase_inductance_ = 0.0f; // [H] inductance at the present current setpoint
+    float calibration_fit_quality_ = 0.0f; // of the last fast calibration
 
     InputPort<float> torque_setpoint_src_; // Usually points to the Controller object's output
     InputPort<float> phase_vel_src_; // Usually points to the Encoder object's output
@@ -1,14 +1,19 @@
 /*
 * Convenience functions to load and store multiple objects from and to NVM.
 * 
-* The NVM stores consecutive one-to-one copies of arbitrary objects.
-* The types of these objects are passed as template arguments to Config<Ts...>.
+* The NVM stores objects as tagged records, either field by field or as
+* one-to-one copies, see ConfigManager.
 */
 
+#ifndef __NVM_CONFIG_HPP
+#define __NVM_CONFIG_HPP
+
 /* Includes ------------------------------------------------------------------*/
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <algorithm>
+#include <type_traits>
 
 #include <Drivers/STM32/stm32_nvm.h>
 #include <fibre/../../crc.hpp>
@@ -24,21 +29,59 @@
 /* Global variables ----------------------------------------------------------*/
 /* Private constant data -----------------------------------------------------*/
 
-// IMPORTANT: if you change, reorder or otherwise modify any of the fields in
-// the config structs without changing its total length, make sure to increment this number:
-static constexpr uint16_t config_version = 0x0001;
+// IMPORTANT: if you change, reorder or otherwise modify any of the fields of
+// an object that is stored one-to-one (read() / write()) without changing its
+// total length, make sure to increment this number. Objects that are stored
+// field by field don't depend on it.
+static constexpr uint16_t config_version = 0x0002;
 
 /* Private variables ---------------------------------------------------------*/
 /* Private function prototypes -----------------------------------------------*/
 /* Function implementations --------------------------------------------------*/
 
+/**
+ * @brief Tag of a config field for ConfigManager::read_fields(), the CRC16
+ * of its name. Same as calc_crc16() in interface_generator.py, which tags the
+ * fields in autogen/config_fields.hpp as "<path>:<type name>".
+ */
+constexpr uint16_t config_field_tag(const char* name) {
+    uint16_t crc16 = 0;
+    for (; *name; ++name) {
+        crc16 ^= (uint16_t)((uint8_t)*name << 8);
+        for (int bit = 0; bit < 8; ++bit) {
+            crc16 = (crc16 & 0x8000) ? (uint16_t)((crc16 << 1) ^ CONFIG_CRC16_POLYNOMIAL) : (uint16_t)(crc16 << 1);
+        }
+    }
+    return crc16;
+}
+
 /**
  * @brief Manages configuration load and store operations from and to NVM
- * 
+ *
+ * Every object is stored as a record with a header (tag, length, CRC16,
+ * format) and the payload, padded to 64-bit fields. The tag is the position
+ * of the object in the read() / write() sequence. The NVM log is scanned on load and the
+ * last valid record of every tag wins. A store only appends the records of the
+ * objects that changed since they were loaded or stored. When the active
+ * sector is full, a store writes all records to the other sector instead
+ * (compaction).
+ *
+ * read() / write() store an object one-to-one. A corrupt record or one whose
+ * length doesn't match the object any more leaves only that object at its
+ * defaults.
+ *
+ * read_fields() / write_fields() store an object field by field, as a packed
+ * sequence of (tag, size, value) without the padding between the members.
+ * TFields::visit(config, visitor) calls visitor(tag, member) for every member
+ * that is stored (see autogen/config_fields.hpp). On load each field is
+ * looked up by its tag, so fields that were added or whose size changed keep
+ * their current value and the others still load, whatever their order.
+ * Fields that are no longer visited are dropped on the next store.
+ *
  * Usage:
  *  1. start_load()
  *  2. read() (as often needed)
- *  3. finish_load() (to see if all reads were successful and the CRC in the end is valid)
+ *  3. finish_load() (to see if any object was loaded)
  * 
  *  1. prepare_store()
  *  2. write() (as often as needed)
@@ -46,60 +89,164 @@ static constexpr uint16_t config_version = 0x0001;
  *  4. write() (same sequence as before)
  *  5. finish_store()
  * 
- * The two store passes are required in order to measure the size on the first
- * pass. If the size increases between the first and second pass, finish_store()
- * will return an error.
+ * The two store passes are required in order to find the changed objects and
+ * measure the size on the first pass. Objects that change between the passes
+ * are stored as they are on the second pass.
+ *
+ * Between the passes, store_needs_erase() tells if the store would erase a
+ * flash sector, which stalls the CPU. reserve_store() can be called instead of
+ * start_store() to erase ahead of time, abort_store() drops the store.
+ *
+ * The CRC is calculated over the bytes in flash, so objects that change
+ * while they are written end up as inconsistent but valid values instead of a
+ * corrupt record.
  */
 class ConfigManager {
 public:
+    static constexpr size_t kMaxRecords = 64;
+    static constexpr uint16_t kFormatRaw = 0xffff; // one-to-one copy, as in older firmware
+    static constexpr uint16_t kFormatFields = 0xfffe; // sequence of FieldHeader_t + value
+
+    struct RecordHeader_t {
+        uint16_t tag;
+        uint16_t length; // of the payload [bytes]
+        uint16_t crc16; // over tag, length and payload, seeded by the format
+        uint16_t format;
+    };
+    static_assert(sizeof(RecordHeader_t) == 8, "the header must fill one NVM field");
+
+    struct FieldHeader_t {
+        uint16_t tag;
+        uint16_t size; // of the value [bytes]
+    };
+    static_assert(sizeof(FieldHeader_t) == 4, "field headers are packed");
+
     /**
-     * @brief Starts a load operation. This can be called at any time, even half
-     * way through a previous load operation.
+     * @brief Starts a load operation and indexes the records in NVM. This can
+     * be called at any time, even half way through a previous load operation.
      */
     bool start_load() {
+        for (auto& record: records_) {
+            record.present = false;
+        }
+        log_clean_ = false;
         if (NVM_init() != 0) {
             return (load_state = kLoadStateFailed), false;
         }
+
+        log_clean_ = true;
+        size_t length = NVM_get_read_length();
+        for (size_t offset = 0; offset + sizeof(RecordHeader_t) <= length; ) {
+            RecordHeader_t header;
+            if (!NVM_is_valid(offset)) {
+                offset += 8; // never committed
+                continue;
+            }
+            size_t size = 0;
+            if (NVM_read(offset, (uint8_t*)&header, sizeof(header)) == 0
+                    && header.tag < kMaxRecords
+                    && (header.format == kFormatRaw || header.format == kFormatFields)
+                    && (size = record_size(header.length)) <= length - offset
+                    && fields_valid(offset, size)
+                    && header.crc16 == stored_crc(header.tag, header.length, header.format, offset + sizeof(header))) {
+                records_[header.tag] = {offset, header.length, header.crc16, header.format, true};
+                offset += size;
+            } else {
+                log_clean_ = false; // resynchronize on the next field
+                offset += 8;
+            }
+        }
+
+        load_tag = 0;
         load_offset = 0;
-        load_crc16 = CONFIG_CRC16_INIT ^ config_version;
+        n_missing = 0;
         load_state = kLoadStateInProgress;
         return true;
     }
 
     /**
-     * @brief Loads the next chunk from NVM.
-     * Note that this may return true even if invalid data was read. The user
-     * will know the final verdict by the return value of finish_load().
+     * @brief Loads the next object from NVM. An object without a valid
+     * record keeps its current value and counts in n_missing.
      */
     template<typename T>
     bool read(T* val) {
-        if (load_state != 1) {
+        if (load_state != kLoadStateInProgress || load_tag >= kMaxRecords) {
+            return (load_state = kLoadStateFailed), false;
+        }
+        StoredRecord& record = records_[load_tag++];
+        if (!record.present || record.format != kFormatRaw || record.length != sizeof(T)) {
+            return load_missing(record);
+        }
+        return load_raw(record, val);
+    }
+
+    /**
+     * @brief Loads the next object as a byte string of up to `capacity` bytes,
+     * see write_bytes(). A one-to-one copy of any size up to that is loaded,
+     * bytes beyond the stored length keep their current value.
+     * @param length: Set to the number of loaded bytes, 0 without a valid record.
+     */
+    bool read_bytes(void* data, size_t capacity, size_t* length) {
+        *length = 0;
+        if (load_state != kLoadStateInProgress || load_tag >= kMaxRecords) {
             return (load_state = kLoadStateFailed), false;
         }
-        size_t size = sizeof(T);
-        if (NVM_read(load_offset, (uint8_t *)val, size) != 0)
+        StoredRecord& record = records_[load_tag++];
+        if (!record.present || record.format != kFormatRaw || record.length > capacity) {
+            return load_missing(record);
+        }
+        if (NVM_read(record.offset + sizeof(RecordHeader_t), (uint8_t *)data, record.length) != 0) {
+            return load_missing(record);
+        }
+        load_offset += record_size(record.length);
+        *length = record.length;
+        return true;
+    }
+
+    /**
+     * @brief Loads the next object from NVM field by field. Fields without a
+     * stored value keep their current value. A one-to-one copy of the same
+     * size (stored by older firmware) is loaded as it is.
+     */
+    template<typename TFields, typename T>
+    bool read_fields(T* val) {
+        if (load_state != kLoadStateInProgress || load_tag >= kMaxRecords) {
             return (load_state = kLoadStateFailed), false;
-        load_crc16 = calc_crc16<CONFIG_CRC16_POLYNOMIAL>(load_crc16, (uint8_t *)val, size);
-        load_offset += size;
+        }
+        StoredRecord& record = records_[load_tag++];
+        if (record.present && record.format == kFormatRaw && record.length == sizeof(T)) {
+            return load_raw(record, val);
+        }
+        if (!record.present || record.format != kFormatFields) {
+            return load_missing(record);
+        }
+
+        size_t begin = record.offset + sizeof(RecordHeader_t);
+        size_t end = begin + record.length;
+        size_t cursor = begin;
+        TFields::visit(*val, [&](uint16_t tag, auto& field) {
+            size_t offset;
+            if (find_field(begin, end, &cursor, tag, sizeof(field), &offset)) {
+                NVM_read(offset, (uint8_t*)&field, sizeof(field));
+            }
+        });
+        load_offset += record_size(record.length);
         return true;
     }
 
     /**
      * @brief Checks the final state of the load operation.
-     * If this function returns false, it is possible that previous read()
-     * operations actually returned garbage.
+     * @returns true if at least one object was loaded.
      */
     bool finish_load(size_t* occupied_size) {
         if (occupied_size) {
-            *occupied_size = load_offset + 2;
+            *occupied_size = load_offset;
         }
-
-        uint16_t crc16_calculated = load_crc16;
-        uint16_t crc16_loaded;
-        if (!read(&crc16_loaded)) {
-            return (load_state = kLoadStateFailed), false;
+        bool result = (load_state == kLoadStateInProgress) && (load_tag > n_missing);
+        // Records of tags that weren't read are stale
+        for (size_t i = load_tag; i < kMaxRecords; ++i) {
+            records_[i].present = false;
         }
-        bool result = (load_state == 1) && (crc16_loaded == crc16_calculated);
         load_state = kLoadStateIdle;
         return result;
     }
@@ -108,50 +255,101 @@ public:
      * @brief Starts preparation of a new store operation.
      */
     bool prepare_store() {
-        if (store_state != kStoreStateIdle) {
+        if (store_state != kStoreStateIdle && store_state != kStoreStateFailed) {
             // it might be possible to restart the store process from other states but let's be safe
             return (store_state = kStoreStateFailed), false;
         }
-        store_offset = 0;
-        store_crc16 = CONFIG_CRC16_INIT ^ config_version;
+        store_tag = 0;
+        full_size = 0;
+        delta_size = 0;
         store_state = kStoreStatePreparing;
         return true;
     }
 
     template<typename T>
     bool write(T* val) {
-        if (store_state == kStoreStateInProgress) {
-            if (NVM_write(store_offset, (uint8_t*)val, sizeof(T)) != 0) {
-                return (store_state = kStoreStateFailed), false;
-            }
-        } else if (store_state != kStoreStatePreparing) {
+        static_assert(sizeof(T) < 0x10000, "too large for a record");
+        return write_record(kFormatRaw, sizeof(T), [val](auto&& emit) {
+            emit(val, sizeof(T));
+        });
+    }
+
+    /**
+     * @brief Stores a byte string whose length is only known at runtime as a
+     * one-to-one copy, see read_bytes().
+     */
+    bool write_bytes(const void* data, size_t length) {
+        return write_record(kFormatRaw, length, [data, length](auto&& emit) {
+            emit(data, length);
+        });
+    }
+
+    /**
+     * @brief Stores the next object field by field, see read_fields().
+     */
+    template<typename TFields, typename T>
+    bool write_fields(T* val) {
+        size_t length = 0;
+        TFields::visit(*val, [&](uint16_t, auto& field) {
+            length += sizeof(FieldHeader_t) + sizeof(field);
+        });
+        return write_record(kFormatFields, length, [val](auto&& emit) {
+            TFields::visit(*val, [&](uint16_t tag, auto& field) {
+                static_assert(std::is_trivially_copyable<std::remove_reference_t<decltype(field)>>::value,
+                              "fields are stored as they are in memory");
+                static_assert(sizeof(field) < 0x10000, "too large for a field");
+                FieldHeader_t header{tag, (uint16_t)sizeof(field)};
+                emit(&header, sizeof(header));
+                emit(&field, sizeof(field));
+            });
+        });
+    }
+
+    /**
+     * @brief Returns true if the store that is being prepared would erase a
+     * flash sector.
+     */
+    bool store_needs_erase() {
+        return NVM_write_needs_erase(full_size, select_append());
+    }
+
+    /**
+     * @brief Finishes the prepare pass without storing anything but erases
+     * the flash that a compaction would need.
+     */
+    bool reserve_store() {
+        if (store_state != kStoreStatePreparing) {
             return (store_state = kStoreStateFailed), false;
         }
-        store_crc16 = calc_crc16<CONFIG_CRC16_POLYNOMIAL>(store_crc16, (uint8_t *)val, sizeof(T));
-        store_offset += sizeof(T);
-        return true;
+        store_state = kStoreStateIdle;
+        return NVM_prepare_write(full_size) == 0;
+    }
+
+    void abort_store() {
+        store_state = kStoreStateIdle;
     }
 
     /**
      * @brief Finishes the prepare pass and starts the actual store pass.
+     * @param occupied_size: Set to the number of bytes that the store writes.
      */
     bool start_store(size_t* occupied_size) {
-        if (occupied_size) {
-            *occupied_size = store_offset + 2;
-        }
-
         if (store_state != kStoreStatePreparing) {
             return (store_state = kStoreStateFailed), false;
         }
-        store_offset += 2; // account for CRC16
-        if (store_offset > NVM_get_max_write_length()) {
-            return (store_state = kStoreStateFailed), false;
+        append_ = select_append();
+        size_t size = append_ ? delta_size : full_size;
+        if (occupied_size) {
+            *occupied_size = size;
         }
-        if (NVM_start_write(store_offset) != 0) {
+        for (auto& record: pending_) {
+            record.present = false;
+        }
+        if (size && NVM_start_write(size, append_) != 0) {
             return (store_state = kStoreStateFailed), false;
         }
+        store_tag = 0;
         store_offset = 0;
-        store_crc16 = CONFIG_CRC16_INIT ^ config_version;
         store_state = kStoreStateInProgress;
         return true;
     }
@@ -162,13 +360,22 @@ public:
      * If this function fails, the old configuration was not touched.
      */
     bool finish_store() {
-        uint16_t crc16 = store_crc16;
-        if (!write(&crc16)) {
+        if (store_state != kStoreStateInProgress) {
             return (store_state = kStoreStateFailed), false;
         }
-        if (NVM_commit() != 0) {
+        if (store_offset && NVM_commit() != 0) {
             return (store_state = kStoreStateFailed), false;
         }
+        for (size_t i = 0; i < kMaxRecords; ++i) {
+            if (pending_[i].present) {
+                records_[i] = pending_[i];
+            } else if (!append_ && store_offset) {
+                records_[i].present = false; // not part of the new log
+            }
+        }
+        if (!append_ && store_offset) {
+            log_clean_ = true;
+        }
         store_state = kStoreStateIdle;
         return true;
     }
@@ -178,8 +385,9 @@ public:
         kLoadStateInProgress = 1,
         kLoadStateFailed = 2
     } load_state = kLoadStateIdle;
+    size_t load_tag;
     size_t load_offset;
-    size_t load_crc16;
+    size_t n_missing = 0; // objects that had no valid record on the last load
 
     enum {
         kStoreStateIdle = 0,
@@ -187,6 +395,177 @@ public:
         kStoreStateInProgress = 2,
         kStoreStateFailed = 3
     } store_state = kStoreStateIdle;
+    size_t store_tag;
     size_t store_offset;
-    size_t store_crc16;
+    size_t full_size;
+    size_t delta_size;
+
+private:
+    struct StoredRecord {
+        size_t offset; // of the header in the log
+        uint16_t length;
+        uint16_t crc16;
+        uint16_t format;
+        bool present;
+    };
+
+    bool load_missing(StoredRecord& record) {
+        record.present = false;
+        n_missing++;
+        return true;
+    }
+
+    template<typename T>
+    bool load_raw(StoredRecord& record, T* val) {
+        if (NVM_read(record.offset + sizeof(RecordHeader_t), (uint8_t *)val, sizeof(T)) != 0) {
+            return load_missing(record);
+        }
+        load_offset += record_size(sizeof(T));
+        return true;
+    }
+
+    /**
+     * @brief Finds the value of a field in the payload [begin, end) of a
+     * record. The fields are usually stored in the order in which they are
+     * read, so the search starts at *cursor, the end of the last field found.
+     * @returns false if there is no such field or its size changed.
+     */
+    static bool find_field(size_t begin, size_t end, size_t* cursor, uint16_t tag, size_t size, size_t* offset) {
+        for (size_t pos = *cursor, stop = end, pass = 0; pass < 2; pos = begin, stop = *cursor, ++pass) {
+            while (pos < stop && pos + sizeof(FieldHeader_t) <= end) {
+                FieldHeader_t header;
+                NVM_read(pos, (uint8_t*)&header, sizeof(header));
+                size_t next = pos + sizeof(header) + header.size;
+                if (next > end) {
+                    return false; // malformed
+                }
+                if (header.tag == tag) {
+                    *cursor = next;
+                    *offset = pos + sizeof(header);
+                    return header.size == size;
+                }
+                pos = next;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * @brief Stores the next record. serialize(emit) calls emit(data, length)
+     * for the consecutive pieces of the payload, once on each pass.
+     */
+    template<typename TSerialize>
+    bool write_record(uint16_t format, size_t length, const TSerialize& serialize) {
+        if (store_tag >= kMaxRecords || length >= 0x10000) {
+            return (store_state = kStoreStateFailed), false;
+        }
+        size_t tag = store_tag++;
+
+        if (store_state == kStoreStatePreparing) {
+            uint16_t crc16 = prefix_crc(tag, length, format);
+            serialize([&](const void* data, size_t n) {
+                crc16 = calc_crc16<CONFIG_CRC16_POLYNOMIAL>(crc16, (const uint8_t*)data, n);
+            });
+            const StoredRecord& record = records_[tag];
+            changed_[tag] = !record.present || record.format != format
+                         || record.length != length || record.crc16 != crc16;
+            full_size += record_size(length);
+            delta_size += changed_[tag] ? record_size(length) : 0;
+            return true;
+        } else if (store_state != kStoreStateInProgress) {
+            return (store_state = kStoreStateFailed), false;
+        }
+
+        if (append_ && !changed_[tag]) {
+            return true;
+        }
+        // The payload goes first so that the header can carry the CRC of the
+        // bytes that ended up in flash. The pieces are collected into aligned
+        // chunks, so most of them are programmed word by word.
+        size_t offset = store_offset;
+        size_t payload_offset = offset + sizeof(RecordHeader_t);
+        uint8_t chunk[64];
+        size_t chunk_offset = payload_offset;
+        size_t n_chunk = 0;
+        bool ok = true;
+        auto flush = [&]() {
+            ok = ok && (NVM_write(chunk_offset, chunk, n_chunk) == 0);
+            chunk_offset += n_chunk;
+            n_chunk = 0;
+        };
+        serialize([&](const void* data, size_t n) {
+            for (const uint8_t* bytes = (const uint8_t*)data; n; ) {
+                size_t k = std::min(n, sizeof(chunk) - n_chunk);
+                std::copy_n(bytes, k, chunk + n_chunk);
+                n_chunk += k;
+                bytes += k;
+                n -= k;
+                if (n_chunk == sizeof(chunk)) {
+                    flush();
+                }
+            }
+        });
+        if (n_chunk) {
+            flush();
+        }
+        if (!ok || chunk_offset != payload_offset + length) {
+            return (store_state = kStoreStateFailed), false;
+        }
+
+        RecordHeader_t header{(uint16_t)tag, (uint16_t)length,
+            calc_crc16<CONFIG_CRC16_POLYNOMIAL>(prefix_crc(tag, length, format), NVM_get_staging_area() + payload_offset, length),
+            format};
+        if (NVM_write(offset, (const uint8_t*)&header, sizeof(header)) != 0) {
+            return (store_state = kStoreStateFailed), false;
+        }
+        pending_[tag] = {offset, (uint16_t)length, header.crc16, format, true};
+        store_offset += record_size(length);
+        return true;
+    }
+
+    static size_t record_size(size_t length) {
+        return sizeof(RecordHeader_t) + ((length + 7) & ~(size_t)7);
+    }
+
+    // CRC of the tag and length. Only the one-to-one copies depend on config_version.
+    static uint16_t prefix_crc(size_t tag, size_t length, uint16_t format) {
+        uint8_t prefix[4] = {(uint8_t)tag, (uint8_t)(tag >> 8), (uint8_t)length, (uint8_t)(length >> 8)};
+        uint16_t init = CONFIG_CRC16_INIT ^ (format == kFormatRaw ? config_version : format);
+        return calc_crc16<CONFIG_CRC16_POLYNOMIAL>(init, prefix, sizeof(prefix));
+    }
+
+    // CRC of a record in the log
+    static uint16_t stored_crc(size_t tag, size_t length, uint16_t format, size_t payload_offset) {
+        uint16_t crc16 = prefix_crc(tag, length, format);
+        uint8_t chunk[64];
+        while (length) {
+            size_t n = std::min(length, sizeof(chunk));
+            NVM_read(payload_offset, chunk, n);
+            crc16 = calc_crc16<CONFIG_CRC16_POLYNOMIAL>(crc16, chunk, n);
+            payload_offset += n;
+            length -= n;
+        }
+        return crc16;
+    }
+
+    static bool fields_valid(size_t offset, size_t size) {
+        for (size_t i = 0; i < size; i += 8) {
+            if (!NVM_is_valid(offset + i)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool select_append() {
+        return log_clean_ && delta_size <= NVM_get_max_write_length(true);
+    }
+
+    StoredRecord records_[kMaxRecords] = {}; // what the log holds for each tag
+    StoredRecord pending_[kMaxRecords] = {}; // written by the current store
+    bool changed_[kMaxRecords] = {};
+    bool append_ = false;
+    bool log_clean_ = false; // the log has no corrupt records, so it can be appended to
 };
+
+#endif // __NVM_CONFIG_HPP
@@ -9,6 +9,7 @@
 #include <communication/interface_i2c.h>
 #include <communication/interface_uart.h>
 #include <task_timer.hpp>
+#include <task_schedule.hpp>
 extern "C" {
 #endif
 
@@ -24,8 +25,23 @@ extern char serial_number_str[13];
 #ifdef __cplusplus
 }
 
+// Time since reset [us] at which each startup phase finished, 0 until it did.
+// The phases are listed in the order in which they finish.
+typedef struct {
+    uint32_t config_loaded; // including the flash erase for the next save, if needed
+    uint32_t board_init;
+    uint32_t gate_drivers_ready;
+    uint32_t encoders_ready;
+    uint32_t adc_pwm_started; // the current sensor calibration starts here
+    uint32_t communication_ready;
+    uint32_t threads_started;
+    uint32_t current_meas_ready; // current sensor calibration settled on all motors (or timed out)
+    uint32_t closed_loop; // first axis that entered closed loop control
+} BootTimes_t;
+
 typedef struct {
     bool fully_booted;
+    BootTimes_t boot;
     uint32_t uptime; // [ms]
     uint32_t min_heap_space; // FreeRTOS heap [Bytes]
     uint32_t max_stack_usage_axis; // minimum remaining space since startup [Bytes]
@@ -34,6 +50,7 @@ typedef struct {
     uint32_t max_stack_usage_startup;
     uint32_t max_stack_usage_can;
     uint32_t max_stack_usage_analog;
+    uint32_t max_stack_usage_i2c;
 
     uint32_t stack_size_axis;
     uint32_t stack_size_usb;
@@ -41,6 +58,7 @@ typedef struct {
     uint32_t stack_size_startup;
     uint32_t stack_size_can;
     uint32_t stack_size_analog;
+    uint32_t stack_size_i2c;
 
     int32_t prio_axis;
     int32_t prio_usb;
@@ -48,15 +66,45 @@ typedef struct {
     int32_t prio_startup;
     int32_t prio_can;
     int32_t prio_analog;
+    int32_t prio_i2c;
+
+    // Fraction of the CPU time over the last update period (8192 control loop
+    // iterations, see task_schedule.hpp). The axis values are the
+    // maximum over all axes. The time spent in traced interrupts (those with
+    // TRACE_IRQ_ENTER) counts as ISR time, not as time of the interrupted
+    // thread. "other" covers the threads that don't have a slot of their own.
+    float cpu_load_axis;
+    float cpu_load_usb;
+    float cpu_load_uart;
+    float cpu_load_startup;
+    float cpu_load_can;
+    float cpu_load_analog;
+    float cpu_load_other;
+    float cpu_load_idle;
+    float cpu_load_isr;
+
+    // Number of times the thread was switched in during the last update period
+    uint32_t context_switches_axis;
+    uint32_t context_switches_usb;
+    uint32_t context_switches_uart;
+    uint32_t context_switches_startup;
+    uint32_t context_switches_can;
+    uint32_t context_switches_analog;
+    uint32_t context_switches_other;
+    uint32_t context_switches_idle;
 
     USBStats_t& usb = usb_stats_;
     I2CStats_t& i2c = i2c_stats_;
+
+    // Time spent in fibre::endpoint_handler() per endpoint operation
+    TaskTimer endpoint_handler;
 } SystemStats_t;
 
 struct PWMMapping_t {
     endpoint_ref_t endpoint = {0, 0};
     float min = 0;
     float max = 0;
+    float filter_bandwidth = 0.0f; // [rad/s] 0 disables the filter
 };
 
 // @brief general user configurable board configuration
@@ -107,9 +155,54 @@ struct BoardConfig_t {
                                                                     //!< Must be larger than `dc_bus_overvoltage_ramp_start`,
                                                                     //!< otherwise the ramp feature is disabled.
 
+    /**
+     * If enabled, the brake resistor brakes for the regen that the motors
+     * are predicted to produce during the next PWM period instead of the
+     * regen of the last period. The predicted bus current is the FOC
+     * output applied to the current setpoint. Additionally, a rising
+     * bus voltage increases the brake current by
+     * `dc_bus_capacitance * d(vbus_voltage)/dt`.
+     */
+    bool enable_predictive_brake = false;
+    float dc_bus_capacitance = 0.0f; // [F] See `enable_predictive_brake`. Zero disables the voltage derivative term.
+
+    /**
+     * The bus voltage that converts voltages to modulation is
+     * `filtered + vbus_ripple_feedforward * (measured - filtered)`, with the
+     * measured voltage low-pass filtered with `vbus_filter_tau`. The
+     * undervoltage trip and the current limits use the filtered voltage,
+     * the overvoltage trip and the brake resistor the measured voltage.
+     */
+    float vbus_filter_tau = 0.001f; // [s]
+    float vbus_ripple_feedforward = 1.0f; // 0: filtered voltage only, 1: measured voltage
+
+    /**
+     * If enabled, each motor shifts its zero vectors such that its DC link
+     * current pulses overlap least with those of the other motors, which
+     * reduces the bus capacitor RMS current. Both zero vectors stay at least
+     * `min_zero_vector_time` long for the current measurements.
+     */
+    bool enable_bus_ripple_minimization = false;
+    float min_zero_vector_time = 2e-6f; // [s]
+
     float dc_max_positive_current = INFINITY; // Max current [A] the power supply can source
     float dc_max_negative_current = -0.01f; // Max current [A] the power supply can sink. You most likely want a non-positive value here. Set to -INFINITY to disable.
+    float calibration_max_bus_current = INFINITY; // [A] Estimated combined bus current of axes that calibrate at the same time
     uint32_t error_gpio_pin = DEFAULT_ERROR_PIN;
+    uint32_t pwm_frequency = TIM_1_8_CLOCK_HZ / (2 * TIM_1_8_PERIOD_CLOCKS); // [Hz] applied at boot
+    uint32_t control_loop_decimation = TIM_1_8_RCR + 1; // PWM periods per control loop iteration, applied at boot
+    // Relative to osPriorityNormal, applied at boot, see comms_thread_priority()
+    int32_t usb_thread_priority = 0;
+    int32_t uart_thread_priority = 0;
+    int32_t can_thread_priority = 1;
+    int32_t i2c_thread_priority = 0;
+    bool enable_idle_sleep = true; // WFI in the idle task
+    ODriveIntf::SyncMode sync_mode = ODriveIntf::SYNC_MODE_DISABLED; // applied at boot, see init_sync()
+    uint32_t sync_divider = 8; // control loop periods per sync pulse edge, must be the same on all boards
+    // Partition of the RAM arena, applied at boot, see partition_ram_arena()
+    uint32_t oscilloscope_depth = 512; // [samples] per channel
+    uint32_t oscilloscope_channels = 8;
+    uint32_t telemetry_frames = 8;
     PWMMapping_t pwm_mappings[4];
     PWMMapping_t analog_mappings[GPIO_COUNT];
 };
@@ -118,9 +211,75 @@ struct TaskTimes {
     TaskTimer sampling;
     TaskTimer control_loop_misc;
     TaskTimer control_loop_checks;
+    TaskTimer input_mapping_update;
     TaskTimer dc_calib_wait;
 };
 
+// Time from a thread becoming ready until it runs [HCLK ticks], see
+// thread_made_ready() in main.cpp
+struct ThreadWakeLatencies {
+    LatencyStats axis; // all axis threads
+    LatencyStats usb;
+    LatencyStats uart;
+    LatencyStats can;
+};
+
+// Energy [J] integrated once per control loop period. A float would stop
+// counting after a few hours at low power, so the sum is a double, which the
+// host reads as float.
+struct EnergyCounter {
+    double value = 0.0;
+
+    void add(float power, float dt) { value += (double)(power * dt); }
+    float get() const {
+        double v = 0.0;
+        CRITICAL_SECTION() { v = value; }
+        return (float)v;
+    }
+    void reset() { CRITICAL_SECTION() { value = 0.0; } }
+};
+
+// Energy on the DC bus, see ODrive::update_energy_counters()
+struct EnergyCounters {
+    EnergyCounter bus_drawn;        // from the power supply
+    EnergyCounter bus_returned;     // to the power supply
+    EnergyCounter brake_resistor;
+};
+
+// Entry latencies of the control interrupts [HCLK ticks], see board.cpp
+struct IrqLatencies {
+    LatencyStats timer_update; // from the TIM8 update event
+    LatencyStats control_loop; // from the software trigger in the TIM8 handler
+};
+
+// Phase lock of the control loop to the pulse on the GPIO in GPIO_MODE_SYNC,
+// see config_.sync_mode. Written by the TIM8 update interrupt.
+struct SyncStatus {
+    float phase_error = 0.0f; // [s] of the last edge, positive if the local control loop lags
+    float max_phase_error = 0.0f; // [s] largest magnitude of phase_error while locked
+    uint32_t n_edges = 0; // received (slave) or sent (master) edges
+    bool locked = false;
+};
+
+// Bytes of the RAM arena given to each buffer at boot
+struct RamArenaUsage {
+    uint32_t size = 0;
+    uint32_t cogging_maps = 0;
+    uint32_t oscilloscope = 0;
+    uint32_t telemetry = 0;
+    uint32_t free = 0;
+};
+
+// Latencies from the arrival of an input setpoint (input_pos, input_vel,
+// input_torque) until the first PWM update that used it [HCLK ticks], per
+// interface it arrived on. See Controller::tag_input().
+struct SetpointLatencies {
+    bool enabled = false;
+    LatencyStats usb;
+    LatencyStats uart;
+    LatencyStats can;
+};
+
 
 // Forward Declarations
 class Axis;
@@ -152,6 +311,8 @@ inline ENUMTYPE operator ~ (ENUMTYPE a) { return static_cast<ENUMTYPE>(~static_c
 #include <mechanical_brake.hpp>
 #include <axis.hpp>
 #include <oscilloscope.hpp>
+#include <telemetry.hpp>
+#include <event_log.hpp>
 #include <communication/communication.h>
 #include <communication/can/odrive_can.hpp>
 
@@ -163,6 +324,15 @@ extern const unsigned char fw_version_revision_;
 extern const unsigned char fw_version_unreleased_;
 }
 
+extern EventLog event_log; // defined in main.cpp, survives warm restarts
+
+// Priority of a communication thread from its *_thread_priority config value.
+// The communication threads stay between osPriorityLow and osPriorityHigh, so
+// they never preempt axis0 and always run ahead of the idle task.
+inline osPriority comms_thread_priority(int32_t config_value) {
+    return (osPriority)std::clamp<int32_t>(config_value, osPriorityLow, osPriorityHigh);
+}
+
 static Stm32Gpio get_gpio(size_t gpio_num) {
     return (gpio_num < GPIO_COUNT) ? gpios[gpio_num] : GPIO_COUNT ? gpios[0] : Stm32Gpio::none;
 }
@@ -172,8 +342,14 @@ class ODrive : public ODriveIntf {
 public:
     bool save_configuration() override;
     void erase_configuration() override;
-    void reboot() override { NVIC_SystemReset(); }
+    void begin_config_transaction() override;
+    void commit_config_transaction() override;
+    void reboot() override;
     void enter_dfu_mode() override;
+    bool begin_firmware_update(uint32_t size, uint32_t crc32) override;
+    bool commit_firmware_update() override;
+    uint32_t get_firmware_update_received();
+    uint32_t get_firmware_update_max_size();
     bool any_error();
     void clear_errors() override;
 
@@ -187,20 +363,40 @@ public:
     }
 
     void do_fast_checks();
-    void sampling_cb();
+    void sampling_cb(uint32_t timestamp);
     void control_loop_cb(uint32_t timestamp);
 
     Axis& get_axis(int num) { return axes[num]; }
 
     uint32_t get_interrupt_status(int32_t irqn);
     uint32_t get_dma_status(uint8_t stream_num);
-    uint32_t get_gpio_states();
+    uint32_t get_gpio_states() { return gpio_states_; }
+    bool read_sampled_gpio(Stm32Gpio gpio) const;
     uint64_t get_drv_fault();
     void disarm_with_error(Error error);
+    void start_concurrent_calibration();
+    bool reserve_calibration_bus_current(float bus_current);
+    void release_calibration_bus_current(float bus_current);
+    bool move_coordinated(float pos0, float pos1) override;
+
+    bool get_trace_enabled() { return ::trace_enabled; }
+    void set_trace_enabled(bool enabled) { ::trace_enabled = enabled; }
+    uint32_t get_trace_head() { return __atomic_load_n(&::trace_head, __ATOMIC_RELAXED); }
+    uint64_t get_trace_event(uint32_t index);
+
+    uint32_t get_event_log_head() { return ::event_log.head(); }
+    std::tuple<uint32_t, EventSource, uint32_t> get_event(uint32_t index);
+    void clear_event_log();
+    std::tuple<uint32_t, uint32_t, uint32_t> run_benchmark(BenchmarkKernel kernel, uint32_t n);
+    LatencyStats* get_setpoint_latency_stats();
+    void update_energy_counters();
+    void reset_energy_counters();
 
     Error error_ = ERROR_NONE;
     float& vbus_voltage_ = ::vbus_voltage; // TODO: make this the actual variable
     float& ibus_ = ::ibus_; // TODO: make this the actual variable
+    float& vbus_voltage_derivative_ = ::vbus_voltage_derivative;
+    float& vbus_voltage_filtered_ = ::vbus_voltage_filtered;
     float ibus_report_filter_k_ = 1.0f;
 
     const uint64_t& serial_number_ = ::serial_number;
@@ -223,12 +419,8 @@ public:
 
     SystemStats_t system_stats_;
 
-    // Edit these to suit your capture needs
-    Oscilloscope oscilloscope_{
-        nullptr, // trigger_src
-        0.5f, // trigger_threshold
-        nullptr // data_src TODO: change data type
-    };
+    Oscilloscope oscilloscope_;
+    Telemetry telemetry_;
 
     ODriveCAN can_;
 
@@ -239,15 +431,36 @@ public:
     uint32_t test_property_ = 0;
 
     uint32_t last_update_timestamp_ = 0;
+    uint32_t sample_cycles_ = 0; // DWT cycle counter at the GPIO sample of the last sampling_cb()
+    uint32_t loop_sample_cycles_ = 0; // sample_cycles_ of the last completed control loop iteration
     uint32_t n_evt_sampling_ = 0;
     uint32_t n_evt_control_loop_ = 0;
+
+    // GPIO input data registers, sampled at the start of every sampling_cb()
+    static const constexpr GPIO_TypeDef* ports_to_sample[] = { GPIOA, GPIOB, GPIOC };
+    uint16_t port_samples_[sizeof(ports_to_sample) / sizeof(ports_to_sample[0])] = {0};
+    uint32_t gpio_states_ = 0; // bit i = state of GPIOi at the last sampling_cb()
     bool task_timers_armed_ = false;
     TaskTimes task_times_;
+    ThreadWakeLatencies thread_wake_latencies_;
+    IrqLatencies irq_latencies_;
+    SetpointLatencies setpoint_latencies_;
+    EnergyCounters energy_;
+    SyncStatus sync_;
+    RamArenaUsage ram_arena_;
+    float calibration_bus_current_ = 0.0f; // [A] sum reserved by calibrating axes
+    uint32_t n_calibrating_axes_ = 0;
     const bool otp_valid_ = ((uint8_t*)FLASH_OTP_BASE)[0] != 0xff;
 };
 
 extern ODrive odrv; // defined in main.cpp
 
+// @brief Event log source of a component of the specified axis, given the
+// source of the same component of axis0
+inline uint8_t axis_event_source(ODrive::EventSource axis0_source, size_t axis_num) {
+    return axis0_source + axis_num * (ODrive::EVENT_SOURCE_AXIS1 - ODrive::EVENT_SOURCE_AXIS0);
+}
+
 #endif // __cplusplus
 
 #endif /* __ODRIVE_MAIN_H */
@@ -1,27 +1,222 @@
+#include "odrive_main.h"
+#include <algorithm>
 
-#include "oscilloscope.hpp"
+// @brief Hands the slice of the RAM arena to the oscilloscope. Only called at
+// boot, before any capture.
+void Oscilloscope::set_buffer(void* buffer, size_t bytes) {
+    data_ = (float*)buffer;
+    data_int16_ = (int16_t*)buffer;
+    size_ = buffer ? bytes / sizeof(float) : 0;
+}
+
+/**
+ * @brief Resolves the configured channels and the trigger and arms the
+ * capture. Fails if no channel refers to a numeric property, if an int16
+ * channel has no positive scale or if the buffer can't hold one sample of
+ * all channels.
+ */
+bool Oscilloscope::start() {
+    FloatEndpointReader channels[OSCILLOSCOPE_MAX_CHANNELS];
+    float scales[OSCILLOSCOPE_MAX_CHANNELS];
+    uint32_t n_channels = 0;
+    for (size_t i = 0; i < OSCILLOSCOPE_MAX_CHANNELS; ++i) {
+        if (fibre::get_float_endpoint_reader(config_.channels[i], &channels[n_channels])) {
+            scales[n_channels] = config_.scales[i];
+            if (config_.sample_format == SAMPLE_FORMAT_INT16 && !(scales[n_channels] > 0.0f)) {
+                return false;
+            }
+            n_channels++;
+        }
+    }
+    uint32_t capacity = (config_.sample_format == SAMPLE_FORMAT_INT16 ? 2 * size_ : size_) / std::max<uint32_t>(n_channels, 1);
+    if (!n_channels || !capacity) {
+        return false;
+    }
+    FloatEndpointReader trigger;
+    bool has_trigger = fibre::get_float_endpoint_reader(config_.trigger, &trigger);
+
+    CRITICAL_SECTION() {
+        for (size_t i = 0; i < n_channels; ++i) {
+            channels_[i] = channels[i];
+            scales_[i] = scales[i];
+        }
+        n_channels_ = n_channels;
+        trigger_ = trigger;
+        has_trigger_ = has_trigger;
+        sample_format_ = config_.sample_format;
+        capacity_ = capacity;
+        pretrigger_samples_ = std::min((uint32_t)(std::clamp(config_.pretrigger, 0.0f, 1.0f) * (float)capacity_), capacity_ - 1);
+        n_captures_ = 0;
+        arm();
+    }
+    return true;
+}
+
+void Oscilloscope::stop() {
+    CRITICAL_SECTION() {
+        ready_ = false;
+        capturing_ = false;
+    }
+}
+
+void Oscilloscope::arm() {
+    n_samples_ = 0;
+    write_pos_ = 0;
+    trigger_index_ = 0;
+    decimation_count_ = 0;
+    bucket_trigger_ = false;
+    last_trigger_val_ = NAN;
+    last_any_error_ = odrv.any_error();
+    capturing_ = false;
+    ready_ = true;
+}
+
+float Oscilloscope::get_val(uint32_t index) {
+    uint32_t n_channels = std::max<uint32_t>(n_channels_, 1);
+    uint32_t sample = index / n_channels;
+    if (!capacity_ || sample >= n_samples_) {
+        return NAN;
+    }
+    // Once the ring buffer wrapped, the oldest sample is the next one to be
+    // overwritten
+    uint32_t oldest = n_samples_ < capacity_ ? 0 : write_pos_;
+    uint32_t channel = index % n_channels;
+    uint32_t pos = ((oldest + sample) % capacity_) * n_channels + channel;
+    if (sample_format_ == SAMPLE_FORMAT_INT16) {
+        int16_t val = data_int16_[pos];
+        return val == INT16_MIN ? NAN : (float)val * scales_[channel];
+    }
+    return data_[pos];
+}
+
+// @brief Evaluates the trigger on the latest sample
+bool Oscilloscope::check_trigger() {
+    if (config_.trigger_mode == TRIGGER_MODE_ANY_ERROR) {
+        bool any_error = odrv.any_error();
+        bool fired = any_error && !last_any_error_;
+        last_any_error_ = any_error;
+        return fired;
+    }
 
-// if you use the oscilloscope feature you can bump up this value
-#define OSCILLOSCOPE_SIZE 4096
+    float val = 0.0f;
+    if (!has_trigger_ || !trigger_.read(&val)) {
+        return true;
+    }
+    float last_val = last_trigger_val_;
+    last_trigger_val_ = val;
+    float threshold = config_.trigger_threshold;
 
+    switch (config_.trigger_mode) {
+        case TRIGGER_MODE_RISING_EDGE: return last_val < threshold && val >= threshold;
+        case TRIGGER_MODE_FALLING_EDGE: return last_val >= threshold && val < threshold;
+        case TRIGGER_MODE_LEVEL: return val >= threshold;
+        case TRIGGER_MODE_CHANGE: return !is_nan(last_val) && val != last_val;
+        default: return false;
+    }
+}
+
+// @brief Writes one sample to the ring buffer and advances the capture
+// @param trigger: The trigger fired since the previous sample
+void Oscilloscope::push_sample(const float* vals, bool trigger) {
+    if (!ready_ && !capturing_) {
+        return;
+    }
+
+    uint32_t pos = write_pos_;
+    if (sample_format_ == SAMPLE_FORMAT_INT16) {
+        int16_t* sample = &data_int16_[pos * n_channels_];
+        for (size_t i = 0; i < n_channels_; ++i) {
+            // INT16_MIN is reserved for NaN
+            float val = vals[i] / scales_[i];
+            sample[i] = is_nan(val) ? INT16_MIN : (int16_t)std::clamp(std::round(val), -32767.0f, 32767.0f);
+        }
+    } else {
+        float* sample = &data_[pos * n_channels_];
+        for (size_t i = 0; i < n_channels_; ++i) {
+            sample[i] = vals[i];
+        }
+    }
+    write_pos_ = (write_pos_ + 1) % capacity_;
+    n_samples_ = std::min(n_samples_ + 1, capacity_);
+
+    if (ready_) {
+        // The trigger only fires once the pretrigger part of the buffer is
+        // filled
+        if (trigger && n_samples_ > pretrigger_samples_) {
+            ready_ = false;
+            capturing_ = true;
+            trigger_pos_ = pos;
+            post_trigger_remaining_ = capacity_ - pretrigger_samples_ - 1;
+        }
+    } else if (post_trigger_remaining_) {
+        post_trigger_remaining_--;
+    }
+
+    if (capturing_ && !post_trigger_remaining_) {
+        uint32_t oldest = n_samples_ < capacity_ ? 0 : write_pos_;
+        trigger_index_ = (trigger_pos_ + capacity_ - oldest) % capacity_;
+        capturing_ = false;
+        n_captures_++;
+        // The ring buffer continues, so the next capture can trigger right
+        // away. It overwrites this one over time, stop() freezes the buffer.
+        ready_ = config_.auto_rearm;
+    }
+}
+
+// @brief Called once per control loop iteration after all components updated
 void Oscilloscope::update() {
-    float trigger_data = trigger_src_ ? *trigger_src_ : 0.0f;
-    float trigger_threshold = trigger_threshold_;
-    float sample_data = data_src_ ? **data_src_ : 0.0f;
+    if (!ready_ && !capturing_) {
+        return;
+    }
 
-    if (trigger_data < trigger_threshold) {
-        ready_ = true;
+    // The edge state is tracked on every iteration, so that short events
+    // between two samples still trigger
+    if (ready_) {
+        bucket_trigger_ = check_trigger() || bucket_trigger_;
     }
-    if (ready_ && trigger_data >= trigger_threshold) {
-        capturing_ = true;
-        ready_ = false;
+
+    uint32_t decimation = std::max<uint32_t>(config_.decimation, 1);
+    uint32_t count = decimation_count_++;
+    DecimationMode mode = config_.decimation_mode;
+
+    if (mode == DECIMATION_MODE_SAMPLE) {
+        // Only the first iteration of each bucket is read
+        if (!count) {
+            for (size_t i = 0; i < n_channels_; ++i) {
+                bucket_a_[i] = NAN;
+                channels_[i].read(&bucket_a_[i]);
+            }
+        }
+    } else {
+        for (size_t i = 0; i < n_channels_; ++i) {
+            float val = NAN;
+            channels_[i].read(&val);
+            if (mode == DECIMATION_MODE_AVERAGE) {
+                bucket_a_[i] = count ? bucket_a_[i] + val : val;
+            } else {
+                // fmin and fmax skip NaN values
+                bucket_a_[i] = count ? std::fmin(bucket_a_[i], val) : val;
+                bucket_b_[i] = count ? std::fmax(bucket_b_[i], val) : val;
+            }
+        }
+    }
+
+    if (decimation_count_ < decimation) {
+        return;
     }
-    if (capturing_) {
-        if (pos_ < OSCILLOSCOPE_SIZE) {
-            data_[pos_++] = sample_data;
-        } else {
-            pos_ = 0;
-            capturing_ = false;
+    decimation_count_ = 0;
+    bool trigger = bucket_trigger_;
+    bucket_trigger_ = false;
+
+    if (mode == DECIMATION_MODE_AVERAGE) {
+        for (size_t i = 0; i < n_channels_; ++i) {
+            bucket_a_[i] /= (float)decimation;
         }
     }
+    push_sample(bucket_a_, trigger);
+    if (mode == DECIMATION_MODE_MIN_MAX) {
+        // The maximum follows the minimum as a separate sample, which shows
+        // the envelope of the signal when plotted
+        push_sample(bucket_b_, false);
+    }
 }
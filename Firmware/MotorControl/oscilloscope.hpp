@@ -2,30 +2,83 @@
 #define __OSCILLOSCOPE_HPP
 
 #include <autogen/interfaces.hpp>
+#include <fibre/introspection.hpp>
 
-// if you use the oscilloscope feature you can bump up this value
-#define OSCILLOSCOPE_SIZE 4096
+#define OSCILLOSCOPE_MAX_CHANNELS 8
 
+/**
+ * @brief Captures up to OSCILLOSCOPE_MAX_CHANNELS numeric properties in the
+ * same control loop iteration.
+ *
+ * The channels and the trigger are endpoint references that are resolved
+ * when the capture is started. While armed, the samples go into a ring
+ * buffer, so that the capture includes `pretrigger` of the buffer before
+ * the trigger event. Sample k of channel c is at index k * n_channels + c
+ * with k = 0 being the oldest sample.
+ *
+ * With SAMPLE_FORMAT_INT16 each value is stored as round(value / scale) in
+ * half the space, which doubles the capacity of the buffer.
+ *
+ * The buffer is a slice of the RAM arena that is sized at boot by
+ * config.oscilloscope_depth and config.oscilloscope_channels of the ODrive.
+ */
 class Oscilloscope : public ODriveIntf::OscilloscopeIntf {
 public:
-    Oscilloscope(float* trigger_src, float trigger_threshold, float** data_src)
-        : trigger_src_(trigger_src), trigger_threshold_(trigger_threshold), data_src_(data_src) {}
+    struct Config_t {
+        endpoint_ref_t channels[OSCILLOSCOPE_MAX_CHANNELS] = {}; // unused channels are invalid references
+        endpoint_ref_t trigger = {0, 0}; // an invalid reference triggers right away, except for TRIGGER_MODE_ANY_ERROR
+        TriggerMode trigger_mode = TRIGGER_MODE_RISING_EDGE;
+        float trigger_threshold = 0.5f;
+        float pretrigger = 0.0f; // fraction of the buffer before the trigger event
+        bool auto_rearm = false; // wait for the next trigger when a capture is complete
+        uint32_t decimation = 1; // control loop iterations per sample
+        DecimationMode decimation_mode = DECIMATION_MODE_SAMPLE;
+        SampleFormat sample_format = SAMPLE_FORMAT_FLOAT32;
+        float scales[OSCILLOSCOPE_MAX_CHANNELS] = {1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f}; // value per LSB for SAMPLE_FORMAT_INT16
+    };
 
-    float get_val(uint32_t index) override {
-        return index < OSCILLOSCOPE_SIZE ? data_[index] : NAN;
-    }
+    float get_val(uint32_t index) override;
 
+    bool start() override;
+    void stop() override;
     void update();
+    void set_buffer(void* buffer, size_t bytes);
 
-    const uint32_t size_ = OSCILLOSCOPE_SIZE;
-    const float* trigger_src_;
-    const float trigger_threshold_;
-    float* const * data_src_;
+    Config_t config_;
 
-    float data_[OSCILLOSCOPE_SIZE] = {0};
-    size_t pos_ = 0;
-    bool ready_ = false;
-    bool capturing_ = false;
+    uint32_t size_ = 0; // [float32 values] of the buffer
+    uint32_t n_channels_ = 0;
+    uint32_t capacity_ = 0; // [samples] per channel
+    uint32_t n_samples_ = 0; // valid samples in the buffer
+    uint32_t trigger_index_ = 0; // sample index of the trigger event in the last capture
+    uint32_t n_captures_ = 0; // completed captures since start()
+    bool ready_ = false; // armed, waiting for the trigger
+    bool capturing_ = false; // triggered, capturing the remainder
+
+    // The same buffer in both sample formats
+    float* data_ = nullptr;
+    int16_t* data_int16_ = nullptr;
+
+private:
+    void arm();
+    bool check_trigger();
+    void push_sample(const float* vals, bool trigger);
+
+    FloatEndpointReader channels_[OSCILLOSCOPE_MAX_CHANNELS];
+    FloatEndpointReader trigger_;
+    bool has_trigger_ = false;
+    float last_trigger_val_ = NAN;
+    bool last_any_error_ = false;
+    SampleFormat sample_format_ = SAMPLE_FORMAT_FLOAT32;
+    float scales_[OSCILLOSCOPE_MAX_CHANNELS];
+    uint32_t pretrigger_samples_ = 0;
+    uint32_t write_pos_ = 0; // [samples]
+    uint32_t trigger_pos_ = 0; // [samples]
+    uint32_t post_trigger_remaining_ = 0; // [samples]
+    uint32_t decimation_count_ = 0;
+    bool bucket_trigger_ = false; // the trigger fired within the current decimation bucket
+    float bucket_a_[OSCILLOSCOPE_MAX_CHANNELS]; // sample, sum or min
+    float bucket_b_[OSCILLOSCOPE_MAX_CHANNELS]; // max
 };
 
-#endif // __OSCILLOSCOPE_HPP
\ No newline at end of file
+#endif // __OSCILLOSCOPE_HPP
@@ -3,6 +3,7 @@
 
 #include <autogen/interfaces.hpp>
 #include <variant>
+#include "utils.hpp"
 
 template<size_t N_PHASES>
 class PhaseControlLaw {
@@ -71,6 +72,10 @@ public:
 };
 
 class AlphaBetaFrameController : public PhaseControlLaw<3> {
+public:
+    // Config - set while this controller is inactive
+    SvmOvermodulation_t svm_overmodulation_ = SVM_OVERMODULATION_NONE;
+
 private:
     ODriveIntf::MotorIntf::Error on_measurement(
             std::optional<float> vbus_voltage,
@@ -0,0 +1,73 @@
+#ifndef __PHASE_CURRENT_RECONSTRUCTION_HPP
+#define __PHASE_CURRENT_RECONSTRUCTION_HPP
+
+#include <stddef.h>
+#include <optional>
+
+/**
+ * @brief Reconstructs the three phase currents from the low-side shunts whose
+ * sample fell into a long enough low-side on time.
+ *
+ * A shunt only carries the phase current while its low-side switch is on.
+ * The sample is taken in the middle of the all-low zero vector, whose length
+ * for each phase equals its rising edge timing from SVM(). At high modulation
+ * the smallest timing gets too short for the amplifier to settle and that
+ * sample is corrupted.
+ *
+ * - Two or more clean shunts: the two with the longest windows are used, the
+ *   third phase follows from Ia + Ib + Ic = 0.
+ * - One clean shunt: the other two phases are the prediction, corrected by
+ *   the same amount each so that the sum is zero. This is the least squares
+ *   fit of the prediction to the measurement and the constraint.
+ * - None: the prediction, made zero sum.
+ *
+ * @param measured: Phase currents [A], std::nullopt for phases without a
+ *        shunt.
+ * @param windows: Low-side on time of each phase around the sample [PWM
+ *        periods].
+ * @param min_window: Shorter windows are considered corrupted [PWM periods].
+ * @param predicted: Expected phase currents of this sample [A].
+ * @param out: Reconstructed phase currents [A].
+ * @returns The number of measurements that were used (0 to 2).
+ */
+inline size_t reconstruct_phase_currents(const std::optional<float> (&measured)[3],
+        const float (&windows)[3], float min_window, const float (&predicted)[3],
+        float (&out)[3]) {
+    // The two phases with the longest clean windows
+    size_t best = 3, second = 3;
+    for (size_t i = 0; i < 3; ++i) {
+        if (!measured[i].has_value() || !(windows[i] >= min_window)) {
+            continue;
+        }
+        if (best == 3 || windows[i] > windows[best]) {
+            second = best;
+            best = i;
+        } else if (second == 3 || windows[i] > windows[second]) {
+            second = i;
+        }
+    }
+
+    if (second != 3) {
+        size_t other = 3 - best - second;
+        out[best] = *measured[best];
+        out[second] = *measured[second];
+        out[other] = -out[best] - out[second];
+        return 2;
+    } else if (best != 3) {
+        size_t j = (best + 1) % 3;
+        size_t k = (best + 2) % 3;
+        float correction = -0.5f * (*measured[best] + predicted[j] + predicted[k]);
+        out[best] = *measured[best];
+        out[j] = predicted[j] + correction;
+        out[k] = predicted[k] + correction;
+        return 1;
+    } else {
+        float correction = -(predicted[0] + predicted[1] + predicted[2]) / 3.0f;
+        for (size_t i = 0; i < 3; ++i) {
+            out[i] = predicted[i] + correction;
+        }
+        return 0;
+    }
+}
+
+#endif // __PHASE_CURRENT_RECONSTRUCTION_HPP
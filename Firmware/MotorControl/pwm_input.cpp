@@ -2,6 +2,8 @@
 #include "pwm_input.hpp"
 #include "odrive_main.h"
 
+#include <algorithm>
+
 void PwmInput::init() {
     TIM_IC_InitTypeDef sConfigIC;
     sConfigIC.ICPolarity = TIM_INPUTCHANNELPOLARITY_BOTHEDGE;
@@ -27,32 +29,27 @@ void PwmInput::init() {
 #define PWM_MAX_LEGAL_HIGH_TIME    ((TIM_2_5_CLOCK_HZ / 1000000UL) * 2500UL) // ignore high periods longer than 2.5ms
 #define PWM_INVERT_INPUT        false
 
-/**
- * @param channel: A channel number in [0, 3]
- */
-void handle_pulse(int channel, uint32_t high_time) {
-    if (high_time < PWM_MIN_LEGAL_HIGH_TIME || high_time > PWM_MAX_LEGAL_HIGH_TIME)
-        return;
-
-    if (high_time < PWM_MIN_HIGH_TIME)
-        high_time = PWM_MIN_HIGH_TIME;
-    if (high_time > PWM_MAX_HIGH_TIME)
-        high_time = PWM_MAX_HIGH_TIME;
-    float fraction = (float)(high_time - PWM_MIN_HIGH_TIME) / (float)(PWM_MAX_HIGH_TIME - PWM_MIN_HIGH_TIME);
-    float value = odrv.config_.pwm_mappings[channel].min +
-                  (fraction * (odrv.config_.pwm_mappings[channel].max - odrv.config_.pwm_mappings[channel].min));
+#define PWM_TIMEOUT             0.1f // [s] endpoints are no longer written when the pulses stop for this long
 
-    fibre::set_endpoint_from_float(odrv.config_.pwm_mappings[channel].endpoint, value);
+float MappingFilter::update(const PWMMapping_t& map, float fraction, float dt) {
+    float target = map.min + (fraction * (map.max - map.min));
+    float alpha = std::min(map.filter_bandwidth * dt, 1.0f);
+    if (!valid || map.filter_bandwidth <= 0.0f) {
+        value = target;
+        valid = true;
+    } else {
+        value += alpha * (target - value);
+    }
+    return value;
 }
 
 /**
  * @param channel: A channel number in [0, 3]
+ *
+ * Only latches the pulse width, the mapping runs later in update() so that the
+ * interrupt stays short and doesn't call into endpoint setters.
  */
 void PwmInput::on_capture(int channel, uint32_t timestamp) {
-    static uint32_t last_timestamp[4] = { 0 };
-    static bool last_pin_state[4] = { false };
-    static bool last_sample_valid[4] = { false };
-
     if (channel >= 4)
         return;
     Stm32Gpio gpio = get_gpio(gpios_[channel]);
@@ -60,31 +57,61 @@ void PwmInput::on_capture(int channel, uint32_t timestamp) {
         return;
     bool current_pin_state = gpio.read();
 
-    if (last_sample_valid[channel]
-        && (last_pin_state[channel] != PWM_INVERT_INPUT)
+    if (last_sample_valid_[channel]
+        && (last_pin_state_[channel] != PWM_INVERT_INPUT)
         && (current_pin_state == PWM_INVERT_INPUT)) {
-        handle_pulse(channel, timestamp - last_timestamp[channel]);
+        uint32_t high_time = timestamp - last_timestamp_[channel];
+        if (high_time >= PWM_MIN_LEGAL_HIGH_TIME && high_time <= PWM_MAX_LEGAL_HIGH_TIME) {
+            high_time_[channel] = high_time;
+            n_pulses_[channel] = n_pulses_[channel] + 1;
+        }
     }
 
-    last_timestamp[channel] = timestamp;
-    last_pin_state[channel] = current_pin_state;
-    last_sample_valid[channel] = true;
+    last_timestamp_[channel] = timestamp;
+    last_pin_state_[channel] = current_pin_state;
+    last_sample_valid_[channel] = true;
+}
+
+void PwmInput::update(float dt) {
+    for (size_t i = 0; i < 4; ++i) {
+        const PWMMapping_t& map = odrv.config_.pwm_mappings[i];
+        if (!fibre::is_endpoint_ref_valid(map.endpoint))
+            continue;
+
+        uint32_t n_pulses = n_pulses_[i];
+        if (n_pulses != last_n_pulses_[i]) {
+            last_n_pulses_[i] = n_pulses;
+            idle_time_[i] = 0.0f;
+        } else if (idle_time_[i] < PWM_TIMEOUT) {
+            idle_time_[i] += dt;
+        }
+        if (!filters_[i].valid && n_pulses == 0)
+            continue; // no pulse yet
+        if (idle_time_[i] >= PWM_TIMEOUT)
+            continue; // signal lost, the endpoint keeps its last value
+
+        uint32_t high_time = std::clamp<uint32_t>(high_time_[i], PWM_MIN_HIGH_TIME, PWM_MAX_HIGH_TIME);
+        float fraction = (float)(high_time - PWM_MIN_HIGH_TIME) / (float)(PWM_MAX_HIGH_TIME - PWM_MIN_HIGH_TIME);
+        fibre::set_endpoint_from_float(map.endpoint, filters_[i].update(map, fraction, dt));
+    }
 }
 
+// Channels without a mapping may be used by something else on the same timer
+// (see init_sync()), so only the enabled interrupts are handled.
 void PwmInput::on_capture() {
-    if(__HAL_TIM_GET_FLAG(htim_, TIM_FLAG_CC1)) {
+    if(__HAL_TIM_GET_FLAG(htim_, TIM_FLAG_CC1) && __HAL_TIM_GET_IT_SOURCE(htim_, TIM_IT_CC1)) {
         __HAL_TIM_CLEAR_IT(htim_, TIM_IT_CC1);
         on_capture(0, htim_->Instance->CCR1);
     }
-    if(__HAL_TIM_GET_FLAG(htim_, TIM_FLAG_CC2)) {
+    if(__HAL_TIM_GET_FLAG(htim_, TIM_FLAG_CC2) && __HAL_TIM_GET_IT_SOURCE(htim_, TIM_IT_CC2)) {
         __HAL_TIM_CLEAR_IT(htim_, TIM_IT_CC2);
         on_capture(1, htim_->Instance->CCR2);
     }
-    if(__HAL_TIM_GET_FLAG(htim_, TIM_FLAG_CC3)) {
+    if(__HAL_TIM_GET_FLAG(htim_, TIM_FLAG_CC3) && __HAL_TIM_GET_IT_SOURCE(htim_, TIM_IT_CC3)) {
         __HAL_TIM_CLEAR_IT(htim_, TIM_IT_CC3);
         on_capture(2, htim_->Instance->CCR3);
     }
-    if(__HAL_TIM_GET_FLAG(htim_, TIM_FLAG_CC4)) {
+    if(__HAL_TIM_GET_FLAG(htim_, TIM_FLAG_CC4) && __HAL_TIM_GET_IT_SOURCE(htim_, TIM_IT_CC4)) {
         __HAL_TIM_CLEAR_IT(htim_, TIM_IT_CC4);
         on_capture(3, htim_->Instance->CCR4);
     }
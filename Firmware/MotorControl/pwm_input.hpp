@@ -4,6 +4,24 @@
 #include <tim.h>
 #include <array>
 
+struct PWMMapping_t;
+
+/**
+ * @brief Output state of an input mapping (PWM or analog).
+ */
+struct MappingFilter {
+    float value = 0.0f;
+    bool valid = false; // false until the first sample
+
+    /**
+     * @brief Scales `fraction` from [0, 1] to [map.min, map.max] and runs it
+     * through the first-order low-pass filter of the mapping.
+     * @param dt: Time since the last call [s]
+     * @returns The filtered value.
+     */
+    float update(const PWMMapping_t& map, float fraction, float dt);
+};
+
 class PwmInput {
 public:
     PwmInput(TIM_HandleTypeDef* htim, std::array<uint16_t, 4> gpios)
@@ -12,11 +30,30 @@ public:
     void init();
     void on_capture();
 
+    /**
+     * @brief Writes the latest pulses to the mapped endpoints. Called from the
+     * control loop, see schedule::input_mapping_update.
+     * @param dt: Time since the last call [s]
+     */
+    void update(float dt);
+
 private:
     void on_capture(int channel, uint32_t timestamp);
 
     TIM_HandleTypeDef* htim_;
     std::array<uint16_t, 4> gpios_;
+
+    // Written by the capture interrupt
+    uint32_t last_timestamp_[4] = {0};
+    bool last_pin_state_[4] = {false};
+    bool last_sample_valid_[4] = {false};
+    volatile uint32_t high_time_[4] = {0}; // last legal pulse [timer ticks]
+    volatile uint32_t n_pulses_[4] = {0}; // number of legal pulses
+
+    // Owned by update()
+    uint32_t last_n_pulses_[4] = {0};
+    float idle_time_[4] = {0.0f}; // time since the last pulse [s]
+    MappingFilter filters_[4];
 };
 
-#endif // __PWM_INPUT_HPP
\ No newline at end of file
+#endif // __PWM_INPUT_HPP
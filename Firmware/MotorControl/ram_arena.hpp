@@ -0,0 +1,62 @@
+#ifndef __RAM_ARENA_HPP
+#define __RAM_ARENA_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+
+/**
+ * @brief Fixed block of RAM that is handed out in consecutive slices, once at
+ * boot from the config (see partition_ram_arena() in main.cpp).
+ *
+ * Slices are never freed one by one. reset() starts over, which is only
+ * valid while none of the slices is in use.
+ */
+class RamArena {
+public:
+    RamArena(uint8_t* base, size_t size) : base_(base), size_(size) {}
+
+    void reset() { used_ = 0; }
+
+    /**
+     * @brief Returns the next `size` bytes, aligned to `align` (a power of
+     * two) relative to the base, or nullptr if they don't fit.
+     */
+    void* allocate(size_t size, size_t align) {
+        size_t offset = align_up(used_, align);
+        if (offset > size_ || size > size_ - offset) {
+            return nullptr;
+        }
+        used_ = offset + size;
+        return base_ + offset;
+    }
+
+    /**
+     * @brief Like allocate(), but if `size` doesn't fit, hands out what is
+     * left instead, rounded down to a multiple of `align`.
+     * @param granted: Set to the number of bytes handed out.
+     * @returns nullptr if granted is 0.
+     */
+    void* allocate_up_to(size_t size, size_t align, size_t* granted) {
+        size_t offset = std::min(align_up(used_, align), size_);
+        size_t available = (size_ - offset) / align * align;
+        *granted = std::min(size, available);
+        return *granted ? allocate(*granted, align) : nullptr;
+    }
+
+    uint8_t* base() const { return base_; }
+    size_t size() const { return size_; }
+    size_t used() const { return used_; }
+    size_t available() const { return size_ - used_; }
+
+private:
+    static size_t align_up(size_t offset, size_t align) {
+        return (offset + align - 1) & ~(align - 1);
+    }
+
+    uint8_t* base_;
+    size_t size_;
+    size_t used_ = 0;
+};
+
+#endif // __RAM_ARENA_HPP
@@ -0,0 +1,268 @@
+#ifndef __RIPPLE_MODEL_HPP
+#define __RIPPLE_MODEL_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <cmath>
+
+/**
+ * @brief Harmonic model of the position-dependent torque ripple and friction
+ * of a transmission.
+ *
+ * Unlike the cogging model, the harmonics refer to a configurable period (e.g.
+ * one output turn of a gearbox, in turns of the motor encoder) and each
+ * harmonic has a second pair of coefficients that is applied with the sign of
+ * the velocity:
+ *
+ *   torque(pos, dir) = coulomb(dir)
+ *                    + sum(a * cos(2*pi*order*pos) + b * sin(2*pi*order*pos))
+ *                    + dir * sum(a_friction * cos(2*pi*order*pos) + b_friction * sin(2*pi*order*pos))
+ *
+ * with pos in periods, dir in {-1, 0, 1} and coulomb(dir) = coulomb_pos for
+ * dir > 0, coulomb_neg for dir < 0, 0 otherwise.
+ */
+namespace ripple_model {
+
+static constexpr size_t MAX_HARMONICS = 8;
+
+struct Harmonic_t {
+    uint32_t order;     // [1/period]
+    float a;            // [Nm] cosine coefficient of the ripple
+    float b;            // [Nm] sine coefficient of the ripple
+    float a_friction;   // [Nm] cosine coefficient of the friction
+    float b_friction;   // [Nm] sine coefficient of the friction
+};
+
+/**
+ * @brief Calls fn(i, cos, sin) with the phase of each harmonic at pos_frac
+ * [period] in [0, 1).
+ *
+ * Only the fundamental goes through sin_cos. The phases of the orders are
+ * composed of its powers of two, which are generated by the angle doubling
+ * recurrence, so each harmonic costs one complex multiply per set bit of its
+ * order.
+ *
+ * @param sin_cos: Callable with the signature of our_arm_sin_cos_f32().
+ */
+template<typename TSinCos, typename TFn>
+void for_each_phase(const Harmonic_t* harmonics, size_t count, float pos_frac, TSinCos sin_cos, TFn fn) {
+    uint32_t all_orders = 0;
+    for (size_t i = 0; i < count; ++i) {
+        all_orders |= harmonics[i].order;
+    }
+
+    float pow2_c[32];
+    float pow2_s[32];
+    size_t n_bits = 0;
+    float c, s;
+    sin_cos(2.0f * (float)M_PI * pos_frac, &s, &c);
+    for (; n_bits < 32 && (all_orders >> n_bits); ++n_bits) {
+        pow2_c[n_bits] = c;
+        pow2_s[n_bits] = s;
+        float c_next = c * c - s * s;
+        s = 2.0f * c * s;
+        c = c_next;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        float hc = 1.0f, hs = 0.0f;
+        for (uint32_t order = harmonics[i].order, bit = 0; order; order >>= 1, ++bit) {
+            if (order & 1) {
+                float hc_next = hc * pow2_c[bit] - hs * pow2_s[bit];
+                hs = hs * pow2_c[bit] + hc * pow2_s[bit];
+                hc = hc_next;
+            }
+        }
+        fn(i, hc, hs);
+    }
+}
+
+/**
+ * @brief Evaluates the model at pos_frac [period] in [0, 1) for the
+ * direction dir (sign of the velocity, 0 at standstill).
+ */
+template<typename TSinCos>
+float eval(const Harmonic_t* harmonics, size_t count, float coulomb_pos, float coulomb_neg,
+           float pos_frac, float dir, TSinCos sin_cos) {
+    float ripple = 0.0f;
+    float friction = 0.0f;
+    for_each_phase(harmonics, count, pos_frac, sin_cos, [&](size_t i, float c, float s) {
+        ripple += harmonics[i].a * c + harmonics[i].b * s;
+        friction += harmonics[i].a_friction * c + harmonics[i].b_friction * s;
+    });
+    float coulomb = (dir > 0.0f) ? coulomb_pos : (dir < 0.0f) ? coulomb_neg : 0.0f;
+    return coulomb + ripple + dir * friction;
+}
+
+/**
+ * @brief Identifies the coefficients of a given set of orders by sweeping one
+ * period forward and one period backward at constant velocity.
+ *
+ * At constant velocity the samples are spread evenly over the period, so the
+ * Fourier coefficients are plain projections of the torque that can be
+ * accumulated while sweeping, without a map. The mean of both directions is
+ * the ripple, half of the difference is the friction, and the mean torque of
+ * each direction is its Coulomb term. A lead-in of `leadin` before each
+ * direction lets the velocity settle.
+ */
+class RippleId {
+public:
+    struct Setpoint_t {
+        float pos;  // [turn]
+        float vel;  // [turn/s]
+    };
+
+    /**
+     * @brief Starts the sweep at pos [turn] for the orders of harmonics.
+     * Returns false if the parameters are invalid.
+     */
+    bool start(const Harmonic_t* harmonics, size_t count, float period, float pos) {
+        if (count == 0 || count > MAX_HARMONICS || !(period > 0.0f) || !(vel > 0.0f)) {
+            return false;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            harmonics_[i] = {harmonics[i].order, 0.0f, 0.0f, 0.0f, 0.0f};
+            proj_[i][0] = proj_[i][1] = 0.0f;
+        }
+        count_ = count;
+        period_ = period;
+        setpoint_ = pos;
+        segment_end_ = pos + leadin;
+        segment_ = SEGMENT_FORWARD_LEADIN;
+        have_last_pos_ = false;
+        valid = false;
+        active = true;
+        return true;
+    }
+
+    void stop() {
+        active = false;
+    }
+
+    /**
+     * @brief Records the response to the previous setpoint and returns the
+     * next one. At the end of the sweep the results are stored and active is
+     * cleared.
+     * @param pos_estimate: Position estimate of this cycle [turn]
+     * @param torque: Torque computed in the previous cycle [Nm]. It is
+     *        attributed to the position estimate of the previous cycle that it
+     *        was computed from.
+     */
+    template<typename TSinCos>
+    Setpoint_t step(float pos_estimate, float torque, float dt, TSinCos sin_cos) {
+        if (!active) {
+            return {pos_estimate, 0.0f};
+        }
+
+        bool forward = segment_ == SEGMENT_FORWARD_LEADIN || segment_ == SEGMENT_FORWARD;
+        if ((segment_ == SEGMENT_FORWARD || segment_ == SEGMENT_REVERSE) && have_last_pos_) {
+            float pos_frac = last_pos_ / period_;
+            pos_frac -= std::floor(pos_frac);
+            for_each_phase(harmonics_, count_, pos_frac, sin_cos, [&](size_t i, float c, float s) {
+                proj_[i][0] += torque * c;
+                proj_[i][1] += torque * s;
+            });
+            sum_ += torque;
+            n_samples_++;
+        }
+        last_pos_ = pos_estimate;
+        have_last_pos_ = true;
+
+        if (forward ? (pos_estimate >= segment_end_) : (pos_estimate <= segment_end_)) {
+            switch (segment_) {
+                case SEGMENT_FORWARD_LEADIN:
+                case SEGMENT_REVERSE_LEADIN: {
+                    for (size_t i = 0; i < count_; ++i) {
+                        proj_[i][0] = proj_[i][1] = 0.0f;
+                    }
+                    sum_ = 0.0f;
+                    n_samples_ = 0;
+                    segment_end_ = pos_estimate + (forward ? period_ : -period_);
+                    segment_ = forward ? SEGMENT_FORWARD : SEGMENT_REVERSE;
+                } break;
+                case SEGMENT_FORWARD: {
+                    if (!store_direction(1.0f)) {
+                        active = false;
+                        return {pos_estimate, 0.0f};
+                    }
+                    segment_end_ = pos_estimate - leadin;
+                    segment_ = SEGMENT_REVERSE_LEADIN;
+                    forward = false;
+                } break;
+                case SEGMENT_REVERSE: {
+                    active = false;
+                    valid = store_direction(-1.0f);
+                    return {pos_estimate, 0.0f};
+                }
+            }
+        }
+
+        float v = forward ? vel : -vel;
+        setpoint_ += v * dt;
+        return {setpoint_, v};
+    }
+
+    // @brief Coefficients of the completed sweep, in the order given to start()
+    const Harmonic_t* harmonics() const { return harmonics_; }
+    size_t count() const { return count_; }
+
+    // Parameters
+    float vel = 0.2f;           // [turn/s]
+    float leadin = 0.05f;       // [turn]
+
+    // State
+    bool active = false;
+    bool valid = false;         // the results are from a completed sweep
+    float coulomb_pos = 0.0f;   // [Nm]
+    float coulomb_neg = 0.0f;   // [Nm]
+
+private:
+    enum Segment_t : uint8_t {
+        SEGMENT_FORWARD_LEADIN,
+        SEGMENT_FORWARD,
+        SEGMENT_REVERSE_LEADIN,
+        SEGMENT_REVERSE,
+    };
+
+    // The forward sweep stores its coefficients as they are, the reverse
+    // sweep splits them into the mean and the half difference.
+    bool store_direction(float dir) {
+        if (n_samples_ == 0) {
+            return false;
+        }
+        float scale = 2.0f / (float)n_samples_;
+        for (size_t i = 0; i < count_; ++i) {
+            float a = proj_[i][0] * scale;
+            float b = proj_[i][1] * scale;
+            if (dir > 0.0f) {
+                harmonics_[i].a_friction = a;
+                harmonics_[i].b_friction = b;
+            } else {
+                float a_fwd = harmonics_[i].a_friction;
+                float b_fwd = harmonics_[i].b_friction;
+                harmonics_[i].a = 0.5f * (a_fwd + a);
+                harmonics_[i].b = 0.5f * (b_fwd + b);
+                harmonics_[i].a_friction = 0.5f * (a_fwd - a);
+                harmonics_[i].b_friction = 0.5f * (b_fwd - b);
+            }
+        }
+        (dir > 0.0f ? coulomb_pos : coulomb_neg) = sum_ / (float)n_samples_;
+        return true;
+    }
+
+    Harmonic_t harmonics_[MAX_HARMONICS] = {};
+    float proj_[MAX_HARMONICS][2] = {};  // sums of torque * cos and torque * sin
+    size_t count_ = 0;
+    float period_ = 1.0f;       // [turn]
+    float sum_ = 0.0f;          // [Nm] sum of the torque samples of the current direction
+    uint32_t n_samples_ = 0;
+    float setpoint_ = 0.0f;     // [turn]
+    float segment_end_ = 0.0f;  // [turn]
+    Segment_t segment_ = SEGMENT_FORWARD_LEADIN;
+    float last_pos_ = 0.0f;     // [turn] position estimate of the previous step
+    bool have_last_pos_ = false;
+};
+
+}
+
+#endif // __RIPPLE_MODEL_HPP
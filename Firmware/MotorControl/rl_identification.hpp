@@ -0,0 +1,141 @@
+#ifndef __RL_IDENTIFICATION_HPP
+#define __RL_IDENTIFICATION_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <cmath>
+
+/**
+ * @brief Maximum length pseudo random binary sequence of period 127
+ */
+class Prbs7 {
+public:
+    // @brief Returns the next bit as +1 or -1
+    float next() {
+        uint8_t bit = ((state_ >> 6) ^ (state_ >> 5)) & 1;
+        state_ = ((state_ << 1) | bit) & 0x7f;
+        return bit ? 1.0f : -1.0f;
+    }
+
+private:
+    uint8_t state_ = 0x7f;
+};
+
+/**
+ * @brief Identifies the resistance and inductance of a winding from the
+ * response of the current to an arbitrary voltage sequence.
+ *
+ * Fits the discrete model I[k] - I[k-1] = alpha * I[k-1] + beta * V[k-1] + c
+ * by least squares, where V[k-1] is the voltage applied between the two
+ * measurements. The offset c absorbs voltage errors that are constant during
+ * the fit, such as the inverter drop at a current that doesn't change its
+ * sign, so the resistance is the one of the winding alone.
+ * The regressors are taken relative to the first sample to keep the sums well
+ * conditioned in single precision.
+ */
+class RLIdentification {
+public:
+    void reset() {
+        for (size_t i = 0; i < 3; ++i) {
+            xy_[i] = 0.0f;
+            for (size_t j = 0; j < 3; ++j) {
+                xx_[i][j] = 0.0f;
+            }
+        }
+        sum_y_ = 0.0f;
+        sum_yy_ = 0.0f;
+        n_samples_ = 0;
+        has_previous_ = false;
+    }
+
+    /**
+     * @param current: Current measured in this cycle [A]
+     * @param voltage: Voltage applied from the previous measurement to this one [V]
+     */
+    void add_sample(float current, float voltage) {
+        if (!has_previous_) {
+            I_ref_ = current;
+            V_ref_ = voltage;
+            has_previous_ = true;
+        } else {
+            float x[3] = {last_current_ - I_ref_, voltage - V_ref_, 1.0f};
+            float y = current - last_current_;
+            for (size_t i = 0; i < 3; ++i) {
+                xy_[i] += x[i] * y;
+                for (size_t j = 0; j < 3; ++j) {
+                    xx_[i][j] += x[i] * x[j];
+                }
+            }
+            sum_y_ += y;
+            sum_yy_ += y * y;
+            n_samples_++;
+        }
+        last_current_ = current;
+    }
+
+    /**
+     * @brief Computes resistance, inductance and quality from the samples so
+     * far. Returns false if the samples don't determine them, e.g. because
+     * there was no excitation.
+     * @param dt: Time between two samples [s]
+     */
+    bool fit(float dt) {
+        auto det3 = [](const float m[3][3]) {
+            return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+                 - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+                 + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+        };
+        float det = det3(xx_);
+        if (n_samples_ < 3 || !(std::abs(det) > 0.0f)) {
+            return false;
+        }
+        float theta[3];
+        for (size_t k = 0; k < 3; ++k) {
+            float m[3][3];
+            for (size_t i = 0; i < 3; ++i) {
+                for (size_t j = 0; j < 3; ++j) {
+                    m[i][j] = (j == k) ? xy_[i] : xx_[i][j];
+                }
+            }
+            theta[k] = det3(m) / det;
+        }
+
+        // Exact discretization of L dI/dt = V - R I over dt:
+        // 1 + alpha = exp(-R dt / L), beta = -alpha / R
+        float alpha = theta[0];
+        float beta = theta[1];
+        if (!(beta > 0.0f) || !(alpha < 0.0f) || !(alpha > -1.0f)) {
+            return false;
+        }
+        resistance = -alpha / beta;
+        inductance = -resistance * dt / std::log1p(alpha);
+
+        // Coefficient of determination of the current increments
+        float ss_res = sum_yy_ - (theta[0] * xy_[0] + theta[1] * xy_[1] + theta[2] * xy_[2]);
+        float ss_tot = sum_yy_ - sum_y_ * sum_y_ / (float)n_samples_;
+        quality = (ss_tot > 0.0f) ? 1.0f - ss_res / ss_tot : 0.0f;
+        return std::isfinite(resistance) && std::isfinite(inductance);
+    }
+
+    size_t n_samples() const {
+        return n_samples_;
+    }
+
+    // Results of the last successful fit
+    float resistance = 0.0f;    // [Ohm]
+    float inductance = 0.0f;    // [H]
+    float quality = 0.0f;       // coefficient of determination, 1 for a perfect fit
+
+private:
+    float xx_[3][3] = {};
+    float xy_[3] = {};
+    float sum_y_ = 0.0f;
+    float sum_yy_ = 0.0f;
+    size_t n_samples_ = 0;
+    bool has_previous_ = false;
+    float last_current_ = 0.0f;
+    float I_ref_ = 0.0f;
+    float V_ref_ = 0.0f;
+};
+
+#endif // __RL_IDENTIFICATION_HPP
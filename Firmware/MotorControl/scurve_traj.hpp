@@ -0,0 +1,187 @@
+#ifndef __SCURVE_TRAJ_HPP
+#define __SCURVE_TRAJ_HPP
+
+#include <stddef.h>
+#include <algorithm>
+#include <cmath>
+
+/**
+ * @brief Jerk-limited trajectory planner with seven segments.
+ *
+ * The profile consists of a velocity ramp from the initial velocity to the
+ * peak velocity, a cruise phase and a ramp down to standstill. Each ramp has a
+ * phase of constant positive jerk, one of constant acceleration and one of
+ * constant negative jerk. Ramps that are too short to reach the acceleration
+ * limit have no constant acceleration phase.
+ *
+ * plan() computes the polynomial coefficients of all segments, so eval() is a
+ * cubic polynomial evaluation.
+ *
+ * The initial acceleration is assumed to be zero. Replanning during a move
+ * therefore causes a step in acceleration.
+ */
+class SCurveTrajectory {
+public:
+    static constexpr size_t N_SEGMENTS = 7;
+
+    struct Step_t {
+        float Y;
+        float Yd;
+        float Ydd;
+    };
+
+    // Y(t) = c0 + c1*dt + c2*dt^2 + c3*dt^3 with dt = t - t0
+    struct Segment_t {
+        float t0;   // [s]
+        float c0;
+        float c1;
+        float c2;
+        float c3;
+    };
+
+    /**
+     * @brief Plans a move from Xi with velocity Vi to a standstill at Xf.
+     * @returns false if one of the limits is not positive.
+     */
+    bool plan(float Xf, float Xi, float Vi, float Vmax, float Amax, float Dmax, float Jmax) {
+        if (!(Vmax > 0.0f) || !(Amax > 0.0f) || !(Dmax > 0.0f) || !(Jmax > 0.0f)) {
+            return false;
+        }
+
+        float dX = Xf - Xi;
+        float s = std::signbit(dX - ramp_dist(Vi, 0.0f, Dmax, Jmax)) ? -1.0f : 1.0f;
+
+        // Going slower than the initial velocity in the direction of travel
+        // decelerates. An initial velocity against the direction of travel
+        // must not be braked harder than Dmax, which the choice of s assumed.
+        auto accel_limit = [&](float Vp) {
+            if (s * Vp < s * Vi) {
+                return Dmax;
+            }
+            return (s * Vi < 0.0f) ? std::min(Amax, Dmax) : Amax;
+        };
+        auto dist = [&](float Vp) {
+            return ramp_dist(Vi, Vp, accel_limit(Vp), Jmax) + ramp_dist(Vp, 0.0f, Dmax, Jmax);
+        };
+
+        float Vp = s * Vmax;
+        float Tv = 0.0f;
+        float d = dist(Vp);
+        if (s * d <= s * dX) {
+            Tv = (dX - d) / Vp;
+        } else {
+            // Without a cruise phase the peak velocity lies between zero, which
+            // covers the stopping distance, and Vmax, which overshoots.
+            float lo = 0.0f, hi = Vmax;
+            for (size_t i = 0; i < 32; ++i) {
+                float mid = 0.5f * (lo + hi);
+                if (s * dist(s * mid) <= s * dX) {
+                    lo = mid;
+                } else {
+                    hi = mid;
+                }
+            }
+            Vp = s * lo;
+        }
+
+        n_segments_ = 0;
+        t_end_ = 0.0f;
+        p_end_ = Xi;
+        v_end_ = Vi;
+        add_ramp(Vi, Vp, accel_limit(Vp), Jmax);
+        add_segment(0.0f, 0.0f, Tv);
+        add_ramp(Vp, 0.0f, Dmax, Jmax);
+
+        Xi_ = Xi;
+        Xf_ = Xf;
+        Vi_ = Vi;
+        Tf_ = t_end_;
+        segment_ = 0;
+        return true;
+    }
+
+    Step_t eval(float t) {
+        if (t < 0.0f) {
+            return {Xi_, Vi_, 0.0f};
+        }
+        if (t >= Tf_) {
+            return {Xf_, 0.0f, 0.0f};
+        }
+
+        // The controller evaluates at increasing times, so the search usually
+        // starts at the right segment.
+        size_t i = (t >= segments_[segment_].t0) ? segment_ : 0;
+        while (i + 1 < N_SEGMENTS && t >= segments_[i + 1].t0) {
+            i++;
+        }
+        segment_ = i;
+
+        const Segment_t& seg = segments_[i];
+        float dt = t - seg.t0;
+        return {
+            seg.c0 + dt * (seg.c1 + dt * (seg.c2 + dt * seg.c3)),
+            seg.c1 + dt * (2.0f * seg.c2 + dt * 3.0f * seg.c3),
+            2.0f * seg.c2 + dt * 6.0f * seg.c3
+        };
+    }
+
+    Segment_t segments_[N_SEGMENTS] = {};
+
+    float Xi_ = 0.0f;
+    float Xf_ = 0.0f;
+    float Vi_ = 0.0f;
+    float Tf_ = 0.0f;
+
+    float t_ = 0.0f;
+
+private:
+    // Duration of the jerk phases and of the constant acceleration phase of a
+    // ramp by dv
+    static void ramp_times(float dv, float Amax, float Jmax, float* Tj, float* Ta) {
+        dv = std::abs(dv);
+        if (dv * Jmax >= Amax * Amax) {
+            *Tj = Amax / Jmax;
+            *Ta = dv / Amax - *Tj;
+        } else {
+            *Tj = std::sqrt(dv / Jmax);
+            *Ta = 0.0f;
+        }
+    }
+
+    // The ramp is symmetric, so it covers the mean velocity times its duration
+    static float ramp_dist(float v0, float v1, float Amax, float Jmax) {
+        float Tj, Ta;
+        ramp_times(v1 - v0, Amax, Jmax, &Tj, &Ta);
+        return 0.5f * (v0 + v1) * (2.0f * Tj + Ta);
+    }
+
+    void add_ramp(float v0, float v1, float Amax, float Jmax) {
+        float Tj, Ta;
+        ramp_times(v1 - v0, Amax, Jmax, &Tj, &Ta);
+        float j = (v1 >= v0) ? Jmax : -Jmax;
+        float a = (Ta > 0.0f) ? std::copysign(Amax, j) : (Tj > 0.0f) ? j * Tj : 0.0f;
+        add_segment(0.0f, j, Tj);
+        add_segment(a, 0.0f, Ta);
+        add_segment(a, -j, Tj);
+    }
+
+    void add_segment(float a, float j, float T) {
+        if (!(T > 0.0f)) {
+            // Keeps an infinite jerk limit from producing NaNs
+            T = 0.0f;
+            j = 0.0f;
+        }
+        segments_[n_segments_++] = {t_end_, p_end_, v_end_, 0.5f * a, j / 6.0f};
+        p_end_ += T * (v_end_ + T * (0.5f * a + T * j / 6.0f));
+        v_end_ += T * (a + T * 0.5f * j);
+        t_end_ += T;
+    }
+
+    size_t n_segments_ = 0;
+    size_t segment_ = 0;
+    float t_end_ = 0.0f;
+    float p_end_ = 0.0f;
+    float v_end_ = 0.0f;
+};
+
+#endif // __SCURVE_TRAJ_HPP
@@ -8,6 +8,8 @@ void SensorlessEstimator::reset() {
     V_alpha_beta_memory_[1] = 0.0f;
     flux_state_[0] = 0.0f;
     flux_state_[1] = 0.0f;
+    flux_error_ = 1.0f;
+    converged_ = false;
 }
 
 bool SensorlessEstimator::update() {
@@ -34,9 +36,10 @@ bool SensorlessEstimator::update() {
         return false;
     }
 
-    // TODO: we read values here which are modified by a higher priority interrupt.
-    // This is not thread-safe.    
-    auto current_meas = axis_->motor_.current_meas_;
+    // The current measurement and the applied voltage are modified by the
+    // current measurement interrupt so we read a consistent snapshot of both.
+    Motor::Sample_t sample = axis_->motor_.sample_.read();
+    auto current_meas = sample.current_meas;
     if (!axis_->motor_.is_armed_) {
         // While the motor is disarmed the current is not measurable so we
         // assume that it's zero.
@@ -54,6 +57,12 @@ bool SensorlessEstimator::update() {
         current_meas->phA,
         one_by_sqrt3 * (current_meas->phB - current_meas->phC)};
 
+    if (flux_linkage_measurement_active_) {
+        float phase_vel = axis_->open_loop_controller_.phase_vel_.any().value_or(0.0f);
+        flux_linkage_measurement_.add_sample(V_alpha_beta_memory_[0], V_alpha_beta_memory_[1],
+                                             I_alpha_beta[0], I_alpha_beta[1], phase_vel);
+    }
+
     // alpha-beta vector operations
     float eta[2];
     for (int i = 0; i <= 1; ++i) {
@@ -74,6 +83,14 @@ bool SensorlessEstimator::update() {
     float bandwidth_factor = 1.0f / pm_flux_sqr;
     float eta_factor = 0.5f * (config_.observer_gain * bandwidth_factor) * (pm_flux_sqr - est_pm_flux_sqr);
 
+    // The prediction only keeps the flux magnitude if the model and the
+    // phase estimate are consistent, so a small error before the correction
+    // means that the observer has converged.
+    float flux_error = std::abs(std::sqrt(est_pm_flux_sqr) - config_.pm_flux_linkage) / config_.pm_flux_linkage;
+    float error_filter_k = std::min(current_meas_period / config_.convergence_time, 1.0f);
+    flux_error_ += error_filter_k * (flux_error - flux_error_);
+    converged_ = flux_error_ < config_.convergence_threshold;
+
     // alpha-beta vector operations
     for (int i = 0; i <= 1; ++i) {
         // add observer action to flux estimate dynamics
@@ -85,8 +102,8 @@ bool SensorlessEstimator::update() {
     }
 
     // Flux state estimation done, store V_alpha_beta for next timestep
-    V_alpha_beta_memory_[0] = axis_->motor_.current_control_.final_v_alpha_;
-    V_alpha_beta_memory_[1] = axis_->motor_.current_control_.final_v_beta_;
+    V_alpha_beta_memory_[0] = sample.final_v_alpha;
+    V_alpha_beta_memory_[1] = sample.final_v_beta;
 
     float phase_vel = phase_vel_.previous().value_or(0.0f);
 
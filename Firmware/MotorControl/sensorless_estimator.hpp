@@ -2,6 +2,7 @@
 #define __SENSORLESS_ESTIMATOR_HPP
 
 #include "component.hpp"
+#include "flux_linkage_measurement.hpp"
 
 class SensorlessEstimator : public ODriveIntf::SensorlessEstimatorIntf {
 public:
@@ -9,6 +10,8 @@ public:
         float observer_gain = 1000.0f; // [rad/s]
         float pll_bandwidth = 1000.0f;  // [rad/s]
         float pm_flux_linkage = 1.58e-3f; // [V / (rad/s)]  { 5.51328895422 / (<pole pairs> * <rpm/v>) }
+        float convergence_threshold = 0.1f; // relative error of the flux magnitude below which the observer is converged
+        float convergence_time = 0.02f; // [s] time constant of the error filter
     };
 
     void reset();
@@ -22,6 +25,12 @@ public:
     float pll_pos_ = 0.0f;                      // [rad]
     float flux_state_[2] = {0.0f, 0.0f};        // [Vs]
     float V_alpha_beta_memory_[2] = {0.0f, 0.0f}; // [V]
+    float flux_error_ = 1.0f;                   // filtered | |eta| - pm_flux_linkage | / pm_flux_linkage
+    bool converged_ = false;
+
+    // Fed by update() while active, see Axis::run_flux_linkage_calibration()
+    bool flux_linkage_measurement_active_ = false;
+    FluxLinkageMeasurement flux_linkage_measurement_;
 
     OutputPort<float> phase_ = 0.0f;                   // [rad]
     OutputPort<float> phase_vel_ = 0.0f;               // [rad/s]
@@ -0,0 +1,186 @@
+#ifndef __SERIAL_ABS_FRAME_HPP
+#define __SERIAL_ABS_FRAME_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief Decoders for the frames of SPI, BiSS-C and SSI absolute encoders.
+ *
+ * Both protocols are clocked out by the SPI peripheral as a sequence of 16-bit
+ * words, MSB first. The clock idles high (CPOL = 1) and data is sampled on
+ * the rising edge, so the first received bit reflects the idle line.
+ *
+ * The decoders take the number of data bits, i.e. multi-turn and single-turn
+ * position bits together, and return them right-aligned.
+ */
+namespace serial_abs {
+
+// Data, status and CRC bits must fit into the 64-bit shift register
+static constexpr size_t MAX_DATA_BITS = 40;
+// Bits the encoder may take to acknowledge the request (BiSS-C)
+static constexpr size_t BISS_MAX_ACK_BITS = 8;
+static constexpr size_t BISS_CRC_BITS = 6;
+
+inline bool get_bit(const uint16_t* words, size_t i) {
+    return (words[i / 16] >> (15 - (i % 16))) & 1;
+}
+
+// @brief Number of 16-bit words needed to clock out a whole frame
+inline size_t biss_c_frame_words(size_t n_data_bits) {
+    // idle, ack, start, CDS, data, nE, nW, CRC
+    return (1 + BISS_MAX_ACK_BITS + 2 + n_data_bits + 2 + BISS_CRC_BITS + 15) / 16;
+}
+
+inline size_t ssi_frame_words(size_t n_data_bits) {
+    // idle, data
+    return (1 + n_data_bits + 15) / 16;
+}
+
+// @brief CRC with polynomial x^6 + x^1 + x^0 over the n_bits LSBs of data, MSB first.
+// The encoder transmits the inverted value.
+inline uint8_t biss_crc6(uint64_t data, size_t n_bits) {
+    uint8_t crc = 0;
+    for (size_t i = n_bits; i > 0; --i) {
+        bool feedback = ((crc >> 5) ^ (data >> (i - 1))) & 1;
+        crc = (crc << 1) & 0x3f;
+        if (feedback) {
+            crc ^= 0x03;
+        }
+    }
+    return crc;
+}
+
+/**
+ * @brief Decodes a BiSS-C single cycle data frame.
+ *
+ * The line goes low to acknowledge the request, then the encoder sends a start
+ * bit, a '0' (CDS), the data, the active-low error and warning bits and the
+ * inverted CRC over data, error and warning.
+ *
+ * @returns false if no complete frame was found, the CRC doesn't match or the
+ * encoder reports an error.
+ */
+inline bool decode_biss_c(const uint16_t* words, size_t n_words, size_t n_data_bits, uint64_t* data) {
+    const size_t n_bits = n_words * 16;
+    if (n_data_bits > MAX_DATA_BITS) {
+        return false;
+    }
+
+    size_t i = 0;
+    while (i < n_bits && get_bit(words, i)) {
+        i++; // idle
+    }
+    while (i < n_bits && !get_bit(words, i)) {
+        i++; // acknowledge
+    }
+    i += 2; // start and CDS bit
+
+    if (i + n_data_bits + 2 + BISS_CRC_BITS > n_bits) {
+        return false;
+    }
+
+    uint64_t payload = 0;
+    for (size_t k = 0; k < n_data_bits + 2; ++k) {
+        payload = (payload << 1) | get_bit(words, i++);
+    }
+    uint8_t crc = 0;
+    for (size_t k = 0; k < BISS_CRC_BITS; ++k) {
+        crc = (crc << 1) | get_bit(words, i++);
+    }
+
+    if (crc != (~biss_crc6(payload, n_data_bits + 2) & 0x3f)) {
+        return false;
+    }
+    if (!(payload & 0x2)) {
+        return false; // nE
+    }
+    *data = payload >> 2;
+    return true;
+}
+
+/**
+ * @brief Decodes an SSI frame with optional Gray coding.
+ *
+ * SSI has no integrity check. The only plausibility check is that the line
+ * was high before the data, which catches a disconnected data line.
+ */
+inline bool decode_ssi(const uint16_t* words, size_t n_words, size_t n_data_bits, bool gray_code, uint64_t* data) {
+    if (n_data_bits > MAX_DATA_BITS || 1 + n_data_bits > n_words * 16) {
+        return false;
+    }
+    if (!get_bit(words, 0)) {
+        return false;
+    }
+
+    uint64_t val = 0;
+    for (size_t k = 1; k <= n_data_bits; ++k) {
+        val = (val << 1) | get_bit(words, k);
+    }
+    if (gray_code) {
+        for (size_t shift = 1; shift < 64; shift <<= 1) {
+            val ^= val >> shift;
+        }
+    }
+    *data = val;
+    return true;
+}
+
+/**
+ * @brief Layout of a single 16-bit frame (AMS, AEAT, CUI, RLS, MA732).
+ *
+ * The checks of all these formats reduce to masks, so one decoder handles all
+ * of them without branching on the encoder type. The frame is valid if the
+ * parity bits of WORD_PARITY_TABLE and the status bits have the expected
+ * values.
+ */
+struct WordFormat {
+    uint8_t parity_mask;
+    uint8_t parity_value;
+    uint16_t status_mask;
+    uint16_t status_value;
+    uint8_t pos_shift;
+    uint16_t pos_mask; // applied after the shift
+};
+
+// Bit 0: parity of the even bits, bit 1: parity of the odd bits, bit 2:
+// parity of all bits of the index. The parity of a 16-bit word is the XOR of
+// the entries of its two bytes.
+struct WordParityTable {
+    uint8_t entries[256];
+
+    constexpr WordParityTable() : entries{} {
+        for (size_t i = 0; i < 256; ++i) {
+            uint8_t even = 0, odd = 0;
+            for (size_t bit = 0; bit < 8; bit += 2) {
+                even ^= (i >> bit) & 1;
+                odd ^= (i >> (bit + 1)) & 1;
+            }
+            entries[i] = even | (odd << 1) | ((even ^ odd) << 2);
+        }
+    }
+};
+inline constexpr WordParityTable WORD_PARITY_TABLE{};
+
+// Even parity over the whole word, bit 14 is the error flag
+inline constexpr WordFormat AMS_WORD_FORMAT = {0x4, 0x0, 1 << 14, 0, 0, 0x3fff};
+// Odd parity over the odd bits and over the even bits (check bits 15 and 14)
+inline constexpr WordFormat CUI_WORD_FORMAT = {0x3, 0x3, 0, 0, 0, 0x3fff};
+// Bit 1 is the active low error bit, bit 0 is a warning
+inline constexpr WordFormat RLS_WORD_FORMAT = {0x0, 0x0, 1 << 1, 1 << 1, 2, 0x3fff};
+// No integrity information
+inline constexpr WordFormat MA732_WORD_FORMAT = {0x0, 0x0, 0, 0, 2, 0x3fff};
+
+inline bool decode_word(const WordFormat& format, uint16_t word, int32_t* pos) {
+    uint8_t parity = WORD_PARITY_TABLE.entries[word & 0xff] ^ WORD_PARITY_TABLE.entries[word >> 8];
+    if ((parity & format.parity_mask) != format.parity_value
+            || (word & format.status_mask) != format.status_value) {
+        return false;
+    }
+    *pos = (word >> format.pos_shift) & format.pos_mask;
+    return true;
+}
+
+}
+
+#endif // __SERIAL_ABS_FRAME_HPP
@@ -0,0 +1,73 @@
+#ifndef __SNAPSHOT_HPP
+#define __SNAPSHOT_HPP
+
+#include <stdint.h>
+#include <atomic>
+
+/**
+ * @brief Single-writer sequence lock for handing over a multi-word value from
+ * an interrupt to lower priority contexts without critical sections.
+ *
+ * The writer bumps the sequence counter to an odd value, copies the value and
+ * bumps the counter to the next even value. A reader copies the value and
+ * retries if the counter was odd or changed in the meantime, so it never
+ * observes a torn value. The writer never waits.
+ *
+ * This relies on the single core execution model: a reader can be preempted
+ * by the writer but not the other way around. Hence publish() must only be
+ * called from a context that cannot be interrupted by a reader, otherwise
+ * the reader would spin forever.
+ */
+template<typename T>
+class Snapshot {
+public:
+    void publish(const T& val) {
+        uint32_t seq = seq_;
+        seq_ = seq + 1;
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        val_ = val;
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        seq_ = seq + 2;
+    }
+
+    T read() const {
+        for (;;) {
+            uint32_t seq = seq_;
+            std::atomic_signal_fence(std::memory_order_seq_cst);
+            T val = val_;
+            std::atomic_signal_fence(std::memory_order_seq_cst);
+            if (!(seq & 1) && (seq == seq_)) {
+                return val;
+            }
+        }
+    }
+
+    /**
+     * @brief Non-blocking read for contexts that can preempt the writer.
+     * Fails if a publish() is in progress or completed during the copy.
+     * @param n_published: Set to get_n_published() of the returned value.
+     */
+    bool try_read(T& val, uint32_t& n_published) const {
+        uint32_t seq = seq_;
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        T copy = val_;
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        if ((seq & 1) || (seq != seq_)) {
+            return false;
+        }
+        val = copy;
+        n_published = seq >> 1;
+        return true;
+    }
+
+    // Number of completed publish() calls (modulo 2^31)
+    uint32_t get_n_published() const {
+        return seq_ >> 1;
+    }
+
+private:
+    volatile uint32_t seq_ = 0;
+    T val_ = {};
+};
+
+#endif // __SNAPSHOT_HPP
@@ -0,0 +1,98 @@
+#ifndef __SPLIT_POS_HPP
+#define __SPLIT_POS_HPP
+
+#include <stdint.h>
+#include <cmath>
+#include <limits>
+
+/**
+ * @brief Position with a 64-bit integer number of turns and a float fraction
+ * in [0, 1).
+ *
+ * A float position has 24 bits of mantissa, so at a few thousand turns its
+ * resolution is in the range of the encoder counts and small increments such
+ * as vel * dt get lost. The fraction of a SplitPos keeps the full resolution
+ * at any distance.
+ *
+ * The operations are meant for the control loop: increments and differences
+ * only use single precision float arithmetic and 64-bit integer add/subtract.
+ * Differences are expected to be small (up to about 2^24 turns for the result
+ * to be meaningful as a float).
+ */
+struct SplitPos {
+    int64_t turns = 0;
+    float frac = 0.0f;  // [turn] in [0, 1)
+
+    static SplitPos from_float(float pos) {
+        SplitPos result;
+        result.turns = 0;
+        result.frac = pos;
+        result.normalize_far();
+        return result;
+    }
+
+    // @brief Nearest float. Loses resolution far away from zero.
+    float to_float() const {
+        return (float)clamp_int32(turns) + frac;
+    }
+
+    SplitPos& operator+=(float delta) {
+        frac += delta;
+        normalize();
+        return *this;
+    }
+
+    SplitPos operator+(float delta) const {
+        SplitPos result = *this;
+        return result += delta;
+    }
+
+    SplitPos& operator-=(float delta) {
+        return *this += -delta;
+    }
+
+    SplitPos operator-(float delta) const {
+        return *this + -delta;
+    }
+
+    // @brief Difference in turns
+    float operator-(const SplitPos& other) const {
+        return (float)clamp_int32(turns - other.turns) + (frac - other.frac);
+    }
+
+    bool operator==(const SplitPos& other) const {
+        return turns == other.turns && frac == other.frac;
+    }
+
+private:
+    // int32 converts to float in a single instruction, int64 doesn't. Beyond
+    // the int32 range a float has no resolution left anyway.
+    static int32_t clamp_int32(int64_t value) {
+        constexpr int64_t limit = std::numeric_limits<int32_t>::max();
+        return (int32_t)(value > limit ? limit : value < -limit ? -limit : value);
+    }
+
+    // Increments of less than a turn per call take one branch
+    void normalize() {
+        if (frac >= 1.0f || frac < 0.0f) {
+            normalize_far();
+        }
+    }
+
+    void normalize_far() {
+        // Like a float, invalid positions stay invalid
+        if (!std::isfinite(frac)) {
+            return;
+        }
+        float whole = std::floor(frac);
+        turns += (int64_t)whole;
+        frac -= whole;
+        // Rounding can land exactly on 1 for tiny negative fractions
+        if (frac >= 1.0f) {
+            turns += 1;
+            frac = 0.0f;
+        }
+    }
+};
+
+#endif // __SPLIT_POS_HPP
@@ -0,0 +1,74 @@
+#ifndef __STEP_INTERPOLATOR_HPP
+#define __STEP_INTERPOLATOR_HPP
+
+#include <stdint.h>
+#include <cmath>
+#include <algorithm>
+
+/**
+ * @brief Reconstructs a smooth position and velocity from the step count of a
+ * step/dir input.
+ *
+ * A step stream of a few kHz changes the count only every few control loop
+ * iterations, so using the count as the position command gives a staircase.
+ * This tracks the count with the same second order PLL as the encoder
+ * estimate: the position is predicted with the estimated step rate and both
+ * are corrected by the difference to the count. At a constant step rate the
+ * PLL has no lag, so the position follows the stream exactly between steps
+ * and the velocity is a feedforward for the controller.
+ *
+ * The position is a whole number of steps (base) plus a fraction, so that
+ * long moves don't lose the resolution of a float.
+ */
+class StepInterpolator {
+public:
+    /**
+     * @brief Starts over from the next count passed to update(), e.g. when the
+     * count jumps because it was set to the current position.
+     */
+    void reset() {
+        valid_ = false;
+    }
+
+    /**
+     * @param steps: Step count of this iteration
+     * @param bandwidth: Bandwidth of the PLL [rad/s]
+     * @param dt: Duration of the iteration [s]
+     */
+    void update(int64_t steps, float bandwidth, float dt) {
+        if (!valid_) {
+            base_ = steps;
+            frac_ = 0.0f;
+            vel_ = 0.0f;
+            valid_ = true;
+            return;
+        }
+
+        float kp = 2.0f * bandwidth;
+        float ki = 0.25f * (kp * kp); // Critically damped
+        // Above 1 the correction would overshoot within one iteration
+        float pos_gain = std::min(dt * kp, 1.0f);
+
+        frac_ += dt * vel_;
+        float delta = (float)(steps - base_) - frac_;
+        frac_ += pos_gain * delta;
+        vel_ += dt * ki * delta;
+
+        // Keep the fraction within [0, 1)
+        float whole = std::floor(frac_);
+        base_ += (int64_t)whole;
+        frac_ -= whole;
+    }
+
+    int64_t base() const { return base_; }
+    float frac() const { return frac_; } // [step] in [0, 1)
+    float vel() const { return vel_; } // [step/s]
+
+private:
+    bool valid_ = false;
+    int64_t base_ = 0; // [step]
+    float frac_ = 0.0f; // [step]
+    float vel_ = 0.0f; // [step/s]
+};
+
+#endif // __STEP_INTERPOLATOR_HPP
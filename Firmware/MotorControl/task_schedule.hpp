@@ -0,0 +1,47 @@
+#ifndef __TASK_SCHEDULE_HPP
+#define __TASK_SCHEDULE_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <board.h>
+
+/**
+ * @brief Slot of a task in the static multi-rate schedule of the control loop.
+ *
+ * A task runs on every `divider`-th control loop iteration, offset by `phase`
+ * iterations. Instances of the same task (e.g. one per axis) are spread evenly
+ * across the divider period so that they never land in the same iteration.
+ *
+ * Tasks that share a divider should use distinct phases such that the worst
+ * case duration of a single control loop iteration stays flat.
+ */
+struct TaskSlot {
+    uint32_t divider;
+    uint32_t phase;
+
+    constexpr bool is_due(uint32_t tick, size_t instance = 0) const {
+        return (tick % divider) == ((phase + instance * (divider / AXIS_COUNT)) % divider);
+    }
+
+    // Time between two consecutive runs of the task [s]
+    float period() const {
+        return divider * current_meas_period;
+    }
+};
+
+namespace schedule {
+
+// All dividers are powers of two so that the modulo compiles to a mask. They
+// count control loop iterations, so the rate of each task follows the
+// configured loop rate. TaskSlot::period() gives the time.
+static constexpr uint32_t SLOW_DIVIDER = 8;
+
+// Tasks not listed here run on every control loop iteration.
+static constexpr TaskSlot thermistor_update{SLOW_DIVIDER, 1};
+static constexpr TaskSlot endstop_update{SLOW_DIVIDER, 2};
+static constexpr TaskSlot input_mapping_update{SLOW_DIVIDER, 4}; // PWM and analog input mappings
+static constexpr TaskSlot thread_stats_update{8192, 3}; // about once per second at the default 8 kHz loop rate
+
+}
+
+#endif // __TASK_SCHEDULE_HPP
@@ -3,11 +3,13 @@
 
 #include <stdint.h>
 #include <board.h>
+#include "latency_histogram.hpp"
 
 #define MEASURE_START_TIME
 #define MEASURE_END_TIME
 #define MEASURE_LENGTH
 #define MEASURE_MAX_LENGTH
+#define MEASURE_HISTOGRAM
 
 inline uint16_t sample_TIM13() {
     constexpr uint16_t clocks_per_cnt = (uint16_t)((float)TIM_1_8_CLOCK_HZ / (float)TIM_APB1_CLOCK_HZ);
@@ -19,15 +21,18 @@ struct TaskTimer {
     uint32_t end_time_ = 0;
     uint32_t length_ = 0;
     uint32_t max_length_ = 0;
+    LatencyHistogram histogram_; // recorded on every run, not only when armed
 
     static bool enabled;
 
     uint32_t start() {
+        trace_event((uint32_t)this);
         return sample_TIM13();
     }
 
     void stop(uint32_t start_time) {
         uint32_t end_time = sample_TIM13();
+        trace_event((uint32_t)this | TRACE_EXIT_FLAG);
         uint32_t length = end_time - start_time;
 
         if (enabled) {
@@ -44,6 +49,22 @@ struct TaskTimer {
 #ifdef MEASURE_MAX_LENGTH
         max_length_ = std::max(max_length_, length);
 #endif
+#ifdef MEASURE_HISTOGRAM
+        histogram_.record(length);
+#endif
+    }
+
+    uint32_t get_percentile(float quantile) {
+        return histogram_.get_percentile(quantile);
+    }
+
+    uint32_t get_n_samples() {
+        return histogram_.n_samples_;
+    }
+
+    void reset() {
+        max_length_ = 0;
+        histogram_.reset();
     }
 };
 
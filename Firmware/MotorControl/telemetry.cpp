@@ -0,0 +1,181 @@
+#include "odrive_main.h"
+#include <algorithm>
+#include <freertos_vars.h>
+#include <fibre/simple_serdes.hpp>
+
+// @brief Hands the slice of the RAM arena to the telemetry. Only called at
+// boot, before streaming.
+void Telemetry::set_buffer(void* buffer, size_t bytes) {
+    frames_ = (Frame_t*)buffer;
+    n_frame_slots_ = buffer ? bytes / sizeof(Frame_t) : 0;
+}
+
+/**
+ * @brief Resolves the configured channels and starts streaming. Fails if no
+ * channel refers to a numeric property or if there are less than two frames.
+ */
+bool Telemetry::start() {
+    FloatEndpointReader channels[TELEMETRY_MAX_CHANNELS];
+    uint32_t n_channels = 0;
+    for (size_t i = 0; i < TELEMETRY_MAX_CHANNELS; ++i) {
+        if (fibre::get_float_endpoint_reader(config_.channels[i], &channels[n_channels])) {
+            n_channels++;
+        }
+    }
+    if (!n_channels || n_frame_slots_ < 2) {
+        return false;
+    }
+
+    CRITICAL_SECTION() {
+        for (size_t i = 0; i < n_channels; ++i) {
+            channels_[i] = channels[i];
+        }
+        n_channels_ = n_channels;
+        capturing_ = false;
+        reset_stream((TELEMETRY_FRAME_SIZE - TELEMETRY_HEADER_SIZE) / (sizeof(float) * n_channels));
+    }
+    return true;
+}
+
+/**
+ * @brief Starts streaming the raw control loop inputs of one axis in every
+ * iteration. config.decimation doesn't apply, as a replay needs each of them.
+ */
+bool Telemetry::start_capture(uint32_t axis) {
+    if (axis >= AXIS_COUNT || n_frame_slots_ < 2) {
+        return false;
+    }
+
+    CRITICAL_SECTION() {
+        n_channels_ = 0;
+        capture_axis_ = axis;
+        capturing_ = true;
+        reset_stream((TELEMETRY_FRAME_SIZE - TELEMETRY_HEADER_SIZE) / CONTROL_CAPTURE_RECORD_SIZE);
+    }
+    return true;
+}
+
+// @brief Must be called in a critical section
+void Telemetry::reset_stream(uint32_t samples_per_frame) {
+    samples_per_frame_ = samples_per_frame;
+    n_frames_ = 0;
+    n_dropped_ = 0;
+    fill_samples_ = 0;
+    decimation_count_ = 0;
+    active_ = true;
+}
+
+void Telemetry::stop() {
+    CRITICAL_SECTION() {
+        active_ = false;
+    }
+}
+
+// @brief Called once per control loop iteration after all components updated
+void Telemetry::update() {
+    if (!active_) {
+        return;
+    }
+
+    if (capturing_) {
+        update_capture();
+        return;
+    }
+
+    if (decimation_count_++ % std::max<uint32_t>(config_.decimation, 1)) {
+        return;
+    }
+
+    uint8_t* frame = frames_[fill_frame_].data;
+    uint8_t* sample = frame + TELEMETRY_HEADER_SIZE + fill_samples_ * n_channels_ * sizeof(float);
+    for (size_t i = 0; i < n_channels_; ++i) {
+        float val = NAN;
+        channels_[i].read(&val);
+        write_le<float>(val, sample + i * sizeof(float));
+    }
+
+    if (++fill_samples_ < samples_per_frame_) {
+        return;
+    }
+
+    finish_frame(TELEMETRY_FRAME_TAG, (uint8_t)n_channels_,
+                 TELEMETRY_HEADER_SIZE + fill_samples_ * n_channels_ * sizeof(float));
+}
+
+void Telemetry::update_capture() {
+    Axis& axis = axes[capture_axis_];
+
+    // The current measurement that this iteration ran on
+    const AdcSample_t& adc = adc_sample_ring[(adc_sample_ring_head - 1) & (ADC_SAMPLE_RING_SIZE - 1)];
+    ControlInputRecord_t record;
+    record.timestamp = adc.timestamp;
+    record.adc_vbus = adc.vbus;
+    record.adc_phB = adc.phB[capture_axis_];
+    record.adc_phC = adc.phC[capture_axis_];
+    record.encoder_raw = axis.encoder_.raw_sample();
+    record.input_pos = axis.controller_.input_pos_;
+    record.input_vel = axis.controller_.input_vel_;
+    record.input_torque = axis.controller_.input_torque_;
+
+    uint8_t* frame = frames_[fill_frame_].data;
+    record.encode(frame + TELEMETRY_HEADER_SIZE + fill_samples_ * CONTROL_CAPTURE_RECORD_SIZE);
+
+    if (++fill_samples_ < samples_per_frame_) {
+        return;
+    }
+
+    finish_frame(CONTROL_CAPTURE_FRAME_TAG, (uint8_t)capture_axis_,
+                 TELEMETRY_HEADER_SIZE + fill_samples_ * CONTROL_CAPTURE_RECORD_SIZE);
+}
+
+// @brief Completes the header of the frame that is being filled and hands it
+// to the USB thread
+void Telemetry::finish_frame(uint16_t tag, uint8_t info, size_t length) {
+    uint8_t* frame = frames_[fill_frame_].data;
+    write_le<uint16_t>(tag, frame);
+    write_le<uint16_t>(seq_no_++, frame + 2);
+    frame[4] = info;
+    frame[5] = (uint8_t)fill_samples_;
+    frames_[fill_frame_].length = (uint8_t)length;
+    fill_samples_ = 0;
+
+    if (n_full_ + 1 >= n_frame_slots_) {
+        // The frame is overwritten by the next one, the gap in the sequence
+        // numbers tells the host
+        n_dropped_++;
+    } else {
+        n_full_ = n_full_ + 1;
+        fill_frame_ = (fill_frame_ + 1) % n_frame_slots_;
+    }
+    // At most one notification is queued so that the telemetry can't crowd
+    // out the USB events. It is also posted for dropped frames in case the
+    // queue was full before.
+    if (!notify_pending_) {
+        notify_pending_ = osMessagePut(usb_event_queue, 8, 0) == osOK;
+    }
+}
+
+// @brief Starts sending a full frame. Called in the USB thread.
+void Telemetry::send_pending() {
+    notify_pending_ = false;
+    if (sending_ || !n_full_) {
+        return;
+    }
+    sending_ = true;
+    const Frame_t& frame = frames_[send_frame_];
+    usb_native_tx_multiplexer.start_write({frame.data, frame.length}, nullptr, MEMBER_CB(this, on_write_done));
+}
+
+void Telemetry::on_write_done(fibre::WriteResult result) {
+    if (result.status == fibre::kStreamOk) {
+        n_frames_++;
+    } else {
+        n_dropped_++;
+    }
+    send_frame_ = (send_frame_ + 1) % n_frame_slots_;
+    CRITICAL_SECTION() {
+        n_full_ = n_full_ - 1;
+    }
+    sending_ = false;
+    send_pending();
+}
@@ -0,0 +1,85 @@
+#ifndef __TELEMETRY_HPP
+#define __TELEMETRY_HPP
+
+#include <autogen/interfaces.hpp>
+#include <fibre/introspection.hpp>
+#include <fibre/async_stream.hpp>
+#include "control_capture.hpp"
+
+#define TELEMETRY_MAX_CHANNELS 8
+#define TELEMETRY_FRAME_SIZE 63 // must be less than the USB packet size, see Stm32UsbTxStream
+#define TELEMETRY_FRAME_TAG 0xff00
+#define TELEMETRY_HEADER_SIZE 6
+
+/**
+ * @brief Streams up to TELEMETRY_MAX_CHANNELS numeric properties continuously
+ * on the native USB endpoint.
+ *
+ * The control loop packs the samples into a ring of frames in the RAM arena,
+ * config.telemetry_frames of the ODrive long. Full frames queue up for the
+ * USB thread while the next one is filled. If all other frames are still
+ * queued, the full frame is dropped.
+ *
+ * Frame layout (little endian):
+ *  - uint16 TELEMETRY_FRAME_TAG. The fibre client discards it as an ACK
+ *    that it doesn't expect, because its sequence numbers have bit 7 set.
+ *  - uint16 sequence number, incremented for every frame including dropped
+ *    ones
+ *  - uint8 number of channels
+ *  - uint8 number of samples
+ *  - float32 values, sample by sample and channel by channel
+ *
+ * Alternatively start_capture() streams the raw inputs of the control loop of
+ * one axis in every iteration, see ControlInputRecord_t for that format.
+ */
+class Telemetry : public ODriveIntf::TelemetryIntf {
+public:
+    struct Frame_t {
+        uint8_t data[TELEMETRY_FRAME_SIZE];
+        uint8_t length;
+    };
+
+    struct Config_t {
+        endpoint_ref_t channels[TELEMETRY_MAX_CHANNELS] = {}; // unused channels are invalid references
+        uint32_t decimation = 1; // control loop iterations per sample
+    };
+
+    bool start() override;
+    bool start_capture(uint32_t axis) override;
+    void stop() override;
+    void update();
+    void send_pending();
+    void set_buffer(void* buffer, size_t bytes);
+
+    Config_t config_;
+
+    uint32_t n_channels_ = 0;
+    uint32_t samples_per_frame_ = 0;
+    uint32_t n_frames_ = 0; // sent frames since start()
+    uint32_t n_dropped_ = 0; // dropped frames since start()
+    bool active_ = false;
+    bool capturing_ = false; // started with start_capture()
+
+private:
+    void reset_stream(uint32_t samples_per_frame);
+    void update_capture();
+    void finish_frame(uint16_t tag, uint8_t info, size_t length);
+    void on_write_done(fibre::WriteResult result);
+
+    FloatEndpointReader channels_[TELEMETRY_MAX_CHANNELS];
+    // Ring of frames: n_full_ frames from send_frame_ on are handed to the USB
+    // thread, the one after them is being filled.
+    Frame_t* frames_ = nullptr;
+    size_t n_frame_slots_ = 0;
+    volatile size_t n_full_ = 0; // only decremented by the USB thread
+    volatile bool notify_pending_ = false; // a message is in usb_event_queue
+    bool sending_ = false; // only accessed by the USB thread
+    size_t send_frame_ = 0; // only accessed by the USB thread
+    size_t fill_frame_ = 0;
+    uint32_t fill_samples_ = 0;
+    uint16_t seq_no_ = 0;
+    uint32_t decimation_count_ = 0;
+    uint32_t capture_axis_ = 0;
+};
+
+#endif // __TELEMETRY_HPP
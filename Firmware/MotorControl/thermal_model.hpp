@@ -0,0 +1,63 @@
+#ifndef __THERMAL_MODEL_HPP
+#define __THERMAL_MODEL_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <algorithm>
+
+/**
+ * @brief Predicts the temperature rise of a hot spot above its thermistor from
+ * the loss power.
+ *
+ * The thermal path is a Foster network of N_STAGES first order RC stages. The
+ * rise of each stage settles at power * thermal_resistance with its time
+ * constant, and the stages add up. A fast stage for the winding or the FET
+ * junction covers the lag of the thermistor, which is fused in by adding the
+ * rise to its reading. A stage with the time constant of the whole motor lets
+ * the model stand in for a missing thermistor, starting from the ambient
+ * temperature.
+ */
+class ThermalModel {
+public:
+    static constexpr size_t N_STAGES = 2;
+
+    struct Config_t {
+        bool enabled = false;
+        float thermal_resistance[N_STAGES] = {0.0f, 0.0f};  // [K/W]
+        float time_constant[N_STAGES] = {1.0f, 60.0f};      // [s]
+        float ambient_temperature = 25.0f;  // [°C] base temperature if the thermistor is disabled
+    };
+
+    void reset() {
+        for (float& stage : stages_) {
+            stage = 0.0f;
+        }
+        rise_ = 0.0f;
+    }
+
+    /**
+     * @param power: Loss power since the last update [W]
+     * @param dt: Time since the last update [s]
+     * @returns the temperature rise [K]
+     */
+    float update(const Config_t& config, float power, float dt) {
+        rise_ = 0.0f;
+        for (size_t i = 0; i < N_STAGES; ++i) {
+            // A time constant below dt settles within one update
+            float k = dt / std::max(config.time_constant[i], dt);
+            stages_[i] += k * (power * config.thermal_resistance[i] - stages_[i]);
+            rise_ += stages_[i];
+        }
+        return rise_;
+    }
+
+    float rise() const {
+        return rise_;
+    }
+
+private:
+    float stages_[N_STAGES] = {};
+    float rise_ = 0.0f; // [K]
+};
+
+#endif // __THERMAL_MODEL_HPP
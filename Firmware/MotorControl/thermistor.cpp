@@ -1,29 +1,46 @@
 #include "odrive_main.h"
 
 #include "low_level.h"
+#include "lookup_table.hpp"
 
 ThermistorCurrentLimiter::ThermistorCurrentLimiter(uint16_t adc_channel,
                                                    const float* const coefficients,
                                                    size_t num_coeffs,
                                                    const float& temp_limit_lower,
                                                    const float& temp_limit_upper,
-                                                   const bool& enabled) :
+                                                   const bool& enabled,
+                                                   const ThermalModel::Config_t& thermal_model_config) :
     adc_channel_(adc_channel),
     coefficients_(coefficients),
     num_coeffs_(num_coeffs),
     temperature_(NAN),
     temp_limit_lower_(temp_limit_lower),
     temp_limit_upper_(temp_limit_upper),
-    enabled_(enabled)
+    enabled_(enabled),
+    thermal_model_config_(thermal_model_config)
 {
 }
 
+float ThermistorCurrentLimiter::voltage_to_temperature(float normalized_voltage) const {
+    return horner_poly_eval(normalized_voltage, coefficients_, num_coeffs_);
+}
+
+// @brief Samples voltage_to_temperature() into table_. Must be called after
+// the curve changed.
+// The update in the slow slot may interpolate between an old and a new point
+// while this runs, which is harmless for one sample behind the filter.
+void ThermistorCurrentLimiter::build_table() {
+    for (size_t i = 0; i < table_size_; ++i) {
+        table_[i] = voltage_to_temperature((float)i / (float)(table_size_ - 1));
+    }
+}
+
 void ThermistorCurrentLimiter::update() {
     const float normalized_voltage = get_adc_relative_voltage_ch(adc_channel_);
-    float raw_temperature_ = horner_poly_eval(normalized_voltage, coefficients_, num_coeffs_);
+    float raw_temperature_ = interp1d(table_.data(), table_size_, 1.0f, normalized_voltage);
 
     constexpr float tau = 0.1f; // [sec]
-    float k = current_meas_period / tau;
+    float k = schedule::thermistor_update.period() / tau;
     float val = raw_temperature_;
     for (float& lpf_val : lpf_vals_) {
         lpf_val += k * (val - lpf_val);
@@ -33,6 +50,17 @@ void ThermistorCurrentLimiter::update() {
         lpf_vals_.fill(0.0f);
     }
     temperature_ = lpf_vals_.back();
+
+    if (thermal_model_config_.enabled) {
+        loss_power_ = loss_power();
+        float rise = thermal_model_.update(thermal_model_config_, loss_power_, schedule::thermistor_update.period());
+        float base_temperature = enabled_ ? temperature_ : thermal_model_config_.ambient_temperature;
+        predicted_temperature_ = base_temperature + rise;
+    } else {
+        thermal_model_.reset();
+        loss_power_ = 0.0f;
+        predicted_temperature_ = temperature_;
+    }
 }
 
 bool ThermistorCurrentLimiter::do_checks() {
@@ -43,11 +71,11 @@ bool ThermistorCurrentLimiter::do_checks() {
 }
 
 float ThermistorCurrentLimiter::get_current_limit(float base_current_lim) const {
-    if (!enabled_) {
+    if (!enabled_ && !thermal_model_config_.enabled) {
         return base_current_lim;
     }
 
-    const float temp_margin = temp_limit_upper_ - temperature_;
+    const float temp_margin = temp_limit_upper_ - predicted_temperature_;
     const float derating_range = temp_limit_upper_ - temp_limit_lower_;
     float thermal_current_lim = base_current_lim * (temp_margin / derating_range);
     if (thermal_current_lim < 0.0f || is_nan(thermal_current_lim)) {
@@ -63,8 +91,22 @@ OnboardThermistorCurrentLimiter::OnboardThermistorCurrentLimiter(uint16_t adc_ch
                              num_coeffs,
                              config_.temp_limit_lower,
                              config_.temp_limit_upper,
-                             config_.enabled)
+                             config_.enabled,
+                             config_.thermal_model)
 {
+    build_table();
+}
+
+// @brief FET conduction and switching losses of the three half bridges.
+// Each phase current flows through one switch at a time, so the conduction
+// loss is fet_resistance * (Ia^2 + Ib^2 + Ic^2) = 3/2 * fet_resistance * |Idq|^2.
+float OnboardThermistorCurrentLimiter::loss_power() const {
+    if (!motor_ || !motor_->is_armed_) {
+        return 0.0f;
+    }
+    float I_sq = SQ(motor_->current_control_.Id_measured_) + SQ(motor_->current_control_.Iq_measured_);
+    return 1.5f * config_.fet_resistance * I_sq
+         + config_.switching_loss_factor * vbus_voltage_filtered * std::sqrt(I_sq);
 }
 
 OffboardThermistorCurrentLimiter::OffboardThermistorCurrentLimiter() :
@@ -73,7 +115,8 @@ OffboardThermistorCurrentLimiter::OffboardThermistorCurrentLimiter() :
                              num_coeffs_,
                              config_.temp_limit_lower,
                              config_.temp_limit_upper,
-                             config_.enabled)
+                             config_.enabled,
+                             config_.thermal_model)
 {
     decode_pin();
 }
@@ -81,9 +124,39 @@ OffboardThermistorCurrentLimiter::OffboardThermistorCurrentLimiter() :
 bool OffboardThermistorCurrentLimiter::apply_config() {
     config_.parent = this;
     decode_pin();
+    build_table();
     return true;
 }
 
+// @brief Uses the B parameter equation if configured. A shorted or open
+// thermistor doesn't have a finite temperature, so the ends of the voltage
+// range are moved in by half a table step.
+float OffboardThermistorCurrentLimiter::voltage_to_temperature(float normalized_voltage) const {
+    if (!(config_.beta > 0.0f)) {
+        return ThermistorCurrentLimiter::voltage_to_temperature(normalized_voltage);
+    }
+    constexpr float margin = 0.5f / (float)(table_size_ - 1);
+    constexpr float T_25 = 25.0f + 273.15f; // [K]
+    float v = std::clamp(normalized_voltage, margin, 1.0f - margin);
+    float resistance = config_.thermistor_bottom
+                     ? config_.r_load * v / (1.0f - v)
+                     : config_.r_load * (1.0f - v) / v;
+    return 1.0f / (1.0f / T_25 + std::log(resistance / config_.r_25) / config_.beta) - 273.15f;
+}
+
+// @brief Copper losses of the winding. phase_resistance is taken to be
+// measured at 25 °C and rises with the predicted temperature.
+float OffboardThermistorCurrentLimiter::loss_power() const {
+    if (!motor_ || !motor_->is_armed_) {
+        return 0.0f;
+    }
+    constexpr float copper_temp_coeff = 0.00393f; // [1/K]
+    float excess = is_nan(predicted_temperature_) ? 0.0f : std::max(predicted_temperature_ - 25.0f, 0.0f);
+    float resistance = motor_->config_.phase_resistance * (1.0f + copper_temp_coeff * excess);
+    float I_sq = SQ(motor_->current_control_.Id_measured_) + SQ(motor_->current_control_.Iq_measured_);
+    return 1.5f * resistance * I_sq;
+}
+
 void OffboardThermistorCurrentLimiter::decode_pin() {
     adc_channel_ = channel_from_gpio(get_gpio(config_.gpio_pin));
 }
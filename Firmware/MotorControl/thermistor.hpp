@@ -4,6 +4,7 @@
 class Motor; // declared in motor.hpp
 
 #include "current_limiter.hpp"
+#include "thermal_model.hpp"
 #include <autogen/interfaces.hpp>
 
 class ThermistorCurrentLimiter : public CurrentLimiter, public ODriveIntf::ThermistorCurrentLimiterIntf {
@@ -15,12 +16,24 @@ public:
                              size_t num_coeffs,
                              const float& temp_limit_lower,
                              const float& temp_limit_upper,
-                             const bool& enabled);
+                             const bool& enabled,
+                             const ThermalModel::Config_t& thermal_model_config);
 
     void update();
     bool do_checks();
+    void build_table();
     float get_current_limit(float base_current_lim) const override;
 
+    // @brief Loss power heating the monitored part [W]
+    virtual float loss_power() const = 0;
+
+    // @brief Temperature [°C] at the given ADC voltage relative to VCCA.
+    // Only used to build the table, so this may be expensive.
+    virtual float voltage_to_temperature(float normalized_voltage) const;
+
+    // Temperatures at evenly spaced relative voltages over [0, 1]
+    static constexpr size_t table_size_ = 33;
+
     uint16_t adc_channel_;
     const float* const coefficients_;
     const size_t num_coeffs_;
@@ -28,8 +41,13 @@ public:
     const float& temp_limit_lower_;
     const float& temp_limit_upper_;
     const bool& enabled_;
+    const ThermalModel::Config_t& thermal_model_config_;
     Motor* motor_ = nullptr; // set by Motor::apply_config()
+    std::array<float, table_size_> table_ = { 0.0f };
     std::array<float, 2> lpf_vals_ = { 0.0f };
+    ThermalModel thermal_model_;
+    float loss_power_ = 0.0f; // [W] input of the thermal model
+    float predicted_temperature_ = NAN; // [°C] temperature_ plus the modelled rise, used for the current limit
 };
 
 class OnboardThermistorCurrentLimiter : public ThermistorCurrentLimiter, public ODriveIntf::OnboardThermistorCurrentLimiterIntf {
@@ -38,11 +56,16 @@ public:
         float temp_limit_lower = 100;
         float temp_limit_upper = 120;
         bool enabled = true;
+        ThermalModel::Config_t thermal_model;
+        float fet_resistance = 0.003f;          // [Ohm] per switch including the board traces
+        float switching_loss_factor = 0.0f;     // [W/(V*A)] switching loss per bus voltage and phase current
     };
 
     virtual ~OnboardThermistorCurrentLimiter() = default;
     OnboardThermistorCurrentLimiter(uint16_t adc_channel, const float* const coefficients, size_t num_coeffs);
 
+    float loss_power() const override;
+
     Config_t config_;
 };
 
@@ -61,10 +84,25 @@ public:
         float temp_limit_lower = 100;
         float temp_limit_upper = 120;
         bool enabled = false;
+        ThermalModel::Config_t thermal_model;
+
+        // B parameter model of the NTC, used instead of the polynomial if beta > 0
+        float beta = 0.0f;                  // [K]
+        float r_25 = 10000.0f;              // [Ohm] thermistor resistance at 25 °C
+        float r_load = 10000.0f;            // [Ohm] other resistor of the voltage divider
+        bool thermistor_bottom = false;     // thermistor between the ADC pin and GNDA
 
         // custom setters
         OffboardThermistorCurrentLimiter* parent;
         void set_gpio_pin(uint16_t value) { gpio_pin = value; parent->decode_pin(); }
+        void set_poly_coefficient_0(float value) { thermistor_poly_coeffs[0] = value; parent->build_table(); }
+        void set_poly_coefficient_1(float value) { thermistor_poly_coeffs[1] = value; parent->build_table(); }
+        void set_poly_coefficient_2(float value) { thermistor_poly_coeffs[2] = value; parent->build_table(); }
+        void set_poly_coefficient_3(float value) { thermistor_poly_coeffs[3] = value; parent->build_table(); }
+        void set_beta(float value) { beta = value; parent->build_table(); }
+        void set_r_25(float value) { r_25 = value; parent->build_table(); }
+        void set_r_load(float value) { r_load = value; parent->build_table(); }
+        void set_thermistor_bottom(bool value) { thermistor_bottom = value; parent->build_table(); }
     };
 
     virtual ~OffboardThermistorCurrentLimiter() = default;
@@ -73,6 +111,8 @@ public:
     Config_t config_;
 
     bool apply_config();
+    float loss_power() const override;
+    float voltage_to_temperature(float normalized_voltage) const override;
 
 private:
     void decode_pin();
@@ -0,0 +1,46 @@
+#ifndef __TORQUE_SHARE_HPP
+#define __TORQUE_SHARE_HPP
+
+#include <cmath>
+#include <algorithm>
+#include <limits>
+
+/**
+ * @brief Splits the torque command of one controller between two motors that
+ * drive the same load.
+ *
+ * The ratio is the share of the second motor. Its sign is the direction of
+ * that motor relative to the load, negative if a positive torque of the motor
+ * turns the load backwards. The preload pushes the two motors against each
+ * other, so that a gear train between them stays engaged on the same flanks
+ * while the command crosses zero. It cancels out on the load.
+ */
+namespace torque_share {
+
+struct Split_t {
+    float own;   // [Nm] torque of the motor of the controller
+    float other; // [Nm] torque of the second motor, in its own direction
+};
+
+inline Split_t split(float torque, float ratio, float preload) {
+    float share = std::min(std::abs(ratio), 1.0f);
+    float dir = std::signbit(ratio) ? -1.0f : 1.0f;
+    return {(1.0f - share) * torque + preload, dir * (share * torque - preload)};
+}
+
+/**
+ * @brief Largest torque command for which neither motor exceeds its limit
+ * with split(), in either direction.
+ */
+inline float limit(float own_limit, float other_limit, float ratio, float preload) {
+    constexpr float inf = std::numeric_limits<float>::infinity();
+    float share = std::min(std::abs(ratio), 1.0f);
+    float p = std::abs(preload);
+    float own = (share < 1.0f) ? (own_limit - p) / (1.0f - share) : inf;
+    float other = (share > 0.0f) ? (other_limit - p) / share : inf;
+    return std::max(std::min(own, other), 0.0f);
+}
+
+}
+
+#endif // __TORQUE_SHARE_HPP
@@ -28,7 +28,11 @@ bool TrapezoidalTrajectory::planTrapezoidal(float Xf, float Xi, float Vi,
     // If we start with a speed faster than cruising, then we need to decel instead of accel
     // aka "double deceleration move" in the paper
     if ((s * Vi) > (s * Vr_)) {
-        Ar_ = -s * Amax;
+        Ar_ = -s * Dmax;
+    } else if ((s * Vi) < 0.0f) {
+        // The initial velocity is braked on the way. Braking harder than Dmax
+        // would stop short of the overshoot that the choice of s assumed.
+        Ar_ = s * std::min(Amax, Dmax);
     }
 
     // Time to accel/decel to/from Vr (cruise speed)
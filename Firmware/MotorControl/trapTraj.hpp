@@ -7,6 +7,8 @@ public:
         float vel_limit = 2.0f;   // [turn/s]
         float accel_limit = 0.5f; // [turn/s^2]
         float decel_limit = 0.5f; // [turn/s^2]
+        float jerk_limit = 5.0f;  // [turn/s^3] only used by INPUT_MODE_SCURVE_TRAJ
+        bool online = false;      // INPUT_MODE_TRAP_TRAJ steps a TrapTracker instead of planning
     };
     
     struct Step_t {
@@ -0,0 +1,77 @@
+#ifndef __TRAP_TRACKER_HPP
+#define __TRAP_TRACKER_HPP
+
+#include <cmath>
+#include <algorithm>
+
+/**
+ * @brief Online counterpart of TrapezoidalTrajectory: advances the setpoint
+ * by one control cycle towards a goal that may change in every cycle.
+ *
+ * Instead of a plan that is recomputed on every new goal, each cycle picks
+ * the acceleration from the current state alone. The velocity at the end of
+ * the cycle is limited to the braking curve v^2 = 2 * Dmax * |distance| of the
+ * remaining distance, so the setpoint coasts, accelerates and brakes exactly
+ * like a trapezoidal profile, and a goal that moves only bends the motion
+ * from where it is instead of starting a new profile. The state is the
+ * setpoint the caller already keeps, so position, velocity and the
+ * acceleration of the previous cycle carry over into every change.
+ *
+ * The acceleration is constant within a cycle, so the returned displacement
+ * is the exact integral of the velocity. A cycle costs one square root.
+ */
+class TrapTracker {
+public:
+    struct Step_t {
+        float dY;   // [turn] displacement over this cycle
+        float Yd;   // [turn/s] velocity at the end of this cycle
+        float Ydd;  // [turn/s^2] acceleration during this cycle
+        bool done;  // the goal was reached at standstill
+    };
+
+    // [turn] Allowed miss of the landing, besides what braking at Dmax within
+    // one cycle covers. Far below an encoder count, but above the resolution
+    // of the position around the goal, so that rounding can't keep the
+    // setpoint from landing.
+    static constexpr float kLandingTolerance = 1e-6f;
+
+    /**
+     * @param dX: Distance from the current position to the goal [turn]
+     * @param V: Current velocity [turn/s]
+     * @param Vmax, Amax, Dmax: Limits, all positive
+     * @param dt: Duration of the cycle [s]
+     */
+    static Step_t step(float dX, float V, float Vmax, float Amax, float Dmax, float dt) {
+        // Within one cycle of braking from the goal: land on it
+        if (std::abs(V) <= Dmax * dt
+                && std::abs(dX - 0.5f * V * dt) <= 0.5f * Dmax * dt * dt + kLandingTolerance) {
+            return {dX, 0.0f, -V / dt, true};
+        }
+
+        // Direction to the goal after stopping, as in planTrapezoidal()
+        float stop_disp = std::copysign(V * V / (2.0f * Dmax), V);
+        float s = std::signbit(dX - stop_disp) ? -1.0f : 1.0f;
+
+        // In the direction s: distance x, velocity w, velocity u at the end
+        // of the cycle. With constant acceleration the cycle covers
+        // (w + u) / 2 * dt, and braking from u at Dmax needs u^2 / (2 Dmax)
+        // of what is left:
+        //   u^2 + Dmax dt u - 2 Dmax (x - w dt / 2) = 0
+        float x = s * dX;
+        float w = s * V;
+        float c = x - 0.5f * w * dt;
+        float u_brake = (c > 0.0f)
+                ? 0.5f * (std::sqrt(Dmax * Dmax * dt * dt + 8.0f * Dmax * c) - Dmax * dt)
+                : 0.0f;
+        float u_target = std::min(Vmax, u_brake);
+
+        // Speeding up in the direction of travel uses Amax, everything else
+        // is braking and uses Dmax
+        float a_up = (w >= 0.0f) ? Amax : Dmax;
+        float a = std::clamp((u_target - w) / dt, -Dmax, a_up);
+        float u = w + a * dt;
+        return {s * 0.5f * (w + u) * dt, s * u, s * a, false};
+    }
+};
+
+#endif // __TRAP_TRACKER_HPP
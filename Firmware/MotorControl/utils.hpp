@@ -64,7 +64,6 @@ constexpr float two_by_sqrt3 = 1.15470053838f;
 constexpr float sqrt3_by_2 = 0.86602540378f;
 
 // Function prototypes for implementations in utils.cpp
-std::tuple<float, float, float, bool> SVM(float alpha, float beta);
 float fast_atan2(float y, float x);
 uint32_t deadline_to_timeout(uint32_t deadline_ms);
 uint32_t timeout_to_deadline(uint32_t timeout_ms);
@@ -75,6 +74,7 @@ void delay_us(uint32_t us);
 extern "C" {
 float our_arm_sin_f32(float x);
 float our_arm_cos_f32(float x);
+void our_arm_sin_cos_f32(float x, float* sin_val, float* cos_val);
 }
 
 // ----------------
@@ -150,6 +150,86 @@ inline float horner_poly_eval(float x, const float *coeffs, size_t count) {
     return result;
 }
 
+/**
+ * @brief What SVM() does if the requested voltage vector lies outside the
+ * hexagon of voltages that the inverter can produce.
+ */
+enum SvmOvermodulation_t {
+    SVM_OVERMODULATION_NONE = 0,        // report failure
+    SVM_OVERMODULATION_CLAMP = 1,       // scale down to the hexagon boundary, preserving the angle
+    SVM_OVERMODULATION_SIX_STEP = 2,    // saturate each phase individually, which preserves the
+                                        // vector component along the nearest active vector and
+                                        // transitions to six-step operation for large inputs
+};
+
+// Compute rising edge timings (0.0 - 1.0) as a function of alpha-beta
+// as per the magnitude invariant clarke transform
+// The magnitude of the alpha-beta vector may not be larger than sqrt(3)/2
+// unless an overmodulation strategy is selected.
+// Returns true on success, and false if the input was out of range
+//
+// This uses min-max (common mode) injection which is equivalent to the
+// classic sector based SVM but runs in constant time without branches.
+inline std::tuple<float, float, float, bool> SVM(float alpha, float beta,
+        SvmOvermodulation_t overmodulation = SVM_OVERMODULATION_NONE) {
+    // Phase voltages, scaled such that the hexagon corresponds to a
+    // phase-to-phase span of 1
+    float vA = (2.0f / 3.0f) * alpha;
+    float vB = -(1.0f / 3.0f) * alpha + one_by_sqrt3 * beta;
+    float vC = -(1.0f / 3.0f) * alpha - one_by_sqrt3 * beta;
+
+    float v_max = std::max(vA, std::max(vB, vC));
+    float v_min = std::min(vA, std::min(vB, vC));
+
+    if (overmodulation == SVM_OVERMODULATION_CLAMP) {
+        float span = v_max - v_min;
+        float scale = span > 1.0f ? 1.0f / span : 1.0f;
+        vA *= scale;
+        vB *= scale;
+        vC *= scale;
+        v_max *= scale;
+        v_min *= scale;
+    }
+
+    // Center the phase voltages in the PWM period
+    float v_mid = 0.5f * (v_max + v_min);
+    float tA = 0.5f - (vA - v_mid);
+    float tB = 0.5f - (vB - v_mid);
+    float tC = 0.5f - (vC - v_mid);
+
+    if (overmodulation == SVM_OVERMODULATION_SIX_STEP) {
+        tA = std::clamp(tA, 0.0f, 1.0f);
+        tB = std::clamp(tB, 0.0f, 1.0f);
+        tC = std::clamp(tC, 0.0f, 1.0f);
+    }
+
+    bool result_valid =
+            tA >= 0.0f && tA <= 1.0f
+         && tB >= 0.0f && tB <= 1.0f
+         && tC >= 0.0f && tC <= 1.0f;
+    return {tA, tB, tC, result_valid};
+}
+
+// Voltage vector that the inverter loses to dead time and switch drops, as
+// per the magnitude invariant clarke transform.
+// Each phase loses `drop` against the direction of its current. Within `band`
+// of zero current the direction isn't reliable and the loss is ramped down
+// linearly.
+inline std::pair<float, float> inverter_drop_alpha_beta(float Ialpha, float Ibeta,
+        float drop, float band) {
+    auto phase_drop = [&](float I) {
+        return band > 0.0f ? drop * std::clamp(I / band, -1.0f, 1.0f)
+                           : (I > 0.0f ? drop : I < 0.0f ? -drop : 0.0f);
+    };
+    float vA = phase_drop(Ialpha);
+    float vB = phase_drop(-0.5f * Ialpha + sqrt3_by_2 * Ibeta);
+    float vC = phase_drop(-0.5f * Ialpha - sqrt3_by_2 * Ibeta);
+    return {
+        (2.0f / 3.0f) * (vA - 0.5f * (vB + vC)),
+        one_by_sqrt3 * (vB - vC)
+    };
+}
+
 // Modulo (as opposed to remainder), per https://stackoverflow.com/a/19288271
 inline int mod(const int dividend, const int divisor){
     int r = dividend % divisor;
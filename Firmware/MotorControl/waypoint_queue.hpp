@@ -0,0 +1,131 @@
+#ifndef __WAYPOINT_QUEUE_HPP
+#define __WAYPOINT_QUEUE_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <cmath>
+
+/**
+ * @brief Bounded queue of timed waypoints that is played back with cubic
+ * Hermite splines.
+ *
+ * Each waypoint carries the time since the previous waypoint. After the queue
+ * ran empty the first waypoint is reached dt after it arrives, starting from
+ * the hold position. Relative times keep the playback accurate however long
+ * the stream runs.
+ *
+ * push() may be called from one thread while step() runs in the control loop
+ * interrupt. All other functions must not race with step().
+ */
+template<size_t N>
+class WaypointQueue {
+    static_assert((N & (N - 1)) == 0, "N must be a power of 2");
+
+public:
+    struct Waypoint_t {
+        float dt;           // [s] time since the previous waypoint
+        float pos;          // [turn]
+        float vel;          // [turn/s]
+        float torque_ff;    // [Nm]
+    };
+
+    struct Setpoint_t {
+        float pos;          // [turn]
+        float vel;          // [turn/s]
+        float acc;          // [turn/s^2]
+        float torque_ff;    // [Nm]
+    };
+
+    // @brief Appends a waypoint. Returns false if the queue is full or the
+    // waypoint is invalid.
+    bool push(const Waypoint_t& wp) {
+        if (!(wp.dt > 0.0f) || !std::isfinite(wp.dt) || !std::isfinite(wp.pos)
+                || !std::isfinite(wp.vel) || !std::isfinite(wp.torque_ff)) {
+            return false;
+        }
+        uint32_t head = head_;
+        if (head - tail_ >= N) {
+            return false;
+        }
+        buf_[head & (N - 1)] = wp;
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        head_ = head + 1;
+        return true;
+    }
+
+    size_t size() const {
+        return head_ - tail_;
+    }
+
+    size_t free_space() const {
+        return N - size();
+    }
+
+    // @brief Continues the playback from the given setpoint towards the
+    // queued waypoints
+    void restart(float pos, float vel, float torque_ff) {
+        prev_ = {0.0f, pos, vel, torque_ff};
+        t_ = 0.0f;
+    }
+
+    void clear() {
+        tail_ = head_;
+    }
+
+    /**
+     * @brief Advances the playback by dt and returns the setpoint.
+     *
+     * Waypoints are removed once they are passed. If the queue runs empty the
+     * setpoint holds the last waypoint at standstill and underruns_ is
+     * incremented.
+     */
+    Setpoint_t step(float dt) {
+        t_ += dt;
+        while (size() && t_ >= buf_[tail_ & (N - 1)].dt) {
+            t_ -= buf_[tail_ & (N - 1)].dt;
+            prev_ = buf_[tail_ & (N - 1)];
+            std::atomic_signal_fence(std::memory_order_seq_cst);
+            tail_ = tail_ + 1;
+        }
+
+        if (!size()) {
+            if (prev_.vel != 0.0f) {
+                underruns_++;
+            }
+            // The next waypoint starts from here
+            prev_.vel = 0.0f;
+            t_ = 0.0f;
+            return {prev_.pos, 0.0f, 0.0f, prev_.torque_ff};
+        }
+
+        return interpolate(prev_, buf_[tail_ & (N - 1)], t_);
+    }
+
+    // @brief Cubic Hermite spline from a to b, t seconds after a
+    static Setpoint_t interpolate(const Waypoint_t& a, const Waypoint_t& b, float t) {
+        float h = b.dt;
+        float s = t / h;
+        float s2 = s * s;
+        float s3 = s2 * s;
+        float dp = b.pos - a.pos;
+        float m0 = h * a.vel;
+        float m1 = h * b.vel;
+        float pos = a.pos + (s3 - 2.0f * s2 + s) * m0 + (-2.0f * s3 + 3.0f * s2) * dp + (s3 - s2) * m1;
+        float vel = ((3.0f * s2 - 4.0f * s + 1.0f) * m0 + (-6.0f * s2 + 6.0f * s) * dp + (3.0f * s2 - 2.0f * s) * m1) / h;
+        float acc = ((6.0f * s - 4.0f) * m0 + (-12.0f * s + 6.0f) * dp + (6.0f * s - 2.0f) * m1) / (h * h);
+        float torque_ff = a.torque_ff + s * (b.torque_ff - a.torque_ff);
+        return {pos, vel, acc, torque_ff};
+    }
+
+    uint32_t underruns_ = 0; // times the queue ran empty while moving
+
+private:
+    Waypoint_t buf_[N];
+    volatile uint32_t head_ = 0; // written by push()
+    volatile uint32_t tail_ = 0; // written by step()
+    Waypoint_t prev_ = {};       // last waypoint that was passed
+    float t_ = 0.0f;             // [s] time since prev_
+};
+
+#endif // __WAYPOINT_QUEUE_HPP
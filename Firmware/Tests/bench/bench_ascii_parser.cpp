@@ -0,0 +1,93 @@
+/**
+ * @file bench_ascii_parser.cpp
+ * @brief Host benchmark of the ASCII protocol parser
+ *
+ * Times the parsing of typical `p` setpoint commands as sent by a PLC with the
+ * previous sscanf path, with AsciiParser and with everything that
+ * process_line() does before the command handler, and prints the time per
+ * line.
+ *
+ * Build and run with `make bench`.
+ */
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "communication/ascii_parser.hpp"
+
+// Accumulates all results, so that the compiler can't drop the calls
+static float sink = 0.0f;
+
+template<typename TFn>
+static double time_ns(size_t n, TFn fn) {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < n; ++i) {
+        fn(i);
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / n;
+}
+
+int main() {
+    // Typical setpoint commands, without the command character like
+    // AsciiProtocol passes them
+    std::mt19937 gen(0);
+    std::uniform_real_distribution<float> dist(-100.0f, 100.0f);
+    std::vector<std::string> lines;
+    for (int i = 0; i < 1024; ++i) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), " %d %.4f %.3f %.3f", i % 2, (double)dist(gen), (double)dist(gen), (double)dist(gen));
+        lines.push_back(buf);
+    }
+
+    const size_t n = 50 * lines.size();
+    printf("%-36s %10.1f ns\n", "p command (sscanf)", time_ns(n, [&](size_t i) {
+        // The previous path: copy into a null-terminated buffer, then sscanf
+        std::string& line = lines[i % lines.size()];
+        char cmd[257];
+        size_t len = std::min(line.size(), (size_t)256);
+        memcpy(cmd, line.data(), len);
+        cmd[len] = 0;
+        unsigned motor;
+        float a = 0.0f, b = 0.0f, c = 0.0f;
+        int n_parsed = sscanf(cmd, " %u %f %f %f", &motor, &a, &b, &c);
+        sink += n_parsed + a + b + c;
+    }));
+    printf("%-36s %10.1f ns\n", "p command (AsciiParser)", time_ns(n, [&](size_t i) {
+        std::string& line = lines[i % lines.size()];
+        AsciiParser parser{&line[0], &line[0] + line.size()};
+        unsigned motor;
+        float a = 0.0f, b = 0.0f, c = 0.0f;
+        int n_parsed = parser.parse_uint(&motor) + parser.parse_float(&a) + parser.parse_float(&b) + parser.parse_float(&c);
+        sink += n_parsed + a + b + c;
+    }));
+
+    // Everything that process_line() does before the command handler
+    std::vector<std::string> framed_lines;
+    for (auto& line : lines) {
+        framed_lines.push_back("p" + line);
+    }
+    double t_line = time_ns(n, [&](size_t i) {
+        std::string& line = framed_lines[i % framed_lines.size()];
+        size_t len;
+        bool use_checksum;
+        frame_ascii_line(&line[0], line.size(), 256, &len, &use_checksum);
+        AsciiParser parser{&line[1], &line[0] + len};
+        unsigned motor;
+        float a = 0.0f, b = 0.0f, c = 0.0f;
+        int n_parsed = parser.parse_uint(&motor) + parser.parse_float(&a) + parser.parse_float(&b) + parser.parse_float(&c);
+        sink += n_parsed + a + b + c;
+    });
+    printf("%-36s %10.1f ns (%.0f commands/s)\n", "p command (framed line)", t_line, 1e9 / t_line);
+
+    if (std::isnan(sink)) {
+        printf("the parser returned NaN\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,106 @@
+/**
+ * @file bench_component.cpp
+ * @brief Host benchmark of InputPort
+ *
+ * Times present() and any() of InputPort against the original std::variant
+ * based port over 16 ports connected to OutputPorts, half of which are valid
+ * in each iteration, and prints the time per port.
+ *
+ * Build and run with `make bench`.
+ */
+
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <variant>
+
+#include "MotorControl/component.hpp"
+
+// Copy of the original std::variant based InputPort for reference.
+template<typename T>
+class VariantInputPort {
+public:
+    void connect_to(OutputPort<T>* input_port) { content_ = input_port; }
+    void connect_to(T* input_ptr) { content_ = input_ptr; }
+    void disconnect() { content_ = (OutputPort<T>*)nullptr; }
+
+    std::optional<T> present() {
+        if (content_.index() == 2) {
+            OutputPort<T>* ptr = std::get<2>(content_);
+            return ptr ? ptr->present() : std::nullopt;
+        } else if (content_.index() == 1) {
+            T* ptr = std::get<1>(content_);
+            return ptr ? std::make_optional(*ptr) : std::nullopt;
+        } else {
+            return std::get<0>(content_);
+        }
+    }
+
+    std::optional<T> any() {
+        if (content_.index() == 2) {
+            OutputPort<T>* ptr = std::get<2>(content_);
+            return ptr ? ptr->any() : std::nullopt;
+        } else if (content_.index() == 1) {
+            T* ptr = std::get<1>(content_);
+            return ptr ? std::make_optional(*ptr) : std::nullopt;
+        } else {
+            return std::get<0>(content_);
+        }
+    }
+
+private:
+    std::variant<T, T*, OutputPort<T>*> content_;
+};
+
+// Accumulates all results, so that the compiler can't drop the calls
+static float sink = 0.0f;
+
+template<typename TFn>
+static double time_ns(size_t n, TFn fn) {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < n; ++i) {
+        fn(i);
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / n;
+}
+
+constexpr size_t N = 16;
+
+template<typename TPorts>
+static double time_ports_ns(TPorts& ports, std::array<OutputPort<float>, N>& outputs) {
+    const size_t iterations = 200000;
+    return time_ns(iterations, [&](size_t it) {
+        for (size_t i = 0; i < N; ++i) {
+            outputs[i].reset();
+            if (i & 1) {
+                outputs[i] = (float)it;
+            }
+        }
+        for (auto& port : ports) {
+            sink += port.present().value_or(0.5f);
+            sink += port.any().value_or(0.5f);
+        }
+    }) / N;
+}
+
+int main() {
+    std::array<OutputPort<float>, N> outputs{
+        0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f,
+        0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+    std::array<VariantInputPort<float>, N> variant_ports;
+    std::array<InputPort<float>, N> ports;
+    for (size_t i = 0; i < N; ++i) {
+        variant_ports[i].connect_to(&outputs[i]);
+        ports[i].connect_to(&outputs[i]);
+    }
+
+    printf("%-36s %10.1f ns\n", "InputPort (variant)", time_ports_ns(variant_ports, outputs));
+    printf("%-36s %10.1f ns\n", "InputPort (resolved)", time_ports_ns(ports, outputs));
+
+    if (!(sink > 0.0f)) {
+        printf("the ports returned no values\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,56 @@
+/**
+ * @file bench_svm.cpp
+ * @brief Host benchmark of the space vector modulation
+ *
+ * Times SVM() against the original sector based implementation over random
+ * vectors inside the linear range and prints the time per call.
+ *
+ * Build and run with `make bench`.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "MotorControl/utils.hpp"
+
+#include "../svm_sector_copy.hpp"
+
+// Accumulates all results, so that the compiler can't drop the calls
+static float sink = 0.0f;
+
+template<typename TFn>
+static double time_ns(size_t n, TFn fn) {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < n; ++i) {
+        fn(i);
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / n;
+}
+
+int main() {
+    std::mt19937 gen(0);
+    std::uniform_real_distribution<float> dist(-0.85f, 0.85f);
+    std::vector<std::pair<float, float>> inputs(4096);
+    for (auto& in : inputs) {
+        in = {dist(gen), dist(gen)};
+    }
+
+    const size_t n = 200 * inputs.size();
+    printf("%-36s %10.1f ns\n", "SVM (sector)", time_ns(n, [&](size_t i) {
+        auto [tA, tB, tC, valid] = SVM_sector(inputs[i % inputs.size()].first, inputs[i % inputs.size()].second);
+        sink += tA + tB + tC + valid;
+    }));
+    printf("%-36s %10.1f ns\n", "SVM (min-max)", time_ns(n, [&](size_t i) {
+        auto [tA, tB, tC, valid] = SVM(inputs[i % inputs.size()].first, inputs[i % inputs.size()].second);
+        sink += tA + tB + tC + valid;
+    }));
+
+    if (is_nan(sink)) {
+        printf("SVM returned NaN\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,97 @@
+/**
+ * @file bench_trap_traj.cpp
+ * @brief Host benchmarks of the trajectory planners
+ *
+ * Times the planning and the evaluation of S-curve and trapezoid moves, the
+ * step of the waypoint queue and the step of the online trapezoid tracker,
+ * and prints the time per call. The on-target counterparts are the TRAP_*
+ * and SCURVE_* kernels of run_benchmark().
+ *
+ * Build and run with `make bench`.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "MotorControl/utils.hpp"
+#include "MotorControl/scurve_traj.hpp"
+#include "MotorControl/trap_tracker.hpp"
+#include "MotorControl/waypoint_queue.hpp"
+
+#include "../trap_traj_copy.hpp"
+
+// Accumulates all results, so that the compiler can't drop the calls
+static float sink = 0.0f;
+
+template<typename TFn>
+static double time_ns(size_t n, TFn fn) {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < n; ++i) {
+        fn(i);
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / n;
+}
+
+int main() {
+    std::mt19937 gen(0);
+    std::uniform_real_distribution<float> dist(-10.0f, 10.0f);
+    std::vector<float> goals(1000);
+    for (auto& goal : goals) {
+        goal = dist(gen);
+    }
+
+    SCurveTrajectory scurve{};
+    TrapezoidalTrajectory trap{};
+    printf("%-36s %10.1f ns\n", "S-curve plan", time_ns(goals.size(), [&](size_t i) {
+        scurve.plan(goals[i], 0.0f, 0.5f, 2.0f, 4.0f, 3.0f, 40.0f);
+        sink += scurve.Tf_;
+    }));
+    printf("%-36s %10.1f ns\n", "trapezoid plan", time_ns(goals.size(), [&](size_t i) {
+        trap.planTrapezoidal(goals[i], 0.0f, 0.5f, 2.0f, 4.0f, 3.0f);
+        sink += trap.Tf_;
+    }));
+
+    const size_t n_eval = 100000;
+    scurve.plan(10.0f, 0.0f, 0.0f, 2.0f, 4.0f, 3.0f, 40.0f);
+    trap.planTrapezoidal(10.0f, 0.0f, 0.0f, 2.0f, 4.0f, 3.0f);
+    float dt_scurve = scurve.Tf_ / n_eval;
+    float dt_trap = trap.Tf_ / n_eval;
+    printf("%-36s %10.1f ns\n", "S-curve eval", time_ns(n_eval, [&](size_t i) {
+        sink += scurve.eval(i * dt_scurve).Y;
+    }));
+    printf("%-36s %10.1f ns\n", "trapezoid eval", time_ns(n_eval, [&](size_t i) {
+        sink += trap.eval(i * dt_trap).Y;
+    }));
+
+    // Waypoints at 1kHz played back at 8kHz, refilled as the control
+    // loop consumes them
+    WaypointQueue<16> queue;
+    queue.restart(0.0f, 0.0f, 0.0f);
+    size_t n_pushed = 0;
+    printf("%-36s %10.1f ns\n", "waypoint queue step (incl. push)", time_ns(n_eval, [&](size_t) {
+        while (queue.free_space()) {
+            float t = 0.001f * n_pushed++;
+            queue.push({0.001f, std::sin(t), std::cos(t), 0.0f});
+        }
+        sink += queue.step(0.000125f).pos;
+    }));
+
+    // Per control cycle with a new goal: replanning the trapezoid against
+    // tracking the goal online
+    printf("%-36s %10.1f ns\n", "planTrapezoidal + eval", time_ns(goals.size(), [&](size_t i) {
+        trap.planTrapezoidal(goals[i], 0.0f, 0.5f, 2.0f, 4.0f, 3.0f);
+        sink += trap.eval(0.000125f).Y;
+    }));
+    printf("%-36s %10.1f ns\n", "TrapTracker::step", time_ns(goals.size(), [&](size_t i) {
+        sink += TrapTracker::step(goals[i], 0.5f, 2.0f, 4.0f, 3.0f, 0.000125f).dY;
+    }));
+
+    if (is_nan(sink)) {
+        printf("a planner returned NaN\n");
+        return 1;
+    }
+    return 0;
+}
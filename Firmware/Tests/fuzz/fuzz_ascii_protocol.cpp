@@ -0,0 +1,65 @@
+/**
+ * @file fuzz_ascii_protocol.cpp
+ * @brief libFuzzer target for the line handling of the ASCII protocol
+ *
+ * Runs arbitrary lines through frame_ascii_line() and then through the
+ * AsciiParser functions that the command handlers use, in an order driven by
+ * the input. This is the part of AsciiProtocol::process_line() that touches
+ * untrusted bytes; the command handlers themselves depend on the firmware.
+ *
+ * The line is copied to a heap buffer with exactly one spare byte for the
+ * terminator, so that AddressSanitizer catches any access beyond it.
+ *
+ * Build and run with `make fuzz-ascii` (requires clang).
+ */
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cstdlib>
+
+#include "communication/ascii_protocol.hpp"
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    if (size > MAX_LINE_LENGTH) {
+        return 0; // AsciiProtocol never passes longer lines
+    }
+
+    char* line = static_cast<char*>(malloc(size + 1));
+    if (size) {
+        memcpy(line, data, size);
+    }
+
+    size_t len;
+    bool use_checksum;
+    if (frame_ascii_line(line, size, MAX_LINE_LENGTH, &len, &use_checksum)) {
+        if (len > size || line[len] != 0) {
+            abort();
+        }
+
+        // The command character selects the sequence of arguments
+        AsciiParser args{line + (len ? 1 : 0), line + len};
+        unsigned op = len ? (uint8_t)line[0] : 0;
+        for (size_t i = 0; i <= len; ++i) {
+            unsigned u;
+            int32_t n;
+            float f;
+            char* begin;
+            char* end;
+            bool ok;
+            switch ((op + i) % 5) {
+                case 0: ok = args.parse_uint(&u); break;
+                case 1: ok = args.parse_int(&n); break;
+                case 2: ok = args.parse_float(&f); break;
+                case 3: ok = args.parse_token(&begin, &end) && begin < end && begin >= line && end <= line + len; break;
+                default: ok = args.expect(' '); break;
+            }
+            if (!ok && !args.expect(args.peek())) {
+                break; // at the end
+            }
+        }
+    }
+
+    free(line);
+    return 0;
+}
@@ -0,0 +1,131 @@
+#ifndef __PMSM_PLANT_HPP
+#define __PMSM_PLANT_HPP
+
+#include <array>
+#include <cmath>
+
+/**
+ * @brief Host-side model of a surface mount PMSM on a rigid inertia, fed by a
+ * two-level inverter. The C++ counterpart of analysis/Simulation/MotorSim.py,
+ * meant to close control loops around firmware code in the tests.
+ *
+ * The electrical model is in the rotor frame and uses the magnitude invariant
+ * Clarke transform like the firmware, so the torque is
+ * 3/2 * pole_pairs * flux_linkage * Iq:
+ *
+ *   L dId/dt = Vd - R Id + w_e L Iq
+ *   L dIq/dt = Vq - R Iq - w_e L Id - w_e flux_linkage
+ *   J dw/dt  = torque - friction * w - load_torque
+ *
+ * The inverter applies the rising edge timings that SVM() produces (phase X
+ * is high for 1 - tX of the period) as pole voltages, without dead time or
+ * switch drops. Each step holds them for the whole period and integrates with
+ * several RK4 sub-steps, which is accurate for any period that the firmware
+ * would run at.
+ */
+class PmsmPlant {
+public:
+    struct Params_t {
+        double phase_resistance = 0.05; // [Ohm]
+        double phase_inductance = 20e-6; // [H]
+        double flux_linkage = 0.005; // [V/(rad/s)] per pole pair, electrical
+        int pole_pairs = 7;
+        double inertia = 1e-4; // [kg m^2]
+        double friction = 0.0; // [Nm/(rad/s)] viscous
+    };
+
+    explicit PmsmPlant(const Params_t& params) : p_(params) {}
+
+    /**
+     * @brief Advances the model by dt with the given inverter timings held
+     * constant.
+     * @param timings: Rising edge timings of phases A, B, C (0...1)
+     * @param vbus: DC bus voltage [V]
+     */
+    void step(const std::array<float, 3>& timings, float vbus, double dt, size_t n_substeps = 8) {
+        // Pole voltages, the common mode doesn't drive any current
+        double uA = (1.0 - timings[0]) * vbus;
+        double uB = (1.0 - timings[1]) * vbus;
+        double uC = (1.0 - timings[2]) * vbus;
+        double V_alpha = (2.0 / 3.0) * (uA - 0.5 * (uB + uC));
+        double V_beta = (uB - uC) / std::sqrt(3.0);
+
+        double h = dt / (double)n_substeps;
+        for (size_t i = 0; i < n_substeps; ++i) {
+            rk4(V_alpha, V_beta, h);
+        }
+        time_ += dt;
+    }
+
+    // @brief Phase currents [A] as the current sensors would see them
+    std::array<float, 3> phase_currents() const {
+        auto [I_alpha, I_beta] = rotate(Id_, Iq_, electrical_phase());
+        return {
+            (float)I_alpha,
+            (float)(-0.5 * I_alpha + 0.5 * std::sqrt(3.0) * I_beta),
+            (float)(-0.5 * I_alpha - 0.5 * std::sqrt(3.0) * I_beta)
+        };
+    }
+
+    double torque() const { return 1.5 * p_.pole_pairs * p_.flux_linkage * Iq_; }
+    double electrical_phase() const { return std::remainder(p_.pole_pairs * pos_, 2.0 * M_PI); }
+
+    const Params_t& params() const { return p_; }
+    double time() const { return time_; }
+    double Id() const { return Id_; }
+    double Iq() const { return Iq_; }
+    double pos() const { return pos_; } // [rad] mechanical, not wrapped
+    double vel() const { return vel_; } // [rad/s] mechanical
+
+    double load_torque_ = 0.0; // [Nm] external torque against the motor
+
+private:
+    struct State_t {
+        double Id, Iq, pos, vel;
+    };
+
+    static std::array<double, 2> rotate(double x, double y, double angle) {
+        double c = std::cos(angle);
+        double s = std::sin(angle);
+        return {c * x - s * y, s * x + c * y};
+    }
+
+    State_t derivative(const State_t& x, double V_alpha, double V_beta) const {
+        double phase = p_.pole_pairs * x.pos;
+        auto [Vd, Vq] = rotate(V_alpha, V_beta, -phase);
+        double w_e = p_.pole_pairs * x.vel;
+        double R = p_.phase_resistance;
+        double L = p_.phase_inductance;
+        double torque = 1.5 * p_.pole_pairs * p_.flux_linkage * x.Iq;
+        return {
+            (Vd - R * x.Id + w_e * L * x.Iq) / L,
+            (Vq - R * x.Iq - w_e * L * x.Id - w_e * p_.flux_linkage) / L,
+            x.vel,
+            (torque - p_.friction * x.vel - load_torque_) / p_.inertia
+        };
+    }
+
+    void rk4(double V_alpha, double V_beta, double h) {
+        auto add = [](const State_t& x, const State_t& d, double k) {
+            return State_t{x.Id + k * d.Id, x.Iq + k * d.Iq, x.pos + k * d.pos, x.vel + k * d.vel};
+        };
+        State_t x{Id_, Iq_, pos_, vel_};
+        State_t k1 = derivative(x, V_alpha, V_beta);
+        State_t k2 = derivative(add(x, k1, 0.5 * h), V_alpha, V_beta);
+        State_t k3 = derivative(add(x, k2, 0.5 * h), V_alpha, V_beta);
+        State_t k4 = derivative(add(x, k3, h), V_alpha, V_beta);
+        Id_ += h / 6.0 * (k1.Id + 2.0 * k2.Id + 2.0 * k3.Id + k4.Id);
+        Iq_ += h / 6.0 * (k1.Iq + 2.0 * k2.Iq + 2.0 * k3.Iq + k4.Iq);
+        pos_ += h / 6.0 * (k1.pos + 2.0 * k2.pos + 2.0 * k3.pos + k4.pos);
+        vel_ += h / 6.0 * (k1.vel + 2.0 * k2.vel + 2.0 * k3.vel + k4.vel);
+    }
+
+    Params_t p_;
+    double Id_ = 0.0;
+    double Iq_ = 0.0;
+    double pos_ = 0.0;
+    double vel_ = 0.0;
+    double time_ = 0.0;
+};
+
+#endif // __PMSM_PLANT_HPP
@@ -0,0 +1,80 @@
+#ifndef __SVM_SECTOR_COPY_HPP
+#define __SVM_SECTOR_COPY_HPP
+
+#include <tuple>
+
+#include "MotorControl/utils.hpp"
+
+// Copy of the original sector based SVM for reference. Shared by the tests
+// and the benchmarks in Tests/bench/.
+inline std::tuple<float, float, float, bool> SVM_sector(float alpha, float beta) {
+    float tA, tB, tC;
+    int Sextant;
+
+    if (beta >= 0.0f) {
+        if (alpha >= 0.0f) {
+            Sextant = (one_by_sqrt3 * beta > alpha) ? 2 : 1;
+        } else {
+            Sextant = (-one_by_sqrt3 * beta > alpha) ? 3 : 2;
+        }
+    } else {
+        if (alpha >= 0.0f) {
+            Sextant = (-one_by_sqrt3 * beta > alpha) ? 5 : 6;
+        } else {
+            Sextant = (one_by_sqrt3 * beta > alpha) ? 4 : 5;
+        }
+    }
+
+    switch (Sextant) {
+        case 1: {
+            float t1 = alpha - one_by_sqrt3 * beta;
+            float t2 = two_by_sqrt3 * beta;
+            tA = (1.0f - t1 - t2) * 0.5f;
+            tB = tA + t1;
+            tC = tB + t2;
+        } break;
+        case 2: {
+            float t2 = alpha + one_by_sqrt3 * beta;
+            float t3 = -alpha + one_by_sqrt3 * beta;
+            tB = (1.0f - t2 - t3) * 0.5f;
+            tA = tB + t3;
+            tC = tA + t2;
+        } break;
+        case 3: {
+            float t3 = two_by_sqrt3 * beta;
+            float t4 = -alpha - one_by_sqrt3 * beta;
+            tB = (1.0f - t3 - t4) * 0.5f;
+            tC = tB + t3;
+            tA = tC + t4;
+        } break;
+        case 4: {
+            float t4 = -alpha + one_by_sqrt3 * beta;
+            float t5 = -two_by_sqrt3 * beta;
+            tC = (1.0f - t4 - t5) * 0.5f;
+            tB = tC + t5;
+            tA = tB + t4;
+        } break;
+        case 5: {
+            float t5 = -alpha - one_by_sqrt3 * beta;
+            float t6 = alpha - one_by_sqrt3 * beta;
+            tC = (1.0f - t5 - t6) * 0.5f;
+            tA = tC + t5;
+            tB = tA + t6;
+        } break;
+        default: {
+            float t6 = -two_by_sqrt3 * beta;
+            float t1 = alpha + one_by_sqrt3 * beta;
+            tA = (1.0f - t6 - t1) * 0.5f;
+            tC = tA + t1;
+            tB = tC + t6;
+        } break;
+    }
+
+    bool result_valid =
+            tA >= 0.0f && tA <= 1.0f
+         && tB >= 0.0f && tB <= 1.0f
+         && tC >= 0.0f && tC <= 1.0f;
+    return {tA, tB, tC, result_valid};
+}
+
+#endif // __SVM_SECTOR_COPY_HPP
@@ -0,0 +1,54 @@
+#include <doctest.h>
+#include <cmath>
+
+#include "MotorControl/acim_flux_observer.hpp"
+
+// Steady state with the rotor flux and the current rotating at w. The current
+// model estimate is off by cm_error in angle.
+static float observed_angle_error(float w, float cm_error) {
+    const float dt = 125e-6f;
+    AcimFluxObserver::Params_t params = {0.5f, 2e-3f, 20e-3f, 20.0f};
+    const float flux = 8.0f;       // [A]
+    const float current = 12.0f;   // [A]
+    const float current_lead = 0.9f;
+
+    auto stator_flux = [&](float t, float* out) {
+        float th = w * t;
+        out[0] = params.magnetizing_inductance * flux * std::cos(th) + params.leakage_inductance * current * std::cos(th + current_lead);
+        out[1] = params.magnetizing_inductance * flux * std::sin(th) + params.leakage_inductance * current * std::sin(th + current_lead);
+    };
+
+    AcimFluxObserver observer;
+    observer.reset(params, flux, 0.0f, current * std::cos(current_lead), current * std::sin(current_lead));
+    float t = 0.0f;
+    for (size_t k = 1; k < 40000; ++k) {
+        t = (float)k * dt;
+        float t_mid = t - 0.5f * dt;
+        float f0[2], f1[2];
+        stator_flux(t - dt, f0);
+        stator_flux(t, f1);
+        float Ia_mid = current * std::cos(w * t_mid + current_lead);
+        float Ib_mid = current * std::sin(w * t_mid + current_lead);
+        float Va = params.resistance * Ia_mid + (f1[0] - f0[0]) / dt;
+        float Vb = params.resistance * Ib_mid + (f1[1] - f0[1]) / dt;
+        float Ia = current * std::cos(w * t + current_lead);
+        float Ib = current * std::sin(w * t + current_lead);
+        float cm_angle = w * t + cm_error;
+        observer.update(params, Va, Vb, Ia, Ib,
+                        flux * std::cos(cm_angle), flux * std::sin(cm_angle), dt);
+    }
+    float angle = std::atan2(observer.rotor_flux_beta(), observer.rotor_flux_alpha());
+    return std::remainder(angle - w * t, 2.0f * (float)M_PI);
+}
+
+TEST_SUITE("acim_flux_observer") {
+    TEST_CASE("current model at standstill") {
+        CHECK(observed_angle_error(0.0f, 0.2f) == doctest::Approx(0.2f).epsilon(0.01));
+    }
+
+    TEST_CASE("voltage model at speed") {
+        // The current model error is attenuated by bandwidth / w
+        CHECK(std::abs(observed_angle_error(1000.0f, 0.2f)) < 0.01f);
+        CHECK(std::abs(observed_angle_error(-1000.0f, 0.2f)) < 0.01f);
+    }
+}
@@ -0,0 +1,163 @@
+#include <doctest.h>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "communication/ascii_parser.hpp"
+
+// Parser over a copy of str (the parser works in place on mutable lines)
+struct ParserFixture {
+    ParserFixture(const char* str) : line(str, str + strlen(str)), parser(line.data(), line.data() + line.size()) {}
+    std::vector<char> line;
+    AsciiParser parser;
+};
+
+// Distance between two floats in units in the last place
+static int64_t ulp_distance(float a, float b) {
+    int32_t ia, ib;
+    memcpy(&ia, &a, sizeof(ia));
+    memcpy(&ib, &b, sizeof(ib));
+    if (ia < 0) ia = INT32_MIN - ia;
+    if (ib < 0) ib = INT32_MIN - ib;
+    return std::abs((int64_t)ia - (int64_t)ib);
+}
+
+TEST_SUITE("ascii_parser") {
+    TEST_CASE("unsigned integers") {
+        ParserFixture f{" 12  +7 4294967295 99999999999 -1 x"};
+        unsigned a, b, c, d, e;
+        REQUIRE(f.parser.parse_uint(&a));
+        REQUIRE(f.parser.parse_uint(&b));
+        REQUIRE(f.parser.parse_uint(&c));
+        REQUIRE(f.parser.parse_uint(&d));
+        REQUIRE(f.parser.parse_uint(&e));
+        CHECK(a == 12);
+        CHECK(b == 7);
+        CHECK(c == 4294967295u);
+        CHECK(d == 4294967295u); // saturated
+        CHECK(e == 4294967295u); // wraps like sscanf
+        CHECK(!f.parser.parse_uint(&a));
+        CHECK(f.parser.peek() == 'x'); // failed parse consumes nothing but whitespace
+    }
+
+    TEST_CASE("signed integers like %i") {
+        const char* inputs[] = {"0", "-42", "+17", "0x1F", "-0x10", "017", "0x", "2147483647", "-2147483648", "123abc"};
+        for (const char* input : inputs) {
+            CAPTURE(input);
+            int expected;
+            ParserFixture f{input};
+            int32_t actual;
+            REQUIRE(sscanf(input, "%i", &expected) == 1);
+            REQUIRE(f.parser.parse_int(&actual));
+            CHECK(actual == expected);
+        }
+
+        ParserFixture f{"- 5"};
+        int32_t value;
+        CHECK(!f.parser.parse_int(&value));
+    }
+
+    TEST_CASE("floats match strtof") {
+        const char* inputs[] = {
+            "0", "-0", "1", "12.345", "-0.0001", ".5", "5.", "1e3", "1.5E-3", "+2.5e+2",
+            "3.4028234e38", "1e39", "1e-46", "1.17549435e-38", "0.1", "123456789.123",
+            "0.000000000000000000000000000001", "98765432109876543210", "1e", "2e+",
+            "16777217", "7.0e-10", "inf", "-Infinity", "NaN",
+        };
+        for (const char* input : inputs) {
+            CAPTURE(input);
+            char* strtof_end;
+            float expected = strtof(input, &strtof_end);
+            ParserFixture f{input};
+            float actual;
+            REQUIRE(f.parser.parse_float(&actual));
+            CHECK((size_t)(f.parser.peek() ? strchr(input, f.parser.peek()) - input : strlen(input)) == (size_t)(strtof_end - input));
+            if (std::isnan(expected)) {
+                CHECK(std::isnan(actual));
+            } else {
+                CHECK(ulp_distance(actual, expected) <= 1);
+            }
+        }
+
+        std::mt19937 gen(0);
+        std::uniform_real_distribution<float> dist(-1000.0f, 1000.0f);
+        std::uniform_int_distribution<int> precision(0, 8);
+        for (int i = 0; i < 10000; ++i) {
+            char buf[32];
+            snprintf(buf, sizeof(buf), "%.*f", precision(gen), (double)dist(gen));
+            CAPTURE(buf);
+            ParserFixture f{buf};
+            float actual;
+            REQUIRE(f.parser.parse_float(&actual));
+            CHECK(actual == strtof(buf, nullptr)); // fast path is correctly rounded
+        }
+    }
+
+    TEST_CASE("invalid floats") {
+        const char* inputs[] = {"", " ", ".", "-", "e5", "x1"};
+        for (const char* input : inputs) {
+            CAPTURE(input);
+            ParserFixture f{input};
+            float value;
+            CHECK(!f.parser.parse_float(&value));
+        }
+    }
+
+    TEST_CASE("tokens and literals") {
+        ParserFixture f{"sl  axis0.config.x  7"};
+        char* begin = nullptr;
+        char* end = nullptr;
+        CHECK(f.parser.expect('s'));
+        CHECK(!f.parser.expect('x'));
+        CHECK(f.parser.expect('l'));
+        REQUIRE(f.parser.parse_token(&begin, &end));
+        CHECK(std::string(begin, end) == "axis0.config.x");
+        REQUIRE(f.parser.parse_token(&begin, &end));
+        CHECK(std::string(begin, end) == "7");
+        CHECK(!f.parser.parse_token(&begin, &end));
+        CHECK(f.parser.peek() == 0);
+    }
+
+    TEST_CASE("line framing") {
+        auto frame = [](const char* str, std::string* cmd, bool* use_checksum) {
+            std::vector<char> line(str, str + strlen(str) + 1);
+            size_t len;
+            bool ok = frame_ascii_line(line.data(), line.size() - 1, 8, &len, use_checksum);
+            *cmd = std::string(line.data());
+            CHECK((!ok || cmd->size() == len));
+            return ok;
+        };
+        std::string cmd;
+        bool use_checksum;
+
+        CHECK(frame("p 0 1.5", &cmd, &use_checksum));
+        CHECK(cmd == "p 0 1.5");
+        CHECK_FALSE(use_checksum);
+
+        // 'v' ^ ' ' ^ '1' = 103
+        CHECK(frame("v 1*103 ; comment", &cmd, &use_checksum));
+        CHECK(cmd == "v 1");
+        CHECK(use_checksum);
+        CHECK_FALSE(frame("v 1*102", &cmd, &use_checksum));
+        CHECK_FALSE(frame("v 1*x", &cmd, &use_checksum));
+
+        // A '*' in the comment isn't a checksum, and only max_len bytes count
+        CHECK(frame("v 1;*5", &cmd, &use_checksum));
+        CHECK(cmd == "v 1");
+        CHECK_FALSE(use_checksum);
+        CHECK(frame("w axis0.x 1", &cmd, &use_checksum));
+        CHECK(cmd == "w axis0.");
+
+        CHECK(frame("", &cmd, &use_checksum));
+        CHECK(cmd == "");
+
+        // expect() doesn't match the terminator beyond the end
+        ParserFixture f{"v"};
+        CHECK(f.parser.expect('v'));
+        CHECK_FALSE(f.parser.expect(0));
+    }
+}
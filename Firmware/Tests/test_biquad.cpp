@@ -0,0 +1,52 @@
+#include <doctest.h>
+#include <algorithm>
+
+#include "MotorControl/biquad.hpp"
+
+// Amplitude of the steady state response to a sine of frequency f
+static float measure_gain(Biquad bq, float f, float fs) {
+    float peak = 0.0f;
+    for (size_t i = 0; i < 20000; ++i) {
+        float y = bq.process(std::sin(2.0f * (float)M_PI * f * (float)i / fs));
+        if (i >= 10000) {
+            peak = std::max(peak, std::abs(y));
+        }
+    }
+    return peak;
+}
+
+TEST_SUITE("biquad") {
+    const float fs = 8000.0f;
+
+    TEST_CASE("lowpass") {
+        Biquad bq;
+        REQUIRE(Biquad::design_lowpass(100.0f, 0.707f, fs, &bq));
+        CHECK(measure_gain(bq, 10.0f, fs) == doctest::Approx(1.0f).epsilon(0.01));
+        CHECK(measure_gain(bq, 100.0f, fs) == doctest::Approx(0.707f).epsilon(0.02));
+        CHECK(measure_gain(bq, 1000.0f, fs) < 0.02f);
+    }
+
+    TEST_CASE("notch") {
+        Biquad bq;
+        REQUIRE(Biquad::design_notch(300.0f, 2.0f, fs, &bq));
+        CHECK(measure_gain(bq, 300.0f, fs) < 0.01f);
+        CHECK(measure_gain(bq, 30.0f, fs) == doctest::Approx(1.0f).epsilon(0.01));
+        CHECK(measure_gain(bq, 3000.0f, fs) == doctest::Approx(1.0f).epsilon(0.01));
+    }
+
+    TEST_CASE("steady state reset") {
+        Biquad bq;
+        REQUIRE(Biquad::design_notch(300.0f, 2.0f, fs, &bq));
+        bq.reset(2.5f);
+        for (size_t i = 0; i < 10; ++i) {
+            CHECK(bq.process(2.5f) == doctest::Approx(2.5f));
+        }
+    }
+
+    TEST_CASE("invalid") {
+        Biquad bq;
+        CHECK_FALSE(Biquad::design_lowpass(4000.0f, 0.707f, fs, &bq));
+        CHECK_FALSE(Biquad::design_notch(100.0f, 0.0f, fs, &bq));
+        CHECK(bq.process(1.5f) == 1.5f); // untouched sections pass through
+    }
+}
@@ -0,0 +1,55 @@
+#include <doctest.h>
+#include <cmath>
+#include <initializer_list>
+
+#include "MotorControl/bus_ripple.hpp"
+
+// DC link current of an inverter at time t by evaluating the switch states
+static float bus_current_at(const InverterPwm_t& inv, float shift, float t) {
+    float tau = t + inv.phase;
+    tau -= std::floor(tau);
+    float counter = tau < 0.5f ? 2.0f * tau : 2.0f - 2.0f * tau;
+    float I = 0.0f;
+    for (size_t i = 0; i < 3; ++i) {
+        if (counter > inv.timings[i] - shift) {
+            I += inv.currents[i];
+        }
+    }
+    return I;
+}
+
+static float sampled_correlation(const InverterPwm_t& a, float shift, const InverterPwm_t& b) {
+    const size_t n = 100000;
+    float sum = 0.0f;
+    for (size_t k = 0; k < n; ++k) {
+        float t = ((float)k + 0.5f) / (float)n;
+        sum += bus_current_at(a, shift, t) * bus_current_at(b, 0.0f, t);
+    }
+    return sum / (float)n;
+}
+
+TEST_SUITE("bus_ripple") {
+    InverterPwm_t a = {{0.2f, 0.45f, 0.7f}, {10.0f, 2.0f, -12.0f}, 0.0f, true};
+    InverterPwm_t b = {{0.6f, 0.15f, 0.35f}, {-3.0f, 9.0f, -6.0f}, 0.23f, true};
+
+    TEST_CASE("correlation") {
+        for (float shift : {0.0f, 0.1f, -0.2f}) {
+            CHECK(inverter_bus_current_correlation(a, shift, b) == doctest::Approx(sampled_correlation(a, shift, b)).epsilon(0.01));
+        }
+    }
+
+    TEST_CASE("best shift") {
+        InverterPwm_t b_in_phase = a;
+        b_in_phase.currents[0] = 8.0f;
+        b_in_phase.currents[2] = -10.0f;
+        float shift = best_zero_vector_shift(a, &b_in_phase, 1, 0.05f, 9);
+        CHECK(inverter_bus_current_correlation(a, shift, b_in_phase) < 0.75f * inverter_bus_current_correlation(a, 0.0f, b_in_phase));
+
+        // Both zero vectors keep the margin
+        CHECK(0.2f - shift >= 0.05f - 1e-6f);
+        CHECK(1.0f - (0.7f - shift) >= 0.05f - 1e-6f);
+
+        // No room
+        CHECK(best_zero_vector_shift(a, &b_in_phase, 1, 0.25f, 9) == 0.0f);
+    }
+}
@@ -0,0 +1,45 @@
+#include <doctest.h>
+#include <cmath>
+#include <initializer_list>
+
+#include "MotorControl/cam_table.hpp"
+
+TEST_SUITE("cam_table") {
+    TEST_CASE("linear gearing") {
+        // A straight table with a matching rise is an exact gear ratio
+        const size_t n = 8;
+        const float period = 2.0f, rise = 3.0f;
+        float points[n];
+        for (size_t i = 0; i < n; ++i) {
+            points[i] = rise * (float)i / (float)n;
+        }
+        for (float master : {-5.3f, -0.1f, 0.0f, 0.7f, 1.99f, 2.0f, 13.4f}) {
+            CamTable::Output_t out = CamTable::eval(points, n, period, rise, master);
+            CHECK(out.pos == doctest::Approx(master * rise / period).epsilon(1e-5));
+            CHECK(out.slope == doctest::Approx(rise / period).epsilon(1e-5));
+            CHECK(out.curvature == doctest::Approx(0.0f).epsilon(1e-4));
+        }
+    }
+
+    TEST_CASE("cyclic cam") {
+        const size_t n = 64;
+        const float period = 1.0f;
+        float points[n];
+        for (size_t i = 0; i < n; ++i) {
+            points[i] = std::sin(2.0f * (float)M_PI * (float)i / (float)n);
+        }
+        for (size_t k = 0; k <= 1000; ++k) {
+            float master = -1.0f + 3.0f * (float)k / 1000.0f;
+            CamTable::Output_t out = CamTable::eval(points, n, period, 0.0f, master);
+            float w = 2.0f * (float)M_PI;
+            CHECK(std::abs(out.pos - std::sin(w * master)) < 1e-3f);
+            CHECK(std::abs(out.slope - w * std::cos(w * master)) < 0.02f);
+        }
+    }
+
+    TEST_CASE("invalid tables") {
+        CHECK(!CamTable::valid(1, 1.0f));
+        CHECK(!CamTable::valid(4, 0.0f));
+        CHECK(CamTable::valid(2, 1.0f));
+    }
+}
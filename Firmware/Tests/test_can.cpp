@@ -2,8 +2,11 @@
 #include <doctest.h>
 #include <algorithm>
 #include <cstring>
+#include <vector>
 
 #include "communication/can/can_helpers.hpp"
+#include "communication/can/can_rx_queue.hpp"
+#include "communication/can/can_tx_queue.hpp"
 
 enum InputMode {
     INPUT_MODE_INACTIVE,
@@ -90,4 +93,71 @@ TEST_SUITE("CAN Functions") {
         CHECK(static_cast<InputMode>(can_getSignal<InputMode>(rxmsg, 0, 8, true, 1, 0)) == INPUT_MODE_MIX_CHANNELS);
         CHECK(static_cast<InputMode>(can_getSignal<InputMode>(rxmsg, 8, 8, true, 1, 0)) == INPUT_MODE_PASSTHROUGH);
     }
-}
\ No newline at end of file
+
+    TEST_CASE("rx queue") {
+        CanRxQueue<4> queue;
+        CanRxQueue<4>::Entry_t entry;
+        CHECK(!queue.pop(&entry));
+
+        can_Message_t msg;
+        for (uint32_t i = 0; i < 6; ++i) {
+            msg.id = i;
+            CHECK(queue.push(msg, i + 100) == (i < 4));
+        }
+        CHECK(queue.get_n_dropped() == 2);
+
+        // Frames come out in order, also after the indices wrapped
+        for (uint32_t i = 0; i < 10; ++i) {
+            REQUIRE(queue.pop(&entry));
+            CHECK(entry.msg.id == i);
+            CHECK(entry.filter_index == i + 100);
+            msg.id = i + 4;
+            CHECK(queue.push(msg, i + 104));
+        }
+        for (uint32_t i = 10; i < 14; ++i) {
+            REQUIRE(queue.pop(&entry));
+            CHECK(entry.msg.id == i);
+        }
+        CHECK(!queue.pop(&entry));
+    }
+
+    TEST_CASE("tx queue") {
+        auto make_msg = [](uint32_t id, bool is_ext, uint8_t tag) {
+            can_Message_t msg;
+            msg.id = id;
+            msg.isExt = is_ext;
+            msg.buf[0] = tag;
+            return msg;
+        };
+
+        // Arbitration order of the base ID, then standard before extended
+        CHECK(CanTxQueue<4>::priority(make_msg(0x010, false, 0)) < CanTxQueue<4>::priority(make_msg(0x010 << 18, true, 0)));
+        CHECK(CanTxQueue<4>::priority(make_msg((0x00f << 18) | 0x3ffff, true, 0)) < CanTxQueue<4>::priority(make_msg(0x010, false, 0)));
+
+        CanTxQueue<4> queue;
+        CHECK(!queue.push(make_msg(0x30, false, 1)));
+        CHECK(!queue.push(make_msg(0x10, false, 2)));
+        CHECK(!queue.push(make_msg(0x30, false, 3)));
+        CHECK(!queue.push(make_msg(0x20, false, 4)));
+
+        // Full: a lower priority frame and an equal one are dropped themselves...
+        std::optional<can_Message_t> dropped = queue.push(make_msg(0x40, false, 5));
+        REQUIRE(dropped);
+        CHECK(dropped->buf[0] == 5);
+        dropped = queue.push(make_msg(0x30, false, 6));
+        REQUIRE(dropped);
+        CHECK(dropped->buf[0] == 6);
+
+        // ...a higher priority one replaces the newest lowest priority one
+        dropped = queue.push(make_msg(0x05, false, 7));
+        REQUIRE(dropped);
+        CHECK(dropped->buf[0] == 3);
+
+        std::vector<uint8_t> order;
+        can_Message_t msg;
+        while (queue.pop(&msg)) {
+            order.push_back(msg.buf[0]);
+        }
+        CHECK(order == std::vector<uint8_t>{7, 2, 4, 1});
+    }
+}
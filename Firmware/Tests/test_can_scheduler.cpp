@@ -0,0 +1,66 @@
+#include <doctest.h>
+#include <vector>
+
+#include "communication/can/can_scheduler.hpp"
+
+// Pops all jobs in deadline order
+template<size_t N>
+static std::vector<size_t> drain(DeadlineScheduler<N>& scheduler) {
+    std::vector<size_t> order;
+    while (!scheduler.empty()) {
+        order.push_back(scheduler.top());
+        scheduler.cancel(scheduler.top());
+    }
+    return order;
+}
+
+TEST_SUITE("can_scheduler") {
+    TEST_CASE("deadline order") {
+        DeadlineScheduler<8> scheduler;
+        CHECK(scheduler.empty());
+        scheduler.schedule(0, 50);
+        scheduler.schedule(1, 10);
+        scheduler.schedule(2, 30);
+        scheduler.schedule(3, 20);
+        scheduler.schedule(4, 40);
+        CHECK(scheduler.size() == 5);
+        CHECK(scheduler.top() == 1);
+        CHECK(scheduler.top_deadline() == 10);
+
+        // Move jobs in both directions and cancel one in the middle
+        scheduler.schedule(1, 45);
+        scheduler.schedule(0, 5);
+        scheduler.cancel(2);
+        CHECK(!scheduler.is_scheduled(2));
+        CHECK(scheduler.size() == 4);
+        CHECK(drain(scheduler) == std::vector<size_t>{0, 3, 4, 1});
+        CHECK(!scheduler.is_scheduled(0));
+    }
+
+    TEST_CASE("tick counter wrap") {
+        DeadlineScheduler<4> scheduler;
+        scheduler.schedule(0, 0xfffffff0);
+        scheduler.schedule(1, 0x10);
+        scheduler.schedule(2, 0xffffffff);
+        CHECK(drain(scheduler) == std::vector<size_t>{0, 2, 1});
+    }
+
+    TEST_CASE("many reschedules") {
+        DeadlineScheduler<16> scheduler;
+        uint32_t rates[16];
+        for (size_t i = 0; i < 16; ++i) {
+            rates[i] = 3 + (i * 7) % 11;
+            scheduler.schedule(i, rates[i]);
+        }
+        // Simulate periodic jobs and check that they come due in order
+        uint32_t last = 0;
+        for (size_t n = 0; n < 1000; ++n) {
+            size_t job = scheduler.top();
+            uint32_t deadline = scheduler.top_deadline();
+            REQUIRE(deadline >= last);
+            last = deadline;
+            scheduler.schedule(job, deadline + rates[job]);
+        }
+        CHECK(scheduler.size() == 16);
+    }
+}
@@ -0,0 +1,104 @@
+#include <doctest.h>
+#include <vector>
+
+#include "communication/can/can_segmented.hpp"
+
+using Link = CanSegmentedLink<128>;
+
+// Passes frames between the two links until neither has anything to send
+static size_t run(Link& a, Link& b, uint32_t now, size_t max_frames = 1000) {
+    size_t n = 0;
+    for (bool busy = true; busy && n < max_frames; ) {
+        busy = false;
+        for (auto [src, dst] : {std::pair<Link*, Link*>{&a, &b}, {&b, &a}}) {
+            can_Message_t msg;
+            if (src->next_frame(&msg, now)) {
+                src->frame_sent(now);
+                dst->on_frame(msg, now);
+                busy = true;
+                n++;
+            }
+        }
+    }
+    return n;
+}
+
+static std::vector<uint8_t> make_packet(size_t length) {
+    std::vector<uint8_t> packet(length);
+    for (size_t i = 0; i < length; ++i) {
+        packet[i] = (uint8_t)(i * 37 + 1);
+    }
+    return packet;
+}
+
+TEST_SUITE("can_segmented") {
+    TEST_CASE("packet sizes") {
+        for (size_t length : {1, 7, 8, 13, 62, 63, 64, 127, 128}) {
+            Link host, node;
+            std::vector<uint8_t> packet = make_packet(length);
+            REQUIRE(host.tx_start(packet.data(), packet.size(), 0));
+            size_t n_frames = run(host, node, 0);
+            CHECK(host.tx_state() == Link::TX_DONE);
+            REQUIRE(node.rx_ready());
+            CHECK(std::vector<uint8_t>(node.rx_data(), node.rx_data() + node.rx_length()) == packet);
+
+            // Data frames plus one flow control frame per block
+            size_t n_data = length <= 7 ? 1 : 1 + (length - 6 + 6) / 7;
+            size_t n_flow = length <= 7 ? 0 : 1 + (n_data - 2) / Link::BLOCK_SIZE;
+            CHECK(n_frames == n_data + n_flow);
+        }
+    }
+
+    TEST_CASE("both directions and busy receiver") {
+        Link host, node;
+        std::vector<uint8_t> request = make_packet(100);
+        std::vector<uint8_t> response = make_packet(50);
+        REQUIRE(host.tx_start(request.data(), request.size(), 0));
+        REQUIRE(node.tx_start(response.data(), response.size(), 0));
+        run(host, node, 0);
+        CHECK(node.rx_ready());
+        CHECK(host.rx_ready());
+        CHECK(host.rx_length() == 50);
+
+        // The node didn't release the first request yet, so it refuses the next
+        host.tx_reset();
+        REQUIRE(host.tx_start(request.data(), request.size(), 0));
+        run(host, node, 0);
+        CHECK(host.tx_state() == Link::TX_FAILED);
+
+        node.rx_release();
+        host.tx_reset();
+        REQUIRE(host.tx_start(request.data(), request.size(), 0));
+        run(host, node, 0);
+        CHECK(host.tx_state() == Link::TX_DONE);
+        CHECK(node.rx_ready());
+    }
+
+    TEST_CASE("timeouts and lost frames") {
+        Link host, node;
+        std::vector<uint8_t> request = make_packet(40);
+        REQUIRE(host.tx_start(request.data(), request.size(), 0));
+
+        // Lose the first frame: the sender gives up waiting for flow control
+        can_Message_t msg;
+        REQUIRE(host.next_frame(&msg, 0));
+        host.frame_sent(0);
+        CHECK(!host.next_frame(&msg, Link::TIMEOUT_MS - 1));
+        CHECK(host.tx_state() == Link::TX_WAITING);
+        CHECK(!host.next_frame(&msg, Link::TIMEOUT_MS));
+        CHECK(host.tx_state() == Link::TX_FAILED);
+
+        // Skip a consecutive frame: the receiver aborts
+        host.tx_reset();
+        REQUIRE(host.tx_start(request.data(), request.size(), 0));
+        run(host, node, 0, 2); // first frame and flow control
+        REQUIRE(host.next_frame(&msg, 0));
+        host.frame_sent(0);
+        REQUIRE(host.next_frame(&msg, 0));
+        host.frame_sent(0);
+        node.on_frame(msg, 0);
+        run(host, node, 0);
+        CHECK(host.tx_state() == Link::TX_FAILED);
+        CHECK(!node.rx_ready());
+    }
+}
@@ -0,0 +1,67 @@
+#include <doctest.h>
+#include <algorithm>
+#include <vector>
+
+#include <fibre/../../cobs.hpp>
+
+using namespace fibre;
+
+static std::vector<uint8_t> encode(const std::vector<uint8_t>& data) {
+    std::vector<uint8_t> out(cobs_max_encoded_size(data.size()));
+    CobsEncoder encoder;
+    encoder.begin(out.data());
+    encoder.write(data.data(), data.size());
+    out.resize(encoder.end());
+    return out;
+}
+
+static bool decode(std::vector<uint8_t>* frame) {
+    size_t length;
+    if (!cobs_decode(frame->data(), frame->size(), &length)) {
+        return false;
+    }
+    frame->resize(length);
+    return true;
+}
+
+TEST_SUITE("cobs") {
+    TEST_CASE("encode") {
+        CHECK(encode({}) == std::vector<uint8_t>{0x01});
+        CHECK(encode({0x00}) == std::vector<uint8_t>{0x01, 0x01});
+        CHECK(encode({0x11, 0x22, 0x00, 0x33}) == std::vector<uint8_t>{0x03, 0x11, 0x22, 0x02, 0x33});
+    }
+
+    TEST_CASE("segments") {
+        // Writing in pieces gives the same result as one write
+        std::vector<uint8_t> data = {0x11, 0x00, 0x00, 0x22, 0x33, 0x00};
+        std::vector<uint8_t> out(cobs_max_encoded_size(data.size()));
+        CobsEncoder encoder;
+        encoder.begin(out.data());
+        encoder.write(data.data(), 2);
+        encoder.write(data.data() + 2, 0);
+        encoder.write(data.data() + 2, 4);
+        out.resize(encoder.end());
+        CHECK(out == encode(data));
+    }
+
+    TEST_CASE("round trip") {
+        for (size_t length : {0, 1, 253, 254, 255, 508, 600}) {
+            for (uint8_t zero_every : {1, 3, 255}) {
+                std::vector<uint8_t> data(length);
+                for (size_t i = 0; i < length; ++i) {
+                    data[i] = (i % zero_every == (size_t)(zero_every - 1)) ? 0 : (uint8_t)(i * 7 + 1) | 1;
+                }
+                std::vector<uint8_t> frame = encode(data);
+                CHECK(frame.size() <= cobs_max_encoded_size(length));
+                CHECK(std::find(frame.begin(), frame.end(), 0) == frame.end());
+                REQUIRE(decode(&frame));
+                CHECK(frame == data);
+            }
+        }
+    }
+
+    TEST_CASE("malformed") {
+        std::vector<uint8_t> frame = {0x05, 0x11, 0x22};
+        CHECK(!decode(&frame));
+    }
+}
@@ -0,0 +1,42 @@
+#include <doctest.h>
+
+#include "MotorControl/cogging_model.hpp"
+
+static void std_sin_cos(float x, float* s, float* c) {
+    *s = std::sin(x);
+    *c = std::cos(x);
+}
+
+TEST_SUITE("cogging_model") {
+    TEST_CASE("fit") {
+        const uint32_t map_size = 360;
+        auto map = [](uint32_t i) {
+            float x = 2.0f * (float)M_PI * (float)i / (float)map_size;
+            return 0.1f + 0.05f * std::cos(42.0f * x) - 0.02f * std::sin(84.0f * x) + 0.001f * std::sin(7.0f * x);
+        };
+
+        cogging_model::Harmonic_t harmonics[2];
+        float offset = 0.0f;
+        size_t n = cogging_model::fit(map, map_size, harmonics, 2, &offset);
+        REQUIRE(n == 2);
+        CHECK(offset == doctest::Approx(0.1f).epsilon(1e-3));
+        CHECK(harmonics[0].order == 42);
+        CHECK(harmonics[0].a == doctest::Approx(0.05f).epsilon(1e-3));
+        CHECK(harmonics[0].b == doctest::Approx(0.0f).epsilon(1e-3));
+        CHECK(harmonics[1].order == 84);
+        CHECK(harmonics[1].b == doctest::Approx(-0.02f).epsilon(1e-3));
+
+        // The dropped harmonic is the only error
+        for (uint32_t i = 0; i < map_size; ++i) {
+            float torque = cogging_model::eval(harmonics, n, offset, (float)i / (float)map_size, std_sin_cos);
+            CHECK(std::abs(torque - map(i)) <= 0.0011f);
+        }
+    }
+
+    TEST_CASE("empty map") {
+        cogging_model::Harmonic_t harmonics[2];
+        float offset = 1.0f;
+        CHECK(cogging_model::fit([](uint32_t) { return 0.0f; }, 0, harmonics, 2, &offset) == 0);
+        CHECK(offset == 0.0f);
+    }
+}
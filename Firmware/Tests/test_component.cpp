@@ -0,0 +1,36 @@
+#include <doctest.h>
+
+#include "MotorControl/component.hpp"
+
+TEST_SUITE("component") {
+    TEST_CASE("input port semantics") {
+        InputPort<float> in;
+        CHECK(in.present() == 0.0f);
+        CHECK(in.any() == 0.0f);
+
+        OutputPort<float> out = 1.0f;
+        in.connect_to(&out);
+        CHECK(!in.present().has_value());
+        CHECK(in.any() == 1.0f);
+        out = 2.0f;
+        CHECK(in.present() == 2.0f);
+        out.reset();
+        CHECK(!in.present().has_value());
+        CHECK(in.any() == 2.0f);
+
+        float val = 3.0f;
+        in.connect_to(&val);
+        CHECK(in.present() == 3.0f);
+        val = 4.0f;
+        CHECK(in.any() == 4.0f);
+
+        in.disconnect();
+        CHECK(!in.present().has_value());
+        CHECK(!in.any().has_value());
+
+        in.connect_to((OutputPort<float>*)nullptr);
+        CHECK(!in.present().has_value());
+        in.connect_to((float*)nullptr);
+        CHECK(!in.any().has_value());
+    }
+}
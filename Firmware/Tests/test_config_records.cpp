@@ -0,0 +1,504 @@
+#include <doctest.h>
+
+#include <string.h>
+#include <array>
+#include <vector>
+
+#include "MotorControl/nvm_config.hpp"
+#include "MotorControl/config_field_lists.hpp"
+#include "MotorControl/cogging_model.hpp"
+#include "MotorControl/ripple_model.hpp"
+
+// RAM model of the log in stm32_nvm.c: two sectors of 64-bit fields, appends
+// go to the active sector and a compaction to the other one.
+namespace {
+
+enum FieldState { kErased, kInvalid, kValid, kRetired };
+
+struct FakeSector {
+    std::vector<uint8_t> data;
+    std::vector<FieldState> states;
+    size_t index = 0;
+    size_t log_start = 0;
+};
+
+constexpr size_t kFakeFields = 1024;
+FakeSector fake_sectors[2];
+size_t fake_active = 0;
+size_t fake_staging_sector = 0;
+size_t fake_staging_length = 0; // [fields]
+size_t fake_erase_count = 0;
+
+void fake_erase(FakeSector& sector) {
+    sector.data.assign(kFakeFields * 8, 0xff);
+    sector.states.assign(kFakeFields, kErased);
+    sector.index = 0;
+    sector.log_start = 0;
+    fake_erase_count++;
+}
+
+void fake_reset() {
+    fake_erase(fake_sectors[0]);
+    fake_erase(fake_sectors[1]);
+    fake_active = 0;
+    fake_staging_length = 0;
+    fake_erase_count = 0;
+}
+
+void fake_retire(FakeSector& sector) {
+    if (sector.index + 1 < kFakeFields) {
+        sector.states[sector.index++] = kRetired;
+        sector.log_start = sector.index;
+    } else {
+        fake_erase(sector);
+    }
+}
+
+}
+
+extern "C" {
+
+int NVM_init(void) {
+    fake_staging_length = 0;
+    for (size_t i = 0; i < 2; ++i) {
+        FakeSector& sector = fake_sectors[i];
+        sector.index = kFakeFields;
+        while (sector.index && sector.states[sector.index - 1] == kErased) {
+            sector.index--;
+        }
+        sector.log_start = 0;
+        for (size_t j = 0; j < sector.index; ++j) {
+            if (sector.states[j] == kRetired) {
+                sector.log_start = j + 1;
+            }
+        }
+    }
+    auto active = [](const FakeSector& s) {
+        for (size_t j = s.log_start; j < s.index; ++j) {
+            if (s.states[j] == kValid) return true;
+        }
+        return false;
+    };
+    fake_active = (active(fake_sectors[1]) && !active(fake_sectors[0])) ? 1 : 0;
+    return 0;
+}
+
+size_t NVM_get_read_length(void) {
+    const FakeSector& s = fake_sectors[fake_active];
+    return (s.index - s.log_start) * 8;
+}
+
+bool NVM_is_valid(size_t offset) {
+    const FakeSector& s = fake_sectors[fake_active];
+    size_t index = s.log_start + offset / 8;
+    return index < s.index && s.states[index] == kValid;
+}
+
+int NVM_read(size_t offset, uint8_t* data, size_t length) {
+    if (offset + length > NVM_get_read_length()) {
+        return -1;
+    }
+    const FakeSector& s = fake_sectors[fake_active];
+    memcpy(data, &s.data[s.log_start * 8 + offset], length);
+    return 0;
+}
+
+size_t NVM_get_max_write_length(bool append) {
+    const FakeSector& s = fake_sectors[append ? fake_active : 1 - fake_active];
+    size_t start = append ? s.index : 1;
+    return (kFakeFields - start - 1) * 8;
+}
+
+bool NVM_write_needs_erase(size_t length, bool append) {
+    const FakeSector& target = fake_sectors[1 - fake_active];
+    return !append && (target.index + 1 + (length + 7) / 8 >= kFakeFields
+                       || fake_sectors[fake_active].index + 1 >= kFakeFields);
+}
+
+int NVM_prepare_write(size_t length) {
+    FakeSector& target = fake_sectors[1 - fake_active];
+    if (target.index + 1 + (length + 7) / 8 >= kFakeFields) {
+        fake_erase(target);
+    }
+    return 0;
+}
+
+const uint8_t* NVM_get_staging_area(void) {
+    FakeSector& s = fake_sectors[fake_staging_sector];
+    return &s.data[s.index * 8];
+}
+
+int NVM_start_write(size_t length, bool append) {
+    fake_sectors[fake_staging_sector].index += fake_staging_length;
+    fake_staging_length = 0;
+    fake_staging_sector = append ? fake_active : 1 - fake_active;
+    FakeSector& target = fake_sectors[fake_staging_sector];
+    length = (length + 7) / 8;
+    if (!append) {
+        if (target.index + 1 + length >= kFakeFields) {
+            fake_erase(target);
+        }
+        if (target.log_start < target.index) {
+            fake_retire(target);
+        }
+    }
+    if (target.index + length >= kFakeFields) {
+        return -1;
+    }
+    for (size_t i = 0; i < length; ++i) {
+        target.states[target.index + i] = kInvalid;
+    }
+    fake_staging_length = length;
+    return 0;
+}
+
+int NVM_write(size_t offset, const uint8_t* data, size_t length) {
+    if (offset + length > fake_staging_length * 8) {
+        return -1;
+    }
+    FakeSector& s = fake_sectors[fake_staging_sector];
+    for (size_t i = 0; i < length; ++i) {
+        s.data[s.index * 8 + offset + i] &= data[i]; // flash can only clear bits
+    }
+    return 0;
+}
+
+int NVM_commit(void) {
+    FakeSector& target = fake_sectors[fake_staging_sector];
+    for (size_t i = 0; i < fake_staging_length; ++i) {
+        target.states[target.index + i] = kValid;
+    }
+    if (fake_staging_sector != fake_active) {
+        target.log_start = target.index;
+        fake_retire(fake_sectors[fake_active]);
+        fake_active = fake_staging_sector;
+    }
+    target.index += fake_staging_length;
+    fake_staging_length = 0;
+    return 0;
+}
+
+}
+
+namespace {
+
+struct SmallConfig { uint32_t a = 1; float b = 2.0f; };
+struct LargeConfig { uint8_t table[1000] = {}; };
+
+struct Configs {
+    SmallConfig small;
+    LargeConfig large;
+    SmallConfig other;
+};
+
+bool store(ConfigManager& manager, Configs& c, size_t* size = nullptr) {
+    size_t written = 0;
+    bool ok = manager.prepare_store()
+        && manager.write(&c.small) && manager.write(&c.large) && manager.write(&c.other)
+        && manager.start_store(&written)
+        && manager.write(&c.small) && manager.write(&c.large) && manager.write(&c.other)
+        && manager.finish_store();
+    if (size) *size = written;
+    return ok;
+}
+
+bool load(ConfigManager& manager, Configs& c) {
+    size_t size;
+    return manager.start_load()
+        && manager.read(&c.small) && manager.read(&c.large) && manager.read(&c.other)
+        && manager.finish_load(&size);
+}
+
+// Two firmware versions of a config struct, with field lists like the ones in
+// autogen/config_fields.hpp
+struct ConfigV1 {
+    bool enabled = false;
+    float gain = 1.0f;
+    uint16_t pin = 0;
+    uint8_t mode = 0;
+    float removed = 0.0f;
+};
+
+struct ConfigV1Fields {
+    template<typename TConfig, typename TVisitor>
+    static void visit(TConfig& config, TVisitor&& visitor) {
+        visitor(config_field_tag("enabled:bool"), config.enabled);
+        visitor(config_field_tag("gain:float32"), config.gain);
+        visitor(config_field_tag("pin:uint16"), config.pin);
+        visitor(config_field_tag("mode"), config.mode);
+        visitor(config_field_tag("removed:float32"), config.removed);
+    }
+};
+
+struct ConfigV2 {
+    float added = 5.0f;
+    uint16_t pin = 0;
+    float gain = 1.0f;
+    bool enabled = false;
+    uint32_t mode = 7; // grew
+};
+
+struct ConfigV2Fields {
+    template<typename TConfig, typename TVisitor>
+    static void visit(TConfig& config, TVisitor&& visitor) {
+        visitor(config_field_tag("added:float32"), config.added);
+        visitor(config_field_tag("pin:uint16"), config.pin);
+        visitor(config_field_tag("gain:float32"), config.gain);
+        visitor(config_field_tag("enabled:bool"), config.enabled);
+        visitor(config_field_tag("mode"), config.mode);
+    }
+};
+
+// The members of Controller::Config_t that ControllerConfigFields adds to the
+// generated list
+struct ControllerTablesConfig {
+    struct {
+        std::array<float, 16> pos_gain{};
+        std::array<float, 16> vel_gain{};
+        std::array<float, 16> vel_integrator_gain{};
+    } gain_schedule;
+    struct {
+        float points[256] = {};
+    } cam;
+    struct {
+        cogging_model::Harmonic_t harmonics[cogging_model::MAX_HARMONICS] = {};
+    } anticogging;
+    struct {
+        ripple_model::Harmonic_t harmonics[ripple_model::MAX_HARMONICS] = {};
+    } ripple;
+};
+
+struct NoFields {
+    template<typename TConfig, typename TVisitor>
+    static void visit(TConfig&, TVisitor&&) {}
+};
+
+template<typename TFields, typename T>
+bool store_fields(ConfigManager& manager, T* config, size_t* size = nullptr) {
+    size_t written = 0;
+    bool ok = manager.prepare_store() && manager.write_fields<TFields>(config)
+        && manager.start_store(&written) && manager.write_fields<TFields>(config)
+        && manager.finish_store();
+    if (size) *size = written;
+    return ok;
+}
+
+template<typename TFields, typename T>
+bool load_fields(ConfigManager& manager, T* config) {
+    return manager.start_load() && manager.read_fields<TFields>(config)
+        && manager.finish_load(nullptr);
+}
+
+}
+
+TEST_SUITE("config_records") {
+    TEST_CASE("only changed objects are appended") {
+        fake_reset();
+        ConfigManager manager;
+        Configs c;
+        CHECK(!load(manager, c)); // empty
+
+        size_t size;
+        REQUIRE(store(manager, c, &size));
+        CHECK(size == 8 + 8 + 8 + 1000 + 8 + 8);
+
+        c.other.b = 3.0f;
+        REQUIRE(store(manager, c, &size));
+        CHECK(size == 16);
+        REQUIRE(store(manager, c, &size));
+        CHECK(size == 0); // nothing changed
+
+        Configs loaded;
+        loaded.other.b = 0.0f;
+        ConfigManager reloaded;
+        REQUIRE(load(reloaded, loaded));
+        CHECK(reloaded.n_missing == 0);
+        CHECK(loaded.other.b == 3.0f);
+
+        // The reloaded manager knows what is stored
+        REQUIRE(store(reloaded, loaded, &size));
+        CHECK(size == 0);
+    }
+
+    TEST_CASE("compaction when the sector is full") {
+        fake_reset();
+        ConfigManager manager;
+        Configs c;
+        for (int i = 0; i < 20; ++i) {
+            c.large.table[0] = i;
+            REQUIRE(store(manager, c));
+        }
+        CHECK(fake_erase_count >= 1); // both sectors were filled
+
+        Configs loaded;
+        ConfigManager reloaded;
+        REQUIRE(load(reloaded, loaded));
+        CHECK(loaded.large.table[0] == 19);
+        CHECK(reloaded.n_missing == 0);
+    }
+
+    TEST_CASE("a corrupt record only resets its object") {
+        fake_reset();
+        ConfigManager manager;
+        Configs c;
+        c.small.a = 11;
+        c.other.a = 33;
+        c.large.table[5] = 55;
+        REQUIRE(store(manager, c));
+
+        // Flip a payload bit of the large record
+        fake_sectors[fake_active].data[fake_sectors[fake_active].log_start * 8 + 16 + 8 + 5] ^= 0x01;
+
+        Configs loaded;
+        ConfigManager reloaded;
+        REQUIRE(load(reloaded, loaded));
+        CHECK(reloaded.n_missing == 1);
+        CHECK(loaded.small.a == 11);
+        CHECK(loaded.other.a == 33);
+        CHECK(loaded.large.table[5] == 0); // default
+
+        // The log is corrupt so the next store compacts it
+        size_t size;
+        REQUIRE(store(reloaded, loaded, &size));
+        CHECK(size == 8 + 8 + 8 + 1000 + 8 + 8);
+        ConfigManager again;
+        REQUIRE(load(again, loaded));
+        CHECK(again.n_missing == 0);
+    }
+
+    TEST_CASE("uncommitted records are ignored") {
+        fake_reset();
+        ConfigManager manager;
+        Configs c;
+        REQUIRE(store(manager, c));
+
+        // Store a change but lose power before the commit
+        c.small.a = 99;
+        REQUIRE(manager.prepare_store());
+        manager.write(&c.small); manager.write(&c.large); manager.write(&c.other);
+        REQUIRE(manager.start_store(nullptr));
+        manager.write(&c.small); manager.write(&c.large); manager.write(&c.other);
+
+        Configs loaded;
+        ConfigManager reloaded;
+        REQUIRE(load(reloaded, loaded));
+        CHECK(loaded.small.a == 1);
+        CHECK(reloaded.n_missing == 0);
+    }
+
+    TEST_CASE("field tags match the interface generator") {
+        static_assert(config_field_tag("phase_resistance:float32") == 0xb293, "see calc_crc16() in interface_generator.py");
+    }
+
+    TEST_CASE("fields survive a changed struct") {
+        fake_reset();
+        ConfigManager manager;
+        ConfigV1 v1;
+        v1.enabled = true;
+        v1.gain = 0.25f;
+        v1.pin = 3;
+        v1.mode = 2;
+        size_t size;
+        REQUIRE(store_fields<ConfigV1Fields>(manager, &v1, &size));
+        CHECK(size == 8 + 32); // 5 field headers + 12 bytes
+
+        ConfigV2 v2;
+        ConfigManager reloaded;
+        REQUIRE(load_fields<ConfigV2Fields>(reloaded, &v2));
+        CHECK(reloaded.n_missing == 0);
+        CHECK(v2.enabled == true);
+        CHECK(v2.gain == 0.25f);
+        CHECK(v2.pin == 3);
+        CHECK(v2.added == 5.0f); // not stored
+        CHECK(v2.mode == 7); // size changed
+
+        // The next store drops the removed field
+        REQUIRE(store_fields<ConfigV2Fields>(reloaded, &v2, &size));
+        CHECK(size == 8 + 40); // 5 field headers + 15 bytes, padded
+        ConfigV1 back;
+        ConfigManager again;
+        REQUIRE(load_fields<ConfigV1Fields>(again, &back));
+        CHECK(back.gain == 0.25f);
+        CHECK(back.mode == 0);
+    }
+
+    TEST_CASE("one-to-one copies of the same size load field by field") {
+        fake_reset();
+        ConfigManager manager;
+        ConfigV1 v1;
+        v1.gain = 4.0f;
+        bool stored = manager.prepare_store() && manager.write(&v1) && manager.start_store(nullptr)
+                && manager.write(&v1) && manager.finish_store();
+        REQUIRE(stored);
+
+        ConfigV1 loaded;
+        ConfigManager reloaded;
+        REQUIRE(load_fields<ConfigV1Fields>(reloaded, &loaded));
+        CHECK(loaded.gain == 4.0f);
+
+        // Stored again because the format changed
+        size_t size;
+        REQUIRE(store_fields<ConfigV1Fields>(reloaded, &loaded, &size));
+        CHECK(size == 8 + 32);
+    }
+
+    TEST_CASE("byte strings load into a larger buffer") {
+        fake_reset();
+        ConfigManager manager;
+        uint8_t stored_bytes[100];
+        for (size_t i = 0; i < sizeof(stored_bytes); ++i) {
+            stored_bytes[i] = (uint8_t)i;
+        }
+        bool stored = manager.prepare_store() && manager.write_bytes(stored_bytes, sizeof(stored_bytes))
+                && manager.start_store(nullptr) && manager.write_bytes(stored_bytes, sizeof(stored_bytes))
+                && manager.finish_store();
+        REQUIRE(stored);
+
+        uint8_t buf[200];
+        memset(buf, 0xaa, sizeof(buf));
+        size_t length = 0;
+        ConfigManager reloaded;
+        REQUIRE((reloaded.start_load() && reloaded.read_bytes(buf, sizeof(buf), &length)
+                && reloaded.finish_load(nullptr)));
+        CHECK(length == sizeof(stored_bytes));
+        CHECK(memcmp(buf, stored_bytes, sizeof(stored_bytes)) == 0);
+        CHECK(buf[sizeof(stored_bytes)] == 0xaa);
+
+        // Too large for the buffer: loads nothing
+        uint8_t small[50];
+        ConfigManager too_small;
+        REQUIRE(too_small.start_load());
+        too_small.read_bytes(small, sizeof(small), &length);
+        CHECK(length == 0);
+    }
+
+    TEST_CASE("controller tables survive a save and reload") {
+        fake_reset();
+        ConfigManager manager;
+        ControllerTablesConfig config;
+        for (size_t i = 0; i < 16; ++i) {
+            config.gain_schedule.pos_gain[i] = 1.0f + i;
+            config.gain_schedule.vel_gain[i] = 2.0f + i;
+            config.gain_schedule.vel_integrator_gain[i] = 3.0f + i;
+        }
+        for (size_t i = 0; i < 256; ++i) {
+            config.cam.points[i] = 0.01f * i;
+        }
+        config.anticogging.harmonics[cogging_model::MAX_HARMONICS - 1] = {24, 0.5f, -0.25f};
+        config.ripple.harmonics[0] = {2, 0.1f, 0.2f, 0.3f, 0.4f};
+        REQUIRE(store_fields<ControllerConfigFields<NoFields>>(manager, &config));
+
+        ControllerTablesConfig loaded;
+        ConfigManager reloaded;
+        REQUIRE(load_fields<ControllerConfigFields<NoFields>>(reloaded, &loaded));
+        CHECK(reloaded.n_missing == 0);
+        CHECK(loaded.gain_schedule.pos_gain == config.gain_schedule.pos_gain);
+        CHECK(loaded.gain_schedule.vel_gain == config.gain_schedule.vel_gain);
+        CHECK(loaded.gain_schedule.vel_integrator_gain == config.gain_schedule.vel_integrator_gain);
+        CHECK(memcmp(loaded.cam.points, config.cam.points, sizeof(config.cam.points)) == 0);
+        CHECK(loaded.anticogging.harmonics[cogging_model::MAX_HARMONICS - 1].order == 24);
+        CHECK(loaded.anticogging.harmonics[cogging_model::MAX_HARMONICS - 1].b == -0.25f);
+        CHECK(loaded.ripple.harmonics[0].order == 2);
+        CHECK(loaded.ripple.harmonics[0].b_friction == 0.4f);
+    }
+}
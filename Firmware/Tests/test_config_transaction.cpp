@@ -0,0 +1,58 @@
+#include <doctest.h>
+#include <MotorControl/config_transaction.hpp>
+
+struct Counter {
+    int n = 0;
+    static void inc(void* obj) { static_cast<Counter*>(obj)->n++; }
+    static void inc2(void* obj) { static_cast<Counter*>(obj)->n += 2; }
+};
+
+static void run(ConfigTransaction& transaction) {
+    ConfigTransaction::Entry_t pending[CONFIG_TRANSACTION_SIZE];
+    size_t n = transaction.close(pending);
+    for (size_t i = 0; i < n; ++i) {
+        pending[i].apply(pending[i].obj);
+    }
+}
+
+TEST_CASE("config transaction") {
+    ConfigTransaction transaction;
+    Counter a, b;
+
+    SUBCASE("closed") {
+        CHECK(!transaction.defer(&a, Counter::inc));
+        CHECK(transaction.get_n_pending() == 0);
+    }
+
+    SUBCASE("deduplicates") {
+        transaction.begin();
+        for (int i = 0; i < 10; ++i) {
+            CHECK(transaction.defer(&a, Counter::inc));
+        }
+        CHECK(transaction.defer(&a, Counter::inc2));
+        CHECK(transaction.defer(&b, Counter::inc));
+        CHECK(transaction.get_n_pending() == 3);
+        CHECK(a.n == 0);
+        run(transaction);
+        CHECK(a.n == 3);
+        CHECK(b.n == 1);
+        CHECK(!transaction.is_open());
+        CHECK(!transaction.defer(&a, Counter::inc));
+    }
+
+    SUBCASE("full") {
+        Counter counters[CONFIG_TRANSACTION_SIZE + 1];
+        transaction.begin();
+        for (Counter& c : counters) {
+            if (!transaction.defer(&c, Counter::inc)) {
+                Counter::inc(&c);
+            }
+        }
+        CHECK(counters[CONFIG_TRANSACTION_SIZE].n == 1);
+        CHECK(counters[0].n == 0);
+        run(transaction);
+        for (Counter& c : counters) {
+            CHECK(c.n == 1);
+        }
+    }
+}
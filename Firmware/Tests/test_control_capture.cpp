@@ -0,0 +1,170 @@
+#include <doctest.h>
+#include <cmath>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "MotorControl/utils.hpp"
+#include "MotorControl/control_capture.hpp"
+#include "pmsm_plant.hpp"
+
+TEST_SUITE("control_capture") {
+    constexpr size_t kFrameSize = 63; // TELEMETRY_FRAME_SIZE
+    constexpr size_t kHeaderSize = 6;
+    constexpr size_t kRecordsPerFrame = (kFrameSize - kHeaderSize) / CONTROL_CAPTURE_RECORD_SIZE;
+
+    // Packs the records into frames like Telemetry::update_capture()
+    std::vector<std::vector<uint8_t>> pack(const std::vector<ControlInputRecord_t>& records, uint8_t axis) {
+        std::vector<std::vector<uint8_t>> frames;
+        for (size_t i = 0; i + kRecordsPerFrame <= records.size(); i += kRecordsPerFrame) {
+            std::vector<uint8_t> frame(kHeaderSize + kRecordsPerFrame * CONTROL_CAPTURE_RECORD_SIZE);
+            write_le<uint16_t>(CONTROL_CAPTURE_FRAME_TAG, frame.data());
+            write_le<uint16_t>((uint16_t)frames.size(), frame.data() + 2);
+            frame[4] = axis;
+            frame[5] = (uint8_t)kRecordsPerFrame;
+            for (size_t j = 0; j < kRecordsPerFrame; ++j) {
+                records[i + j].encode(frame.data() + kHeaderSize + j * CONTROL_CAPTURE_RECORD_SIZE);
+            }
+            frames.push_back(frame);
+        }
+        return frames;
+    }
+
+    bool bit_equal(float a, float b) {
+        return std::memcmp(&a, &b, sizeof(float)) == 0;
+    }
+
+    TEST_CASE("records survive the frames bit-exactly") {
+        CHECK(kRecordsPerFrame == 2);
+
+        std::vector<ControlInputRecord_t> records = {
+            {0xfffffff0, 2048, 0, 4095, -32768, -0.0f, NAN, 1e-40f},
+            {0x00000010, 1234, 2047, 2049, 0x7fffffff, 1.5f, -INFINITY, -3.25f},
+        };
+        auto frames = pack(records, 1);
+        REQUIRE(frames.size() == 1);
+
+        ControlCaptureReader reader;
+        std::vector<ControlInputRecord_t> decoded;
+        CHECK(reader.feed(frames[0].data(), frames[0].size(), [&](const ControlInputRecord_t& r, bool) { decoded.push_back(r); }));
+        REQUIRE(decoded.size() == 2);
+        CHECK(reader.axis_ == 1);
+        for (size_t i = 0; i < 2; ++i) {
+            CHECK(decoded[i].timestamp == records[i].timestamp);
+            CHECK(decoded[i].adc_vbus == records[i].adc_vbus);
+            CHECK(decoded[i].adc_phB == records[i].adc_phB);
+            CHECK(decoded[i].adc_phC == records[i].adc_phC);
+            CHECK(decoded[i].encoder_raw == records[i].encoder_raw);
+            CHECK(bit_equal(decoded[i].input_pos, records[i].input_pos));
+            CHECK(bit_equal(decoded[i].input_vel, records[i].input_vel));
+            CHECK(bit_equal(decoded[i].input_torque, records[i].input_torque));
+        }
+
+        // Telemetry frames and truncated frames are not capture frames
+        uint8_t telemetry_frame[kFrameSize] = {0x00, 0xff};
+        CHECK_FALSE(reader.feed(telemetry_frame, sizeof(telemetry_frame), [](const ControlInputRecord_t&, bool) {}));
+        CHECK_FALSE(reader.feed(frames[0].data(), frames[0].size() - 1, [](const ControlInputRecord_t&, bool) {}));
+        CHECK(reader.n_records_ == 2);
+    }
+
+    // Current controller on raw inputs, standing in for the firmware code
+    // that a trace is replayed through. Its outputs only depend on the
+    // sequence of records.
+    struct RawCurrentLoop {
+        static constexpr float adc_to_amps = 0.01f;
+        static constexpr float adc_to_volts = 0.01f;
+        static constexpr float counts_to_rad = 2.0f * (float)M_PI / 8192.0f;
+        static constexpr float gain = 0.05f;
+
+        std::array<float, 3> step(const ControlInputRecord_t& r) {
+            float phB = ((float)r.adc_phB - 2048.0f) * adc_to_amps;
+            float phC = ((float)r.adc_phC - 2048.0f) * adc_to_amps;
+            float I_alpha = -phB - phC;
+            float I_beta = one_by_sqrt3 * (phB - phC);
+            float phase = (float)r.encoder_raw * counts_to_rad;
+            float c = std::cos(phase);
+            float s = std::sin(phase);
+            float Id = c * I_alpha + s * I_beta;
+            float Iq = c * I_beta - s * I_alpha;
+
+            integral_d_ += gain * (0.0f - Id);
+            integral_q_ += gain * (r.input_torque - Iq);
+            float V_to_mod = 1.0f / ((2.0f / 3.0f) * (float)r.adc_vbus * adc_to_volts);
+            float mod_d = std::clamp(V_to_mod * integral_d_, -0.5f, 0.5f);
+            float mod_q = std::clamp(V_to_mod * integral_q_, -0.5f, 0.5f);
+            auto [tA, tB, tC, success] = SVM(c * mod_d - s * mod_q, c * mod_q + s * mod_d);
+            (void)success;
+            return {tA, tB, tC};
+        }
+
+        float integral_d_ = 0.0f;
+        float integral_q_ = 0.0f;
+    };
+
+    TEST_CASE("replaying a trace reproduces the control outputs bit-exactly") {
+        PmsmPlant::Params_t params;
+        params.phase_inductance = 200e-6;
+        PmsmPlant plant(params);
+        RawCurrentLoop live;
+
+        // Record a closed loop run on the plant
+        std::vector<ControlInputRecord_t> trace;
+        std::vector<std::array<float, 3>> outputs;
+        std::array<float, 3> timings = {0.5f, 0.5f, 0.5f};
+        uint32_t timestamp = 0;
+        for (size_t i = 0; i < 400; ++i) {
+            plant.step(timings, 24.0f, 1.0 / 8000.0);
+            auto I = plant.phase_currents();
+            double counts = std::fmod(plant.params().pole_pairs * plant.pos(), 2.0 * M_PI) / (2.0 * M_PI) * 8192.0;
+
+            ControlInputRecord_t r;
+            r.timestamp = timestamp += 21000;
+            r.adc_vbus = (uint16_t)std::lround(24.0f / RawCurrentLoop::adc_to_volts);
+            r.adc_phB = (uint16_t)std::lround(2048.0f + I[1] / RawCurrentLoop::adc_to_amps);
+            r.adc_phC = (uint16_t)std::lround(2048.0f + I[2] / RawCurrentLoop::adc_to_amps);
+            r.encoder_raw = (int32_t)std::floor(counts);
+            r.input_pos = 0.0f;
+            r.input_vel = 0.0f;
+            r.input_torque = i < 200 ? 2.0f : -1.0f;
+            trace.push_back(r);
+
+            timings = live.step(r);
+            outputs.push_back(timings);
+        }
+        REQUIRE(plant.vel() > 0.0);
+
+        auto frames = pack(trace, 0);
+        ControlCaptureReader reader;
+        RawCurrentLoop replay;
+        size_t n = 0;
+        size_t mismatches = 0;
+        for (auto& frame : frames) {
+            reader.feed(frame.data(), frame.size(), [&](const ControlInputRecord_t& r, bool contiguous) {
+                CHECK(contiguous == (n > 0));
+                auto out = replay.step(r);
+                for (size_t k = 0; k < 3; ++k) {
+                    mismatches += bit_equal(out[k], outputs[n][k]) ? 0 : 1;
+                }
+                n++;
+            });
+        }
+        CHECK(n == trace.size());
+        CHECK(mismatches == 0);
+        CHECK(reader.n_gaps_ == 0);
+    }
+
+    TEST_CASE("a dropped frame marks the next record as not contiguous") {
+        std::vector<ControlInputRecord_t> records(8, ControlInputRecord_t{0, 2048, 2048, 2048, 0, 0.0f, 0.0f, 0.0f});
+        auto frames = pack(records, 0);
+        REQUIRE(frames.size() == 4);
+
+        ControlCaptureReader reader;
+        std::vector<bool> contiguous;
+        for (size_t i : {0, 1, 3}) {
+            reader.feed(frames[i].data(), frames[i].size(), [&](const ControlInputRecord_t&, bool c) { contiguous.push_back(c); });
+        }
+        CHECK(contiguous == std::vector<bool>{false, true, true, true, false, true});
+        CHECK(reader.n_gaps_ == 1);
+        CHECK(reader.n_records_ == 6);
+    }
+}
@@ -0,0 +1,43 @@
+#include <doctest.h>
+
+#define FIBRE_CRC_TABLES 1
+#include <fibre/../../crc.hpp>
+#include <fibre/../../legacy_protocol.hpp>
+
+template<typename T, unsigned POLYNOMIAL>
+static T reference_crc(T remainder, const uint8_t* buffer, size_t length) {
+    while (length--)
+        remainder = calc_crc_bitwise<T, POLYNOMIAL>(remainder, *(buffer++));
+    return remainder;
+}
+
+TEST_SUITE("crc") {
+    TEST_CASE("check values") {
+        const uint8_t text[] = "123456789";
+        CHECK(calc_crc8<0x07>(0x00, text, 9) == 0xf4); // CRC-8
+        CHECK(calc_crc16<0x1021>(0xffff, text, 9) == 0x29b1); // CRC-16/CCITT-FALSE
+    }
+
+    TEST_CASE("tables match the bitwise calculation") {
+        uint8_t buffer[64];
+        uint32_t state = 12345;
+        for (size_t i = 0; i < sizeof(buffer); ++i) {
+            state = state * 1103515245 + 12345;
+            buffer[i] = state >> 16;
+        }
+
+        // All alignments of the slice-by-4 loop and the tail
+        for (size_t offset = 0; offset < 4; ++offset) {
+            for (size_t length = 0; length + offset <= sizeof(buffer); ++length) {
+                const uint8_t* data = buffer + offset;
+                CHECK(calc_crc8<fibre::CANONICAL_CRC8_POLYNOMIAL>(fibre::CANONICAL_CRC8_INIT, data, length)
+                      == reference_crc<uint8_t, fibre::CANONICAL_CRC8_POLYNOMIAL>(fibre::CANONICAL_CRC8_INIT, data, length));
+                CHECK(calc_crc16<fibre::CANONICAL_CRC16_POLYNOMIAL>(fibre::CANONICAL_CRC16_INIT, data, length)
+                      == reference_crc<uint16_t, fibre::CANONICAL_CRC16_POLYNOMIAL>(fibre::CANONICAL_CRC16_INIT, data, length));
+            }
+        }
+
+        CHECK(calc_crc16<fibre::CANONICAL_CRC16_POLYNOMIAL>(0x1234, buffer[7])
+              == calc_crc_bitwise<uint16_t, fibre::CANONICAL_CRC16_POLYNOMIAL>(0x1234, buffer[7]));
+    }
+}
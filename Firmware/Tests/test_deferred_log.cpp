@@ -0,0 +1,85 @@
+#include <doctest.h>
+#include <string>
+
+#include "communication/deferred_log.hpp"
+
+namespace {
+
+template<size_t I>
+struct FakeSink {
+    static constexpr size_t capacity = I - 1;
+    size_t get_free_space() const { return capacity - pending.size(); }
+    void write(fibre::cbufptr_t buf) { pending.append((const char*)buf.begin(), buf.size()); }
+    void maybe_start_async_write() {}
+    // Simulates the completion of the stream writes
+    void flush() { out += pending; pending.clear(); }
+    std::string pending;
+    std::string out;
+};
+
+}
+
+TEST_SUITE("deferred_log") {
+    TEST_CASE("formats later") {
+        static DeferredLog log;
+        DeferredLog::Reader reader;
+        FakeSink<128> sink;
+
+        int counter = -3;
+        log.log("a=%d b=%.2f c=%u %s\r\n", counter, 1.5f, 7u, "ok");
+        counter = 42; // the value at the time of the call is logged
+        log.write_text("plain text that is longer than one entry\r\n", 42);
+        log.log("no args\r\n");
+
+        log.drain(&reader, sink);
+        sink.flush();
+        CHECK(sink.out == "a=-3 b=1.50 c=7 ok\r\nplain text that is longer than one entry\r\nno args\r\n");
+        CHECK(reader.index == log.head());
+    }
+
+    TEST_CASE("waits for space") {
+        static DeferredLog log;
+        DeferredLog::Reader reader;
+        FakeSink<16> sink;
+
+        log.log("%d\r\n", 123456789);
+        log.log("%d\r\n", 987654321);
+        log.drain(&reader, sink);
+        CHECK(sink.pending == "123456789\r\n");
+        sink.flush();
+        log.drain(&reader, sink);
+        sink.flush();
+        CHECK(sink.out == "123456789\r\n987654321\r\n");
+
+        // Longer than the sink: truncated instead of blocking forever
+        log.log("%s", "0123456789abcdefghij");
+        log.drain(&reader, sink);
+        sink.flush();
+        CHECK(sink.out == "123456789\r\n987654321\r\n0123456789abcde");
+    }
+
+    TEST_CASE("readers are independent and report overruns") {
+        static DeferredLog log;
+        DeferredLog::Reader fast, slow;
+        FakeSink<128> fast_sink, slow_sink;
+
+        for (unsigned i = 0; i < DEFERRED_LOG_SIZE + 5; ++i) {
+            log.log("%u\n", i);
+            log.drain(&fast, fast_sink);
+            fast_sink.flush();
+        }
+        CHECK(fast.index == DEFERRED_LOG_SIZE + 5);
+
+        slow_sink.pending.reserve(128);
+        log.drain(&slow, slow_sink);
+        CHECK(slow_sink.pending.rfind("[5 log messages dropped]\r\n5\n6\n", 0) == 0);
+        for (int i = 0; i < 10 && slow.index != log.head(); ++i) {
+            slow_sink.flush();
+            log.drain(&slow, slow_sink);
+        }
+        slow_sink.flush();
+        CHECK(slow.index == log.head());
+        CHECK(slow_sink.out.size() > 20);
+        CHECK(slow_sink.out.substr(slow_sink.out.size() - 3) == "68\n");
+    }
+}
@@ -0,0 +1,93 @@
+#include <doctest.h>
+#include <initializer_list>
+
+#include "MotorControl/disturbance_observer.hpp"
+
+// Rigid body with Coulomb and viscous friction
+struct Plant {
+    float inertia = 0.01f;
+    float coulomb = 0.05f;
+    float viscous = 0.02f;
+    float vel = 0.0f;
+
+    void step(float torque, float load, float dt) {
+        float friction = (vel > 0.0f ? coulomb : vel < 0.0f ? -coulomb : 0.0f) + viscous * vel;
+        vel += dt * (torque + load - friction) / inertia;
+    }
+};
+
+TEST_SUITE("disturbance_observer") {
+    const float dt = 1.0f / 8000.0f;
+
+    TEST_CASE("observer converges to a load step") {
+        Plant plant;
+        plant.coulomb = plant.viscous = 0.0f;
+        DisturbanceObserver dob;
+        dob.reset(0.0f, plant.inertia, 200.0f);
+        float torque = 0.1f;
+        for (size_t i = 0; i < 800; ++i) { // 20 time constants
+            plant.step(torque, -0.3f, dt);
+            dob.update(plant.vel, torque, plant.inertia, 200.0f, dt);
+        }
+        CHECK(dob.estimate_ == doctest::Approx(-0.3f).epsilon(0.01));
+    }
+
+    // Velocity PI loop with friction feedforward and the observer composed as
+    // in Controller::update(): the observer is fed the torque without the
+    // feedforward, so in steady state neither it nor the integrator has to
+    // take back friction that the feedforward already cancels.
+    TEST_CASE("friction feedforward is not compensated twice") {
+        for (float model_share : {1.0f, 0.5f}) {
+            CAPTURE(model_share);
+            Plant plant;
+            DisturbanceObserver dob;
+            dob.reset(0.0f, plant.inertia, 200.0f);
+            const float vel_des = 2.0f;
+            float model_ff = model_share * (plant.coulomb + plant.viscous * vel_des);
+            float torque = 0.0f;
+            float integrator = 0.0f;
+            for (size_t i = 0; i < 16000; ++i) { // 2s
+                plant.step(torque, 0.0f, dt);
+                dob.update(plant.vel, torque - model_ff, plant.inertia, 200.0f, dt);
+                float v_err = vel_des - plant.vel;
+                integrator += 20.0f * dt * v_err;
+                torque = 2.0f * v_err + integrator + model_ff - dob.estimate_;
+            }
+            float friction = plant.coulomb + plant.viscous * vel_des;
+            CHECK(plant.vel == doctest::Approx(vel_des).epsilon(0.001));
+            CHECK(torque == doctest::Approx(friction).epsilon(0.001));
+            CHECK(-dob.estimate_ == doctest::Approx(friction - model_ff).epsilon(0.01));
+            CHECK(integrator == doctest::Approx(0.0f).epsilon(0.001));
+        }
+    }
+
+    TEST_CASE("identification") {
+        Plant plant;
+        InertiaFrictionId id;
+        REQUIRE(id.start());
+        float torque = 0.0f;
+        float integrator = 0.0f;
+        InertiaFrictionId::Setpoint_t sp = {0.0f, 0.0f};
+        size_t n = 0;
+        while (id.active) {
+            plant.step(torque, 0.0f, dt);
+            sp = id.step(plant.vel, torque, dt);
+            // PI velocity loop as in the controller, without feedforward
+            float v_err = sp.vel - plant.vel;
+            integrator += 20.0f * dt * v_err;
+            torque = 2.0f * v_err + integrator;
+            REQUIRE(++n < 200000);
+        }
+        REQUIRE(id.valid);
+        CHECK(id.inertia == doctest::Approx(plant.inertia).epsilon(0.05));
+        CHECK(id.coulomb == doctest::Approx(plant.coulomb).epsilon(0.05));
+        CHECK(id.viscous == doctest::Approx(plant.viscous).epsilon(0.05));
+    }
+
+    TEST_CASE("identification rejects invalid parameters") {
+        InertiaFrictionId id;
+        id.vel = 0.0f;
+        CHECK(!id.start());
+        CHECK(!id.active);
+    }
+}
@@ -0,0 +1,51 @@
+#include <doctest.h>
+
+#include "MotorControl/event_log.hpp"
+
+TEST_SUITE("event_log") {
+    TEST_CASE("ring buffer") {
+        static EventLog log;
+        log.reset();
+        CHECK(log.is_valid());
+        EventLog::Entry_t entry;
+        CHECK(!log.read(0, &entry));
+
+        for (uint32_t i = 0; i < EVENT_LOG_SIZE + 10; ++i) {
+            log.push(100 + i, 3, i);
+        }
+        CHECK(log.head() == EVENT_LOG_SIZE + 10);
+        CHECK(!log.read(9, &entry));
+        REQUIRE(log.read(10, &entry));
+        CHECK(entry.cycles == 110);
+        CHECK(entry.source == 3);
+        CHECK(entry.code == 10);
+        REQUIRE(log.read(EVENT_LOG_SIZE + 9, &entry));
+        CHECK(entry.code == EVENT_LOG_SIZE + 9);
+        CHECK(!log.read(EVENT_LOG_SIZE + 10, &entry));
+    }
+
+    TEST_CASE("error tracking") {
+        static EventLog log;
+        log.reset();
+        EventLog::Entry_t entry;
+
+        log.track(1, 2, 0x1);
+        log.track(2, 2, 0x1); // unchanged
+        log.track(3, 2, 0x5); // new bit 0x4
+        log.track(4, 5, 0x1); // other source
+        CHECK(log.head() == 3);
+        REQUIRE(log.read(1, &entry));
+        CHECK(entry.code == 0x4);
+        CHECK(entry.cycles == 3);
+
+        log.track(5, 2, 0x0); // cleared
+        log.track(6, 2, 0x1);
+        REQUIRE(log.read(3, &entry));
+        CHECK(entry.code == 0x1);
+        CHECK(entry.cycles == 6);
+
+        log.reset_sources();
+        log.track(7, 5, 0x1);
+        CHECK(log.head() == 5);
+    }
+}
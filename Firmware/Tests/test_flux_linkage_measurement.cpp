@@ -0,0 +1,41 @@
+#include <doctest.h>
+#include <cmath>
+#include <initializer_list>
+
+#include "MotorControl/flux_linkage_measurement.hpp"
+
+TEST_SUITE("flux_linkage_measurement") {
+    TEST_CASE("lock-in spin") {
+        const float dt = 125e-6f;
+        const float R = 0.1f;
+        const float L = 50e-6f;
+        const float flux = 2e-3f;
+        const float current = 5.0f;
+        const float load_angle = 0.4f; // rotor lags the current vector
+
+        for (float w : {400.0f, -1200.0f}) {
+            FluxLinkageMeasurement meas;
+            meas.reset();
+            CHECK(std::isnan(meas.result(R, L)));
+
+            auto current_at = [&](float t, float* Ia, float* Ib) {
+                *Ia = current * std::cos(w * t);
+                *Ib = current * std::sin(w * t);
+            };
+            for (size_t k = 0; k < 4000; ++k) {
+                // Voltage of the interval before measurement k
+                float t_mid = ((float)k - 0.5f) * dt;
+                float Ia, Ib;
+                current_at(t_mid, &Ia, &Ib);
+                float rotor = w * t_mid - std::copysign(load_angle, w);
+                float Va = R * Ia - w * L * Ib - w * flux * std::sin(rotor);
+                float Vb = R * Ib + w * L * Ia + w * flux * std::cos(rotor);
+
+                current_at((float)k * dt, &Ia, &Ib);
+                meas.add_sample(Va, Vb, Ia, Ib, w);
+            }
+            CHECK(meas.n_samples() == 3999);
+            CHECK(meas.result(R, L) == doctest::Approx(flux).epsilon(0.01));
+        }
+    }
+}
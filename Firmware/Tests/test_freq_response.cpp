@@ -0,0 +1,54 @@
+#include <doctest.h>
+#include <complex>
+
+#include "MotorControl/freq_response.hpp"
+
+static void std_sin_cos(float x, float* s, float* c) {
+    *s = std::sin(x);
+    *c = std::cos(x);
+}
+
+TEST_SUITE("freq_response") {
+    TEST_CASE("first order lowpass") {
+        const float dt = 0.000125f;
+        const float a = 0.05f; // y[n] = y[n-1] + a * (x[n] - y[n-1])
+
+        FrequencyResponse fr;
+        fr.f_min = 10.0f;
+        fr.f_max = 1000.0f;
+        fr.n_points = 5;
+        fr.amplitude = 0.5f;
+        fr.settle_periods = 50.0f; // the time constant is 20 samples
+        REQUIRE(fr.start(dt));
+
+        float y = 0.0f;
+        for (size_t i = 0; i < 1000000 && fr.active; ++i) {
+            float x = fr.step(y, std_sin_cos);
+            y += a * (x - y);
+        }
+        REQUIRE(fr.n_done == 5);
+
+        for (size_t i = 0; i < fr.n_done; ++i) {
+            float w = 2.0f * (float)M_PI * fr.points_[i].frequency * dt;
+            std::complex<float> z = std::exp(std::complex<float>(0.0f, w));
+            std::complex<float> h = a / (1.0f - (1.0f - a) / z);
+            CHECK(fr.points_[i].gain == doctest::Approx(std::abs(h)).epsilon(0.02));
+            CHECK(fr.points_[i].phase == doctest::Approx(std::arg(h)).epsilon(0.02).scale(0.02));
+        }
+        CHECK(fr.points_[0].frequency == doctest::Approx(10.0f));
+        CHECK(fr.points_[4].frequency == doctest::Approx(1000.0f));
+    }
+
+    TEST_CASE("invalid parameters") {
+        FrequencyResponse fr;
+        fr.amplitude = 1.0f;
+        fr.f_max = 3000.0f;
+        CHECK_FALSE(fr.start(0.000125f)); // above a quarter of the sample rate
+        fr.f_max = 100.0f;
+        fr.n_points = 0;
+        CHECK_FALSE(fr.start(0.000125f));
+        fr.n_points = FrequencyResponse::MAX_POINTS + 1;
+        CHECK_FALSE(fr.start(0.000125f));
+        CHECK_FALSE(fr.active);
+    }
+}
@@ -0,0 +1,115 @@
+#include <doctest.h>
+#include <cmath>
+
+#include "MotorControl/hall_calibration.hpp"
+
+// Hall sensors at the given electrical angles [rad], each either normal or
+// inverted. Turns the rotor `turns` times in 1000 steps per turn.
+static void spin(HallCalibration* calib, std::array<float, 3> angles, uint8_t inverted, float turns) {
+    calib->reset();
+    int n = (int)(turns * 1000.0f);
+    for (int i = 0; i <= n; i++) {
+        float phase = 2.0f * (float)M_PI * turns * (float)i / (float)n;
+        uint8_t state = 0;
+        for (size_t k = 0; k < 3; k++) {
+            if (std::sin(phase - angles[k]) > 0.0f)
+                state |= 1 << k;
+        }
+        CHECK(calib->add_sample(state ^ inverted, phase));
+    }
+}
+
+TEST_SUITE("hall_calibration") {
+    constexpr float deg = (float)M_PI / 180.0f;
+
+    TEST_CASE("120 degrees") {
+        HallCalibration calib;
+        spin(&calib, {0.0f, 120.0f * deg, 240.0f * deg}, 0b000, 5.0f);
+
+        uint8_t polarity;
+        std::array<float, 6> edges;
+        int32_t direction;
+        REQUIRE(calib.get_edges(&polarity, &edges, &direction) == HallCalibration::kOk);
+        CHECK(polarity == 0b000);
+        for (size_t i = 0; i < 6; i++) {
+            CHECK(edges[i] == doctest::Approx((float)i).epsilon(0.01));
+        }
+    }
+
+    TEST_CASE("60 degrees") {
+        // The middle sensor of a 60 degree arrangement is an inverted sensor
+        // at 240 degrees
+        HallCalibration calib;
+        spin(&calib, {0.0f, 60.0f * deg, 120.0f * deg}, 0b000, 5.0f);
+
+        uint8_t polarity;
+        std::array<float, 6> edges;
+        int32_t direction;
+        REQUIRE(calib.get_edges(&polarity, &edges, &direction) == HallCalibration::kOk);
+        CHECK(polarity == 0b010);
+    }
+
+    TEST_CASE("inverted and reversed") {
+        HallCalibration calib;
+        spin(&calib, {0.0f, 240.0f * deg, 120.0f * deg}, 0b111, 5.0f);
+
+        uint8_t polarity;
+        REQUIRE(calib.get_polarity(&polarity) == HallCalibration::kOk);
+        std::array<float, 6> edges;
+        int32_t direction;
+        REQUIRE(calib.get_edges(&polarity, &edges, &direction) == HallCalibration::kOk);
+        CHECK(direction == -1);
+        for (size_t i = 0; i < 6; i++) {
+            CHECK(edges[i] == doctest::Approx((float)i).epsilon(0.01));
+        }
+    }
+
+    TEST_CASE("misplaced sensor") {
+        // A sensor that is off by 10 degrees moves its two edges by 1/6 count
+        HallCalibration calib;
+        spin(&calib, {0.0f, 130.0f * deg, 240.0f * deg}, 0b000, 5.0f);
+
+        uint8_t polarity;
+        std::array<float, 6> edges;
+        int32_t direction;
+        REQUIRE(calib.get_edges(&polarity, &edges, &direction) == HallCalibration::kOk);
+        float moved = 0.0f;
+        for (size_t i = 0; i < 6; i++) {
+            moved += std::abs(edges[i] - (float)i);
+        }
+        CHECK(moved == doctest::Approx(2.0f / 6.0f).epsilon(0.05));
+    }
+
+    TEST_CASE("missing edge") {
+        // The rotor swings back and forth over five edges but never passes
+        // the sixth, so all states but no full turn are seen
+        const uint8_t sequence[] = {0b001, 0b011, 0b010, 0b110, 0b100, 0b101};
+        HallCalibration calib;
+        calib.reset();
+        for (int swing = 0; swing < 20; swing++) {
+            for (int i = 0; i < 60; i++) {
+                int idx = (swing % 2) ? 5 - i / 10 : i / 10;
+                CHECK(calib.add_sample(sequence[idx], (float)M_PI / 3.0f * (float)idx));
+            }
+        }
+
+        uint8_t polarity;
+        std::array<float, 6> edges;
+        int32_t direction;
+        CHECK(calib.get_polarity(&polarity) == HallCalibration::kOk);
+        CHECK(calib.get_edges(&polarity, &edges, &direction) == HallCalibration::kEdgesInconsistent);
+    }
+
+    TEST_CASE("illegal states") {
+        // Less than a turn misses states
+        HallCalibration calib;
+        spin(&calib, {0.0f, 120.0f * deg, 240.0f * deg}, 0b000, 0.5f);
+        uint8_t polarity;
+        CHECK(calib.get_polarity(&polarity) == HallCalibration::kIllegalState);
+
+        // Two sensors that change at once
+        calib.reset();
+        CHECK(calib.add_sample(0b001, 0.0f));
+        CHECK(!calib.add_sample(0b010, 0.0f));
+    }
+}
@@ -0,0 +1,95 @@
+#include <doctest.h>
+#include <cmath>
+#include <initializer_list>
+
+#include "MotorControl/hfi_demodulator.hpp"
+
+// Salient motor at standstill in the stationary frame
+struct SalientMotor {
+    float Ld, Lq, theta;
+    float Ialpha = 0.0f, Ibeta = 0.0f;
+
+    void apply(float Valpha, float Vbeta, float dt) {
+        float c = std::cos(theta), s = std::sin(theta);
+        float Vd = c * Valpha + s * Vbeta;
+        float Vq = c * Vbeta - s * Valpha;
+        float dId = dt * Vd / Ld;
+        float dIq = dt * Vq / Lq;
+        Ialpha += c * dId - s * dIq;
+        Ibeta += s * dId + c * dIq;
+    }
+};
+
+TEST_SUITE("hfi_demodulator") {
+    const float dt = 125e-6f;
+    const float Ld = 100e-6f;
+    const float Lq = 150e-6f;
+    const float inv_L_diff = 0.5f * (1.0f / Ld - 1.0f / Lq);
+
+    TEST_CASE("angle error") {
+        for (float err : {-0.6f, -0.2f, 0.0f, 0.1f, 0.5f}) {
+            SalientMotor motor{Ld, Lq, 1.0f};
+            float phase = motor.theta - err;
+            HfiDemodulator demod;
+            demod.reset();
+            HfiDemodulator::Output_t out;
+            bool valid = false;
+            float sign = 1.0f;
+            for (size_t i = 0; i < 10; ++i) {
+                // Square wave on the estimated d-axis plus a constant
+                // fundamental voltage that must not affect the result
+                float Valpha = sign * std::cos(phase) + 0.1f;
+                float Vbeta = sign * std::sin(phase) - 0.05f;
+                motor.apply(Valpha, Vbeta, dt);
+                valid = demod.update(motor.Ialpha, motor.Ibeta, Valpha, Vbeta,
+                                     phase, inv_L_diff, 1.0f, dt, &out);
+                sign = -sign;
+            }
+            REQUIRE(valid);
+            CHECK(out.angle_error == doctest::Approx(0.5f * std::sin(2.0f * err)).epsilon(0.01));
+            if (err == 0.0f) {
+                CHECK(out.admittance == doctest::Approx(dt / Ld).epsilon(0.01));
+            }
+        }
+    }
+
+    TEST_CASE("no output without injection") {
+        SalientMotor motor{Ld, Lq, 0.3f};
+        HfiDemodulator demod;
+        demod.reset();
+        HfiDemodulator::Output_t out;
+        for (size_t i = 0; i < 10; ++i) {
+            motor.apply(0.2f, 0.1f, dt);
+            CHECK_FALSE(demod.update(motor.Ialpha, motor.Ibeta, 0.2f, 0.1f,
+                                     0.0f, inv_L_diff, 0.5f, dt, &out));
+        }
+    }
+
+    TEST_CASE("tracking") {
+        SalientMotor motor{Ld, Lq, 2.0f};
+        HfiDemodulator demod;
+        demod.reset();
+        float pll_kp = 2.0f * 200.0f;
+        float pll_ki = 0.25f * pll_kp * pll_kp;
+        float phase = 1.5f;
+        float phase_vel = 0.0f;
+        float sign = 1.0f;
+        for (size_t i = 0; i < 8000; ++i) {
+            motor.theta += dt * 5.0f; // slow rotation
+            float Valpha = sign * std::cos(phase);
+            float Vbeta = sign * std::sin(phase);
+            motor.apply(Valpha, Vbeta, dt);
+            HfiDemodulator::Output_t out;
+            float err = 0.0f;
+            if (demod.update(motor.Ialpha, motor.Ibeta, Valpha, Vbeta,
+                             phase, inv_L_diff, 1.0f, dt, &out)) {
+                err = out.angle_error;
+            }
+            phase += dt * (phase_vel + pll_kp * err);
+            phase_vel += dt * pll_ki * err;
+            sign = -sign;
+        }
+        CHECK(std::remainder(motor.theta - phase, (float)M_PI) == doctest::Approx(0.0f).epsilon(0.01));
+        CHECK(phase_vel == doctest::Approx(5.0f).epsilon(0.05));
+    }
+}
@@ -0,0 +1,76 @@
+#include <doctest.h>
+#include <algorithm>
+
+#include "MotorControl/input_shaper.hpp"
+
+// Peak to peak residual vibration of a damped oscillator at f following a
+// unit step of the reference after the shaper has finished
+static float residual_vibration(InputShaper& shaper, float f, float zeta, float dt) {
+    const float wn = 2.0f * (float)M_PI * f / std::sqrt(1.0f - zeta * zeta);
+    float x = 0.0f, v = 0.0f;
+    shaper.reset({0.0f, 0.0f, 0.0f});
+    size_t settle = (size_t)(shaper.duration(dt) / dt) + 1;
+    float lo = INFINITY, hi = -INFINITY;
+    for (size_t i = 0; i < settle + (size_t)(2.0f / (f * dt)); ++i) {
+        float u = shaper.shape({1.0f, 0.0f, 0.0f}).pos;
+        float a = wn * wn * (u - x) - 2.0f * zeta * wn * v;
+        v += a * dt;
+        x += v * dt;
+        if (i > settle) {
+            lo = std::min(lo, x);
+            hi = std::max(hi, x);
+        }
+    }
+    return hi - lo;
+}
+
+TEST_SUITE("input_shaper") {
+    const float dt = 1.0f / 8000.0f;
+
+    TEST_CASE("invalid parameters") {
+        InputShaper shaper;
+        CHECK(!shaper.configure(1, 10.0f, 0.05f, dt));
+        CHECK(!shaper.configure(2, 0.0f, 0.05f, dt));
+        CHECK(!shaper.configure(2, 10.0f, 1.0f, dt));
+        CHECK(!shaper.enabled());
+        InputShaper::Sample_t out = shaper.shape({1.0f, 2.0f, 3.0f});
+        CHECK(out.pos == 1.0f);
+        CHECK(out.vel == 2.0f);
+        CHECK(out.torque == 3.0f);
+    }
+
+    TEST_CASE("unity gain and duration") {
+        InputShaper shaper;
+        REQUIRE(shaper.configure(3, 10.0f, 0.0f, dt));
+        CHECK(shaper.duration(dt) == doctest::Approx(0.1f));
+        shaper.reset({0.0f, 0.0f, 0.0f});
+        InputShaper::Sample_t out = {};
+        for (size_t i = 0; i < 1000; ++i) {
+            out = shaper.shape({1.0f, 0.5f, 0.25f});
+        }
+        CHECK(out.pos == doctest::Approx(1.0f));
+        CHECK(out.vel == doctest::Approx(0.5f));
+        CHECK(out.torque == doctest::Approx(0.25f));
+    }
+
+    TEST_CASE("cancels the resonance") {
+        for (float f : {10.0f, 1.0f}) { // 1 Hz needs a decimated history
+            const float zeta = 0.05f;
+            InputShaper shaper;
+            float unshaped = residual_vibration(shaper, f, zeta, dt);
+            REQUIRE(shaper.configure(2, f, zeta, dt));
+            float zv = residual_vibration(shaper, f, zeta, dt);
+            REQUIRE(shaper.configure(3, f, zeta, dt));
+            float zvd = residual_vibration(shaper, f, zeta, dt);
+            CHECK(zv < 0.02f * unshaped);
+            CHECK(zvd < 0.02f * unshaped);
+
+            // ZVD tolerates a 10% frequency error much better than ZV
+            REQUIRE(shaper.configure(2, 1.1f * f, zeta, dt));
+            float zv_err = residual_vibration(shaper, f, zeta, dt);
+            REQUIRE(shaper.configure(3, 1.1f * f, zeta, dt));
+            float zvd_err = residual_vibration(shaper, f, zeta, dt);
+            CHECK(zvd_err < 0.5f * zv_err);
+        }
+    }
+}
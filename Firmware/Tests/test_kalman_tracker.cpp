@@ -0,0 +1,78 @@
+#include <doctest.h>
+#include <cmath>
+#include <algorithm>
+#include <initializer_list>
+
+#include "MotorControl/kalman_tracker.hpp"
+
+TEST_SUITE("kalman_tracker") {
+    const float dt = 1.0f / 8000.0f;
+    const float cpr = 8192.0f;
+
+    // Runs the filter like Encoder::update_estimates() on a quantized
+    // position that accelerates at accel [turn/s^2]. known_accel is the part
+    // of it passed as the input. Returns the largest velocity error [turn/s]
+    // after settle_time.
+    float track(const KalmanTrackerGains& gains, float accel, float known_accel, float settle_time) {
+        double true_pos = 0.0, true_vel = 0.0;
+        float pos = 0.0f, vel = 0.0f, load_accel = 0.0f;
+        float max_err = 0.0f;
+        for (size_t i = 0; i < 8000; ++i) {
+            true_pos += true_vel * dt + 0.5 * accel * dt * dt * cpr;
+            true_vel += accel * dt * cpr;
+
+            float a = known_accel * cpr + load_accel;
+            pos += dt * vel + 0.5f * dt * dt * a;
+            vel += dt * a;
+            float residual = (float)std::floor(true_pos) - std::floor(pos);
+            pos += gains.pos * residual;
+            vel += gains.vel * residual;
+            load_accel += gains.acc * residual;
+
+            if ((float)i * dt >= settle_time) {
+                max_err = std::max(max_err, std::abs(vel - (float)true_vel) / cpr);
+            }
+        }
+        return max_err;
+    }
+
+    TEST_CASE("gains") {
+        KalmanTrackerGains low, high;
+        REQUIRE(compute_kalman_tracker_gains(100.0f * cpr, 0.3f, dt, &low));
+        REQUIRE(compute_kalman_tracker_gains(10000.0f * cpr, 0.3f, dt, &high));
+        CHECK(low.pos > 0.0f);
+        CHECK(low.pos < high.pos);
+        CHECK(low.vel < high.vel);
+        CHECK(low.acc < high.acc);
+        CHECK(high.pos < 1.0f);
+
+        // Steady-state alpha-beta-gamma filters satisfy gamma = beta^2 / (2 alpha)
+        for (auto& g : {low, high}) {
+            float alpha = g.pos, beta = g.vel * dt, gamma = g.acc * dt * dt;
+            CHECK(gamma == doctest::Approx(beta * beta / (2.0f * alpha)).epsilon(1e-2));
+        }
+
+        // Only the ratio of the noises matters
+        KalmanTrackerGains scaled;
+        REQUIRE(compute_kalman_tracker_gains(200.0f * cpr, 0.6f, dt, &scaled));
+        CHECK(scaled.pos == doctest::Approx(low.pos).epsilon(1e-3));
+
+        CHECK_FALSE(compute_kalman_tracker_gains(0.0f, 0.3f, dt, &scaled));
+        CHECK_FALSE(compute_kalman_tracker_gains(100.0f, 0.0f, dt, &scaled));
+        CHECK_FALSE(compute_kalman_tracker_gains(100.0f, 0.3f, 0.0f, &scaled));
+    }
+
+    TEST_CASE("the torque input removes the lag during accelerations") {
+        KalmanTrackerGains gains;
+        REQUIRE(compute_kalman_tracker_gains(400.0f * cpr, 0.3f, dt, &gains));
+
+        // Known acceleration: no transient, only quantization noise
+        float err_known = track(gains, 200.0f, 200.0f, 0.0f);
+        // Unknown: the load acceleration state takes a while to pick it up
+        float err_unknown_transient = track(gains, 200.0f, 0.0f, 0.0f);
+        float err_unknown_settled = track(gains, 200.0f, 0.0f, 0.2f);
+        CHECK(err_known < 0.5f * err_unknown_transient);
+        CHECK(err_unknown_settled < 0.5f * err_unknown_transient);
+        CHECK(err_known < 0.5f);
+    }
+}
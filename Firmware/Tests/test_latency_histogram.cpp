@@ -0,0 +1,59 @@
+#include <doctest.h>
+#include "MotorControl/latency_histogram.hpp"
+
+TEST_SUITE("latency_histogram") {
+    TEST_CASE("bucket bounds") {
+        for (uint32_t val = 0; val < (1 << 16); ++val) {
+            size_t bucket = LatencyHistogram::bucket_of(val);
+            REQUIRE(bucket < LatencyHistogram::N_BUCKETS);
+            CHECK(val <= LatencyHistogram::bucket_upper_bound(bucket));
+            if (bucket > 0) {
+                CHECK(val > LatencyHistogram::bucket_upper_bound(bucket - 1));
+            }
+        }
+        CHECK(LatencyHistogram::bucket_of(0xffffffff) == LatencyHistogram::N_BUCKETS - 1);
+    }
+
+    TEST_CASE("percentiles") {
+        LatencyHistogram hist;
+        CHECK(hist.get_percentile(0.5f) == 0);
+
+        for (int i = 0; i < 990; ++i) {
+            hist.record(1000);
+        }
+        for (int i = 0; i < 9; ++i) {
+            hist.record(5000);
+        }
+        hist.record(20000);
+
+        // Resolution is 1/4 of an octave
+        CHECK(hist.get_percentile(0.5f) >= 1000);
+        CHECK(hist.get_percentile(0.5f) < 1250);
+        CHECK(hist.get_percentile(0.99f) >= 5000);
+        CHECK(hist.get_percentile(0.99f) < 6250);
+        CHECK(hist.get_percentile(0.999f) >= 20000);
+        CHECK(hist.get_percentile(0.999f) < 25000);
+        CHECK(hist.get_percentile(1.0f) >= 20000);
+
+        hist.reset();
+        CHECK(hist.n_samples_ == 0);
+        CHECK(hist.get_percentile(0.99f) == 0);
+    }
+
+    TEST_CASE("latency stats") {
+        LatencyStats stats;
+        for (uint32_t val : {22, 21, 400, 23}) {
+            stats.record(val);
+        }
+        CHECK(stats.last_ == 23);
+        CHECK(stats.min_ == 21);
+        CHECK(stats.max_ == 400);
+        CHECK(stats.get_n_samples() == 4);
+        CHECK(stats.get_percentile(1.0f) >= 400);
+
+        stats.reset();
+        CHECK(stats.min_ == UINT32_MAX);
+        CHECK(stats.max_ == 0);
+        CHECK(stats.get_n_samples() == 0);
+    }
+}
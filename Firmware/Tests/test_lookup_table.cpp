@@ -0,0 +1,41 @@
+#include <doctest.h>
+
+#include "MotorControl/lookup_table.hpp"
+
+TEST_SUITE("lookup_table") {
+    TEST_CASE("bilinear") {
+        // f(x, y) = x + 10 * y is reproduced exactly
+        const size_t nx = 3, ny = 4;
+        const float x_max = 2.0f, y_max = 30.0f;
+        float table[nx * ny];
+        for (size_t ix = 0; ix < nx; ++ix) {
+            for (size_t iy = 0; iy < ny; ++iy) {
+                table[ix * ny + iy] = x_max * (float)ix / (float)(nx - 1) + 10.0f * y_max * (float)iy / (float)(ny - 1);
+            }
+        }
+        CHECK(interp2d(table, ny, nx, ny, x_max, y_max, 0.0f, 0.0f) == doctest::Approx(0.0f));
+        CHECK(interp2d(table, ny, nx, ny, x_max, y_max, 1.3f, 17.0f) == doctest::Approx(171.3f));
+        CHECK(interp2d(table, ny, nx, ny, x_max, y_max, 2.0f, 30.0f) == doctest::Approx(302.0f));
+        // Clamped outside of the range
+        CHECK(interp2d(table, ny, nx, ny, x_max, y_max, 5.0f, -3.0f) == doctest::Approx(2.0f));
+    }
+
+    TEST_CASE("single row or column") {
+        float row[3] = {1.0f, 2.0f, 4.0f};
+        CHECK(interp2d(row, 3, 1, 3, 1.0f, 2.0f, 0.7f, 1.5f) == doctest::Approx(3.0f));
+        CHECK(interp2d(row, 1, 3, 1, 2.0f, 1.0f, 0.5f, 0.3f) == doctest::Approx(1.5f));
+        // A 2x2 corner of a table with 3 columns
+        float wide[6] = {0.0f, 1.0f, 100.0f, 2.0f, 3.0f, 100.0f};
+        CHECK(interp2d(wide, 3, 2, 2, 1.0f, 1.0f, 0.5f, 0.5f) == doctest::Approx(1.5f));
+        float one = 7.0f;
+        CHECK(interp2d(&one, 1, 1, 1, 1.0f, 1.0f, 0.5f, 0.5f) == doctest::Approx(7.0f));
+    }
+
+    TEST_CASE("1d") {
+        float table[4] = {10.0f, 8.0f, 5.0f, 4.0f};
+        CHECK(interp1d(table, 4, 30.0f, 0.0f) == doctest::Approx(10.0f));
+        CHECK(interp1d(table, 4, 30.0f, 15.0f) == doctest::Approx(6.5f));
+        CHECK(interp1d(table, 4, 30.0f, 45.0f) == doctest::Approx(4.0f));
+        CHECK(interp1d(table, 1, 30.0f, 15.0f) == doctest::Approx(10.0f));
+    }
+}
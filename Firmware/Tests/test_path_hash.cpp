@@ -0,0 +1,23 @@
+#include <doctest.h>
+#include <cstring>
+
+#include <fibre/../../protocol.hpp>
+#include <fibre/introspection.hpp>
+
+TEST_SUITE("path_hash") {
+    // The property path hash table in the autogenerated endpoints.hpp is built
+    // with the Python versions of these functions in interface_generator.py.
+    // These values come from there.
+    TEST_CASE("matches interface_generator.py") {
+        struct { const char* path; uint32_t hash; uint32_t mixed; } cases[] = {
+            {"", 0x811c9dc5, 0xab3e7c0b},
+            {"vbus_voltage", 0x48742e0c, 0x6f64c6d0},
+            {"axis0.controller.config.vel_limit", 0x75b9c1c7, 0x1e56e192},
+        };
+        for (auto& c : cases) {
+            CAPTURE(c.path);
+            CHECK(fibre::hash_path(c.path, strlen(c.path)) == c.hash);
+            CHECK(fibre::mix_hash(c.hash) == c.mixed);
+        }
+    }
+}
@@ -0,0 +1,55 @@
+#include <doctest.h>
+#include <cmath>
+
+#include "MotorControl/phase_current_reconstruction.hpp"
+
+TEST_SUITE("phase_current_reconstruction") {
+    const float truth[3] = {3.0f, -1.0f, -2.0f};
+    const float min_window = 0.1f;
+
+    TEST_CASE("two shunts, both clean") {
+        std::optional<float> measured[3] = {std::nullopt, truth[1], truth[2]};
+        float windows[3] = {0.05f, 0.5f, 0.6f};
+        float predicted[3] = {0.0f, 0.0f, 0.0f};
+        float out[3];
+        CHECK(reconstruct_phase_currents(measured, windows, min_window, predicted, out) == 2);
+        CHECK(out[0] == doctest::Approx(truth[0]));
+        CHECK(out[1] == truth[1]);
+        CHECK(out[2] == truth[2]);
+    }
+
+    TEST_CASE("three shunts pick the longest windows") {
+        // Phase C is corrupted by its short window
+        std::optional<float> measured[3] = {truth[0], truth[1], 10.0f};
+        float windows[3] = {0.4f, 0.3f, 0.12f};
+        float predicted[3] = {0.0f, 0.0f, 0.0f};
+        float out[3];
+        CHECK(reconstruct_phase_currents(measured, windows, min_window, predicted, out) == 2);
+        CHECK(out[0] == truth[0]);
+        CHECK(out[1] == truth[1]);
+        CHECK(out[2] == doctest::Approx(truth[2]));
+    }
+
+    TEST_CASE("one clean shunt falls back to the prediction") {
+        std::optional<float> measured[3] = {std::nullopt, 50.0f, truth[2]};
+        float windows[3] = {0.9f, 0.02f, 0.5f};
+        // The prediction is off by 0.2 A on both phases
+        float predicted[3] = {truth[0] + 0.2f, truth[1] - 0.2f, 0.0f};
+        float out[3];
+        CHECK(reconstruct_phase_currents(measured, windows, min_window, predicted, out) == 1);
+        CHECK(out[2] == truth[2]);
+        CHECK(out[0] + out[1] + out[2] == doctest::Approx(0.0f));
+        CHECK(out[0] == doctest::Approx(truth[0] + 0.2f));
+        CHECK(out[1] == doctest::Approx(truth[1] - 0.2f));
+    }
+
+    TEST_CASE("no clean shunt") {
+        std::optional<float> measured[3] = {std::nullopt, truth[1], truth[2]};
+        float windows[3] = {0.5f, 0.05f, 0.05f};
+        float predicted[3] = {3.3f, -1.0f, -2.0f};
+        float out[3];
+        CHECK(reconstruct_phase_currents(measured, windows, min_window, predicted, out) == 0);
+        CHECK(out[0] + out[1] + out[2] == doctest::Approx(0.0f));
+        CHECK(out[0] == doctest::Approx(3.2f));
+    }
+}
@@ -0,0 +1,116 @@
+#include <doctest.h>
+#include <cmath>
+
+#include "MotorControl/utils.hpp"
+#include "pmsm_plant.hpp"
+
+TEST_SUITE("pmsm_plant") {
+    constexpr double dt = 1.0 / 8000.0; // control loop period
+    constexpr float vbus = 24.0f;
+
+    // dq current PI with the gains of Motor::update_current_controller_gains()
+    // and the one period output delay of the firmware, modulated by SVM().
+    // The back EMF is fed forward like with motor.config.bEMF_FF_enable,
+    // otherwise the PI lags behind it while the rotor accelerates.
+    struct CurrentLoop {
+        CurrentLoop(PmsmPlant& plant, float bandwidth) : plant_(plant) {
+            p_gain_ = bandwidth * (float)plant.params().phase_inductance;
+            i_gain_ = p_gain_ * (float)(plant.params().phase_resistance / plant.params().phase_inductance);
+        }
+
+        void run(float Id_setpoint, float Iq_setpoint, size_t n) {
+            for (size_t i = 0; i < n; ++i) {
+                // The timings computed in the previous period are in effect
+                // while the next measurement is taken
+                plant_.step(timings_, vbus, dt);
+
+                auto I = plant_.phase_currents();
+                float I_alpha = I[0];
+                float I_beta = one_by_sqrt3 * (I[1] - I[2]);
+                float phase = (float)plant_.electrical_phase();
+                float c = std::cos(phase);
+                float s = std::sin(phase);
+                float Id = c * I_alpha + s * I_beta;
+                float Iq = c * I_beta - s * I_alpha;
+
+                float phase_vel = (float)(plant_.params().pole_pairs * plant_.vel());
+                float bemf = phase_vel * (float)plant_.params().flux_linkage;
+                float Vd = integral_d_ + p_gain_ * (Id_setpoint - Id);
+                float Vq = bemf + integral_q_ + p_gain_ * (Iq_setpoint - Iq);
+                integral_d_ += i_gain_ * (float)dt * (Id_setpoint - Id);
+                integral_q_ += i_gain_ * (float)dt * (Iq_setpoint - Iq);
+
+                float V_to_mod = 1.0f / ((2.0f / 3.0f) * vbus);
+                float mod_d = V_to_mod * Vd;
+                float mod_q = V_to_mod * Vq;
+                // Rotate to the middle of the period in which it is applied
+                float pwm_phase = phase + 1.5f * (float)dt * phase_vel;
+                float c_p = std::cos(pwm_phase);
+                float s_p = std::sin(pwm_phase);
+                auto [tA, tB, tC, success] = SVM(c_p * mod_d - s_p * mod_q, c_p * mod_q + s_p * mod_d);
+                REQUIRE(success);
+                timings_ = {tA, tB, tC};
+            }
+        }
+
+        PmsmPlant& plant_;
+        float p_gain_;
+        float i_gain_;
+        float integral_d_ = 0.0f;
+        float integral_q_ = 0.0f;
+        std::array<float, 3> timings_ = {0.5f, 0.5f, 0.5f};
+    };
+
+    TEST_CASE("standstill current follows ohms law") {
+        PmsmPlant::Params_t params;
+        params.inertia = 1e9; // locked rotor
+        PmsmPlant plant(params);
+
+        // 0.1 V along alpha (d at zero phase), see the SVM() scaling
+        float mod_alpha = 0.1f / ((2.0f / 3.0f) * vbus);
+        auto [tA, tB, tC, success] = SVM(mod_alpha, 0.0f);
+        REQUIRE(success);
+        for (size_t i = 0; i < 100; ++i) {
+            plant.step({tA, tB, tC}, vbus, dt);
+        }
+        CHECK(plant.Id() == doctest::Approx(0.1 / params.phase_resistance).epsilon(1e-4));
+        CHECK(plant.Iq() == doctest::Approx(0.0).epsilon(1e-6));
+
+        auto I = plant.phase_currents();
+        CHECK(I[0] + I[1] + I[2] == doctest::Approx(0.0f).epsilon(1e-5));
+    }
+
+    TEST_CASE("current loop tracks a step and the torque accelerates the inertia") {
+        PmsmPlant::Params_t params;
+        PmsmPlant plant(params);
+        CurrentLoop loop(plant, 1000.0f);
+
+        // About 5 time constants of the closed loop
+        loop.run(0.0f, 5.0f, 40);
+        CHECK(plant.Iq() == doctest::Approx(5.0).epsilon(0.02));
+        CHECK(std::abs(plant.Id()) < 0.1);
+
+        double vel_before = plant.vel();
+        double t_before = plant.time();
+        loop.run(0.0f, 5.0f, 400);
+        double accel = (plant.vel() - vel_before) / (plant.time() - t_before);
+        double torque = 1.5 * params.pole_pairs * params.flux_linkage * 5.0;
+        CHECK(accel == doctest::Approx(torque / params.inertia).epsilon(0.02));
+        // The residual error is the cross coupling of the axes, which isn't
+        // decoupled
+        CHECK(plant.Iq() == doctest::Approx(5.0).epsilon(0.05));
+    }
+
+    TEST_CASE("balanced load torque stops the acceleration") {
+        PmsmPlant::Params_t params;
+        PmsmPlant plant(params);
+        CurrentLoop loop(plant, 1000.0f);
+
+        float Iq = 2.0f;
+        plant.load_torque_ = 1.5 * params.pole_pairs * params.flux_linkage * Iq;
+        loop.run(0.0f, Iq, 80); // the rotor turns backwards until Iq settled
+        double vel_settled = plant.vel();
+        loop.run(0.0f, Iq, 4000);
+        CHECK(plant.vel() == doctest::Approx(vel_settled).epsilon(0.02));
+    }
+}
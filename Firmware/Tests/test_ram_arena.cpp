@@ -0,0 +1,41 @@
+#include <doctest.h>
+
+#include "MotorControl/ram_arena.hpp"
+
+TEST_SUITE("ram_arena") {
+    TEST_CASE("slices are aligned and consecutive") {
+        alignas(8) uint8_t storage[100];
+        RamArena arena(storage, sizeof(storage));
+
+        CHECK(arena.allocate(3, 1) == storage);
+        CHECK(arena.allocate(8, 4) == storage + 4);
+        CHECK(arena.used() == 12);
+        CHECK(arena.allocate(0, 8) == storage + 16);
+
+        // Doesn't fit: nothing is taken
+        CHECK(arena.allocate(85, 1) == nullptr);
+        CHECK(arena.used() == 16);
+        CHECK(arena.allocate(84, 1) == storage + 16);
+        CHECK(arena.available() == 0);
+
+        arena.reset();
+        CHECK(arena.allocate(100, 4) == storage);
+    }
+
+    TEST_CASE("allocate_up_to hands out the rest") {
+        alignas(8) uint8_t storage[100];
+        RamArena arena(storage, sizeof(storage));
+        size_t granted = 0;
+
+        CHECK(arena.allocate_up_to(10, 4, &granted) == storage);
+        CHECK(granted == 10);
+
+        // 88 bytes are left from offset 12, 80 of them in whole 16 byte units
+        CHECK(arena.allocate_up_to(1000, 16, &granted) == storage + 16);
+        CHECK(granted == 80);
+        CHECK(arena.available() == 4);
+
+        CHECK(arena.allocate_up_to(8, 8, &granted) == nullptr);
+        CHECK(granted == 0);
+    }
+}
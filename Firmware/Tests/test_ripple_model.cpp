@@ -0,0 +1,97 @@
+#include <doctest.h>
+#include <initializer_list>
+
+#include "MotorControl/ripple_model.hpp"
+
+static void std_sin_cos(float x, float* s, float* c) {
+    *s = std::sin(x);
+    *c = std::cos(x);
+}
+
+TEST_SUITE("ripple_model") {
+    TEST_CASE("recurrence matches direct evaluation") {
+        ripple_model::Harmonic_t harmonics[] = {
+            {1, 0.1f, -0.2f, 0.0f, 0.0f},
+            {2, 0.0f, 0.05f, 0.01f, 0.0f},
+            {50, 0.03f, 0.0f, 0.0f, -0.02f},
+            {101, -0.01f, 0.02f, 0.005f, 0.005f},
+            {1000, 0.002f, 0.001f, 0.0f, 0.0f},
+        };
+        const size_t n = sizeof(harmonics) / sizeof(harmonics[0]);
+        for (float dir : {-1.0f, 0.0f, 1.0f}) {
+            for (uint32_t i = 0; i < 997; ++i) {
+                float pos_frac = (float)i / 997.0f;
+                double expected = (dir > 0.0f) ? 0.3 : (dir < 0.0f) ? -0.25 : 0.0;
+                for (auto& h : harmonics) {
+                    double x = 2.0 * M_PI * (double)h.order * (double)pos_frac;
+                    expected += h.a * std::cos(x) + h.b * std::sin(x) + dir * (h.a_friction * std::cos(x) + h.b_friction * std::sin(x));
+                }
+                float torque = ripple_model::eval(harmonics, n, 0.3f, -0.25f, pos_frac, dir, std_sin_cos);
+                INFO("pos_frac = " << pos_frac << ", dir = " << dir);
+                CHECK(std::abs(torque - expected) < 1e-4);
+            }
+        }
+    }
+
+    TEST_CASE("identification of a simulated transmission") {
+        const float period = 2.0f; // [turn]
+        ripple_model::Harmonic_t truth[] = {
+            {3, 0.05f, -0.02f, 0.01f, 0.0f},
+            {40, 0.0f, 0.03f, -0.005f, 0.015f},
+        };
+        auto load_torque = [&](float pos, float vel) {
+            float pos_frac = pos / period - std::floor(pos / period);
+            float dir = (vel > 0.0f) ? 1.0f : -1.0f;
+            return ripple_model::eval(truth, 2, 0.2f, -0.15f, pos_frac, dir, std_sin_cos);
+        };
+
+        // The orders are given, the coefficients are found
+        ripple_model::Harmonic_t orders[] = {{3, 0, 0, 0, 0}, {40, 0, 0, 0, 0}, {7, 0, 0, 0, 0}};
+        ripple_model::RippleId id;
+        id.vel = 0.5f;
+        REQUIRE(id.start(orders, 3, period, 0.3f));
+
+        // Ideal position tracking: the torque of each cycle is the load at
+        // the position it was computed for
+        const float dt = 1.0f / 8000.0f;
+        float pos = 0.3f;
+        float vel = 0.0f;
+        float torque = 0.0f;
+        size_t n_steps = 0;
+        while (id.active && n_steps++ < 200000) {
+            auto setpoint = id.step(pos, torque, dt, std_sin_cos);
+            torque = load_torque(pos, setpoint.vel != 0.0f ? setpoint.vel : vel);
+            vel = setpoint.vel;
+            pos = setpoint.pos;
+        }
+        REQUIRE(id.valid);
+        CHECK(id.count() == 3);
+
+        CHECK(id.coulomb_pos == doctest::Approx(0.2f).epsilon(1e-2));
+        CHECK(id.coulomb_neg == doctest::Approx(-0.15f).epsilon(1e-2));
+        const ripple_model::Harmonic_t* h = id.harmonics();
+        for (size_t i = 0; i < 2; ++i) {
+            INFO("order " << h[i].order);
+            CHECK(h[i].order == truth[i].order);
+            CHECK(std::abs(h[i].a - truth[i].a) < 1e-3f);
+            CHECK(std::abs(h[i].b - truth[i].b) < 1e-3f);
+            CHECK(std::abs(h[i].a_friction - truth[i].a_friction) < 1e-3f);
+            CHECK(std::abs(h[i].b_friction - truth[i].b_friction) < 1e-3f);
+        }
+        CHECK(h[2].order == 7);
+        CHECK(std::abs(h[2].a) < 1e-3f);
+        CHECK(std::abs(h[2].b) < 1e-3f);
+        CHECK(std::abs(h[2].a_friction) < 1e-3f);
+        CHECK(std::abs(h[2].b_friction) < 1e-3f);
+    }
+
+    TEST_CASE("invalid parameters") {
+        ripple_model::Harmonic_t orders[] = {{1, 0, 0, 0, 0}};
+        ripple_model::RippleId id;
+        CHECK_FALSE(id.start(orders, 0, 1.0f, 0.0f));
+        CHECK_FALSE(id.start(orders, 1, 0.0f, 0.0f));
+        id.vel = 0.0f;
+        CHECK_FALSE(id.start(orders, 1, 1.0f, 0.0f));
+        CHECK_FALSE(id.active);
+    }
+}
@@ -0,0 +1,82 @@
+#include <doctest.h>
+#include <cmath>
+#include <random>
+
+#include "MotorControl/rl_identification.hpp"
+
+TEST_SUITE("rl_identification") {
+    TEST_CASE("prbs7 period") {
+        Prbs7 prbs;
+        float first[127];
+        float sum = 0.0f;
+        for (size_t i = 0; i < 127; ++i) {
+            first[i] = prbs.next();
+            sum += first[i];
+        }
+        CHECK(sum == 1.0f); // 64 ones and 63 zeros
+        for (size_t i = 0; i < 127; ++i) {
+            CHECK(prbs.next() == first[i]);
+        }
+    }
+
+    // Winding with an inverter drop, biased to a positive current and excited
+    // by a PRBS that flips when the current deviates too far
+    static void simulate(RLIdentification& id, float R, float L, float noise, size_t n) {
+        const float dt = 125e-6f;
+        const float bias = 10.0f;
+        const float drop = 0.3f;
+        const float amplitude = 0.5f;
+        std::mt19937 gen(0);
+        std::uniform_real_distribution<float> dist(-noise, noise);
+        Prbs7 prbs;
+
+        float a = std::exp(-R * dt / L);
+        float I = bias;
+        id.reset();
+        float V = 0.0f;
+        for (size_t k = 0; k < n; ++k) {
+            I = a * I + (1.0f - a) / R * (V - drop);
+            float I_meas = I + dist(gen);
+            id.add_sample(I_meas, V);
+
+            float excitation = prbs.next();
+            if (I_meas - bias > 2.0f) {
+                excitation = -1.0f;
+            } else if (I_meas - bias < -2.0f) {
+                excitation = 1.0f;
+            }
+            V = R * bias + drop + amplitude * excitation;
+        }
+        REQUIRE(id.fit(dt));
+    }
+
+    TEST_CASE("fit") {
+        RLIdentification id;
+        simulate(id, 0.05f, 20e-6f, 0.0f, 1000);
+        CHECK(id.resistance == doctest::Approx(0.05f).epsilon(0.01));
+        CHECK(id.inductance == doctest::Approx(20e-6f).epsilon(0.01));
+        CHECK(id.quality > 0.999f);
+
+        simulate(id, 0.5f, 500e-6f, 0.0f, 2000);
+        CHECK(id.resistance == doctest::Approx(0.5f).epsilon(0.02));
+        CHECK(id.inductance == doctest::Approx(500e-6f).epsilon(0.01));
+    }
+
+    TEST_CASE("noise") {
+        RLIdentification id;
+        simulate(id, 0.05f, 20e-6f, 0.05f, 2000);
+        CHECK(id.resistance == doctest::Approx(0.05f).epsilon(0.1));
+        CHECK(id.inductance == doctest::Approx(20e-6f).epsilon(0.05));
+        CHECK(id.quality > 0.95f);
+        CHECK(id.quality < 1.0f);
+    }
+
+    TEST_CASE("no excitation") {
+        RLIdentification id;
+        id.reset();
+        for (size_t k = 0; k < 100; ++k) {
+            id.add_sample(1.0f, 0.5f);
+        }
+        CHECK(!id.fit(125e-6f));
+    }
+}
@@ -0,0 +1,123 @@
+#include <doctest.h>
+
+#include "MotorControl/serial_abs_frame.hpp"
+#include <utility>
+
+// Writes the n_bits LSBs of val into the bit stream at position *pos
+static void put_bits(uint16_t* words, size_t* pos, uint64_t val, size_t n_bits) {
+    for (size_t i = n_bits; i > 0; --i, ++*pos) {
+        if ((val >> (i - 1)) & 1) {
+            words[*pos / 16] |= (1 << (15 - (*pos % 16)));
+        } else {
+            words[*pos / 16] &= ~(1 << (15 - (*pos % 16)));
+        }
+    }
+}
+
+static void make_biss_c_frame(uint16_t* words, size_t n_ack_bits, uint64_t data, size_t n_data_bits, bool error) {
+    size_t pos = 0;
+    put_bits(words, &pos, 1, 1); // idle
+    put_bits(words, &pos, 0, n_ack_bits);
+    put_bits(words, &pos, 0b10, 2); // start, CDS
+    uint64_t payload = (data << 2) | (error ? 0b01 : 0b11);
+    put_bits(words, &pos, payload, n_data_bits + 2);
+    put_bits(words, &pos, ~serial_abs::biss_crc6(payload, n_data_bits + 2), 6);
+}
+
+TEST_SUITE("serial_abs_frame") {
+    TEST_CASE("crc6") {
+        CHECK(serial_abs::biss_crc6(0, 26) == 0);
+        CHECK(serial_abs::biss_crc6(1, 1) == 0x03);
+        // every single bit error is detected
+        uint64_t payload = 0x2a5a5a7;
+        uint8_t crc = serial_abs::biss_crc6(payload, 26);
+        for (size_t i = 0; i < 26; ++i) {
+            CHECK(serial_abs::biss_crc6(payload ^ (1ull << i), 26) != crc);
+        }
+    }
+
+    TEST_CASE("biss-c") {
+        const size_t n_data_bits = 24;
+        const size_t n_words = serial_abs::biss_c_frame_words(n_data_bits);
+        uint16_t words[4] = {0};
+        REQUIRE(n_words <= 4);
+        uint64_t data = 0;
+
+        for (size_t n_ack_bits = 1; n_ack_bits <= serial_abs::BISS_MAX_ACK_BITS; ++n_ack_bits) {
+            make_biss_c_frame(words, n_ack_bits, 0xabcdef, n_data_bits, false);
+            CHECK(serial_abs::decode_biss_c(words, n_words, n_data_bits, &data));
+            CHECK(data == 0xabcdef);
+        }
+
+        make_biss_c_frame(words, 2, 0x123456, n_data_bits, true);
+        CHECK_FALSE(serial_abs::decode_biss_c(words, n_words, n_data_bits, &data));
+
+        make_biss_c_frame(words, 2, 0x123456, n_data_bits, false);
+        words[1] ^= 0x0100;
+        CHECK_FALSE(serial_abs::decode_biss_c(words, n_words, n_data_bits, &data));
+
+        uint16_t idle[4] = {0xffff, 0xffff, 0xffff, 0xffff};
+        CHECK_FALSE(serial_abs::decode_biss_c(idle, n_words, n_data_bits, &data));
+        uint16_t low[4] = {0};
+        CHECK_FALSE(serial_abs::decode_biss_c(low, n_words, n_data_bits, &data));
+    }
+
+    TEST_CASE("ssi") {
+        uint16_t words[2] = {0};
+        size_t pos = 0;
+        put_bits(words, &pos, 1, 1);
+        put_bits(words, &pos, 0x1234, 13);
+        uint64_t data = 0;
+        CHECK(serial_abs::decode_ssi(words, 1, 13, false, &data));
+        CHECK(data == (0x1234 & 0x1fff));
+
+        // Gray code 0b1101 is binary 0b1001
+        pos = 0;
+        put_bits(words, &pos, 1, 1);
+        put_bits(words, &pos, 0b1101, 4);
+        CHECK(serial_abs::decode_ssi(words, 1, 4, true, &data));
+        CHECK(data == 0b1001);
+
+        words[0] = 0;
+        CHECK_FALSE(serial_abs::decode_ssi(words, 1, 4, false, &data));
+        CHECK_FALSE(serial_abs::decode_ssi(words, 1, 16, false, &data));
+    }
+
+    // Straightforward checks of each format, as the encoder used to decode them
+    static bool parity(uint16_t v) {
+        bool p = false;
+        for (; v; v >>= 1) {
+            p ^= v & 1;
+        }
+        return p;
+    }
+
+    static bool reference_decode(char format, uint16_t v, int32_t* pos) {
+        switch (format) {
+            case 'A': *pos = v & 0x3fff; return !parity(v) && !((v >> 14) & 1);
+            case 'C': *pos = v & 0x3fff; return parity(v & 0x5555) && parity(v & 0xaaaa);
+            case 'R': *pos = (v >> 2) & 0x3fff; return (v >> 1) & 1;
+            default: *pos = (v >> 2) & 0x3fff; return true;
+        }
+    }
+
+    TEST_CASE("16-bit words") {
+        const std::pair<char, serial_abs::WordFormat> formats[] = {
+            {'A', serial_abs::AMS_WORD_FORMAT},
+            {'C', serial_abs::CUI_WORD_FORMAT},
+            {'R', serial_abs::RLS_WORD_FORMAT},
+            {'M', serial_abs::MA732_WORD_FORMAT},
+        };
+        for (auto& [name, format] : formats) {
+            size_t mismatches = 0;
+            for (uint32_t v = 0; v <= 0xffff; ++v) {
+                int32_t expected_pos = -1, pos = -1;
+                bool expected = reference_decode(name, (uint16_t)v, &expected_pos);
+                bool valid = serial_abs::decode_word(format, (uint16_t)v, &pos);
+                mismatches += (valid != expected || (valid && pos != expected_pos)) ? 1 : 0;
+            }
+            INFO("format " << name);
+            CHECK(mismatches == 0);
+        }
+    }
+}
@@ -0,0 +1,97 @@
+#include <doctest.h>
+
+#include "MotorControl/snapshot.hpp"
+
+// Payload whose copy invokes a hook part way through, which lets the test
+// emulate the writer interrupt preempting a reader in the middle of a copy.
+struct Payload {
+    static void (*on_copy)();
+
+    Payload() = default;
+    Payload(const Payload& other) : a(other.a) {
+        if (on_copy) {
+            on_copy();
+        }
+        b = other.b;
+    }
+    Payload& operator=(const Payload& other) = default;
+
+    int a = 0;
+    int b = 0;
+};
+
+void (*Payload::on_copy)() = nullptr;
+
+static Snapshot<Payload> snapshot;
+static int n_preemptions = 0;
+
+static void preempt() {
+    if (n_preemptions > 0) {
+        n_preemptions--;
+        Payload val;
+        val.a = 100 + n_preemptions;
+        val.b = 100 + n_preemptions;
+        Payload::on_copy = nullptr;
+        snapshot.publish(val);
+        Payload::on_copy = preempt;
+    }
+}
+
+TEST_SUITE("snapshot") {
+    TEST_CASE("publish and read") {
+        Snapshot<Payload> s;
+        CHECK(s.read().a == 0);
+        CHECK(s.get_n_published() == 0);
+
+        Payload val;
+        val.a = 1;
+        val.b = 2;
+        s.publish(val);
+        CHECK(s.read().a == 1);
+        CHECK(s.read().b == 2);
+        CHECK(s.get_n_published() == 1);
+    }
+
+    TEST_CASE("read retries when preempted by the writer") {
+        Payload val;
+        val.a = 1;
+        val.b = 1;
+        snapshot.publish(val);
+
+        n_preemptions = 3;
+        Payload::on_copy = preempt;
+        Payload result = snapshot.read();
+        Payload::on_copy = nullptr;
+
+        // The reader must not return a mix of the old and new values
+        CHECK(result.a == result.b);
+        CHECK(result.a == 100);
+        CHECK(n_preemptions == 0);
+        CHECK(snapshot.get_n_published() == 4);
+    }
+
+    TEST_CASE("try_read fails instead of retrying") {
+        Payload val;
+        val.a = 5;
+        val.b = 5;
+        snapshot.publish(val);
+        uint32_t n = snapshot.get_n_published();
+
+        Payload result;
+        uint32_t n_published = 0;
+        CHECK(snapshot.try_read(result, n_published));
+        CHECK(result.a == 5);
+        CHECK(n_published == n);
+
+        n_preemptions = 1;
+        Payload::on_copy = preempt;
+        result = {};
+        bool ok = snapshot.try_read(result, n_published);
+        Payload::on_copy = nullptr;
+        CHECK(!ok);
+        CHECK(result.a == 0); // left untouched
+        CHECK(snapshot.try_read(result, n_published));
+        CHECK(result.a == 100);
+        CHECK(n_published == n + 1);
+    }
+}
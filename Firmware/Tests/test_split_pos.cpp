@@ -0,0 +1,64 @@
+#include <doctest.h>
+#include <cmath>
+
+#include "MotorControl/split_pos.hpp"
+
+TEST_SUITE("split_pos") {
+    TEST_CASE("normalization") {
+        SplitPos p = SplitPos::from_float(-2.25f);
+        CHECK(p.turns == -3);
+        CHECK(p.frac == 0.75f);
+        CHECK(p.to_float() == -2.25f);
+
+        p += 0.5f;
+        CHECK(p.turns == -2);
+        CHECK(p.frac == 0.25f);
+        p -= 10.0f;
+        CHECK(p.turns == -12);
+        CHECK(p.frac == 0.25f);
+
+        // A tiny negative fraction rounds to 1.0f in float
+        SplitPos q;
+        q += -1e-9f;
+        CHECK(q.frac >= 0.0f);
+        CHECK(q.frac < 1.0f);
+
+        SplitPos r;
+        r += NAN;
+        CHECK(std::isnan(r.to_float()));
+    }
+
+    TEST_CASE("increments keep their resolution far away from zero") {
+        const float step = 1e-5f; // e.g. 0.08 turn/s at 8 kHz
+        SplitPos split;
+        split.turns = 100000;
+        float flat = split.to_float();
+        for (size_t i = 0; i < 1000; ++i) {
+            split += step;
+            flat += step;
+        }
+        // The float doesn't move at all, the split position does
+        CHECK(flat == 100000.0f);
+        CHECK(split.turns == 100000);
+        CHECK(split.frac == doctest::Approx(1000 * step).epsilon(1e-3));
+
+        SplitPos origin;
+        origin.turns = 100000;
+        CHECK((split - origin) == doctest::Approx(1000 * step).epsilon(1e-3));
+        CHECK((origin - split) == doctest::Approx(-1000 * step).epsilon(1e-3));
+    }
+
+    TEST_CASE("difference across a turn boundary") {
+        SplitPos a;
+        a.turns = (int64_t)1 << 40;
+        a.frac = 0.99f;
+        SplitPos b = a + 0.02f;
+        CHECK(b.turns == a.turns + 1);
+        CHECK((b - a) == doctest::Approx(0.02f).epsilon(1e-3));
+
+        // Far differences saturate instead of wrapping
+        SplitPos c;
+        CHECK((a - c) > 1e9f);
+        CHECK((c - a) < -1e9f);
+    }
+}
@@ -0,0 +1,64 @@
+#include <doctest.h>
+#include <cmath>
+
+#include "MotorControl/step_interpolator.hpp"
+
+TEST_SUITE("step_interpolator") {
+    const float dt = 1.0f / 8000.0f;
+
+    TEST_CASE("starts at the count") {
+        StepInterpolator interp;
+        interp.update(-1000000007, 200.0f, dt);
+        CHECK(interp.base() == -1000000007);
+        CHECK(interp.frac() == 0.0f);
+        CHECK(interp.vel() == 0.0f);
+    }
+
+    TEST_CASE("constant step rate") {
+        // 1 kHz, a step every 8 iterations
+        StepInterpolator interp;
+        const float rate = 1000.0f;
+        int64_t start = 5000000000LL;
+        float max_jump = 0.0f;
+        float max_error = 0.0f;
+        double last = (double)start;
+        for (int i = 0; i < 16000; ++i) {
+            int64_t steps = start + (int64_t)(i * dt * rate);
+            interp.update(steps, 200.0f, dt);
+            double pos = (double)interp.base() + interp.frac();
+            if (i > 8000) {
+                // Within a step of the count and advancing smoothly
+                max_error = std::max(max_error, (float)std::abs(pos - (double)start - i * dt * rate));
+                max_jump = std::max(max_jump, (float)std::abs(pos - last - dt * rate));
+                CHECK(interp.vel() == doctest::Approx(rate).epsilon(0.05));
+            }
+            CHECK(interp.frac() >= 0.0f);
+            CHECK(interp.frac() < 1.0f);
+            last = pos;
+        }
+        CHECK(max_error < 1.0f);
+        // A staircase would jump by 8 times the change per iteration
+        CHECK(max_jump < 0.2f * dt * rate);
+    }
+
+    TEST_CASE("comes to rest on the count") {
+        StepInterpolator interp;
+        interp.update(0, 200.0f, dt);
+        for (int i = 0; i < 8000; ++i) {
+            interp.update(i < 800 ? i / 8 : 100, 200.0f, dt);
+        }
+        CHECK((double)interp.base() + interp.frac() == doctest::Approx(100.0).epsilon(1e-4));
+        CHECK(std::abs(interp.vel()) < 0.1f);
+    }
+
+    TEST_CASE("reset follows a jump of the count") {
+        StepInterpolator interp;
+        for (int i = 0; i < 100; ++i) {
+            interp.update(i, 200.0f, dt);
+        }
+        interp.reset();
+        interp.update(123456, 200.0f, dt);
+        CHECK(interp.base() == 123456);
+        CHECK(interp.vel() == 0.0f);
+    }
+}
@@ -0,0 +1,71 @@
+#include <doctest.h>
+
+#include "MotorControl/utils.hpp"
+#include "svm_sector_copy.hpp"
+
+TEST_SUITE("svm") {
+    TEST_CASE("matches sector implementation") {
+        for (float alpha = -1.2f; alpha <= 1.2f; alpha += 0.0137f) {
+            for (float beta = -1.2f; beta <= 1.2f; beta += 0.0113f) {
+                auto [tA, tB, tC, valid] = SVM(alpha, beta);
+                auto [rA, rB, rC, rvalid] = SVM_sector(alpha, beta);
+                REQUIRE(tA == doctest::Approx(rA).epsilon(1e-5));
+                REQUIRE(tB == doctest::Approx(rB).epsilon(1e-5));
+                REQUIRE(tC == doctest::Approx(rC).epsilon(1e-5));
+                // validity may only differ right at the hexagon boundary
+                if (valid != rvalid) {
+                    float m = std::max({std::abs(rA - 0.5f), std::abs(rB - 0.5f), std::abs(rC - 0.5f)});
+                    REQUIRE(m == doctest::Approx(0.5f).epsilon(1e-5));
+                }
+            }
+        }
+    }
+
+    TEST_CASE("overmodulation") {
+        // Inside the hexagon all strategies are identical
+        auto [a0, a1, a2, a_ok] = SVM(0.3f, -0.2f, SVM_OVERMODULATION_NONE);
+        auto [b0, b1, b2, b_ok] = SVM(0.3f, -0.2f, SVM_OVERMODULATION_CLAMP);
+        auto [c0, c1, c2, c_ok] = SVM(0.3f, -0.2f, SVM_OVERMODULATION_SIX_STEP);
+        CHECK(a_ok); CHECK(b_ok); CHECK(c_ok);
+        CHECK(a0 == b0); CHECK(a1 == b1); CHECK(a2 == b2);
+        CHECK(a0 == c0); CHECK(a1 == c1); CHECK(a2 == c2);
+
+        // Far outside the hexagon
+        CHECK(!std::get<3>(SVM(1.5f, 0.4f, SVM_OVERMODULATION_NONE)));
+
+        auto [tA, tB, tC, ok] = SVM(1.5f, 0.4f, SVM_OVERMODULATION_CLAMP);
+        CHECK(ok);
+        // Clamped vector lies on the hexagon boundary...
+        CHECK(std::max({tA, tB, tC}) - std::min({tA, tB, tC}) == doctest::Approx(1.0f));
+        // ...and keeps its angle
+        float alpha = (tB + tC) * 0.5f - tA;
+        float beta = (tC - tB) * sqrt3_by_2;
+        CHECK(std::atan2(beta, alpha) == doctest::Approx(std::atan2(0.4f, 1.5f)).epsilon(1e-4));
+
+        auto [sA, sB, sC, s_ok] = SVM(10.0f, 0.0f, SVM_OVERMODULATION_SIX_STEP);
+        CHECK(s_ok);
+        CHECK(sA == 0.0f); // phase A fully on
+        CHECK(sB == 1.0f);
+        CHECK(sC == 1.0f);
+
+        CHECK(!std::get<3>(SVM(NAN, 0.0f, SVM_OVERMODULATION_CLAMP)));
+        CHECK(!std::get<3>(SVM(NAN, 0.0f, SVM_OVERMODULATION_SIX_STEP)));
+    }
+
+    TEST_CASE("inverter drop") {
+        // Current into phase A, out of B and C: A loses the drop, B and C gain it
+        auto [a, b] = inverter_drop_alpha_beta(10.0f, 0.0f, 1.5f, 0.5f);
+        CHECK(a == doctest::Approx(4.0f / 3.0f * 1.5f));
+        CHECK(b == doctest::Approx(0.0f));
+
+        // With the currents well outside of the band the loss has the
+        // magnitude of a six-step vector and points along the current's sector
+        auto [c, d] = inverter_drop_alpha_beta(-3.0f, -8.0f, 1.0f, 0.1f);
+        CHECK(std::hypot(c, d) == doctest::Approx(4.0f / 3.0f).epsilon(1e-4));
+
+        // Inside the band the loss acts like a resistance of drop / band
+        auto [e, f] = inverter_drop_alpha_beta(0.1f, 0.0f, 1.0f, 0.5f);
+        CHECK(e == doctest::Approx(0.1f * 1.0f / 0.5f));
+        CHECK(f == doctest::Approx(0.0f));
+    }
+}
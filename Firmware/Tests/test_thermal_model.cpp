@@ -0,0 +1,44 @@
+#include <doctest.h>
+#include <cmath>
+
+#include "MotorControl/thermal_model.hpp"
+
+TEST_SUITE("thermal_model") {
+    TEST_CASE("step response") {
+        ThermalModel::Config_t config;
+        config.thermal_resistance[0] = 0.5f;
+        config.thermal_resistance[1] = 2.0f;
+        config.time_constant[0] = 1.0f;
+        config.time_constant[1] = 20.0f;
+
+        ThermalModel model;
+        model.reset();
+        const float dt = 0.001f;
+        for (size_t i = 0; i < 1000; ++i) {
+            model.update(config, 10.0f, dt);
+        }
+        // After one time constant of the fast stage
+        float expected = 5.0f * (1.0f - std::exp(-1.0f)) + 20.0f * (1.0f - std::exp(-1.0f / 20.0f));
+        CHECK(model.rise() == doctest::Approx(expected).epsilon(0.01));
+
+        for (size_t i = 0; i < 200000; ++i) {
+            model.update(config, 10.0f, dt);
+        }
+        CHECK(model.rise() == doctest::Approx(25.0f).epsilon(0.001));
+
+        // Cools down without power
+        for (size_t i = 0; i < 200000; ++i) {
+            model.update(config, 0.0f, dt);
+        }
+        CHECK(model.rise() == doctest::Approx(0.0f).epsilon(0.001));
+    }
+
+    TEST_CASE("short time constant") {
+        ThermalModel::Config_t config;
+        config.thermal_resistance[0] = 1.0f;
+        config.time_constant[0] = 0.0f;
+        ThermalModel model;
+        model.reset();
+        CHECK(model.update(config, 3.0f, 0.01f) == doctest::Approx(3.0f));
+    }
+}
@@ -0,0 +1,57 @@
+#include <doctest.h>
+#include <cmath>
+
+#include "MotorControl/torque_share.hpp"
+
+TEST_SUITE("torque_share") {
+    TEST_CASE("split") {
+        torque_share::Split_t split = torque_share::split(2.0f, 0.5f, 0.0f);
+        CHECK(split.own == 1.0f);
+        CHECK(split.other == 1.0f);
+
+        // The second motor turns the load backwards
+        split = torque_share::split(2.0f, -0.25f, 0.0f);
+        CHECK(split.own == 1.5f);
+        CHECK(split.other == -0.5f);
+
+        // A ratio above 1 gives all of the torque to the second motor
+        split = torque_share::split(2.0f, 1.5f, 0.0f);
+        CHECK(split.own == 0.0f);
+        CHECK(split.other == 2.0f);
+    }
+
+    TEST_CASE("preload cancels on the load") {
+        for (float ratio : {0.5f, -0.5f, 0.3f}) {
+            for (float torque : {-1.0f, 0.0f, 0.7f}) {
+                torque_share::Split_t split = torque_share::split(torque, ratio, 0.2f);
+                float other_on_load = std::signbit(ratio) ? -split.other : split.other;
+                CHECK(split.own + other_on_load == doctest::Approx(torque));
+                CHECK(split.own - other_on_load == doctest::Approx((1.0f - 2.0f * std::abs(ratio)) * torque + 0.4f));
+            }
+        }
+        // At zero torque the motors push against each other
+        torque_share::Split_t split = torque_share::split(0.0f, 0.5f, 0.2f);
+        CHECK(split.own == doctest::Approx(0.2f));
+        CHECK(split.other == doctest::Approx(-0.2f));
+    }
+
+    TEST_CASE("limit") {
+        CHECK(torque_share::limit(1.0f, 1.0f, 0.5f, 0.0f) == doctest::Approx(2.0f));
+        // The weaker motor limits the split
+        CHECK(torque_share::limit(1.0f, 0.5f, 0.5f, 0.0f) == doctest::Approx(1.0f));
+        CHECK(torque_share::limit(1.0f, 0.5f, -0.5f, 0.0f) == doctest::Approx(1.0f));
+        // The preload takes some of the limit of both motors
+        float lim = torque_share::limit(1.0f, 1.0f, 0.5f, 0.2f);
+        CHECK(lim == doctest::Approx(1.6f));
+        for (float torque : {lim, -lim}) {
+            torque_share::Split_t split = torque_share::split(torque, 0.5f, 0.2f);
+            CHECK(std::abs(split.own) <= 1.0f + 1e-6f);
+            CHECK(std::abs(split.other) <= 1.0f + 1e-6f);
+        }
+        // A motor without a share doesn't limit
+        CHECK(torque_share::limit(1.0f, 0.0f, 0.0f, 0.0f) == doctest::Approx(1.0f));
+        CHECK(torque_share::limit(0.0f, 1.0f, 1.0f, 0.0f) == doctest::Approx(1.0f));
+        // More preload than a motor can apply
+        CHECK(torque_share::limit(1.0f, 1.0f, 0.5f, 2.0f) == 0.0f);
+    }
+}
@@ -1,139 +1,19 @@
 
 #include <doctest.h>
 #include <limits.h>
+#include <limits>
 #include <cmath>
 #include <iostream>
 #include <random>
+#include <vector>
 
 #include "MotorControl/utils.hpp"
+#include "MotorControl/scurve_traj.hpp"
+#include "MotorControl/trap_tracker.hpp"
+#include "MotorControl/split_pos.hpp"
+#include "MotorControl/waypoint_queue.hpp"
 
-// TODO: This is currently a copy-paste of the real code due to non-trivial
-// include dependencies. Should include real code.
-
-class TrapezoidalTrajectory {
-public:
-    struct Step_t {
-        float Y;
-        float Yd;
-        float Ydd;
-    };
-
-    explicit TrapezoidalTrajectory();
-    bool planTrapezoidal(float Xf, float Xi, float Vi,
-                         float Vmax, float Amax, float Dmax);
-    Step_t eval(float t);
-
-    float Xi_;
-    float Xf_;
-    float Vi_;
-
-    float Ar_;
-    float Vr_;
-    float Dr_;
-
-    float Ta_;
-    float Tv_;
-    float Td_;
-    float Tf_;
-
-    float yAccel_;
-
-    float t_;
-};
-
-
-
-// A sign function where input 0 has positive sign (not 0)
-float sign_hard(float val) {
-    return (std::signbit(val)) ? -1.0f : 1.0f;
-}
-
-// Symbol                     Description
-// Ta, Tv and Td              Duration of the stages of the AL profile
-// Xi and Vi                  Adapted initial conditions for the AL profile
-// Xf                         Position set-point
-// s                          Direction (sign) of the trajectory
-// Vmax, Amax, Dmax and jmax  Kinematic bounds
-// Ar, Dr and Vr              Reached values of acceleration and velocity
-
-TrapezoidalTrajectory::TrapezoidalTrajectory() {}
-
-bool TrapezoidalTrajectory::planTrapezoidal(float Xf, float Xi, float Vi,
-                                            float Vmax, float Amax, float Dmax) {
-    float dX = Xf - Xi;  // Distance to travel
-    float stop_dist = (Vi * Vi) / (2.0f * Dmax); // Minimum stopping distance
-    float dXstop = std::copysign(stop_dist, Vi); // Minimum stopping displacement
-    float s = sign_hard(dX - dXstop); // Sign of coast velocity (if any)
-    Ar_ = s * Amax;  // Maximum Acceleration (signed)
-    Dr_ = -s * Dmax; // Maximum Deceleration (signed)
-    Vr_ = s * Vmax;  // Maximum Velocity (signed)
-
-    // If we start with a speed faster than cruising, then we need to decel instead of accel
-    // aka "double deceleration move" in the paper
-    if ((s * Vi) > (s * Vr_)) {
-        Ar_ = -s * Amax;
-    }
-
-    // Time to accel/decel to/from Vr (cruise speed)
-    Ta_ = (Vr_ - Vi) / Ar_;
-    Td_ = -Vr_ / Dr_;
-
-    // Integral of velocity ramps over the full accel and decel times to get
-    // minimum displacement required to reach cuising speed
-    float dXmin = 0.5f*Ta_*(Vr_ + Vi) + 0.5f*Td_*Vr_;
-
-    // Are we displacing enough to reach cruising speed?
-    if (s*dX < s*dXmin) {
-        // Short move (triangle profile)
-        Vr_ = s * std::sqrt(std::max((Dr_*SQ(Vi) + 2*Ar_*Dr_*dX) / (Dr_ - Ar_), 0.0f));
-        //Vr_ = s * std::sqrt((Dr_*SQ(Vi) + 2*Ar_*Dr_*dX) / (Dr_ - Ar_));
-        Ta_ = std::max(0.0f, (Vr_ - Vi) / Ar_);
-        Td_ = std::max(0.0f, -Vr_ / Dr_);
-        Tv_ = 0.0f;
-    } else {
-        // Long move (trapezoidal profile)
-        Tv_ = (dX - dXmin) / Vr_;
-    }
-
-    // Fill in the rest of the values used at evaluation-time
-    Tf_ = Ta_ + Tv_ + Td_;
-    Xi_ = Xi;
-    Xf_ = Xf;
-    Vi_ = Vi;
-    yAccel_ = Xi + Vi*Ta_ + 0.5f*Ar_*SQ(Ta_); // pos at end of accel phase
-
-    return true;
-}
-
-TrapezoidalTrajectory::Step_t TrapezoidalTrajectory::eval(float t) {
-    Step_t trajStep;
-    if (t < 0.0f) {  // Initial Condition
-        trajStep.Y   = Xi_;
-        trajStep.Yd  = Vi_;
-        trajStep.Ydd = 0.0f;
-    } else if (t < Ta_) {  // Accelerating
-        trajStep.Y   = Xi_ + Vi_*t + 0.5f*Ar_*SQ(t);
-        trajStep.Yd  = Vi_ + Ar_*t;
-        trajStep.Ydd = Ar_;
-    } else if (t < Ta_ + Tv_) {  // Coasting
-        trajStep.Y   = yAccel_ + Vr_*(t - Ta_);
-        trajStep.Yd  = Vr_;
-        trajStep.Ydd = 0.0f;
-    } else if (t < Tf_) {  // Deceleration
-        float td     = t - Tf_;
-        trajStep.Y   = Xf_ + 0.5f*Dr_*SQ(td);
-        trajStep.Yd  = Dr_*td;
-        trajStep.Ydd = Dr_;
-    } else if (t >= Tf_) {  // Final Condition
-        trajStep.Y   = Xf_;
-        trajStep.Yd  = 0.0f;
-        trajStep.Ydd = 0.0f;
-    } else {
-        // TODO: report error here
-    }
-
-    return trajStep;
-}
+#include "trap_traj_copy.hpp"
 
 static_assert(sizeof(float) * CHAR_BIT == 32);
 
@@ -233,3 +113,331 @@ TEST_SUITE("Trajectory Planner") {
         run_trajectory_test(8192.0f, -8192.0f, 40000.0f, 27712.0f, 22288.0f, 22288.0f);
     }
 }
+
+
+void run_scurve_test(float goal, float position, float velocity, float Vmax, float Amax, float Dmax, float Jmax) {
+    const float dt = 0.000125f;
+    const float Vmax_test = std::max(Vmax, std::abs(velocity)) * 1.001f;
+    const float Amax_test = std::max(Amax, Dmax) * 1.001f;
+
+    SCurveTrajectory traj{};
+    REQUIRE(traj.plan(goal, position, velocity, Vmax, Amax, Dmax, Jmax));
+
+    float acceleration = 0.0f;
+    for (float t = 0.0f; t < traj.Tf_; t += dt) {
+        SCurveTrajectory::Step_t step = traj.eval(t);
+        CHECK(std::abs(step.Ydd) <= Amax_test);
+        CHECK(std::abs(step.Ydd - acceleration) <= Jmax * dt * 1.01f + 1e-3f * Amax_test);
+        CHECK(std::abs(step.Yd) <= Vmax_test);
+        CHECK(std::abs(step.Y - position) <= Vmax_test * dt * 1.01f);
+        position = step.Y;
+        velocity = step.Yd;
+        acceleration = step.Ydd;
+    }
+
+    // The last sample before the end must hardly differ from the final state
+    CHECK(std::abs(position - goal) <= 1e-4f * std::max(1.0f, std::abs(goal)) + Vmax_test * dt);
+    CHECK(std::abs(velocity) <= Jmax * dt * dt + Dmax * dt);
+    CHECK(traj.eval(traj.Tf_).Y == goal);
+}
+
+TEST_SUITE("S-Curve Planner") {
+    TEST_CASE("long-move") {
+        // reaches vel, accel and jerk limits
+        run_scurve_test(10.0f, 0.0f, 0.0f, 2.0f, 4.0f, 3.0f, 40.0f);
+        run_scurve_test(-10.0f, 0.0f, 0.0f, 2.0f, 4.0f, 3.0f, 40.0f);
+    }
+    TEST_CASE("short-move") {
+        // neither vel nor accel limit reached
+        run_scurve_test(0.01f, 0.0f, 0.0f, 2.0f, 4.0f, 3.0f, 40.0f);
+        run_scurve_test(-0.01f, 0.0f, 0.0f, 2.0f, 4.0f, 3.0f, 40.0f);
+    }
+    TEST_CASE("moving-start") {
+        run_scurve_test(1.0f, 0.0f, 1.5f, 2.0f, 4.0f, 3.0f, 40.0f);
+        run_scurve_test(1.0f, 0.0f, -1.5f, 2.0f, 4.0f, 3.0f, 40.0f);
+        // not enough braking distance
+        run_scurve_test(0.1f, 0.0f, 2.0f, 2.0f, 4.0f, 3.0f, 40.0f);
+        // over speed
+        run_scurve_test(10.0f, 0.0f, 3.0f, 2.0f, 4.0f, 3.0f, 40.0f);
+    }
+    TEST_CASE("infinite-jerk") {
+        SCurveTrajectory traj{};
+        REQUIRE(traj.plan(10.0f, 0.0f, 0.0f, 2.0f, 4.0f, 4.0f, INFINITY));
+        // same as a trapezoid: 0.5 s accel, 4.5 s cruise, 0.5 s decel
+        CHECK(traj.Tf_ == doctest::Approx(5.5f));
+        CHECK(!is_nan(traj.eval(0.25f).Y));
+        CHECK(traj.eval(2.0f).Yd == doctest::Approx(2.0f));
+    }
+    TEST_CASE("invalid-limits") {
+        SCurveTrajectory traj{};
+        CHECK_FALSE(traj.plan(10.0f, 0.0f, 0.0f, 2.0f, 4.0f, 4.0f, 0.0f));
+        CHECK_FALSE(traj.plan(10.0f, 0.0f, 0.0f, 0.0f, 4.0f, 4.0f, 40.0f));
+    }
+}
+
+
+// Randomized plans, each checked for the invariants that the controller
+// relies on. Violations are counted instead of checked one by one, so that a
+// failure reports the offending plan.
+struct RandomMove {
+    float goal, position, velocity, Vmax, Amax, Dmax, Jmax;
+};
+
+RandomMove random_move(std::mt19937& gen) {
+    std::uniform_real_distribution<float> pos(-10.0f, 10.0f);
+    std::uniform_real_distribution<float> log_limit(-1.0f, 2.0f);
+    std::uniform_real_distribution<float> vel_ratio(-1.5f, 1.5f);
+    RandomMove m;
+    m.goal = pos(gen);
+    m.position = pos(gen);
+    m.Vmax = std::pow(10.0f, log_limit(gen));
+    m.Amax = std::pow(10.0f, log_limit(gen));
+    m.Dmax = std::pow(10.0f, log_limit(gen));
+    m.Jmax = 10.0f * std::pow(10.0f, log_limit(gen));
+    m.velocity = m.Vmax * vel_ratio(gen);
+    return m;
+}
+
+std::ostream& operator<<(std::ostream& os, const RandomMove& m) {
+    return os << "goal " << m.goal << ", position " << m.position << ", velocity " << m.velocity
+              << ", Vmax " << m.Vmax << ", Amax " << m.Amax << ", Dmax " << m.Dmax << ", Jmax " << m.Jmax;
+}
+
+// Samples a planned trajectory at the control loop rate and returns the
+// number of samples that exceed the limits or jump.
+template<typename TTraj>
+size_t count_violations(TTraj& traj, float Tf, const RandomMove& m, float Jmax_test) {
+    const float dt = 0.000125f;
+    const float Vmax_test = std::max(m.Vmax, std::abs(m.velocity)) * 1.001f;
+    const float Amax_test = std::max(m.Amax, m.Dmax) * 1.001f;
+    const float pos_tol = 1e-5f * std::max(1.0f, std::max(std::abs(m.goal), std::abs(m.position)));
+    // Moves with a large initial velocity take long and overshoot far, where
+    // the float resolution of t and Y dominates
+    auto resolution = [](float x) { return 4.0f * std::numeric_limits<float>::epsilon() * std::max(1.0f, std::abs(x)); };
+
+    size_t violations = 0;
+    auto prev = traj.eval(0.0f);
+    violations += std::abs(prev.Y - m.position) > pos_tol;
+    violations += std::abs(prev.Yd - m.velocity) > 1e-4f * Vmax_test;
+    for (float t = dt; t < Tf + 2.0f * dt; t += dt) {
+        auto step = traj.eval(t);
+        violations += !(std::abs(step.Ydd) <= Amax_test);
+        violations += !(std::abs(step.Yd) <= Vmax_test);
+        violations += !(std::abs(step.Y - prev.Y) <= Vmax_test * (dt + resolution(t)) + pos_tol + resolution(step.Y));
+        violations += !(std::abs(step.Yd - prev.Yd) <= Amax_test * (dt + resolution(t)) + 1e-4f * Vmax_test);
+        if (std::isfinite(Jmax_test)) {
+            violations += !(std::abs(step.Ydd - prev.Ydd) <= Jmax_test * (dt + resolution(t)) * 1.01f + 1e-3f * Amax_test);
+        }
+        prev = step;
+    }
+
+    // The end state is exact and the approach to it is continuous
+    auto end = traj.eval(Tf);
+    violations += end.Y != m.goal;
+    violations += end.Yd != 0.0f;
+    const float t_before = Tf - std::max(1e-5f, resolution(Tf));
+    auto before_end = traj.eval(std::max(0.0f, t_before));
+    violations += !(std::abs(before_end.Y - m.goal) <= Vmax_test * (Tf - t_before) + pos_tol + resolution(m.goal));
+    violations += !(std::abs(before_end.Yd) <= Amax_test * (Tf - t_before) + 1e-4f * Vmax_test);
+    return violations;
+}
+
+TEST_SUITE("Trajectory properties") {
+    TEST_CASE("random-trapezoids") {
+        std::mt19937 gen(1);
+        TrapezoidalTrajectory traj{};
+        for (size_t i = 0; i < 500; ++i) {
+            RandomMove m = random_move(gen);
+            INFO(m);
+            REQUIRE(traj.planTrapezoidal(m.goal, m.position, m.velocity, m.Vmax, m.Amax, m.Dmax));
+            REQUIRE(std::isfinite(traj.Tf_));
+            REQUIRE(traj.Ta_ >= 0.0f);
+            REQUIRE(traj.Tv_ >= 0.0f);
+            REQUIRE(traj.Td_ >= 0.0f);
+            CHECK(count_violations(traj, traj.Tf_, m, INFINITY) == 0);
+        }
+    }
+
+    TEST_CASE("random-scurves") {
+        std::mt19937 gen(2);
+        SCurveTrajectory traj{};
+        for (size_t i = 0; i < 500; ++i) {
+            RandomMove m = random_move(gen);
+            INFO(m);
+            REQUIRE(traj.plan(m.goal, m.position, m.velocity, m.Vmax, m.Amax, m.Dmax, m.Jmax));
+            REQUIRE(std::isfinite(traj.Tf_));
+            CHECK(count_violations(traj, traj.Tf_, m, m.Jmax) == 0);
+        }
+    }
+
+    TEST_CASE("random-coordinated-moves") {
+        // ODrive::move_coordinated() scales the tightest normalized limits by
+        // the distance of each axis. The planner must then yield the same
+        // timing for every axis and a straight line in joint space.
+        std::mt19937 gen(3);
+        std::uniform_real_distribution<float> pos(-10.0f, 10.0f);
+        std::uniform_real_distribution<float> log_limit(-1.0f, 2.0f);
+        for (size_t i = 0; i < 200; ++i) {
+            float start[2], goal[2], dist[2];
+            float vel_limit = INFINITY, accel_limit = INFINITY, decel_limit = INFINITY;
+            for (size_t j = 0; j < 2; ++j) {
+                start[j] = pos(gen);
+                goal[j] = pos(gen);
+                dist[j] = std::abs(goal[j] - start[j]);
+                vel_limit = std::min(vel_limit, std::pow(10.0f, log_limit(gen)) / dist[j]);
+                accel_limit = std::min(accel_limit, std::pow(10.0f, log_limit(gen)) / dist[j]);
+                decel_limit = std::min(decel_limit, std::pow(10.0f, log_limit(gen)) / dist[j]);
+            }
+
+            TrapezoidalTrajectory traj[2];
+            for (size_t j = 0; j < 2; ++j) {
+                REQUIRE(traj[j].planTrapezoidal(goal[j], start[j], 0.0f,
+                        vel_limit * dist[j], accel_limit * dist[j], decel_limit * dist[j]));
+            }
+            INFO("start " << start[0] << ", " << start[1] << ", goal " << goal[0] << ", " << goal[1]);
+            CHECK(traj[0].Tf_ == doctest::Approx(traj[1].Tf_).epsilon(1e-4));
+            CHECK(traj[0].Ta_ == doctest::Approx(traj[1].Ta_).epsilon(1e-4).scale(1e-6));
+            CHECK(traj[0].Td_ == doctest::Approx(traj[1].Td_).epsilon(1e-4).scale(1e-6));
+
+            size_t off_path = 0;
+            float Tf = std::max(traj[0].Tf_, traj[1].Tf_);
+            for (float t = 0.0f; t <= Tf; t += Tf / 1000.0f) {
+                float progress0 = std::abs(traj[0].eval(t).Y - start[0]) / dist[0];
+                float progress1 = std::abs(traj[1].eval(t).Y - start[1]) / dist[1];
+                off_path += !(std::abs(progress0 - progress1) <= 1e-3f);
+            }
+            CHECK(off_path == 0);
+        }
+    }
+
+    TEST_CASE("random-waypoint-streams") {
+        std::mt19937 gen(4);
+        std::uniform_real_distribution<float> interval(0.0005f, 0.02f);
+        std::uniform_real_distribution<float> delta(-0.05f, 0.05f);
+        std::uniform_real_distribution<float> vel(-5.0f, 5.0f);
+        const float dt = 0.000125f;
+
+        for (size_t i = 0; i < 100; ++i) {
+            WaypointQueue<16> q;
+            q.restart(0.0f, 0.0f, 0.0f);
+            std::vector<WaypointQueue<16>::Waypoint_t> waypoints;
+            float duration = 0.0f;
+            float vel_bound = 0.0f; // of the cubic Hermite segments
+            float prev_pos = 0.0f, prev_vel = 0.0f;
+            for (size_t j = 0; j < 16; ++j) {
+                WaypointQueue<16>::Waypoint_t wp = {interval(gen), prev_pos + delta(gen), vel(gen), 0.0f};
+                REQUIRE(q.push(wp));
+                waypoints.push_back(wp);
+                duration += wp.dt;
+                vel_bound = std::max(vel_bound, 1.5f * std::abs(wp.pos - prev_pos) / wp.dt + std::abs(prev_vel) + std::abs(wp.vel));
+                prev_pos = wp.pos;
+                prev_vel = wp.vel;
+            }
+
+            // The splines pass through the waypoints with their velocities
+            for (size_t j = 1; j < waypoints.size(); ++j) {
+                auto a = WaypointQueue<16>::interpolate(waypoints[j - 1], waypoints[j], waypoints[j].dt);
+                CHECK(a.pos == doctest::Approx(waypoints[j].pos).epsilon(1e-5).scale(1e-4));
+                CHECK(a.vel == doctest::Approx(waypoints[j].vel).epsilon(1e-3).scale(1e-2));
+            }
+
+            size_t jumps = 0;
+            float pos = 0.0f;
+            for (float t = dt; t < duration + 10.0f * dt; t += dt) {
+                auto sp = q.step(dt);
+                jumps += !(std::abs(sp.pos - pos) <= vel_bound * dt * 1.01f + 1e-6f);
+                pos = sp.pos;
+            }
+            CHECK(jumps == 0);
+            CHECK(q.size() == 0);
+            CHECK(pos == waypoints.back().pos);
+        }
+    }
+}
+
+
+// Runs the tracker until it reports done and returns the number of cycles
+// that exceed the limits. The position is a SplitPos like the setpoint of the
+// controller.
+size_t track(float goal, float& pos_out, float& vel, float Vmax, float Amax, float Dmax, size_t& cycles) {
+    const float dt = 0.000125f;
+    const float Vmax_test = std::max(Vmax, std::abs(vel)) * 1.001f;
+    const float Amax_test = std::max(Amax, Dmax) * 1.001f;
+    const SplitPos goal_split = SplitPos::from_float(goal);
+    SplitPos pos = SplitPos::from_float(pos_out);
+    size_t violations = 0;
+    for (cycles = 0; cycles < 10000000; ++cycles) {
+        TrapTracker::Step_t step = TrapTracker::step(goal_split - pos, vel, Vmax, Amax, Dmax, dt);
+        violations += !(std::abs(step.Yd) <= Vmax_test);
+        violations += !(std::abs(step.dY) <= Vmax_test * dt);
+        // The landing cycle brakes from at most Dmax * dt
+        violations += !step.done && !(std::abs(step.Ydd) <= Amax_test);
+        pos += step.dY;
+        vel = step.Yd;
+        if (step.done) {
+            break;
+        }
+    }
+    pos_out = pos.to_float();
+    return violations;
+}
+
+TEST_SUITE("Trap Tracker") {
+    TEST_CASE("single move takes as long as the planned trapezoid") {
+        for (float goal : {10.0f, -10.0f, 0.3f, -0.3f}) {
+            TrapezoidalTrajectory trap{};
+            trap.planTrapezoidal(goal, 0.0f, 0.0f, 2.0f, 4.0f, 3.0f);
+            float pos = 0.0f, vel = 0.0f;
+            size_t cycles = 0;
+            CHECK(track(goal, pos, vel, 2.0f, 4.0f, 3.0f, cycles) == 0);
+            CHECK(pos == goal);
+            CHECK(vel == 0.0f);
+            INFO("goal " << goal);
+            CHECK(cycles * 0.000125f == doctest::Approx(trap.Tf_).epsilon(0.005));
+        }
+    }
+
+    TEST_CASE("random moves") {
+        std::mt19937 gen(2);
+        size_t failures = 0;
+        for (size_t i = 0; i < 200; ++i) {
+            RandomMove m = random_move(gen);
+            // Overspeed moves with weak braking take far too long to simulate
+            TrapezoidalTrajectory trap{};
+            trap.planTrapezoidal(m.goal, m.position, m.velocity, m.Vmax, m.Amax, m.Dmax);
+            if (trap.Tf_ > 100.0f) {
+                continue;
+            }
+            float pos = m.position, vel = m.velocity;
+            size_t cycles = 0;
+            size_t violations = track(m.goal, pos, vel, m.Vmax, m.Amax, m.Dmax, cycles);
+            if (violations || pos != m.goal || vel != 0.0f) {
+                MESSAGE(m << ": " << violations << " violations, ended at " << pos);
+                ++failures;
+            }
+        }
+        CHECK(failures == 0);
+    }
+
+    TEST_CASE("streamed goals") {
+        // A host sends a sine at 100 Hz, every 80th control cycle
+        const float dt = 0.000125f;
+        const float Vmax = 2.0f, Amax = 4.0f, Dmax = 3.0f;
+        float pos = 0.0f, vel = 0.0f, goal = 0.0f;
+        size_t violations = 0;
+        for (size_t i = 0; i < 80000; ++i) {
+            if (i % 80 == 0) {
+                goal = std::sin(0.01f * (float)(i / 80));
+            }
+            TrapTracker::Step_t step = TrapTracker::step(goal - pos, vel, Vmax, Amax, Dmax, dt);
+            violations += !(std::abs(step.Yd) <= Vmax * 1.001f);
+            violations += !(std::abs(step.Yd - vel) <= std::max(Amax, Dmax) * dt * 1.001f);
+            pos += step.dY;
+            vel = step.Yd;
+        }
+        CHECK(violations == 0);
+        // Chasing a goal that moves at up to 1 turn/s, the setpoint stays on
+        // the braking curve behind it: 1^2 / (2 Dmax), plus one goal update
+        CHECK(std::abs(pos - goal) <= 1.0f / (2.0f * Dmax) + 0.01f);
+    }
+}
@@ -0,0 +1,103 @@
+#include <doctest.h>
+#include <cstring>
+
+#include "communication/uart_simple_frame.hpp"
+
+static can_Message_t make_msg(uint32_t id, bool rtr, uint8_t len, const uint8_t* data) {
+    can_Message_t msg;
+    msg.id = id;
+    msg.rtr = rtr;
+    msg.len = len;
+    memcpy(msg.buf, data, len);
+    return msg;
+}
+
+TEST_SUITE("uart_simple_frame") {
+    TEST_CASE("round trip") {
+        const uint8_t data[8] = {0x00, 0x01, 0x00, 0x00, 0xff, 0x00, 0x7f, 0x00};
+        for (uint32_t id : {0x000u, 0x001u, 0x100u, 0x7ffu}) {
+            for (uint8_t len = 0; len <= 8; ++len) {
+                CAPTURE(id);
+                CAPTURE(len);
+                can_Message_t in = make_msg(id, false, len, data);
+                uint8_t buf[UartSimpleFrame::MAX_ENCODED_SIZE];
+                size_t n = UartSimpleFrame::encode(in, buf, sizeof(buf));
+                REQUIRE(n == (size_t)len + 5);
+                CHECK(buf[n - 1] == 0);
+                for (size_t i = 0; i < n - 1; ++i) {
+                    CHECK(buf[i] != 0); // the delimiter is the only zero byte
+                }
+
+                can_Message_t out;
+                REQUIRE(UartSimpleFrame::decode(buf, n - 1, &out));
+                CHECK(out.id == id);
+                CHECK(!out.isExt);
+                CHECK(!out.rtr);
+                CHECK(out.len == len);
+                CHECK(memcmp(out.buf, data, len) == 0);
+            }
+        }
+    }
+
+    TEST_CASE("remote requests carry no data") {
+        const uint8_t data[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+        can_Message_t in = make_msg(0x029, true, 8, data);
+        uint8_t buf[UartSimpleFrame::MAX_ENCODED_SIZE];
+        size_t n = UartSimpleFrame::encode(in, buf, sizeof(buf));
+        REQUIRE(n == 5);
+
+        can_Message_t out;
+        REQUIRE(UartSimpleFrame::decode(buf, n - 1, &out));
+        CHECK(out.id == 0x029);
+        CHECK(out.rtr);
+        CHECK(out.len == 0);
+    }
+
+    TEST_CASE("unsupported messages are not encoded") {
+        const uint8_t data[8] = {};
+        uint8_t buf[UartSimpleFrame::MAX_ENCODED_SIZE];
+        can_Message_t ext = make_msg(0x01, false, 8, data);
+        ext.isExt = true;
+        CHECK(UartSimpleFrame::encode(ext, buf, sizeof(buf)) == 0);
+        CHECK(UartSimpleFrame::encode(make_msg(0x800, false, 8, data), buf, sizeof(buf)) == 0);
+        CHECK(UartSimpleFrame::encode(make_msg(0x01, false, 8, data), buf, sizeof(buf) - 1) == 0);
+    }
+
+    TEST_CASE("corrupted frames are rejected") {
+        const uint8_t data[4] = {0x12, 0x00, 0x34, 0x56};
+        uint8_t ref[UartSimpleFrame::MAX_ENCODED_SIZE];
+        size_t n = UartSimpleFrame::encode(make_msg(0x00c, false, 4, data), ref, sizeof(ref));
+        REQUIRE(n > 0);
+
+        // Every single-bit error that doesn't create a delimiter is caught
+        for (size_t i = 0; i < n - 1; ++i) {
+            for (int bit = 0; bit < 8; ++bit) {
+                uint8_t buf[UartSimpleFrame::MAX_ENCODED_SIZE];
+                memcpy(buf, ref, n);
+                buf[i] ^= 1 << bit;
+                if (!buf[i]) {
+                    continue;
+                }
+                CAPTURE(i);
+                CAPTURE(bit);
+                can_Message_t out;
+                CHECK(!UartSimpleFrame::decode(buf, n - 1, &out));
+            }
+        }
+
+        // Truncated frames
+        for (size_t len = 0; len < n - 1; ++len) {
+            uint8_t buf[UartSimpleFrame::MAX_ENCODED_SIZE];
+            memcpy(buf, ref, n);
+            can_Message_t out;
+            CHECK(!UartSimpleFrame::decode(buf, len, &out));
+        }
+
+        // Oversized frame
+        uint8_t garbage[UartSimpleFrame::MAX_ENCODED_SIZE + 4];
+        memset(garbage, 0x55, sizeof(garbage));
+        garbage[0] = sizeof(garbage) + 1;
+        can_Message_t out;
+        CHECK(!UartSimpleFrame::decode(garbage, sizeof(garbage), &out));
+    }
+}
@@ -0,0 +1,62 @@
+#include <doctest.h>
+
+#include "MotorControl/waypoint_queue.hpp"
+
+using Queue = WaypointQueue<8>;
+
+TEST_SUITE("waypoint_queue") {
+    TEST_CASE("push") {
+        Queue q;
+        CHECK_FALSE(q.push({0.0f, 1.0f, 0.0f, 0.0f}));
+        CHECK_FALSE(q.push({-0.1f, 1.0f, 0.0f, 0.0f}));
+        CHECK_FALSE(q.push({0.1f, NAN, 0.0f, 0.0f}));
+        for (size_t i = 0; i < 8; ++i) {
+            CHECK(q.push({0.1f, (float)i, 0.0f, 0.0f}));
+        }
+        CHECK_FALSE(q.push({0.1f, 8.0f, 0.0f, 0.0f}));
+        CHECK(q.size() == 8);
+        q.clear();
+        CHECK(q.size() == 0);
+    }
+
+    TEST_CASE("spline") {
+        // Waypoints on pos = t^3 are reproduced exactly
+        const float h = 0.01f;
+        const float dt = 0.000125f;
+        Queue q;
+        q.restart(0.0f, 0.0f, 0.0f);
+        for (size_t i = 1; i <= 4; ++i) {
+            float t = i * h;
+            REQUIRE(q.push({h, t * t * t, 3.0f * t * t, 0.0f}));
+        }
+        for (size_t i = 1; i < 300; ++i) {
+            float t = i * dt;
+            Queue::Setpoint_t sp = q.step(dt);
+            CHECK(sp.pos == doctest::Approx(t * t * t).epsilon(1e-3).scale(1e-6));
+            CHECK(sp.vel == doctest::Approx(3.0f * t * t).epsilon(1e-3).scale(1e-4));
+            CHECK(sp.acc == doctest::Approx(6.0f * t).epsilon(1e-3).scale(1e-2));
+        }
+        CHECK(q.size() == 1);
+        CHECK(q.underruns_ == 0);
+    }
+
+    TEST_CASE("underrun") {
+        Queue q;
+        q.restart(0.0f, 0.0f, 0.0f);
+        REQUIRE(q.push({0.01f, 1.0f, 10.0f, 0.5f}));
+        for (size_t i = 0; i < 100; ++i) {
+            q.step(0.001f);
+        }
+        // holds the last waypoint at standstill
+        Queue::Setpoint_t sp = q.step(0.001f);
+        CHECK(sp.pos == 1.0f);
+        CHECK(sp.vel == 0.0f);
+        CHECK(sp.torque_ff == 0.5f);
+        CHECK(q.underruns_ == 1);
+
+        // the next waypoint starts from the hold position now
+        REQUIRE(q.push({0.01f, 2.0f, 0.0f, 0.0f}));
+        sp = q.step(0.005f);
+        CHECK(sp.pos == doctest::Approx(1.5f));
+    }
+}
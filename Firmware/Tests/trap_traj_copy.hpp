@@ -0,0 +1,142 @@
+#ifndef __TRAP_TRAJ_COPY_HPP
+#define __TRAP_TRAJ_COPY_HPP
+
+#include <algorithm>
+#include <cmath>
+
+#include "MotorControl/utils.hpp"
+
+// TODO: This is currently a copy-paste of the real code due to non-trivial
+// include dependencies. Should include real code. Shared by the tests and
+// the benchmarks in Tests/bench/.
+
+class TrapezoidalTrajectory {
+public:
+    struct Step_t {
+        float Y;
+        float Yd;
+        float Ydd;
+    };
+
+    explicit TrapezoidalTrajectory();
+    bool planTrapezoidal(float Xf, float Xi, float Vi,
+                         float Vmax, float Amax, float Dmax);
+    Step_t eval(float t);
+
+    float Xi_;
+    float Xf_;
+    float Vi_;
+
+    float Ar_;
+    float Vr_;
+    float Dr_;
+
+    float Ta_;
+    float Tv_;
+    float Td_;
+    float Tf_;
+
+    float yAccel_;
+
+    float t_;
+};
+
+
+
+// A sign function where input 0 has positive sign (not 0)
+inline float sign_hard(float val) {
+    return (std::signbit(val)) ? -1.0f : 1.0f;
+}
+
+// Symbol                     Description
+// Ta, Tv and Td              Duration of the stages of the AL profile
+// Xi and Vi                  Adapted initial conditions for the AL profile
+// Xf                         Position set-point
+// s                          Direction (sign) of the trajectory
+// Vmax, Amax, Dmax and jmax  Kinematic bounds
+// Ar, Dr and Vr              Reached values of acceleration and velocity
+
+inline TrapezoidalTrajectory::TrapezoidalTrajectory() {}
+
+inline bool TrapezoidalTrajectory::planTrapezoidal(float Xf, float Xi, float Vi,
+                                                   float Vmax, float Amax, float Dmax) {
+    float dX = Xf - Xi;  // Distance to travel
+    float stop_dist = (Vi * Vi) / (2.0f * Dmax); // Minimum stopping distance
+    float dXstop = std::copysign(stop_dist, Vi); // Minimum stopping displacement
+    float s = sign_hard(dX - dXstop); // Sign of coast velocity (if any)
+    Ar_ = s * Amax;  // Maximum Acceleration (signed)
+    Dr_ = -s * Dmax; // Maximum Deceleration (signed)
+    Vr_ = s * Vmax;  // Maximum Velocity (signed)
+
+    // If we start with a speed faster than cruising, then we need to decel instead of accel
+    // aka "double deceleration move" in the paper
+    if ((s * Vi) > (s * Vr_)) {
+        Ar_ = -s * Dmax;
+    } else if ((s * Vi) < 0.0f) {
+        // The initial velocity is braked on the way. Braking harder than Dmax
+        // would stop short of the overshoot that the choice of s assumed.
+        Ar_ = s * std::min(Amax, Dmax);
+    }
+
+    // Time to accel/decel to/from Vr (cruise speed)
+    Ta_ = (Vr_ - Vi) / Ar_;
+    Td_ = -Vr_ / Dr_;
+
+    // Integral of velocity ramps over the full accel and decel times to get
+    // minimum displacement required to reach cuising speed
+    float dXmin = 0.5f*Ta_*(Vr_ + Vi) + 0.5f*Td_*Vr_;
+
+    // Are we displacing enough to reach cruising speed?
+    if (s*dX < s*dXmin) {
+        // Short move (triangle profile)
+        Vr_ = s * std::sqrt(std::max((Dr_*SQ(Vi) + 2*Ar_*Dr_*dX) / (Dr_ - Ar_), 0.0f));
+        //Vr_ = s * std::sqrt((Dr_*SQ(Vi) + 2*Ar_*Dr_*dX) / (Dr_ - Ar_));
+        Ta_ = std::max(0.0f, (Vr_ - Vi) / Ar_);
+        Td_ = std::max(0.0f, -Vr_ / Dr_);
+        Tv_ = 0.0f;
+    } else {
+        // Long move (trapezoidal profile)
+        Tv_ = (dX - dXmin) / Vr_;
+    }
+
+    // Fill in the rest of the values used at evaluation-time
+    Tf_ = Ta_ + Tv_ + Td_;
+    Xi_ = Xi;
+    Xf_ = Xf;
+    Vi_ = Vi;
+    yAccel_ = Xi + Vi*Ta_ + 0.5f*Ar_*SQ(Ta_); // pos at end of accel phase
+
+    return true;
+}
+
+inline TrapezoidalTrajectory::Step_t TrapezoidalTrajectory::eval(float t) {
+    Step_t trajStep;
+    if (t < 0.0f) {  // Initial Condition
+        trajStep.Y   = Xi_;
+        trajStep.Yd  = Vi_;
+        trajStep.Ydd = 0.0f;
+    } else if (t < Ta_) {  // Accelerating
+        trajStep.Y   = Xi_ + Vi_*t + 0.5f*Ar_*SQ(t);
+        trajStep.Yd  = Vi_ + Ar_*t;
+        trajStep.Ydd = Ar_;
+    } else if (t < Ta_ + Tv_) {  // Coasting
+        trajStep.Y   = yAccel_ + Vr_*(t - Ta_);
+        trajStep.Yd  = Vr_;
+        trajStep.Ydd = 0.0f;
+    } else if (t < Tf_) {  // Deceleration
+        float td     = t - Tf_;
+        trajStep.Y   = Xf_ + 0.5f*Dr_*SQ(td);
+        trajStep.Yd  = Dr_*td;
+        trajStep.Ydd = Dr_;
+    } else if (t >= Tf_) {  // Final Condition
+        trajStep.Y   = Xf_;
+        trajStep.Yd  = 0.0f;
+        trajStep.Ydd = 0.0f;
+    } else {
+        // TODO: report error here
+    }
+
+    return trajStep;
+}
+
+#endif // __TRAP_TRAJ_COPY_HPP
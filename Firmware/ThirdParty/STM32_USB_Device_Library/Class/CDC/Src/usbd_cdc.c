@@ -61,6 +61,7 @@ EndBSPDependencies */
 #include "usbd_ctlreq.h"
 #include <cmsis_os.h>
 #include <freertos_vars.h>
+#include <communication/interface_usb.h>
 
 
 /** @addtogroup STM32_USB_DEVICE_LIBRARY
@@ -113,6 +114,7 @@ static uint8_t *USBD_CDC_GetFSCfgDesc(uint16_t *length);
 static uint8_t *USBD_CDC_GetHSCfgDesc(uint16_t *length);
 static uint8_t *USBD_CDC_GetOtherSpeedCfgDesc(uint16_t *length);
 static uint8_t *USBD_CDC_GetOtherSpeedCfgDesc(uint16_t *length);
+static void USBD_CDC_SetBulkPacketSize(uint16_t size);
 uint8_t *USBD_CDC_GetDeviceQualifierDescriptor(uint16_t *length);
 static uint8_t  USBD_WinUSBComm_SetupVendor(USBD_HandleTypeDef *pdev, USBD_SetupReqTypedef *req);
 
@@ -160,7 +162,9 @@ USBD_ClassTypeDef  USBD_CDC =
   USBD_UsrStrDescriptor
 };
 
-/* USB CDC device Configuration Descriptor */
+/* USB CDC device Configuration Descriptor.
+ * The bulk endpoint packet sizes are set for the requested speed by
+ * USBD_CDC_SetBulkPacketSize(). */
 __ALIGN_BEGIN uint8_t USBD_CDC_CfgDesc[USB_CDC_CONFIG_DESC_SIZ] __ALIGN_END =
 {
   /*Configuration Descriptor*/
@@ -253,8 +257,8 @@ __ALIGN_BEGIN uint8_t USBD_CDC_CfgDesc[USB_CDC_CONFIG_DESC_SIZ] __ALIGN_END =
   USB_DESC_TYPE_ENDPOINT,      /* bDescriptorType: Endpoint */
   CDC_OUT_EP,                        /* bEndpointAddress */
   0x02,                              /* bmAttributes: Bulk */
-  LOBYTE(CDC_DATA_HS_MAX_PACKET_SIZE),  /* wMaxPacketSize: */
-  HIBYTE(CDC_DATA_HS_MAX_PACKET_SIZE),
+  LOBYTE(CDC_DATA_FS_MAX_PACKET_SIZE),  /* wMaxPacketSize: */
+  HIBYTE(CDC_DATA_FS_MAX_PACKET_SIZE),
   0x00,                              /* bInterval: ignore for Bulk transfer */
   
   /*Endpoint IN Descriptor*/
@@ -262,8 +266,8 @@ __ALIGN_BEGIN uint8_t USBD_CDC_CfgDesc[USB_CDC_CONFIG_DESC_SIZ] __ALIGN_END =
   USB_DESC_TYPE_ENDPOINT,      /* bDescriptorType: Endpoint */
   CDC_IN_EP,                         /* bEndpointAddress */
   0x02,                              /* bmAttributes: Bulk */
-  LOBYTE(CDC_DATA_HS_MAX_PACKET_SIZE),  /* wMaxPacketSize: */
-  HIBYTE(CDC_DATA_HS_MAX_PACKET_SIZE),
+  LOBYTE(CDC_DATA_FS_MAX_PACKET_SIZE),  /* wMaxPacketSize: */
+  HIBYTE(CDC_DATA_FS_MAX_PACKET_SIZE),
   0x00,                              /* bInterval: ignore for Bulk transfer */
 
   ///////////////////////////////////////////////////////////////////////////////
@@ -296,8 +300,8 @@ __ALIGN_BEGIN uint8_t USBD_CDC_CfgDesc[USB_CDC_CONFIG_DESC_SIZ] __ALIGN_END =
   USB_DESC_TYPE_ENDPOINT,      /* bDescriptorType: Endpoint */
   ODRIVE_OUT_EP,                        /* bEndpointAddress */
   0x02,                              /* bmAttributes: Bulk */
-  LOBYTE(CDC_DATA_HS_MAX_PACKET_SIZE),  /* wMaxPacketSize: */
-  HIBYTE(CDC_DATA_HS_MAX_PACKET_SIZE),
+  LOBYTE(CDC_DATA_FS_MAX_PACKET_SIZE),  /* wMaxPacketSize: */
+  HIBYTE(CDC_DATA_FS_MAX_PACKET_SIZE),
   0x00,                              /* bInterval: ignore for Bulk transfer */
   
   /*Endpoint IN Descriptor*/
@@ -305,8 +309,8 @@ __ALIGN_BEGIN uint8_t USBD_CDC_CfgDesc[USB_CDC_CONFIG_DESC_SIZ] __ALIGN_END =
   USB_DESC_TYPE_ENDPOINT,      /* bDescriptorType: Endpoint */
   ODRIVE_IN_EP,                         /* bEndpointAddress */
   0x02,                              /* bmAttributes: Bulk */
-  LOBYTE(CDC_DATA_HS_MAX_PACKET_SIZE),  /* wMaxPacketSize: */
-  HIBYTE(CDC_DATA_HS_MAX_PACKET_SIZE),
+  LOBYTE(CDC_DATA_FS_MAX_PACKET_SIZE),  /* wMaxPacketSize: */
+  HIBYTE(CDC_DATA_FS_MAX_PACKET_SIZE),
   0x00,                              /* bInterval: ignore for Bulk transfer */
 };
 
@@ -584,11 +588,11 @@ static uint8_t USBD_CDC_DataIn(USBD_HandleTypeDef *pdev, uint8_t epnum)
     // NOTE: We would logically expect xx_IN_EP here, but we actually get the xx_OUT_EP
     if (epnum == CDC_OUT_EP) {
       hcdc->CDC_Tx.State = 0;
-      osMessagePut(usb_event_queue, 3, 0);
+      usb_tx_process_done(CDC_IN_EP);
     }
     if (epnum == ODRIVE_OUT_EP) {
       hcdc->ODRIVE_Tx.State = 0;
-      osMessagePut(usb_event_queue, 4, 0);
+      usb_tx_process_done(ODRIVE_IN_EP);
     }
     return USBD_OK;
   }
@@ -655,6 +659,27 @@ static uint8_t USBD_CDC_EP0_RxReady(USBD_HandleTypeDef *pdev)
   return (uint8_t)USBD_OK;
 }
 
+/**
+  * @brief  USBD_CDC_SetBulkPacketSize
+  *         Set wMaxPacketSize of all bulk endpoints in the configuration
+  *         descriptor (the only fields that differ between the speeds)
+  * @param  size : packet size
+  * @retval None
+  */
+static void USBD_CDC_SetBulkPacketSize(uint16_t size)
+{
+  uint16_t i = 0U;
+  while (i + 7U <= sizeof(USBD_CDC_CfgDesc) && USBD_CDC_CfgDesc[i] != 0U)
+  {
+    if (USBD_CDC_CfgDesc[i + 1U] == USB_DESC_TYPE_ENDPOINT && (USBD_CDC_CfgDesc[i + 3U] & 0x03U) == 0x02U)
+    {
+      USBD_CDC_CfgDesc[i + 4U] = LOBYTE(size);
+      USBD_CDC_CfgDesc[i + 5U] = HIBYTE(size);
+    }
+    i += USBD_CDC_CfgDesc[i];
+  }
+}
+
 /**
   * @brief  USBD_CDC_GetFSCfgDesc
   *         Return configuration descriptor
@@ -664,6 +689,7 @@ static uint8_t USBD_CDC_EP0_RxReady(USBD_HandleTypeDef *pdev)
   */
 static uint8_t *USBD_CDC_GetFSCfgDesc(uint16_t *length)
 {
+  USBD_CDC_SetBulkPacketSize(CDC_DATA_FS_MAX_PACKET_SIZE);
   *length = (uint16_t)sizeof(USBD_CDC_CfgDesc);
 
   return USBD_CDC_CfgDesc;
@@ -678,6 +704,7 @@ static uint8_t *USBD_CDC_GetFSCfgDesc(uint16_t *length)
   */
 static uint8_t *USBD_CDC_GetHSCfgDesc(uint16_t *length)
 {
+  USBD_CDC_SetBulkPacketSize(CDC_DATA_HS_MAX_PACKET_SIZE);
   *length = (uint16_t)sizeof(USBD_CDC_CfgDesc);
 
   return USBD_CDC_CfgDesc;
@@ -692,6 +719,7 @@ static uint8_t *USBD_CDC_GetHSCfgDesc(uint16_t *length)
   */
 static uint8_t *USBD_CDC_GetOtherSpeedCfgDesc(uint16_t *length)
 {
+  USBD_CDC_SetBulkPacketSize(CDC_DATA_FS_MAX_PACKET_SIZE);
   *length = (uint16_t)sizeof(USBD_CDC_CfgDesc);
 
   return USBD_CDC_CfgDesc;
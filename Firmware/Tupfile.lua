@@ -43,7 +43,7 @@ function compile(src_file, obj_file)
     compiler = (tup.ext(src_file) == 'c') and CC or CXX
     tup.frule{
         inputs={src_file},
-        extra_inputs = {'autogen/interfaces.hpp', 'autogen/function_stubs.hpp', 'autogen/endpoints.hpp', 'autogen/type_info.hpp'},
+        extra_inputs = {'autogen/interfaces.hpp', 'autogen/function_stubs.hpp', 'autogen/endpoints.hpp', 'autogen/type_info.hpp', 'autogen/config_fields.hpp'},
         command='^o^ '..compiler..' -c %f '..tostring(CFLAGS)..' -o %o',
         outputs={obj_file}
     }
@@ -72,6 +72,7 @@ odrive_firmware_pkg = {
         'MotorControl/utils.cpp',
         'MotorControl/arm_sin_f32.c',
         'MotorControl/arm_cos_f32.c',
+        'MotorControl/arm_sin_cos_f32.c',
         'MotorControl/low_level.cpp',
         'MotorControl/axis.cpp',
         'MotorControl/motor.cpp',
@@ -84,19 +85,26 @@ odrive_firmware_pkg = {
         'MotorControl/foc.cpp',
         'MotorControl/open_loop_controller.cpp',
         'MotorControl/oscilloscope.cpp',
+        'MotorControl/telemetry.cpp',
         'MotorControl/sensorless_estimator.cpp',
+        'MotorControl/fused_estimator.cpp',
+        'MotorControl/hfi_estimator.cpp',
         'MotorControl/trapTraj.cpp',
         'MotorControl/pwm_input.cpp',
         'MotorControl/main.cpp',
+        'MotorControl/benchmark.cpp',
         'Drivers/STM32/stm32_system.cpp',
         'Drivers/STM32/stm32_gpio.cpp',
         'Drivers/STM32/stm32_nvm.c',
+        'Drivers/STM32/stm32_fw_update.c',
         'Drivers/STM32/stm32_spi_arbiter.cpp',
+        'communication/can/can_fibre.cpp',
         'communication/can/can_simple.cpp',
         'communication/can/odrive_can.cpp',    
         'communication/communication.cpp',
         'communication/ascii_protocol.cpp',
         'communication/interface_uart.cpp',
+        'communication/uart_simple.cpp',
         'communication/interface_usb.cpp',
         'communication/interface_i2c.cpp',
         'FreeRTOS-openocd.c',
@@ -262,7 +270,7 @@ board_v3 = {
         'Src/gpio.c',
         'Src/i2c.c',
     },
-    cflags = {'-DSTM32F405xx', '-DHW_VERSION_MAJOR=3'},
+    cflags = {'-DSTM32F405xx', '-DHW_VERSION_MAJOR=3', '-DFIBRE_CRC_TABLES=1'},
     ldflags = {
         '-TBoard/v3/STM32F405RGTx_FLASH.ld',
         '-larm_cortexM4lf_math',
@@ -304,7 +312,7 @@ board_v4 = {
         'Src/usbd_cdc_if.c',
         'Src/i2c.c',
     },
-    cflags = {'-DSTM32F722xx', '-DHW_VERSION_MAJOR=4'},
+    cflags = {'-DSTM32F722xx', '-DHW_VERSION_MAJOR=4', '-DFIBRE_CRC_TABLES=1'},
     ldflags = {
         '-TPrivate/v4/STM32F722RETx_FLASH.ld',
         '-larm_cortexM7lfsp_math',
@@ -357,6 +365,7 @@ LDFLAGS += '-flto -lc -lm -lnosys' -- libs
 -- LDFLAGS += '-mthumb -mfloat-abi=hard -specs=nosys.specs -specs=nano.specs -u _printf_float -u _scanf_float -Wl,--cref -Wl,--gc-sections'
 LDFLAGS += '-mthumb -mfloat-abi=hard -specs=nosys.specs -u _printf_float -u _scanf_float -Wl,--cref -Wl,--gc-sections'
 LDFLAGS += '-Wl,--undefined=uxTopUsedPriority'
+LDFLAGS += '-Wl,--print-memory-usage' -- RAM/CCMRAM usage report, all RTOS objects are static
 
 
 -- Handle Configuration Options ------------------------------------------------
@@ -401,6 +410,22 @@ if tup.getconfig("USE_LTO") == "true" then
     CFLAGS += '-flto'
 end
 
+if tup.getconfig("RAMFUNC_HOT_PATH") == "true" then
+    CFLAGS += '-DRAMFUNC_HOT_PATH'
+end
+
+if tup.getconfig("COMPRESSED_JSON_ONLY") == "true" then
+    CFLAGS += '-DFIBRE_COMPRESSED_JSON_ONLY=1'
+end
+
+if tup.getconfig("UART_RX_BUFFER_SIZE") ~= "" then
+    CFLAGS += '-DUART_RX_BUFFER_SIZE='..tup.getconfig("UART_RX_BUFFER_SIZE")
+end
+
+if tup.getconfig("UART_TX_BUFFER_SIZE") ~= "" then
+    CFLAGS += '-DUART_TX_BUFFER_SIZE='..tup.getconfig("UART_TX_BUFFER_SIZE")
+end
+
 
 -- Generate Tup Rules ----------------------------------------------------------
 
@@ -424,6 +449,11 @@ tup.frule{inputs={'fibre-cpp/interfaces_template.j2', extra_inputs='odrive-inter
 tup.frule{inputs={'fibre-cpp/function_stubs_template.j2', extra_inputs='odrive-interface.yaml'}, command=python_command..' interface_generator_stub.py --definitions odrive-interface.yaml --template %f --output %o', outputs='autogen/function_stubs.hpp'}
 tup.frule{inputs={'fibre-cpp/endpoints_template.j2', extra_inputs='odrive-interface.yaml'}, command=python_command..' interface_generator_stub.py --definitions odrive-interface.yaml --generate-endpoints '..root_interface..' --template %f --output %o', outputs='autogen/endpoints.hpp'}
 tup.frule{inputs={'fibre-cpp/type_info_template.j2', extra_inputs='odrive-interface.yaml'}, command=python_command..' interface_generator_stub.py --definitions odrive-interface.yaml --template %f --output %o', outputs='autogen/type_info.hpp'}
+-- Fails if a member of a stored config struct is on no field list
+config_check_args = '--config-sources MotorControl/*.hpp MotorControl/odrive_main.h communication/can/odrive_can.hpp --config-struct ODrive3=BoardConfig_t --config-struct Can=ODriveCAN::Config_t'
+tup.frule{inputs={'fibre-cpp/config_fields_template.j2', extra_inputs='odrive-interface.yaml'}, command=python_command..' interface_generator_stub.py --definitions odrive-interface.yaml --template %f --output %o '..config_check_args, outputs='autogen/config_fields.hpp'}
+-- Not used by the firmware: the typed client header for host applications (see fibre-cpp/host_client.hpp)
+tup.frule{inputs={'fibre-cpp/host_client_template.j2', extra_inputs='odrive-interface.yaml'}, command=python_command..' interface_generator_stub.py --definitions odrive-interface.yaml --generate-endpoints '..root_interface..' --template %f --output %o', outputs='autogen/host_client.hpp'}
 
 
 add_pkg(board)
@@ -452,6 +482,11 @@ tup.frule{inputs={'build/ODriveFirmware.elf'}, command=CCPATH..'arm-none-eabi-si
 tup.frule{inputs={'build/ODriveFirmware.elf'}, command=CCPATH..'arm-none-eabi-objcopy -O ihex %f %o', outputs={'build/ODriveFirmware.hex'}}
 tup.frule{inputs={'build/ODriveFirmware.elf'}, command=CCPATH..'arm-none-eabi-objcopy -O binary -S %f %o', outputs={'build/ODriveFirmware.bin'}}
 
+if tup.getconfig('RAMFUNC_HOT_PATH') == 'true' then
+    -- List all functions that landed in RAM (address, size, name)
+    tup.frule{inputs={'build/ODriveFirmware.elf'}, command=CCPATH..'arm-none-eabi-nm -C -S -n %f | grep -E "^2[0-9a-f]{7} [0-9a-f]+ [tT] " > %o', outputs={'build/ramfunc_report.txt'}}
+end
+
 if tup.getconfig('ENABLE_DISASM') == 'true' then
     tup.frule{inputs={'build/ODriveFirmware.elf'}, command=CCPATH..'arm-none-eabi-objdump %f -dSC > %o', outputs={'build/ODriveFirmware.asm'}}
 end
@@ -0,0 +1,340 @@
+#ifndef __ASCII_PARSER_HPP
+#define __ASCII_PARSER_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <limits>
+
+/**
+ * @brief Cursor over one line of the ASCII protocol that parses the arguments
+ * of a command in place.
+ *
+ * This replaces sscanf on the command path. It doesn't copy the line, doesn't
+ * allocate and doesn't go through the C library's format string interpreter.
+ * The parse functions behave like the corresponding sscanf conversions: they
+ * skip leading whitespace and stop at the first character that doesn't belong
+ * to the value. If a function fails, nothing is consumed.
+ */
+class AsciiParser {
+public:
+    AsciiParser(char* begin, char* end) : pos_(begin), end_(end) {}
+
+    // Returns the next character without consuming it or 0 at the end
+    char peek() const {
+        return pos_ < end_ ? *pos_ : 0;
+    }
+
+    // Consumes the character c if it comes next (without skipping whitespace,
+    // like a literal character in a scanf format)
+    bool expect(char c) {
+        if (pos_ >= end_ || *pos_ != c) {
+            return false;
+        }
+        pos_++;
+        return true;
+    }
+
+    /**
+     * @brief Parses the next whitespace delimited token (like "%s").
+     * @param begin, end: Set to the bounds of the token. The token isn't null
+     *        terminated but *end may be overwritten by the caller.
+     */
+    bool parse_token(char** begin, char** end) {
+        skip_whitespace();
+        char* token_end = pos_;
+        while (token_end < end_ && !is_whitespace(*token_end)) {
+            token_end++;
+        }
+        if (token_end == pos_) {
+            return false;
+        }
+        *begin = pos_;
+        *end = token_end;
+        pos_ = token_end;
+        return true;
+    }
+
+    // Parses a decimal unsigned integer (like "%u"). Saturates on overflow.
+    template<typename T>
+    bool parse_uint(T* value) {
+        static_assert(!std::numeric_limits<T>::is_signed, "T must be unsigned");
+        skip_whitespace();
+        char* pos = pos_;
+        bool negative = (pos < end_) && *pos == '-';
+        if (pos < end_ && (*pos == '+' || *pos == '-')) {
+            pos++;
+        }
+        T result;
+        if (!parse_digits(&pos, 10, &result)) {
+            return false;
+        }
+        *value = negative ? (T)(0 - result) : result; // wraps like strtoul
+        pos_ = pos;
+        return true;
+    }
+
+    // Parses a signed integer in decimal, hexadecimal (0x prefix) or octal
+    // (0 prefix) notation (like "%i"). Saturates on overflow.
+    bool parse_int(int32_t* value) {
+        skip_whitespace();
+        char* pos = pos_;
+        bool negative = (pos < end_) && *pos == '-';
+        if (pos < end_ && (*pos == '+' || *pos == '-')) {
+            pos++;
+        }
+
+        unsigned base = 10;
+        if (pos < end_ && *pos == '0') {
+            base = 8; // the leading zero is a valid octal digit
+            if (pos + 2 < end_ && (pos[1] == 'x' || pos[1] == 'X') && digit_value(pos[2]) < 16) {
+                base = 16;
+                pos += 2;
+            }
+        }
+
+        uint32_t magnitude;
+        if (!parse_digits(&pos, base, &magnitude)) {
+            return false;
+        }
+        uint32_t limit = negative ? (uint32_t)INT32_MAX + 1 : (uint32_t)INT32_MAX;
+        magnitude = magnitude < limit ? magnitude : limit;
+        *value = negative ? (int32_t)(0 - magnitude) : (int32_t)magnitude;
+        pos_ = pos;
+        return true;
+    }
+
+    // Parses a decimal floating point number with optional exponent, "inf",
+    // "infinity" or "nan" (like "%f", without hexadecimal floats)
+    bool parse_float(float* value) {
+        skip_whitespace();
+        char* pos = pos_;
+        bool negative = (pos < end_) && *pos == '-';
+        if (pos < end_ && (*pos == '+' || *pos == '-')) {
+            pos++;
+        }
+
+        float special;
+        if (parse_special(&pos, &special)) {
+            *value = negative ? -special : special;
+            pos_ = pos;
+            return true;
+        }
+
+        // Up to 19 significant digits fit into the mantissa. Further digits
+        // only shift the decimal exponent.
+        uint64_t mantissa = 0;
+        int n_significant = 0;
+        int exp10 = 0;
+        bool any_digits = false;
+
+        for (; pos < end_ && is_digit(*pos); ++pos) {
+            any_digits = true;
+            accumulate(*pos, &mantissa, &n_significant, &exp10, false);
+        }
+        if (pos < end_ && *pos == '.') {
+            ++pos;
+            for (; pos < end_ && is_digit(*pos); ++pos) {
+                any_digits = true;
+                accumulate(*pos, &mantissa, &n_significant, &exp10, true);
+            }
+        }
+        if (!any_digits) {
+            return false;
+        }
+
+        // The exponent is only part of the number if it has digits
+        if (pos < end_ && (*pos == 'e' || *pos == 'E')) {
+            char* exp_pos = pos + 1;
+            bool exp_negative = (exp_pos < end_) && *exp_pos == '-';
+            if (exp_pos < end_ && (*exp_pos == '+' || *exp_pos == '-')) {
+                exp_pos++;
+            }
+            if (exp_pos < end_ && is_digit(*exp_pos)) {
+                int exp = 0;
+                for (; exp_pos < end_ && is_digit(*exp_pos); ++exp_pos) {
+                    exp = exp < 10000 ? exp * 10 + (*exp_pos - '0') : exp; // far beyond the float range
+                }
+                exp10 += exp_negative ? -exp : exp;
+                pos = exp_pos;
+            }
+        }
+
+        float result = to_float(mantissa, exp10);
+        *value = negative ? -result : result;
+        pos_ = pos;
+        return true;
+    }
+
+private:
+    static bool is_whitespace(char c) {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+    }
+
+    static bool is_digit(char c) {
+        return c >= '0' && c <= '9';
+    }
+
+    // Returns the value of a digit in bases up to 16 or 16 for other characters
+    static unsigned digit_value(char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return 16;
+    }
+
+    static char to_lower(char c) {
+        return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+    }
+
+    void skip_whitespace() {
+        while (pos_ < end_ && is_whitespace(*pos_)) {
+            pos_++;
+        }
+    }
+
+    template<typename T>
+    bool parse_digits(char** pos, unsigned base, T* value) {
+        constexpr T max = std::numeric_limits<T>::max();
+        T result = 0;
+        char* p = *pos;
+        for (unsigned digit; p < end_ && (digit = digit_value(*p)) < base; ++p) {
+            result = (result > (max - digit) / base) ? max : result * base + digit;
+        }
+        if (p == *pos) {
+            return false;
+        }
+        *value = result;
+        *pos = p;
+        return true;
+    }
+
+    // Matches a case insensitive keyword at pos
+    bool match(char* pos, const char* keyword) const {
+        for (; *keyword; ++keyword, ++pos) {
+            if (pos >= end_ || to_lower(*pos) != *keyword) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool parse_special(char** pos, float* value) {
+        if (match(*pos, "infinity")) {
+            *pos += 8;
+            *value = std::numeric_limits<float>::infinity();
+        } else if (match(*pos, "inf")) {
+            *pos += 3;
+            *value = std::numeric_limits<float>::infinity();
+        } else if (match(*pos, "nan")) {
+            *pos += 3;
+            *value = std::numeric_limits<float>::quiet_NaN();
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    static void accumulate(char c, uint64_t* mantissa, int* n_significant, int* exp10, bool is_fraction) {
+        if (*n_significant < 19) {
+            *mantissa = *mantissa * 10 + (c - '0');
+            *n_significant += (*mantissa != 0); // leading zeros are not significant
+            *exp10 -= is_fraction;
+        } else {
+            *exp10 += !is_fraction; // digit beyond the precision of the mantissa
+        }
+    }
+
+    // Returns mantissa * 10^exp10
+    static float to_float(uint64_t mantissa, int exp10) {
+        static const float pow10f[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
+
+        if (mantissa == 0) {
+            return 0.0f;
+        }
+
+        // Fast path for typical setpoints like "12.345": the mantissa and the
+        // power of ten are exact in single precision, so the result is
+        // correctly rounded.
+        if (mantissa <= (1 << 24) && exp10 >= -10 && exp10 <= 10) {
+            return exp10 < 0 ? (float)mantissa / pow10f[-exp10] : (float)mantissa * pow10f[exp10];
+        }
+
+        // Everything else is rare enough for double precision
+        if (exp10 < -400) {
+            return 0.0f;
+        } else if (exp10 > 400) {
+            return std::numeric_limits<float>::infinity();
+        }
+        double result = (double)mantissa;
+        double scale = 1.0;
+        for (int i = exp10 < 0 ? -exp10 : exp10; i > 0; i -= 22) {
+            scale *= (i >= 22) ? 1e22 : pow10d(i);
+            if (scale > 1e300) { // keep the intermediate result finite
+                result = exp10 < 0 ? result / scale : result * scale;
+                scale = 1.0;
+            }
+        }
+        result = exp10 < 0 ? result / scale : result * scale;
+        return (float)result;
+    }
+
+    static double pow10d(int exp) {
+        double result = 1.0;
+        for (int i = 0; i < exp; ++i) {
+            result *= 10.0;
+        }
+        return result;
+    }
+
+    char* pos_;
+    char* end_;
+};
+
+/**
+ * @brief Prunes the optional checksum and comment of one line of the ASCII
+ * protocol and null-terminates the command.
+ *
+ * A line has the form "<command>[*<checksum>][;<comment>]", where the
+ * checksum is the XOR of all bytes before the '*'. Only the first max_len
+ * bytes of the command are kept.
+ *
+ * @param line: The line without its terminator. line[size] is overwritten.
+ * @param len: Set to the length of the command.
+ * @param use_checksum: Set to true if the line has a checksum.
+ * @returns false if the checksum is malformed or doesn't match.
+ */
+inline bool frame_ascii_line(char* line, size_t size, size_t max_len, size_t* len, bool* use_checksum) {
+    // scan line to find beginning of checksum and prune comment
+    uint8_t checksum = 0;
+    size_t checksum_start = SIZE_MAX;
+    for (size_t i = 0; i < size; ++i) {
+        if (line[i] == ';') { // ';' is the comment start char
+            size = i;
+            break;
+        }
+        if (checksum_start > i) {
+            if (line[i] == '*') {
+                checksum_start = i + 1;
+            } else {
+                checksum ^= (uint8_t)line[i];
+            }
+        }
+    }
+
+    *len = size < max_len ? size : max_len;
+
+    // optional checksum validation
+    *use_checksum = (checksum_start < *len);
+    if (*use_checksum) {
+        AsciiParser checksum_parser{line + checksum_start, line + *len};
+        unsigned int received_checksum;
+        if (!checksum_parser.parse_uint(&received_checksum) || (received_checksum != checksum)) {
+            return false;
+        }
+        *len = checksum_start - 1; // prune checksum and asterisk
+    }
+    line[*len] = 0; // null-terminate
+    return true;
+}
+
+#endif // __ASCII_PARSER_HPP
@@ -13,7 +13,7 @@
 #include <utils.hpp>
 #include <fibre/cpp_utils.hpp>
 
-#include "autogen/type_info.hpp"
+#include <fibre/introspection.hpp>
 #include "communication/interface_can.hpp"
 
 using namespace fibre;
@@ -29,12 +29,6 @@ using namespace fibre;
 
 /* Private variables ---------------------------------------------------------*/
 
-#if HW_VERSION_MAJOR == 3
-static Introspectable root_obj = ODrive3TypeInfo<ODrive>::make_introspectable(odrv);
-#elif HW_VERSION_MAJOR == 4
-static Introspectable root_obj = ODrive4TypeInfo<ODrive>::make_introspectable(odrv);
-#endif
-
 /* Private function prototypes -----------------------------------------------*/
 
 /* Function implementations --------------------------------------------------*/
@@ -45,97 +39,80 @@ void AsciiProtocol::respond(bool include_checksum, const char * fmt, TArgs&& ...
     char tx_buf[64];
 
     size_t len = snprintf(tx_buf, sizeof(tx_buf), fmt, std::forward<TArgs>(args)...);
+    send_line(include_checksum, tx_buf, len, sizeof(tx_buf));
+}
 
+// @brief Terminates the line in buf (with the checksum if requested) and sends it.
+// @param len length of the line, may exceed capacity if the line was truncated
+// @param capacity size of buf
+void AsciiProtocol::send_line(bool include_checksum, char* buf, size_t len, size_t capacity) {
     // Silently truncate the output if it's too long for the buffer.
-    len = std::min(len, sizeof(tx_buf));
+    len = std::min(len, capacity);
 
     if (include_checksum) {
         uint8_t checksum = 0;
         for (size_t i = 0; i < len; ++i)
-            checksum ^= tx_buf[i];
-        len += snprintf(tx_buf + len, sizeof(tx_buf) - len, "*%u\r\n", checksum);
+            checksum ^= buf[i];
+        len += snprintf(buf + len, capacity - len, "*%u\r\n", checksum);
     } else {
-        len += snprintf(tx_buf + len, sizeof(tx_buf) - len, "\r\n");
+        len += snprintf(buf + len, capacity - len, "\r\n");
     }
 
     // Silently truncate the output if it's too long for the buffer.
-    len = std::min(len, sizeof(tx_buf));
+    len = std::min(len, capacity);
 
-    sink_.write({(const uint8_t*)tx_buf, len});
+    sink_.write({(const uint8_t*)buf, len});
     sink_.maybe_start_async_write();
 }
 
 
 // @brief Executes an ASCII protocol command
-// @param buffer buffer of ASCII encoded characters
-// @param len size of the buffer
-void AsciiProtocol::process_line(cbufptr_t buffer) {
+// @param buffer buffer of ASCII encoded characters. The line is parsed in
+//        place. The byte after the end of the buffer (the line terminator) may
+//        be overwritten.
+void AsciiProtocol::process_line(bufptr_t buffer) {
     static_assert(sizeof(char) == sizeof(uint8_t));
-    
-    // scan line to find beginning of checksum and prune comment
-    uint8_t checksum = 0;
-    size_t checksum_start = SIZE_MAX;
-    for (size_t i = 0; i < buffer.size(); ++i) {
-        if (buffer.begin()[i] == ';') { // ';' is the comment start char
-            buffer = buffer.take(i);
-            break;
-        }
-        if (checksum_start > i) {
-            if (buffer[i] == '*') {
-                checksum_start = i + 1;
-            } else {
-                checksum ^= buffer[i];
-            }
-        }
-    }
 
-    // copy everything into a local buffer so we can insert null-termination
-    char cmd[MAX_LINE_LENGTH + 1];
-    size_t len = std::min(buffer.size(), MAX_LINE_LENGTH);
-    memcpy(cmd, buffer.begin(), len);
-    cmd[len] = 0; // null-terminate
-
-    // optional checksum validation
-    bool use_checksum = (checksum_start < len);
-    if (use_checksum) {
-        unsigned int received_checksum;
-        int numscan = sscanf(&cmd[checksum_start], "%u", &received_checksum);
-        if ((numscan < 1) || (received_checksum != checksum))
-            return;
-        len = checksum_start - 1; // prune checksum and asterisk
-        cmd[len] = 0; // null-terminate
+    char* cmd = reinterpret_cast<char*>(buffer.begin());
+    size_t len;
+    bool use_checksum;
+    if (!frame_ascii_line(cmd, buffer.size(), MAX_LINE_LENGTH, &len, &use_checksum)) {
+        return;
     }
 
+    AsciiParser args{cmd + std::min(len, (size_t)1), cmd + len};
 
     // check incoming packet type
     switch(cmd[0]) {
-        case 'p': cmd_set_position(cmd, use_checksum);                break;  // position control
-        case 'q': cmd_set_position_wl(cmd, use_checksum);             break;  // position control with limits
-        case 'v': cmd_set_velocity(cmd, use_checksum);                break;  // velocity control
-        case 'c': cmd_set_torque(cmd, use_checksum);                  break;  // current control
-        case 't': cmd_set_trapezoid_trajectory(cmd, use_checksum);    break;  // trapezoidal trajectory
-        case 'f': cmd_get_feedback(cmd, use_checksum);                break;  // feedback
-        case 'h': cmd_help(cmd, use_checksum);                        break;  // Help
-        case 'i': cmd_info_dump(cmd, use_checksum);                   break;  // Dump device info
-        case 's': cmd_system_ctrl(cmd, use_checksum);                 break;  // System
-        case 'r': cmd_read_property(cmd,  use_checksum);              break;  // read property
-        case 'w': cmd_write_property(cmd, use_checksum);              break;  // write property
-        case 'u': cmd_update_axis_wdg(cmd, use_checksum);             break;  // Update axis watchdog. 
-        case 'e': cmd_encoder(cmd, use_checksum);                     break;  // Encoder commands
-        default : cmd_unknown(nullptr, use_checksum);                 break;
+        case 'p': cmd_set_position(args, use_checksum);                break;  // position control
+        case 'q': cmd_set_position_wl(args, use_checksum);             break;  // position control with limits
+        case 'v': cmd_set_velocity(args, use_checksum);                break;  // velocity control
+        case 'c': cmd_set_torque(args, use_checksum);                  break;  // current control
+        case 't': cmd_set_trapezoid_trajectory(args, use_checksum);    break;  // trapezoidal trajectory
+        case 'f': cmd_get_feedback(args, use_checksum);                break;  // feedback
+        case 'h': cmd_help(args, use_checksum);                        break;  // Help
+        case 'i': cmd_info_dump(args, use_checksum);                   break;  // Dump device info
+        case 's': cmd_system_ctrl(args, use_checksum);                 break;  // System
+        case 'r': cmd_read_property(args,  use_checksum);              break;  // read property
+        case 'w': cmd_write_property(args, use_checksum);              break;  // write property
+        case 'u': cmd_update_axis_wdg(args, use_checksum);             break;  // Update axis watchdog. 
+        case 'e': cmd_encoder(args, use_checksum);                     break;  // Encoder commands
+        case 'o': cmd_oscilloscope_read(args, use_checksum);           break;  // Oscilloscope bulk read
+        case 'l': cmd_event_log_read(args, use_checksum);              break;  // Event log read
+        case 'x': cmd_trace_read(args, use_checksum);                  break;  // Trace bulk read
+        default : cmd_unknown(args, use_checksum);                     break;
     }
 }
 
 // @brief Executes the set position command
-// @param pStr buffer of ASCII encoded values
+// @param args arguments of the command (the line after the command character)
 // @param response_channel reference to the stream to respond on
 // @param use_checksum bool to indicate whether a checksum is required on response
-void AsciiProtocol::cmd_set_position(char * pStr, bool use_checksum) {
+void AsciiProtocol::cmd_set_position(AsciiParser& args, bool use_checksum) {
     unsigned motor_number;
     float pos_setpoint, vel_feed_forward, torque_feed_forward;
 
-    int numscan = sscanf(pStr, "p %u %f %f %f", &motor_number, &pos_setpoint, &vel_feed_forward, &torque_feed_forward);
-    if (numscan < 2) {
+    if (!args.parse_uint(&motor_number) || !args.parse_float(&pos_setpoint)) {
         respond(use_checksum, "invalid command format");
     } else if (motor_number >= AXIS_COUNT) {
         respond(use_checksum, "invalid motor %u", motor_number);
@@ -143,25 +120,26 @@ void AsciiProtocol::cmd_set_position(char * pStr, bool use_checksum) {
         Axis& axis = axes[motor_number];
         axis.controller_.config_.control_mode = Controller::CONTROL_MODE_POSITION_CONTROL;
         axis.controller_.input_pos_ = pos_setpoint;
-        if (numscan >= 3)
+        if (args.parse_float(&vel_feed_forward)) {
             axis.controller_.input_vel_ = vel_feed_forward;
-        if (numscan >= 4)
-            axis.controller_.input_torque_ = torque_feed_forward;
+            if (args.parse_float(&torque_feed_forward))
+                axis.controller_.input_torque_ = torque_feed_forward;
+        }
         axis.controller_.input_pos_updated();
+        axis.controller_.tag_input();
         axis.watchdog_feed();
     }
 }
 
 // @brief Executes the set position with current and velocity limit command
-// @param pStr buffer of ASCII encoded values
+// @param args arguments of the command (the line after the command character)
 // @param response_channel reference to the stream to respond on
 // @param use_checksum bool to indicate whether a checksum is required on response
-void AsciiProtocol::cmd_set_position_wl(char * pStr, bool use_checksum) {
+void AsciiProtocol::cmd_set_position_wl(AsciiParser& args, bool use_checksum) {
     unsigned motor_number;
     float pos_setpoint, vel_limit, torque_lim;
 
-    int numscan = sscanf(pStr, "q %u %f %f %f", &motor_number, &pos_setpoint, &vel_limit, &torque_lim);
-    if (numscan < 2) {
+    if (!args.parse_uint(&motor_number) || !args.parse_float(&pos_setpoint)) {
         respond(use_checksum, "invalid command format");
     } else if (motor_number >= AXIS_COUNT) {
         respond(use_checksum, "invalid motor %u", motor_number);
@@ -169,24 +147,25 @@ void AsciiProtocol::cmd_set_position_wl(char * pStr, bool use_checksum) {
         Axis& axis = axes[motor_number];
         axis.controller_.config_.control_mode = Controller::CONTROL_MODE_POSITION_CONTROL;
         axis.controller_.input_pos_ = pos_setpoint;
-        if (numscan >= 3)
+        if (args.parse_float(&vel_limit)) {
             axis.controller_.config_.vel_limit = vel_limit;
-        if (numscan >= 4)
-            axis.motor_.config_.torque_lim = torque_lim;
+            if (args.parse_float(&torque_lim))
+                axis.motor_.config_.torque_lim = torque_lim;
+        }
         axis.controller_.input_pos_updated();
+        axis.controller_.tag_input();
         axis.watchdog_feed();
     }
 }
 
 // @brief Executes the set velocity command
-// @param pStr buffer of ASCII encoded values
+// @param args arguments of the command (the line after the command character)
 // @param response_channel reference to the stream to respond on
 // @param use_checksum bool to indicate whether a checksum is required on response
-void AsciiProtocol::cmd_set_velocity(char * pStr, bool use_checksum) {
+void AsciiProtocol::cmd_set_velocity(AsciiParser& args, bool use_checksum) {
     unsigned motor_number;
     float vel_setpoint, torque_feed_forward;
-    int numscan = sscanf(pStr, "v %u %f %f", &motor_number, &vel_setpoint, &torque_feed_forward);
-    if (numscan < 2) {
+    if (!args.parse_uint(&motor_number) || !args.parse_float(&vel_setpoint)) {
         respond(use_checksum, "invalid command format");
     } else if (motor_number >= AXIS_COUNT) {
         respond(use_checksum, "invalid motor %u", motor_number);
@@ -194,21 +173,22 @@ void AsciiProtocol::cmd_set_velocity(char * pStr, bool use_checksum) {
         Axis& axis = axes[motor_number];
         axis.controller_.config_.control_mode = Controller::CONTROL_MODE_VELOCITY_CONTROL;
         axis.controller_.input_vel_ = vel_setpoint;
-        if (numscan >= 3)
+        if (args.parse_float(&torque_feed_forward))
             axis.controller_.input_torque_ = torque_feed_forward;
+        axis.controller_.tag_input();
         axis.watchdog_feed();
     }
 }
 
 // @brief Executes the set torque control command
-// @param pStr buffer of ASCII encoded values
+// @param args arguments of the command (the line after the command character)
 // @param response_channel reference to the stream to respond on
 // @param use_checksum bool to indicate whether a checksum is required on response
-void AsciiProtocol::cmd_set_torque(char * pStr, bool use_checksum) {
+void AsciiProtocol::cmd_set_torque(AsciiParser& args, bool use_checksum) {
     unsigned motor_number;
     float torque_setpoint;
 
-    if (sscanf(pStr, "c %u %f", &motor_number, &torque_setpoint) < 2) {
+    if (!args.parse_uint(&motor_number) || !args.parse_float(&torque_setpoint)) {
         respond(use_checksum, "invalid command format");
     } else if (motor_number >= AXIS_COUNT) {
         respond(use_checksum, "invalid motor %u", motor_number);
@@ -216,22 +196,21 @@ void AsciiProtocol::cmd_set_torque(char * pStr, bool use_checksum) {
         Axis& axis = axes[motor_number];
         axis.controller_.config_.control_mode = Controller::CONTROL_MODE_TORQUE_CONTROL;
         axis.controller_.input_torque_ = torque_setpoint;
+        axis.controller_.tag_input();
         axis.watchdog_feed();
     }
 }
 
 // @brief Sets the encoder linear count
-// @param pStr buffer of ASCII encoded values
+// @param args arguments of the command (the line after the command character)
 // @param response_channel reference to the stream to respond on
 // @param use_checksum bool to indicate whether a checksum is required on response
-void AsciiProtocol::cmd_encoder(char * pStr, bool use_checksum) {
-    if (pStr[1] == 's') {
-        pStr += 2; // Substring two characters to the right (ok because we have guaranteed null termination after all chars)
-
+void AsciiProtocol::cmd_encoder(AsciiParser& args, bool use_checksum) {
+    if (args.expect('s')) {
         unsigned motor_number;
-        int encoder_count;
+        int32_t encoder_count;
 
-        if (sscanf(pStr, "l %u %i", &motor_number, &encoder_count) < 2) {
+        if (!args.expect('l') || !args.parse_uint(&motor_number) || !args.parse_int(&encoder_count)) {
             respond(use_checksum, "invalid command format");
         } else if (motor_number >= AXIS_COUNT) {
             respond(use_checksum, "invalid motor %u", motor_number);
@@ -239,7 +218,7 @@ void AsciiProtocol::cmd_encoder(char * pStr, bool use_checksum) {
             Axis& axis = axes[motor_number];
             axis.encoder_.set_linear_count(encoder_count);
             axis.watchdog_feed();
-            respond(use_checksum, "encoder set to %u", encoder_count);
+            respond(use_checksum, "encoder set to %u", (unsigned)encoder_count);
         }
     } else {
         respond(use_checksum, "invalid command format");
@@ -247,14 +226,14 @@ void AsciiProtocol::cmd_encoder(char * pStr, bool use_checksum) {
 }
 
 // @brief Executes the set trapezoid trajectory command
-// @param pStr buffer of ASCII encoded values
+// @param args arguments of the command (the line after the command character)
 // @param response_channel reference to the stream to respond on
 // @param use_checksum bool to indicate whether a checksum is required on response
-void AsciiProtocol::cmd_set_trapezoid_trajectory(char* pStr, bool use_checksum) {
+void AsciiProtocol::cmd_set_trapezoid_trajectory(AsciiParser& args, bool use_checksum) {
     unsigned motor_number;
     float goal_point;
 
-    if (sscanf(pStr, "t %u %f", &motor_number, &goal_point) < 2) {
+    if (!args.parse_uint(&motor_number) || !args.parse_float(&goal_point)) {
         respond(use_checksum, "invalid command format");
     } else if (motor_number >= AXIS_COUNT) {
         respond(use_checksum, "invalid motor %u", motor_number);
@@ -264,18 +243,21 @@ void AsciiProtocol::cmd_set_trapezoid_trajectory(char* pStr, bool use_checksum)
         axis.controller_.config_.control_mode = Controller::CONTROL_MODE_POSITION_CONTROL;
         axis.controller_.input_pos_ = goal_point;
         axis.controller_.input_pos_updated();
+        axis.controller_.tag_input();
         axis.watchdog_feed();
     }
 }
 
 // @brief Executes the get position and velocity feedback command
-// @param pStr buffer of ASCII encoded values
+// @param args arguments of the command (the line after the command character)
 // @param response_channel reference to the stream to respond on
 // @param use_checksum bool to indicate whether a checksum is required on response
-void AsciiProtocol::cmd_get_feedback(char * pStr, bool use_checksum) {
+void AsciiProtocol::cmd_get_feedback(AsciiParser& args, bool use_checksum) {
     unsigned motor_number;
 
-    if (sscanf(pStr, "f %u", &motor_number) < 1) {
+    if (args.expect('s')) {
+        cmd_feedback_stream(args, use_checksum);
+    } else if (!args.parse_uint(&motor_number)) {
         respond(use_checksum, "invalid command format");
     } else if (motor_number >= AXIS_COUNT) {
         respond(use_checksum, "invalid motor %u", motor_number);
@@ -287,12 +269,92 @@ void AsciiProtocol::cmd_get_feedback(char * pStr, bool use_checksum) {
     }
 }
 
+// @brief Starts, changes or stops the feedback stream
+// @param args arguments of the command (the line after "fs")
+// @param use_checksum bool to indicate whether a checksum is required on response
+//
+// Format: fs period [axes] [fields]
+// The period is in ms, 0 stops the stream. axes and fields are bit masks that
+// default to all axes and to position and velocity. The feedback lines carry a
+// checksum if this command did.
+void AsciiProtocol::cmd_feedback_stream(AsciiParser& args, bool use_checksum) {
+    unsigned period_ms;
+    unsigned axis_mask = (1 << AXIS_COUNT) - 1;
+    unsigned field_mask = FEEDBACK_FIELD_POS | FEEDBACK_FIELD_VEL;
+
+    if (!args.parse_uint(&period_ms)) {
+        respond(use_checksum, "invalid command format");
+        return;
+    }
+    if (args.parse_uint(&axis_mask)) {
+        args.parse_uint(&field_mask);
+    }
+
+    if (axis_mask == 0 || axis_mask >= (1 << AXIS_COUNT)) {
+        respond(use_checksum, "invalid axes %u", axis_mask);
+    } else if (field_mask == 0 || field_mask >= (FEEDBACK_FIELD_IQ << 1)) {
+        respond(use_checksum, "invalid fields %u", field_mask);
+    } else {
+        feedback_period_ms_ = period_ms;
+        feedback_next_ms_ = HAL_GetTick(); // first line right away
+        feedback_axes_ = axis_mask;
+        feedback_fields_ = field_mask;
+        feedback_checksum_ = use_checksum;
+    }
+}
+
+uint32_t AsciiProtocol::poll_feedback(uint32_t now_ms) {
+    if (!feedback_period_ms_) {
+        return UINT32_MAX;
+    }
+
+    int32_t time_left = (int32_t)(feedback_next_ms_ - now_ms);
+    if (time_left > 0) {
+        return time_left;
+    }
+
+    // Stay on the original schedule unless the stream fell behind by more
+    // than one period (e.g. because the line was too slow)
+    feedback_next_ms_ += feedback_period_ms_;
+    if ((int32_t)(feedback_next_ms_ - now_ms) <= 0) {
+        feedback_next_ms_ = now_ms + feedback_period_ms_;
+    }
+
+    char line[128];
+    size_t len = 1;
+    line[0] = 'F';
+    auto append = [&](float val) {
+        len += snprintf(line + len, sizeof(line) - len, " %f", (double)val);
+        len = std::min(len, sizeof(line) - 1);
+    };
+    for (size_t i = 0; i < AXIS_COUNT; ++i) {
+        if (!(feedback_axes_ & (1 << i))) {
+            continue;
+        }
+        Axis& axis = axes[i];
+        if (feedback_fields_ & FEEDBACK_FIELD_POS)
+            append(axis.encoder_.pos_estimate_.any().value_or(0.0f));
+        if (feedback_fields_ & FEEDBACK_FIELD_VEL)
+            append(axis.encoder_.vel_estimate_.any().value_or(0.0f));
+        if (feedback_fields_ & FEEDBACK_FIELD_IQ)
+            append(axis.motor_.current_control_.Iq_measured_);
+    }
+
+    // Skip this line rather than send part of it if the host doesn't keep up
+    // with the stream. Leaves room for the checksum and line ending.
+    if (len + 6 <= sink_.get_free_space()) {
+        send_line(feedback_checksum_, line, len, sizeof(line));
+    }
+
+    return feedback_next_ms_ - now_ms;
+}
+
 // @brief Shows help text
-// @param pStr buffer of ASCII encoded values
+// @param args arguments of the command (the line after the command character)
 // @param response_channel reference to the stream to respond on
 // @param use_checksum bool to indicate whether a checksum is required on response
-void AsciiProtocol::cmd_help(char * pStr, bool use_checksum) {
-    (void)pStr;
+void AsciiProtocol::cmd_help(AsciiParser& args, bool use_checksum) {
+    (void)args;
     respond(use_checksum, "Please see documentation for more details");
     respond(use_checksum, "");
     respond(use_checksum, "Available commands syntax reference:");
@@ -300,10 +362,15 @@ void AsciiProtocol::cmd_help(char * pStr, bool use_checksum) {
     respond(use_checksum, "Position: p axis pos vel-ff I-ff");
     respond(use_checksum, "Velocity: v axis vel I-ff");
     respond(use_checksum, "Torque: c axis T");
+    respond(use_checksum, "Feedback: f axis");
+    respond(use_checksum, "Feedback stream: fs period-ms [axes] [fields]");
     respond(use_checksum, "");
     respond(use_checksum, "Properties start at odrive root, such as axis0.requested_state");
     respond(use_checksum, "Read: r property");
     respond(use_checksum, "Write: w property value");
+    respond(use_checksum, "Oscilloscope: o index [scale]");
+    respond(use_checksum, "Event log: l [index]");
+    respond(use_checksum, "Trace: x [index]");
     respond(use_checksum, "");
     respond(use_checksum, "Save config: ss");
     respond(use_checksum, "Erase config: se");
@@ -311,10 +378,10 @@ void AsciiProtocol::cmd_help(char * pStr, bool use_checksum) {
 }
 
 // @brief Gets the hardware, firmware and serial details
-// @param pStr buffer of ASCII encoded values
+// @param args arguments of the command (the line after the command character)
 // @param response_channel reference to the stream to respond on
 // @param use_checksum bool to indicate whether a checksum is required on response
-void AsciiProtocol::cmd_info_dump(char * pStr, bool use_checksum) {
+void AsciiProtocol::cmd_info_dump(AsciiParser& args, bool use_checksum) {
     // respond(use_checksum, "Signature: %#x", STM_ID_GetSignature());
     // respond(use_checksum, "Revision: %#x", STM_ID_GetRevision());
     // respond(use_checksum, "Flash Size: %#x KiB", STM_ID_GetFlashSize());
@@ -324,11 +391,11 @@ void AsciiProtocol::cmd_info_dump(char * pStr, bool use_checksum) {
 }
 
 // @brief Executes the system control command
-// @param pStr buffer of ASCII encoded values
+// @param args arguments of the command (the line after the command character)
 // @param response_channel reference to the stream to respond on
 // @param use_checksum bool to indicate whether a checksum is required on response
-void AsciiProtocol::cmd_system_ctrl(char * pStr, bool use_checksum) {
-    switch (pStr[1])
+void AsciiProtocol::cmd_system_ctrl(AsciiParser& args, bool use_checksum) {
+    switch (args.peek())
     {
         case 's':   odrv.save_configuration();  break;  // Save config
         case 'e':   odrv.erase_configuration(); break;  // Erase config
@@ -339,16 +406,18 @@ void AsciiProtocol::cmd_system_ctrl(char * pStr, bool use_checksum) {
 }
 
 // @brief Executes the read parameter command
-// @param pStr buffer of ASCII encoded values
+// @param args arguments of the command (the line after the command character)
 // @param response_channel reference to the stream to respond on
 // @param use_checksum bool to indicate whether a checksum is required on response
-void AsciiProtocol::cmd_read_property(char * pStr, bool use_checksum) {
-    char name[MAX_LINE_LENGTH];
+void AsciiProtocol::cmd_read_property(AsciiParser& args, bool use_checksum) {
+    char* name;
+    char* name_end;
 
-    if (sscanf(pStr, "r %255s", name) < 1) {
+    if (!args.parse_token(&name, &name_end)) {
         respond(use_checksum, "invalid command format");
     } else {
-        Introspectable property = root_obj.get_child(name, sizeof(name));
+        Introspectable property;
+        get_property_by_path(name, name_end - name, &property);
         const StringConvertibleTypeInfo* type_info = dynamic_cast<const StringConvertibleTypeInfo*>(property.get_type_info());
         if (!type_info) {
             respond(use_checksum, "invalid property");
@@ -361,22 +430,29 @@ void AsciiProtocol::cmd_read_property(char * pStr, bool use_checksum) {
 }
 
 // @brief Executes the set write position command
-// @param pStr buffer of ASCII encoded values
+// @param args arguments of the command (the line after the command character)
 // @param response_channel reference to the stream to respond on
 // @param use_checksum bool to indicate whether a checksum is required on response
-void AsciiProtocol::cmd_write_property(char * pStr, bool use_checksum) {
-    char name[MAX_LINE_LENGTH];
-    char value[MAX_LINE_LENGTH];
+void AsciiProtocol::cmd_write_property(AsciiParser& args, bool use_checksum) {
+    char* name;
+    char* name_end;
+    char* value;
+    char* value_end;
 
-    if (sscanf(pStr, "w %255s %255s", name, value) < 1) {
+    if (!args.parse_token(&name, &name_end)) {
         respond(use_checksum, "invalid command format");
     } else {
-        Introspectable property = root_obj.get_child(name, sizeof(name));
+        if (!args.parse_token(&value, &value_end)) {
+            value = value_end = name_end; // empty value
+        }
+        Introspectable property;
+        get_property_by_path(name, name_end - name, &property);
+        *value_end = 0; // null-terminate for set_string(), after the lookup because an empty value ends at the name
         const StringConvertibleTypeInfo* type_info = dynamic_cast<const StringConvertibleTypeInfo*>(property.get_type_info());
         if (!type_info) {
             respond(use_checksum, "invalid property");
         } else {
-            bool success = type_info->set_string(property, value, sizeof(value));
+            bool success = type_info->set_string(property, value, value_end - value + 1);
             if (!success) {
                 respond(use_checksum, "not implemented");
             }
@@ -385,13 +461,13 @@ void AsciiProtocol::cmd_write_property(char * pStr, bool use_checksum) {
 }
 
 // @brief Executes the motor watchdog update command
-// @param pStr buffer of ASCII encoded values
+// @param args arguments of the command (the line after the command character)
 // @param response_channel reference to the stream to respond on
 // @param use_checksum bool to indicate whether a checksum is required on response
-void AsciiProtocol::cmd_update_axis_wdg(char * pStr, bool use_checksum) {
+void AsciiProtocol::cmd_update_axis_wdg(AsciiParser& args, bool use_checksum) {
     unsigned motor_number;
 
-    if (sscanf(pStr, "u %u", &motor_number) < 1) {
+    if (!args.parse_uint(&motor_number)) {
         respond(use_checksum, "invalid command format");
     } else if (motor_number >= AXIS_COUNT) {
         respond(use_checksum, "invalid motor %u", motor_number);
@@ -400,12 +476,128 @@ void AsciiProtocol::cmd_update_axis_wdg(char * pStr, bool use_checksum) {
     }
 }
 
+// @brief Executes the oscilloscope bulk read command
+// @param args arguments of the command (the line after the command character)
+// @param response_channel reference to the stream to respond on
+// @param use_checksum bool to indicate whether a checksum is required on response
+//
+// Responds with the start index followed by a contiguous chunk of the capture
+// in hex. The chunk is sized such that the line fits into one USB packet. The
+// chunk ends early at the end of the capture.
+void AsciiProtocol::cmd_oscilloscope_read(AsciiParser& args, bool use_checksum) {
+    unsigned long index;
+    float scale = 0.0f;
+
+    if (!args.parse_uint(&index)) {
+        respond(use_checksum, "invalid command format");
+        return;
+    }
+    args.parse_float(&scale);
+
+    Oscilloscope& osc = odrv.oscilloscope_;
+    uint32_t total = osc.n_samples_ * std::max<uint32_t>(osc.n_channels_, 1);
+    uint32_t remaining = index < total ? total - index : 0;
+    char hex[49];
+    size_t pos = 0;
+
+    if (scale > 0.0f) {
+        // int16 values of round(val / scale), -32768 marks NaN
+        uint32_t n = std::min<uint32_t>(remaining, 12);
+        for (uint32_t i = 0; i < n; ++i) {
+            float val = osc.get_val(index + i) / scale;
+            int16_t packed = std::isnan(val) ? INT16_MIN
+                           : (int16_t)std::clamp(std::round(val), -32767.0f, 32767.0f);
+            pos += snprintf(hex + pos, sizeof(hex) - pos, "%04x", (unsigned)(uint16_t)packed);
+        }
+    } else {
+        // IEEE 754 bit patterns of the float values
+        uint32_t n = std::min<uint32_t>(remaining, 6);
+        for (uint32_t i = 0; i < n; ++i) {
+            float val = osc.get_val(index + i);
+            uint32_t bits;
+            memcpy(&bits, &val, sizeof(bits));
+            pos += snprintf(hex + pos, sizeof(hex) - pos, "%08lx", (unsigned long)bits);
+        }
+    }
+    hex[pos] = 0;
+
+    respond(use_checksum, "%lu %s", index, hex);
+}
+
+// @brief Executes the event log read command
+// @param args arguments of the command (the line after the command character)
+// @param response_channel reference to the stream to respond on
+// @param use_checksum bool to indicate whether a checksum is required on response
+//
+// Without an index, responds with the total number of events. With an index,
+// responds with the index followed by the timestamp, source and code of up to
+// four consecutive events starting at that one. The chunk ends early at the
+// first event that is no longer (or not yet) in the log, so the response is
+// just the index if the requested event itself is missing.
+void AsciiProtocol::cmd_event_log_read(AsciiParser& args, bool use_checksum) {
+    unsigned long index;
+
+    if (!args.parse_uint(&index)) {
+        respond(use_checksum, "%lu", (unsigned long)event_log.head());
+        return;
+    }
+
+    char line[128];
+    size_t pos = snprintf(line, sizeof(line), "%lu", index);
+    EventLog::Entry_t entry;
+    for (uint32_t i = 0; i < 4 && event_log.read(index + i, &entry); ++i) {
+        pos += snprintf(line + pos, sizeof(line) - pos, " %lu %u %lx", (unsigned long)entry.cycles,
+                        (unsigned)entry.source, (unsigned long)entry.code);
+    }
+
+    send_line(use_checksum, line, pos, sizeof(line));
+}
+
+// @brief Executes the trace bulk read command
+// @param args arguments of the command (the line after the command character)
+// @param response_channel reference to the stream to respond on
+// @param use_checksum bool to indicate whether a checksum is required on response
+//
+// Without an index, responds with trace_head. With an index, responds with
+// the number of the first event, the number of events and the events in hex
+// (16 digits each, as returned by get_trace_event()). A host that fell behind
+// by more than the buffer size gets the oldest events that are still there.
+// The chunk ends early at trace_head.
+void AsciiProtocol::cmd_trace_read(AsciiParser& args, bool use_checksum) {
+    unsigned long index;
+    uint32_t head = odrv.get_trace_head();
+
+    if (!args.parse_uint(&index)) {
+        respond(use_checksum, "%lu", (unsigned long)head);
+        return;
+    }
+
+    uint32_t behind = head - (uint32_t)index;
+    if (behind > 0x80000000UL) {
+        behind = 0; // index is ahead of the head
+    } else if (behind > TRACE_BUFFER_SIZE) {
+        index = head - TRACE_BUFFER_SIZE;
+        behind = TRACE_BUFFER_SIZE;
+    }
+    uint32_t n = std::min<uint32_t>(behind, 6);
+
+    char line[128];
+    size_t pos = snprintf(line, sizeof(line), "%lu %lu ", index, (unsigned long)n);
+    for (uint32_t i = 0; i < n; ++i) {
+        uint64_t evt = odrv.get_trace_event(index + i);
+        pos += snprintf(line + pos, sizeof(line) - pos, "%08lx%08lx",
+                        (unsigned long)(evt >> 32), (unsigned long)(evt & 0xffffffff));
+    }
+
+    send_line(use_checksum, line, pos, sizeof(line));
+}
+
 // @brief Sends the unknown command response
-// @param pStr buffer of ASCII encoded values
+// @param args arguments of the command (the line after the command character)
 // @param response_channel reference to the stream to respond on
 // @param use_checksum bool to indicate whether a checksum is required on response
-void AsciiProtocol::cmd_unknown(char * pStr, bool use_checksum) {
-    (void)pStr;
+void AsciiProtocol::cmd_unknown(AsciiParser& args, bool use_checksum) {
+    (void)args;
     respond(use_checksum, "unknown command");
 }
 
@@ -449,6 +641,7 @@ void AsciiProtocol::on_read_finished(ReadResult result) {
 }
 
 void AsciiProtocol::start() {
+    feedback_period_ms_ = 0; // a new host must request its own stream
     TransferHandle dummy;
     rx_channel_->start_read(rx_buf_, &dummy, MEMBER_CB(this, on_read_finished));
 }
@@ -3,6 +3,7 @@
 
 #include <fibre/async_stream.hpp>
 #include <fibre/../../stream_utils.hpp>
+#include "ascii_parser.hpp"
 
 #define MAX_LINE_LENGTH ((size_t)256)
 
@@ -13,24 +14,44 @@ public:
 
     void start();
 
+    /**
+     * @brief Sends the feedback line of the feedback stream if it's due.
+     * Must be called on the thread that runs the protocol.
+     * @returns The number of milliseconds until the next line is due or
+     *          UINT32_MAX if the feedback stream is off.
+     */
+    uint32_t poll_feedback(uint32_t now_ms);
+
 private:
-    void cmd_set_position(char * pStr, bool use_checksum);
-    void cmd_set_position_wl(char * pStr, bool use_checksum);
-    void cmd_set_velocity(char * pStr, bool use_checksum);
-    void cmd_set_torque(char * pStr, bool use_checksum);
-    void cmd_set_trapezoid_trajectory(char * pStr, bool use_checksum);
-    void cmd_get_feedback(char * pStr, bool use_checksum);
-    void cmd_help(char * pStr, bool use_checksum);
-    void cmd_info_dump(char * pStr, bool use_checksum);
-    void cmd_system_ctrl(char * pStr, bool use_checksum);
-    void cmd_read_property(char * pStr, bool use_checksum);
-    void cmd_write_property(char * pStr, bool use_checksum);
-    void cmd_update_axis_wdg(char * pStr, bool use_checksum);
-    void cmd_unknown(char * pStr, bool use_checksum);
-    void cmd_encoder(char * pStr, bool use_checksum);
+    // Bits of the fields mask of the feedback stream
+    enum : uint8_t {
+        FEEDBACK_FIELD_POS = 1 << 0, // encoder.pos_estimate [turns]
+        FEEDBACK_FIELD_VEL = 1 << 1, // encoder.vel_estimate [turns/s]
+        FEEDBACK_FIELD_IQ = 1 << 2,  // motor.current_control.Iq_measured [A]
+    };
+
+    void cmd_set_position(AsciiParser& args, bool use_checksum);
+    void cmd_set_position_wl(AsciiParser& args, bool use_checksum);
+    void cmd_set_velocity(AsciiParser& args, bool use_checksum);
+    void cmd_set_torque(AsciiParser& args, bool use_checksum);
+    void cmd_set_trapezoid_trajectory(AsciiParser& args, bool use_checksum);
+    void cmd_get_feedback(AsciiParser& args, bool use_checksum);
+    void cmd_feedback_stream(AsciiParser& args, bool use_checksum);
+    void cmd_help(AsciiParser& args, bool use_checksum);
+    void cmd_info_dump(AsciiParser& args, bool use_checksum);
+    void cmd_system_ctrl(AsciiParser& args, bool use_checksum);
+    void cmd_read_property(AsciiParser& args, bool use_checksum);
+    void cmd_write_property(AsciiParser& args, bool use_checksum);
+    void cmd_update_axis_wdg(AsciiParser& args, bool use_checksum);
+    void cmd_unknown(AsciiParser& args, bool use_checksum);
+    void cmd_encoder(AsciiParser& args, bool use_checksum);
+    void cmd_oscilloscope_read(AsciiParser& args, bool use_checksum);
+    void cmd_event_log_read(AsciiParser& args, bool use_checksum);
+    void cmd_trace_read(AsciiParser& args, bool use_checksum);
 
     template<typename ... TArgs> void respond(bool include_checksum, const char * fmt, TArgs&& ... args);
-    void process_line(fibre::cbufptr_t buffer);
+    void send_line(bool include_checksum, char* buf, size_t len, size_t capacity);
+    void process_line(fibre::bufptr_t buffer);
     void on_write_finished(fibre::WriteResult result);
     void on_read_finished(fibre::ReadResult result);
 
@@ -41,6 +62,13 @@ private:
     bool read_active_ = true;
 
     fibre::BufferedStreamSink<512> sink_;
+
+    // Feedback stream (see cmd_feedback_stream())
+    uint32_t feedback_period_ms_ = 0; // 0: off
+    uint32_t feedback_next_ms_ = 0;
+    uint8_t feedback_axes_ = 0;
+    uint8_t feedback_fields_ = 0;
+    bool feedback_checksum_ = false;
 };
 
 #endif // __ASCII_PROTOCOL_HPP
@@ -0,0 +1,93 @@
+#include "can_fibre.hpp"
+
+#include <cmsis_os.h>
+#include <freertos_vars.h>
+#include <odrive_main.h>
+
+using namespace fibre;
+
+void CanFibre::start() {
+    if (!started_) {
+        started_ = true;
+        protocol_.start({});
+    }
+}
+
+void CanFibre::on_frame(const can_Message_t& msg) {
+    link_.on_frame(msg, HAL_GetTick());
+    osSemaphoreRelease(sem_can); // for the flow control frame or the response
+}
+
+uint32_t CanFibre::service(uint32_t tx_id, bool is_extended) {
+    uint32_t now = HAL_GetTick();
+
+    // This runs the endpoint operation and usually starts the response
+    if (rx_completer_ && link_.rx_ready()) {
+        size_t length = std::min(link_.rx_length(), rx_buf_.size());
+        memcpy(rx_buf_.begin(), link_.rx_data(), length);
+        link_.rx_release();
+        uint8_t* rx_end = rx_buf_.begin() + length;
+        rx_buf_ = {nullptr, nullptr};
+        rx_completer_.invoke_and_clear({kStreamOk, rx_end});
+    }
+
+    // May start a notification packet if the TX channel is free
+    uint32_t subscription_timeout = protocol_.poll_subscriptions(now);
+
+    can_Message_t txmsg;
+    txmsg.id = tx_id;
+    txmsg.isExt = is_extended;
+    txmsg.rtr = false;
+    while (link_.next_frame(&txmsg, now)) {
+        if (!canbus_->send_message(txmsg)) {
+            return 1; // TX queue full, retry
+        }
+        link_.frame_sent(now);
+    }
+
+    auto state = link_.tx_state();
+    if (state == CanSegmentedLink<MTU>::TX_DONE || state == CanSegmentedLink<MTU>::TX_FAILED) {
+        link_.tx_reset();
+        const uint8_t* tx_end = state == CanSegmentedLink<MTU>::TX_DONE ? tx_buf_.end() : tx_buf_.begin();
+        tx_buf_ = {nullptr, nullptr};
+        tx_completer_.invoke_and_clear({state == CanSegmentedLink<MTU>::TX_DONE ? kStreamOk : kStreamError, tx_end});
+        osSemaphoreRelease(sem_can); // a request may be waiting for the TX channel
+    }
+
+    // Poll for the minimum gap between frames and for timeouts
+    return (state == CanSegmentedLink<MTU>::TX_IDLE && !link_.rx_ready()) ? subscription_timeout : 1;
+}
+
+void CanFibre::start_read(bufptr_t buffer, TransferHandle* handle, Callback<void, ReadResult> completer) {
+    if (handle) {
+        *handle = reinterpret_cast<TransferHandle>(this);
+    }
+    if (rx_completer_) {
+        completer.invoke({kStreamError, buffer.begin()});
+        return;
+    }
+    rx_buf_ = buffer;
+    rx_completer_ = completer;
+    osSemaphoreRelease(sem_can); // a packet may already be waiting
+}
+
+void CanFibre::cancel_read(TransferHandle transfer_handle) {
+    // not implemented
+}
+
+void CanFibre::start_write(cbufptr_t buffer, TransferHandle* handle, Callback<void, WriteResult> completer) {
+    if (handle) {
+        *handle = reinterpret_cast<TransferHandle>(this);
+    }
+    if (tx_completer_ || !link_.tx_start(buffer.begin(), buffer.size(), HAL_GetTick())) {
+        completer.invoke({kStreamError, buffer.begin()});
+        return;
+    }
+    tx_buf_ = buffer;
+    tx_completer_ = completer;
+    osSemaphoreRelease(sem_can);
+}
+
+void CanFibre::cancel_write(TransferHandle transfer_handle) {
+    // not implemented
+}
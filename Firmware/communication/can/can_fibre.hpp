@@ -0,0 +1,51 @@
+#ifndef __CAN_FIBRE_HPP
+#define __CAN_FIBRE_HPP
+
+#include <fibre/async_stream.hpp>
+#include <fibre/../../legacy_protocol.hpp>
+#include "canbus.hpp"
+#include "can_segmented.hpp"
+
+/**
+ * @brief Fibre endpoint access over CAN.
+ *
+ * The packets of the packet based fibre protocol (the same as on the native
+ * USB interface) are split into CAN frames by CanSegmentedLink. The frames
+ * are received and sent by CANSimple, see MSG_FIBRE.
+ *
+ * All functions run on the CAN thread, including the endpoint handlers.
+ */
+class CanFibre : public fibre::AsyncStreamSource, public fibre::AsyncStreamSink {
+public:
+    static constexpr size_t MTU = 128; // size of the buffers of LegacyProtocolPacketBased
+
+    CanFibre(CanBusBase* canbus) : canbus_(canbus) {}
+
+    void start();
+    void on_frame(const can_Message_t& msg);
+
+    /**
+     * @brief Hands received packets to fibre and sends the pending frames.
+     * @returns Time until the next call is needed [ms]
+     */
+    uint32_t service(uint32_t tx_id, bool is_extended);
+
+    void start_read(fibre::bufptr_t buffer, fibre::TransferHandle* handle, fibre::Callback<void, fibre::ReadResult> completer) final;
+    void cancel_read(fibre::TransferHandle transfer_handle) final;
+    void start_write(fibre::cbufptr_t buffer, fibre::TransferHandle* handle, fibre::Callback<void, fibre::WriteResult> completer) final;
+    void cancel_write(fibre::TransferHandle transfer_handle) final;
+
+private:
+    CanBusBase* canbus_;
+    CanSegmentedLink<MTU> link_;
+    bool started_ = false;
+
+    fibre::bufptr_t rx_buf_ = {nullptr, nullptr};
+    fibre::Callback<void, fibre::ReadResult> rx_completer_;
+    fibre::cbufptr_t tx_buf_ = {nullptr, nullptr};
+    fibre::Callback<void, fibre::WriteResult> tx_completer_;
+
+    fibre::LegacyProtocolPacketBased protocol_{this, this, MTU};
+};
+
+#endif // __CAN_FIBRE_HPP
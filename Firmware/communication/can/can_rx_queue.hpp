@@ -0,0 +1,54 @@
+#ifndef __CAN_RX_QUEUE_HPP
+#define __CAN_RX_QUEUE_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include "can_helpers.hpp"
+
+/**
+ * @brief Ring buffer of received CAN frames from the RX interrupt (the only
+ * producer) to the CAN thread (the only consumer).
+ *
+ * Frames that arrive while the queue is full are dropped and counted.
+ */
+template<size_t N>
+class CanRxQueue {
+    static_assert((N & (N - 1)) == 0, "N must be a power of two");
+
+public:
+    struct Entry_t {
+        can_Message_t msg;
+        uint32_t filter_index; // FilterMatchIndex of the frame
+    };
+
+    bool push(const can_Message_t& msg, uint32_t filter_index) {
+        uint32_t head = head_;
+        if (head - __atomic_load_n(&tail_, __ATOMIC_ACQUIRE) >= N) {
+            n_dropped_++;
+            return false;
+        }
+        entries_[head & (N - 1)] = {msg, filter_index};
+        __atomic_store_n(&head_, head + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    bool pop(Entry_t* entry) {
+        uint32_t tail = tail_;
+        if (tail == __atomic_load_n(&head_, __ATOMIC_ACQUIRE)) {
+            return false;
+        }
+        *entry = entries_[tail & (N - 1)];
+        __atomic_store_n(&tail_, tail + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    uint32_t get_n_dropped() const { return __atomic_load_n(&n_dropped_, __ATOMIC_RELAXED); }
+
+private:
+    Entry_t entries_[N];
+    uint32_t head_ = 0; // only written by the producer
+    uint32_t tail_ = 0; // only written by the consumer
+    uint32_t n_dropped_ = 0;
+};
+
+#endif // __CAN_RX_QUEUE_HPP
@@ -0,0 +1,121 @@
+#ifndef __CAN_SCHEDULER_HPP
+#define __CAN_SCHEDULER_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <array>
+#include <utility>
+
+/**
+ * @brief Deadline ordered set of up to N jobs with the IDs 0 to N-1, used to
+ * send the periodic CAN messages.
+ *
+ * The jobs are kept in a binary min-heap on their deadline, so finding the
+ * next due job is O(1) and (re)scheduling one is O(log N). A job is either
+ * scheduled once or not at all.
+ *
+ * Deadlines are compared by their signed difference so that the 32-bit tick
+ * counter can wrap. All deadlines must be within 2^31 ticks of each other.
+ */
+template<size_t N>
+class DeadlineScheduler {
+public:
+    DeadlineScheduler() { clear(); }
+
+    static bool before(uint32_t a, uint32_t b) {
+        return (int32_t)(a - b) < 0;
+    }
+
+    void clear() {
+        size_ = 0;
+        pos_.fill(INVALID);
+    }
+
+    bool empty() const { return size_ == 0; }
+    size_t size() const { return size_; }
+    bool is_scheduled(size_t id) const { return pos_[id] != INVALID; }
+
+    // @brief The job with the earliest deadline. Only valid if not empty().
+    size_t top() const { return heap_[0].id; }
+    uint32_t top_deadline() const { return heap_[0].deadline; }
+
+    // @brief Schedules the job or moves it to the new deadline
+    void schedule(size_t id, uint32_t deadline) {
+        size_t i = pos_[id];
+        if (i == INVALID) {
+            i = size_++;
+            heap_[i] = {deadline, id};
+            pos_[id] = i;
+            sift_up(i);
+        } else {
+            bool earlier = before(deadline, heap_[i].deadline);
+            heap_[i].deadline = deadline;
+            earlier ? sift_up(i) : sift_down(i);
+        }
+    }
+
+    void cancel(size_t id) {
+        size_t i = pos_[id];
+        if (i == INVALID) {
+            return;
+        }
+        pos_[id] = INVALID;
+        if (i == --size_) {
+            return;
+        }
+        heap_[i] = heap_[size_];
+        pos_[heap_[i].id] = i;
+        if (i > 0 && before(heap_[i].deadline, heap_[(i - 1) / 2].deadline)) {
+            sift_up(i);
+        } else {
+            sift_down(i);
+        }
+    }
+
+private:
+    static constexpr size_t INVALID = SIZE_MAX;
+
+    struct Entry {
+        uint32_t deadline;
+        size_t id;
+    };
+
+    void swap_entries(size_t a, size_t b) {
+        std::swap(heap_[a], heap_[b]);
+        pos_[heap_[a].id] = a;
+        pos_[heap_[b].id] = b;
+    }
+
+    void sift_up(size_t i) {
+        while (i > 0) {
+            size_t parent = (i - 1) / 2;
+            if (!before(heap_[i].deadline, heap_[parent].deadline)) {
+                break;
+            }
+            swap_entries(i, parent);
+            i = parent;
+        }
+    }
+
+    void sift_down(size_t i) {
+        for (;;) {
+            size_t smallest = i;
+            for (size_t child = 2 * i + 1; child <= 2 * i + 2 && child < size_; ++child) {
+                if (before(heap_[child].deadline, heap_[smallest].deadline)) {
+                    smallest = child;
+                }
+            }
+            if (smallest == i) {
+                break;
+            }
+            swap_entries(i, smallest);
+            i = smallest;
+        }
+    }
+
+    std::array<Entry, N> heap_;
+    std::array<size_t, N> pos_; // index of each job in heap_
+    size_t size_ = 0;
+};
+
+#endif // __CAN_SCHEDULER_HPP
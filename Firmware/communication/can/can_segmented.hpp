@@ -0,0 +1,308 @@
+#ifndef __CAN_SEGMENTED_HPP
+#define __CAN_SEGMENTED_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <algorithm>
+#include "can_helpers.hpp"
+
+/**
+ * @brief Transfers packets of up to MAX_SIZE bytes in both directions
+ * between two CAN nodes, similar to ISO-TP (ISO 15765-2).
+ *
+ * The upper nibble of the first data byte is the frame type:
+ *  - 0x0L Single frame: L (1 to 7) data bytes follow.
+ *  - 0x10 First frame: byte 1 is the packet length (8 to MAX_SIZE), 6 data
+ *    bytes follow.
+ *  - 0x2N Consecutive frame: N is the sequence number, starting at 1 after
+ *    the first frame and wrapping from 15 to 0. Up to 7 data bytes follow.
+ *  - 0x3S Flow control, sent by the receiver after the first frame and after
+ *    every block of consecutive frames. S is 0 to continue, 1 to wait for the
+ *    next flow control frame and 2 to abort. Byte 1 is the number of
+ *    consecutive frames in the next block (0 for all), byte 2 the minimum gap
+ *    between consecutive frames in ms.
+ *
+ * The class only builds and parses the data bytes. The caller sends the
+ * frames that next_frame() returns and relays the received ones to
+ * on_frame(). Not thread safe.
+ */
+template<size_t MAX_SIZE>
+class CanSegmentedLink {
+    static_assert(MAX_SIZE >= 8 && MAX_SIZE <= 255, "the length field has 8 bits");
+
+public:
+    static constexpr uint8_t BLOCK_SIZE = 8;        // consecutive frames that we accept per flow control frame
+    static constexpr uint32_t TIMEOUT_MS = 1000;    // max gap between two frames of one packet
+
+    enum : uint8_t {
+        FRAME_SINGLE = 0x00,
+        FRAME_FIRST = 0x10,
+        FRAME_CONSECUTIVE = 0x20,
+        FRAME_FLOW_CONTROL = 0x30,
+    };
+
+    enum : uint8_t {
+        FLOW_CONTINUE = 0,
+        FLOW_WAIT = 1,
+        FLOW_ABORT = 2,
+    };
+
+    enum TxState {
+        TX_IDLE,
+        TX_SENDING,     // next_frame() returns the next frame of the packet
+        TX_WAITING,     // waiting for a flow control frame
+        TX_DONE,
+        TX_FAILED,      // aborted by the receiver or timed out
+    };
+
+    /**
+     * @brief Starts transmitting a packet. The buffer must stay valid until
+     * tx_state() is TX_DONE or TX_FAILED.
+     */
+    bool tx_start(const uint8_t* data, size_t length, uint32_t now) {
+        if (tx_state_ == TX_SENDING || tx_state_ == TX_WAITING || length == 0 || length > MAX_SIZE) {
+            return false;
+        }
+        tx_data_ = data;
+        tx_length_ = length;
+        tx_pos_ = 0;
+        tx_seq_ = 0;
+        tx_block_left_ = 0;
+        tx_next_time_ = now;
+        tx_state_ = TX_SENDING;
+        return true;
+    }
+
+    TxState tx_state() const { return tx_state_; }
+
+    // @brief Stops sending the current packet. The receiver discards it after TIMEOUT_MS.
+    void tx_abort() {
+        tx_state_ = TX_IDLE;
+    }
+
+    // @brief Acknowledges a finished transfer so that tx_state() is TX_IDLE
+    void tx_reset() {
+        if (tx_state_ == TX_DONE || tx_state_ == TX_FAILED) {
+            tx_state_ = TX_IDLE;
+        }
+    }
+
+    // @brief True if a complete packet was received and not released yet
+    bool rx_ready() const { return rx_ready_; }
+    const uint8_t* rx_data() const { return rx_buf_; }
+    size_t rx_length() const { return rx_length_; }
+
+    // @brief Frees the receive buffer for the next packet
+    void rx_release() { rx_ready_ = false; }
+
+    void on_frame(const can_Message_t& msg, uint32_t now) {
+        if (msg.rtr || msg.len < 1) {
+            return;
+        }
+        switch (msg.buf[0] & 0xf0) {
+            case FRAME_SINGLE: on_single(msg); break;
+            case FRAME_FIRST: on_first(msg, now); break;
+            case FRAME_CONSECUTIVE: on_consecutive(msg, now); break;
+            case FRAME_FLOW_CONTROL: on_flow_control(msg, now); break;
+            default: break;
+        }
+    }
+
+    /**
+     * @brief Returns the next frame to send, if any. Only the data of `msg`
+     * is set. Call frame_sent() once it was handed to the bus, otherwise the
+     * same frame is returned again.
+     */
+    bool next_frame(can_Message_t* msg, uint32_t now) {
+        check_timeouts(now);
+
+        if (flow_pending_) {
+            msg->len = 3;
+            msg->buf[0] = FRAME_FLOW_CONTROL | flow_status_;
+            msg->buf[1] = BLOCK_SIZE;
+            msg->buf[2] = 0;
+            return true;
+        }
+
+        if (tx_state_ != TX_SENDING || before(now, tx_next_time_)) {
+            return false;
+        }
+
+        if (tx_pos_ == 0 && tx_length_ <= 7) {
+            msg->len = 1 + tx_length_;
+            msg->buf[0] = FRAME_SINGLE | tx_length_;
+            memcpy(&msg->buf[1], tx_data_, tx_length_);
+        } else if (tx_pos_ == 0) {
+            msg->len = 8;
+            msg->buf[0] = FRAME_FIRST;
+            msg->buf[1] = tx_length_;
+            memcpy(&msg->buf[2], tx_data_, 6);
+        } else {
+            size_t chunk = std::min(tx_length_ - tx_pos_, (size_t)7);
+            msg->len = 1 + chunk;
+            msg->buf[0] = FRAME_CONSECUTIVE | (tx_seq_ & 0x0f);
+            memcpy(&msg->buf[1], tx_data_ + tx_pos_, chunk);
+        }
+        return true;
+    }
+
+    // @brief Call after the frame of next_frame() was sent
+    void frame_sent(uint32_t now) {
+        if (flow_pending_) {
+            flow_pending_ = false;
+            return;
+        }
+        if (tx_state_ != TX_SENDING) {
+            return;
+        }
+
+        if (tx_pos_ == 0 && tx_length_ <= 7) {
+            tx_pos_ = tx_length_;
+        } else if (tx_pos_ == 0) {
+            tx_pos_ = 6;
+            tx_seq_ = 1;
+            wait_for_flow(now);
+            return;
+        } else {
+            tx_pos_ += std::min(tx_length_ - tx_pos_, (size_t)7);
+            tx_seq_++;
+        }
+
+        if (tx_pos_ >= tx_length_) {
+            tx_state_ = TX_DONE;
+        } else if (tx_block_left_ && !--tx_block_left_) {
+            wait_for_flow(now);
+        } else {
+            tx_next_time_ = now + tx_min_gap_;
+        }
+    }
+
+private:
+    static bool before(uint32_t a, uint32_t b) {
+        return (int32_t)(a - b) < 0;
+    }
+
+    void on_single(const can_Message_t& msg) {
+        size_t length = msg.buf[0] & 0x0f;
+        if (length < 1 || length > 7 || length + 1 > msg.len || rx_ready_) {
+            return; // can't be refused, the sender doesn't wait for flow control
+        }
+        rx_active_ = false;
+        memcpy(rx_buf_, &msg.buf[1], length);
+        rx_length_ = length;
+        rx_ready_ = true;
+    }
+
+    void on_first(const can_Message_t& msg, uint32_t now) {
+        size_t length = msg.buf[1];
+        if (msg.len < 8 || length < 8 || length > MAX_SIZE || rx_ready_) {
+            rx_active_ = false;
+            send_flow(FLOW_ABORT);
+            return;
+        }
+        memcpy(rx_buf_, &msg.buf[2], 6);
+        rx_length_ = length;
+        rx_pos_ = 6;
+        rx_seq_ = 1;
+        rx_block_left_ = BLOCK_SIZE;
+        rx_deadline_ = now + TIMEOUT_MS;
+        rx_active_ = true;
+        send_flow(FLOW_CONTINUE);
+    }
+
+    void on_consecutive(const can_Message_t& msg, uint32_t now) {
+        if (!rx_active_) {
+            return;
+        }
+        size_t chunk = std::min(rx_length_ - rx_pos_, (size_t)7);
+        if ((msg.buf[0] & 0x0f) != (rx_seq_ & 0x0f) || msg.len < 1 + chunk) {
+            rx_active_ = false;
+            send_flow(FLOW_ABORT);
+            return;
+        }
+        memcpy(rx_buf_ + rx_pos_, &msg.buf[1], chunk);
+        rx_pos_ += chunk;
+        rx_seq_++;
+        rx_deadline_ = now + TIMEOUT_MS;
+        if (rx_pos_ >= rx_length_) {
+            rx_active_ = false;
+            rx_ready_ = true;
+        } else if (!--rx_block_left_) {
+            rx_block_left_ = BLOCK_SIZE;
+            send_flow(FLOW_CONTINUE);
+        }
+    }
+
+    void on_flow_control(const can_Message_t& msg, uint32_t now) {
+        if (msg.len < 3) {
+            return;
+        }
+        if ((msg.buf[0] & 0x0f) == FLOW_ABORT && tx_state_ == TX_SENDING) {
+            tx_state_ = TX_FAILED; // the receiver gave up in the middle of a block
+            return;
+        }
+        if (tx_state_ != TX_WAITING) {
+            return;
+        }
+        switch (msg.buf[0] & 0x0f) {
+            case FLOW_CONTINUE:
+                tx_block_left_ = msg.buf[1];
+                tx_min_gap_ = msg.buf[2] <= 127 ? msg.buf[2] : 127;
+                tx_next_time_ = now;
+                tx_state_ = TX_SENDING;
+                break;
+            case FLOW_WAIT:
+                tx_deadline_ = now + TIMEOUT_MS;
+                break;
+            default:
+                tx_state_ = TX_FAILED;
+                break;
+        }
+    }
+
+    void send_flow(uint8_t status) {
+        flow_status_ = status;
+        flow_pending_ = true;
+    }
+
+    void wait_for_flow(uint32_t now) {
+        tx_deadline_ = now + TIMEOUT_MS;
+        tx_state_ = TX_WAITING;
+    }
+
+    void check_timeouts(uint32_t now) {
+        if (tx_state_ == TX_WAITING && !before(now, tx_deadline_)) {
+            tx_state_ = TX_FAILED;
+        }
+        if (rx_active_ && !before(now, rx_deadline_)) {
+            rx_active_ = false;
+        }
+    }
+
+    // Transmitter
+    TxState tx_state_ = TX_IDLE;
+    const uint8_t* tx_data_ = nullptr;
+    size_t tx_length_ = 0;
+    size_t tx_pos_ = 0;         // bytes sent
+    uint8_t tx_seq_ = 0;
+    uint8_t tx_block_left_ = 0; // consecutive frames until the next flow control frame, 0 for no limit
+    uint32_t tx_min_gap_ = 0;   // [ms]
+    uint32_t tx_next_time_ = 0;
+    uint32_t tx_deadline_ = 0;  // for the flow control frame
+
+    // Receiver
+    uint8_t rx_buf_[MAX_SIZE];
+    size_t rx_length_ = 0;
+    size_t rx_pos_ = 0;         // bytes received
+    uint8_t rx_seq_ = 0;
+    uint8_t rx_block_left_ = 0;
+    uint32_t rx_deadline_ = 0;  // for the next consecutive frame
+    bool rx_active_ = false;    // a segmented packet is being received
+    bool rx_ready_ = false;
+
+    bool flow_pending_ = false;
+    uint8_t flow_status_ = FLOW_CONTINUE;
+};
+
+#endif // __CAN_SEGMENTED_HPP
@@ -2,15 +2,47 @@
 #include "can_simple.hpp"
 
 #include <odrive_main.h>
+#include <freertos_vars.h>
+#include <cmath>
 #include <functional>
+#include <limits>
 
 bool CANSimple::init() {
+    // The schedule is built on the first call of service_stack()
+    config_changed_ = true;
     for (size_t i = 0; i < AXIS_COUNT; ++i) {
         if (!renew_subscription(i)) {
             return false;
         }
     }
 
+    fibre_enabled_ = odrv.can_.config_.enable_fibre;
+    if (fibre_enabled_) {
+        fibre_.start();
+    }
+
+    sync_enabled_ = odrv.can_.config_.enable_sync;
+    sync_id_ = odrv.can_.config_.sync_id & 0x7ff;
+    if (sync_enabled_) {
+        MsgIdFilterSpecs filter = {.id = (uint16_t)sync_id_, .mask = 0x7ff};
+        if (!canbus_->subscribe(filter, [](void* ctx, const can_Message_t& msg) {
+                ((CANSimple*)ctx)->handle_can_message(msg);
+            }, this, nullptr)) {
+            return false;
+        }
+    }
+
+    board_frames_enabled_ = odrv.can_.config_.enable_board_frames;
+    board_command_id_ = odrv.can_.config_.board_command_id & 0x7ff;
+    if (board_frames_enabled_) {
+        MsgIdFilterSpecs filter = {.id = (uint16_t)board_command_id_, .mask = 0x7ff};
+        if (!canbus_->subscribe(filter, [](void* ctx, const can_Message_t& msg) {
+                ((CANSimple*)ctx)->handle_can_message(msg);
+            }, this, nullptr)) {
+            return false;
+        }
+    }
+
     return true;
 }
 
@@ -45,41 +77,255 @@ void CANSimple::handle_can_message(const can_Message_t& msg) {
     //     Frame
     // nodeID | CMD
     // 6 bits | 5 bits
+    if (is_sync(msg)) {
+        on_sync();
+        return;
+    }
+    if (is_board_command(msg)) {
+        on_board_command(msg);
+        return;
+    }
+
     uint32_t nodeID = get_node_id(msg.id);
 
     for (auto& axis : axes) {
         if ((axis.config_.can.node_id == nodeID) && (axis.config_.can.is_extended == msg.isExt)) {
-            do_command(axis, msg);
+            if (get_cmd_id(msg.id) == MSG_FIBRE) {
+                if (&axis == &axes[0] && fibre_enabled_) {
+                    fibre_.on_frame(msg);
+                }
+            } else {
+                do_command(axis, msg);
+            }
             return;
         }
     }
 }
 
+/**
+ * @brief Applies an input setpoint frame directly from the RX interrupt, see
+ * ODriveCAN::Config_t::enable_fast_setpoints. Returns false for all other
+ * frames so that the CAN thread handles them.
+ */
+bool CANSimple::try_fast_setpoint(const can_Message_t& msg) {
+    if (is_sync(msg)) {
+        on_sync();
+        return true;
+    }
+    if (is_board_command(msg)) {
+        on_board_command(msg);
+        return true;
+    }
+
+    uint32_t nodeID = get_node_id(msg.id);
+    for (size_t i = 0; i < AXIS_COUNT; ++i) {
+        Axis& axis = axes[i];
+        if ((axis.config_.can.node_id == nodeID) && (axis.config_.can.is_extended == msg.isExt)) {
+            LatchedInputs_t inputs;
+            if (!decode_setpoint(msg, sync_enabled_ ? latched_inputs_[i] : inputs)) {
+                return false;
+            }
+            axis.watchdog_feed();
+            publish_inputs(axis.controller_, inputs);
+            return true;
+        }
+    }
+    return false;
+}
+
+// @brief Decodes an input setpoint frame into `inputs`. Returns false for all
+// other frames.
+bool CANSimple::decode_setpoint(const can_Message_t& msg, LatchedInputs_t& inputs) {
+    if (msg.rtr) {
+        return false;
+    }
+    switch (get_cmd_id(msg.id)) {
+        case MSG_SET_INPUT_POS:
+            inputs.pos = {can_getSignal<float>(msg, 0, 32, true),
+                          can_getSignal<int16_t>(msg, 32, 16, true, 0.001f, 0),
+                          can_getSignal<int16_t>(msg, 48, 16, true, 0.001f, 0)};
+            inputs.has_pos = true;
+            return true;
+        case MSG_SET_INPUT_VEL:
+            inputs.vel = {can_getSignal<float>(msg, 0, 32, true),
+                          can_getSignal<float>(msg, 32, 32, true)};
+            inputs.has_vel = true;
+            return true;
+        case MSG_SET_INPUT_TORQUE:
+            inputs.torque = can_getSignal<float>(msg, 0, 32, true);
+            inputs.has_torque = true;
+            return true;
+        default:
+            return false;
+    }
+}
+
+// @brief Hands the decoded setpoints to the next control loop iteration.
+// With SYNC, the latency of the setpoints is measured from here.
+void CANSimple::publish_inputs(Controller& controller, LatchedInputs_t& inputs) {
+    if (!inputs.has_pos && !inputs.has_vel && !inputs.has_torque) {
+        return;
+    }
+    if (inputs.has_pos) {
+        controller.fast_input_pos_.publish(inputs.pos);
+    }
+    if (inputs.has_vel) {
+        controller.fast_input_vel_.publish(inputs.vel);
+    }
+    if (inputs.has_torque) {
+        controller.fast_input_torque_.publish(inputs.torque);
+    }
+    inputs.has_pos = inputs.has_vel = inputs.has_torque = false;
+    controller.tag_input();
+}
+
+bool CANSimple::is_sync(const can_Message_t& msg) const {
+    return sync_enabled_ && !msg.isExt && (msg.id == sync_id_);
+}
+
+// @brief Releases the setpoints latched since the previous SYNC message to
+// the controllers of all axes at once.
+void CANSimple::on_sync() {
+    for (size_t i = 0; i < AXIS_COUNT; ++i) {
+        publish_inputs(axes[i].controller_, latched_inputs_[i]);
+    }
+    n_syncs_ = n_syncs_ + 1;
+}
+
+bool CANSimple::is_board_command(const can_Message_t& msg) const {
+    return board_frames_enabled_ && !msg.isExt && (msg.id == board_command_id_);
+}
+
+/**
+ * @brief Handles the combined setpoint frame of all axes, see
+ * ODriveCAN::Config_t::enable_board_frames.
+ *
+ * Each axis takes 32 bits in the order of the axes, little endian: the
+ * position as int16 in units of board_pos_scale followed by the velocity
+ * feedforward as int16 in units of board_vel_scale. This is Set_Input_Pos
+ * without a torque feedforward, so SYNC and fast setpoints apply the same way.
+ * Frames of another length are ignored.
+ *
+ * Every command frame is answered by one feedback frame.
+ */
+void CANSimple::on_board_command(const can_Message_t& msg) {
+    static_assert(AXIS_COUNT * 32 <= 64, "one frame holds the setpoints of all axes");
+    if (msg.rtr || msg.len != AXIS_COUNT * 4) {
+        return;
+    }
+
+    const float pos_scale = odrv.can_.config_.board_pos_scale;
+    const float vel_scale = odrv.can_.config_.board_vel_scale;
+    for (size_t i = 0; i < AXIS_COUNT; ++i) {
+        LatchedInputs_t inputs;
+        LatchedInputs_t& target = sync_enabled_ ? latched_inputs_[i] : inputs;
+        target.pos = {can_getSignal<int16_t>(msg, 32 * i, 16, true, pos_scale, 0),
+                      can_getSignal<int16_t>(msg, 32 * i + 16, 16, true, vel_scale, 0),
+                      0.0f};
+        target.has_pos = true;
+        axes[i].watchdog_feed();
+        publish_inputs(axes[i].controller_, inputs);
+    }
+
+    board_feedback_pending_ = true;
+    osSemaphoreRelease(sem_can);
+}
+
+// @brief Saturating and rounding conversion to a signal of type T
+template<typename T>
+static T to_raw_signal(float scaled) {
+    if (std::isnan(scaled)) {
+        return 0;
+    } else if (scaled >= (float)std::numeric_limits<T>::max()) {
+        return std::numeric_limits<T>::max();
+    } else if (scaled <= (float)std::numeric_limits<T>::min()) {
+        return std::numeric_limits<T>::min();
+    } else {
+        return (T)std::round(scaled);
+    }
+}
+
+// @brief Position and velocity estimates of all axes in the layout of the
+// combined setpoint frame
+bool CANSimple::send_board_feedback() {
+    const float pos_scale = odrv.can_.config_.board_pos_scale;
+    const float vel_scale = odrv.can_.config_.board_vel_scale;
+
+    can_Message_t txmsg;
+    txmsg.id = odrv.can_.config_.board_feedback_id & 0x7ff;
+    txmsg.isExt = false;
+    txmsg.len = AXIS_COUNT * 4;
+    for (size_t i = 0; i < AXIS_COUNT; ++i) {
+        const Controller& controller = axes[i].controller_;
+        float pos = controller.pos_estimate_linear_src_.any().value_or(0.0f);
+        float vel = controller.vel_estimate_src_.any().value_or(0.0f);
+        can_setSignal<int16_t>(txmsg, to_raw_signal<int16_t>(pos / pos_scale), 32 * i, 16, true);
+        can_setSignal<int16_t>(txmsg, to_raw_signal<int16_t>(vel / vel_scale), 32 * i + 16, 16, true);
+    }
+
+    return canbus_->send_message(txmsg);
+}
+
 void CANSimple::do_command(Axis& axis, const can_Message_t& msg) {
-    const uint32_t cmd = get_cmd_id(msg.id);
     axis.watchdog_feed();
+    if (sync_enabled_ && decode_setpoint(msg, latched_inputs_[axis.axis_num_])) {
+        return; // applied on the next SYNC message
+    }
+    execute_command(axis, msg, canbus_);
+}
+
+/**
+ * @brief Executes a CANSimple frame that arrived on another transport than the
+ * CAN bus (see UartSimple) and sends the response (if any) on reply_bus.
+ *
+ * The frame is addressed by node ID, regardless of whether the axis uses
+ * extended IDs on CAN. Setpoints are applied right away, even if SYNC is
+ * enabled. Segmented fibre frames are not supported.
+ * Can be called from any thread that may set the inputs of the axes.
+ *
+ * @returns False if no axis has the node ID of the frame.
+ */
+bool CANSimple::execute_frame(const can_Message_t& msg, CanBusBase* reply_bus) {
+    uint32_t nodeID = get_node_id(msg.id);
+
+    for (auto& axis : axes) {
+        if (axis.config_.can.node_id == nodeID) {
+            if (get_cmd_id(msg.id) != MSG_FIBRE) {
+                axis.watchdog_feed();
+                execute_command(axis, msg, reply_bus);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+void CANSimple::execute_command(Axis& axis, const can_Message_t& msg, CanBusBase* reply_bus) {
+    const uint32_t cmd = get_cmd_id(msg.id);
     switch (cmd) {
         case MSG_CO_NMT_CTRL:
             break;
         case MSG_CO_HEARTBEAT_CMD:
             break;
         case MSG_ODRIVE_HEARTBEAT:
-            // We don't currently do anything to respond to ODrive heartbeat messages
+            // Heartbeats of other nodes are ignored but a request is answered
+            if (msg.rtr || msg.len == 0)
+                send_heartbeat(axis, reply_bus);
             break;
         case MSG_ODRIVE_ESTOP:
             estop_callback(axis, msg);
             break;
         case MSG_GET_MOTOR_ERROR:
             if (msg.rtr || msg.len == 0)
-                get_motor_error_callback(axis);
+                get_motor_error_callback(axis, reply_bus);
             break;
         case MSG_GET_ENCODER_ERROR:
             if (msg.rtr || msg.len == 0)
-                get_encoder_error_callback(axis);
+                get_encoder_error_callback(axis, reply_bus);
             break;
         case MSG_GET_SENSORLESS_ERROR:
             if (msg.rtr || msg.len == 0)
-                get_sensorless_error_callback(axis);
+                get_sensorless_error_callback(axis, reply_bus);
             break;
         case MSG_SET_AXIS_NODE_ID:
             set_axis_nodeid_callback(axis, msg);
@@ -92,11 +338,11 @@ void CANSimple::do_command(Axis& axis, const can_Message_t& msg) {
             break;
         case MSG_GET_ENCODER_ESTIMATES:
             if (msg.rtr || msg.len == 0)
-                get_encoder_estimates_callback(axis);
+                get_encoder_estimates_callback(axis, reply_bus);
             break;
         case MSG_GET_ENCODER_COUNT:
             if (msg.rtr || msg.len == 0)
-                get_encoder_count_callback(axis);
+                get_encoder_count_callback(axis, reply_bus);
             break;
         case MSG_SET_INPUT_POS:
             set_input_pos_callback(axis, msg);
@@ -127,18 +373,18 @@ void CANSimple::do_command(Axis& axis, const can_Message_t& msg) {
             break;
         case MSG_GET_IQ:
             if (msg.rtr || msg.len == 0)
-                get_iq_callback(axis);
+                get_iq_callback(axis, reply_bus);
             break;
         case MSG_GET_SENSORLESS_ESTIMATES:
             if (msg.rtr || msg.len == 0)
-                get_sensorless_estimates_callback(axis);
+                get_sensorless_estimates_callback(axis, reply_bus);
             break;
         case MSG_RESET_ODRIVE:
-            NVIC_SystemReset();
+            odrv.reboot();
             break;
         case MSG_GET_BUS_VOLTAGE_CURRENT:
             if (msg.rtr || msg.len == 0)
-                get_bus_voltage_current_callback(axis);
+                get_bus_voltage_current_callback(axis, reply_bus);
             break;
         case MSG_CLEAR_ERRORS:
             clear_errors_callback(axis, msg);
@@ -153,10 +399,10 @@ void CANSimple::do_command(Axis& axis, const can_Message_t& msg) {
             set_vel_gains_callback(axis, msg);
             break;
         case MSG_GET_ADC_VOLTAGE:
-            get_adc_voltage_callback(axis, msg);
+            get_adc_voltage_callback(axis, msg, reply_bus);
             break;
         case MSG_GET_CONTROLLER_ERROR:
-            get_controller_error_callback(axis);
+            get_controller_error_callback(axis, reply_bus);
             break;
         default:
             break;
@@ -171,7 +417,7 @@ void CANSimple::estop_callback(Axis& axis, const can_Message_t& msg) {
     axis.error_ |= Axis::ERROR_ESTOP_REQUESTED;
 }
 
-bool CANSimple::get_motor_error_callback(const Axis& axis) {
+bool CANSimple::get_motor_error_callback(const Axis& axis, CanBusBase* bus) {
     can_Message_t txmsg;
     txmsg.id = axis.config_.can.node_id << NUM_CMD_ID_BITS;
     txmsg.id += MSG_GET_MOTOR_ERROR;  // heartbeat ID
@@ -180,10 +426,10 @@ bool CANSimple::get_motor_error_callback(const Axis& axis) {
 
     can_setSignal(txmsg, axis.motor_.error_, 0, 64, true);
 
-    return canbus_->send_message(txmsg);
+    return bus->send_message(txmsg);
 }
 
-bool CANSimple::get_encoder_error_callback(const Axis& axis) {
+bool CANSimple::get_encoder_error_callback(const Axis& axis, CanBusBase* bus) {
     can_Message_t txmsg;
     txmsg.id = axis.config_.can.node_id << NUM_CMD_ID_BITS;
     txmsg.id += MSG_GET_ENCODER_ERROR;  // heartbeat ID
@@ -192,10 +438,10 @@ bool CANSimple::get_encoder_error_callback(const Axis& axis) {
 
     can_setSignal(txmsg, axis.encoder_.error_, 0, 32, true);
 
-    return canbus_->send_message(txmsg);
+    return bus->send_message(txmsg);
 }
 
-bool CANSimple::get_sensorless_error_callback(const Axis& axis) {
+bool CANSimple::get_sensorless_error_callback(const Axis& axis, CanBusBase* bus) {
     can_Message_t txmsg;
     txmsg.id = axis.config_.can.node_id << NUM_CMD_ID_BITS;
     txmsg.id += MSG_GET_SENSORLESS_ERROR;  // heartbeat ID
@@ -204,10 +450,10 @@ bool CANSimple::get_sensorless_error_callback(const Axis& axis) {
 
     can_setSignal(txmsg, axis.sensorless_estimator_.error_, 0, 32, true);
 
-    return canbus_->send_message(txmsg);
+    return bus->send_message(txmsg);
 }
 
-bool CANSimple::get_controller_error_callback(const Axis& axis) {
+bool CANSimple::get_controller_error_callback(const Axis& axis, CanBusBase* bus) {
     can_Message_t txmsg;
     txmsg.id = axis.config_.can.node_id << NUM_CMD_ID_BITS;
     txmsg.id += MSG_GET_CONTROLLER_ERROR;  // heartbeat ID
@@ -216,22 +462,22 @@ bool CANSimple::get_controller_error_callback(const Axis& axis) {
 
     can_setSignal(txmsg, axis.controller_.error_, 0, 32, true);
 
-    return canbus_->send_message(txmsg);
+    return bus->send_message(txmsg);
 }
 
 void CANSimple::set_axis_nodeid_callback(Axis& axis, const can_Message_t& msg) {
-    axis.config_.can.node_id = can_getSignal<uint32_t>(msg, 0, 32, true);
+    axis.config_.can.set_node_id(can_getSignal<uint32_t>(msg, 0, 32, true));
 }
 
 void CANSimple::set_axis_requested_state_callback(Axis& axis, const can_Message_t& msg) {
-    axis.requested_state_ = static_cast<Axis::AxisState>(can_getSignal<int32_t>(msg, 0, 32, true));
+    axis.request_state(static_cast<Axis::AxisState>(can_getSignal<int32_t>(msg, 0, 32, true)));
 }
 
 void CANSimple::set_axis_startup_config_callback(Axis& axis, const can_Message_t& msg) {
     // Not Implemented
 }
 
-bool CANSimple::get_encoder_estimates_callback(const Axis& axis) {
+bool CANSimple::get_encoder_estimates_callback(const Axis& axis, CanBusBase* bus) {
     can_Message_t txmsg;
     txmsg.id = axis.config_.can.node_id << NUM_CMD_ID_BITS;
     txmsg.id += MSG_GET_ENCODER_ESTIMATES;  // heartbeat ID
@@ -241,10 +487,10 @@ bool CANSimple::get_encoder_estimates_callback(const Axis& axis) {
     can_setSignal<float>(txmsg, axis.controller_.pos_estimate_linear_src_.any().value_or(0.0f), 0, 32, true);
     can_setSignal<float>(txmsg, axis.controller_.vel_estimate_src_.any().value_or(0.0f), 32, 32, true);
 
-    return canbus_->send_message(txmsg);
+    return bus->send_message(txmsg);
 }
 
-bool CANSimple::get_sensorless_estimates_callback(const Axis& axis) {
+bool CANSimple::get_sensorless_estimates_callback(const Axis& axis, CanBusBase* bus) {
     can_Message_t txmsg;
     txmsg.id = axis.config_.can.node_id << NUM_CMD_ID_BITS;
     txmsg.id += MSG_GET_SENSORLESS_ESTIMATES;  // heartbeat ID
@@ -256,19 +502,19 @@ bool CANSimple::get_sensorless_estimates_callback(const Axis& axis) {
     can_setSignal<float>(txmsg, axis.sensorless_estimator_.pll_pos_, 0, 32, true);
     can_setSignal<float>(txmsg, axis.sensorless_estimator_.vel_estimate_.any().value_or(0.0f), 32, 32, true);
 
-    return canbus_->send_message(txmsg);
+    return bus->send_message(txmsg);
 }
 
-bool CANSimple::get_encoder_count_callback(const Axis& axis) {
+bool CANSimple::get_encoder_count_callback(const Axis& axis, CanBusBase* bus) {
     can_Message_t txmsg;
     txmsg.id = axis.config_.can.node_id << NUM_CMD_ID_BITS;
     txmsg.id += MSG_GET_ENCODER_COUNT;
     txmsg.isExt = axis.config_.can.is_extended;
     txmsg.len = 8;
 
-    can_setSignal<int32_t>(txmsg, axis.encoder_.shadow_count_, 0, 32, true);
+    can_setSignal<int32_t>(txmsg, (int32_t)axis.encoder_.shadow_count_, 0, 32, true);
     can_setSignal<int32_t>(txmsg, axis.encoder_.count_in_cpr_, 32, 32, true);
-    return canbus_->send_message(txmsg);
+    return bus->send_message(txmsg);
 }
 
 void CANSimple::set_input_pos_callback(Axis& axis, const can_Message_t& msg) {
@@ -276,15 +522,18 @@ void CANSimple::set_input_pos_callback(Axis& axis, const can_Message_t& msg) {
     axis.controller_.input_vel_ = can_getSignal<int16_t>(msg, 32, 16, true, 0.001f, 0);
     axis.controller_.input_torque_ = can_getSignal<int16_t>(msg, 48, 16, true, 0.001f, 0);
     axis.controller_.input_pos_updated();
+    axis.controller_.tag_input();
 }
 
 void CANSimple::set_input_vel_callback(Axis& axis, const can_Message_t& msg) {
     axis.controller_.input_vel_ = can_getSignal<float>(msg, 0, 32, true);
     axis.controller_.input_torque_ = can_getSignal<float>(msg, 32, 32, true);
+    axis.controller_.tag_input();
 }
 
 void CANSimple::set_input_torque_callback(Axis& axis, const can_Message_t& msg) {
     axis.controller_.input_torque_ = can_getSignal<float>(msg, 0, 32, true);
+    axis.controller_.tag_input();
 }
 
 void CANSimple::set_controller_modes_callback(Axis& axis, const can_Message_t& msg) {
@@ -329,7 +578,7 @@ void CANSimple::set_vel_gains_callback(Axis& axis, const can_Message_t& msg) {
     axis.controller_.config_.vel_integrator_gain = can_getSignal<float>(msg, 32, 32, true);
 }
 
-bool CANSimple::get_iq_callback(const Axis& axis) {
+bool CANSimple::get_iq_callback(const Axis& axis, CanBusBase* bus) {
     can_Message_t txmsg;
     txmsg.id = axis.config_.can.node_id << NUM_CMD_ID_BITS;
     txmsg.id += MSG_GET_IQ;
@@ -346,10 +595,10 @@ bool CANSimple::get_iq_callback(const Axis& axis) {
     can_setSignal<float>(txmsg, Idq_setpoint->second, 0, 32, true);
     can_setSignal<float>(txmsg, axis.motor_.current_control_.Iq_measured_, 32, 32, true);
 
-    return canbus_->send_message(txmsg);
+    return bus->send_message(txmsg);
 }
 
-bool CANSimple::get_bus_voltage_current_callback(const Axis& axis) {
+bool CANSimple::get_bus_voltage_current_callback(const Axis& axis, CanBusBase* bus) {
     can_Message_t txmsg;
 
     txmsg.id = axis.config_.can.node_id << NUM_CMD_ID_BITS;
@@ -362,10 +611,10 @@ bool CANSimple::get_bus_voltage_current_callback(const Axis& axis) {
     can_setSignal<float>(txmsg, vbus_voltage, 0, 32, true);
     can_setSignal<float>(txmsg, ibus_, 32, 32, true);
 
-    return canbus_->send_message(txmsg);
+    return bus->send_message(txmsg);
 }
 
-bool CANSimple::get_adc_voltage_callback(const Axis& axis, const can_Message_t& msg) {
+bool CANSimple::get_adc_voltage_callback(const Axis& axis, const can_Message_t& msg, CanBusBase* bus) {
     can_Message_t txmsg;
 
     txmsg.id = axis.config_.can.node_id << NUM_CMD_ID_BITS;
@@ -377,7 +626,7 @@ bool CANSimple::get_adc_voltage_callback(const Axis& axis, const can_Message_t&
     if (gpio_num < GPIO_COUNT) {
         auto voltage = get_adc_voltage(get_gpio(gpio_num));
         can_setSignal<float>(txmsg, voltage, 0, 32, true);
-        return canbus_->send_message(txmsg);
+        return bus->send_message(txmsg);
     } else {
         return false;
     }
@@ -387,11 +636,52 @@ void CANSimple::clear_errors_callback(Axis& axis, const can_Message_t& msg) {
     odrv.clear_errors();  // TODO: might want to clear axis errors only
 }
 
-uint32_t CANSimple::service_stack() {
-    uint32_t nextServiceTime = UINT32_MAX;
-    uint32_t now = HAL_GetTick();
+// Periodic messages of each axis, in the order of their job IDs
+const CANSimple::AxisPeriodic CANSimple::axis_periodics_[N_AXIS_PERIODICS] = {
+    {&Axis::CANConfig_t::heartbeat_rate_ms, &CANSimple::send_heartbeat},
+    {&Axis::CANConfig_t::encoder_rate_ms, &CANSimple::get_encoder_estimates_callback},
+    {&Axis::CANConfig_t::motor_error_rate_ms, &CANSimple::get_motor_error_callback},
+    {&Axis::CANConfig_t::encoder_error_rate_ms, &CANSimple::get_encoder_error_callback},
+    {&Axis::CANConfig_t::controller_error_rate_ms, &CANSimple::get_controller_error_callback},
+    {&Axis::CANConfig_t::sensorless_error_rate_ms, &CANSimple::get_sensorless_error_callback},
+    {&Axis::CANConfig_t::encoder_count_rate_ms, &CANSimple::get_encoder_count_callback},
+    {&Axis::CANConfig_t::iq_rate_ms, &CANSimple::get_iq_callback},
+    {&Axis::CANConfig_t::sensorless_rate_ms, &CANSimple::get_sensorless_estimates_callback},
+    {&Axis::CANConfig_t::bus_vi_rate_ms, &CANSimple::get_bus_voltage_current_callback},
+};
+
+// @brief Called from any thread after a node ID or a rate was changed
+void CANSimple::on_config_changed() {
+    config_changed_ = true;
+    osSemaphoreRelease(sem_can);
+}
+
+uint32_t CANSimple::job_rate(size_t job) const {
+    if (job < AXIS_COUNT * N_AXIS_PERIODICS) {
+        const Axis& axis = axes[job / N_AXIS_PERIODICS];
+        return axis.config_.can.*axis_periodics_[job % N_AXIS_PERIODICS].rate;
+    }
+    return odrv.can_.config_.cyclic_frames[job - AXIS_COUNT * N_AXIS_PERIODICS].rate_ms;
+}
 
-    // TODO: remove this polling loop and replace with protocol hook
+bool CANSimple::run_job(size_t job) {
+    if (job < AXIS_COUNT * N_AXIS_PERIODICS) {
+        Axis& axis = axes[job / N_AXIS_PERIODICS];
+        bool success = false;
+        MEASURE_TIME(axis.task_times_.can_heartbeat) {
+            success = std::invoke(axis_periodics_[job % N_AXIS_PERIODICS].callback, this, axis, canbus_);
+        }
+        return success;
+    }
+    return send_cyclic_frame(job - AXIS_COUNT * N_AXIS_PERIODICS);
+}
+
+/**
+ * @brief Brings the subscriptions and the schedule in line with the config.
+ * Jobs whose rate didn't change keep their deadline, new ones are due
+ * immediately.
+ */
+void CANSimple::apply_config_changes(uint32_t now) {
     for (size_t i = 0; i < AXIS_COUNT; ++i) {
         bool node_id_changed = (axes[i].config_.can.node_id != node_ids_[i]) || (axes[i].config_.can.is_extended != extended_node_ids_[i]);
         if (node_id_changed) {
@@ -399,46 +689,155 @@ uint32_t CANSimple::service_stack() {
         }
     }
 
-    struct periodic {
-        const uint32_t& rate;
-        uint32_t& last_time;
-        bool (CANSimple::* callback)(const Axis& axis);
-    };
+    for (size_t job = 0; job < N_JOBS; ++job) {
+        uint32_t rate = job_rate(job);
+        if (rate == 0) {
+            scheduler_.cancel(job);
+        } else if (rate != job_rates_[job] || !scheduler_.is_scheduled(job)) {
+            scheduler_.schedule(job, now);
+        }
+        job_rates_[job] = rate;
+    }
+}
 
-    for (auto& axis : axes) {
-        std::array<periodic, 10> periodics = {{
-            {axis.config_.can.heartbeat_rate_ms, axis.can_.last_heartbeat, &CANSimple::send_heartbeat},
-            {axis.config_.can.encoder_rate_ms, axis.can_.last_encoder, &CANSimple::get_encoder_estimates_callback},
-            {axis.config_.can.motor_error_rate_ms, axis.can_.last_motor_error, &CANSimple::get_motor_error_callback},
-            {axis.config_.can.encoder_error_rate_ms, axis.can_.last_encoder_error, &CANSimple::get_encoder_error_callback},
-            {axis.config_.can.controller_error_rate_ms, axis.can_.last_controller_error, &CANSimple::get_controller_error_callback},
-            {axis.config_.can.sensorless_error_rate_ms, axis.can_.last_sensorless_error, &CANSimple::get_sensorless_error_callback},
-            {axis.config_.can.encoder_count_rate_ms, axis.can_.last_encoder_count, &CANSimple::get_encoder_count_callback},
-            {axis.config_.can.iq_rate_ms, axis.can_.last_iq, &CANSimple::get_iq_callback},
-            {axis.config_.can.sensorless_rate_ms, axis.can_.last_sensorless, &CANSimple::get_sensorless_estimates_callback},
-            {axis.config_.can.bus_vi_rate_ms, axis.can_.last_bus_vi, &CANSimple::get_bus_voltage_current_callback},
-        }};
+uint32_t CANSimple::service_stack() {
+    uint32_t nextServiceTime = UINT32_MAX;
+    uint32_t now = HAL_GetTick();
 
-        MEASURE_TIME(axis.task_times_.can_heartbeat) {
-            for (auto& msg : periodics) {
-                if (msg.rate > 0) {
-                    if ((now - msg.last_time) >= msg.rate) {
-                        if (std::invoke(msg.callback, this, axis)) {
-                            msg.last_time = now;
-                        }
-                    }
-
-                    int nextAxisService = msg.last_time + msg.rate - now;
-                    nextServiceTime = std::min(nextServiceTime, static_cast<uint32_t>(std::max(0, nextAxisService)));
-                }
+    if (config_changed_) {
+        config_changed_ = false;
+        apply_config_changes(now);
+    }
+
+    for (auto& axis : axes) {
+        // Events go out as soon as the control loop flagged them
+        uint32_t events;
+        CRITICAL_SECTION() {
+            events = axis.can_.pending_events;
+            axis.can_.pending_events = 0;
+        }
+        if (events && !send_event(axis, events)) {
+            CRITICAL_SECTION() {
+                axis.can_.pending_events = axis.can_.pending_events | events;
             }
+            nextServiceTime = 0;
         }
     }
 
+    // A feedback frame that doesn't fit into the TX queue is retried, but
+    // several command frames are only answered once
+    if (board_feedback_pending_) {
+        board_feedback_pending_ = false;
+        if (!send_board_feedback()) {
+            board_feedback_pending_ = true;
+            nextServiceTime = 0;
+        }
+    }
+
+    // Send the due messages in deadline order. If the TX queue is full of
+    // higher priority frames the rest waits until a mailbox frees up (which
+    // wakes this thread).
+    while (!scheduler_.empty() && !DeadlineScheduler<N_JOBS>::before(now, scheduler_.top_deadline())) {
+        size_t job = scheduler_.top();
+        uint32_t deadline = scheduler_.top_deadline();
+        if (!run_job(job)) {
+            nextServiceTime = 0;
+            break;
+        }
+        // Keep the phase of the message unless it fell behind by more than a
+        // period, in which case the missed messages are skipped
+        uint32_t next = deadline + job_rates_[job];
+        if (DeadlineScheduler<N_JOBS>::before(next, now)) {
+            next = now + job_rates_[job];
+        }
+        scheduler_.schedule(job, next);
+    }
+
+    if (fibre_enabled_) {
+        const Axis& axis = axes[AXIS_COUNT - 1];
+        uint32_t fibre_id = (axis.config_.can.node_id << NUM_CMD_ID_BITS) | MSG_FIBRE;
+        nextServiceTime = std::min(nextServiceTime, fibre_.service(fibre_id, axis.config_.can.is_extended));
+    }
+
+    if (!scheduler_.empty()) {
+        uint32_t wait = DeadlineScheduler<N_JOBS>::before(now, scheduler_.top_deadline()) ? scheduler_.top_deadline() - now : 0;
+        nextServiceTime = std::min(nextServiceTime, wait);
+    }
+
     return nextServiceTime;
 }
 
-bool CANSimple::send_heartbeat(const Axis& axis) {
+/**
+ * @brief Packs the signals of a user defined cyclic frame into one message.
+ *
+ * Integer signals are rounded and saturated, an unreadable property is sent
+ * as 0 (NaN for FLOAT32). Signals that don't fit into the 8 data bytes
+ * anymore are left out.
+ */
+bool CANSimple::send_cyclic_frame(size_t i) {
+    const ODriveCAN::CyclicFrame_t& frame = odrv.can_.config_.cyclic_frames[i];
+    can_Message_t txmsg;
+    txmsg.id = frame.id;
+    txmsg.isExt = frame.is_extended;
+
+    uint8_t offset = 0;
+    for (const ODriveCAN::CyclicSignal_t& signal : frame.signals) {
+        FloatEndpointReader reader;
+        float val = NAN;
+        if (fibre::get_float_endpoint_reader(signal.endpoint, &reader)) {
+            reader.read(&val);
+        }
+        float scaled = val / (signal.scale != 0.0f ? signal.scale : 1.0f);
+
+        auto put_int = [&](auto type_tag, uint8_t size) {
+            using T = decltype(type_tag);
+            if (offset + size > 8) {
+                return;
+            }
+            can_setSignal<T>(txmsg, to_raw_signal<T>(scaled), offset * 8, size * 8, true);
+            offset += size;
+        };
+
+        switch (signal.type) {
+            case ODriveCAN::SIGNAL_TYPE_INT8: put_int(int8_t{}, 1); break;
+            case ODriveCAN::SIGNAL_TYPE_UINT8: put_int(uint8_t{}, 1); break;
+            case ODriveCAN::SIGNAL_TYPE_INT16: put_int(int16_t{}, 2); break;
+            case ODriveCAN::SIGNAL_TYPE_UINT16: put_int(uint16_t{}, 2); break;
+            case ODriveCAN::SIGNAL_TYPE_INT32: put_int(int32_t{}, 4); break;
+            case ODriveCAN::SIGNAL_TYPE_FLOAT32:
+                if (offset + 4 <= 8) {
+                    can_setSignal<float>(txmsg, scaled, offset * 8, 32, true);
+                    offset += 4;
+                }
+                break;
+            default: break;
+        }
+    }
+    txmsg.len = offset;
+
+    return canbus_->send_message(txmsg);
+}
+
+bool CANSimple::send_event(const Axis& axis, uint32_t events) {
+    can_Message_t txmsg;
+    txmsg.id = axis.config_.can.node_id << NUM_CMD_ID_BITS;
+    txmsg.id += MSG_ODRIVE_EVENT;
+    txmsg.isExt = axis.config_.can.is_extended;
+    txmsg.len = 8;
+
+    can_setSignal(txmsg, axis.error_, 0, 32, true);
+    can_setSignal(txmsg, uint8_t(axis.current_state_), 32, 8, true);
+    can_setSignal(txmsg, uint8_t(events), 40, 8, true);
+
+    // Same layout as the controller flags of the heartbeat
+    uint8_t controllerFlags = axis.controller_.error_ != 0;
+    controllerFlags |= uint8_t(axis.controller_.trajectory_done_) << 7;
+    can_setSignal(txmsg, controllerFlags, 48, 8, true);
+
+    return canbus_->send_message(txmsg);
+}
+
+bool CANSimple::send_heartbeat(const Axis& axis, CanBusBase* bus) {
     can_Message_t txmsg;
     txmsg.id = axis.config_.can.node_id << NUM_CMD_ID_BITS;
     txmsg.id += MSG_ODRIVE_HEARTBEAT;  // heartbeat ID
@@ -463,5 +862,5 @@ bool CANSimple::send_heartbeat(const Axis& axis) {
     can_setSignal(txmsg, encoderFlags, 48, 8, true);
     can_setSignal(txmsg, controllerFlags, 56, 8, true);
 
-    return canbus_->send_message(txmsg);
+    return bus->send_message(txmsg);
 }
@@ -2,8 +2,14 @@
 #define __CAN_SIMPLE_HPP_
 
 #include "canbus.hpp"
+#include "can_scheduler.hpp"
+#include "can_fibre.hpp"
 #include "axis.hpp"
 
+// User defined cyclic frames, see ODriveCAN::CyclicFrame_t
+#define CAN_CYCLIC_FRAMES 4
+#define CAN_CYCLIC_SIGNALS 4 // per frame
+
 class CANSimple {
    public:
     enum {
@@ -37,35 +43,77 @@ class CANSimple {
         MSG_SET_VEL_GAINS,
         MSG_GET_ADC_VOLTAGE,
         MSG_GET_CONTROLLER_ERROR,
+        MSG_ODRIVE_EVENT,
+        MSG_FIBRE,  // segmented fibre packets, see CanFibre
         MSG_CO_HEARTBEAT_CMD = 0x700,  // CANOpen NMT Heartbeat  SEND
     };
 
-    CANSimple(CanBusBase* canbus) : canbus_(canbus) {}
+    CANSimple(CanBusBase* canbus) : canbus_(canbus), fibre_(canbus) {}
 
     bool init();
     uint32_t service_stack();
+    void on_config_changed();
+    bool try_fast_setpoint(const can_Message_t& msg);
+    uint32_t get_n_syncs() const { return n_syncs_; }
+    bool execute_frame(const can_Message_t& msg, CanBusBase* reply_bus);
 
    private:
 
+    struct AxisPeriodic {
+        uint32_t Axis::CANConfig_t::* rate;
+        bool (CANSimple::* callback)(const Axis& axis, CanBusBase* bus);
+    };
+
+    // Job IDs: the periodic messages of axis0, those of axis1, ..., then
+    // the cyclic frames
+    static constexpr size_t N_AXIS_PERIODICS = 10;
+    static constexpr size_t N_JOBS = AXIS_COUNT * N_AXIS_PERIODICS + CAN_CYCLIC_FRAMES;
+    static const AxisPeriodic axis_periodics_[N_AXIS_PERIODICS];
+
+    uint32_t job_rate(size_t job) const;
+    bool run_job(size_t job);
+    void apply_config_changes(uint32_t now);
+
     bool renew_subscription(size_t i);
-    bool send_heartbeat(const Axis& axis);
+    bool send_heartbeat(const Axis& axis, CanBusBase* bus);
+    bool send_event(const Axis& axis, uint32_t events);
+    bool send_cyclic_frame(size_t i);
+
+    // Input setpoints of one axis that were received since the last SYNC
+    struct LatchedInputs_t {
+        Controller::FastInputPos_t pos;
+        Controller::FastInputVel_t vel;
+        float torque;
+        bool has_pos = false;
+        bool has_vel = false;
+        bool has_torque = false;
+    };
+
+    static bool decode_setpoint(const can_Message_t& msg, LatchedInputs_t& inputs);
+    bool is_board_command(const can_Message_t& msg) const;
+    void on_board_command(const can_Message_t& msg);
+    bool send_board_feedback();
+    static void publish_inputs(Controller& controller, LatchedInputs_t& inputs);
+    bool is_sync(const can_Message_t& msg) const;
+    void on_sync();
 
     void handle_can_message(const can_Message_t& msg);
 
     void do_command(Axis& axis, const can_Message_t& cmd);
+    void execute_command(Axis& axis, const can_Message_t& msg, CanBusBase* reply_bus);
     
-    // Get functions (msg.rtr bit must be set)
-    bool get_motor_error_callback(const Axis& axis);
-    bool get_encoder_error_callback(const Axis& axis);
-    bool get_controller_error_callback(const Axis& axis);
-    bool get_sensorless_error_callback(const Axis& axis);
-    bool get_encoder_estimates_callback(const Axis& axis);
-    bool get_encoder_count_callback(const Axis& axis);
-    bool get_iq_callback(const Axis& axis);
-    bool get_sensorless_estimates_callback(const Axis& axis);
-    bool get_bus_voltage_current_callback(const Axis& axis);
+    // Get functions (msg.rtr bit must be set). They send the response on bus.
+    bool get_motor_error_callback(const Axis& axis, CanBusBase* bus);
+    bool get_encoder_error_callback(const Axis& axis, CanBusBase* bus);
+    bool get_controller_error_callback(const Axis& axis, CanBusBase* bus);
+    bool get_sensorless_error_callback(const Axis& axis, CanBusBase* bus);
+    bool get_encoder_estimates_callback(const Axis& axis, CanBusBase* bus);
+    bool get_encoder_count_callback(const Axis& axis, CanBusBase* bus);
+    bool get_iq_callback(const Axis& axis, CanBusBase* bus);
+    bool get_sensorless_estimates_callback(const Axis& axis, CanBusBase* bus);
+    bool get_bus_voltage_current_callback(const Axis& axis, CanBusBase* bus);
     // msg.rtr bit must NOT be set
-    bool get_adc_voltage_callback(const Axis& axis, const can_Message_t& msg);
+    bool get_adc_voltage_callback(const Axis& axis, const can_Message_t& msg, CanBusBase* bus);
 
     // Set functions
     static void set_axis_nodeid_callback(Axis& axis, const can_Message_t& msg);
@@ -104,10 +152,32 @@ class CANSimple {
     CanBusBase* canbus_;
     CanBusBase::CanSubscription* subscription_handles_[AXIS_COUNT];
 
-    // TODO: we this is a hack but actually we should use protocol hooks to
-    // renew our filter when the node ID changes
+    // Node IDs of the current subscriptions
     uint32_t node_ids_[AXIS_COUNT];
     bool extended_node_ids_[AXIS_COUNT];
+
+    // Requests arrive on the node ID of the first axis, responses are sent
+    // on the node ID of the last axis
+    CanFibre fibre_;
+    bool fibre_enabled_ = false; // copied from the ODriveCAN config in init()
+
+    volatile bool config_changed_ = true;
+
+    // Copied from the ODriveCAN config in init(). The latched inputs are
+    // only accessed by the context that handles the setpoints, which is the
+    // RX interrupt if fast setpoints are enabled and the CAN thread otherwise.
+    bool sync_enabled_ = false;
+    uint32_t sync_id_ = 0;
+    LatchedInputs_t latched_inputs_[AXIS_COUNT];
+    volatile uint32_t n_syncs_ = 0;
+
+    // Copied from the ODriveCAN config in init(). The feedback frame is sent
+    // by the CAN thread after each command frame.
+    bool board_frames_enabled_ = false;
+    uint32_t board_command_id_ = 0;
+    volatile bool board_feedback_pending_ = false;
+    DeadlineScheduler<N_JOBS> scheduler_;
+    uint32_t job_rates_[N_JOBS] = {}; // [ms] rates that the schedule is based on
 };
 
 #endif
@@ -0,0 +1,85 @@
+#ifndef __CAN_TX_QUEUE_HPP
+#define __CAN_TX_QUEUE_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <optional>
+#include "can_helpers.hpp"
+
+/**
+ * @brief Queue of frames waiting for a free TX mailbox, ordered like the bus
+ * arbitration: lower IDs first, a standard frame before an extended frame
+ * with the same base ID, and frames with the same ID in the order they were
+ * queued.
+ *
+ * If the queue is full, the frame with the lowest priority is dropped, so a
+ * burst of low priority frames can't delay a high priority one.
+ *
+ * Not thread safe.
+ */
+template<size_t N>
+class CanTxQueue {
+public:
+    // @brief Arbitration priority of a frame, lower values win. The bus
+    // compares the 11 bit base ID, then the IDE bit (standard frames win),
+    // then the 18 bit ID extension.
+    static uint32_t priority(const can_Message_t& msg) {
+        return msg.isExt ? (((msg.id >> 18) & 0x7ff) << 19) | (1U << 18) | (msg.id & 0x3ffff)
+                         : (msg.id & 0x7ff) << 19;
+    }
+
+    /**
+     * @brief Queues the frame.
+     * @returns The dropped frame if the queue was full. This is either the
+     * new frame or a queued one with a strictly lower priority.
+     */
+    std::optional<can_Message_t> push(const can_Message_t& msg) {
+        uint32_t key = priority(msg);
+        std::optional<can_Message_t> dropped;
+        if (size_ == N) {
+            if (key >= priority(entries_[0])) {
+                return msg;
+            }
+            dropped = entries_[0];
+            pop_worst();
+        }
+
+        // Entries are sorted from the lowest to the highest priority so that
+        // pop() takes the last one
+        size_t i = 0;
+        while (i < size_ && priority(entries_[i]) > key) {
+            ++i;
+        }
+        for (size_t j = size_; j > i; --j) {
+            entries_[j] = entries_[j - 1];
+        }
+        entries_[i] = msg;
+        size_++;
+        return dropped;
+    }
+
+    // @brief Removes the frame with the highest priority
+    bool pop(can_Message_t* msg) {
+        if (!size_) {
+            return false;
+        }
+        *msg = entries_[--size_];
+        return true;
+    }
+
+    bool empty() const { return size_ == 0; }
+    size_t size() const { return size_; }
+
+private:
+    void pop_worst() {
+        for (size_t j = 1; j < size_; ++j) {
+            entries_[j - 1] = entries_[j];
+        }
+        size_--;
+    }
+
+    can_Message_t entries_[N];
+    size_t size_ = 0;
+};
+
+#endif // __CAN_TX_QUEUE_HPP
@@ -2,9 +2,11 @@
 
 #include <can.h>
 #include <cmsis_os.h>
+#include <Drivers/STM32/stm32_system.h>
 
 #include "freertos_vars.h"
 #include "utils.hpp"
+#include <odrive_main.h>
 
 // Safer context handling via maps instead of arrays
 // #include <unordered_map>
@@ -13,6 +15,9 @@
 
 bool ODriveCAN::apply_config() {
     config_.parent = this;
+    for (CyclicFrame_t& frame : config_.cyclic_frames) {
+        frame.parent = this;
+    }
     set_baud_rate(config_.baud_rate);
     return true;
 }
@@ -25,18 +30,30 @@ bool ODriveCAN::reinit() {
         && (HAL_CAN_ActivateNotification(handle_, CAN_IT_RX_FIFO0_MSG_PENDING | CAN_IT_RX_FIFO1_MSG_PENDING | CAN_IT_TX_MAILBOX_EMPTY) == HAL_OK);
 }
 
-bool ODriveCAN::start_server(CAN_HandleTypeDef* handle) {
+bool ODriveCAN::start_server(CAN_HandleTypeDef* handle, osPriority priority) {
     handle_ = handle;
+    rx_in_isr_ = config_.enable_fast_setpoints;
 
     handle_->Init.Prescaler = CAN_FREQ / config_.baud_rate;
     if (!reinit()) {
         return false;
     }
 
+    // Put every filter bank that we manage into a known state so that each
+    // of them takes exactly one filter number, see rebuild_filter_map().
+    for (size_t bank = 0; bank < subscriptions_.size(); ++bank) {
+        if (!config_filter_bank(bank, CAN_RX_FIFO0, 0, 0, false)) {
+            return false;
+        }
+    }
+    rebuild_filter_map();
+
     auto wrapper = [](void* ctx) {
         ((ODriveCAN*)ctx)->can_server_thread();
     };
-    osThreadDef(can_server_thread_def, wrapper, osPriorityNormal, 0, stack_size_ / sizeof(StackType_t));
+    CCMRAM static StackType_t stack[stack_size_ / sizeof(StackType_t)];
+    CCMRAM static osStaticThreadDef_t thread_cb;
+    osThreadStaticDef(can_server_thread_def, wrapper, priority, 0, stack_size_ / sizeof(StackType_t), stack, &thread_cb);
     thread_id_ = osThreadCreate(osThread(can_server_thread_def), this);
 
     return true;
@@ -58,7 +75,13 @@ void ODriveCAN::can_server_thread() {
                 next_service_time = std::min(can_simple_.service_stack(), next_service_time);
             }
 
-            process_rx_fifo(CAN_RX_FIFO0);
+            CanRxQueue<16>::Entry_t entry;
+            while (rx_queue_.pop(&entry)) {
+                dispatch(CAN_RX_FIFO0, entry.filter_index, entry.msg);
+            }
+            if (!rx_in_isr_) {
+                process_rx_fifo(CAN_RX_FIFO0);
+            }
             process_rx_fifo(CAN_RX_FIFO1);
             HAL_CAN_ActivateNotification(handle_, CAN_IT_RX_FIFO0_MSG_PENDING | CAN_IT_RX_FIFO1_MSG_PENDING | CAN_IT_TX_MAILBOX_EMPTY);
 
@@ -83,7 +106,7 @@ bool ODriveCAN::set_baud_rate(uint32_t baud_rate) {
         config_.baud_rate = baud_rate;
         if (handle_) {
             handle_->Init.Prescaler = prescaler;
-            return reinit();
+            config_changed<&ODriveCAN::reinit>(this);
         }
         return true;
     } else {
@@ -92,43 +115,127 @@ bool ODriveCAN::set_baud_rate(uint32_t baud_rate) {
     }
 }
 
+bool ODriveCAN::read_rx_message(uint32_t fifo, can_Message_t* msg, uint32_t* filter_index) {
+    if (!HAL_CAN_GetRxFifoFillLevel(handle_, fifo)) {
+        return false;
+    }
+    CAN_RxHeaderTypeDef header;
+    HAL_CAN_GetRxMessage(handle_, fifo, &header, msg->buf);
+
+    msg->isExt = header.IDE;
+    msg->id = msg->isExt ? header.ExtId : header.StdId;  // If it's an extended message, pass the extended ID
+    msg->len = header.DLC;
+    msg->rtr = header.RTR;
+    *filter_index = header.FilterMatchIndex;
+    return true;
+}
+
+void ODriveCAN::dispatch(uint32_t fifo, uint32_t filter_index, const can_Message_t& msg) {
+    ODriveCanSubscription* subscription = filter_index < filter_map_[fifo].size()
+                                        ? filter_map_[fifo][filter_index] : nullptr;
+    if (subscription) {
+        subscription->callback(subscription->ctx, msg);
+    }
+}
+
 void ODriveCAN::process_rx_fifo(uint32_t fifo) {
-    while (HAL_CAN_GetRxFifoFillLevel(handle_, fifo)) {
-        CAN_RxHeaderTypeDef header;
-        can_Message_t rxmsg;
-        HAL_CAN_GetRxMessage(handle_, fifo, &header, rxmsg.buf);
-
-        rxmsg.isExt = header.IDE;
-        rxmsg.id = rxmsg.isExt ? header.ExtId : header.StdId;  // If it's an extended message, pass the extended ID
-        rxmsg.len = header.DLC;
-        rxmsg.rtr = header.RTR;
-
-        // TODO: this could be optimized with an ahead-of-time computed
-        // index-to-filter map
-
-        size_t fifo0_idx = 0;
-        size_t fifo1_idx = 0;
-
-        // Find the triggered subscription item based on header.FilterMatchIndex
-        auto it = std::find_if(subscriptions_.begin(), subscriptions_.end(), [&](auto& s) {
-            size_t current_idx = (s.fifo == 0 ? fifo0_idx : fifo1_idx)++;
-            return (header.FilterMatchIndex == current_idx) && (s.fifo == fifo);
-        });
-
-        if (it == subscriptions_.end()) {
-            continue;
+    can_Message_t rxmsg;
+    uint32_t filter_index;
+    while (read_rx_message(fifo, &rxmsg, &filter_index)) {
+        dispatch(fifo, filter_index, rxmsg);
+    }
+}
+
+/**
+ * @brief Drains FIFO 0 from the RX interrupt if fast setpoints are enabled.
+ *
+ * Input setpoint frames are applied right away, so that they reach the next
+ * control loop iteration without waiting for the CAN thread. All other frames
+ * are handed to the CAN thread, which handles them in order.
+ */
+void ODriveCAN::on_rx_fifo0_pending() {
+    if (!rx_in_isr_) {
+        HAL_CAN_DeactivateNotification(handle_, CAN_IT_RX_FIFO0_MSG_PENDING);
+        osSemaphoreRelease(sem_can);
+        return;
+    }
+
+    bool queued = false;
+    can_Message_t rxmsg;
+    uint32_t filter_index;
+    while (read_rx_message(CAN_RX_FIFO0, &rxmsg, &filter_index)) {
+        if (!can_simple_.try_fast_setpoint(rxmsg)) {
+            rx_queue_.push(rxmsg, filter_index);
+            queued = true;
         }
+    }
+    if (queued) {
+        osSemaphoreRelease(sem_can);
+    }
+}
 
-        it->callback(it->ctx, rxmsg);
+/**
+ * @brief Recomputes which subscription each filter number of each FIFO
+ * belongs to.
+ *
+ * The hardware numbers the filters of each FIFO in the order of the filter
+ * banks, including inactive ones. All our banks are single 32-bit filters,
+ * free ones stay assigned to FIFO 0 and map to no subscription.
+ */
+void ODriveCAN::rebuild_filter_map() {
+    size_t n_filters[2] = {0, 0};
+    filter_map_[0].fill(nullptr);
+    filter_map_[1].fill(nullptr);
+    for (ODriveCanSubscription& subscription : subscriptions_) {
+        bool in_use = subscription.fifo != kCanFifoNone;
+        uint32_t fifo = in_use ? subscription.fifo : CAN_RX_FIFO0;
+        filter_map_[fifo][n_filters[fifo]++] = in_use ? &subscription : nullptr;
     }
 }
 
-// Send a CAN message on the bus
+bool ODriveCAN::config_filter_bank(size_t bank, uint32_t fifo, uint32_t id, uint32_t mask, bool active) {
+    CAN_FilterTypeDef hal_filter = {};
+    hal_filter.FilterActivation = active ? ENABLE : DISABLE;
+    hal_filter.FilterBank = bank;
+    hal_filter.FilterFIFOAssignment = fifo;
+    hal_filter.FilterIdHigh = (id >> 16) & 0xffff;
+    hal_filter.FilterIdLow = id & 0xffff;
+    hal_filter.FilterMaskIdHigh = (mask >> 16) & 0xffff;
+    hal_filter.FilterMaskIdLow = mask & 0xffff;
+    hal_filter.FilterMode = CAN_FILTERMODE_IDMASK;
+    hal_filter.FilterScale = CAN_FILTERSCALE_32BIT;
+    hal_filter.SlaveStartFilterBank = 14; // reset value, CAN2 is unused
+    return HAL_CAN_ConfigFilter(handle_, &hal_filter) == HAL_OK;
+}
+
+// Send a CAN message on the bus. If all TX mailboxes are busy the message is
+// queued and sent from the TX complete interrupt. Returns false if it was
+// dropped instead.
 bool ODriveCAN::send_message(const can_Message_t &txmsg) {
     if (HAL_CAN_GetError(handle_) != HAL_CAN_ERROR_NONE) {
         return false;
     }
 
+    CRITICAL_SECTION() {
+        if (tx_queue_.empty() && HAL_CAN_GetTxMailboxesFreeLevel(handle_)) {
+            return add_tx_message(txmsg);
+        }
+
+        // Queued frames are sent from on_tx_mailbox_free(). A mailbox that
+        // completed while the notification was off triggers it right away.
+        HAL_CAN_ActivateNotification(handle_, CAN_IT_TX_MAILBOX_EMPTY);
+        std::optional<can_Message_t> dropped = tx_queue_.push(txmsg);
+        if (dropped) {
+            tx_dropped_++;
+            tx_dropped_by_cmd_[dropped->id & 0x1f]++;
+            // A queued frame is never dropped in favor of one with the same ID
+            return dropped->id != txmsg.id || dropped->isExt != txmsg.isExt;
+        }
+    }
+    return true;
+}
+
+bool ODriveCAN::add_tx_message(const can_Message_t& txmsg) {
     CAN_TxHeaderTypeDef header;
     header.StdId = txmsg.id;
     header.ExtId = txmsg.id;
@@ -138,13 +245,24 @@ bool ODriveCAN::send_message(const can_Message_t &txmsg) {
     header.TransmitGlobalTime = FunctionalState::DISABLE;
 
     uint32_t retTxMailbox = 0;
-    if (!HAL_CAN_GetTxMailboxesFreeLevel(handle_)) {
-        return false;
-    }
-    
     return HAL_CAN_AddTxMessage(handle_, &header, (uint8_t*)txmsg.buf, &retTxMailbox) == HAL_OK;
 }
 
+// @brief Called from the TX complete interrupt. Moves queued frames into the
+// free mailboxes.
+void ODriveCAN::on_tx_mailbox_free() {
+    can_Message_t txmsg;
+    CRITICAL_SECTION() {
+        while (HAL_CAN_GetTxMailboxesFreeLevel(handle_) && tx_queue_.pop(&txmsg)) {
+            add_tx_message(txmsg);
+        }
+        if (tx_queue_.empty()) {
+            HAL_CAN_DeactivateNotification(handle_, CAN_IT_TX_MAILBOX_EMPTY);
+        }
+    }
+    osSemaphoreRelease(sem_can);
+}
+
 //void ODriveCAN::set_error(Error error) {
 //    error_ |= error;
 //}
@@ -158,13 +276,6 @@ bool ODriveCAN::subscribe(const MsgIdFilterSpecs& filter, on_can_message_cb_t ca
         return false; // all subscription slots in use
     }
 
-    it->callback = callback;
-    it->ctx = ctx;
-    it->fifo = CAN_RX_FIFO0; // TODO: make customizable
-    if (handle) {
-        *handle = &*it;
-    }
-
     bool is_extended = filter.id.index() == 1;
     uint32_t id = is_extended ?
                   ((std::get<1>(filter.id) << 3) | (1 << 2)) :
@@ -172,20 +283,18 @@ bool ODriveCAN::subscribe(const MsgIdFilterSpecs& filter, on_can_message_cb_t ca
     uint32_t mask = (is_extended ? (filter.mask << 3) : (filter.mask << 21))
                   | (1 << 2); // care about the is_extended bit
 
-    CAN_FilterTypeDef hal_filter;
-    hal_filter.FilterActivation = ENABLE;
-    hal_filter.FilterBank = &*it - &subscriptions_[0];
-    hal_filter.FilterFIFOAssignment = it->fifo;
-    hal_filter.FilterIdHigh = (id >> 16) & 0xffff;
-    hal_filter.FilterIdLow = id & 0xffff;
-    hal_filter.FilterMaskIdHigh = (mask >> 16) & 0xffff;
-    hal_filter.FilterMaskIdLow = mask & 0xffff;
-    hal_filter.FilterMode = CAN_FILTERMODE_IDMASK;
-    hal_filter.FilterScale = CAN_FILTERSCALE_32BIT;
-
-    if (HAL_CAN_ConfigFilter(handle_, &hal_filter) != HAL_OK) {
+    uint32_t fifo = CAN_RX_FIFO0; // TODO: make customizable
+    if (!config_filter_bank(&*it - &subscriptions_[0], fifo, id, mask, true)) {
         return false;
     }
+
+    it->callback = callback;
+    it->ctx = ctx;
+    it->fifo = fifo;
+    if (handle) {
+        *handle = &*it;
+    }
+    rebuild_filter_map();
     return true;
 }
 
@@ -194,35 +303,30 @@ bool ODriveCAN::unsubscribe(CanSubscription* handle) {
     if (subscription < subscriptions_.begin() || subscription >= subscriptions_.end()) {
         return false;
     }
-    if (subscription->fifo != kCanFifoNone) {
+    if (subscription->fifo == kCanFifoNone) {
         return false; // not in use
     }
 
     subscription->fifo = kCanFifoNone;
+    rebuild_filter_map();
 
-    CAN_FilterTypeDef hal_filter = {};
-    hal_filter.FilterActivation = DISABLE;
-    return HAL_CAN_ConfigFilter(handle_, &hal_filter) == HAL_OK;
+    return config_filter_bank(subscription - subscriptions_.begin(), CAN_RX_FIFO0, 0, 0, false);
 }
 
 void HAL_CAN_TxMailbox0CompleteCallback(CAN_HandleTypeDef *hcan) {
-    HAL_CAN_DeactivateNotification(hcan, CAN_IT_TX_MAILBOX_EMPTY);
-    osSemaphoreRelease(sem_can);
+    odrv.can_.on_tx_mailbox_free();
 }
 void HAL_CAN_TxMailbox1CompleteCallback(CAN_HandleTypeDef *hcan) {
-    HAL_CAN_DeactivateNotification(hcan, CAN_IT_TX_MAILBOX_EMPTY);
-    osSemaphoreRelease(sem_can);
+    odrv.can_.on_tx_mailbox_free();
 }
 void HAL_CAN_TxMailbox2CompleteCallback(CAN_HandleTypeDef *hcan) {
-    HAL_CAN_DeactivateNotification(hcan, CAN_IT_TX_MAILBOX_EMPTY);
-    osSemaphoreRelease(sem_can);
+    odrv.can_.on_tx_mailbox_free();
 }
 void HAL_CAN_TxMailbox0AbortCallback(CAN_HandleTypeDef *hcan) {}
 void HAL_CAN_TxMailbox1AbortCallback(CAN_HandleTypeDef *hcan) {}
 void HAL_CAN_TxMailbox2AbortCallback(CAN_HandleTypeDef *hcan) {}
 void HAL_CAN_RxFifo0MsgPendingCallback(CAN_HandleTypeDef *hcan) {
-    HAL_CAN_DeactivateNotification(hcan, CAN_IT_RX_FIFO0_MSG_PENDING);
-    osSemaphoreRelease(sem_can);
+    odrv.can_.on_rx_fifo0_pending();
 }
 void HAL_CAN_RxFifo0FullCallback(CAN_HandleTypeDef *hcan) {
     HAL_CAN_DeactivateNotification(hcan, CAN_IT_RX_FIFO1_MSG_PENDING);
@@ -5,6 +5,9 @@
 
 #include "canbus.hpp"
 #include "can_simple.hpp"
+#include "can_rx_queue.hpp"
+#include "can_tx_queue.hpp"
+#include <MotorControl/config_transaction.hpp>
 #include <autogen/interfaces.hpp>
 
 #define CAN_CLK_HZ (42000000)
@@ -21,9 +24,36 @@ enum {
 
 class ODriveCAN : public CanBusBase, public ODriveIntf::CanIntf {
 public:
+    struct CyclicSignal_t {
+        endpoint_ref_t endpoint = {}; // numeric property
+        SignalType type = SIGNAL_TYPE_NONE;
+        float scale = 1.0f; // value per LSB of the integer types
+    };
+
+    // User defined frame that is sent every rate_ms milliseconds
+    struct CyclicFrame_t {
+        uint32_t id = 0; // arbitration ID
+        bool is_extended = false;
+        uint32_t rate_ms = 0; // 0 disables the frame
+        CyclicSignal_t signals[CAN_CYCLIC_SIGNALS]; // packed in order, little endian
+
+        ODriveCAN* parent = nullptr; // set in apply_config()
+        void set_rate_ms(uint32_t value) { rate_ms = value; parent->can_simple_.on_config_changed(); }
+    };
+
     struct Config_t {
         uint32_t baud_rate = CAN_BAUD_250K;
         Protocol protocol = PROTOCOL_SIMPLE;
+        CyclicFrame_t cyclic_frames[CAN_CYCLIC_FRAMES];
+        bool enable_fast_setpoints = false; // decode input setpoints in the RX interrupt. Takes effect after reboot.
+        bool enable_sync = false; // latch input setpoints until the next SYNC message. Takes effect after reboot.
+        uint32_t sync_id = 0x080; // standard ID of the SYNC message (CANopen default)
+        bool enable_fibre = false; // endpoint access over CAN, see CanFibre. Takes effect after reboot.
+        bool enable_board_frames = false; // setpoints and feedback of all axes in one frame each, see CANSimple::on_board_command(). Takes effect after reboot.
+        uint32_t board_command_id = 0x7e0; // standard ID of the combined setpoint frame. Takes effect after reboot.
+        uint32_t board_feedback_id = 0x7e1; // standard ID of the combined feedback frame
+        float board_pos_scale = 0.001f; // [turn/LSB] of the positions in both frames
+        float board_vel_scale = 0.01f; // [turn/s/LSB] of the velocities in both frames
 
         ODriveCAN* parent = nullptr; // set in apply_config()
         void set_baud_rate(uint32_t value) { parent->set_baud_rate(value); }
@@ -32,7 +62,14 @@ public:
     ODriveCAN() {}
 
     bool apply_config();
-    bool start_server(CAN_HandleTypeDef* handle);
+    bool start_server(CAN_HandleTypeDef* handle, osPriority priority);
+    void on_rx_fifo0_pending();
+    uint32_t get_rx_dropped() { return rx_queue_.get_n_dropped(); }
+    uint32_t get_n_syncs() { return can_simple_.get_n_syncs(); }
+    void on_tx_mailbox_free();
+    uint32_t get_tx_dropped(uint32_t cmd_id) { return cmd_id < 32 ? tx_dropped_by_cmd_[cmd_id] : 0; }
+
+    uint32_t tx_dropped_ = 0; // frames dropped because the TX queue was full
 
     Error error_ = ERROR_NONE;
 
@@ -40,7 +77,7 @@ public:
     CANSimple can_simple_{this};
 
     osThreadId thread_id_;
-    const uint32_t stack_size_ = 1024;  // Bytes
+    static constexpr uint32_t stack_size_ = 4096;  // Bytes. The fibre endpoint handlers run on this thread.
 
 private:
     static const uint8_t kCanFifoNone = 0xff;
@@ -52,17 +89,35 @@ private:
     };
 
     bool reinit();
+    bool config_filter_bank(size_t bank, uint32_t fifo, uint32_t id, uint32_t mask, bool active);
+    void rebuild_filter_map();
     void can_server_thread();
     bool set_baud_rate(uint32_t baud_rate);
+    bool read_rx_message(uint32_t fifo, can_Message_t* msg, uint32_t* filter_index);
+    void dispatch(uint32_t fifo, uint32_t filter_index, const can_Message_t& msg);
     void process_rx_fifo(uint32_t fifo);
     bool send_message(const can_Message_t& message) final;
+    bool add_tx_message(const can_Message_t& message);
     bool subscribe(const MsgIdFilterSpecs& filter, on_can_message_cb_t callback, void* ctx, CanSubscription** handle) final;
     bool unsubscribe(CanSubscription* handle) final;
 
     // Hardware supports at most 28 filters unless we do optimizations. For now
     // we don't need that many.
     std::array<ODriveCanSubscription, 8> subscriptions_;
+    // Subscription of each filter number (FilterMatchIndex) of each FIFO
+    std::array<ODriveCanSubscription*, 8> filter_map_[2] = {};
     CAN_HandleTypeDef *handle_ = nullptr;
+
+    // Set from config_.enable_fast_setpoints in start_server(). FIFO 0 is
+    // then drained by the RX interrupt, which handles the input setpoints
+    // itself and queues all other frames for the CAN thread.
+    bool rx_in_isr_ = false;
+    CanRxQueue<16> rx_queue_;
+
+    // Frames waiting for a TX mailbox, sent by on_tx_mailbox_free(). Only
+    // accessed in critical sections.
+    CanTxQueue<16> tx_queue_;
+    uint32_t tx_dropped_by_cmd_[32] = {}; // indexed by the lowest 5 bits of the ID
 };
 
 #endif  // __ODRIVE_CAN_HPP
@@ -7,6 +7,7 @@
 #include "interface_uart.h"
 #include "interface_can.hpp"
 #include "interface_i2c.h"
+#include "deferred_log.hpp"
 
 #include "odrive_main.h"
 #include "freertos_vars.h"
@@ -38,25 +39,16 @@ char serial_number_str[13]; // 12 digits + null termination
 void init_communication(void) {
     //printf("hi!\r\n");
 
-    // Dual UART operation not supported yet
-    if (odrv.config_.enable_uart_a && odrv.config_.enable_uart_b) {
-        odrv.misconfigured_ = true;
-    }
-
-    if (odrv.config_.enable_uart_a && uart_a) {
-        start_uart_server(uart_a);
-    } else if (odrv.config_.enable_uart_b && uart_b) {
-        start_uart_server(uart_b);
-    }
+    start_uart_servers(comms_thread_priority(odrv.config_.uart_thread_priority));
 
-    start_usb_server();
+    start_usb_server(comms_thread_priority(odrv.config_.usb_thread_priority));
 
     if (odrv.config_.enable_i2c_a) {
-        start_i2c_server();
+        start_i2c_server(comms_thread_priority(odrv.config_.i2c_thread_priority));
     }
 
     if (odrv.config_.enable_can_a) {
-        odrv.can_.start_server(&hcan1);
+        odrv.can_.start_server(&hcan1, comms_thread_priority(odrv.config_.can_thread_priority));
     }
 }
 
@@ -67,22 +59,18 @@ extern "C" {
 int _write(int file, const char* data, int len) __attribute__((used));
 }
 
+DeferredLog deferred_log;
+
 // @brief This is what printf calls internally
+// The text goes to the deferred log, the UART and USB threads pass it on to
+// the stdout streams.
 int _write(int file, const char* data, int len) {
-    fibre::cbufptr_t buf{(const uint8_t*)data, (const uint8_t*)data + len};
-
-    if (odrv.config_.uart0_protocol == ODrive::STREAM_PROTOCOL_TYPE_STDOUT ||
-        odrv.config_.uart0_protocol == ODrive::STREAM_PROTOCOL_TYPE_ASCII_AND_STDOUT) {
-        uart0_stdout_sink.write(buf);
-        if (!uart0_stdout_pending) {
-            uart0_stdout_pending = true;
-            osMessagePut(uart_event_queue, 3, 0);
-        }
-    }
+    deferred_log.write_text(data, len);
+
+    uart_notify_stdout();
 
     if (odrv.config_.usb_cdc_protocol == ODrive::STREAM_PROTOCOL_TYPE_STDOUT ||
         odrv.config_.usb_cdc_protocol == ODrive::STREAM_PROTOCOL_TYPE_ASCII_AND_STDOUT) {
-        usb_cdc_stdout_sink.write(buf);
         if (!usb_cdc_stdout_pending) {
             usb_cdc_stdout_pending = true;
             osMessagePut(usb_event_queue, 7, 0);
@@ -96,4 +84,11 @@ int _write(int file, const char* data, int len) {
 #include "../autogen/function_stubs.hpp"
 
 ODrive& ep_root = odrv;
+
+// Measures every endpoint operation in system_stats.endpoint_handler
+struct EndpointTimer : TaskTimerContext {
+    EndpointTimer() : TaskTimerContext(odrv.system_stats_.endpoint_handler) {}
+};
+#define FIBRE_ENDPOINT_TIMER EndpointTimer
+
 #include "../autogen/endpoints.hpp"
@@ -0,0 +1,233 @@
+#ifndef __DEFERRED_LOG_HPP
+#define __DEFERRED_LOG_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <tuple>
+#include <type_traits>
+#include <fibre/bufptr.hpp>
+
+#define DEFERRED_LOG_SIZE 64 // entries, must be a power of two
+#define DEFERRED_LOG_ARG_SIZE 24 // bytes of arguments or text per entry
+#define DEFERRED_LOG_MAX_LINE 128 // formatted length of one entry, including the null terminator
+#define DEFERRED_LOG_POLL_INTERVAL_MS 10
+
+/**
+ * @brief Ring buffer of log messages that are formatted later by the
+ * communication threads.
+ *
+ * A message only stores the format string pointer and a copy of its
+ * arguments, so logging costs about as much as a memcpy and never waits for
+ * a stream. It can be called from any context, including interrupts.
+ *
+ * Entries are claimed with an atomic increment like the event log. When the
+ * readers fall behind, the oldest entries are overwritten and the readers
+ * report how many they missed. Every reader (one per stdout stream) keeps its
+ * own position.
+ *
+ * Logging doesn't touch the RTOS, so it is safe in interrupts above
+ * configMAX_SYSCALL_INTERRUPT_PRIORITY. The communication threads check for
+ * new messages every DEFERRED_LOG_POLL_INTERVAL_MS instead of being woken up.
+ *
+ * The format string and any string (%s) arguments must outlive the message,
+ * so only pass string literals.
+ */
+class DeferredLog {
+public:
+    using Formatter = int (*)(char* buf, size_t len, const char* fmt, const uint8_t* args);
+
+    struct Entry_t {
+        uint32_t seq; // message number + 1, 0 while invalid
+        Formatter format; // nullptr for plain text
+        const char* fmt;
+        uint8_t text_len;
+        uint8_t args[DEFERRED_LOG_ARG_SIZE]; // arguments or plain text
+    };
+
+    struct Reader {
+        uint32_t index = 0; // next message number
+        uint32_t n_dropped = 0; // overwritten before they were read, not reported yet
+    };
+
+    /**
+     * @brief Logs a printf style message.
+     * Floats are stored as double, like printf receives them.
+     */
+    template<typename... Ts>
+    void log(const char* fmt, Ts... args) {
+        store_args<decltype(promote(args))...>(fmt, promote(args)...);
+    }
+
+    /**
+     * @brief Logs text that is already formatted (e.g. from _write). Long
+     * text takes up several entries.
+     */
+    void write_text(const char* text, size_t len) {
+        do {
+            size_t chunk = std::min(len, (size_t)DEFERRED_LOG_ARG_SIZE);
+            uint32_t idx;
+            Entry_t& entry = claim(&idx);
+            entry.format = nullptr;
+            entry.fmt = nullptr;
+            entry.text_len = chunk;
+            memcpy(entry.args, text, chunk);
+            commit(entry, idx);
+            text += chunk;
+            len -= chunk;
+        } while (len);
+    }
+
+    // @brief Total number of messages since startup (wraps)
+    uint32_t head() const { return __atomic_load_n(&head_, __ATOMIC_RELAXED); }
+
+    /**
+     * @brief Formats the next message of `reader` into buf without consuming
+     * it. Overwritten messages are skipped and counted in reader->n_dropped.
+     * @returns The length of the text (truncated to len - 1) or -1 if there
+     *          is no message or the next one is still being written.
+     */
+    int peek(Reader* reader, char* buf, size_t len) {
+        for (;;) {
+            uint32_t head = this->head();
+            if (head == reader->index) {
+                return -1;
+            }
+            if (head - reader->index > DEFERRED_LOG_SIZE) {
+                uint32_t oldest = head - DEFERRED_LOG_SIZE;
+                reader->n_dropped += oldest - reader->index;
+                reader->index = oldest;
+            }
+
+            const Entry_t& src = entries_[reader->index & (DEFERRED_LOG_SIZE - 1)];
+            uint32_t seq = __atomic_load_n(&src.seq, __ATOMIC_ACQUIRE);
+            if (seq != reader->index + 1) {
+                if (this->head() - reader->index > DEFERRED_LOG_SIZE) {
+                    continue; // overwritten in the meantime
+                }
+                return -1; // claimed but not written yet
+            }
+
+            Entry_t entry;
+            memcpy(&entry, &src, sizeof(entry));
+            __atomic_signal_fence(__ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&src.seq, __ATOMIC_RELAXED) != seq) {
+                continue; // overwritten while copying
+            }
+
+            int n;
+            if (entry.format) {
+                n = entry.format(buf, len, entry.fmt, entry.args);
+            } else {
+                n = std::min((size_t)entry.text_len, len - 1);
+                memcpy(buf, entry.args, n);
+                buf[n] = '\0';
+            }
+            return std::clamp(n, 0, (int)len - 1);
+        }
+    }
+
+    /**
+     * @brief Moves as many messages of `reader` to the stdout stream as it can
+     * take right now. Called on the thread of the stream.
+     */
+    template<typename TSink>
+    void drain(Reader* reader, TSink& sink) {
+        char buf[DEFERRED_LOG_MAX_LINE];
+        // A message that is longer than the stream buffer would never fit
+        size_t max_len = std::min(sizeof(buf), TSink::capacity + 1);
+        for (;;) {
+            int n = peek(reader, buf, max_len);
+            if (reader->n_dropped) {
+                char notice[32];
+                int m = snprintf(notice, sizeof(notice), "[%lu log messages dropped]\r\n", (unsigned long)reader->n_dropped);
+                if ((size_t)m > sink.get_free_space()) {
+                    break;
+                }
+                sink.write({(const uint8_t*)notice, (size_t)m});
+                reader->n_dropped = 0;
+            }
+            if (n < 0 || (size_t)n > sink.get_free_space()) {
+                break;
+            }
+            sink.write({(const uint8_t*)buf, (size_t)n});
+            reader->index++;
+        }
+        sink.maybe_start_async_write();
+    }
+
+private:
+    // printf receives the default argument promotions
+    template<typename T>
+    static auto promote(T val) {
+        static_assert(std::is_arithmetic_v<T> || std::is_pointer_v<T> || std::is_enum_v<T>,
+                      "only numbers and pointers can be logged");
+        if constexpr (std::is_floating_point_v<T>) {
+            return (double)val;
+        } else if constexpr (std::is_enum_v<T>) {
+            return +static_cast<std::underlying_type_t<T>>(val);
+        } else if constexpr (std::is_pointer_v<T>) {
+            return val;
+        } else {
+            return +val;
+        }
+    }
+
+    template<typename... Ts>
+    static int format(char* buf, size_t len, const char* fmt, const uint8_t* raw) {
+        size_t offset = 0;
+        auto next = [&](auto* tag) {
+            std::remove_pointer_t<decltype(tag)> val;
+            memcpy(&val, raw + offset, sizeof(val));
+            offset += sizeof(val);
+            return val;
+        };
+        (void)next; // unused without arguments
+        // Braced initialization evaluates the arguments in order
+        std::tuple<Ts...> args{next((Ts*)nullptr)...};
+        // The unused trailing argument keeps -Wformat-security quiet for
+        // messages without arguments
+        return std::apply([&](auto... vals) { return snprintf(buf, len, fmt, vals..., 0); }, args);
+    }
+
+    template<typename... Ts>
+    void store_args(const char* fmt, Ts... args) {
+        static_assert((sizeof(Ts) + ... + 0) <= DEFERRED_LOG_ARG_SIZE, "too many arguments");
+        uint32_t idx;
+        Entry_t& entry = claim(&idx);
+        entry.format = &format<Ts...>;
+        entry.fmt = fmt;
+        entry.text_len = 0;
+        size_t offset = 0;
+        ((memcpy(entry.args + offset, &args, sizeof(args)), offset += sizeof(args)), ...);
+        commit(entry, idx);
+    }
+
+    Entry_t& claim(uint32_t* idx) {
+        *idx = __atomic_fetch_add(&head_, 1, __ATOMIC_RELAXED);
+        Entry_t& entry = entries_[*idx & (DEFERRED_LOG_SIZE - 1)];
+        __atomic_store_n(&entry.seq, 0, __ATOMIC_RELAXED);
+        __atomic_signal_fence(__ATOMIC_SEQ_CST);
+        return entry;
+    }
+
+    void commit(Entry_t& entry, uint32_t idx) {
+        __atomic_store_n(&entry.seq, idx + 1, __ATOMIC_RELEASE);
+    }
+
+    uint32_t head_ = 0;
+    Entry_t entries_[DEFERRED_LOG_SIZE];
+};
+
+extern DeferredLog deferred_log;
+
+// Like printf but formatted later on the communication threads, see
+// DeferredLog. The format is still checked at compile time.
+#define DEFERRED_PRINTF(fmt, ...) do { \
+        if (false) printf(fmt, ##__VA_ARGS__); \
+        deferred_log.log(fmt, ##__VA_ARGS__); \
+    } while (0)
+
+#endif // __DEFERRED_LOG_HPP
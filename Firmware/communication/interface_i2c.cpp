@@ -1,88 +1,210 @@
-
 #include "interface_i2c.h"
 
 #include <i2c.h>
-
-#define I2C_RX_BUFFER_SIZE 128
-#define I2C_RX_BUFFER_PREAMBLE_SIZE   4
-#define I2C_TX_BUFFER_SIZE 128
+#include <cmsis_os.h>
+#include <Drivers/STM32/stm32_system.h>
+#include <string.h>
+#include <fibre/../../protocol.hpp>
+#include <fibre/simple_serdes.hpp>
+
+#define I2C_RX_BUFFER_SIZE 64
+#define I2C_TX_BUFFER_SIZE 64
+
+// Transactions (the register address is the fibre endpoint ID, all values
+// little endian):
+//
+//  Read:    START | addr+W | id (uint16) | [count (uint8) | [id (uint16) | count (uint8)]...] |
+//           json_crc (uint16) | REPEATED START | addr+R | values | STOP
+//           Reads the endpoints id, id+1, ..., id+count-1 (count defaults to 1)
+//           of every run and returns their values back to back. The master
+//           reads as many bytes as it expects.
+//  Write:   START | addr+W | id (uint16) | values | json_crc (uint16) | STOP
+//           Writes the values to the endpoints id, id+1, ... in turn. Without
+//           values this calls the function with the ID id.
+//
+// Reads are served in the interrupt so that the master doesn't have to wait
+// for a thread. Only property endpoints can be read this way. Writes can call
+// setters and functions, so they run in the I2C thread. The master should
+// wait for a write to complete before the next one, a write that arrives
+// while the previous one is running is dropped and counted in error_cnt.
 
 I2CStats_t i2c_stats_;
-/*
-TODO: add support back
 
-static uint8_t i2c_rx_buffer[I2C_RX_BUFFER_PREAMBLE_SIZE + I2C_RX_BUFFER_SIZE];
+osThreadId i2c_thread = nullptr;
+const uint32_t stack_size_i2c_thread = 4096; // Bytes. The fibre endpoint handlers run on this thread.
+static osSemaphoreId sem_i2c;
+CCMRAM static StackType_t i2c_thread_stack[stack_size_i2c_thread / sizeof(StackType_t)];
+CCMRAM static osStaticThreadDef_t i2c_thread_cb;
+CCMRAM static osStaticSemaphoreDef_t sem_i2c_cb;
+
+static uint8_t i2c_rx_buffer[I2C_RX_BUFFER_SIZE];
 static uint8_t i2c_tx_buffer[I2C_TX_BUFFER_SIZE];
+static bool i2c_rx_active = false;
+
+// Write transaction handed to the I2C thread. Non-zero length while the
+// thread owns the buffer.
+static uint8_t i2c_write_buffer[I2C_RX_BUFFER_SIZE];
+static volatile size_t i2c_write_length = 0;
+
+// Checks the trailer of a received register access and splits it into the
+// endpoint ID and the payload
+static bool i2c_parse(fibre::cbufptr_t buffer, uint16_t* endpoint_id, fibre::cbufptr_t* payload) {
+    if (buffer.size() < 4) {
+        return false;
+    }
+    uint16_t trailer = buffer.end()[-2] | (buffer.end()[-1] << 8);
+    if (trailer != fibre::json_crc_) {
+        return false;
+    }
+    *endpoint_id = *fibre::read_le<uint16_t>(&buffer);
+    *payload = {buffer.begin(), buffer.end() - 2};
+    return true;
+}
+
+// Fills i2c_tx_buffer with the values of a read request. Called in the
+// interrupt.
+static void i2c_prepare_read(fibre::cbufptr_t request) {
+    fibre::bufptr_t output{i2c_tx_buffer};
+    uint16_t endpoint_id;
+    fibre::cbufptr_t payload;
+    if (!i2c_parse(request, &endpoint_id, &payload) || (payload.size() && payload.size() % 3 != 1)) {
+        i2c_stats_.error_cnt++;
+    } else {
+        size_t count = payload.size() ? *fibre::read_le<uint8_t>(&payload) : 1;
+        for (;;) {
+            size_t i = 0;
+            for (; i < count; ++i) {
+                fibre::cbufptr_t input{nullptr, nullptr};
+                if (!fibre::is_property_endpoint(endpoint_id + i)
+                        || !fibre::endpoint_handler(endpoint_id + i, &input, &output)) {
+                    break;
+                }
+            }
+            if (i < count) {
+                i2c_stats_.error_cnt++;
+                break;
+            }
+            if (!payload.size()) {
+                break;
+            }
+            endpoint_id = *fibre::read_le<uint16_t>(&payload);
+            count = *fibre::read_le<uint8_t>(&payload);
+        }
+    }
+    // The master decides how many bytes it reads
+    memset(output.begin(), 0, output.size());
+}
 
-class I2CSender : public PacketSink {
-public:
-    int process_packet(const uint8_t* buffer, size_t length) {
-        if (length >= 2 && (length - 2) <= sizeof(i2c_tx_buffer))
-            memcpy(i2c_tx_buffer, buffer + 2, length - 2);
-        return 0;
+static void i2c_execute_write(fibre::cbufptr_t request) {
+    uint16_t endpoint_id;
+    fibre::cbufptr_t payload;
+    if (!i2c_parse(request, &endpoint_id, &payload)) {
+        i2c_stats_.error_cnt++;
+        return;
+    }
+
+    uint8_t scratch[8]; // receives the previous values, which are discarded
+    do {
+        fibre::bufptr_t output{scratch};
+        size_t remaining = payload.size();
+        if (!fibre::endpoint_handler(endpoint_id++, &payload, &output)
+                || (remaining && payload.size() == remaining)) {
+            i2c_stats_.error_cnt++;
+            return;
+        }
+    } while (payload.size());
+}
+
+static void i2c_server_thread(void* ctx) {
+    (void) ctx;
+
+    for (;;) {
+        osSemaphoreWait(sem_i2c, osWaitForever);
+        if (i2c_write_length) {
+            i2c_execute_write({i2c_write_buffer, i2c_write_length});
+            i2c_write_length = 0;
+        }
     }
-    size_t get_free_space() { return SIZE_MAX; }
-} i2c1_packet_output;
-BidirectionalPacketBasedChannel i2c1_channel(i2c1_packet_output);
-*/
-void start_i2c_server() {
+}
+
+void start_i2c_server(osPriority priority) {
     // CAN H = SDA
     // CAN L = SCL
-    //HAL_I2C_EnableListen_IT(&hi2c1);
+    osSemaphoreStaticDef(sem_i2c, &sem_i2c_cb);
+    sem_i2c = osSemaphoreCreate(osSemaphore(sem_i2c), 1);
+    osSemaphoreWait(sem_i2c, 0);
+
+    osThreadStaticDef(i2c_server_thread_def, i2c_server_thread, priority, 0, stack_size_i2c_thread / sizeof(StackType_t), i2c_thread_stack, &i2c_thread_cb);
+    i2c_thread = osThreadCreate(osThread(i2c_server_thread_def), NULL);
+
+    HAL_I2C_EnableListen_IT(&hi2c1);
 }
-/*
-void i2c_handle_packet(I2C_HandleTypeDef *hi2c) {
-    size_t received = sizeof(i2c_rx_buffer) - hi2c->XferCount;
-    if (received > I2C_RX_BUFFER_PREAMBLE_SIZE) {
-        i2c_stats_.rx_cnt++;
-        
-        write_le<uint16_t>(0, i2c_rx_buffer); // hallucinate seq-no (not needed for I2C)
-        i2c_rx_buffer[2] = i2c_rx_buffer[4]; // endpoint-id = I2C register address
-        i2c_rx_buffer[3] = i2c_rx_buffer[5] | 0x80; // MSB must be 1
-        size_t expected_bytes = (TX_BUF_SIZE - 2) < I2C_TX_BUFFER_SIZE ? (TX_BUF_SIZE - 2) : I2C_TX_BUFFER_SIZE;
-        write_le<uint16_t>(expected_bytes, i2c_rx_buffer + 4); // hallucinate maximum number of expected response bytes
-
-        i2c1_channel.process_packet(i2c_rx_buffer, received);
-
-        // reset receive buffer
-        hi2c->pBuffPtr = I2C_RX_BUFFER_PREAMBLE_SIZE + i2c_rx_buffer;
-        hi2c->XferCount = sizeof(i2c_rx_buffer) - I2C_RX_BUFFER_PREAMBLE_SIZE;
+
+// Ends the write phase of a transaction and returns the received bytes.
+// Called on a repeated start or stop condition.
+static fibre::cbufptr_t i2c_finish_rx(I2C_HandleTypeDef* hi2c) {
+    if (!i2c_rx_active) {
+        return {nullptr, nullptr};
     }
+    i2c_rx_active = false;
 
+    // On a repeated start the last byte can still be in the data register
+    if (hi2c->XferCount && __HAL_I2C_GET_FLAG(hi2c, I2C_FLAG_RXNE) == SET) {
+        *hi2c->pBuffPtr++ = hi2c->Instance->DR;
+        hi2c->XferCount--;
+    }
+    size_t received = sizeof(i2c_rx_buffer) - hi2c->XferCount;
 
-    if (hi2c->State == HAL_I2C_STATE_BUSY_RX_LISTEN)
+    // The HAL expects the master to send exactly the number of bytes that we
+    // asked for. Go back to listening for the address.
+    if (hi2c->State == HAL_I2C_STATE_BUSY_RX_LISTEN) {
         hi2c->State = HAL_I2C_STATE_LISTEN;
-}
-
+    }
 
-void HAL_I2C_ListenCpltCallback(I2C_HandleTypeDef *hi2c) {
-    i2c_handle_packet(hi2c);
-    // restart listening for address
-    HAL_I2C_EnableListen_IT(hi2c);
+    i2c_stats_.rx_cnt++;
+    return {i2c_rx_buffer, received};
 }
 
 void HAL_I2C_AddrCallback(I2C_HandleTypeDef *hi2c, uint8_t TransferDirection, uint16_t AddrMatchCode) {
     i2c_stats_.addr_match_cnt += 1;
-    
-    i2c_handle_packet(hi2c);
 
     if (TransferDirection == I2C_DIRECTION_TRANSMIT) {
-        HAL_I2C_Slave_Sequential_Receive_IT(hi2c,
-            I2C_RX_BUFFER_PREAMBLE_SIZE + i2c_rx_buffer,
-            sizeof(i2c_rx_buffer) - I2C_RX_BUFFER_PREAMBLE_SIZE, I2C_FIRST_AND_LAST_FRAME);
+        // Master writes
+        i2c_finish_rx(hi2c);
+        i2c_rx_active = true;
+        HAL_I2C_Slave_Sequential_Receive_IT(hi2c, i2c_rx_buffer, sizeof(i2c_rx_buffer), I2C_FIRST_AND_LAST_FRAME);
     } else {
+        // Master reads after a repeated start: the write phase was a read
+        // request
+        i2c_prepare_read(i2c_finish_rx(hi2c));
         HAL_I2C_Slave_Sequential_Transmit_IT(hi2c, i2c_tx_buffer, sizeof(i2c_tx_buffer), I2C_FIRST_AND_LAST_FRAME);
     }
 }
 
-void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c) {
-    // ignore NACK errors
-    if (!(hi2c->ErrorCode & (~HAL_I2C_ERROR_AF)))
-        return;
+void HAL_I2C_ListenCpltCallback(I2C_HandleTypeDef *hi2c) {
+    // Stop condition. If the master only wrote, it's a write request.
+    fibre::cbufptr_t request = i2c_finish_rx(hi2c);
+    if (request.size()) {
+        if (i2c_write_length) {
+            i2c_stats_.error_cnt++; // previous write still running
+        } else {
+            memcpy(i2c_write_buffer, request.begin(), request.size());
+            i2c_write_length = request.size();
+            osSemaphoreRelease(sem_i2c);
+        }
+    }
+
+    // restart listening for address
+    HAL_I2C_EnableListen_IT(hi2c);
+}
 
-    i2c_stats_.error_cnt += 1;
+void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c) {
+    // The master NACKs the last byte it reads, so ignore NACK errors
+    if (hi2c->ErrorCode & (~HAL_I2C_ERROR_AF)) {
+        i2c_stats_.error_cnt += 1;
+        i2c_rx_active = false;
+    }
 
     // Continue listening
     HAL_I2C_EnableListen_IT(hi2c);
 }
-*/
@@ -6,6 +6,7 @@ extern "C" {
 #endif
 
 #include <stdint.h>
+#include <cmsis_os.h>
 
 struct I2CStats_t {
     uint8_t addr;
@@ -15,8 +16,10 @@ struct I2CStats_t {
 };
 
 extern I2CStats_t i2c_stats_;
+extern osThreadId i2c_thread;
+extern const uint32_t stack_size_i2c_thread;
 
-void start_i2c_server(void);
+void start_i2c_server(osPriority priority);
 
 #ifdef __cplusplus
 }
@@ -2,27 +2,59 @@
 #include "interface_uart.h"
 
 #include "ascii_protocol.hpp"
+#include "uart_simple.hpp"
+#include "deferred_log.hpp"
 
 #include <MotorControl/utils.hpp>
 
 #include <fibre/async_stream.hpp>
 #include <fibre/../../legacy_protocol.hpp>
+#include <fibre/../../stream_utils.hpp>
 #include <usart.h>
 #include <cmsis_os.h>
+#include <Drivers/STM32/stm32_system.h>
 #include <freertos_vars.h>
 #include <odrive_main.h>
 
-#define UART_TX_BUFFER_SIZE 64
-#define UART_RX_BUFFER_SIZE 64
-
-// DMA open loop continous circular buffer
-// 1ms delay periodic, chase DMA ptr around
-static uint8_t dma_rx_buffer[UART_RX_BUFFER_SIZE];
-static uint32_t dma_last_rcv_idx;
+// Size of each of the two TX staging buffers (see CONFIG_UART_TX_BUFFER_SIZE
+// in tup.config.default). Writes that fit are copied and complete right away,
+// so that consecutive small writes (e.g. the header, payload and trailer of a
+// fibre packet) go out in one DMA transfer. Larger writes are sent by DMA
+// directly from the caller's buffer.
+#ifndef UART_TX_BUFFER_SIZE
+#define UART_TX_BUFFER_SIZE 128
+#endif
+
+// Size of the circular DMA receive buffer (see CONFIG_UART_RX_BUFFER_SIZE in
+// tup.config.default). It must hold all bytes that arrive while the UART
+// thread is delayed by higher priority work, e.g. about 25 bytes per ms at
+// 250 kbaud.
+#ifndef UART_RX_BUFFER_SIZE
+#define UART_RX_BUFFER_SIZE 256
+#endif
+static_assert(UART_RX_BUFFER_SIZE % 2 == 0, "the half transfer interrupt needs an even buffer size");
+
+// Number of UARTs that can run a protocol at the same time. Each one takes
+// about 2kB of RAM for its buffers and protocol instances.
+#ifndef UART_SERVER_COUNT
+#define UART_SERVER_COUNT 2
+#endif
 
 osThreadId uart_thread = 0;
-static UART_HandleTypeDef* huart_ = nullptr;
 const uint32_t stack_size_uart_thread = 4096;  // Bytes
+CCMRAM static StackType_t uart_thread_stack[stack_size_uart_thread / sizeof(StackType_t)];
+CCMRAM static osStaticThreadDef_t uart_thread_cb;
+
+// Events on uart_event_queue: the index of the server in the upper bits, the
+// event in the lower bits
+enum : uint32_t {
+    kUartEventRx = 1,
+    kUartEventTxDone = 2,
+    kUartEventStdout = 3, // not tied to a server
+    kUartEventShift = 4,
+};
+
+class UartServer;
 
 namespace fibre {
 
@@ -33,51 +65,196 @@ public:
     void start_write(cbufptr_t buffer, TransferHandle* handle, Callback<void, WriteResult> completer) final;
     void cancel_write(TransferHandle transfer_handle) final;
     void did_finish();
+    void complete_buffered_write();
 
     UART_HandleTypeDef *huart_;
+
+private:
+    void try_take_write();
+    void flush();
+    void start_dma(const uint8_t* buffer, size_t length);
+
+    enum {
+        kStateIdle,
+        kStateBuffered, // copied to the staging buffer, completed by complete_buffered_write()
+        kStateDirect,   // sent from the caller's buffer, completed by did_finish()
+        kStateWaiting,  // waiting for space in the staging buffer
+    } state_ = kStateIdle;
+    cbufptr_t write_buf_ = {nullptr, nullptr};
+    const uint8_t* write_end_ = nullptr;
     Callback<void, WriteResult> completer_;
-    const uint8_t* tx_end_ = nullptr;
+
+    uint8_t staging_bufs_[2][UART_TX_BUFFER_SIZE]; // one is filled while the other one is sent
+    size_t staging_idx_ = 0; // index of the buffer that is being filled
+    size_t staging_size_ = 0;
+    bool dma_active_ = false;
+    bool dma_direct_ = false; // the active DMA transfer reads from the caller's buffer
 };
 
 class Stm32UartRxStream : public AsyncStreamSource {
 public:
+    Stm32UartRxStream(UartServer* server) : server_(server) {}
+
     void start_read(bufptr_t buffer, TransferHandle* handle, Callback<void, ReadResult> completer) final;
     void cancel_read(TransferHandle transfer_handle) final;
-    void did_receive(uint8_t* buffer, size_t length);
+    size_t did_receive(uint8_t* buffer, size_t length);
 
     Callback<void, ReadResult> completer_;
     bufptr_t rx_buf_ = {nullptr, nullptr};
+
+private:
+    UartServer* server_;
 };
 
 }
 
 using namespace fibre;
 
-void Stm32UartTxStream::start_write(cbufptr_t buffer, TransferHandle* handle, Callback<void, WriteResult> completer) {
-    size_t chunk = std::min(buffer.size(), (size_t)UART_TX_BUFFER_SIZE);
+/**
+ * @brief One UART with its DMA buffers, streams and protocol instances.
+ *
+ * All servers run on the UART thread. The interrupts only post events that
+ * carry the index of the server.
+ */
+class UartServer {
+public:
+    UartServer()
+        : tx_stream_(nullptr), rx_stream_(this),
+          fibre_(&rx_stream_, &tx_stream_),
+          tx_multiplexer_(tx_stream_), stdout_sink_(tx_multiplexer_),
+          ascii_(&rx_stream_, &tx_multiplexer_), simple_(&rx_stream_, &tx_multiplexer_) {}
+
+    void init(uint8_t index, UART_HandleTypeDef* huart, ODriveIntf::StreamProtocolType protocol);
+    void start_protocol();
+    uint32_t poll(uint32_t now);
+    void handle_event(uint32_t event);
+
+    void rx_event();
+    void tx_done() { osMessagePut(uart_event_queue, (index_ << kUartEventShift) | kUartEventTxDone, 0); }
+
+    UART_HandleTypeDef* huart_ = nullptr;
+
+private:
+    void start_rx_dma();
+    void process_rx();
+    bool stdout_enabled() const {
+        return protocol_ == ODriveIntf::STREAM_PROTOCOL_TYPE_STDOUT
+            || protocol_ == ODriveIntf::STREAM_PROTOCOL_TYPE_ASCII_AND_STDOUT;
+    }
 
+    uint8_t index_ = 0;
+    ODriveIntf::StreamProtocolType protocol_ = ODriveIntf::STREAM_PROTOCOL_TYPE_FIBRE;
+
+    // DMA open loop continous circular buffer
+    // Chased by the UART thread whenever the line goes idle or the DMA crosses
+    // the middle or the end of the buffer.
+    uint8_t dma_rx_buffer_[UART_RX_BUFFER_SIZE];
+    uint32_t dma_last_rcv_idx_ = 0;
+
+    // True while an RX event is in the queue. Limits the queue to one RX event
+    // per server no matter how many interrupts occur before the thread runs.
+    volatile bool rx_event_pending_ = false;
+
+    Stm32UartTxStream tx_stream_;
+    Stm32UartRxStream rx_stream_;
+    LegacyProtocolStreamBased fibre_;
+    AsyncStreamSinkMultiplexer<2> tx_multiplexer_;
+    BufferedStreamSink<128> stdout_sink_;
+    AsciiProtocol ascii_;
+    UartSimple simple_;
+    DeferredLog::Reader stdout_reader_;
+};
+
+void Stm32UartTxStream::start_write(cbufptr_t buffer, TransferHandle* handle, Callback<void, WriteResult> completer) {
+    write_buf_ = buffer;
     completer_ = completer;
-    tx_end_ = buffer.begin() + chunk;
+    state_ = kStateWaiting;
 
     if (handle) {
         *handle = reinterpret_cast<TransferHandle>(this);
     }
 
-    if (HAL_UART_Transmit_DMA(huart_, const_cast<uint8_t*>(buffer.begin()), chunk) != HAL_OK) {
-        completer_ = nullptr;
-        tx_end_ = nullptr;
-        completer.invoke({kStreamError, buffer.begin()});
-    }
+    try_take_write();
 }
 
 void Stm32UartTxStream::cancel_write(TransferHandle transfer_handle) {
     // not implemented
 }
 
+// Copies the pending write to the staging buffer if it fits or sends it
+// directly if the UART is idle. Otherwise the write keeps waiting for
+// did_finish().
+void Stm32UartTxStream::try_take_write() {
+    size_t length = write_buf_.size();
+
+    if (length <= sizeof(staging_bufs_[0]) - staging_size_) {
+        memcpy(staging_bufs_[staging_idx_] + staging_size_, write_buf_.begin(), length);
+        staging_size_ += length;
+        write_end_ = write_buf_.end();
+        state_ = kStateBuffered;
+        if (!dma_active_) {
+            flush();
+        }
+    } else if (!dma_active_ && !staging_size_) {
+        size_t chunk = std::min(length, (size_t)UINT16_MAX); // DMA length limit
+        write_end_ = write_buf_.begin() + chunk;
+        state_ = kStateDirect;
+        dma_direct_ = true;
+        start_dma(write_buf_.begin(), chunk);
+    }
+}
+
+// Sends the staging buffer that is being filled and switches to the other one
+void Stm32UartTxStream::flush() {
+    if (staging_size_) {
+        const uint8_t* buffer = staging_bufs_[staging_idx_];
+        size_t length = staging_size_;
+        staging_idx_ ^= 1;
+        staging_size_ = 0;
+        dma_direct_ = false;
+        start_dma(buffer, length);
+    }
+}
+
+void Stm32UartTxStream::start_dma(const uint8_t* buffer, size_t length) {
+    dma_active_ = true;
+    if (HAL_UART_Transmit_DMA(huart_, const_cast<uint8_t*>(buffer), length) != HAL_OK) {
+        dma_active_ = false;
+        if (dma_direct_) {
+            dma_direct_ = false;
+            state_ = kStateIdle;
+            completer_.invoke_and_clear({kStreamError, write_buf_.begin()});
+        }
+        // Staged data is dropped. Its writes were already reported as done.
+    }
+}
+
+// Called on the UART thread after the TX DMA finished
 void Stm32UartTxStream::did_finish() {
-    const uint8_t* tx_end = tx_end_;
-    tx_end_ = nullptr;
-    completer_.invoke_and_clear({kStreamOk, tx_end});
+    dma_active_ = false;
+
+    if (dma_direct_) {
+        dma_direct_ = false;
+        state_ = kStateIdle;
+        completer_.invoke_and_clear({kStreamOk, write_end_}); // may start the next write
+    }
+
+    if (!dma_active_) {
+        flush();
+    }
+    if (state_ == kStateWaiting) {
+        try_take_write();
+    }
+}
+
+// Called on the UART thread before it waits for the next event. Completing
+// copied writes here rather than from within start_write() avoids recursion
+// into the writer.
+void Stm32UartTxStream::complete_buffered_write() {
+    while (state_ == kStateBuffered) {
+        state_ = kStateIdle;
+        completer_.invoke_and_clear({kStreamOk, write_end_}); // may start the next write
+    }
 }
 
 void Stm32UartRxStream::start_read(bufptr_t buffer, TransferHandle* handle, Callback<void, ReadResult> completer) {
@@ -86,15 +263,16 @@ void Stm32UartRxStream::start_read(bufptr_t buffer, TransferHandle* handle, Call
     if (handle) {
         *handle = reinterpret_cast<TransferHandle>(this);
     }
+    server_->rx_event(); // the DMA buffer may already contain data
 }
 
 void Stm32UartRxStream::cancel_read(TransferHandle transfer_handle) {
     // not implemented
 }
 
-void Stm32UartRxStream::did_receive(uint8_t* buffer, size_t length) {
-    // This can be called even if there was no RX operation in progress
-
+// Returns the number of bytes that were consumed, which is 0 if there was no
+// RX operation in progress
+size_t Stm32UartRxStream::did_receive(uint8_t* buffer, size_t length) {
     bufptr_t rx_buf = rx_buf_;
 
     if (completer_ && rx_buf.begin()) {
@@ -102,105 +280,226 @@ void Stm32UartRxStream::did_receive(uint8_t* buffer, size_t length) {
         size_t chunk = std::min(length, rx_buf.size());
         memcpy(rx_buf.begin(), buffer, chunk);
         completer_.invoke_and_clear({kStreamOk, rx_buf.begin() + chunk});
+        return chunk;
     }
+    return 0;
 }
 
-Stm32UartTxStream uart_tx_stream(huart_);
-Stm32UartRxStream uart_rx_stream;
+static UartServer uart_servers[UART_SERVER_COUNT];
+static size_t n_uart_servers = 0;
+static volatile bool stdout_event_pending = false;
 
-LegacyProtocolStreamBased fibre_over_uart(&uart_rx_stream, &uart_tx_stream);
+void UartServer::init(uint8_t index, UART_HandleTypeDef* huart, ODriveIntf::StreamProtocolType protocol) {
+    index_ = index;
+    huart_ = huart;
+    tx_stream_.huart_ = huart;
+    protocol_ = protocol;
+
+    // DMA is set up to receive in a circular buffer forever. The interrupts
+    // only wake the UART thread, which then copies the new data out of the
+    // circular buffer.
+    start_rx_dma();
+}
 
-fibre::AsyncStreamSinkMultiplexer<2> uart_tx_multiplexer(uart_tx_stream);
-fibre::BufferedStreamSink<64> uart0_stdout_sink(uart_tx_multiplexer); // Used in communication.cpp
-AsciiProtocol ascii_over_uart(&uart_rx_stream, &uart_tx_multiplexer);
+void UartServer::start_protocol() {
+    if (protocol_ == ODriveIntf::STREAM_PROTOCOL_TYPE_FIBRE
+            || protocol_ == ODriveIntf::STREAM_PROTOCOL_TYPE_FIBRE_COBS) {
+        fibre_.set_cobs_framing(protocol_ == ODriveIntf::STREAM_PROTOCOL_TYPE_FIBRE_COBS);
+        fibre_.start({});
+    } else if (protocol_ == ODriveIntf::STREAM_PROTOCOL_TYPE_ASCII
+            || protocol_ == ODriveIntf::STREAM_PROTOCOL_TYPE_ASCII_AND_STDOUT) {
+        ascii_.start();
+    } else if (protocol_ == ODriveIntf::STREAM_PROTOCOL_TYPE_SIMPLE) {
+        simple_.start();
+    }
+}
 
-bool uart0_stdout_pending = false;
+// (Re)starts the circular DMA reception. The DMA raises the half and full
+// transfer interrupts, the UART raises the IDLE interrupt one character time
+// after the last byte of a burst.
+void UartServer::start_rx_dma() {
+    HAL_UART_Receive_DMA(huart_, dma_rx_buffer_, sizeof(dma_rx_buffer_));
+    dma_last_rcv_idx_ = 0;
+    __HAL_UART_CLEAR_IDLEFLAG(huart_);
+    __HAL_UART_ENABLE_IT(huart_, UART_IT_IDLE);
+}
+
+// Wakes the UART thread to process the received bytes. Called from interrupts
+// and when a reader starts a new read.
+void UartServer::rx_event() {
+    if (!rx_event_pending_) {
+        rx_event_pending_ = true;
+        if (osMessagePut(uart_event_queue, (index_ << kUartEventShift) | kUartEventRx, 0) != osOK) {
+            rx_event_pending_ = false; // try again on the next interrupt
+        }
+    }
+}
+
+// Called on the UART thread before it waits for the next event. Returns the
+// time in ms until the server needs to be polled again.
+uint32_t UartServer::poll(uint32_t now) {
+    tx_stream_.complete_buffered_write();
+
+    uint32_t timeout = ascii_.poll_feedback(now);
+    if (stdout_enabled()) {
+        deferred_log.drain(&stdout_reader_, stdout_sink_);
+        timeout = std::min<uint32_t>(timeout, DEFERRED_LOG_POLL_INTERVAL_MS);
+    }
+    return timeout;
+}
+
+void UartServer::handle_event(uint32_t event) {
+    switch (event) {
+        case kUartEventRx: {
+            // This event is triggered by the IDLE line, DMA half/full
+            // transfer and error interrupts (see rx_event()).
+            rx_event_pending_ = false;
+
+            // Check for UART errors and restart receive DMA transfer if required
+            if (huart_->RxState != HAL_UART_STATE_BUSY_RX) {
+                HAL_UART_AbortReceive(huart_);
+                start_rx_dma();
+            }
+            process_rx();
+        } break;
+
+        case kUartEventTxDone: {
+            tx_stream_.did_finish();
+        } break;
+    }
+}
+
+// Hands the new bytes to the reader for as long as it starts new reads. Bytes
+// that aren't consumed stay in the buffer until the next read.
+void UartServer::process_rx() {
+    for (;;) {
+        // Fetch the circular buffer "write pointer", where it would write next
+        uint32_t new_rcv_idx = UART_RX_BUFFER_SIZE - huart_->hdmarx->Instance->NDTR;
+        if (new_rcv_idx > UART_RX_BUFFER_SIZE) { // defensive programming
+            break;
+        }
+
+        // Process bytes up to the end of the buffer in case there was a wrap
+        uint32_t chunk_end = new_rcv_idx < dma_last_rcv_idx_ ? UART_RX_BUFFER_SIZE : new_rcv_idx;
+        if (chunk_end == dma_last_rcv_idx_) {
+            break;
+        }
+        size_t n_consumed = rx_stream_.did_receive(dma_rx_buffer_ + dma_last_rcv_idx_,
+                chunk_end - dma_last_rcv_idx_);
+        if (!n_consumed) {
+            break;
+        }
+        dma_last_rcv_idx_ = (dma_last_rcv_idx_ + n_consumed) % UART_RX_BUFFER_SIZE;
+    }
+}
+
+static UartServer* find_uart_server(UART_HandleTypeDef* huart) {
+    for (size_t i = 0; i < n_uart_servers; ++i) {
+        if (uart_servers[i].huart_ == huart) {
+            return &uart_servers[i];
+        }
+    }
+    return nullptr;
+}
 
 static void uart_server_thread(void * ctx) {
     (void) ctx;
 
-    if (odrv.config_.uart0_protocol == ODrive::STREAM_PROTOCOL_TYPE_FIBRE) {
-        fibre_over_uart.start({});
-    } else if (odrv.config_.uart0_protocol == ODrive::STREAM_PROTOCOL_TYPE_ASCII
-            || odrv.config_.uart0_protocol == ODrive::STREAM_PROTOCOL_TYPE_ASCII_AND_STDOUT) {
-        ascii_over_uart.start();
+    for (size_t i = 0; i < n_uart_servers; ++i) {
+        uart_servers[i].start_protocol();
     }
 
     for (;;) {
-        osEvent event = osMessageGet(uart_event_queue, osWaitForever);
+        uint32_t now = HAL_GetTick();
+        uint32_t timeout = UINT32_MAX;
+        for (size_t i = 0; i < n_uart_servers; ++i) {
+            timeout = std::min(timeout, uart_servers[i].poll(now));
+        }
+
+        osEvent event = osMessageGet(uart_event_queue, timeout == UINT32_MAX ? osWaitForever : timeout);
 
         if (event.status != osEventMessage) {
             continue;
         }
 
-        switch (event.value.v) {
-            case 1: {
-                // This event is triggered by the control loop at 8kHz. This should be
-                // enough for most applications.
-                // At 1Mbaud/s that corresponds to at most 12.5 bytes which can arrive
-                // during the sleep period.
-
-                // Check for UART errors and restart receive DMA transfer if required
-                if (huart_->RxState != HAL_UART_STATE_BUSY_RX) {
-                    HAL_UART_AbortReceive(huart_);
-                    HAL_UART_Receive_DMA(huart_, dma_rx_buffer, sizeof(dma_rx_buffer));
-                    dma_last_rcv_idx = 0;
-                }
-                // Fetch the circular buffer "write pointer", where it would write next
-                uint32_t new_rcv_idx = UART_RX_BUFFER_SIZE - huart_->hdmarx->Instance->NDTR;
-                if (new_rcv_idx > UART_RX_BUFFER_SIZE) { // defensive programming
-                    continue;
-                }
-
-                // Process bytes in one or two chunks (two in case there was a wrap)
-                if (new_rcv_idx < dma_last_rcv_idx) {
-                    uart_rx_stream.did_receive(dma_rx_buffer + dma_last_rcv_idx,
-                            UART_RX_BUFFER_SIZE - dma_last_rcv_idx);
-                    dma_last_rcv_idx = 0;
-                }
-                if (new_rcv_idx > dma_last_rcv_idx) {
-                    uart_rx_stream.did_receive(dma_rx_buffer + dma_last_rcv_idx,
-                            new_rcv_idx - dma_last_rcv_idx);
-                    dma_last_rcv_idx = new_rcv_idx;
-                }
-            } break;
-
-            case 2: {
-                uart_tx_stream.did_finish();
-            } break;
-
-            case 3: { // stdout has data
-                uart0_stdout_pending = false;
-                uart0_stdout_sink.maybe_start_async_write();
-            } break;
+        uint32_t code = event.value.v & ((1 << kUartEventShift) - 1);
+        size_t index = event.value.v >> kUartEventShift;
+        if (code == kUartEventStdout) {
+            stdout_event_pending = false; // stdout is sent at the top of the loop
+        } else if (index < n_uart_servers) {
+            uart_servers[index].handle_event(code);
         }
     }
 }
 
-// TODO: allow multiple UART server instances
-void start_uart_server(UART_HandleTypeDef* huart) {
-    huart_ = huart;
-    uart_tx_stream.huart_ = huart;
+void start_uart_servers(osPriority priority) {
+    struct {
+        bool enabled;
+        UART_HandleTypeDef* huart;
+        ODriveIntf::StreamProtocolType protocol;
+    } uarts[] = {
+        {odrv.config_.enable_uart_a, uart_a, odrv.config_.uart0_protocol},
+        {odrv.config_.enable_uart_b, uart_b, odrv.config_.uart1_protocol},
+        {odrv.config_.enable_uart_c, uart_c, odrv.config_.uart2_protocol},
+    };
+
+    for (auto& uart : uarts) {
+        if (!uart.enabled || !uart.huart) {
+            continue;
+        }
+        if (n_uart_servers >= UART_SERVER_COUNT) {
+            odrv.misconfigured_ = true; // more UARTs enabled than this build supports
+            break;
+        }
+        uart_servers[n_uart_servers].init(n_uart_servers, uart.huart, uart.protocol);
+        n_uart_servers++;
+    }
+
+    if (n_uart_servers) {
+        // Start UART communication thread
+        osThreadStaticDef(uart_server_thread_def, uart_server_thread, priority, 0, stack_size_uart_thread / sizeof(StackType_t) /* the ascii protocol needs considerable stack space */, uart_thread_stack, &uart_thread_cb);
+        uart_thread = osThreadCreate(osThread(uart_server_thread_def), NULL);
+    }
+}
 
-    // DMA is set up to receive in a circular buffer forever.
-    // We dont use interrupts to fetch the data, instead we periodically read
-    // data out of the circular buffer into a parse buffer, controlled by a state machine
-    HAL_UART_Receive_DMA(huart_, dma_rx_buffer, sizeof(dma_rx_buffer));
-    dma_last_rcv_idx = 0;
+void uart_notify_stdout() {
+    if (uart_thread && !stdout_event_pending) {
+        stdout_event_pending = true;
+        if (osMessagePut(uart_event_queue, kUartEventStdout, 0) != osOK) {
+            stdout_event_pending = false;
+        }
+    }
+}
+
+void uart_irq_handler(UART_HandleTypeDef* huart) {
+    UartServer* server = find_uart_server(huart);
+    if (server && __HAL_UART_GET_FLAG(huart, UART_FLAG_IDLE)
+            && __HAL_UART_GET_IT_SOURCE(huart, UART_IT_IDLE)) {
+        __HAL_UART_CLEAR_IDLEFLAG(huart);
+        server->rx_event();
+    }
+}
 
-    // Start UART communication thread
-    osThreadDef(uart_server_thread_def, uart_server_thread, osPriorityNormal, 0, stack_size_uart_thread / sizeof(StackType_t) /* the ascii protocol needs considerable stack space */);
-    uart_thread = osThreadCreate(osThread(uart_server_thread_def), NULL);
+void HAL_UART_RxHalfCpltCallback(UART_HandleTypeDef* huart) {
+    if (UartServer* server = find_uart_server(huart)) {
+        server->rx_event();
+    }
+}
+
+void HAL_UART_RxCpltCallback(UART_HandleTypeDef* huart) {
+    if (UartServer* server = find_uart_server(huart)) {
+        server->rx_event();
+    }
 }
 
-void uart_poll() {
-    if (uart_thread) { // the thread is only started if UART is enabled
-        osMessagePut(uart_event_queue, 1, 0);
+void HAL_UART_ErrorCallback(UART_HandleTypeDef* huart) {
+    if (UartServer* server = find_uart_server(huart)) {
+        server->rx_event(); // the thread restarts the DMA if the HAL aborted it
     }
 }
 
 void HAL_UART_TxCpltCallback(UART_HandleTypeDef* huart) {
-    if (huart == huart_) {
-        osMessagePut(uart_event_queue, 2, 0);
+    if (UartServer* server = find_uart_server(huart)) {
+        server->tx_done();
     }
 }
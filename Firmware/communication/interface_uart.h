@@ -12,18 +12,16 @@ extern "C" {
 extern osThreadId uart_thread;
 extern const uint32_t stack_size_uart_thread;
 
-void start_uart_server(UART_HandleTypeDef* huart);
-void uart_poll(void);
+// Starts a server on every enabled UART, each with the protocol from
+// config.uart0_protocol (UART A), uart1_protocol (B) or uart2_protocol (C)
+void start_uart_servers(osPriority priority);
+// Wakes the UART thread to send new stdout data
+void uart_notify_stdout(void);
+// Must be called at the beginning of the IRQ handler of the UART
+void uart_irq_handler(UART_HandleTypeDef* huart);
 
 #ifdef __cplusplus
 }
 #endif
 
-
-#ifdef __cplusplus
-#include <fibre/../../stream_utils.hpp>
-extern fibre::BufferedStreamSink<64> uart0_stdout_sink;
-extern bool uart0_stdout_pending;
-#endif
-
 #endif // __INTERFACE_UART_HPP
@@ -1,6 +1,7 @@
 
 #include "interface_usb.h"
 #include "ascii_protocol.hpp"
+#include "deferred_log.hpp"
 
 #include <MotorControl/utils.hpp>
 
@@ -16,36 +17,88 @@
 
 osThreadId usb_thread;
 const uint32_t stack_size_usb_thread = 4096; // Bytes
+CCMRAM static StackType_t usb_thread_stack[stack_size_usb_thread / sizeof(StackType_t)];
+CCMRAM static osStaticThreadDef_t usb_thread_cb;
 USBStats_t usb_stats_;
 
 namespace fibre {
 
+/**
+ * @brief Sends on a USB IN endpoint with two packet buffers (ping-pong).
+ *
+ * A write is completed as soon as it is copied into a free packet buffer, so
+ * the writer can prepare the next packet while the previous one is on the
+ * wire. When a packet is sent, the USB interrupt starts the other buffer right
+ * away, so the endpoint doesn't wait for the USB thread to be scheduled. The
+ * USB thread is only notified if a writer waits for a free buffer.
+ */
 class Stm32UsbTxStream : public AsyncStreamSink {
 public:
-    Stm32UsbTxStream(uint8_t endpoint_num) : endpoint_num_(endpoint_num) {}
+    Stm32UsbTxStream(uint8_t endpoint_num, uint32_t event) : endpoint_num_(endpoint_num), event_(event) {}
 
     void start_write(cbufptr_t buffer, TransferHandle* handle, Callback<void, WriteResult> completer) final;
     void cancel_write(TransferHandle transfer_handle) final;
+    void reset(bool connected, size_t mtu = 0);
     void did_finish();
+    void on_packet_sent(); // called from the USB interrupt
+
+private:
+    bool start_transmission();
 
     const uint8_t endpoint_num_;
+    const uint32_t event_; // posted to usb_event_queue for did_finish()
     bool connected_ = false;
+    size_t mtu_ = 0; // largest write, depends on the USB speed
+    bool delivering_ = false; // did_finish() is running
     Callback<void, WriteResult> completer_;
-    const uint8_t* tx_end_ = nullptr;
+    cbufptr_t tx_buf_ = {nullptr, nullptr};
+
+    // Shared with the USB interrupt
+    uint8_t packets_[2][USB_TX_DATA_SIZE];
+    size_t lengths_[2];
+    volatile size_t head_ = 0; // oldest queued packet
+    volatile size_t n_queued_ = 0;
+    volatile bool transmitting_ = false;
+    volatile bool waiting_ = false; // the writer waits for a free buffer
 };
 
+/**
+ * @brief Receives on a USB OUT endpoint with two packet buffers (ping-pong).
+ *
+ * When a packet arrives, the USB interrupt primes the endpoint with the other
+ * buffer right away, so the host can send the next packet before the USB
+ * thread was scheduled. Reads are served from the received packets and can
+ * be smaller than a packet. The USB thread is only notified if a reader waits
+ * for data.
+ */
 class Stm32UsbRxStream : public AsyncStreamSource {
 public:
-    Stm32UsbRxStream(uint8_t endpoint_num) : endpoint_num_(endpoint_num) {}
+    Stm32UsbRxStream(uint8_t endpoint_num, uint32_t event) : endpoint_num_(endpoint_num), event_(event) {}
 
     void start_read(bufptr_t buffer, TransferHandle* handle, Callback<void, ReadResult> completer) final;
     void cancel_read(TransferHandle transfer_handle) final;
+    void reset(bool connected);
     void did_finish();
-    
+    void on_packet_received(size_t length); // called from the USB interrupt
+
+private:
+    bool prime();
+
     const uint8_t endpoint_num_;
+    const uint32_t event_; // posted to usb_event_queue for did_finish()
     bool connected_ = false;
+    bool delivering_ = false; // did_finish() is running
     Callback<void, ReadResult> completer_;
-    uint8_t* rx_end_ = nullptr;
+    bufptr_t rx_buf_ = {nullptr, nullptr};
+    size_t offset_ = 0; // bytes of the head packet that were already read
+
+    // Shared with the USB interrupt
+    uint8_t packets_[2][USB_RX_DATA_SIZE];
+    size_t lengths_[2];
+    volatile size_t head_ = 0; // oldest received packet
+    volatile size_t n_full_ = 0;
+    volatile bool primed_ = false; // the endpoint receives into the packet after the full ones
+    volatile bool waiting_ = false; // the reader waits for data
 };
 
 }
@@ -63,24 +116,100 @@ void Stm32UsbTxStream::start_write(cbufptr_t buffer, TransferHandle* handle, Cal
     }
 
     // Note on MTU: on the physical layer, a full speed device can transmit up
-    // to 64 bytes of payload per bulk package. However a single logical
-    // transfer can consist of multiple 64 byte packets terminated by a 0 byte
-    // packet. Currently we don't implement this segmentation. Therefore we
-    // must ensure that all packets are < 64 bytes, otherwise the host will wait
-    // for more.
-    if (buffer.size() >= USB_TX_DATA_SIZE) {
+    // to 64 bytes of payload per bulk package (512 bytes at high speed).
+    // However a single logical transfer can consist of multiple max size
+    // packets terminated by a 0 byte packet. Currently we don't implement this
+    // segmentation. Therefore we must ensure that all packets are shorter than
+    // the max packet size, otherwise the host will wait for more.
+    if (buffer.size() > mtu_) {
         completer.invoke({kStreamError, buffer.begin()});
         return;
     }
 
-    if (completer_ || tx_end_) {
+    if (completer_) {
         completer.invoke({kStreamError, buffer.begin()});
         return;
     }
 
     completer_ = completer;
-    tx_end_ = buffer.end();
+    tx_buf_ = buffer;
+
+    // If this is called from a completion callback, the loop in did_finish()
+    // takes care of it. This keeps the stack flat for writers that write
+    // again from the callback.
+    if (!delivering_) {
+        did_finish();
+    }
+}
+
+void Stm32UsbTxStream::cancel_write(TransferHandle transfer_handle) {
+    // not implemented
+}
+
+void Stm32UsbTxStream::reset(bool connected, size_t mtu) {
+    mtu_ = mtu;
+    CRITICAL_SECTION() {
+        connected_ = connected;
+        head_ = 0;
+        n_queued_ = 0;
+        transmitting_ = false;
+        waiting_ = false;
+    }
+    completer_.invoke_and_clear({kStreamClosed, tx_buf_.begin()});
+}
+
+// Moves the pending write into a free packet buffer. Called in the USB thread.
+void Stm32UsbTxStream::did_finish() {
+    delivering_ = true;
+    while (completer_) {
+        // The interrupt only dequeues packets, which doesn't move the free
+        // buffer after the queued ones
+        size_t tail = 0;
+        bool full = false;
+        CRITICAL_SECTION() {
+            tail = (head_ + n_queued_) & 1;
+            full = n_queued_ >= 2;
+            waiting_ = full;
+        }
+        if (full) {
+            break;
+        }
 
+        memcpy(packets_[tail], tx_buf_.begin(), tx_buf_.size());
+        lengths_[tail] = tx_buf_.size();
+
+        bool ok = true;
+        CRITICAL_SECTION() {
+            n_queued_ = n_queued_ + 1;
+            if (!transmitting_) {
+                ok = start_transmission();
+            }
+        }
+        completer_.invoke_and_clear({ok ? kStreamOk : kStreamError, ok ? tx_buf_.end() : tx_buf_.begin()});
+    }
+    delivering_ = false;
+}
+
+void Stm32UsbTxStream::on_packet_sent() {
+    if (!transmitting_) {
+        return; // started before reset()
+    }
+    transmitting_ = false;
+    head_ = head_ ^ 1;
+    n_queued_ = n_queued_ - 1;
+    if (n_queued_) {
+        start_transmission();
+    }
+    if (waiting_) {
+        waiting_ = false;
+        osMessagePut(usb_event_queue, event_, 0);
+    }
+}
+
+// Sends the head packet. Called with interrupts disabled or from the USB
+// interrupt. Failed packets are dropped.
+bool Stm32UsbTxStream::start_transmission() {
+    size_t head = head_;
     if (
 #if HW_VERSION_MAJOR == 3 // TODO: remove preprocessor switch
         CDC_Transmit_FS
@@ -89,20 +218,13 @@ void Stm32UsbTxStream::start_write(cbufptr_t buffer, TransferHandle* handle, Cal
 #else
 #error "not supported"
 #endif
-        (const_cast<uint8_t*>(buffer.begin()), buffer.size(), endpoint_num_) != USBD_OK) {
-        tx_end_ = nullptr;
-        completer_.invoke_and_clear({kStreamError, buffer.begin()});
+        (packets_[head], lengths_[head], endpoint_num_) != USBD_OK) {
+        head_ = head ^ 1;
+        n_queued_ = n_queued_ - 1;
+        return false;
     }
-}
-
-void Stm32UsbTxStream::cancel_write(TransferHandle transfer_handle) {
-    // not implemented
-}
-
-void Stm32UsbTxStream::did_finish() {
-    const uint8_t* tx_end = tx_end_;
-    tx_end_ = nullptr;
-    completer_.invoke_and_clear({connected_ ? kStreamOk : kStreamClosed, tx_end});
+    transmitting_ = true;
+    return true;
 }
 
 void Stm32UsbRxStream::start_read(bufptr_t buffer, TransferHandle* handle, Callback<void, ReadResult> completer) {
@@ -115,50 +237,140 @@ void Stm32UsbRxStream::start_read(bufptr_t buffer, TransferHandle* handle, Callb
         return;
     }
 
-    if (completer_ || rx_end_) {
+    if (completer_) {
         completer.invoke({kStreamError, buffer.begin()});
         return;
     }
 
     completer_ = completer;
-    rx_end_ = buffer.begin(); // the pointer is updated at the end of the transfer
+    rx_buf_ = buffer;
 
-    if (USBD_CDC_ReceivePacket(&usb_dev_handle, buffer.begin(), buffer.size(), endpoint_num_) != USBD_OK) {
-        rx_end_ = nullptr;
+    bool primed = false;
+    CRITICAL_SECTION() {
+        primed = primed_ || n_full_ >= 2;
+    }
+    if (!primed && !prime()) {
         completer_.invoke_and_clear({kStreamError, buffer.begin()});
         return;
     }
+
+    // See Stm32UsbTxStream::start_write()
+    if (!delivering_) {
+        did_finish();
+    }
 }
 
 void Stm32UsbRxStream::cancel_read(TransferHandle transfer_handle) {
     // not implemented
 }
 
+void Stm32UsbRxStream::reset(bool connected) {
+    CRITICAL_SECTION() {
+        connected_ = connected;
+        head_ = 0;
+        n_full_ = 0;
+        primed_ = false;
+        waiting_ = false;
+    }
+    offset_ = 0;
+    completer_.invoke_and_clear({kStreamClosed, rx_buf_.begin()});
+}
+
+// Serves the pending read from the received packets. Called in the USB thread.
 void Stm32UsbRxStream::did_finish() {
-    uint8_t* rx_end = rx_end_;
-    rx_end_ = nullptr;
-    completer_.invoke_and_clear({connected_ ? kStreamOk : kStreamClosed, rx_end});
+    delivering_ = true;
+    while (completer_) {
+        bool empty = false;
+        CRITICAL_SECTION() {
+            empty = !n_full_;
+            waiting_ = empty;
+        }
+        if (empty) {
+            break;
+        }
+
+        size_t head = head_;
+        size_t n_copy = std::min(lengths_[head] - offset_, rx_buf_.size());
+        memcpy(rx_buf_.begin(), packets_[head] + offset_, n_copy);
+        offset_ += n_copy;
+
+        if (offset_ >= lengths_[head]) {
+            offset_ = 0;
+            bool primed = false;
+            CRITICAL_SECTION() {
+                head_ = head ^ 1;
+                n_full_ = n_full_ - 1;
+                primed = primed_;
+            }
+            if (!primed) {
+                prime();
+            }
+        }
+        completer_.invoke_and_clear({kStreamOk, rx_buf_.begin() + n_copy});
+    }
+    delivering_ = false;
+}
+
+void Stm32UsbRxStream::on_packet_received(size_t length) {
+    if (!primed_) {
+        return; // primed before reset()
+    }
+    lengths_[(head_ + n_full_) & 1] = length;
+    n_full_ = n_full_ + 1;
+    primed_ = false;
+    if (n_full_ < 2) {
+        prime();
+    }
+    if (waiting_) {
+        waiting_ = false;
+        osMessagePut(usb_event_queue, event_, 0);
+    }
+}
+
+// Receives the next packet into the buffer after the full ones. Called in the
+// USB thread while the endpoint is not primed or from the USB interrupt.
+bool Stm32UsbRxStream::prime() {
+    bool ok = false;
+    CRITICAL_SECTION() {
+        size_t tail = (head_ + n_full_) & 1;
+        ok = USBD_CDC_ReceivePacket(&usb_dev_handle, packets_[tail], USB_RX_DATA_SIZE, endpoint_num_) == USBD_OK;
+        primed_ = ok;
+    }
+    return ok;
 }
 
-Stm32UsbTxStream usb_cdc_tx_stream(CDC_IN_EP);
-Stm32UsbTxStream usb_native_tx_stream(ODRIVE_IN_EP);
-Stm32UsbRxStream usb_cdc_rx_stream(CDC_OUT_EP);
-Stm32UsbRxStream usb_native_rx_stream(ODRIVE_OUT_EP);
+Stm32UsbTxStream usb_cdc_tx_stream(CDC_IN_EP, 3);
+Stm32UsbTxStream usb_native_tx_stream(ODRIVE_IN_EP, 4);
+Stm32UsbRxStream usb_cdc_rx_stream(CDC_OUT_EP, 5);
+Stm32UsbRxStream usb_native_rx_stream(ODRIVE_OUT_EP, 6);
 
 LegacyProtocolStreamBased fibre_over_cdc(&usb_cdc_rx_stream, &usb_cdc_tx_stream);
-LegacyProtocolPacketBased fibre_over_usb(&usb_native_rx_stream, &usb_native_tx_stream, USB_TX_DATA_SIZE - 1); // See note on MTU above
+fibre::AsyncStreamSinkMultiplexer<2> usb_native_tx_multiplexer(usb_native_tx_stream); // shared with the telemetry stream
+LegacyProtocolPacketBased fibre_over_usb(&usb_native_rx_stream, &usb_native_tx_multiplexer, USB_TX_DATA_SIZE - 1); // MTU is updated on connection, see note on MTU above
 
 fibre::AsyncStreamSinkMultiplexer<2> usb_cdc_tx_multiplexer(usb_cdc_tx_stream);
-fibre::BufferedStreamSink<64> usb_cdc_stdout_sink(usb_cdc_tx_multiplexer); // Used in communication.cpp
+fibre::BufferedStreamSink<128> usb_cdc_stdout_sink(usb_cdc_tx_multiplexer);
 AsciiProtocol ascii_over_cdc(&usb_cdc_rx_stream, &usb_cdc_tx_multiplexer);
 
 bool usb_cdc_stdout_pending = false;
+static DeferredLog::Reader usb_cdc_stdout_reader;
 
 static void usb_server_thread(void * ctx) {
     (void) ctx;
  
     for (;;) {
-        osEvent event = osMessageGet(usb_event_queue, osWaitForever);
+        // The subscribed properties and the ASCII feedback stream are sent
+        // from this thread because it runs the endpoint handlers of
+        // fibre_over_usb and the ASCII protocol on the CDC interface
+        uint32_t now = HAL_GetTick();
+        uint32_t timeout = std::min(fibre_over_usb.poll_subscriptions(now),
+                                    ascii_over_cdc.poll_feedback(now));
+        if (odrv.config_.usb_cdc_protocol == ODrive::STREAM_PROTOCOL_TYPE_STDOUT
+                || odrv.config_.usb_cdc_protocol == ODrive::STREAM_PROTOCOL_TYPE_ASCII_AND_STDOUT) {
+            deferred_log.drain(&usb_cdc_stdout_reader, usb_cdc_stdout_sink);
+            timeout = std::min<uint32_t>(timeout, DEFERRED_LOG_POLL_INTERVAL_MS);
+        }
+        osEvent event = osMessageGet(usb_event_queue, timeout == UINT32_MAX ? osWaitForever : timeout);
 
         if (event.status != osEventMessage) {
             continue;
@@ -168,14 +380,24 @@ static void usb_server_thread(void * ctx) {
 
         switch (event.value.v) {
             case 1: { // USB connected event
-                usb_cdc_tx_stream.connected_ = true;
-                usb_native_tx_stream.connected_ = true;
-                usb_cdc_rx_stream.connected_ = true;
-                usb_native_rx_stream.connected_ = true;
-
+                // The host reads the packet size from the endpoint
+                // descriptors, so a high speed link gets larger packets
+                // without further negotiation
+                size_t max_packet_size = usb_dev_handle.dev_speed == USBD_SPEED_HIGH
+                        ? CDC_DATA_HS_MAX_PACKET_SIZE : CDC_DATA_FS_MAX_PACKET_SIZE;
+                size_t mtu = std::min<size_t>(USB_TX_DATA_SIZE, max_packet_size - 1);
+
+                usb_cdc_tx_stream.reset(true, mtu);
+                usb_native_tx_stream.reset(true, mtu);
+                usb_cdc_rx_stream.reset(true);
+                usb_native_rx_stream.reset(true);
+
+                fibre_over_usb.set_tx_mtu(mtu);
                 fibre_over_usb.start({});
 
-                if (odrv.config_.usb_cdc_protocol == ODrive::STREAM_PROTOCOL_TYPE_FIBRE) {
+                if (odrv.config_.usb_cdc_protocol == ODrive::STREAM_PROTOCOL_TYPE_FIBRE
+                        || odrv.config_.usb_cdc_protocol == ODrive::STREAM_PROTOCOL_TYPE_FIBRE_COBS) {
+                    fibre_over_cdc.set_cobs_framing(odrv.config_.usb_cdc_protocol == ODrive::STREAM_PROTOCOL_TYPE_FIBRE_COBS);
                     fibre_over_cdc.start({});
                 } else if (odrv.config_.usb_cdc_protocol == ODrive::STREAM_PROTOCOL_TYPE_ASCII
                         || odrv.config_.usb_cdc_protocol == ODrive::STREAM_PROTOCOL_TYPE_ASCII_AND_STDOUT) {
@@ -184,14 +406,10 @@ static void usb_server_thread(void * ctx) {
             } break;
 
             case 2: { // USB disconnected event
-                usb_cdc_tx_stream.connected_ = false;
-                usb_native_tx_stream.connected_ = false;
-                usb_cdc_rx_stream.connected_ = false;
-                usb_native_rx_stream.connected_ = false;
-                usb_cdc_tx_stream.did_finish();
-                usb_native_tx_stream.did_finish();
-                usb_cdc_rx_stream.did_finish();
-                usb_native_rx_stream.did_finish();
+                usb_cdc_tx_stream.reset(false);
+                usb_native_tx_stream.reset(false);
+                usb_cdc_rx_stream.reset(false);
+                usb_native_rx_stream.reset(false);
             } break;
 
             case 3: { // TX on CDC interface done
@@ -210,28 +428,37 @@ static void usb_server_thread(void * ctx) {
                 usb_native_rx_stream.did_finish();
             } break;
 
-            case 7: { // stdout has data
+            case 7: { // stdout has data, it's sent at the top of the loop
                 usb_cdc_stdout_pending = false;
-                usb_cdc_stdout_sink.maybe_start_async_write();
+            } break;
+
+            case 8: { // telemetry frame ready
+                odrv.telemetry_.send_pending();
             } break;
         }
     }
 }
 
-// Called from CDC_Receive_FS callback function, this allows the communication
-// thread to handle the incoming data
+// Called from CDC_Receive_FS callback function in the USB interrupt
 void usb_rx_process_packet(uint8_t *buf, uint32_t len, uint8_t endpoint_pair) {
-    if (endpoint_pair == CDC_OUT_EP && usb_cdc_rx_stream.rx_end_) {
-        usb_cdc_rx_stream.rx_end_ += len;
-        osMessagePut(usb_event_queue, 5, 0);
-    } else if (endpoint_pair == ODRIVE_OUT_EP && usb_native_rx_stream.rx_end_) {
-        usb_native_rx_stream.rx_end_ += len;
-        osMessagePut(usb_event_queue, 6, 0);
+    if (endpoint_pair == CDC_OUT_EP) {
+        usb_cdc_rx_stream.on_packet_received(len);
+    } else if (endpoint_pair == ODRIVE_OUT_EP) {
+        usb_native_rx_stream.on_packet_received(len);
+    }
+}
+
+// Called from USBD_CDC_DataIn in the USB interrupt
+void usb_tx_process_done(uint8_t endpoint_pair) {
+    if (endpoint_pair == CDC_IN_EP) {
+        usb_cdc_tx_stream.on_packet_sent();
+    } else if (endpoint_pair == ODRIVE_IN_EP) {
+        usb_native_tx_stream.on_packet_sent();
     }
 }
 
-void start_usb_server() {
+void start_usb_server(osPriority priority) {
     // Start USB communication thread
-    osThreadDef(usb_server_thread_def, usb_server_thread, osPriorityNormal, 0, stack_size_usb_thread / sizeof(StackType_t));
+    osThreadStaticDef(usb_server_thread_def, usb_server_thread, priority, 0, stack_size_usb_thread / sizeof(StackType_t), usb_thread_stack, &usb_thread_cb);
     usb_thread = osThreadCreate(osThread(usb_server_thread_def), NULL);
 }
@@ -21,7 +21,8 @@ typedef struct {
 extern USBStats_t usb_stats_;
 
 void usb_rx_process_packet(uint8_t *buf, uint32_t len, uint8_t endpoint_pair);
-void start_usb_server(void);
+void usb_tx_process_done(uint8_t endpoint_pair);
+void start_usb_server(osPriority priority);
 
 #ifdef __cplusplus
 }
@@ -30,7 +31,8 @@ void start_usb_server(void);
 
 #ifdef __cplusplus
 #include <fibre/../../stream_utils.hpp>
-extern fibre::BufferedStreamSink<64> usb_cdc_stdout_sink;
+extern fibre::BufferedStreamSink<128> usb_cdc_stdout_sink;
+extern fibre::AsyncStreamSinkMultiplexer<2> usb_native_tx_multiplexer;
 extern bool usb_cdc_stdout_pending;
 #endif
 
@@ -0,0 +1,56 @@
+#include "uart_simple.hpp"
+#include "odrive_main.h"
+
+using namespace fibre;
+
+void UartSimple::start() {
+    frame_len_ = 0;
+    frame_overflow_ = false;
+    TransferHandle dummy;
+    rx_channel_->start_read(rx_buf_, &dummy, MEMBER_CB(this, on_read_finished));
+}
+
+bool UartSimple::send_message(const can_Message_t& message) {
+    uint8_t buf[UartSimpleFrame::MAX_ENCODED_SIZE];
+    size_t len = UartSimpleFrame::encode(message, buf, sizeof(buf));
+
+    // Drop the whole frame rather than a part of it if the host doesn't
+    // keep up
+    if (!len || len > sink_.get_free_space()) {
+        return false;
+    }
+    sink_.write({buf, len});
+    sink_.maybe_start_async_write();
+    return true;
+}
+
+void UartSimple::on_read_finished(ReadResult result) {
+    if (result.status != kStreamOk) {
+        return;
+    }
+
+    for (const uint8_t* it = rx_buf_; it < result.end; ++it) {
+        if (*it) {
+            if (frame_len_ < sizeof(frame_buf_)) {
+                frame_buf_[frame_len_++] = *it;
+            } else {
+                frame_overflow_ = true;
+            }
+            continue;
+        }
+
+        // End of frame. Empty frames are just padding that a host can send
+        // to resynchronize.
+        can_Message_t msg;
+        if (frame_overflow_ || (frame_len_ && !UartSimpleFrame::decode(frame_buf_, frame_len_, &msg))) {
+            n_rx_errors_++;
+        } else if (frame_len_) {
+            odrv.can_.can_simple_.execute_frame(msg, this);
+        }
+        frame_len_ = 0;
+        frame_overflow_ = false;
+    }
+
+    TransferHandle dummy;
+    rx_channel_->start_read(rx_buf_, &dummy, MEMBER_CB(this, on_read_finished));
+}
@@ -0,0 +1,48 @@
+#ifndef __UART_SIMPLE_HPP
+#define __UART_SIMPLE_HPP
+
+#include <fibre/async_stream.hpp>
+#include <fibre/../../stream_utils.hpp>
+#include "can/canbus.hpp"
+#include "uart_simple_frame.hpp"
+
+/**
+ * @brief Runs the CANSimple command set over a byte stream, with the frames
+ * encoded as described in UartSimpleFrame.
+ *
+ * This gives microcontroller hosts the compact fixed-layout messages of CAN
+ * without a CAN transceiver. The commands are executed by the CANSimple
+ * instance of the CAN interface (its periodic messages and events stay on the
+ * CAN bus). Responses are sent back on this stream, so this class looks like
+ * a CAN bus to CANSimple.
+ */
+class UartSimple : public CanBusBase {
+public:
+    UartSimple(fibre::AsyncStreamSource* rx_channel, fibre::AsyncStreamSink* tx_channel)
+        : rx_channel_(rx_channel), sink_(*tx_channel) {}
+
+    void start();
+
+    bool send_message(const can_Message_t& message) final;
+
+    // The frames reach the axes without subscriptions
+    bool subscribe(const MsgIdFilterSpecs& filter, on_can_message_cb_t callback, void* ctx, CanSubscription** handle) final { return false; }
+    bool unsubscribe(CanSubscription* handle) final { return false; }
+
+    uint32_t n_rx_errors_ = 0; // frames that were dropped because they were corrupted or too long
+
+private:
+    void on_read_finished(fibre::ReadResult result);
+
+    fibre::AsyncStreamSource* rx_channel_ = nullptr;
+    uint8_t rx_buf_[64];
+
+    // Encoded frame received so far (without delimiter)
+    uint8_t frame_buf_[UartSimpleFrame::MAX_ENCODED_SIZE];
+    size_t frame_len_ = 0;
+    bool frame_overflow_ = false;
+
+    fibre::BufferedStreamSink<256> sink_;
+};
+
+#endif // __UART_SIMPLE_HPP
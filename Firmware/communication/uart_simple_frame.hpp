@@ -0,0 +1,127 @@
+#ifndef __UART_SIMPLE_FRAME_HPP
+#define __UART_SIMPLE_FRAME_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include "can/can_helpers.hpp"
+#include <fibre/../../crc.hpp>
+
+/**
+ * @brief Encodes CANSimple messages for a byte stream such as UART.
+ *
+ * A frame consists of:
+ *  - The message ID (uint16 little endian). Bits 0-10 are the 11 bit
+ *    arbitration ID, bit 15 is the RTR flag, the others are zero.
+ *  - The data bytes (0 to 8, so the length of the frame determines the DLC).
+ *  - A CRC8 over the ID and data bytes (same polynomial and initial value as
+ *    the fibre stream protocol).
+ *
+ * The frame is COBS encoded (consistent overhead byte stuffing) and ends with
+ * a zero byte, so a receiver can find the start of the next frame after any
+ * corrupted byte.
+ */
+struct UartSimpleFrame {
+    static constexpr uint8_t CRC8_POLYNOMIAL = 0x37;
+    static constexpr uint8_t CRC8_INIT = 0x42;
+    static constexpr uint16_t RTR_FLAG = 0x8000;
+
+    static constexpr size_t MAX_RAW_SIZE = 2 + 8 + 1;
+    // One COBS code byte and the delimiter. The frames are shorter than a
+    // COBS block (254 bytes), so the encoder never needs an extra code byte.
+    static constexpr size_t MAX_ENCODED_SIZE = MAX_RAW_SIZE + 2;
+    static_assert(MAX_RAW_SIZE < 254, "frames must fit in one COBS block");
+
+    /**
+     * @brief Encodes msg into buffer, including the trailing zero byte.
+     * @returns The number of bytes written or 0 if the message has an
+     *          extended ID or doesn't fit.
+     */
+    static size_t encode(const can_Message_t& msg, uint8_t* buffer, size_t length) {
+        if (msg.isExt || msg.id > 0x7ff || msg.len > 8 || length < MAX_ENCODED_SIZE) {
+            return 0;
+        }
+
+        uint8_t raw[MAX_RAW_SIZE];
+        size_t raw_len = 0;
+        uint16_t id = msg.id | (msg.rtr ? RTR_FLAG : 0);
+        raw[raw_len++] = id & 0xff;
+        raw[raw_len++] = id >> 8;
+        size_t data_len = msg.rtr ? 0 : msg.len;
+        for (size_t i = 0; i < data_len; ++i) {
+            raw[raw_len++] = msg.buf[i];
+        }
+        raw[raw_len] = calc_crc8<CRC8_POLYNOMIAL>(CRC8_INIT, raw, raw_len);
+        raw_len++;
+
+        // COBS: every zero byte is replaced by the distance to the next one.
+        // The first (code) byte holds the distance to the first zero byte.
+        size_t code_pos = 0;
+        size_t pos = 1;
+        uint8_t code = 1;
+        for (size_t i = 0; i < raw_len; ++i) {
+            if (raw[i]) {
+                buffer[pos++] = raw[i];
+                code++;
+            } else {
+                buffer[code_pos] = code;
+                code_pos = pos++;
+                code = 1;
+            }
+        }
+        buffer[code_pos] = code;
+        buffer[pos++] = 0;
+        return pos;
+    }
+
+    /**
+     * @brief Decodes a frame.
+     * @param buffer: The COBS encoded frame without the trailing zero byte.
+     * @returns False if the frame is malformed or the CRC doesn't match.
+     */
+    static bool decode(const uint8_t* buffer, size_t length, can_Message_t* msg) {
+        // Every write to raw is checked against its size, so no input can
+        // overrun it.
+        uint8_t raw[MAX_RAW_SIZE];
+        size_t raw_len = 0;
+        for (size_t i = 0; i < length;) {
+            uint8_t code = buffer[i++];
+            if (!code || i + code - 1 > length) {
+                return false;
+            }
+            for (uint8_t j = 1; j < code; ++j) {
+                if (raw_len >= MAX_RAW_SIZE) {
+                    return false;
+                }
+                raw[raw_len++] = buffer[i++];
+            }
+            if (code != 0xff && i < length) {
+                if (raw_len >= MAX_RAW_SIZE) {
+                    return false;
+                }
+                raw[raw_len++] = 0;
+            }
+        }
+
+        if (raw_len < 3 || calc_crc8<CRC8_POLYNOMIAL>(CRC8_INIT, raw, raw_len - 1) != raw[raw_len - 1]) {
+            return false;
+        }
+
+        uint16_t id = raw[0] | (raw[1] << 8);
+        if (id & ~(RTR_FLAG | 0x7ff)) {
+            return false;
+        }
+        msg->id = id & 0x7ff;
+        msg->isExt = false;
+        msg->rtr = id & RTR_FLAG;
+        msg->len = raw_len - 3;
+        if (msg->rtr && msg->len) {
+            return false;
+        }
+        for (size_t i = 0; i < msg->len; ++i) {
+            msg->buf[i] = raw[2 + i];
+        }
+        return true;
+    }
+};
+
+#endif // __UART_SIMPLE_FRAME_HPP
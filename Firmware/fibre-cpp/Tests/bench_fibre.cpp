@@ -0,0 +1,749 @@
+/**
+ * @file bench_fibre.cpp
+ * @brief Host benchmarks for the fibre protocol stack
+ *
+ * Measures the building blocks (CRC, bufptr serialization, JSON parsing,
+ * stream framing, endpoint dispatch), the request rate of a server instance of
+ * LegacyProtocolPacketBased on its own and complete remote calls between a
+ * client and a server instance that are connected by an in-memory loopback
+ * transport, through LegacyObjectClient and through HostClient. The
+ * multi-device benchmark runs many client/server pairs over Unix sockets on one
+ * EpollEventLoop, like a host that talks to many devices. For each benchmark
+ * it prints
+ * the time per operation, the operations per second and the heap allocations
+ * per operation.
+ *
+ * Build and run with `make bench`. The number of iterations can be scaled
+ * with $FIBRE_BENCH_SCALE (default 1.0).
+ *
+ * @author ODrive Robotics
+ * @date 2026-10-14
+ */
+
+#include "../legacy_protocol.hpp"
+#include "../legacy_object_client.hpp"
+#include "../host_client.hpp"
+#include "../platform_support/epoll_event_loop.hpp"
+#include "../platform_support/posix_socket.hpp"
+#include "../protocol.hpp"
+#include "../crc.hpp"
+#include "../json.hpp"
+#include "../logging.hpp"
+#include "loopback_device.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace fibre;
+
+// ============================================================================
+// Allocation Counter
+// ============================================================================
+
+static size_t n_heap_allocs = 0;
+
+void* operator new(size_t size) {
+    n_heap_allocs++;
+    if (void* ptr = malloc(size ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc{};
+}
+
+void operator delete(void* ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    free(ptr);
+}
+
+// ============================================================================
+// Benchmark Runner
+// ============================================================================
+
+static double scale = 1.0;
+
+// Runs fn() n times after a short warmup and prints the results. fn returns
+// false if an operation failed.
+template<typename TFn>
+static bool run_benchmark(const char* name, size_t n, TFn fn) {
+    n = std::max<size_t>(1, (size_t)(n * scale));
+
+    for (size_t i = 0; i < std::min<size_t>(n / 10 + 1, 1000); ++i) {
+        if (!fn()) {
+            printf("%-36s FAILED during warmup\n", name);
+            return false;
+        }
+    }
+
+    size_t allocs_before = n_heap_allocs;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < n; ++i) {
+        if (!fn()) {
+            printf("%-36s FAILED at iteration %zu\n", name, i);
+            return false;
+        }
+    }
+    auto duration = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start);
+    size_t allocs = n_heap_allocs - allocs_before;
+
+    double ns_per_op = duration.count() / n;
+    printf("%-36s %10.1f ns/op %12.0f op/s %8.2f allocs/op\n",
+           name, ns_per_op, 1e9 / ns_per_op, (double)allocs / n);
+    return true;
+}
+
+// ============================================================================
+// Client/Server Fixture
+// ============================================================================
+
+/**
+ * @brief A client and a server protocol instance that are connected by a pair
+ * of loopback pipes in packet mode (like USB bulk endpoints).
+ */
+struct Loopback {
+    LoopbackPipe to_server{false};
+    LoopbackPipe to_client{false};
+    LegacyProtocolPacketBased server{&to_server, &to_client, 64};
+    LegacyProtocolPacketBased client{&to_client, &to_server, 64};
+    std::shared_ptr<LegacyObject> root;
+    bool stopped = false;
+
+    bool connect() {
+        // Without an on_found_root_object callback the instance only acts as server
+        server.start({}, {}, {});
+        client.start(MEMBER_CB(this, on_found_root_object), MEMBER_CB(this, on_lost_root_object), MEMBER_CB(this, on_stopped));
+        pump();
+        return root != nullptr;
+    }
+
+    void disconnect() {
+        to_server.close();
+        to_client.close();
+    }
+
+    void pump() {
+        pump_all(to_server, to_client);
+    }
+
+    void on_found_root_object(LegacyObjectClient* client, std::shared_ptr<LegacyObject> obj) { root = obj; }
+    void on_lost_root_object(LegacyObjectClient* client, std::shared_ptr<LegacyObject> obj) { root = nullptr; }
+    void on_stopped(LegacyProtocolPacketBased* protocol, StreamStatus status) { stopped = true; }
+};
+
+/**
+ * @brief Invokes a function through the same interface that libfibre uses and
+ * pumps the loopback until the call is finished.
+ */
+struct CallRunner {
+    Loopback& loopback;
+    bool done = false;
+    Status status = kFibreOk;
+    uint8_t* rx_end = nullptr;
+
+    bool run(LegacyFunction& func, LegacyObject* obj, const void* args, size_t args_size, bufptr_t rx_buf) {
+        uint8_t tx_buf[LegacyCallContext::kMaxArgsSize];
+        memcpy(tx_buf, &obj, sizeof(obj));
+        memcpy(tx_buf + sizeof(obj), args, args_size);
+
+        void* handle = nullptr;
+        done = false;
+        auto result = func.call(&handle, {kFibreClosed, {tx_buf, sizeof(obj) + args_size}, rx_buf}, MEMBER_CB(this, on_finished));
+        if (result.has_value()) {
+            on_finished(*result);
+        }
+        loopback.pump();
+        return done && status == kFibreClosed && rx_end == rx_buf.end();
+    }
+
+    std::optional<CallBuffers> on_finished(CallBufferRelease result) {
+        done = true;
+        status = result.status;
+        rx_end = result.rx_end;
+        return std::nullopt;
+    }
+};
+
+static LegacyObject* find_attribute(LegacyObject* obj, const char* name) {
+    auto it = obj->intf->attributes.find(name);
+    return it == obj->intf->attributes.end() ? nullptr : it->second.object.get();
+}
+
+static LegacyFunction* find_function(LegacyObject* obj, const char* name) {
+    auto it = obj->intf->functions.find(name);
+    return it == obj->intf->functions.end() ? nullptr : &it->second;
+}
+
+// ============================================================================
+// Building Block Benchmarks
+// ============================================================================
+
+static uint8_t sink; // keeps the compiler from optimizing results away
+
+static bool bench_building_blocks() {
+    bool ok = true;
+
+    uint8_t packet[64];
+    for (size_t i = 0; i < sizeof(packet); ++i) {
+        packet[i] = (uint8_t)(i * 7);
+    }
+
+    ok = run_benchmark("crc8 (64 B)", 200000, [&]() {
+        sink ^= calc_crc8<CANONICAL_CRC8_POLYNOMIAL>(CANONICAL_CRC8_INIT, packet, sizeof(packet));
+        return true;
+    }) && ok;
+
+    ok = run_benchmark("crc16 (64 B)", 200000, [&]() {
+        sink ^= (uint8_t)calc_crc16<CANONICAL_CRC16_POLYNOMIAL>(CANONICAL_CRC16_INIT, packet, sizeof(packet));
+        return true;
+    }) && ok;
+
+    ok = run_benchmark("bufptr write_le/read_le (16 values)", 1000000, [&]() {
+        bufptr_t out{packet, sizeof(packet)};
+        for (uint32_t i = 0; i < 16; ++i) {
+            write_le<uint32_t>(i + sink, &out);
+        }
+        cbufptr_t in{packet, sizeof(packet)};
+        uint32_t sum = 0;
+        for (size_t i = 0; i < 16; ++i) {
+            sum += *read_le<uint32_t>(&in);
+        }
+        sink ^= (uint8_t)sum;
+        return true;
+    }) && ok;
+
+    ok = run_benchmark("json parse (descriptor)", 20000, [&]() {
+        json_document doc;
+        return doc.parse(kJson, kJson + sizeof(kJson) - 1) != nullptr;
+    }) && ok;
+
+    // Stream framing as used on UART
+    LoopbackPipe stream{true};
+    PacketWrapper wrapper{&stream};
+    PacketUnwrapper unwrapper{&stream};
+    ok = run_benchmark("packet wrap/unwrap (64 B)", 200000, [&]() {
+        uint8_t rx_buf[64];
+        TransferHandle handle;
+        bool written = false, read = false;
+        struct Completers {
+            bool* written; bool* read;
+            void on_written(WriteResult result) { *written = result.status == kStreamOk; }
+            void on_read(ReadResult result) { *read = result.status == kStreamOk; }
+        } completers{&written, &read};
+        wrapper.start_write({packet, sizeof(packet)}, &handle, MEMBER_CB(&completers, on_written));
+        unwrapper.start_read(rx_buf, &handle, MEMBER_CB(&completers, on_read));
+        while (stream.pump()) {}
+        return written && read && !memcmp(packet, rx_buf, sizeof(packet));
+    }) && ok;
+
+    // Called through a pointer like from LegacyProtocolPacketBased, which is
+    // in a different translation unit than the generated handler
+    bool (* volatile handler)(int, cbufptr_t*, bufptr_t*) = endpoint_handler;
+    ok = run_benchmark("endpoint handler (property read)", 5000000, [&]() {
+        uint8_t out[4];
+        cbufptr_t input{nullptr, nullptr};
+        bufptr_t output{out, sizeof(out)};
+        bool result = handler(1, &input, &output);
+        sink ^= out[0];
+        return result && output.size() == 0;
+    }) && ok;
+
+    return ok;
+}
+
+// ============================================================================
+// Server Benchmarks
+// ============================================================================
+
+// @brief Builds a request packet like LegacyProtocolPacketBased sends it
+static size_t make_request(uint8_t* buf, uint16_t seq_no, uint16_t endpoint_id, uint16_t response_length,
+                           const uint8_t* payload, size_t payload_length) {
+    bufptr_t out{buf, 64};
+    write_le<uint16_t>(seq_no & 0x7fff, &out);
+    write_le<uint16_t>(endpoint_id | 0x8000, &out);
+    write_le<uint16_t>(response_length, &out);
+    memcpy(out.begin(), payload, payload_length);
+    out = out.skip(payload_length);
+    write_le<uint16_t>(endpoint_id ? json_crc_ : PROTOCOL_VERSION, &out);
+    return out.begin() - buf;
+}
+
+// Requests decoded and answered per second by the server, without the client
+// side, which is what bounds the command rate of a device
+static bool bench_server() {
+    LoopbackPipe to_server{false};
+    LoopbackPipe to_client{false};
+    LegacyProtocolPacketBased server{&to_server, &to_client, 64};
+    RawPeer peer{to_server, to_client};
+    server.start({}, {}, {});
+    peer.start();
+
+    bool ok = true;
+    uint8_t request[64];
+    uint16_t seq_no = 0;
+
+    ok = run_benchmark("server request (property read)", 200000, [&]() {
+        size_t n = make_request(request, seq_no++, 1, 4, nullptr, 0);
+        size_t n_received = peer.n_received;
+        peer.write({request, n});
+        pump_all(to_server, to_client);
+        return peer.written && peer.n_received == n_received + 1 && peer.rx_end - peer.rx_buf == 6;
+    }) && ok;
+
+    ok = run_benchmark("server request (property write)", 200000, [&]() {
+        uint32_t value = seq_no;
+        size_t n = make_request(request, seq_no++, 2, 0, (const uint8_t*)&value, sizeof(value));
+        size_t n_received = peer.n_received;
+        peer.write({request, n});
+        pump_all(to_server, to_client);
+        return peer.written && peer.n_received == n_received + 1 && counter == value;
+    }) && ok;
+
+    ok = run_benchmark("server request (bad trailer)", 200000, [&]() {
+        size_t n = make_request(request, seq_no++, 1, 4, nullptr, 0);
+        request[n - 1] ^= 0xff;
+        size_t n_received = peer.n_received;
+        peer.write({request, n});
+        pump_all(to_server, to_client);
+        return peer.written && peer.n_received == n_received;
+    }) && ok;
+
+    to_server.close();
+    to_client.close();
+    return ok;
+}
+
+// ============================================================================
+// End-to-End Benchmarks
+// ============================================================================
+
+static bool bench_end_to_end() {
+    Loopback loopback;
+
+    auto start = std::chrono::steady_clock::now();
+    if (!loopback.connect()) {
+        printf("client didn't find the root object\n");
+        return false;
+    }
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    printf("%-36s %10lld us\n", "connect (download JSON)", (long long)duration.count());
+
+    LegacyObject* vbus = find_attribute(loopback.root.get(), "vbus_voltage");
+    LegacyObject* counter_obj = find_attribute(loopback.root.get(), "counter");
+    LegacyObject* axis0 = find_attribute(loopback.root.get(), "axis0");
+    LegacyFunction* set_pos = axis0 ? find_function(axis0, "set_pos") : nullptr;
+    if (!vbus || !counter_obj || !set_pos) {
+        printf("unexpected object tree\n");
+        return false;
+    }
+
+    bool ok = true;
+    CallRunner runner{loopback};
+    DebugStats stats_before = get_debug_stats();
+
+    ok = run_benchmark("property read (float)", 100000, [&]() {
+        float value;
+        return runner.run(vbus->intf->functions.at("read"), vbus, nullptr, 0, {(uint8_t*)&value, sizeof(value)})
+            && value == vbus_voltage;
+    }) && ok;
+
+    ok = run_benchmark("property exchange (uint32)", 100000, [&]() {
+        uint32_t new_value = counter + 1;
+        uint32_t old_value;
+        return runner.run(counter_obj->intf->functions.at("exchange"), counter_obj, &new_value, sizeof(new_value), {(uint8_t*)&old_value, sizeof(old_value)})
+            && counter == new_value;
+    }) && ok;
+
+    ok = run_benchmark("function call (1 in, 1 out)", 50000, [&]() {
+        float pos = 1.0f;
+        uint8_t result = 0;
+        return runner.run(*set_pos, axis0, &pos, sizeof(pos), {&result, sizeof(result)})
+            && result == 1;
+    }) && ok;
+
+    const DebugStats& stats = get_debug_stats();
+    printf("call contexts: %zu allocs (%zu on heap), max %zu in use\n",
+           stats.call_contexts.n_allocs - stats_before.call_contexts.n_allocs,
+           stats.call_contexts.n_heap_allocs - stats_before.call_contexts.n_heap_allocs,
+           stats.call_contexts.max_in_use);
+    printf("enqueued endpoint operations: %zu allocs (%zu on heap), max %zu in use\n",
+           stats.endpoint_operations.n_allocs - stats_before.endpoint_operations.n_allocs,
+           stats.endpoint_operations.n_heap_allocs - stats_before.endpoint_operations.n_heap_allocs,
+           stats.endpoint_operations.max_in_use);
+
+    loopback.disconnect();
+    if (!loopback.stopped) {
+        printf("client didn't stop\n");
+        ok = false;
+    }
+    return ok;
+}
+
+// The same property operations through HostClient, which knows the endpoints
+// at compile time instead of downloading the JSON
+static bool bench_host_client() {
+    LoopbackPipe to_server{false};
+    LoopbackPipe to_client{false};
+    LegacyProtocolPacketBased server{&to_server, &to_client, 64};
+    LegacyProtocolPacketBased protocol{&to_client, &to_server, 64};
+    server.start({}, {}, {});
+    protocol.start({}, {}, {});
+
+    // What a generated header (see host_client_template.j2) would declare
+    constexpr HostProperty<float, false> vbus_voltage_property{1};
+    constexpr HostProperty<uint32_t, true> counter_property{2};
+
+    bool done = false;
+    bool result = false;
+    auto on_done = [&](bool ok) { done = true; result = ok; };
+    auto run = [&](bool started) {
+        done = false;
+        pump_all(to_server, to_client);
+        return started && done && result;
+    };
+
+    HostClient client{&protocol, json_version_id_};
+    HostClient wrong_client{&protocol, json_version_id_ ^ 1};
+    auto start = std::chrono::steady_clock::now();
+    client.connect(on_done);
+    if (!run(true)) {
+        printf("host client didn't connect\n");
+        return false;
+    }
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    printf("%-36s %10lld us\n", "host client connect", (long long)duration.count());
+    wrong_client.connect(on_done);
+    if (run(true) || wrong_client.is_connected()) {
+        printf("host client accepted the wrong JSON version\n");
+        return false;
+    }
+
+    bool ok = true;
+    DebugStats stats_before = get_debug_stats();
+
+    ok = run_benchmark("host client read (float)", 100000, [&]() {
+        float value = 0.0f;
+        return run(client.read(vbus_voltage_property, &value, on_done)) && value == vbus_voltage;
+    }) && ok;
+
+    ok = run_benchmark("host client write (uint32)", 100000, [&]() {
+        uint32_t new_value = counter + 1;
+        return run(client.write(counter_property, new_value, on_done)) && counter == new_value;
+    }) && ok;
+
+    const DebugStats& stats = get_debug_stats();
+    printf("host client operations: %zu allocs (%zu on heap), max %zu in use\n",
+           stats.host_operations.n_allocs - stats_before.host_operations.n_allocs,
+           stats.host_operations.n_heap_allocs - stats_before.host_operations.n_heap_allocs,
+           stats.host_operations.max_in_use);
+    return ok;
+}
+
+// ============================================================================
+// Multi-Device Benchmarks
+// ============================================================================
+
+struct MultiDeviceBench;
+
+/**
+ * @brief A device and its host connection on the two ends of a Unix socket
+ * pair. The client keeps one property read in flight at all times.
+ */
+struct SocketDevice {
+    MultiDeviceBench* bench;
+    PosixSocket server_socket;
+    PosixSocket client_socket;
+    LegacyProtocolPacketBased server{&server_socket, &server_socket, 64};
+    LegacyProtocolPacketBased protocol{&client_socket, &client_socket, 64};
+    HostClient client{&protocol, json_version_id_};
+    float value = 0.0f;
+
+    explicit SocketDevice(MultiDeviceBench* bench) : bench(bench) {}
+    bool open(EventLoop* event_loop);
+    void close();
+    void issue();
+    void on_connected(bool ok);
+    void on_read(bool ok);
+};
+
+struct MultiDeviceBench {
+    EpollEventLoop event_loop;
+    std::vector<std::unique_ptr<SocketDevice>> devices;
+    size_t n_devices;
+    size_t target;
+    size_t n_done = 0;
+    size_t n_failed = 0;
+    bool running = true;
+    size_t allocs_before = 0;
+    std::chrono::steady_clock::time_point start_time;
+    std::chrono::steady_clock::time_point end_time;
+
+    void on_started() {
+        for (size_t i = 0; i < n_devices; ++i) {
+            devices.push_back(std::make_unique<SocketDevice>(this));
+            if (!devices.back()->open(&event_loop)) {
+                n_failed++;
+                devices.pop_back();
+            }
+        }
+        allocs_before = n_heap_allocs;
+        start_time = std::chrono::steady_clock::now();
+    }
+
+    void on_done(bool ok) {
+        n_failed += ok ? 0 : 1;
+        if (++n_done == target || !ok) {
+            if (running) {
+                running = false;
+                end_time = std::chrono::steady_clock::now();
+                event_loop.post(MEMBER_CB(this, stop));
+            }
+        }
+    }
+
+    void stop() {
+        for (auto& device : devices) {
+            device->close();
+        }
+    }
+};
+
+bool SocketDevice::open(EventLoop* event_loop) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, fds) != 0) {
+        return false;
+    }
+    // The sockets duplicate the file descriptors
+    bool ok = server_socket.init(event_loop, fds[0]) && client_socket.init(event_loop, fds[1]);
+    ::close(fds[0]);
+    ::close(fds[1]);
+    if (!ok) {
+        return false;
+    }
+    server.start({}, {}, {});
+    protocol.start({}, {}, {});
+    client.connect(MEMBER_CB(this, on_connected));
+    return true;
+}
+
+void SocketDevice::close() {
+    server_socket.deinit();
+    client_socket.deinit();
+}
+
+void SocketDevice::issue() {
+    if (bench->running && !client.read(HostProperty<float, false>{1}, &value, MEMBER_CB(this, on_read))) {
+        bench->on_done(false);
+    }
+}
+
+void SocketDevice::on_connected(bool ok) {
+    if (ok) {
+        issue();
+    } else {
+        bench->on_done(false);
+    }
+}
+
+void SocketDevice::on_read(bool ok) {
+    bench->on_done(ok && value == vbus_voltage);
+    issue();
+}
+
+// Aggregate property reads per second of one event loop thread against the
+// number of devices it serves (host and device side)
+static bool bench_multi_device() {
+    bool ok = true;
+    for (size_t n_devices : {1, 8, 32, 64, 128}) {
+        MultiDeviceBench bench;
+        bench.n_devices = n_devices;
+        bench.target = std::max<size_t>(n_devices, (size_t)(100000 * scale));
+        if (!bench.event_loop.start(MEMBER_CB(&bench, on_started)) || bench.n_failed || bench.running) {
+            printf("%zu devices: FAILED (%zu of %zu reads failed)\n", n_devices, bench.n_failed, bench.n_done);
+            ok = false;
+            continue;
+        }
+        double seconds = std::chrono::duration<double>(bench.end_time - bench.start_time).count();
+        char name[64];
+        snprintf(name, sizeof(name), "reads on %zu devices", n_devices);
+        printf("%-36s %10.1f ns/op %12.0f op/s %8.2f allocs/op\n", name,
+               seconds * 1e9 / bench.n_done, bench.n_done / seconds,
+               (double)(n_heap_allocs - bench.allocs_before) / bench.n_done);
+    }
+    return ok;
+}
+
+struct PostBench {
+    EpollEventLoop event_loop;
+    size_t target;
+    size_t n_done = 0;
+    EventLoopTimer* keepalive = nullptr;
+
+    void on_started() {
+        // Keeps the loop running while the other thread is starting
+        keepalive = event_loop.call_later(60.0f, {});
+        // Like the completions of a separate libusb thread
+        std::thread([this]() {
+            for (size_t i = 0; i < target; ++i) {
+                event_loop.post(MEMBER_CB(this, on_posted));
+            }
+        }).detach();
+    }
+
+    void on_posted() {
+        if (++n_done == target) {
+            event_loop.cancel_timer(keepalive);
+        }
+    }
+};
+
+// Callbacks posted from another thread, which is how transfer completions
+// reach the application when libusb runs on its own thread
+static bool bench_cross_thread_post() {
+    PostBench bench;
+    bench.target = (size_t)(1000000 * scale);
+    auto start_time = std::chrono::steady_clock::now();
+    // Returns once the other thread is done and all callbacks ran
+    bool ok = bench.event_loop.start(MEMBER_CB(&bench, on_started)) && bench.n_done == bench.target;
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    if (!ok) {
+        printf("cross-thread post: FAILED\n");
+        return false;
+    }
+    printf("%-36s %10.1f ns/op %12.0f op/s\n", "cross-thread post",
+           seconds * 1e9 / bench.n_done, bench.n_done / seconds);
+    return true;
+}
+
+// ============================================================================
+// Stream Framing Benchmarks
+// ============================================================================
+
+// Collects the bytes written by a packet wrapper
+struct CaptureSink : AsyncStreamSink {
+    std::vector<uint8_t> data;
+
+    void start_write(cbufptr_t buffer, TransferHandle* handle, Callback<void, WriteResult> completer) final {
+        data.insert(data.end(), buffer.begin(), buffer.end());
+        completer.invoke({kStreamOk, buffer.end()});
+    }
+    void cancel_write(TransferHandle transfer_handle) final {}
+};
+
+/**
+ * @brief Replays a recorded stream forever, in chunks of at most `chunk_size`
+ * bytes, like the UART thread hands out what the DMA received since it last
+ * woke up. Reads complete from pump(), not from within start_read().
+ */
+struct ChunkedStream : AsyncStreamSource {
+    std::vector<uint8_t> data;
+    size_t chunk_size;
+    size_t pos = 0;
+    size_t n_reads = 0;
+    bufptr_t pending = {nullptr, nullptr};
+    Callback<void, ReadResult> completer;
+
+    void start_read(bufptr_t buffer, TransferHandle* handle, Callback<void, ReadResult> completer) final {
+        pending = buffer;
+        this->completer = completer;
+    }
+    void cancel_read(TransferHandle transfer_handle) final {}
+
+    bool pump() {
+        if (!completer) {
+            return false;
+        }
+        n_reads++;
+        size_t n = std::min({pending.size(), chunk_size, data.size() - pos});
+        memcpy(pending.begin(), data.data() + pos, n);
+        pos = (pos + n) % data.size();
+        completer.invoke_and_clear({kStreamOk, pending.begin() + n});
+        return true;
+    }
+};
+
+/**
+ * @brief Receives back to back packets of 64 bytes from a stream with either
+ * framing, in DMA sized chunks. The time per packet is the CPU time that the
+ * unwrapper needs, the line rate of a 2 Mbaud UART is printed for comparison.
+ */
+template<typename TWrapper, typename TUnwrapper>
+static bool bench_stream_framing(const char* name, size_t chunk_size) {
+    uint8_t packet[64];
+    for (size_t i = 0; i < sizeof(packet); ++i) {
+        packet[i] = (uint8_t)(i * 7); // includes zero bytes
+    }
+
+    CaptureSink capture;
+    TWrapper wrapper{&capture};
+    for (size_t i = 0; i < 16; ++i) {
+        wrapper.start_write({packet, sizeof(packet)}, nullptr, {});
+    }
+
+    ChunkedStream stream;
+    stream.data = capture.data;
+    stream.chunk_size = chunk_size;
+    TUnwrapper unwrapper{&stream};
+
+    struct Reader {
+        bool done = false;
+        bool ok = false;
+        uint8_t* rx_end;
+        void on_read(ReadResult result) { done = true; ok = result.status == kStreamOk; rx_end = result.end; }
+    } reader;
+
+    size_t n_packets = 0;
+    bool ok = run_benchmark(name, 1000000, [&]() {
+        uint8_t rx_buf[64];
+        reader.done = false;
+        unwrapper.start_read(rx_buf, nullptr, MEMBER_CB(&reader, on_read));
+        while (!reader.done && stream.pump()) {}
+        n_packets++;
+        return reader.ok && reader.rx_end == rx_buf + sizeof(rx_buf) && !memcmp(packet, rx_buf, sizeof(packet));
+    });
+
+    if (ok) {
+        double frame_size = (double)capture.data.size() / 16;
+        printf("    %.1f B/frame, %.2f reads/packet, 2 Mbaud line limit %.0f packets/s\n",
+               frame_size, (double)stream.n_reads / n_packets, 2e6 / 10 / frame_size);
+    }
+    return ok;
+}
+
+static bool bench_stream() {
+    bool ok = bench_stream_framing<PacketWrapper, PacketUnwrapper>("legacy framing (64 B, 16 B chunks)", 16);
+    ok = bench_stream_framing<PacketWrapper, PacketUnwrapper>("legacy framing (64 B, 128 B chunks)", 128) && ok;
+    ok = bench_stream_framing<CobsPacketWrapper, CobsPacketUnwrapper>("cobs framing (64 B, 16 B chunks)", 16) && ok;
+    ok = bench_stream_framing<CobsPacketWrapper, CobsPacketUnwrapper>("cobs framing (64 B, 128 B chunks)", 128) && ok;
+    return ok;
+}
+
+// ============================================================================
+// Main Entry Point
+// ============================================================================
+
+int main() {
+    if (const char* str = getenv("FIBRE_BENCH_SCALE")) {
+        scale = atof(str);
+    }
+    setenv("FIBRE_CACHE_DIR", "", 1); // always download the JSON
+
+    bool ok = bench_building_blocks();
+    ok = bench_server() && ok;
+    ok = bench_end_to_end() && ok;
+    ok = bench_host_client() && ok;
+    ok = bench_multi_device() && ok;
+    ok = bench_cross_thread_post() && ok;
+    ok = bench_stream() && ok;
+    return ok ? 0 : 1;
+}
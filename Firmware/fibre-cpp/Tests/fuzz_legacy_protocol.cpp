@@ -0,0 +1,64 @@
+/**
+ * @file fuzz_legacy_protocol.cpp
+ * @brief libFuzzer target for the packet parser of LegacyProtocolPacketBased
+ *
+ * Feeds arbitrary packets into a protocol instance that serves the loopback
+ * device, like a host or a corrupted link would on USB. Client support is
+ * compiled in as well, so that stray ACKs and notifications reach the client
+ * side of the parser too.
+ *
+ * The input is a sequence of packets, each preceded by a control byte:
+ *  - bits 0-5: length of the packet (the rest of the input if it's shorter)
+ *  - bit 6: replace the last two bytes by the valid trailer of the endpoint in
+ *    bytes 2-3, so that the fuzzer gets past the trailer check quickly
+ *  - bit 7: don't pick up the response before the next packet, so the server
+ *    sees a busy TX channel
+ *
+ * Build and run with `make fuzz` (requires clang).
+ */
+
+#include "loopback_device.hpp"
+#include <cstdint>
+#include <cstddef>
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    LoopbackPipe to_server{false};
+    LoopbackPipe to_client{false};
+    LegacyProtocolPacketBased server{&to_server, &to_client, 64};
+    RawPeer peer{to_server, to_client};
+    server.start({}, {}, {});
+    peer.start();
+
+    const uint8_t* end = data + size;
+    while (data < end) {
+        uint8_t control = *data++;
+        uint8_t packet[64];
+        size_t length = std::min<size_t>(control & 0x3f, end - data);
+        memcpy(packet, data, length);
+        data += length;
+
+        if ((control & 0x40) && length >= 4) {
+            uint16_t endpoint_id = (packet[2] | (packet[3] << 8)) & 0x7fff;
+            uint16_t trailer = endpoint_id ? json_crc_ : PROTOCOL_VERSION;
+            packet[length - 2] = (uint8_t)trailer;
+            packet[length - 1] = (uint8_t)(trailer >> 8);
+        }
+
+        peer.write({packet, length});
+        if (control & 0x80) {
+            while (to_server.pump()) {}
+        } else {
+            pump_all(to_server, to_client);
+        }
+        // The pipe holds one write at a time, so a packet that the server
+        // doesn't take now is dropped like on a full USB endpoint
+        if (!peer.written) {
+            to_server.cancel_write(0);
+        }
+    }
+
+    pump_all(to_server, to_client);
+    to_server.close();
+    to_client.close();
+    return 0;
+}
@@ -0,0 +1,247 @@
+/**
+ * @file loopback_device.hpp
+ * @brief In-memory transport and a small device for host tests of the fibre
+ * protocol stack
+ *
+ * The device definitions are normally generated from the interface YAML, so
+ * this header defines the symbols that the protocol links against and must be
+ * included by exactly one translation unit of a program. It is shared by
+ * bench_fibre.cpp and fuzz_legacy_protocol.cpp.
+ */
+
+#ifndef __FIBRE_TESTS_LOOPBACK_DEVICE_HPP
+#define __FIBRE_TESTS_LOOPBACK_DEVICE_HPP
+
+#include "../legacy_protocol.hpp"
+#include "../protocol.hpp"
+#include "../crc.hpp"
+#include <algorithm>
+#include <cstring>
+
+using namespace fibre;
+
+// ============================================================================
+// Loopback Transport
+// ============================================================================
+
+/**
+ * @brief One direction of an in-memory connection.
+ *
+ * Written data is buffered and handed to the reader by pump() rather than
+ * from within start_write() or start_read(), so the protocol sees the same
+ * asynchronous completions as on a real transport. In packet mode every
+ * write is delivered as one read (truncated to the read buffer), in stream
+ * mode reads return whatever bytes are buffered.
+ */
+class LoopbackPipe : public AsyncStreamSink, public AsyncStreamSource {
+public:
+    explicit LoopbackPipe(bool is_stream) : is_stream_(is_stream) {}
+
+    void start_write(cbufptr_t buffer, TransferHandle* handle, Callback<void, WriteResult> completer) final {
+        tx_buf_ = buffer;
+        tx_completer_ = completer;
+        if (handle) {
+            *handle = reinterpret_cast<TransferHandle>(this);
+        }
+    }
+
+    void cancel_write(TransferHandle transfer_handle) final {
+        tx_completer_.invoke_and_clear({kStreamCancelled, tx_buf_.begin()});
+    }
+
+    void start_read(bufptr_t buffer, TransferHandle* handle, Callback<void, ReadResult> completer) final {
+        rx_buf_ = buffer;
+        rx_completer_ = completer;
+        if (handle) {
+            *handle = reinterpret_cast<TransferHandle>(this);
+        }
+    }
+
+    void cancel_read(TransferHandle transfer_handle) final {
+        rx_completer_.invoke_and_clear({kStreamCancelled, rx_buf_.begin()});
+    }
+
+    // Completes at most one pending write and one pending read. Returns
+    // false if there was nothing to do.
+    bool pump() {
+        bool progress = false;
+
+        if (tx_completer_ && size_ + tx_buf_.size() <= sizeof(data_)
+                && (is_stream_ || n_packets_ < kMaxPackets)) {
+            memcpy(data_ + size_, tx_buf_.begin(), tx_buf_.size());
+            size_ += tx_buf_.size();
+            if (!is_stream_) {
+                packet_sizes_[n_packets_++] = tx_buf_.size();
+            }
+            tx_completer_.invoke_and_clear({kStreamOk, tx_buf_.end()});
+            progress = true;
+        }
+
+        if (rx_completer_ && (is_stream_ ? size_ > 0 : n_packets_ > 0)) {
+            size_t n_consume = is_stream_ ? std::min(size_, rx_buf_.size()) : packet_sizes_[0];
+            size_t n_copy = std::min(n_consume, rx_buf_.size());
+            memcpy(rx_buf_.begin(), data_, n_copy);
+            memmove(data_, data_ + n_consume, size_ - n_consume);
+            size_ -= n_consume;
+            if (!is_stream_) {
+                memmove(packet_sizes_, packet_sizes_ + 1, (--n_packets_) * sizeof(packet_sizes_[0]));
+            }
+            rx_completer_.invoke_and_clear({kStreamOk, rx_buf_.begin() + n_copy});
+            progress = true;
+        }
+
+        return progress;
+    }
+
+    // Fails all pending and future operations with kStreamClosed
+    void close() {
+        tx_completer_.invoke_and_clear({kStreamClosed, tx_buf_.begin()});
+        rx_completer_.invoke_and_clear({kStreamClosed, rx_buf_.begin()});
+    }
+
+private:
+    static constexpr size_t kMaxPackets = 16;
+
+    bool is_stream_;
+    uint8_t data_[2048];
+    size_t size_ = 0;
+    size_t packet_sizes_[kMaxPackets];
+    size_t n_packets_ = 0;
+
+    cbufptr_t tx_buf_ = {nullptr, nullptr};
+    Callback<void, WriteResult> tx_completer_;
+    bufptr_t rx_buf_ = {nullptr, nullptr};
+    Callback<void, ReadResult> rx_completer_;
+};
+
+// Runs the loopback pipes until neither of them makes progress
+static void pump_all(LoopbackPipe& a, LoopbackPipe& b) {
+    for (;;) {
+        bool progress = a.pump();
+        progress = b.pump() || progress;
+        if (!progress) {
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Sends raw packets into a loopback pipe and receives whatever comes
+ * back on the other one, without a protocol instance on this side.
+ */
+struct RawPeer {
+    LoopbackPipe& tx;
+    LoopbackPipe& rx;
+    uint8_t rx_buf[64];
+    uint8_t* rx_end = rx_buf;
+    size_t n_received = 0;
+    bool written = false;
+
+    void start() {
+        TransferHandle handle;
+        rx.start_read(rx_buf, &handle, MEMBER_CB(this, on_read));
+    }
+
+    // Hands the packet to tx. It is sent on the next pump() of tx.
+    void write(cbufptr_t packet) {
+        TransferHandle handle;
+        written = false;
+        tx.start_write(packet, &handle, MEMBER_CB(this, on_written));
+    }
+
+    void on_written(WriteResult result) {
+        written = result.status == kStreamOk;
+    }
+
+    void on_read(ReadResult result) {
+        if (result.status == kStreamOk) {
+            rx_end = result.end;
+            n_received++;
+            start();
+        }
+    }
+};
+
+// ============================================================================
+// Server Side Definitions
+// ============================================================================
+
+// These are normally generated from the interface YAML (see
+// endpoints_template.j2). The benchmark serves a small device with a
+// read-only float, a read/write integer and a function with one input and
+// one output.
+#define BENCH_JSON \
+    "[{\"name\":\"\",\"id\":0,\"type\":\"json\",\"access\":\"r\"}," \
+    "{\"name\":\"vbus_voltage\",\"id\":1,\"type\":\"float\",\"access\":\"r\"}," \
+    "{\"name\":\"counter\",\"id\":2,\"type\":\"uint32\",\"access\":\"rw\"}," \
+    "{\"name\":\"axis0\",\"type\":\"object\",\"members\":[" \
+        "{\"name\":\"set_pos\",\"id\":3,\"type\":\"function\"," \
+            "\"inputs\":[{\"name\":\"pos\",\"id\":4,\"type\":\"float\",\"access\":\"rw\"}]," \
+            "\"outputs\":[{\"name\":\"result\",\"id\":5,\"type\":\"bool\",\"access\":\"r\"}]}" \
+    "]}]"
+
+static const char kJson[] = BENCH_JSON;
+
+const unsigned char fibre::embedded_json[] = BENCH_JSON;
+const size_t fibre::embedded_json_length = sizeof(kJson) - 1;
+const unsigned char fibre::embedded_json_compressed[1] = {};
+const size_t fibre::embedded_json_compressed_length = 0; // server doesn't support compressed JSON
+const uint16_t fibre::json_crc_ = calc_crc16<CANONICAL_CRC16_POLYNOMIAL>(PROTOCOL_VERSION, reinterpret_cast<const uint8_t*>(kJson), sizeof(kJson) - 1);
+const uint32_t fibre::json_version_id_ = ((uint32_t)fibre::json_crc_ << 16) | calc_crc16<CANONICAL_CRC16_POLYNOMIAL>(fibre::json_crc_, reinterpret_cast<const uint8_t*>(kJson), sizeof(kJson) - 1);
+
+static float vbus_voltage = 24.0f;
+static uint32_t counter = 0;
+static float set_pos_in = 0.0f;
+static bool set_pos_out = false;
+
+// Returns the old value of a property and sets the new value if one was sent
+// (the host is little endian like the ODrive)
+template<typename T>
+static bool exchange_property(T* value, cbufptr_t* input_buffer, bufptr_t* output_buffer) {
+    T old_value = *value;
+    if (input_buffer->size() >= sizeof(T)) {
+        memcpy(value, input_buffer->begin(), sizeof(T));
+        *input_buffer = input_buffer->skip(sizeof(T));
+    }
+    if (output_buffer->size() >= sizeof(T)) {
+        memcpy(output_buffer->begin(), &old_value, sizeof(T));
+        *output_buffer = output_buffer->skip(sizeof(T));
+    }
+    return true;
+}
+
+bool fibre::endpoint_handler(int idx, cbufptr_t* input_buffer, bufptr_t* output_buffer) {
+    switch (idx) {
+        case 0: return endpoint0_handler(input_buffer, output_buffer);
+        case 1: {
+            float value = vbus_voltage;
+            return exchange_property(&value, input_buffer, output_buffer); // read-only
+        }
+        case 2: return exchange_property(&counter, input_buffer, output_buffer);
+        case 3: set_pos_out = set_pos_in >= 0.0f; return true;
+        case 4: return exchange_property(&set_pos_in, input_buffer, output_buffer);
+        case 5: {
+            uint8_t value = set_pos_out;
+            return exchange_property(&value, input_buffer, output_buffer); // read-only
+        }
+        default: return false;
+    }
+}
+
+bool fibre::firmware_update_handler(cbufptr_t* input_buffer, bufptr_t* output_buffer) {
+    return false;
+}
+
+bool fibre::is_property_endpoint(int idx) {
+    return idx == 1 || idx == 2 || idx == 4 || idx == 5;
+}
+
+bool fibre::is_endpoint_ref_valid(endpoint_ref_t endpoint_ref) {
+    return endpoint_ref.json_crc == json_crc_ && is_property_endpoint(endpoint_ref.endpoint_id);
+}
+
+bool fibre::set_endpoint_from_float(endpoint_ref_t endpoint_ref, float value) {
+    return false;
+}
+
+#endif // __FIBRE_TESTS_LOOPBACK_DEVICE_HPP
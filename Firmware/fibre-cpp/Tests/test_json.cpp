@@ -0,0 +1,169 @@
+/**
+ * @file test_json.cpp
+ * @brief Unit tests and parse benchmark for the JSON parser used by
+ * LegacyObjectClient
+ *
+ * The benchmark parses the file in $FIBRE_TEST_JSON (e.g. the JSON read from
+ * endpoint 0 of an ODrive) or a generated descriptor of similar size.
+ *
+ * @author ODrive Robotics
+ * @date 2026-10-14
+ */
+
+#include <gtest/gtest.h>
+#include "../json.hpp"
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+using namespace fibre;
+
+static const json_value* parse(json_document& doc, const std::string& str) {
+    return doc.parse(str.data(), str.data() + str.size());
+}
+
+// ============================================================================
+// Parser Tests
+// ============================================================================
+
+TEST(JsonTest, ParseDescriptorEntry) {
+    std::string str = "[{\"name\":\"vbus_voltage\",\"id\":1,\"type\":\"float\",\"access\":\"r\"},"
+                      " {\"name\": \"axis0\", \"type\": \"object\", \"members\": []}]";
+    json_document doc;
+    const json_value* root = parse(doc, str);
+
+    ASSERT_NE(nullptr, root);
+    ASSERT_TRUE(json_is_list(*root));
+    ASSERT_EQ(2, json_as_list(*root).size());
+
+    const json_value& prop = *json_as_list(*root).begin();
+    EXPECT_TRUE(json_as_str(json_dict_find(prop, "name")) == "vbus_voltage");
+    EXPECT_EQ(1, json_as_int(json_dict_find(prop, "id")));
+    EXPECT_FALSE(json_is_str(json_dict_find(prop, "members")));
+
+    const json_value& obj = *(json_as_list(*root).begin() + 1);
+    EXPECT_TRUE(json_as_str(json_dict_find(obj, "type")) == "object");
+    EXPECT_TRUE(json_is_list(json_dict_find(obj, "members")));
+    EXPECT_EQ(0, json_as_list(json_dict_find(obj, "members")).size());
+}
+
+TEST(JsonTest, StringsPointIntoBuffer) {
+    std::string str = "[\"abc\"]";
+    json_document doc;
+    const json_value* root = parse(doc, str);
+
+    ASSERT_NE(nullptr, root);
+    json_str item = json_as_str(*json_as_list(*root).begin());
+    EXPECT_EQ(str.data() + 2, item.begin);
+    EXPECT_EQ(3, item.size());
+}
+
+TEST(JsonTest, Errors) {
+    json_document doc;
+    std::string truncated = "[{\"name\":\"x\"";
+    EXPECT_EQ(nullptr, parse(doc, truncated));
+    EXPECT_STREQ("expected ',' or '}'", doc.error());
+    EXPECT_EQ(truncated.data() + truncated.size(), doc.error_pos());
+
+    EXPECT_EQ(nullptr, parse(doc, "[\"a\\\"b\"]"));
+    EXPECT_STREQ("escaped strings not supported", doc.error());
+
+    EXPECT_EQ(nullptr, parse(doc, "[99999999999]"));
+    EXPECT_STREQ("integer too large", doc.error());
+
+    EXPECT_EQ(nullptr, parse(doc, "[true]"));
+    EXPECT_STREQ("unexpected character", doc.error());
+}
+
+TEST(JsonTest, LargeList) {
+    // More items than fit into one arena block
+    std::string str = "[";
+    for (int i = 0; i < 10000; ++i) {
+        str += (i ? "," : "") + std::to_string(i);
+    }
+    str += "]";
+    json_document doc;
+    const json_value* root = parse(doc, str);
+
+    ASSERT_NE(nullptr, root);
+    ASSERT_EQ(10000, json_as_list(*root).size());
+    EXPECT_EQ(9999, json_as_int(*(json_as_list(*root).end() - 1)));
+}
+
+TEST(JsonTest, LargeListWithSibling) {
+    // The sibling must not be allocated inside the block of the large list
+    for (bool nested : {false, true}) {
+        std::string str = nested ? "[[" : "[[7,8,9],[";
+        for (int i = 0; i < 5000; ++i) {
+            str += (i ? "," : "") + std::to_string(i);
+        }
+        str += nested ? "],[7,8,9]]" : "]]";
+        json_document doc;
+        const json_value* root = parse(doc, str);
+
+        ASSERT_NE(nullptr, root);
+        ASSERT_EQ(2, json_as_list(*root).size());
+        const json_value& large = *(json_as_list(*root).begin() + (nested ? 0 : 1));
+        const json_value& small = *(json_as_list(*root).begin() + (nested ? 1 : 0));
+        ASSERT_EQ(5000, json_as_list(large).size());
+        for (int i = 0; i < 5000; ++i) {
+            ASSERT_EQ(i, json_as_int(*(json_as_list(large).begin() + i)));
+        }
+        ASSERT_EQ(3, json_as_list(small).size());
+        EXPECT_EQ(9, json_as_int(*(json_as_list(small).end() - 1)));
+    }
+}
+
+// ============================================================================
+// Benchmark
+// ============================================================================
+
+// Roughly the structure and size of the ODrive descriptor
+static std::string make_descriptor() {
+    std::ostringstream str;
+    int id = 1;
+    str << "[{\"name\":\"\",\"id\":0,\"type\":\"json\",\"access\":\"r\"}";
+    for (int obj = 0; obj < 40; ++obj) {
+        str << ",{\"name\":\"object" << obj << "\",\"type\":\"object\",\"members\":[";
+        for (int prop = 0; prop < 25; ++prop) {
+            str << (prop ? "," : "") << "{\"name\":\"property" << prop << "\",\"id\":" << id++
+                << ",\"type\":\"float\",\"access\":\"rw\"}";
+        }
+        str << ",{\"name\":\"function\",\"id\":" << id << ",\"type\":\"function\",\"inputs\":["
+            << "{\"name\":\"obj\",\"id\":" << id + 1 << ",\"type\":\"object_ref\",\"access\":\"rw\"}],\"outputs\":[]}";
+        id += 2;
+        str << "]}";
+    }
+    str << "]";
+    return str.str();
+}
+
+TEST(JsonTest, ParseBenchmark) {
+    std::string str;
+    if (const char* path = getenv("FIBRE_TEST_JSON")) {
+        std::ifstream file(path, std::ios::binary);
+        ASSERT_TRUE(file.good()) << "can't open " << path;
+        str.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    } else {
+        str = make_descriptor();
+    }
+
+    const int n_runs = 100;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < n_runs; ++i) {
+        json_document doc;
+        ASSERT_NE(nullptr, parse(doc, str));
+    }
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    std::cout << "parsed " << str.size() << " bytes in " << (duration.count() / n_runs) << " us" << std::endl;
+}
+
+// ============================================================================
+// Main Entry Point
+// ============================================================================
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,86 @@
+/**
+ * @file test_pool.cpp
+ * @brief Unit tests for the object pool used for the call contexts and
+ * endpoint operations of the fibre client
+ *
+ * @author ODrive Robotics
+ * @date 2026-10-14
+ */
+
+#include <gtest/gtest.h>
+#include "../pool.hpp"
+#include <vector>
+
+using namespace fibre;
+
+struct Item {
+    int value;
+    int* n_destroyed;
+    ~Item() { (*n_destroyed)++; }
+};
+
+// ============================================================================
+// Pool Tests
+// ============================================================================
+
+TEST(PoolTest, ReusesSlots) {
+    PoolStats stats;
+    Pool<Item, 4> pool{stats};
+    int n_destroyed = 0;
+
+    Item* a = pool.alloc(1, &n_destroyed);
+    EXPECT_EQ(1, a->value);
+    pool.free(a);
+    EXPECT_EQ(1, n_destroyed);
+
+    // A freed slot is handed out again
+    Item* b = pool.alloc(2, &n_destroyed);
+    EXPECT_EQ(a, b);
+    pool.free(b);
+
+    EXPECT_EQ(0, stats.in_use);
+    EXPECT_EQ(1, stats.max_in_use);
+    EXPECT_EQ(2, stats.n_allocs);
+    EXPECT_EQ(0, stats.n_heap_allocs);
+}
+
+TEST(PoolTest, FallsBackToHeap) {
+    PoolStats stats;
+    Pool<Item, 4> pool{stats};
+    int n_destroyed = 0;
+
+    std::vector<Item*> items;
+    for (int i = 0; i < 6; ++i) {
+        items.push_back(pool.alloc(i, &n_destroyed));
+    }
+    EXPECT_EQ(6, stats.in_use);
+    EXPECT_EQ(2, stats.n_heap_allocs);
+    for (int i = 0; i < 6; ++i) {
+        EXPECT_EQ(i, items[i]->value);
+    }
+
+    for (Item* item: items) {
+        pool.free(item);
+    }
+    EXPECT_EQ(6, n_destroyed);
+    EXPECT_EQ(0, stats.in_use);
+    EXPECT_EQ(6, stats.max_in_use);
+
+    // All pool slots are available again
+    for (int i = 0; i < 4; ++i) {
+        items[i] = pool.alloc(i, &n_destroyed);
+    }
+    EXPECT_EQ(2, stats.n_heap_allocs);
+    for (int i = 0; i < 4; ++i) {
+        pool.free(items[i]);
+    }
+}
+
+// ============================================================================
+// Main Entry Point
+// ============================================================================
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,148 @@
+/**
+ * @file test_timer_wheel.cpp
+ * @brief Unit tests and benchmark for the TimerWheel used by EpollEventLoop
+ *
+ * @author ODrive Robotics
+ * @date 2026-10-14
+ */
+
+#include <gtest/gtest.h>
+#include "../timer_wheel.hpp"
+#include <chrono>
+#include <random>
+#include <vector>
+
+using namespace fibre;
+
+struct Recorder {
+    TimerWheel* wheel;
+    std::vector<uint64_t> fired; // wheel time at which each timer fired
+    void on_timer() { fired.push_back(wheel->now()); }
+};
+
+// ============================================================================
+// Timer Tests
+// ============================================================================
+
+TEST(TimerWheelTest, FiresAtExpiry) {
+    TimerWheel wheel;
+    Recorder rec{&wheel};
+    wheel.advance(1000);
+
+    // One timer per level and a few on the slot boundaries
+    std::vector<uint64_t> delays = {1, 255, 256, 257, 70000, 20000000, 5000000000ULL};
+    for (uint64_t delay: delays) {
+        wheel.add(1000 + delay, MEMBER_CB(&rec, on_timer));
+    }
+    EXPECT_EQ(delays.size(), wheel.size());
+
+    while (wheel.size()) {
+        wheel.advance(wheel.next_deadline());
+    }
+    ASSERT_EQ(delays.size(), rec.fired.size());
+    for (size_t i = 0; i < delays.size(); ++i) {
+        EXPECT_EQ(1000 + delays[i], rec.fired[i]);
+    }
+}
+
+TEST(TimerWheelTest, NextDeadlineNeverLate) {
+    TimerWheel wheel;
+    Recorder rec{&wheel};
+    std::mt19937 rng(1);
+    std::vector<uint64_t> expiries;
+    for (int i = 0; i < 2000; ++i) {
+        uint64_t expiry = 1 + rng() % 1000000;
+        expiries.push_back(expiry);
+        wheel.add(expiry, MEMBER_CB(&rec, on_timer));
+    }
+
+    // Only waking up at next_deadline() must not delay any timer
+    while (wheel.size()) {
+        wheel.advance(wheel.next_deadline());
+    }
+    std::sort(expiries.begin(), expiries.end());
+    EXPECT_EQ(expiries, rec.fired);
+}
+
+TEST(TimerWheelTest, Cancel) {
+    TimerWheel wheel;
+    Recorder rec{&wheel};
+    TimerWheel::Node* a = wheel.add(10, MEMBER_CB(&rec, on_timer));
+    wheel.add(20, MEMBER_CB(&rec, on_timer));
+    TimerWheel::Node* c = wheel.add(100000, MEMBER_CB(&rec, on_timer));
+    wheel.cancel(a);
+    wheel.cancel(c);
+    EXPECT_EQ(1, wheel.size());
+
+    wheel.advance(200000);
+    EXPECT_EQ(std::vector<uint64_t>{20}, rec.fired);
+    EXPECT_EQ(0, wheel.size());
+}
+
+struct Rearm {
+    TimerWheel* wheel;
+    int count;
+    void on_timer() {
+        if (++count < 5) {
+            wheel->add(wheel->now(), MEMBER_CB(this, on_timer)); // fires on the next tick
+        }
+    }
+};
+
+TEST(TimerWheelTest, AddFromCallback) {
+    TimerWheel wheel;
+    Rearm rearm{&wheel, 0};
+    wheel.add(10, MEMBER_CB(&rearm, on_timer));
+    wheel.advance(12);
+    EXPECT_EQ(3, rearm.count);
+    wheel.advance(100);
+    EXPECT_EQ(5, rearm.count);
+    EXPECT_EQ(0, wheel.size());
+}
+
+// ============================================================================
+// Benchmark
+// ============================================================================
+
+TEST(TimerWheelTest, Benchmark) {
+    const size_t n_timers = 50000;
+    TimerWheel wheel;
+    Recorder rec{&wheel};
+    std::mt19937 rng(2);
+    std::vector<TimerWheel::Node*> nodes(n_timers);
+
+    auto start = std::chrono::steady_clock::now();
+
+    // Roughly the pattern of many devices with outstanding calls: timeouts of
+    // up to 10 s that are mostly cancelled before they expire.
+    for (int round = 0; round < 10; ++round) {
+        for (size_t i = 0; i < n_timers; ++i) {
+            nodes[i] = wheel.add(wheel.now() + 1 + rng() % 10000, MEMBER_CB(&rec, on_timer));
+        }
+        for (size_t i = 0; i < n_timers; i += 10) {
+            wheel.advance(wheel.now() + 1);
+        }
+        // Cancel the ones that haven't fired yet. The nodes of fired timers
+        // are not reused until the next add().
+        uint64_t now = wheel.now();
+        for (size_t i = 0; i < n_timers; ++i) {
+            if (nodes[i]->expiry > now) {
+                wheel.cancel(nodes[i]);
+            }
+        }
+    }
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+    EXPECT_EQ(0, wheel.size());
+    std::cout << "10 rounds of " << n_timers << " timers in " << duration.count() << " us ("
+              << rec.fired.size() << " fired)" << std::endl;
+}
+
+// ============================================================================
+// Main Entry Point
+// ============================================================================
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -91,7 +91,10 @@ pkg = get_fibre_package({
     enable_client=true,
     enable_tcp_server_backend=get_bool_config("ENABLE_TCP_SERVER_BACKEND", true),
     enable_tcp_client_backend=get_bool_config("ENABLE_TCP_CLIENT_BACKEND", true),
+    enable_udp_server_backend=get_bool_config("ENABLE_UDP_SERVER_BACKEND", true),
+    enable_udp_client_backend=get_bool_config("ENABLE_UDP_CLIENT_BACKEND", true),
     enable_libusb_backend=get_bool_config("ENABLE_LIBUSB_BACKEND", true),
+    enable_socketcan_backend=get_bool_config("ENABLE_SOCKETCAN_BACKEND", string.find(machine, ".*%-linux%-.*") ~= nil),
     allow_heap=true,
     pkgconf=(tup.getconfig("USE_PKGCONF") != "") and tup.getconfig("USE_PKGCONF") or nil
 })
@@ -0,0 +1,98 @@
+#ifndef __FIBRE_COBS_HPP
+#define __FIBRE_COBS_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+namespace fibre {
+
+/**
+ * @brief Consistent overhead byte stuffing (COBS) removes all zero bytes from
+ * a frame, so that a zero byte can delimit frames on a stream.
+ *
+ * Every zero byte is replaced by the distance to the next one, with a code
+ * byte in front of the first. Blocks of 254 non-zero bytes get an extra code
+ * byte (0xff) that stands for no zero byte.
+ */
+
+// Largest encoded size of `length` bytes, without the delimiter
+constexpr size_t cobs_max_encoded_size(size_t length) {
+    return length + length / 254 + 1;
+}
+
+/**
+ * @brief Encodes a frame from several segments, e.g. a payload and its CRC,
+ * without copying them together first.
+ *
+ * Usage: begin(), then write() for each segment, then end().
+ */
+class CobsEncoder {
+public:
+    // `dst` must hold cobs_max_encoded_size() of the total length
+    void begin(uint8_t* dst) {
+        dst_ = dst;
+        code_pos_ = 0;
+        pos_ = 1;
+        code_ = 1;
+    }
+
+    void write(const uint8_t* src, size_t length) {
+        for (const uint8_t* end = src + length; src < end; ++src) {
+            if (*src) {
+                dst_[pos_++] = *src;
+                if (++code_ != 0xff) {
+                    continue;
+                }
+            }
+            dst_[code_pos_] = code_;
+            code_pos_ = pos_++;
+            code_ = 1;
+        }
+    }
+
+    // Returns the encoded length, without the delimiter
+    size_t end() {
+        dst_[code_pos_] = code_;
+        return pos_;
+    }
+
+private:
+    uint8_t* dst_;
+    size_t code_pos_; // where the current code byte goes
+    size_t pos_;
+    uint8_t code_;
+};
+
+/**
+ * @brief Decodes a frame in place. The decoded frame is never longer than the
+ * encoded one.
+ *
+ * @param buf: The encoded frame without the delimiter. Because frames are
+ *        split at the delimiter, it contains no zero bytes.
+ * @param decoded_length: Set to the decoded length.
+ * @returns false if the frame is malformed, i.e. a code byte points past the
+ *          end.
+ */
+inline bool cobs_decode(uint8_t* buf, size_t length, size_t* decoded_length) {
+    size_t in = 0;
+    size_t out = 0;
+    while (in < length) {
+        uint8_t code = buf[in++];
+        if (!code || (size_t)(code - 1) > length - in) {
+            return false;
+        }
+        memmove(buf + out, buf + in, code - 1);
+        in += code - 1;
+        out += code - 1;
+        if (code != 0xff && in < length) {
+            buf[out++] = 0;
+        }
+    }
+    *decoded_length = out;
+    return true;
+}
+
+}
+
+#endif // __FIBRE_COBS_HPP
@@ -242,6 +242,7 @@ void Domain::add_channels(ChannelDiscoveryResult result) {
     // Deleted during on_stopped()
     auto protocol = new fibre::LegacyProtocolPacketBased(result.rx_channel, result.tx_channel, result.mtu);
 #if FIBRE_ENABLE_CLIENT
+    protocol->client_.device_id_ = result.device_id ? result.device_id : "";
     protocol->start(MEMBER_CB(this, on_found_root_object), MEMBER_CB(this, on_lost_root_object), MEMBER_CB(this, on_stopped));
 #else
     protocol->start(MEMBER_CB(this, on_stopped));
@@ -255,6 +256,16 @@ void Domain::on_found_root_object(LegacyObjectClient* obj_client, std::shared_pt
     Interface* root_intf = reinterpret_cast<Interface*>(obj->intf.get());
     root_objects_[root_object] = root_intf;
     on_found_object_.invoke(root_object, root_intf);
+
+    // Subscriptions that the application made in the callback above take
+    // precedence over the ones of the previous connection
+    auto it = lost_subscriptions_.find(obj_client->device_id_);
+    if (it != lost_subscriptions_.end()) {
+        if (!obj_client->is_subscribing() && obj_client->resume_subscriptions(*it->second)) {
+            FIBRE_LOG(D) << "resuming subscriptions of " << obj_client->device_id_;
+        }
+        lost_subscriptions_.erase(it);
+    }
 }
 
 void Domain::on_lost_root_object(LegacyObjectClient* obj_client, std::shared_ptr<LegacyObject> obj) {
@@ -266,5 +277,12 @@ void Domain::on_lost_root_object(LegacyObjectClient* obj_client, std::shared_ptr
 #endif
 
 void Domain::on_stopped(LegacyProtocolPacketBased* protocol, StreamStatus status) {
+#if FIBRE_ENABLE_CLIENT
+    if (!protocol->client_.device_id_.empty()) {
+        if (auto subscriptions = protocol->client_.get_subscriptions()) {
+            lost_subscriptions_[protocol->client_.device_id_] = subscriptions;
+        }
+    }
+#endif
     delete protocol;
 }
@@ -0,0 +1,163 @@
+#ifndef __FIBRE_HOST_CLIENT_HPP
+#define __FIBRE_HOST_CLIENT_HPP
+
+#include "legacy_protocol.hpp"
+#include "logging.hpp"
+#include "print_utils.hpp"
+#include <fibre/simple_serdes.hpp>
+
+#if FIBRE_ENABLE_CLIENT
+
+namespace fibre {
+
+/**
+ * @brief A property of a device whose interface is known at compile time:
+ * the endpoint ID and the value type. Instances are generated from the
+ * interface definition by host_client_template.j2.
+ */
+template<typename T, bool Writable>
+struct HostProperty {
+    using value_type = T;
+    static constexpr bool writable = Writable;
+    uint16_t endpoint_id;
+};
+
+/**
+ * @brief Accesses the properties of a device through a header that was
+ * generated from the same interface definition as its firmware.
+ *
+ * Unlike LegacyObjectClient, this doesn't download and parse the JSON of the
+ * device and looks up no codecs at runtime: each read() or write() is one
+ * endpoint operation with the ID and value size of the generated
+ * HostProperty. connect() makes sure that the device runs the generated
+ * interface by comparing its JSON version ID with the generated one.
+ *
+ * The protocol must be started without an object client, i.e. with an empty
+ * on_found_root_object callback. The client must outlive its operations.
+ *
+ * Not thread safe. All calls and callbacks run on the thread of the protocol.
+ */
+class HostClient {
+public:
+    HostClient(LegacyProtocolPacketBased* protocol, uint32_t json_version_id)
+        : protocol_(protocol), json_version_id_(json_version_id) {}
+
+    HostClient(const HostClient&) = delete;
+    HostClient& operator=(const HostClient&) = delete;
+
+    /**
+     * @brief Reads the JSON version ID of the device.
+     * @param on_done: Invoked with true if it matches the generated one. Only
+     *        then read() and write() can be used.
+     */
+    void connect(Callback<void, bool> on_done) {
+        connected_ = false;
+        on_connected_ = on_done;
+        write_le<uint32_t>(0xffffffff, version_tx_buf_); // offset of the version ID
+        protocol_->start_endpoint_operation(0, version_tx_buf_, version_rx_buf_, &version_handle_, MEMBER_CB(this, on_received_version_id));
+    }
+
+    bool is_connected() const { return connected_; }
+
+    /**
+     * @brief Reads a property into `value`, which must remain valid until
+     * on_done is invoked.
+     * @param on_done: Invoked with true once `value` holds the value.
+     * @returns false if the client isn't connected.
+     */
+    template<typename T, bool Writable>
+    bool read(HostProperty<T, Writable> property, T* value, Callback<void, bool> on_done) {
+        static_assert(sizeof(T) <= kMaxValueSize, "value too large");
+        if (!connected_) {
+            return false;
+        }
+        Operation* op = operation_pool_.alloc();
+        *op = {this, {}, {}, sizeof(T), value, &decode<T>, on_done, 0};
+        protocol_->start_endpoint_operation(property.endpoint_id, cbufptr_t{op->tx_buf, (size_t)0},
+                bufptr_t{op->rx_buf, sizeof(T)}, &op->handle, MEMBER_CB(op, on_finished));
+        return true;
+    }
+
+    /**
+     * @brief Writes a property.
+     * @param on_done: Invoked with true once the device acknowledged the
+     *        value.
+     * @returns false if the client isn't connected.
+     */
+    template<typename T>
+    bool write(HostProperty<T, true> property, T value, Callback<void, bool> on_done) {
+        static_assert(sizeof(T) <= kMaxValueSize, "value too large");
+        if (!connected_) {
+            return false;
+        }
+        Operation* op = operation_pool_.alloc();
+        *op = {this, {}, {}, 0, nullptr, nullptr, on_done, 0};
+        write_le<T>(value, op->tx_buf);
+        protocol_->start_endpoint_operation(property.endpoint_id, cbufptr_t{op->tx_buf, sizeof(T)},
+                bufptr_t{op->rx_buf, (size_t)0}, &op->handle, MEMBER_CB(op, on_finished));
+        return true;
+    }
+
+private:
+    static constexpr size_t kMaxValueSize = 8;
+
+    // Number of operations that can be in progress without touching the heap
+    static constexpr size_t kPoolSize = 16;
+
+    struct Operation {
+        HostClient* client;
+        uint8_t tx_buf[kMaxValueSize];
+        uint8_t rx_buf[kMaxValueSize];
+        size_t rx_size;
+        void* value;
+        void (*decode_fn)(void* value, const uint8_t* buf);
+        Callback<void, bool> on_done;
+        EndpointOperationHandle handle;
+
+        void on_finished(EndpointOperationResult result) {
+            bool ok = result.status == kStreamOk && (size_t)(result.rx_end - rx_buf) == rx_size;
+            if (ok && decode_fn) {
+                decode_fn(value, rx_buf);
+            }
+            Callback<void, bool> callback = on_done;
+            client->operation_pool_.free(this);
+            callback.invoke(ok);
+        }
+    };
+
+    template<typename T>
+    static void decode(void* value, const uint8_t* buf) {
+        read_le<T>(static_cast<T*>(value), buf);
+    }
+
+    void on_received_version_id(EndpointOperationResult result) {
+        version_handle_ = 0;
+        uint32_t version_id = 0;
+        if (result.status == kStreamOk && result.rx_end - version_rx_buf_ == sizeof(version_rx_buf_)) {
+            read_le<uint32_t>(&version_id, version_rx_buf_);
+        }
+        connected_ = version_id == json_version_id_;
+        if (connected_) {
+            // The trailer of all endpoint operations but those of endpoint 0
+            protocol_->client_.json_crc_ = (uint16_t)(json_version_id_ >> 16);
+        } else if (result.status == kStreamOk) {
+            FIBRE_LOG(W) << "device runs JSON version " << as_hex(version_id) << ", expected " << as_hex(json_version_id_);
+        }
+        on_connected_.invoke_and_clear(connected_);
+    }
+
+    LegacyProtocolPacketBased* protocol_;
+    uint32_t json_version_id_;
+    bool connected_ = false;
+    Callback<void, bool> on_connected_;
+    uint8_t version_tx_buf_[4];
+    uint8_t version_rx_buf_[4];
+    EndpointOperationHandle version_handle_ = 0;
+    Pool<Operation, kPoolSize> operation_pool_{get_debug_stats().host_operations};
+};
+
+}
+
+#endif
+
+#endif // __FIBRE_HOST_CLIENT_HPP
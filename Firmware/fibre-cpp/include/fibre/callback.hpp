@@ -34,7 +34,8 @@ public:
     //    static_assert(std::is_same<Callback<TRetOther, TArgsOther...>, Callback>::value, "incompatible callback type");
     //}
 
-    Callback(const Callback& other) : cb_(other.cb_), ctx_(other.ctx_) {}
+    Callback(const Callback& other) = default;
+    Callback& operator=(const Callback& other) = default;
 
     // If you get a compile error "[...] invokes a deleted function" that points
     // here then you're probably trying to assign a Callback with incompatible
@@ -12,6 +12,10 @@ struct ChannelDiscoveryResult {
     AsyncStreamSource* rx_channel;
     AsyncStreamSink* tx_channel;
     size_t mtu;
+    // Identifies the device across reconnects (e.g. USB serial number) or null
+    // if unknown (null if omitted from the initializer list). Only needs to be
+    // valid during add_channels().
+    const char* device_id;
 };
 
 struct ChannelDiscoveryContext {};
@@ -13,10 +13,14 @@
 #include "../../platform_support/libusb_transport.hpp"
 #endif
 
-#if FIBRE_ENABLE_TCP_CLIENT_BACKEND
+#if FIBRE_ENABLE_TCP_CLIENT_BACKEND || FIBRE_ENABLE_TCP_SERVER_BACKEND || FIBRE_ENABLE_UDP_CLIENT_BACKEND || FIBRE_ENABLE_UDP_SERVER_BACKEND
 #include "../../platform_support/posix_tcp_backend.hpp"
 #endif
 
+#if FIBRE_ENABLE_SOCKETCAN_BACKEND
+#include "../../platform_support/socket_can_backend.hpp"
+#endif
+
 namespace fibre {
 
 struct CallBuffers {
@@ -60,11 +64,29 @@ struct Context {
 #if FIBRE_ENABLE_TCP_CLIENT_BACKEND
         PosixTcpClientBackend
 #endif
-#if FIBRE_ENABLE_TCP_CLIENT_BACKEND && FIBRE_ENABLE_TCP_SERVER_BACKEND
-        , // TODO: find a less awkward way to do this
+#if (FIBRE_ENABLE_LIBUSB_BACKEND || FIBRE_ENABLE_TCP_CLIENT_BACKEND) && FIBRE_ENABLE_TCP_SERVER_BACKEND
+        ,
 #endif
 #if FIBRE_ENABLE_TCP_SERVER_BACKEND
         PosixTcpServerBackend
+#endif
+#if (FIBRE_ENABLE_LIBUSB_BACKEND || FIBRE_ENABLE_TCP_CLIENT_BACKEND || FIBRE_ENABLE_TCP_SERVER_BACKEND) && FIBRE_ENABLE_UDP_CLIENT_BACKEND
+        ,
+#endif
+#if FIBRE_ENABLE_UDP_CLIENT_BACKEND
+        PosixUdpClientBackend
+#endif
+#if (FIBRE_ENABLE_LIBUSB_BACKEND || FIBRE_ENABLE_TCP_CLIENT_BACKEND || FIBRE_ENABLE_TCP_SERVER_BACKEND || FIBRE_ENABLE_UDP_CLIENT_BACKEND) && FIBRE_ENABLE_UDP_SERVER_BACKEND
+        ,
+#endif
+#if FIBRE_ENABLE_UDP_SERVER_BACKEND
+        PosixUdpServerBackend
+#endif
+#if (FIBRE_ENABLE_LIBUSB_BACKEND || FIBRE_ENABLE_TCP_CLIENT_BACKEND || FIBRE_ENABLE_TCP_SERVER_BACKEND || FIBRE_ENABLE_UDP_CLIENT_BACKEND || FIBRE_ENABLE_UDP_SERVER_BACKEND) && FIBRE_ENABLE_SOCKETCAN_BACKEND
+        ,
+#endif
+#if FIBRE_ENABLE_SOCKETCAN_BACKEND
+        SocketCanBackend
 #endif
     > static_backends;
 
@@ -89,6 +111,7 @@ struct Context {
 struct LegacyProtocolPacketBased;
 class LegacyObjectClient;
 struct LegacyObject;
+struct LegacySubscriptionSet;
 
 class Domain {
     friend struct Context;
@@ -117,6 +140,9 @@ private:
     Callback<void, Object*, Interface*> on_found_object_;
     Callback<void, Object*> on_lost_object_;
     std::unordered_map<Object*, Interface*> root_objects_;
+    // Subscriptions of lost devices that are resumed when the same device is
+    // found again. Key: ChannelDiscoveryResult::device_id
+    std::unordered_map<std::string, std::shared_ptr<LegacySubscriptionSet>> lost_subscriptions_;
 #endif
 };
 
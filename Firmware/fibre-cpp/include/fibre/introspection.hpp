@@ -144,10 +144,13 @@ struct StringConvertibleTypeInfo {
 };
 
 struct FloatSettableTypeInfo {
-    //virtual bool get_float(const Introspectable& obj, float* val) const { return false; }
     virtual bool set_float(const Introspectable& obj, float val) const { return false; }
 };
 
+struct FloatGettableTypeInfo {
+    virtual bool get_float(const Introspectable& obj, float* val) const { return false; }
+};
+
 /* Built-in type infos ********************************************************/
 
 template<typename T>
@@ -155,7 +158,7 @@ struct FibrePropertyTypeInfo;
 
 // readonly property
 template<typename T>
-struct FibrePropertyTypeInfo<Property<const T>> : StringConvertibleTypeInfo, TypeInfo {
+struct FibrePropertyTypeInfo<Property<const T>> : FloatGettableTypeInfo, StringConvertibleTypeInfo, TypeInfo {
     using TypeInfo::TypeInfo;
     static const PropertyInfo property_table[];
     static const FibrePropertyTypeInfo<Property<const T>> singleton;
@@ -167,6 +170,10 @@ struct FibrePropertyTypeInfo<Property<const T>> : StringConvertibleTypeInfo, Typ
     bool get_string(const Introspectable& obj, char* buffer, size_t length) const override {
         return to_string(static_cast<maybe_underlying_type_t<T>>(as<const Property<const T>>(obj).read()), buffer, length, 0);
     }
+
+    bool get_float(const Introspectable& obj, float* val) const override {
+        return conversion::get_as_float(static_cast<maybe_underlying_type_t<T>>(as<const Property<const T>>(obj).read()), val);
+    }
 };
 
 template<typename T>
@@ -176,7 +183,7 @@ const FibrePropertyTypeInfo<Property<const T>> FibrePropertyTypeInfo<Property<co
 
 // readwrite property
 template<typename T>
-struct FibrePropertyTypeInfo<Property<T>> : FloatSettableTypeInfo, StringConvertibleTypeInfo, TypeInfo {
+struct FibrePropertyTypeInfo<Property<T>> : FloatSettableTypeInfo, FloatGettableTypeInfo, StringConvertibleTypeInfo, TypeInfo {
     using TypeInfo::TypeInfo;
     static const PropertyInfo property_table[];
     static const FibrePropertyTypeInfo<Property<T>> singleton;
@@ -190,6 +197,10 @@ struct FibrePropertyTypeInfo<Property<T>> : FloatSettableTypeInfo, StringConvert
         return to_string(static_cast<maybe_underlying_type_t<T>>(as<const Property<T>>(obj).read()), buffer, length, 0);
     }
 
+    bool get_float(const Introspectable& obj, float* val) const override {
+        return conversion::get_as_float(static_cast<maybe_underlying_type_t<T>>(as<const Property<T>>(obj).read()), val);
+    }
+
     bool set_string(const Introspectable& obj, char* buffer, size_t length) const override {
         maybe_underlying_type_t<T> value{};
         if (!from_string(buffer, length, &value, 0)) {
@@ -214,6 +225,57 @@ const PropertyInfo FibrePropertyTypeInfo<Property<T>>::property_table[] = {};
 template<typename T>
 const FibrePropertyTypeInfo<Property<T>> FibrePropertyTypeInfo<Property<T>>::singleton{FibrePropertyTypeInfo<Property<T>>::property_table, sizeof(FibrePropertyTypeInfo<Property<T>>::property_table) / sizeof(FibrePropertyTypeInfo<Property<T>>::property_table[0])};
 
+/**
+ * @brief A property that was resolved from an endpoint reference once and
+ * can then be read as float repeatedly without looking it up again.
+ */
+struct FloatEndpointReader {
+    bool read(float* val) const {
+        return type_info && type_info->get_float(property, val);
+    }
+
+    Introspectable property;
+    const FloatGettableTypeInfo* type_info = nullptr;
+};
+
+namespace fibre {
+// Defined in the autogenerated endpoints.hpp. Returns false if the endpoint
+// reference is invalid or doesn't refer to a numeric property.
+bool get_float_endpoint_reader(endpoint_ref_t endpoint_ref, FloatEndpointReader* reader);
+
+/**
+ * @brief Looks up a property by its path from the root object, such as
+ * "axis0.controller.config.vel_limit", in O(length) time.
+ *
+ * Defined in the autogenerated endpoints.hpp.
+ *
+ * @param length: The maximum length of the path. The path ends early at a
+ *        null character.
+ * @returns False if there is no such property (result is invalid then).
+ */
+bool get_property_by_path(const char* path, size_t length, Introspectable* result);
+
+// 32 bit FNV-1a hash of a property path. Must match hash_path() in
+// interface_generator.py.
+inline uint32_t hash_path(const char* path, size_t length) {
+    uint32_t hash = 0x811c9dc5;
+    for (size_t i = 0; i < length; ++i) {
+        hash = (hash ^ (uint8_t)path[i]) * 0x01000193;
+    }
+    return hash;
+}
+
+// Finalizer of MurmurHash3. Must match mix_hash() in interface_generator.py.
+inline uint32_t mix_hash(uint32_t hash) {
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6b;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35;
+    hash ^= hash >> 16;
+    return hash;
+}
+}
+
 #pragma GCC pop_options
 
 #endif // __FIBRE_INTROSPECTION_HPP
\ No newline at end of file
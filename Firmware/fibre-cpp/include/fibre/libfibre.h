@@ -226,6 +226,51 @@ typedef LibFibreStatus (*libfibre_call_cb_t)(void* ctx,
         const unsigned char** tx_buf, size_t* tx_len,
         unsigned char** rx_buf, size_t* rx_len);
 
+/**
+ * @brief One function call of a batch that is started with
+ * libfibre_call_batch().
+ *
+ * `func`, `tx_buf`, `tx_len`, `rx_buf` and `rx_len` are inputs and have the
+ * same meaning as the corresponding arguments of libfibre_call(). `tx_buf`
+ * must contain all inputs of the function and `rx_buf` must be large enough
+ * for all outputs.
+ *
+ * `status`, `tx_end` and `rx_end` are set by libfibre once the call
+ * completed. A status of kFibreClosed indicates that the call completed
+ * successfully.
+ */
+struct LibFibreCallBatchItem {
+    LibFibreFunction* func;
+    const unsigned char* tx_buf;
+    size_t tx_len;
+    unsigned char* rx_buf;
+    size_t rx_len;
+    LibFibreStatus status;
+    const unsigned char* tx_end;
+    unsigned char* rx_end;
+};
+
+/**
+ * @brief Callback type for libfibre_call_batch().
+ *
+ * @param ctx: The context pointer that was passed to libfibre_call_batch().
+ * @param items: The array that was passed to libfibre_call_batch(). The
+ *        results of all calls are filled in.
+ * @param n_items: The length of `items`.
+ */
+typedef void (*libfibre_call_batch_cb_t)(void* ctx, struct LibFibreCallBatchItem* items, size_t n_items);
+
+/**
+ * @brief Callback type for libfibre_subscribe().
+ *
+ * @param ctx: The context pointer that was passed to libfibre_subscribe().
+ * @param obj: The property object whose value was received.
+ * @param value: The value, encoded like the output of the property's read
+ *        function. Only valid for the duration of the callback.
+ * @param length: The length of `value`.
+ */
+typedef void (*on_property_update_cb_t)(void* ctx, LibFibreObject* obj, const unsigned char* value, size_t length);
+
 /**
  * @brief TX completion callback type for libfibre_start_tx().
  * 
@@ -516,6 +561,72 @@ FIBRE_PUBLIC LibFibreStatus libfibre_call(LibFibreFunction* func, LibFibreCallCo
         unsigned char** rx_end,
         libfibre_call_cb_t callback, void* cb_ctx);
 
+/**
+ * @brief Starts several complete function calls at once and reports their
+ * results with a single callback.
+ *
+ * This behaves like one libfibre_call() per item with a status of
+ * kFibreClosed, except that all calls are started before any of them is
+ * waited for. The calls therefore go through the protocol back-to-back and
+ * the application pays for only one transition into and out of libfibre.
+ * This is useful for reading many properties at once.
+ *
+ * The calls complete in arbitrary order. Items of the same batch can refer to
+ * different functions and different objects.
+ *
+ * @param items: The calls to make. The array and all buffers referenced by it
+ *        must remain valid until `callback` is invoked (or until this
+ *        function returns if it doesn't return kFibreBusy).
+ * @param n_items: Number of items in `items`.
+ * @param callback: Will be invoked once all calls completed if and only if
+ *        libfibre_call_batch() returns kFibreBusy. This callback is never
+ *        invoked from inside libfibre_call_batch().
+ * @param cb_ctx: An opaque application-defined handle that gets passed to
+ *        `callback`.
+ *
+ * @retval kFibreOk: All calls completed synchronously and their results are
+ *         filled in. `callback` will not be invoked.
+ * @retval kFibreBusy: At least one call is still in progress. `callback` will
+ *         be invoked once all calls completed.
+ * @retval kFibreInvalidArgument: At least one of the items is invalid. None of
+ *         the calls was started.
+ */
+FIBRE_PUBLIC LibFibreStatus libfibre_call_batch(struct LibFibreCallBatchItem* items, size_t n_items,
+        libfibre_call_batch_cb_t callback, void* cb_ctx);
+
+/**
+ * @brief Asks a device to send the values of the given properties without
+ * being polled.
+ *
+ * Each call replaces the subscriptions of the previous call for the same
+ * device. The device sends a value either at a fixed interval or whenever it
+ * changes. Subscriptions end when the device is lost.
+ *
+ * The device supports a limited number of subscriptions (currently 16) and
+ * only properties of up to 8 bytes. Subscriptions beyond that are dropped
+ * with a warning.
+ *
+ * @param obj: Any object of the device, for instance the root object.
+ * @param properties: Property objects of the same device, as obtained with
+ *        libfibre_get_attribute().
+ * @param intervals_ms: One interval per property [ms]. 0 means that the value
+ *        is sent whenever it changes (checked every 10 ms).
+ * @param n_properties: Number of items in `properties` and `intervals_ms`. 0
+ *        ends all subscriptions of the device.
+ * @param on_update: Invoked on the event loop thread for every value received.
+ * @param cb_ctx: An opaque application-defined handle that gets passed to
+ *        `on_update`.
+ *
+ * @retval kFibreOk: The request was sent.
+ * @retval kFibreBusy: The previous request for this device is still in
+ *         progress. Try again later.
+ * @retval kFibreInvalidArgument: One of the objects is not a property of the
+ *         device.
+ */
+FIBRE_PUBLIC LibFibreStatus libfibre_subscribe(LibFibreObject* obj,
+        LibFibreObject** properties, const uint16_t* intervals_ms, size_t n_properties,
+        on_property_update_cb_t on_update, void* cb_ctx);
+
 /**
  * @brief Starts sending data on the specified TX stream.
  * 
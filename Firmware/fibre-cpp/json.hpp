@@ -0,0 +1,256 @@
+#ifndef __FIBRE_JSON_HPP
+#define __FIBRE_JSON_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <limits.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <memory>
+
+namespace fibre {
+
+/**
+ * @brief Reference to a string in the parsed JSON buffer.
+ */
+struct json_str {
+    const char* begin = nullptr;
+    const char* end = nullptr;
+
+    size_t size() const { return end - begin; }
+    std::string to_string() const { return {begin, end}; }
+
+    bool operator==(const char* str) const {
+        size_t len = strlen(str);
+        return len == size() && !memcmp(begin, str, len);
+    }
+    bool operator!=(const char* str) const { return !(*this == str); }
+};
+
+struct json_value {
+    enum type_t : uint8_t { kNone, kStr, kInt, kList, kDict };
+
+    type_t type = kNone;
+    int integer = 0;
+    json_str str;
+    // kList: n_items values, kDict: n_items key/value pairs as 2 * n_items values
+    const json_value* items = nullptr;
+    size_t n_items = 0;
+};
+
+// Range over the items of a list
+struct json_list {
+    const json_value* begin_;
+    const json_value* end_;
+
+    const json_value* begin() const { return begin_; }
+    const json_value* end() const { return end_; }
+    size_t size() const { return end_ - begin_; }
+};
+
+inline bool json_is_str(const json_value& val) { return val.type == json_value::kStr; }
+inline bool json_is_int(const json_value& val) { return val.type == json_value::kInt; }
+inline bool json_is_list(const json_value& val) { return val.type == json_value::kList; }
+inline bool json_is_dict(const json_value& val) { return val.type == json_value::kDict; }
+inline json_str json_as_str(const json_value& val) { return val.str; }
+inline int json_as_int(const json_value& val) { return val.integer; }
+inline json_list json_as_list(const json_value& val) {
+    return json_is_list(val) ? json_list{val.items, val.items + val.n_items} : json_list{nullptr, nullptr};
+}
+
+/**
+ * @brief Returns the value of the given key or a value of type kNone if `dict`
+ * is not a dict or has no such key.
+ */
+inline const json_value& json_dict_find(const json_value& dict, const char* key) {
+    static const json_value none;
+    if (json_is_dict(dict)) {
+        for (size_t i = 0; i < dict.n_items; ++i) {
+            const json_value& k = dict.items[2 * i];
+            if (json_is_str(k) && k.str == key) {
+                return dict.items[2 * i + 1];
+            }
+        }
+    }
+    return none;
+}
+
+/**
+ * @brief Parses a JSON buffer into a tree of json_value that point into the
+ * buffer, so the buffer must outlive the document.
+ *
+ * Only the subset of JSON used by the interface definition is supported:
+ * lists, dicts, strings without escape sequences and non-negative integers.
+ *
+ * The values are allocated in blocks that are owned by the document. The
+ * items of each list and dict are stored contiguously.
+ */
+class json_document {
+public:
+    // @brief Returns the root value or nullptr if the JSON is invalid
+    const json_value* parse(const char* begin, const char* end) {
+        stack_.clear();
+        error_ = nullptr;
+        error_pos_ = nullptr;
+        if (!parse_value(&begin, end)) {
+            return nullptr;
+        }
+        json_value* root = allocate(1);
+        *root = stack_.back();
+        return root;
+    }
+
+    const char* error() const { return error_; }
+    const char* error_pos() const { return error_pos_; }
+
+private:
+    static constexpr size_t kBlockSize = 4096; // values per block
+
+    static bool is_space(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+    static bool is_digit(char c) { return c >= '0' && c <= '9'; }
+
+    static void skip_whitespace(const char** begin, const char* end) {
+        while (*begin < end && is_space(**begin)) {
+            (*begin)++;
+        }
+    }
+
+    static bool comp(const char* begin, const char* end, char c) {
+        return begin < end && *begin == c;
+    }
+
+    bool fail(const char* pos, const char* error) {
+        error_pos_ = pos;
+        error_ = error;
+        return false;
+    }
+
+    json_value* allocate(size_t n) {
+        if (n > kBlockSize) {
+            // Goes before the current block, so that the next allocation
+            // continues in the current block and not inside this one
+            if (blocks_.empty()) {
+                blocks_.emplace_back(new json_value[n]);
+                block_used_ = kBlockSize;
+                return blocks_.back().get();
+            }
+            return blocks_.emplace(blocks_.end() - 1, new json_value[n])->get();
+        }
+        if (blocks_.empty() || block_used_ + n > kBlockSize) {
+            blocks_.emplace_back(new json_value[kBlockSize]);
+            block_used_ = 0;
+        }
+        json_value* result = blocks_.back().get() + block_used_;
+        block_used_ += n;
+        return result;
+    }
+
+    // Moves the values above `base` from the stack to the arena
+    const json_value* pop_items(size_t base) {
+        size_t n = stack_.size() - base;
+        json_value* items = n ? allocate(n) : nullptr;
+        std::copy(stack_.begin() + base, stack_.end(), items);
+        stack_.resize(base);
+        return items;
+    }
+
+    // Parses a list or dict and pushes it to the stack
+    bool parse_container(const char** begin, const char* end, bool is_dict) {
+        char close = is_dict ? '}' : ']';
+        (*begin)++; // consume leading '{' or '['
+        size_t base = stack_.size();
+        bool expect_comma = false;
+
+        skip_whitespace(begin, end);
+        while (!comp(*begin, end, close)) {
+            if (expect_comma) {
+                if (!comp(*begin, end, ',')) {
+                    return fail(*begin, is_dict ? "expected ',' or '}'" : "expected ',' or ']'");
+                }
+                (*begin)++; // consume comma
+                skip_whitespace(begin, end);
+            }
+            expect_comma = true;
+
+            if (is_dict) {
+                // Parse key-value pair
+                if (!parse_value(begin, end)) return false;
+                skip_whitespace(begin, end);
+                if (!comp(*begin, end, ':')) {
+                    return fail(*begin, "expected :");
+                }
+                (*begin)++;
+                skip_whitespace(begin, end);
+            }
+            if (!parse_value(begin, end)) return false;
+
+            skip_whitespace(begin, end);
+        }
+
+        (*begin)++; // consume trailing '}' or ']'
+        json_value val;
+        val.type = is_dict ? json_value::kDict : json_value::kList;
+        val.n_items = is_dict ? (stack_.size() - base) / 2 : stack_.size() - base;
+        val.items = pop_items(base);
+        stack_.push_back(val);
+        return true;
+    }
+
+    // Parses a value and pushes it to the stack
+    bool parse_value(const char** begin, const char* end) {
+        if (*begin >= end) {
+            return fail(*begin, "expected value but got EOF");
+        }
+
+        json_value val;
+
+        if (comp(*begin, end, '{') || comp(*begin, end, '[')) {
+            return parse_container(begin, end, **begin == '{');
+
+        } else if (comp(*begin, end, '"')) {
+            (*begin)++; // consume leading '"'
+            val.type = json_value::kStr;
+            val.str.begin = *begin;
+            while (!comp(*begin, end, '"')) {
+                if (*begin >= end) {
+                    return fail(*begin, "expected '\"' but got EOF");
+                }
+                if (comp(*begin, end, '\\')) {
+                    return fail(*begin, "escaped strings not supported");
+                }
+                (*begin)++;
+            }
+            val.str.end = *begin;
+            (*begin)++; // consume trailing '"'
+
+        } else if (is_digit(**begin)) {
+            val.type = json_value::kInt;
+            while (*begin < end && is_digit(**begin)) {
+                int digit = **begin - '0';
+                if (val.integer > (INT_MAX - digit) / 10) {
+                    return fail(*begin, "integer too large");
+                }
+                val.integer = val.integer * 10 + digit;
+                (*begin)++;
+            }
+
+        } else {
+            return fail(*begin, "unexpected character");
+        }
+
+        stack_.push_back(val);
+        return true;
+    }
+
+    std::vector<std::unique_ptr<json_value[]>> blocks_;
+    size_t block_used_ = 0;
+    std::vector<json_value> stack_; // items of the containers that are being parsed
+    const char* error_ = nullptr;
+    const char* error_pos_ = nullptr;
+};
+
+}
+
+#endif // __FIBRE_JSON_HPP
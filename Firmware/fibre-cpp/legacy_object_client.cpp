@@ -5,169 +5,26 @@
 #include "logging.hpp"
 #include "print_utils.hpp"
 #include "crc.hpp"
+#include "json.hpp"
+#include "pool.hpp"
 #include <variant>
 #include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/stat.h>
+#if defined(_WIN32) || defined(_WIN64)
+#include <direct.h>
+#endif
 
 DEFINE_LOG_TOPIC(LEGACY_OBJ);
 USE_LOG_TOPIC(LEGACY_OBJ);
 
 using namespace fibre;
 
-struct json_error {
-    const char* ptr;
-    std::string str;
-};
-
-struct json_value;
-using json_list = std::vector<std::shared_ptr<json_value>>;
-using json_dict = std::vector<std::pair<std::shared_ptr<json_value>, std::shared_ptr<json_value>>>;
-using json_value_variant = std::variant<std::string, int, json_list, json_dict, json_error>;
-
-struct json_value : json_value_variant {
-    //json_value(const json_value_variant& v) : json_value_variant{v} {}
-    template<typename T> json_value(T&& arg) : json_value_variant{std::forward<T>(arg)} {}
-    //json_value_variant v;
-};
-
-// helper functions
-bool json_is_str(json_value val) { return val.index() == 0; }
-bool json_is_int(json_value val) { return val.index() == 1; }
-bool json_is_list(json_value val) { return val.index() == 2; }
-bool json_is_dict(json_value val) { return val.index() == 3; }
-bool json_is_err(json_value val) { return val.index() == 4; }
-std::string json_as_str(json_value val) { return std::get<0>(val); }
-int json_as_int(json_value val) { return std::get<1>(val); }
-json_list json_as_list(json_value val) { return std::get<2>(val); }
-json_dict json_as_dict(json_value val) { return std::get<3>(val); }
-json_error json_as_err(json_value val) { return std::get<4>(val); }
-
-json_value json_make_error(const char* ptr, std::string str) {
-    return {json_error{ptr, str}};
-}
-
-
-void json_skip_whitespace(const char** begin, const char* end) {
-    while (*begin < end && std::isspace(**begin)) {
-        (*begin)++;
-    }
-}
-
-bool json_comp(const char* begin, const char* end, char c) {
-    return begin < end && *begin == c;
-}
-
-json_value json_parse(const char** begin, const char* end) {
-    // skip whitespace
-
-    if (*begin >= end) {
-        return json_make_error(*begin, "expected value but got EOF");
-    }
-
-    if (json_comp(*begin, end, '{')) {
-        // parse dict
-        (*begin)++; // consume leading '{'
-        json_dict dict;
-        bool expect_comma = false;
-
-        json_skip_whitespace(begin, end);
-        while (!json_comp(*begin, end, '}')) {
-            if (expect_comma) {
-                if (!json_comp(*begin, end, ',')) {
-                    return json_make_error(*begin, "expected ',' or '}'");
-                }
-                (*begin)++; // consume comma
-                json_skip_whitespace(begin, end);
-            }
-            expect_comma = true;
-
-            // Parse key-value pair
-            json_value key = json_parse(begin, end);
-            if (json_is_err(key)) return key;
-            json_skip_whitespace(begin, end);
-            if (!json_comp(*begin, end, ':')) {
-                return json_make_error(*begin, "expected :");
-            }
-            (*begin)++;
-            json_value val = json_parse(begin, end);
-            if (json_is_err(val)) return val;
-            dict.push_back({std::make_shared<json_value>(key), std::make_shared<json_value>(val)});
-
-            json_skip_whitespace(begin, end);
-        }
-
-        (*begin)++;
-        return {dict};
-
-    } else if (json_comp(*begin, end, '[')) {
-        // parse list
-        (*begin)++; // consume leading '['
-        json_list list;
-        bool expect_comma = false;
-
-        json_skip_whitespace(begin, end);
-        while (!json_comp(*begin, end, ']')) {
-            if (expect_comma) {
-                if (!json_comp(*begin, end, ',')) {
-                    return json_make_error(*begin, "expected ',' or ']'");
-                }
-                (*begin)++; // consume comma
-                json_skip_whitespace(begin, end);
-            }
-            expect_comma = true;
-
-            // Parse item
-            json_value val = json_parse(begin, end);
-            if (json_is_err(val)) return val;
-            list.push_back(std::make_shared<json_value>(val));
-
-            json_skip_whitespace(begin, end);
-        }
-
-        (*begin)++; // consume trailing ']'
-        return {list};
-
-    } else if (json_comp(*begin, end, '"')) {
-        // parse string
-        (*begin)++; // consume leading '"'
-        std::string str;
-
-        while (!json_comp(*begin, end, '"')) {
-            if (*begin >= end) {
-                return json_make_error(*begin, "expected '\"' but got EOF");
-            }
-            if (json_comp(*begin, end, '\\')) {
-                return json_make_error(*begin, "escaped strings not supported");
-            }
-            str.push_back(**begin);
-            (*begin)++;
-        }
-
-        (*begin)++; // consume trailing '"'
-        return {str};
-
-    } else if (std::isdigit(**begin)) {
-        // parse int
-
-        std::string str;
-        while (*begin < end && std::isdigit(**begin)) {
-            str.push_back(**begin);
-            (*begin)++;
-        }
-
-        return {std::stoi(str)}; // note: this can throw an exception if the int is too long
-
-    } else {
-        return json_make_error(*begin, "unexpected character '" + std::string(*begin, *begin + 1) + "'");
-    }
-}
-
-json_value json_dict_find(json_dict dict, std::string key) {
-    auto it = std::find_if(dict.begin(), dict.end(),
-        [&](std::pair<std::shared_ptr<json_value>, std::shared_ptr<json_value>>& kv){
-            return json_is_str(*kv.first) && json_as_str(*kv.first) == key;
-        });
-    return (it == dict.end()) ? json_make_error(nullptr, "key not found") : *it->second;
-}
+// Number of concurrent calls whose contexts don't need a heap allocation
+static constexpr size_t kCallContextPoolSize = 64;
+static Pool<LegacyCallContext, kCallContextPoolSize> call_context_pool{get_debug_stats().call_contexts};
 
 // not sure if this function exists in the STL
 template<typename TIt, typename TFunc, typename TNum = decltype(std::declval<TFunc>()(*std::declval<TIt>()))>
@@ -201,29 +58,28 @@ size_t get_codec_size(std::string codec) {
 std::vector<LegacyFibreArg> parse_arglist(const json_value& list_val) {
     std::vector<LegacyFibreArg> arglist;
 
-    for (auto& arg : json_is_list(list_val) ? json_as_list(list_val) : json_list()) {
-        if (!json_is_dict(*arg)) {
+    for (auto& arg : json_as_list(list_val)) {
+        if (!json_is_dict(arg)) {
             FIBRE_LOG(W) << "arglist is invalid";
             continue;
         }
-        auto dict = json_as_dict(*arg);
-        
-        json_value name_val = json_dict_find(dict, "name");
-        json_value id_val = json_dict_find(dict, "id");
-        json_value type_val = json_dict_find(dict, "type");
 
-        if (!json_is_str(name_val) || !json_is_int(id_val) || ((int)(size_t)json_as_int(id_val) != json_as_int(id_val)) || !json_is_str(type_val)) {
+        const json_value& name_val = json_dict_find(arg, "name");
+        const json_value& id_val = json_dict_find(arg, "id");
+        const json_value& type_val = json_dict_find(arg, "type");
+
+        if (!json_is_str(name_val) || !json_is_int(id_val) || !json_is_str(type_val)) {
             FIBRE_LOG(W) << "arglist is invalid";
             continue;
         }
 
-
+        std::string type_str = json_as_str(type_val).to_string();
         arglist.push_back({
-            json_as_str(name_val),
-            json_as_str(type_val),
-            (json_as_str(type_val) == "endpoint_ref") ? "object_ref" : json_as_str(type_val),
-            get_codec_size(json_as_str(type_val)),
-            (json_as_str(type_val) == "endpoint_ref") ? sizeof(uintptr_t) : get_codec_size(json_as_str(type_val)),
+            json_as_str(name_val).to_string(),
+            type_str,
+            (type_str == "endpoint_ref") ? "object_ref" : type_str,
+            get_codec_size(type_str),
+            (type_str == "endpoint_ref") ? sizeof(uintptr_t) : get_codec_size(type_str),
             (size_t)json_as_int(id_val),
         });
     }
@@ -236,7 +92,8 @@ void LegacyObjectClient::start(Callback<void, LegacyObjectClient*, std::shared_p
     on_found_root_object_ = on_found_root_object;
     on_lost_root_object_ = on_lost_root_object;
     json_.clear();
-    receive_more_json();
+    version_id_ = 0;
+    receive_version_id();
 }
 
 std::shared_ptr<FibreInterface> LegacyObjectClient::get_property_interfaces(std::string codec, bool write) {
@@ -267,9 +124,7 @@ std::shared_ptr<FibreInterface> LegacyObjectClient::get_property_interfaces(std:
     return intf_ptr;
 }
 
-std::shared_ptr<LegacyObject> LegacyObjectClient::load_object(json_value list_val) {
-    
-
+std::shared_ptr<LegacyObject> LegacyObjectClient::load_object(const json_value& list_val) {
     if (!json_is_list(list_val)) {
         FIBRE_LOG(W) << "interface members must be a list";
         return nullptr;
@@ -285,23 +140,23 @@ std::shared_ptr<LegacyObject> LegacyObjectClient::load_object(json_value list_va
     FibreInterface& intf = *obj_ptr->intf;
 
     for (auto& item: json_as_list(list_val)) {
-        if (!json_is_dict(*item)) {
+        if (!json_is_dict(item)) {
             FIBRE_LOG(W) << "expected dict";
             continue;
         }
-        auto dict = json_as_dict(*item);
+        const json_value& dict = item;
 
-        json_value type = json_dict_find(dict, "type");
-        json_value name_val = json_dict_find(dict, "name");
-        std::string name = json_is_str(name_val) ? json_as_str(name_val) : "[anonymous]";
+        const json_value& type = json_dict_find(dict, "type");
+        const json_value& name_val = json_dict_find(dict, "name");
+        std::string name = json_is_str(name_val) ? json_as_str(name_val).to_string() : "[anonymous]";
 
         if (json_is_str(type) && json_as_str(type) == "object") {
             std::shared_ptr<LegacyObject> subobj = load_object(json_dict_find(dict, "members"));
             intf.attributes[name] = {subobj};
 
         } else if (json_is_str(type) && json_as_str(type) == "function") {
-            json_value id = json_dict_find(dict, "id");
-            if (!json_is_int(id) || ((int)(size_t)json_as_int(id) != json_as_int(id))) {
+            const json_value& id = json_dict_find(dict, "id");
+            if (!json_is_int(id)) {
                 continue;
             }
             intf.functions.emplace(name, LegacyFunction{
@@ -315,13 +170,13 @@ std::shared_ptr<LegacyObject> LegacyObjectClient::load_object(json_value list_va
             // Ignore
 
         } else if (json_is_str(type)) {
-            std::string type_str = json_as_str(type);
-            json_value access = json_dict_find(dict, "access");
-            std::string access_str = json_is_str(access) ? json_as_str(access) : "r";
-            bool can_write = access_str.find('w') != std::string::npos;
+            std::string type_str = json_as_str(type).to_string();
+            const json_value& access = json_dict_find(dict, "access");
+            json_str access_str = json_is_str(access) ? json_as_str(access) : json_str{};
+            bool can_write = std::find(access_str.begin, access_str.end, 'w') != access_str.end;
 
-            json_value id = json_dict_find(dict, "id");
-            if (!json_is_int(id) || ((int)(size_t)json_as_int(id) != json_as_int(id))) {
+            const json_value& id = json_dict_find(dict, "id");
+            if (!json_is_int(id)) {
                 continue;
             }
 
@@ -344,8 +199,200 @@ std::shared_ptr<LegacyObject> LegacyObjectClient::load_object(json_value list_va
     return obj_ptr;
 }
 
+/**
+ * @brief Returns the directory where the JSON of known devices is cached or an
+ * empty string if caching is disabled.
+ *
+ * This is $FIBRE_CACHE_DIR if set (an empty value disables the cache),
+ * otherwise a "fibre" subdirectory of the user's cache directory.
+ */
+static std::string get_json_cache_dir() {
+#if defined(EMSCRIPTEN)
+    return "";
+#else
+    if (const char* dir = getenv("FIBRE_CACHE_DIR")) {
+        return dir;
+    }
+#if defined(_WIN32) || defined(_WIN64)
+    const char* base = getenv("LOCALAPPDATA");
+    return base ? std::string{base} + "\\fibre" : "";
+#else
+    if (const char* base = getenv("XDG_CACHE_HOME")) {
+        return std::string{base} + "/fibre";
+    }
+    const char* home = getenv("HOME");
+    return home ? std::string{home} + "/.cache/fibre" : "";
+#endif
+#endif
+}
+
+static std::string get_json_cache_file(uint32_t version_id) {
+    std::string dir = get_json_cache_dir();
+    if (dir.empty()) {
+        return "";
+    }
+    char name[16];
+    snprintf(name, sizeof(name), "/%08x.json", (unsigned)version_id);
+    return dir + name;
+}
+
+static bool make_dir(const std::string& path) {
+#if defined(_WIN32) || defined(_WIN64)
+    return _mkdir(path.c_str()) == 0 || errno == EEXIST;
+#else
+    return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+#endif
+}
+
+static uint32_t calc_json_version_id(const std::vector<uint8_t>& json) {
+    uint16_t json_crc = calc_crc16<CANONICAL_CRC16_POLYNOMIAL>(PROTOCOL_VERSION, json.data(), json.size());
+    return ((uint32_t)json_crc << 16) | calc_crc16<CANONICAL_CRC16_POLYNOMIAL>(json_crc, json.data(), json.size());
+}
+
+// Loads the cached JSON of the given version. The content is checked against
+// the version ID so that a corrupted file is never used.
+static bool read_json_cache(uint32_t version_id, std::vector<uint8_t>* json) {
+    std::string path = get_json_cache_file(version_id);
+    FILE* file = path.empty() ? nullptr : fopen(path.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+    json->clear();
+    uint8_t chunk[1024];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        json->insert(json->end(), chunk, chunk + n);
+    }
+    bool ok = !ferror(file) && calc_json_version_id(*json) == version_id;
+    fclose(file);
+    if (!ok) {
+        FIBRE_LOG(W) << "ignoring corrupted JSON cache file " << path;
+        json->clear();
+    }
+    return ok;
+}
+
+// Stores the JSON. It's written to a temporary file first so that concurrent
+// clients never see a partial file.
+static void write_json_cache(uint32_t version_id, const std::vector<uint8_t>& json) {
+    std::string path = get_json_cache_file(version_id);
+    if (path.empty()) {
+        return;
+    }
+    std::string dir = get_json_cache_dir();
+    size_t sep = dir.find_last_of("/\\");
+    if (sep != std::string::npos && sep > 0) {
+        make_dir(dir.substr(0, sep)); // e.g. ~/.cache
+    }
+    if (!make_dir(dir)) {
+        FIBRE_LOG(W) << "can't create JSON cache directory " << dir;
+        return;
+    }
+
+    std::string tmp_path = path + ".tmp";
+    FILE* file = fopen(tmp_path.c_str(), "wb");
+    if (!file) {
+        FIBRE_LOG(W) << "can't write JSON cache file " << tmp_path;
+        return;
+    }
+    bool ok = fwrite(json.data(), 1, json.size(), file) == json.size();
+    ok = (fclose(file) == 0) && ok;
+#if defined(_WIN32) || defined(_WIN64)
+    remove(path.c_str()); // rename() doesn't replace existing files on Windows
+#endif
+    if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0) {
+        FIBRE_LOG(W) << "can't write JSON cache file " << path;
+        remove(tmp_path.c_str());
+    }
+}
+
+/**
+ * @brief Decompresses the JSON as compressed by compress_json() in
+ * interface_generator.py.
+ *
+ * The data starts with the uncompressed length (uint32 little endian),
+ * followed by tokens. A token byte t < 0x80 is followed by t + 1 literal
+ * bytes. A token byte t >= 0x80 is followed by a uint16 little endian
+ * distance d and copies (t & 0x7f) + 3 bytes starting d bytes back.
+ */
+static bool decompress_json(const std::vector<uint8_t>& in, std::vector<uint8_t>* out) {
+    uint32_t length;
+    if (in.size() < 4 || in.size() > 0x7fffffff) {
+        return false;
+    }
+    read_le<uint32_t>(&length, in.data());
+    out->clear();
+    out->reserve(length);
+
+    size_t pos = 4;
+    while (pos < in.size()) {
+        uint8_t token = in[pos++];
+        if (token < 0x80) {
+            size_t n = (size_t)token + 1;
+            if (in.size() - pos < n) {
+                return false;
+            }
+            out->insert(out->end(), in.begin() + pos, in.begin() + pos + n);
+            pos += n;
+        } else {
+            size_t n = (size_t)(token & 0x7f) + 3;
+            uint16_t dist;
+            if (in.size() - pos < 2) {
+                return false;
+            }
+            read_le<uint16_t>(&dist, in.data() + pos);
+            pos += 2;
+            if (!dist || dist > out->size()) {
+                return false;
+            }
+            for (size_t i = 0; i < n; ++i) {
+                out->push_back((*out)[out->size() - dist]); // may overlap with the output
+            }
+        }
+        if (out->size() > length) {
+            return false;
+        }
+    }
+    return out->size() == length;
+}
+
+void LegacyObjectClient::receive_version_id() {
+    // Offset 0xffffffff returns the version ID instead of JSON data
+    write_le<uint32_t>(0xffffffff, tx_buf_);
+    protocol_->start_endpoint_operation(0, tx_buf_, version_buf_, &op_handle_, MEMBER_CB(this, on_received_version_id));
+}
+
+void LegacyObjectClient::on_received_version_id(EndpointOperationResult result) {
+    op_handle_ = 0;
+
+    if (result.status == kStreamCancelled) {
+        return;
+    } else if (result.status == kStreamClosed) {
+        return;
+    } else if (result.status != kStreamOk) {
+        FIBRE_LOG(W) << "JSON version read operation failed";
+        return;
+    }
+
+    if (result.rx_end - version_buf_ == sizeof(version_buf_)) {
+        read_le<uint32_t>(&version_id_, version_buf_);
+        FIBRE_LOG(D) << "JSON version " << as_hex(version_id_);
+
+        if (read_json_cache(version_id_, &json_)) {
+            FIBRE_LOG(D) << "loaded JSON of length " << json_.size() << " from cache";
+            if (load_json()) {
+                return;
+            }
+            json_.clear();
+        }
+    }
+
+    json_compressed_ = true;
+    receive_more_json();
+}
+
 void LegacyObjectClient::receive_more_json() {
-    write_le<uint32_t>(json_.size(), tx_buf_);
+    write_le<uint32_t>(json_.size() | (json_compressed_ ? JSON_COMPRESSED_OFFSET : 0), tx_buf_);
     json_.resize(json_.size() + 1024);
     bufptr_t rx_buf = {json_.data() + json_.size() - 1024, json_.data() + json_.size()};
     protocol_->start_endpoint_operation(0, tx_buf_, rx_buf, &op_handle_, MEMBER_CB(this, on_received_json));
@@ -370,31 +417,56 @@ void LegacyObjectClient::on_received_json(EndpointOperationResult result) {
 
     if (n_received) {
         receive_more_json();
+        return;
+    }
 
-    } else {
+    if (json_compressed_) {
+        // An empty result means that the server has no compressed JSON
+        std::vector<uint8_t> compressed;
+        std::swap(compressed, json_);
+        json_compressed_ = false;
+        if (compressed.size() && (!decompress_json(compressed, &json_)
+                || (version_id_ && calc_json_version_id(json_) != version_id_))) {
+            FIBRE_LOG(W) << "invalid compressed JSON, downloading uncompressed JSON";
+            json_.clear();
+        }
+        if (json_.empty()) {
+            receive_more_json();
+            return;
+        }
+        FIBRE_LOG(D) << "received compressed JSON of length " << compressed.size();
+    }
 
-        FIBRE_LOG(D) << "received JSON of length " << json_.size();
-        //FIBRE_LOG(D) << "JSON: " << str{json_.data(), json_.data() + json_.size()};
+    FIBRE_LOG(D) << "received JSON of length " << json_.size();
+    //FIBRE_LOG(D) << "JSON: " << str{json_.data(), json_.data() + json_.size()};
 
-        const char *begin = reinterpret_cast<const char*>(json_.data());
-        auto val = json_parse(&begin, begin + json_.size());
+    if (version_id_ && calc_json_version_id(json_) == version_id_) {
+        write_json_cache(version_id_, json_);
+    }
+    load_json();
+}
 
-        if (json_is_err(val)) {
-            size_t pos = json_as_err(val).ptr - reinterpret_cast<const char*>(json_.data());
-            FIBRE_LOG(E) << "JSON parsing error: " << json_as_err(val).str << " at position " << pos;
-            return;
-        } else if (!json_is_list(val)) {
-            FIBRE_LOG(E) << "JSON data must be a list";
-            return;
-        }
+bool LegacyObjectClient::load_json() {
+    const char *begin = reinterpret_cast<const char*>(json_.data());
+    json_document doc;
+    const json_value* val = doc.parse(begin, begin + json_.size());
+
+    if (!val) {
+        size_t pos = doc.error_pos() - begin;
+        FIBRE_LOG(E) << "JSON parsing error: " << doc.error() << " at position " << pos;
+        return false;
+    } else if (!json_is_list(*val)) {
+        FIBRE_LOG(E) << "JSON data must be a list";
+        return false;
+    }
 
-        FIBRE_LOG(D) << "sucessfully parsed JSON";
-        root_obj_ = load_object(val);
-        json_crc_ = calc_crc16<CANONICAL_CRC16_POLYNOMIAL>(PROTOCOL_VERSION, json_.data(), json_.size());
-        if (root_obj_) {
-            on_found_root_object_.invoke_and_clear(this, root_obj_);
-        }
+    FIBRE_LOG(D) << "sucessfully parsed JSON";
+    root_obj_ = load_object(*val);
+    json_crc_ = calc_crc16<CANONICAL_CRC16_POLYNOMIAL>(PROTOCOL_VERSION, json_.data(), json_.size());
+    if (root_obj_) {
+        on_found_root_object_.invoke_and_clear(this, root_obj_);
     }
+    return true;
 }
 
 
@@ -406,21 +478,29 @@ std::optional<CallBufferRelease> LegacyFunction::call(void** call_handle,
 
     if (!*call_handle) {
         // Instantiate new call
-        ctx = new LegacyCallContext();
-        ctx->func_ = this;
-
-        size_t total_tx_decoded_size = sizeof(uintptr_t);
+        size_t tx_app_size = sizeof(uintptr_t);
+        size_t tx_protocol_size = 0;
         for (auto& arg: inputs) {
-            total_tx_decoded_size += arg.app_size;
+            tx_app_size += arg.app_size;
+            tx_protocol_size += arg.protocol_size;
         }
 
-        size_t total_rx_encoded_size = 0;
+        size_t rx_app_size = 0;
+        size_t rx_protocol_size = 0;
         for (auto& arg: outputs) {
-            total_rx_encoded_size += arg.protocol_size;
+            rx_app_size += arg.app_size;
+            rx_protocol_size += arg.protocol_size;
         }
 
-        ctx->tx_buf_.resize(total_tx_decoded_size);
-        ctx->rx_buf_.resize(total_rx_encoded_size);
+        if (std::max({tx_app_size, tx_protocol_size, rx_app_size, rx_protocol_size}) > LegacyCallContext::kMaxArgsSize) {
+            FIBRE_LOG(E) << "function arguments too large";
+            return CallBufferRelease{kFibreInternalError, buffers.tx_buf.begin(), buffers.rx_buf.begin()};
+        }
+
+        ctx = call_context_pool.alloc();
+        ctx->func_ = this;
+        ctx->tx_size_ = tx_app_size;
+        ctx->rx_size_ = rx_protocol_size;
 
         *call_handle = ctx;
     } else {
@@ -436,6 +516,10 @@ std::optional<CallBufferRelease> LegacyFunction::call(void** call_handle,
     for (;;) {
         auto continuation = ctx->get_next_task(result);
         if (continuation.index() == 0) {
+            if (std::get<0>(continuation).status != kFibreOk) {
+                FIBRE_LOG(T) << "closing call";
+                call_context_pool.free(ctx);
+            }
             return std::get<0>(continuation);
         } else if (continuation.index() == 1) {
             auto proto_continuation = std::get<1>(continuation);
@@ -454,7 +538,9 @@ std::optional<CallBufferRelease> LegacyFunction::call(void** call_handle,
 
             // TODO: ensure progress
         } else {
-            return CallBufferRelease{kFibreInternalError, ctx->app_tx_end_, ctx->app_rx_buf_.begin()};
+            CallBufferRelease release{kFibreInternalError, ctx->app_tx_end_, ctx->app_rx_buf_.begin()};
+            call_context_pool.free(ctx);
+            return release;
         }
     }
 
@@ -482,7 +568,7 @@ void LegacyCallContext::resume_from_protocol(EndpointOperationResult result) {
                     FIBRE_LOG(W) << "app tried to continue a closed call";
                 }
                 FIBRE_LOG(T) << "closing call";
-                delete this;
+                call_context_pool.free(this);
                 return;
             } else {
                 res = *app_result;
@@ -496,12 +582,13 @@ void LegacyCallContext::resume_from_protocol(EndpointOperationResult result) {
             return; // protocol will return asynchronously
         } else {
             callback.invoke({kFibreInternalError, app_tx_end_, app_rx_buf_.begin()});
+            call_context_pool.free(this);
             return;
         }
     }
 }
 
-bool LegacyObjectClient::transcode(cbufptr_t src, bufptr_t dst, std::string src_codec, std::string dst_codec) {
+bool LegacyObjectClient::transcode(cbufptr_t src, bufptr_t dst, const std::string& src_codec, const std::string& dst_codec) {
     if (src_codec == "object_ref" && dst_codec == "endpoint_ref") {
         if (src.size() < sizeof(uintptr_t) || dst.size() < 4) {
             return false;
@@ -544,6 +631,126 @@ bool LegacyObjectClient::transcode(cbufptr_t src, bufptr_t dst, std::string src_
     return true;
 }
 
+bool LegacyObjectClient::subscribe(LegacyObject** properties, const uint16_t* intervals_ms, size_t n_properties, Callback<void, LegacyObject*, cbufptr_t> on_update) {
+    if (subscribe_handle_) {
+        FIBRE_LOG(W) << "previous subscription request still in progress";
+        return false;
+    }
+
+    std::vector<uint8_t> tx_buf;
+    for (size_t i = 0; i < n_properties; ++i) {
+        LegacyObject* obj = properties[i];
+        if (!obj || obj->client != this || !obj->ep_num) {
+            FIBRE_LOG(W) << "can only subscribe to properties of this device";
+            return false;
+        }
+        auto it = obj->intf->functions.find("read");
+        if (it == obj->intf->functions.end() || it->second.outputs.size() != 1) {
+            FIBRE_LOG(W) << "not a property";
+            return false;
+        }
+        uint8_t entry[5];
+        bufptr_t dst{entry, sizeof(entry)};
+        write_le<uint16_t>(obj->ep_num, &dst);
+        write_le<uint8_t>(it->second.outputs[0].protocol_size, &dst);
+        write_le<uint16_t>(intervals_ms[i], &dst);
+        tx_buf.insert(tx_buf.end(), entry, entry + sizeof(entry));
+    }
+
+    // Values of the old set that arrive before the device acknowledged the
+    // request are still reported (to the new callback)
+    on_property_update_ = on_update;
+    subscribe_tx_buf_ = tx_buf;
+    requested_subscriptions_ = {properties, properties + n_properties};
+    requested_intervals_ = {intervals_ms, intervals_ms + n_properties};
+    protocol_->start_endpoint_operation(SUBSCRIBE_ENDPOINT_ID,
+            {subscribe_tx_buf_.data(), subscribe_tx_buf_.size()},
+            subscribe_rx_buf_, &subscribe_handle_, MEMBER_CB(this, on_subscribed));
+    return true;
+}
+
+void LegacyObjectClient::on_subscribed(EndpointOperationResult result) {
+    subscribe_handle_ = 0;
+    size_t n_accepted = (result.status == kStreamOk && result.rx_end == subscribe_rx_buf_ + 1) ? subscribe_rx_buf_[0] : 0;
+    if (n_accepted < requested_subscriptions_.size()) {
+        FIBRE_LOG(W) << "device accepted only " << n_accepted << " of " << requested_subscriptions_.size() << " subscriptions";
+    }
+
+    subscriptions_.clear();
+    for (size_t i = 0; i < std::min(n_accepted, requested_subscriptions_.size()); ++i) {
+        subscriptions_[requested_subscriptions_[i]->ep_num] = {requested_subscriptions_[i], requested_intervals_[i]};
+    }
+    requested_subscriptions_.clear();
+    requested_intervals_.clear();
+}
+
+std::shared_ptr<LegacySubscriptionSet> LegacyObjectClient::get_subscriptions() {
+    if (subscriptions_.empty() || !version_id_) {
+        return nullptr;
+    }
+    auto set = std::make_shared<LegacySubscriptionSet>();
+    set->version_id = version_id_;
+    set->on_update = on_property_update_;
+    for (auto& it: subscriptions_) {
+        set->endpoint_ids.push_back(it.first);
+        set->intervals_ms.push_back(it.second.interval_ms);
+    }
+    return set;
+}
+
+bool LegacyObjectClient::resume_subscriptions(const LegacySubscriptionSet& set) {
+    if (set.version_id != version_id_) {
+        FIBRE_LOG(D) << "not resuming subscriptions of a different JSON version";
+        return false;
+    }
+
+    // Endpoint IDs are stable for a given JSON version so they identify the
+    // corresponding objects of this client
+    std::unordered_map<size_t, LegacyObject*> objects;
+    for (auto& obj: objects_) {
+        objects[obj->ep_num] = obj.get();
+    }
+    std::vector<LegacyObject*> properties;
+    for (uint16_t ep_num: set.endpoint_ids) {
+        auto it = objects.find(ep_num);
+        if (it == objects.end()) {
+            return false;
+        }
+        properties.push_back(it->second);
+    }
+
+    return subscribe(properties.data(), set.intervals_ms.data(), properties.size(), set.on_update);
+}
+
+void LegacyObjectClient::on_notification(cbufptr_t payload) {
+    // Each entry is the endpoint ID (uint16), the size (uint8) and the value
+    while (payload.size()) {
+        std::optional<uint16_t> ep_num = read_le<uint16_t>(&payload);
+        std::optional<uint8_t> length = read_le<uint8_t>(&payload);
+        if (!ep_num.has_value() || !length.has_value() || *length > payload.size()) {
+            FIBRE_LOG(W) << "malformed notification";
+            return;
+        }
+        cbufptr_t value{payload.begin(), *length};
+        payload = payload.skip(*length);
+
+        auto it = subscriptions_.find(*ep_num);
+        if (it == subscriptions_.end() || !on_property_update_) {
+            continue; // not (or no longer) subscribed
+        }
+
+        const LegacyFibreArg& arg = it->second.obj->intf->functions.at("read").outputs[0];
+        if (arg.protocol_codec == arg.app_codec) {
+            on_property_update_.invoke(it->second.obj, value);
+        } else {
+            uint8_t app_value[sizeof(uintptr_t)];
+            if (arg.app_size <= sizeof(app_value) && transcode(value, {app_value, arg.app_size}, arg.protocol_codec, arg.app_codec)) {
+                on_property_update_.invoke(it->second.obj, {app_value, arg.app_size});
+            }
+        }
+    }
+}
+
 
 std::variant<LegacyCallContext::ContinueWithApp, LegacyCallContext::ContinueWithProtocol, LegacyCallContext::InternalError> LegacyCallContext::get_next_task(std::variant<ResultFromApp, ResultFromProtocol> continue_from) {
     if (progress == 0) {
@@ -554,15 +761,15 @@ std::variant<LegacyCallContext::ContinueWithApp, LegacyCallContext::ContinueWith
 
         ResultFromApp result_from_app = std::get<0>(continue_from);
 
-        size_t n_copy = std::min(tx_buf_.size() - tx_pos_, result_from_app.tx_buf.size());
-        std::copy_n(result_from_app.tx_buf.begin(), n_copy, tx_buf_.begin() + tx_pos_);
+        size_t n_copy = std::min(tx_size_ - tx_pos_, result_from_app.tx_buf.size());
+        std::copy_n(result_from_app.tx_buf.begin(), n_copy, tx_buf_ + tx_pos_);
         result_from_app.tx_buf = result_from_app.tx_buf.skip(n_copy);
         tx_pos_ += n_copy;
 
         app_tx_end_ = result_from_app.tx_buf.begin();
         app_rx_buf_ = result_from_app.rx_buf;
 
-        if (tx_pos_ < tx_buf_.size()) {
+        if (tx_pos_ < tx_size_) {
             // application specified kFibreOk? => return kFibreOk
             // application specified kFibreClosed? => return kFibreClosed
             return ContinueWithApp{result_from_app.status, app_tx_end_, app_rx_buf_.begin()};
@@ -583,9 +790,9 @@ std::variant<LegacyCallContext::ContinueWithApp, LegacyCallContext::ContinueWith
             return ContinueWithApp{kFibreHostUnreachable, app_tx_end_, app_rx_buf_.begin()};
         }
 
-        tx_pos_ = result_from_protocol.tx_end - tx_buf_.data();
+        tx_pos_ = result_from_protocol.tx_end - tx_buf_;
         if (result_from_protocol.rx_end) {
-            rx_pos_ = result_from_protocol.rx_end - rx_buf_.data();
+            rx_pos_ = result_from_protocol.rx_end - rx_buf_;
         }
 
     } else if (progress == func_->inputs.size() + 2 + func_->outputs.size()) {
@@ -608,21 +815,20 @@ std::variant<LegacyCallContext::ContinueWithApp, LegacyCallContext::ContinueWith
     if (progress == 0) {
         // Transcode from application codec to protocol codec
 
-        obj_ = *reinterpret_cast<LegacyObject**>(tx_buf_.data());
+        obj_ = *reinterpret_cast<LegacyObject**>(tx_buf_);
         FIBRE_LOG(T) << "object is " << as_hex(reinterpret_cast<uintptr_t>(obj_));
-        FIBRE_LOG(T) << "tx buf is " << as_hex(cbufptr_t{tx_buf_});
+        FIBRE_LOG(T) << "tx buf is " << as_hex(cbufptr_t{tx_buf_, tx_size_});
 
-        std::vector<uint8_t> transcoded;
+        uint8_t transcoded[kMaxArgsSize];
         size_t transcoded_size = calc_sum(func_->inputs.begin(), func_->inputs.end(),
             [](LegacyFibreArg& arg) { return arg.protocol_size; });
-        FIBRE_LOG(T) << "transcoding " << func_->inputs.size() << " inputs from " << tx_buf_.size() << " B to " << transcoded_size << " B";
-        transcoded.resize(transcoded_size);
+        FIBRE_LOG(T) << "transcoding " << func_->inputs.size() << " inputs from " << tx_size_ << " B to " << transcoded_size << " B";
         
         tx_pos_ = sizeof(uintptr_t);
         size_t transcoded_pos = 0;
         for (auto& arg: func_->inputs) {
-            if (!obj_->client->transcode({tx_buf_.data() + tx_pos_, arg.app_size},
-                    {transcoded.data() + transcoded_pos, arg.protocol_size},
+            if (!obj_->client->transcode({tx_buf_ + tx_pos_, arg.app_size},
+                    {transcoded + transcoded_pos, arg.protocol_size},
                     arg.app_codec, arg.protocol_codec)) {
                 return ContinueWithApp{kFibreInternalError, app_tx_end_, app_rx_buf_.begin()};
             }
@@ -630,26 +836,26 @@ std::variant<LegacyCallContext::ContinueWithApp, LegacyCallContext::ContinueWith
             tx_pos_ += arg.app_size;
         }
 
-        tx_buf_ = transcoded;
+        std::copy_n(transcoded, transcoded_size, tx_buf_);
+        tx_size_ = transcoded_size;
         tx_pos_ = 0;
 
     } else if (progress == func_->inputs.size() + 1 + func_->outputs.size()) {
         // Transcode from protocol codec to application codec
 
-        std::vector<uint8_t> transcoded;
+        uint8_t transcoded[kMaxArgsSize];
         for (auto& arg: func_->outputs) {
             FIBRE_LOG(T) << "arg size " << arg.app_size;
         }
         size_t transcoded_size = calc_sum(func_->outputs.begin(), func_->outputs.end(),
             [](LegacyFibreArg& arg) { return arg.app_size; });
-        FIBRE_LOG(T) << "transcoding " << func_->outputs.size() << " outputs from " << rx_buf_.size() << " B to " << transcoded_size << " B";
-        transcoded.resize(transcoded_size);
+        FIBRE_LOG(T) << "transcoding " << func_->outputs.size() << " outputs from " << rx_size_ << " B to " << transcoded_size << " B";
         
         rx_pos_ = 0;
         size_t transcoded_pos = 0;
         for (auto& arg: func_->outputs) {
-            if (!obj_->client->transcode({rx_buf_.data() + rx_pos_, arg.protocol_size},
-                    {transcoded.data() + transcoded_pos, arg.app_size},
+            if (!obj_->client->transcode({rx_buf_ + rx_pos_, arg.protocol_size},
+                    {transcoded + transcoded_pos, arg.app_size},
                     arg.protocol_codec, arg.app_codec)) {
                 return ContinueWithApp{kFibreInternalError, app_tx_end_, app_rx_buf_.begin()};
             }
@@ -657,10 +863,11 @@ std::variant<LegacyCallContext::ContinueWithApp, LegacyCallContext::ContinueWith
             rx_pos_ += arg.protocol_size;
         }
 
-        rx_buf_ = transcoded;
+        std::copy_n(transcoded, transcoded_size, rx_buf_);
+        rx_size_ = transcoded_size;
         rx_pos_ = 0;
 
-        FIBRE_LOG(T) << "rx buf is " << as_hex(cbufptr_t{rx_buf_});
+        FIBRE_LOG(T) << "rx buf is " << as_hex(cbufptr_t{rx_buf_, rx_size_});
     }
 
     progress++;
@@ -668,26 +875,26 @@ std::variant<LegacyCallContext::ContinueWithApp, LegacyCallContext::ContinueWith
     if (progress == 1 && obj_->ep_num) {
         // Single Endpoint Function - exchange everything in one go
         progress = func_->inputs.size() + 1 + func_->outputs.size();
-        return ContinueWithProtocol{obj_->client->protocol_, obj_->ep_num, tx_buf_, rx_buf_};
+        return ContinueWithProtocol{obj_->client->protocol_, obj_->ep_num, {tx_buf_, tx_size_}, {rx_buf_, rx_size_}};
 
     } else if (progress <= func_->inputs.size()) {
         // send arg
-        auto arg = func_->inputs[progress - 1];
-        return ContinueWithProtocol{obj_->client->protocol_, arg.ep_num, {tx_buf_.data() + tx_pos_, arg.protocol_size}, {}};
+        auto& arg = func_->inputs[progress - 1];
+        return ContinueWithProtocol{obj_->client->protocol_, arg.ep_num, {tx_buf_ + tx_pos_, arg.protocol_size}, {}};
     } else if (progress == func_->inputs.size() + 1) {
         // send trigger
         return ContinueWithProtocol{obj_->client->protocol_, func_->ep_num, {}, {}};
     } else if (progress <= func_->inputs.size() + 1 + func_->outputs.size()) {
         // receive arg
-        auto arg = func_->outputs[progress - 2 - func_->inputs.size()];
-        return ContinueWithProtocol{obj_->client->protocol_, arg.ep_num, {}, {rx_buf_.data() + rx_pos_, arg.protocol_size}};
+        auto& arg = func_->outputs[progress - 2 - func_->inputs.size()];
+        return ContinueWithProtocol{obj_->client->protocol_, arg.ep_num, {}, {rx_buf_ + rx_pos_, arg.protocol_size}};
     } else if (progress == func_->inputs.size() + 2 + func_->outputs.size()) {
         // return data to application
-        size_t n_copy = std::min(rx_buf_.size() - rx_pos_, app_rx_buf_.size());
-        std::copy_n(rx_buf_.data() + rx_pos_, n_copy, app_rx_buf_.begin());
+        size_t n_copy = std::min(rx_size_ - rx_pos_, app_rx_buf_.size());
+        std::copy_n(rx_buf_ + rx_pos_, n_copy, app_rx_buf_.begin());
         app_rx_buf_ = app_rx_buf_.skip(n_copy);
         rx_pos_ += n_copy;
-        return ContinueWithApp{rx_pos_ == rx_buf_.size() ? kFibreClosed : kFibreOk, app_tx_end_, app_rx_buf_.begin()};
+        return ContinueWithApp{rx_pos_ == rx_size_ ? kFibreClosed : kFibreOk, app_tx_end_, app_rx_buf_.begin()};
     }
 
     return InternalError{};
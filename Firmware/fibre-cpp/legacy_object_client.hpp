@@ -10,10 +10,10 @@
 #include <fibre/cpp_utils.hpp> // std::variant and std::optional C++ backport
 #include <fibre/fibre.hpp>
 
-struct json_value;
-
 namespace fibre {
 
+struct json_value;
+
 struct EndpointOperationResult {
     StreamStatus status;
     const uint8_t* tx_end;
@@ -73,6 +73,10 @@ struct LegacyObject {
 };
 
 struct LegacyCallContext {
+    // Maximum total size of the inputs and of the outputs of a function in
+    // either codec (including the object pointer). Larger calls fail.
+    static constexpr size_t kMaxArgsSize = 64;
+
     LegacyFunction* func_;
 
     size_t progress = 0; //!< 0: expecting more tx data
@@ -83,9 +87,11 @@ struct LegacyCallContext {
                          
     EndpointOperationHandle op_handle_ = 0;
 
-    std::vector<uint8_t> tx_buf_;
+    alignas(uintptr_t) uint8_t tx_buf_[kMaxArgsSize]; // starts with the object pointer
+    size_t tx_size_ = 0;
     size_t tx_pos_ = 0;
-    std::vector<uint8_t> rx_buf_;
+    uint8_t rx_buf_[kMaxArgsSize];
+    size_t rx_size_ = 0;
     size_t rx_pos_ = 0;
 
     const uint8_t* app_tx_end_;
@@ -117,34 +123,99 @@ struct LegacyCallContext {
     std::variant<ContinueWithApp, ContinueWithProtocol, InternalError> get_next_task(std::variant<ResultFromApp, ResultFromProtocol> continue_from);
 };
 
+/**
+ * @brief Subscriptions of a lost LegacyObjectClient that can be resumed on a
+ * new client of the same device (see LegacyObjectClient::get_subscriptions()).
+ */
+struct LegacySubscriptionSet {
+    uint32_t version_id; // JSON version to which the endpoint IDs refer
+    std::vector<uint16_t> endpoint_ids;
+    std::vector<uint16_t> intervals_ms;
+    Callback<void, LegacyObject*, cbufptr_t> on_update;
+};
+
 class LegacyObjectClient {
 public:
     LegacyObjectClient(LegacyProtocolPacketBased* protocol) : protocol_(protocol) {}
 
     void start(Callback<void, LegacyObjectClient*, std::shared_ptr<LegacyObject>> on_found_root_object, Callback<void, LegacyObjectClient*, std::shared_ptr<LegacyObject>> on_lost_root_object);
-    bool transcode(cbufptr_t src, bufptr_t dst, std::string src_codec, std::string dst_codec);
-
-    // For direct access by LegacyProtocolPacketBased and libfibre.cpp
+    bool transcode(cbufptr_t src, bufptr_t dst, const std::string& src_codec, const std::string& dst_codec);
+
+    /**
+     * @brief Replaces the set of properties whose values the server sends
+     * without a request (see SUBSCRIBE_ENDPOINT_ID).
+     *
+     * @param properties: Property objects of this client.
+     * @param intervals_ms: One interval per property [ms]. 0 means that the
+     *        value is sent whenever it changes.
+     * @param on_update: Invoked with the property object and the value (in the
+     *        application codec of the property) for every value the server
+     *        sends.
+     * @returns false if one of the properties is invalid or if the previous
+     *          subscription request is still in progress.
+     */
+    bool subscribe(LegacyObject** properties, const uint16_t* intervals_ms, size_t n_properties, Callback<void, LegacyObject*, cbufptr_t> on_update);
+
+    // True while a subscription request is waiting for the server's response
+    bool is_subscribing() const { return subscribe_handle_; }
+
+    // Called by LegacyProtocolPacketBased for each notification packet
+    void on_notification(cbufptr_t payload);
+
+    // Returns the accepted subscriptions or null if there are none
+    std::shared_ptr<LegacySubscriptionSet> get_subscriptions();
+
+    /**
+     * @brief Subscribes to the properties of this client that correspond to
+     * the subscriptions of a previous client of the same device.
+     *
+     * @returns false if the device runs a different JSON version than the one
+     *          of the subscription set or if subscribe() fails.
+     */
+    bool resume_subscriptions(const LegacySubscriptionSet& set);
+
+    // For direct access by LegacyProtocolPacketBased, HostClient and libfibre.cpp
     uint16_t json_crc_ = 0;
     Callback<void, LegacyObjectClient*, std::shared_ptr<LegacyObject>> on_lost_root_object_;
     std::shared_ptr<LegacyObject> root_obj_;
     std::vector<std::shared_ptr<LegacyObject>> objects_;
     void* user_data_; // used by libfibre to store the libfibre context pointer
     LegacyProtocolPacketBased* protocol_;
+    std::string device_id_; // see ChannelDiscoveryResult::device_id, empty if unknown
 
 private:
+    struct Subscription {
+        LegacyObject* obj;
+        uint16_t interval_ms;
+    };
+
     std::shared_ptr<FibreInterface> get_property_interfaces(std::string codec, bool write);
-    std::shared_ptr<LegacyObject> load_object(json_value list_val);
+    std::shared_ptr<LegacyObject> load_object(const json_value& list_val);
+    void receive_version_id();
+    void on_received_version_id(EndpointOperationResult result);
     void receive_more_json();
     void on_received_json(EndpointOperationResult result);
+    bool load_json();
+    void on_subscribed(EndpointOperationResult result);
 
     Callback<void, LegacyObjectClient*, std::shared_ptr<LegacyObject>> on_found_root_object_;
     uint8_t tx_buf_[4] = {0xff, 0xff, 0xff, 0xff};
+    uint8_t version_buf_[4];
+    uint32_t version_id_ = 0; // (json_crc_ << 16) | crc16(json_crc_, json_), 0 if unknown
+    bool json_compressed_ = false; // json_ is being downloaded in compressed form
     EndpointOperationHandle op_handle_ = 0;
     std::vector<uint8_t> json_;
     //std::vector<LegacyCallContext*> pending_calls_;
     std::unordered_map<std::string, std::shared_ptr<FibreInterface>> rw_property_interfaces;
     std::unordered_map<std::string, std::shared_ptr<FibreInterface>> ro_property_interfaces;
+
+    EndpointOperationHandle subscribe_handle_ = 0;
+    std::vector<uint8_t> subscribe_tx_buf_;
+    uint8_t subscribe_rx_buf_[1];
+    std::vector<LegacyObject*> requested_subscriptions_; // in the order of the request
+    std::vector<uint16_t> requested_intervals_;
+    std::unordered_map<uint16_t, Subscription> subscriptions_; // key: endpoint ID
+    Callback<void, LegacyObject*, cbufptr_t> on_property_update_;
 };
 
 }
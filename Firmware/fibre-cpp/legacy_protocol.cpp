@@ -179,6 +179,183 @@ void PacketUnwrapper::complete(ReadResult result) {
 }
 
 
+/* CobsPacketWrapper ---------------------------------------------------------*/
+
+void CobsPacketWrapper::start_write(cbufptr_t buffer, TransferHandle* handle, Callback<void, WriteResult> completer) {
+    if (handle) {
+        *handle = reinterpret_cast<TransferHandle>(this);
+    }
+
+    if (state_ != kStateIdle || buffer.size() > kMaxPayloadSize) {
+        completer.invoke({kStreamError, buffer.begin()});
+        return;
+    }
+
+    completer_ = completer;
+    payload_buf_ = buffer;
+
+    uint16_t crc16 = calc_crc16<CANONICAL_CRC16_POLYNOMIAL>(CANONICAL_CRC16_INIT, buffer.begin(), buffer.size());
+    uint8_t trailer[2] = {(uint8_t)((crc16 >> 8) & 0xff), (uint8_t)((crc16 >> 0) & 0xff)};
+
+    CobsEncoder encoder;
+    encoder.begin(tx_buf_);
+    encoder.write(buffer.begin(), buffer.size());
+    encoder.write(trailer, sizeof(trailer));
+    size_t length = encoder.end();
+    tx_buf_[length++] = 0;
+
+    state_ = kStateSending;
+    tx_end_ = tx_buf_ + length;
+    tx_channel_->start_write({tx_buf_, tx_end_}, &inner_transfer_handle_, MEMBER_CB(this, complete));
+}
+
+void CobsPacketWrapper::cancel_write(TransferHandle transfer_handle) {
+    state_ = kStateCancelling;
+    tx_channel_->cancel_write(inner_transfer_handle_);
+}
+
+void CobsPacketWrapper::complete(WriteResult result) {
+    if (state_ == kStateCancelling) {
+        state_ = kStateIdle;
+        completer_.invoke_and_clear({kStreamCancelled, payload_buf_.begin()});
+        return;
+    }
+
+    if (result.status != kStreamOk) {
+        state_ = kStateIdle;
+        completer_.invoke_and_clear({result.status, payload_buf_.begin()});
+        return;
+    }
+
+    if (result.end < tx_end_) {
+        tx_channel_->start_write({result.end, tx_end_}, &inner_transfer_handle_, MEMBER_CB(this, complete));
+        return;
+    }
+
+    state_ = kStateIdle;
+    completer_.invoke_and_clear({kStreamOk, payload_buf_.end()});
+}
+
+
+/* CobsPacketUnwrapper -------------------------------------------------------*/
+
+void CobsPacketUnwrapper::start_read(bufptr_t buffer, TransferHandle* handle, Callback<void, ReadResult> completer) {
+    if (handle) {
+        *handle = reinterpret_cast<TransferHandle>(this);
+    }
+
+    if (reading_) {
+        completer.invoke({kStreamError, buffer.begin()});
+        return;
+    }
+
+    completer_ = completer;
+    payload_buf_ = buffer;
+    reading_ = true;
+    process();
+}
+
+void CobsPacketUnwrapper::cancel_read(TransferHandle transfer_handle) {
+    // An inner read that is in progress stays in progress. Its data is kept
+    // for the next read.
+    if (reading_) {
+        reading_ = false;
+        completer_.invoke_and_clear({kStreamCancelled, payload_buf_.begin()});
+    }
+}
+
+void CobsPacketUnwrapper::complete(ReadResult result) {
+    inner_reading_ = false;
+    if (result.status != kStreamOk) {
+        inner_status_ = result.status;
+    }
+    end_ = result.end - rx_buf_;
+    process();
+}
+
+/**
+ * @brief Delivers buffered frames and reads more data until the client's read
+ * is complete.
+ *
+ * The client usually starts the next read from within its completer and the
+ * underlying stream may complete a read synchronously. Both only resume the
+ * loop here instead of recursing, so the stack doesn't grow with the number
+ * of frames.
+ */
+void CobsPacketUnwrapper::process() {
+    if (processing_) {
+        return;
+    }
+    processing_ = true;
+
+    while (reading_) {
+        if (deliver_frame()) {
+            continue;
+        }
+
+        if (inner_status_ != kStreamOk) {
+            reading_ = false;
+            completer_.invoke_and_clear({inner_status_, payload_buf_.begin()});
+            continue;
+        }
+
+        if (inner_reading_) {
+            break;
+        }
+
+        // Move the incomplete frame to the front once the space behind it
+        // might not hold a whole frame
+        if (begin_ && sizeof(rx_buf_) - end_ < kMaxFrameSize) {
+            memmove(rx_buf_, rx_buf_ + begin_, end_ - begin_);
+            scan_ -= begin_;
+            end_ -= begin_;
+            begin_ = 0;
+        }
+        if (end_ == sizeof(rx_buf_)) {
+            // No valid frame is this long
+            discarding_ = true;
+            scan_ = end_ = 0;
+        }
+
+        inner_reading_ = true;
+        rx_channel_->start_read({rx_buf_ + end_, rx_buf_ + sizeof(rx_buf_)}, &inner_transfer_handle_, MEMBER_CB(this, complete));
+    }
+
+    processing_ = false;
+}
+
+/**
+ * @brief Completes the client's read with the next valid frame in the buffer.
+ * @returns false if the buffer holds no complete valid frame.
+ */
+bool CobsPacketUnwrapper::deliver_frame() {
+    while (scan_ < end_) {
+        uint8_t* delimiter = (uint8_t*)memchr(rx_buf_ + scan_, 0, end_ - scan_);
+        if (!delimiter) {
+            scan_ = end_;
+            return false;
+        }
+
+        uint8_t* frame = rx_buf_ + begin_;
+        size_t frame_length = delimiter - frame;
+        begin_ = scan_ = delimiter + 1 - rx_buf_;
+
+        size_t length;
+        if (discarding_) {
+            discarding_ = false;
+        } else if (frame_length && cobs_decode(frame, frame_length, &length) && length >= 2
+                && !calc_crc16<CANONICAL_CRC16_POLYNOMIAL>(CANONICAL_CRC16_INIT, frame, length)) {
+            size_t payload_length = std::min(payload_buf_.size(), length - 2);
+            memcpy(payload_buf_.begin(), frame, payload_length);
+            reading_ = false;
+            completer_.invoke_and_clear({kStreamOk, payload_buf_.begin() + payload_length});
+            return true;
+        }
+    }
+    return false;
+}
+
+
 /* LegacyProtocolPacketBased -------------------------------------------------*/
 
 #if FIBRE_ENABLE_CLIENT
@@ -216,17 +393,43 @@ void LegacyProtocolPacketBased::start_endpoint_operation(uint16_t endpoint_id, c
         *handle = op.seqno | 0xffff0000;
     }
 
-    if (tx_handle_) {
+    if (tx_handle_ || pending_head_ || n_expected_acks_ >= kMaxOpsInFlight) {
         FIBRE_LOG(D) << "Endpoint operation already in progress. Enqueuing this one.";
 
-        // A TX operation is already in progress. Enqueue this one.
-        pending_operations_.push_back(op);
+        // The TX channel is busy or the window is full. Enqueue this one.
+        PendingOperation* pending = pending_pool_.alloc(op, nullptr);
+        if (pending_tail_) {
+            pending_tail_->next = pending;
+        } else {
+            pending_head_ = pending;
+        }
+        pending_tail_ = pending;
         return;
     }
 
     start_endpoint_operation(op);
 }
 
+/**
+ * @brief Transmits the oldest enqueued operation if the TX channel is free and
+ * fewer than kMaxOpsInFlight operations are waiting for their ACK.
+ * @returns true if an operation was started and is still transmitting.
+ */
+bool LegacyProtocolPacketBased::start_pending_operation() {
+    if (tx_handle_ || !pending_head_ || n_expected_acks_ >= kMaxOpsInFlight) {
+        return false;
+    }
+    PendingOperation* pending = pending_head_;
+    pending_head_ = pending->next;
+    if (!pending_head_) {
+        pending_tail_ = nullptr;
+    }
+    EndpointOperation op = pending->op;
+    pending_pool_.free(pending);
+    start_endpoint_operation(op);
+    return transmitting_op_;
+}
+
 void LegacyProtocolPacketBased::start_endpoint_operation(EndpointOperation op) {
     write_le<uint16_t>(op.seqno, tx_buf_);
     write_le<uint16_t>(op.endpoint_id | 0x8000, tx_buf_ + 2);
@@ -242,11 +445,29 @@ void LegacyProtocolPacketBased::start_endpoint_operation(EndpointOperation op) {
 
     write_le<uint16_t>(trailer, tx_buf_ + 6 + n_payload);
 
-    expected_acks_[op.seqno] = op;
+    expected_acks_[n_expected_acks_++] = op;
     transmitting_op_ = op.seqno | 0xffff0000;
     tx_channel_->start_write(cbufptr_t{tx_buf_}.take(8 + n_payload), &tx_handle_, MEMBER_CB(this, on_write_finished));
 }
 
+LegacyProtocolPacketBased::EndpointOperation* LegacyProtocolPacketBased::find_expected_ack(uint16_t seqno) {
+    for (size_t i = 0; i < n_expected_acks_; ++i) {
+        if (expected_acks_[i].seqno == seqno) {
+            return &expected_acks_[i];
+        }
+    }
+    return nullptr;
+}
+
+// Removes an operation from expected_acks_. This moves the last one into its
+// place, so pointers into expected_acks_ become invalid.
+LegacyProtocolPacketBased::EndpointOperation LegacyProtocolPacketBased::pop_expected_ack(EndpointOperation* op) {
+    EndpointOperation result = *op;
+    *op = expected_acks_[--n_expected_acks_];
+    expected_acks_[n_expected_acks_] = {};
+    return result;
+}
+
 
 void LegacyProtocolPacketBased::cancel_endpoint_operation(EndpointOperationHandle handle) {
     if (!handle) {
@@ -259,24 +480,26 @@ void LegacyProtocolPacketBased::cancel_endpoint_operation(EndpointOperationHandl
     const uint8_t* tx_end = nullptr;
     uint8_t* rx_end = nullptr;
 
-    auto it0 = std::find_if(pending_operations_.begin(), pending_operations_.end(), [&](EndpointOperation& op) {
-        return op.seqno == seqno;
-    });
-
-    if (it0 != pending_operations_.end()) {
-        callback = it0->callback;
-        tx_end = it0->tx_buf.begin();
-        rx_end = it0->rx_buf.begin();
-        pending_operations_.erase(it0);
+    PendingOperation* prev = nullptr;
+    for (PendingOperation* pending = pending_head_; pending; prev = pending, pending = pending->next) {
+        if (pending->op.seqno == seqno) {
+            callback = pending->op.callback;
+            tx_end = pending->op.tx_buf.begin();
+            rx_end = pending->op.rx_buf.begin();
+            (prev ? prev->next : pending_head_) = pending->next;
+            if (pending_tail_ == pending) {
+                pending_tail_ = prev;
+            }
+            pending_pool_.free(pending);
+            break;
+        }
     }
 
-    auto it1 = expected_acks_.find(seqno);
-
-    if (it1 != expected_acks_.end()) {
-        callback = it1->second.callback;
-        tx_end = it1->second.tx_buf.begin();
-        rx_end = it1->second.rx_buf.begin();
-        expected_acks_.erase(it1);
+    if (EndpointOperation* op = find_expected_ack(seqno)) {
+        callback = op->callback;
+        tx_end = op->tx_buf.begin();
+        rx_end = op->rx_buf.begin();
+        pop_expected_ack(op);
     }
 
     if (transmitting_op_ == handle) {
@@ -287,6 +510,10 @@ void LegacyProtocolPacketBased::cancel_endpoint_operation(EndpointOperationHandl
         // Either we're waiting for an ack on this operation or it has not yet
         // been sent. In both cases we can just complete immediately.
         callback.invoke_and_clear({kStreamCancelled, tx_end, rx_end});
+
+        // The cancelled operation may have freed a slot in the window, e.g.
+        // when its ACK was lost
+        start_pending_operation();
     }
 }
 
@@ -302,21 +529,156 @@ bool fibre::endpoint0_handler(fibre::cbufptr_t* input_buffer, fibre::bufptr_t* o
     if (!offset.has_value()) {
         // Didn't receive any offset
         return false;
-    } else if (*offset == 0xffffffff) {
+    }
+
+    const unsigned char* json = embedded_json;
+    size_t json_length = embedded_json_length;
+
+    if (*offset == 0xffffffff) {
         // If the offset is special value 0xFFFFFFFF, send back the JSON version ID instead
         return write_le<uint32_t>(json_version_id_, output_buffer);
-    } else if (*offset >= embedded_json_length) {
+    } else if (*offset & JSON_COMPRESSED_OFFSET) {
+        // Offsets with the top bit set read the compressed JSON. Older
+        // firmware returns an empty response for these.
+        *offset &= ~JSON_COMPRESSED_OFFSET;
+        json = embedded_json_compressed;
+        json_length = embedded_json_compressed_length;
+    }
+
+    if (*offset >= json_length) {
         // Attempt to read beyond the buffer end - return empty response
         return true;
     } else {
         // Return part of the json file
-        size_t n_copy = std::min(output_buffer->size(), embedded_json_length - (size_t)*offset);
-        memcpy(output_buffer->begin(), embedded_json + *offset, n_copy);
+        size_t n_copy = std::min(output_buffer->size(), json_length - (size_t)*offset);
+        memcpy(output_buffer->begin(), json + *offset, n_copy);
         *output_buffer = output_buffer->skip(n_copy);
         return true;
     }
 }
 
+/**
+ * @brief Runs several endpoint operations of one request.
+ *
+ * Each operation in the request consists of the endpoint ID (uint16), the
+ * number of input bytes (uint8), the maximum number of output bytes (uint8)
+ * and the input bytes. For each operation the response contains the number
+ * of output bytes (uint8, 0xff if the operation failed) followed by the
+ * output bytes.
+ *
+ * Operations that don't fit into the response anymore are not run, so the
+ * client can tell from the response which ones took effect.
+ */
+bool fibre::batch_endpoint_handler(fibre::cbufptr_t* input_buffer, fibre::bufptr_t* output_buffer) {
+    while (input_buffer->size()) {
+        std::optional<uint16_t> endpoint_id = read_le<uint16_t>(input_buffer);
+        std::optional<uint8_t> in_length = read_le<uint8_t>(input_buffer);
+        std::optional<uint8_t> out_length = read_le<uint8_t>(input_buffer);
+        if (!endpoint_id || !in_length || !out_length || *in_length > input_buffer->size()) {
+            return false; // malformed request
+        }
+        if (1 + (size_t)*out_length > output_buffer->size()) {
+            return true; // response full
+        }
+
+        fibre::cbufptr_t op_input = {input_buffer->begin(), *in_length};
+        fibre::bufptr_t op_output = {output_buffer->begin() + 1, *out_length};
+        *input_buffer = input_buffer->skip(*in_length);
+
+        // Endpoint 0 and nested batches are not allowed
+        bool ok = *endpoint_id && (*endpoint_id != BATCH_ENDPOINT_ID)
+               && fibre::endpoint_handler(*endpoint_id, &op_input, &op_output);
+        size_t n_written = op_output.begin() - (output_buffer->begin() + 1);
+        *output_buffer->begin() = ok ? (uint8_t)n_written : 0xff;
+        *output_buffer = output_buffer->skip(1 + (ok ? n_written : 0));
+    }
+    return true;
+}
+
+/**
+ * @brief Replaces the set of subscribed properties.
+ *
+ * Each entry in the request consists of the endpoint ID (uint16), the size of
+ * the value (uint8, at most 8) and the interval (uint16) [ms]. An interval of
+ * 0 means that the value is sent whenever it changes. An empty request ends
+ * all subscriptions. The response is the number of accepted entries (uint8).
+ *
+ * Entries are accepted up to the first one that is invalid (not a property
+ * endpoint or an unsupported size) or exceeds kMaxSubscriptions, so the
+ * client can tell from the response which ones took effect.
+ */
+void LegacyProtocolPacketBased::subscribe(cbufptr_t* input_buffer, bufptr_t* output_buffer) {
+    n_subscriptions_ = 0;
+
+    while (input_buffer->size() && n_subscriptions_ < kMaxSubscriptions) {
+        std::optional<uint16_t> endpoint_id = read_le<uint16_t>(input_buffer);
+        std::optional<uint8_t> size = read_le<uint8_t>(input_buffer);
+        std::optional<uint16_t> interval_ms = read_le<uint16_t>(input_buffer);
+        if (!endpoint_id || !size || !interval_ms || !*size || *size > sizeof(Subscription::last_value)
+                || !fibre::is_property_endpoint(*endpoint_id)) {
+            break;
+        }
+        subscriptions_[n_subscriptions_++] = {*endpoint_id, *size, false, *interval_ms, 0, {}};
+    }
+
+    write_le<uint8_t>(n_subscriptions_, output_buffer);
+    FIBRE_LOG(D) << n_subscriptions_ << " subscriptions";
+}
+
+uint32_t LegacyProtocolPacketBased::poll_subscriptions(uint32_t now_ms) {
+    if (!n_subscriptions_) {
+        return UINT32_MAX;
+    }
+    if (tx_handle_ || rx_end_) {
+        return 1; // responses take precedence, retry once the TX channel is free
+    }
+
+    // Packet: the notification tag followed by one entry per value, each
+    // consisting of the endpoint ID (uint16), the size (uint8) and the value.
+    bufptr_t packet{tx_buf_ + 2, tx_mtu_ - 2};
+    uint32_t next_poll = UINT32_MAX;
+
+    for (size_t i = 0; i < n_subscriptions_; ++i) {
+        Subscription& sub = subscriptions_[i];
+        uint32_t interval = sub.interval_ms ? sub.interval_ms : kOnChangePollInterval;
+        uint32_t elapsed = now_ms - sub.last_poll_ms;
+        if (sub.sent && elapsed < interval) {
+            next_poll = std::min(next_poll, interval - elapsed);
+            continue;
+        }
+        if (packet.size() < 3 + (size_t)sub.size) {
+            next_poll = 1; // goes into the next packet
+            continue;
+        }
+
+        uint8_t value[sizeof(sub.last_value)];
+        cbufptr_t input_buffer{nullptr, nullptr};
+        bufptr_t output_buffer{value, sub.size};
+        bool ok = fibre::endpoint_handler(sub.endpoint_id, &input_buffer, &output_buffer);
+        size_t length = output_buffer.begin() - value;
+        sub.last_poll_ms = now_ms;
+        next_poll = std::min(next_poll, interval);
+
+        if (!ok || (!sub.interval_ms && sub.sent && !memcmp(value, sub.last_value, length))) {
+            continue;
+        }
+        memcpy(sub.last_value, value, length);
+        sub.sent = true;
+
+        write_le<uint16_t>(sub.endpoint_id, &packet);
+        write_le<uint8_t>(length, &packet);
+        memcpy(packet.begin(), value, length);
+        packet = packet.skip(length);
+    }
+
+    if (packet.begin() != tx_buf_ + 2) {
+        write_le<uint16_t>(NOTIFICATION_TAG, tx_buf_);
+        tx_channel_->start_write({tx_buf_, packet.begin()}, &tx_handle_, MEMBER_CB(this, on_write_finished));
+    }
+
+    return next_poll;
+}
+
 #endif
 
 void LegacyProtocolPacketBased::on_write_finished(WriteResult result) {
@@ -332,22 +694,20 @@ void LegacyProtocolPacketBased::on_write_finished(WriteResult result) {
         uint16_t seqno = transmitting_op_ & 0xffff;
         transmitting_op_ = 0;
 
-        auto it = expected_acks_.find(seqno);
+        EndpointOperation* it = find_expected_ack(seqno);
 
         size_t n_sent = std::max((size_t)(result.end - tx_buf_), (size_t)8) - 8;
-        it->second.tx_buf = it->second.tx_buf.skip(n_sent);
-        it->second.tx_done = true;
+        it->tx_buf = it->tx_buf.skip(n_sent);
+        it->tx_done = true;
 
-        if (it->second.rx_done) {
+        if (it->rx_done) {
             // It's possible that the RX operation completes before the TX operation
-            auto op = it->second;
-            expected_acks_.erase(it);
+            auto op = pop_expected_ack(it);
             op.callback.invoke_and_clear({kStreamOk, op.tx_buf.begin(), op.rx_buf.begin()});
         } else if (result.status != kStreamOk) {
             // If the TX task was a remote endpoint operation but didn't succeed
             // we terminate that operation
-            auto op = it->second;
-            expected_acks_.erase(it);
+            auto op = pop_expected_ack(it);
             op.callback.invoke_and_clear({result.status, result.end, op.rx_buf.begin()});
         }
 
@@ -375,15 +735,10 @@ void LegacyProtocolPacketBased::on_write_finished(WriteResult result) {
 #endif
 
 #if FIBRE_ENABLE_CLIENT
-    if (pending_operations_.size() > 0) {
-        // There is a write operation pending from the client side (i.e. an
-        // outgoing remote endpoint operation).
-        EndpointOperation op = pending_operations_[0];
-        pending_operations_.erase(pending_operations_.begin());
-        start_endpoint_operation(op);
-        if (transmitting_op_) {
-            return;
-        }
+    // There may be a write operation pending from the client side (i.e. an
+    // outgoing remote endpoint operation).
+    if (start_pending_operation()) {
+        return;
     }
 #endif
 }
@@ -416,29 +771,36 @@ void LegacyProtocolPacketBased::on_read_finished(ReadResult result) {
     if (!seq_no.has_value()) {
         FIBRE_LOG(W) << "packet too short";
 
+    } else if (*seq_no == NOTIFICATION_TAG) {
+#if FIBRE_ENABLE_CLIENT
+        client_.on_notification(rx_buf);
+#endif
+
     } else if (*seq_no & 0x8000) {
 
 #if FIBRE_ENABLE_CLIENT
         
-        auto it = expected_acks_.find(*seq_no & 0x7fff);
+        EndpointOperation* it = find_expected_ack(*seq_no & 0x7fff);
 
-        if (it == expected_acks_.end()) {
+        if (!it) {
             FIBRE_LOG(W) << "received unexpected ACK: " << (*seq_no & 0x7fff);
         } else {
-            size_t n_copy = std::min((size_t)(result.end - rx_buf.begin()), it->second.rx_buf.size());
-            memcpy(it->second.rx_buf.begin(), rx_buf.begin(), n_copy);
-            it->second.rx_buf = it->second.rx_buf.skip(n_copy);
-            it->second.rx_done = true;
+            size_t n_copy = std::min((size_t)(result.end - rx_buf.begin()), it->rx_buf.size());
+            memcpy(it->rx_buf.begin(), rx_buf.begin(), n_copy);
+            it->rx_buf = it->rx_buf.skip(n_copy);
+            it->rx_done = true;
             FIBRE_LOG(T) << "received ACK: " << (*seq_no & 0x7fff);
 
             // It's possible that the RX operation completes before the TX operation
-            if (it->second.tx_done) {
-                auto op = it->second;
-                expected_acks_.erase(it);
+            if (it->tx_done) {
+                auto op = pop_expected_ack(it);
                 op.callback.invoke_and_clear({kStreamOk, op.tx_buf.begin(), op.rx_buf.begin()});
             }
         }
 
+        // The ACK freed a slot in the window
+        start_pending_operation();
+
 #else
         FIBRE_LOG(W) << "received ack but client support is not compiled in";
 #endif
@@ -489,7 +851,15 @@ void LegacyProtocolPacketBased::on_read_finished(ReadResult result) {
 
         fibre::cbufptr_t input_buffer{rx_buf.begin(), rx_buf.end() - 2};
         fibre::bufptr_t output_buffer{tx_buf_ + 2, expected_response_length};
-        fibre::endpoint_handler(endpoint_id, &input_buffer, &output_buffer);
+        if (endpoint_id == BATCH_ENDPOINT_ID) {
+            fibre::batch_endpoint_handler(&input_buffer, &output_buffer);
+        } else if (endpoint_id == SUBSCRIBE_ENDPOINT_ID) {
+            subscribe(&input_buffer, &output_buffer);
+        } else if (endpoint_id == FW_UPDATE_ENDPOINT_ID) {
+            fibre::firmware_update_handler(&input_buffer, &output_buffer);
+        } else {
+            fibre::endpoint_handler(endpoint_id, &input_buffer, &output_buffer);
+        }
 
         // Send response
         if (expect_response) {
@@ -531,20 +901,29 @@ void LegacyProtocolPacketBased::on_rx_tx_closed(StreamStatus status) {
         status = kStreamError;
     }
 
+#if FIBRE_ENABLE_SERVER
+    n_subscriptions_ = 0;
+#endif
+
 #if FIBRE_ENABLE_CLIENT
     // Cancel pending endpoint operation
-    for (auto& op: pending_operations_) {
+    while (PendingOperation* pending = pending_head_) {
+        pending_head_ = pending->next;
+        if (!pending_head_) {
+            pending_tail_ = nullptr;
+        }
+        EndpointOperation op = pending->op;
+        pending_pool_.free(pending);
         op.callback.invoke_and_clear({status, op.tx_buf.begin(), op.rx_buf.begin()});
     }
-    pending_operations_.clear();
 
     // Cancel all ongoing endpoint operations
-    for (auto& item: expected_acks_) {
-        if (item.second.callback) {
-            item.second.callback.invoke_and_clear({status, item.second.tx_buf.begin(), item.second.rx_buf.begin()});
+    while (n_expected_acks_) {
+        auto op = pop_expected_ack(&expected_acks_[n_expected_acks_ - 1]);
+        if (op.callback) {
+            op.callback.invoke_and_clear({status, op.tx_buf.begin(), op.rx_buf.begin()});
         }
     }
-    expected_acks_.clear();
 
     // Report that the root object was lost
     if (client_.on_lost_root_object_ && client_.root_obj_) {
@@ -562,11 +941,16 @@ void LegacyProtocolPacketBased::start(Callback<void, LegacyObjectClient*, std::s
 void LegacyProtocolPacketBased::start(Callback<void, LegacyProtocolPacketBased*, StreamStatus> on_stopped) {
 #endif
     on_stopped_ = on_stopped;
+#if FIBRE_ENABLE_SERVER
+    n_subscriptions_ = 0; // the client of the previous session may not be there anymore
+#endif
     TransferHandle dummy;
     rx_channel_->start_read(rx_buf_, &dummy, MEMBER_CB(this, on_read_finished));
 
 #if FIBRE_ENABLE_CLIENT
-    if (on_stopped_) {
+    // Without on_found_root_object the instance only serves or runs endpoint
+    // operations of a HostClient
+    if (on_found_root_object) {
         client_.start(on_found_root_object, on_lost_root_object);
     }
 #endif
@@ -2,12 +2,14 @@
 #define __FIBRE_LEGACY_PROTOCOL_HPP
 
 #include <fibre/async_stream.hpp>
+#include "cobs.hpp"
 
 #ifdef FIBRE_ENABLE_CLIENT
 #include "legacy_object_client.hpp"
 #include <unordered_map>
 #include <optional>
 #include <queue>
+#include "pool.hpp"
 #endif
 
 namespace fibre {
@@ -29,6 +31,18 @@ constexpr uint8_t CANONICAL_PREFIX = 0xAA;
 
 constexpr uint16_t PROTOCOL_VERSION = 1;
 
+// Endpoint 0 offsets with this bit set read the compressed JSON instead of the
+// plain JSON (except for 0xffffffff, which reads the JSON version ID)
+constexpr uint32_t JSON_COMPRESSED_OFFSET = 0x80000000;
+
+// Endpoint ID of a request that sets the properties which the server sends to
+// the client without a request, see LegacyProtocolPacketBased::subscribe().
+constexpr uint16_t SUBSCRIBE_ENDPOINT_ID = 0x7ffe;
+// Sequence number field of these unsolicited packets. The MSB is set like in a
+// response but bit 7 is clear, which is never the case for the sequence number
+// of a request, so clients that don't know it discard the packet.
+constexpr uint16_t NOTIFICATION_TAG = 0xff01;
+
 
 class PacketWrapper : public AsyncStreamSink {
 public:
@@ -88,16 +102,110 @@ private:
 };
 
 
+/**
+ * @brief Alternative to PacketWrapper that frames packets with COBS (see
+ * cobs.hpp) instead of a sync byte and length prefix.
+ *
+ * A frame is the COBS encoding of the payload and its CRC16 (big endian, as
+ * in PacketWrapper), followed by a zero byte. The frame is encoded into an
+ * own buffer and written with one write of the underlying stream.
+ */
+class CobsPacketWrapper : public AsyncStreamSink {
+public:
+    static constexpr size_t kMaxPayloadSize = 127;
+
+    CobsPacketWrapper(AsyncStreamSink* tx_channel)
+        : tx_channel_(tx_channel) {}
+
+    void start_write(cbufptr_t buffer, TransferHandle* handle, Callback<void, WriteResult> completer) final;
+    void cancel_write(TransferHandle transfer_handle) final;
+
+private:
+    void complete(WriteResult result);
+
+    AsyncStreamSink* tx_channel_;
+    TransferHandle inner_transfer_handle_;
+    uint8_t tx_buf_[cobs_max_encoded_size(kMaxPayloadSize + 2) + 1];
+    const uint8_t* tx_end_;
+    cbufptr_t payload_buf_ = {nullptr, nullptr};
+    Callback<void, WriteResult> completer_;
+
+    enum {
+        kStateIdle,
+        kStateCancelling,
+        kStateSending
+    } state_ = kStateIdle;
+};
+
+
+/**
+ * @brief Receives the frames of CobsPacketWrapper.
+ *
+ * Unlike PacketUnwrapper, which reads the header, payload and trailer of each
+ * packet with separate reads, this reads as much as the underlying stream has
+ * (e.g. everything in the DMA buffer of a UART) and looks for the delimiters
+ * in it. Several frames that arrive in one chunk cost one read, and no read
+ * depends on the content of the previous one.
+ *
+ * Frames that don't decode or whose CRC doesn't match are dropped, like frames
+ * that are longer than the largest valid frame. Reading only continues while
+ * the client has a read in progress, so that data that isn't consumed stays
+ * in the underlying stream.
+ */
+class CobsPacketUnwrapper : public AsyncStreamSource {
+public:
+    CobsPacketUnwrapper(AsyncStreamSource* rx_channel)
+        : rx_channel_(rx_channel) {}
+
+    void start_read(bufptr_t buffer, TransferHandle* handle, Callback<void, ReadResult> completer) final;
+    void cancel_read(TransferHandle transfer_handle) final;
+
+private:
+    // Encoded payload and CRC16 and the delimiter
+    static constexpr size_t kMaxFrameSize = cobs_max_encoded_size(CobsPacketWrapper::kMaxPayloadSize + 2) + 1;
+
+    void complete(ReadResult result);
+    void process();
+    bool deliver_frame();
+
+    AsyncStreamSource* rx_channel_;
+    TransferHandle inner_transfer_handle_;
+    // Received data is in [begin_, end_), of which [begin_, scan_) is known to
+    // contain no delimiter.
+    uint8_t rx_buf_[2 * kMaxFrameSize];
+    size_t begin_ = 0;
+    size_t scan_ = 0;
+    size_t end_ = 0;
+    bool discarding_ = false; // drop everything up to the next delimiter
+    bool reading_ = false; // a read of the client is in progress
+    bool inner_reading_ = false;
+    bool processing_ = false;
+    StreamStatus inner_status_ = kStreamOk;
+    bufptr_t payload_buf_ = {nullptr, nullptr};
+    Callback<void, ReadResult> completer_;
+};
+
+
+// Largest packet that LegacyProtocolPacketBased sends or receives. Targets
+// with larger transport packets (e.g. high speed USB) can raise this.
+#ifndef FIBRE_LEGACY_MAX_PACKET_SIZE
+#define FIBRE_LEGACY_MAX_PACKET_SIZE 128
+#endif
+
 struct LegacyProtocolPacketBased {
 public:
     LegacyProtocolPacketBased(AsyncStreamSource* rx_channel, AsyncStreamSink* tx_channel, size_t tx_mtu)
         : rx_channel_(rx_channel), tx_channel_(tx_channel), tx_mtu_(std::min(tx_mtu, sizeof(tx_buf_))) {}
 
+    // Changes the MTU for a transport whose packet size is only known once
+    // it's connected. Must be called before start().
+    void set_tx_mtu(size_t tx_mtu) { tx_mtu_ = std::min(tx_mtu, sizeof(tx_buf_)); }
+
     AsyncStreamSource* rx_channel_ = nullptr;
     AsyncStreamSink* tx_channel_ = nullptr;
     size_t tx_mtu_;
-    uint8_t tx_buf_[128];
-    uint8_t rx_buf_[128];
+    uint8_t tx_buf_[FIBRE_LEGACY_MAX_PACKET_SIZE];
+    uint8_t rx_buf_[FIBRE_LEGACY_MAX_PACKET_SIZE];
 
     TransferHandle tx_handle_ = 0; // non-zero while a TX operation is in progress
     uint8_t* rx_end_ = nullptr; // non-zero if an RX operation has finished but wasn't handled yet because the TX channel was busy
@@ -120,8 +228,42 @@ public:
     void start(Callback<void, LegacyProtocolPacketBased*, StreamStatus> on_stopped);
 #endif
 
+#if FIBRE_ENABLE_SERVER
+    /**
+     * @brief Sends the values of the subscribed properties that are due in one
+     * notification packet.
+     *
+     * Must be called on the thread that runs the endpoint handlers of this
+     * instance.
+     *
+     * @param now_ms: Monotonic time [ms]
+     * @returns Time until the next call is needed [ms] or UINT32_MAX if there
+     *          are no subscriptions.
+     */
+    uint32_t poll_subscriptions(uint32_t now_ms);
+#endif
+
 private:
 
+#if FIBRE_ENABLE_SERVER
+    struct Subscription {
+        uint16_t endpoint_id;
+        uint8_t size; // size of the value [bytes]
+        bool sent; // false until the first value was sent
+        uint16_t interval_ms; // 0: send the value when it changes
+        uint32_t last_poll_ms;
+        uint8_t last_value[8];
+    };
+
+    static constexpr size_t kMaxSubscriptions = 16;
+    static constexpr uint32_t kOnChangePollInterval = 10; // [ms]
+
+    void subscribe(cbufptr_t* input_buffer, bufptr_t* output_buffer);
+
+    Subscription subscriptions_[kMaxSubscriptions];
+    size_t n_subscriptions_ = 0;
+#endif
+
 #if FIBRE_ENABLE_CLIENT
     struct EndpointOperation {
         uint16_t seqno;
@@ -133,12 +275,32 @@ private:
         Callback<void, EndpointOperationResult> callback;
     };
 
+    // Maximum number of operations that are sent but not acknowledged yet.
+    // The server handles one packet at a time, further packets wait in the
+    // TX channel (e.g. the USB stack) until it starts reading again.
+    static constexpr size_t kMaxOpsInFlight = 4;
+
+    // Number of enqueued operations that fit into pending_pool_. More
+    // operations are allocated on the heap.
+    static constexpr size_t kPendingPoolSize = 64;
+
+    struct PendingOperation {
+        EndpointOperation op;
+        PendingOperation* next;
+    };
+
     void start_endpoint_operation(EndpointOperation op);
+    bool start_pending_operation();
+    EndpointOperation* find_expected_ack(uint16_t seqno);
+    EndpointOperation pop_expected_ack(EndpointOperation* op);
 
     uint16_t outbound_seq_no_ = 0;
-    std::vector<EndpointOperation> pending_operations_; // operations that are waiting for TX
+    Pool<PendingOperation, kPendingPoolSize> pending_pool_{get_debug_stats().endpoint_operations};
+    PendingOperation* pending_head_ = nullptr; // operations that are waiting for TX (oldest first)
+    PendingOperation* pending_tail_ = nullptr;
     EndpointOperationHandle transmitting_op_ = 0; // operation that is in TX
-    std::unordered_map<uint16_t, EndpointOperation> expected_acks_; // operations that are waiting for RX
+    EndpointOperation expected_acks_[kMaxOpsInFlight]; // operations that are waiting for RX
+    size_t n_expected_acks_ = 0;
 #endif
 
     void on_write_finished(WriteResult result);
@@ -151,8 +313,18 @@ private:
 struct LegacyProtocolStreamBased {
 public:
     LegacyProtocolStreamBased(AsyncStreamSource* rx_channel, AsyncStreamSink* tx_channel)
-        : unwrapper_(rx_channel), wrapper_(tx_channel) {}
-
+        : unwrapper_(rx_channel), wrapper_(tx_channel),
+          cobs_unwrapper_(rx_channel), cobs_wrapper_(tx_channel) {}
+
+    /**
+     * @brief Selects the COBS framing (CobsPacketWrapper) instead of the
+     * length prefixed one (PacketWrapper). Only valid while the protocol is
+     * not running.
+     */
+    void set_cobs_framing(bool cobs) {
+        inner_protocol_.rx_channel_ = cobs ? (AsyncStreamSource*)&cobs_unwrapper_ : &unwrapper_;
+        inner_protocol_.tx_channel_ = cobs ? (AsyncStreamSink*)&cobs_wrapper_ : &wrapper_;
+    }
 
 #if FIBRE_ENABLE_CLIENT
     void start(Callback<void, LegacyObjectClient*, std::shared_ptr<LegacyObject>> on_found_root_object, Callback<void, LegacyObjectClient*, std::shared_ptr<LegacyObject>> on_lost_root_object, Callback<void, LegacyProtocolPacketBased*, StreamStatus> on_stopped) {
@@ -165,6 +337,8 @@ public:
 private:
     PacketUnwrapper unwrapper_;
     PacketWrapper wrapper_;
+    CobsPacketUnwrapper cobs_unwrapper_;
+    CobsPacketWrapper cobs_wrapper_;
     LegacyProtocolPacketBased inner_protocol_{&unwrapper_, &wrapper_, 127};
 };
 
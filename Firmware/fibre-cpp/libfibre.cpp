@@ -5,6 +5,7 @@
 #include "print_utils.hpp"
 #include "legacy_protocol.hpp" // TODO: remove this include
 #include "legacy_object_client.hpp" // TODO: remove this include
+#include "pool.hpp"
 #include <algorithm>
 
 DEFINE_LOG_TOPIC(LIBFIBRE);
@@ -56,7 +57,7 @@ fibre::ChannelDiscoveryContext* from_c(LibFibreChannelDiscoveryCtx* ptr) {
 }
 
 
-static const struct LibFibreVersion libfibre_version = { 0, 1, 4 };
+static const struct LibFibreVersion libfibre_version = { 0, 1, 6 };
 
 class FIBRE_PRIVATE ExternalEventLoop final : public fibre::EventLoop {
 public:
@@ -294,6 +295,14 @@ void libfibre_close(LibFibreCtx* ctx) {
     delete ctx;
 
     FIBRE_LOG(D) << "closed (" << fibre::as_hex((uintptr_t)ctx) << ")";
+
+    const fibre::DebugStats& stats = fibre::get_debug_stats();
+    FIBRE_LOG(D) << "heap allocations: " << stats.call_contexts.n_heap_allocs << " of "
+                 << stats.call_contexts.n_allocs << " call contexts, "
+                 << stats.endpoint_operations.n_heap_allocs << " of "
+                 << stats.endpoint_operations.n_allocs << " enqueued endpoint operations, "
+                 << stats.libfibre_calls.n_heap_allocs << " of "
+                 << stats.libfibre_calls.n_allocs << " libfibre_call() contexts";
 }
 
 
@@ -500,6 +509,14 @@ void resize_at(std::vector<uint8_t>& vec, size_t pos, ssize_t delta) {
     }
 }
 
+struct FIBRE_PRIVATE LibFibreCallCtx {
+    libfibre_call_cb_t callback;
+    void* ctx;
+};
+
+// Callback contexts of the libfibre_call() invocations that are in progress
+static fibre::Pool<LibFibreCallCtx, 64> call_ctx_pool{fibre::get_debug_stats().libfibre_calls};
+
 LibFibreStatus libfibre_call(LibFibreFunction* func, LibFibreCallContext** handle,
         LibFibreStatus status,
         const unsigned char* tx_buf, size_t tx_len,
@@ -517,19 +534,18 @@ LibFibreStatus libfibre_call(LibFibreFunction* func, LibFibreCallContext** handl
         return kFibreInvalidArgument;
     }
 
-    struct Ctx { libfibre_call_cb_t callback; void* ctx; };
-    struct Ctx* ctx = new Ctx{callback, cb_ctx};
+    LibFibreCallCtx* ctx = call_ctx_pool.alloc(callback, cb_ctx);
 
     fibre::Callback<std::optional<fibre::CallBuffers>, fibre::CallBufferRelease> cb{
         [](void* ctx_, fibre::CallBufferRelease result) -> std::optional<fibre::CallBuffers> {
-            auto ctx = reinterpret_cast<Ctx*>(ctx_);
+            auto ctx = reinterpret_cast<LibFibreCallCtx*>(ctx_);
             const unsigned char* tx_buf;
             size_t tx_len;
             unsigned char* rx_buf;
             size_t rx_len;
             auto status = ctx->callback(ctx->ctx, to_c(result.status), result.tx_end, result.rx_end, &tx_buf, &tx_len, &rx_buf, &rx_len);
             if (status == kFibreBusy) {
-                delete ctx;
+                call_ctx_pool.free(ctx);
                 return std::nullopt;
             } else {
                 return fibre::CallBuffers{from_c(status), {tx_buf, tx_len}, {rx_buf, rx_len}};
@@ -542,13 +558,159 @@ LibFibreStatus libfibre_call(LibFibreFunction* func, LibFibreCallContext** handl
     if (!response.has_value()) {
         return kFibreBusy;
     } else {
-        delete ctx;
+        call_ctx_pool.free(ctx);
         *tx_end = response->tx_end;
         *rx_end = response->rx_end;
         return to_c(response->status);
     }
 }
 
+/**
+ * @brief State of a libfibre_call_batch() invokation.
+ */
+struct FIBRE_PRIVATE LibFibreCallBatch {
+    struct Call {
+        LibFibreCallBatch* batch;
+        LibFibreCallBatchItem* item;
+        void* handle;
+
+        bool on_progress(fibre::CallBufferRelease result);
+        std::optional<fibre::CallBuffers> resume(fibre::CallBufferRelease result);
+    };
+
+    void on_call_finished();
+
+    std::vector<Call> calls;
+    size_t n_pending;
+    bool is_starting = true; // true while inside libfibre_call_batch()
+    libfibre_call_batch_cb_t callback;
+    void* cb_ctx;
+};
+
+/**
+ * @brief Records the progress of a call and returns true if the call needs
+ * to continue.
+ */
+bool LibFibreCallBatch::Call::on_progress(fibre::CallBufferRelease result) {
+    item->tx_end = result.tx_end;
+    item->rx_end = result.rx_end;
+    item->status = to_c(result.status);
+    if (result.status == fibre::kFibreOk) {
+        return true;
+    }
+    batch->on_call_finished();
+    return false;
+}
+
+std::optional<fibre::CallBuffers> LibFibreCallBatch::Call::resume(fibre::CallBufferRelease result) {
+    if (!on_progress(result)) {
+        return std::nullopt;
+    }
+    return fibre::CallBuffers{fibre::kFibreClosed,
+        {item->tx_end, (size_t)(item->tx_buf + item->tx_len - item->tx_end)},
+        {item->rx_end, (size_t)(item->rx_buf + item->rx_len - item->rx_end)}};
+}
+
+void LibFibreCallBatch::on_call_finished() {
+    if (--n_pending == 0 && !is_starting) {
+        (*callback)(cb_ctx, calls.front().item, calls.size());
+        delete this;
+    }
+}
+
+LibFibreStatus libfibre_call_batch(LibFibreCallBatchItem* items, size_t n_items,
+        libfibre_call_batch_cb_t callback, void* cb_ctx) {
+    bool valid_args = (items || !n_items) && callback;
+    for (size_t i = 0; valid_args && i < n_items; ++i) {
+        valid_args = items[i].func
+                  && (!items[i].tx_len || items[i].tx_buf) // tx_buf valid
+                  && (!items[i].rx_len || items[i].rx_buf); // rx_buf valid
+    }
+    if (!valid_args) {
+        FIBRE_LOG(E) << "invalid argument";
+        return kFibreInvalidArgument;
+    }
+
+    if (!n_items) {
+        return kFibreOk;
+    }
+
+    // Deleted in on_call_finished() or below
+    LibFibreCallBatch* batch = new LibFibreCallBatch{};
+    batch->n_pending = n_items;
+    batch->callback = callback;
+    batch->cb_ctx = cb_ctx;
+    batch->calls.reserve(n_items);
+
+    // Start all calls before waiting for any of them so that the protocol can
+    // pipeline their endpoint operations.
+    for (size_t i = 0; i < n_items; ++i) {
+        batch->calls.push_back({batch, &items[i], nullptr});
+        LibFibreCallBatch::Call* call = &batch->calls.back();
+        items[i].status = kFibreBusy;
+        items[i].tx_end = items[i].tx_buf;
+        items[i].rx_end = items[i].rx_buf;
+
+        fibre::CallBuffers buffers{fibre::kFibreClosed,
+            {items[i].tx_buf, items[i].tx_len}, {items[i].rx_buf, items[i].rx_len}};
+
+        for (;;) {
+            auto response = from_c(items[i].func)->call(&call->handle, buffers,
+                    MEMBER_CB(call, resume));
+            if (!response.has_value() || !call->on_progress(*response)) {
+                break; // will resume asynchronously or is finished
+            }
+            buffers = {fibre::kFibreClosed,
+                {items[i].tx_end, (size_t)(items[i].tx_buf + items[i].tx_len - items[i].tx_end)},
+                {items[i].rx_end, (size_t)(items[i].rx_buf + items[i].rx_len - items[i].rx_end)}};
+        }
+    }
+
+    batch->is_starting = false;
+    if (!batch->n_pending) {
+        delete batch;
+        return kFibreOk;
+    }
+    return kFibreBusy;
+}
+
+/**
+ * @brief Forwards the property updates of one device to the application.
+ */
+struct FIBRE_PRIVATE LibFibreSubscriber {
+    void on_update(fibre::LegacyObject* obj, fibre::cbufptr_t value) {
+        (*on_update_)(cb_ctx_, reinterpret_cast<LibFibreObject*>(obj), value.begin(), value.size());
+    }
+
+    on_property_update_cb_t on_update_;
+    void* cb_ctx_;
+};
+
+LibFibreStatus libfibre_subscribe(LibFibreObject* obj,
+        LibFibreObject** properties, const uint16_t* intervals_ms, size_t n_properties,
+        on_property_update_cb_t on_update, void* cb_ctx) {
+    if (!obj || ((!properties || !intervals_ms) && n_properties) || !on_update) {
+        FIBRE_LOG(E) << "invalid argument";
+        return kFibreInvalidArgument;
+    }
+
+    fibre::LegacyObjectClient* client = reinterpret_cast<fibre::LegacyObject*>(obj)->client;
+
+    // One subscriber per device. The entry of a lost device stays around but
+    // is no longer invoked. The elements of an unordered_map don't move.
+    static std::unordered_map<fibre::LegacyObjectClient*, LibFibreSubscriber> subscribers;
+    LibFibreSubscriber* subscriber = &subscribers[client];
+
+    LibFibreSubscriber old_subscriber = *subscriber;
+    *subscriber = {on_update, cb_ctx};
+    if (!client->subscribe(reinterpret_cast<fibre::LegacyObject**>(properties), intervals_ms, n_properties,
+            MEMBER_CB(subscriber, on_update))) {
+        *subscriber = old_subscriber;
+        return client->is_subscribing() ? kFibreBusy : kFibreInvalidArgument;
+    }
+    return kFibreOk;
+}
+
 void libfibre_start_tx(LibFibreTxStream* tx_stream,
         const uint8_t* tx_buf, size_t tx_len, on_tx_completed_cb_t on_completed,
         void* ctx) {
@@ -338,4 +338,39 @@ struct NullStream {
 
 #endif // FIBRE_MAX_LOG_VERBOSITY
 
+#include <stddef.h>
+
+namespace fibre {
+
+/**
+ * @brief Allocation counters of one object pool (see pool.hpp)
+ */
+struct PoolStats {
+    size_t in_use = 0; //!< objects that are currently allocated
+    size_t max_in_use = 0; //!< maximum of in_use so far
+    size_t n_allocs = 0; //!< total number of allocations
+    size_t n_heap_allocs = 0; //!< allocations that didn't fit into the pool and went to the heap
+};
+
+/**
+ * @brief Debug statistics about the allocations on the fibre client's hot
+ * paths. If n_heap_allocs stays constant while the application is running,
+ * the calls don't cause any allocator traffic in fibre.
+ *
+ * Only updated from the event loop thread.
+ */
+struct DebugStats {
+    PoolStats call_contexts; //!< LegacyCallContext (one per remote call)
+    PoolStats endpoint_operations; //!< endpoint operations that were enqueued in LegacyProtocolPacketBased
+    PoolStats libfibre_calls; //!< callback contexts of libfibre_call()
+    PoolStats host_operations; //!< reads and writes of HostClient (see host_client.hpp)
+};
+
+inline DebugStats& get_debug_stats() {
+    static DebugStats stats;
+    return stats;
+}
+
+}
+
 #endif // __FIBRE_LOGGING_HPP
@@ -78,6 +78,9 @@ function get_fibre_package(args)
     pkg.cflags += '-DFIBRE_ENABLE_LIBUSB_BACKEND='..(args.enable_libusb_backend and '1' or '0')
     pkg.cflags += '-DFIBRE_ENABLE_TCP_SERVER_BACKEND='..(args.enable_tcp_server_backend and '1' or '0')
     pkg.cflags += '-DFIBRE_ENABLE_TCP_CLIENT_BACKEND='..(args.enable_tcp_client_backend and '1' or '0')
+    pkg.cflags += '-DFIBRE_ENABLE_UDP_SERVER_BACKEND='..(args.enable_udp_server_backend and '1' or '0')
+    pkg.cflags += '-DFIBRE_ENABLE_UDP_CLIENT_BACKEND='..(args.enable_udp_client_backend and '1' or '0')
+    pkg.cflags += '-DFIBRE_ENABLE_SOCKETCAN_BACKEND='..(args.enable_socketcan_backend and '1' or '0')
 
     if args.enable_libusb_backend then
         pkg.code_files += 'platform_support/libusb_transport.cpp'
@@ -98,12 +101,15 @@ function get_fibre_package(args)
     if args.enable_event_loop then
         pkg.code_files += 'platform_support/epoll_event_loop.cpp'
     end
-    if args.enable_tcp_client_backend or args.enable_tcp_server_backend then
+    if args.enable_tcp_client_backend or args.enable_tcp_server_backend or args.enable_udp_client_backend or args.enable_udp_server_backend then
         -- TODO: chose between windows and posix backend
         pkg.code_files += 'platform_support/posix_tcp_backend.cpp'
         pkg.code_files += 'platform_support/posix_socket.cpp'
         pkg.ldflags += '-lanl'
     end
+    if args.enable_socketcan_backend then
+        pkg.code_files += 'platform_support/socket_can_backend.cpp'
+    end
 
     return pkg
 end
@@ -5,6 +5,9 @@
 #include <sys/epoll.h>
 #include <sys/types.h>
 #include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <math.h>
 #include <unistd.h>
 #include <string.h>
 
@@ -39,9 +42,22 @@ bool EpollEventLoop::start(Callback<void> on_started) {
         ok = false;
     }
 
-    // Run for as long as there are callbacks pending posted or there's at least
-    // one file descriptor other than post_fd_ registerd.
-    while (pending_callbacks_.size() || (context_map_.size() > 1)) {
+    timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+    bool timer_fd_ok = (timer_fd_ >= 0)
+            && register_event(timer_fd_, EPOLLIN, MEMBER_CB(this, run_timers));
+
+    if (!timer_fd_ok) {
+        FIBRE_LOG(E) << "failed to create a timer file descriptor";
+        ok = false;
+    }
+
+    size_t n_internal_fds = (post_fd_ok ? 1 : 0) + (timer_fd_ok ? 1 : 0);
+
+    // Run for as long as there are callbacks pending posted, timers running or
+    // there's at least one file descriptor other than post_fd_ and timer_fd_
+    // registerd.
+    while (pending_callbacks_.size() || timers_.size() || (context_map_.size() > n_internal_fds)) {
         iterations_++;
 
         do {
@@ -74,6 +90,18 @@ bool EpollEventLoop::start(Callback<void> on_started) {
 
     FIBRE_LOG(D) << "epoll loop exited";
 
+    if ((timer_fd_ >= 0) && timer_fd_ok && !deregister_event(timer_fd_)) {
+        FIBRE_LOG(E) << "deregister_event() failed";
+        ok = false;
+    }
+
+    if ((timer_fd_ >= 0) && close(timer_fd_) != 0) {
+        FIBRE_LOG(E) << "close() failed: " << sys_err();
+        ok = false;
+    }
+    timer_fd_ = -1;
+    timer_fd_deadline_ = 0;
+
     if ((post_fd_ >= 0) && !deregister_event(post_fd_)) {
         FIBRE_LOG(E) << "deregister_event() failed";
         ok = false;
@@ -100,11 +128,21 @@ bool EpollEventLoop::post(Callback<void> callback) {
         return false;
     }
 
+    bool wakeup_pending;
+
     {
         std::unique_lock<std::mutex> lock(pending_callbacks_mutex_);
+        wakeup_pending = pending_callbacks_.size();
         pending_callbacks_.push_back(callback);
     }
 
+    // Only the first callback of a batch wakes up the loop. The ones after it
+    // are picked up by the same run_callbacks(), which saves a syscall per
+    // callback when many transfers complete at once.
+    if (wakeup_pending) {
+        return true;
+    }
+
     const uint64_t val = 1;
     if (write(post_fd_, &val, sizeof(val)) != sizeof(val)) {
         FIBRE_LOG(E) << "write() failed" << sys_err();
@@ -155,8 +193,6 @@ bool EpollEventLoop::deregister_event(int event_fd) {
         result = false;
     }
 
-    EventContext* callback = context_map_[event_fd];
-
     auto it = context_map_.find(event_fd);
     if (it == context_map_.end()) {
         FIBRE_LOG(E) << "event context not found";
@@ -169,19 +205,76 @@ bool EpollEventLoop::deregister_event(int event_fd) {
         }
     }
 
+    delete it->second;
     context_map_.erase(it);
-    
+
     return result;
 }
 
 struct EventLoopTimer* EpollEventLoop::call_later(float delay, Callback<void> callback) {
-    FIBRE_LOG(E) << "not implemented"; // TODO: implement
-    return nullptr;
+    if (timer_fd_ < 0) {
+        FIBRE_LOG(E) << "not started";
+        return nullptr;
+    }
+
+    // Catch up first so that the delay is counted from now
+    uint64_t now = get_time_ms();
+    if (!timers_.size() || now > timers_.now()) {
+        timers_.advance(now);
+    }
+
+    uint64_t delay_ms = delay > 0.0f ? (uint64_t)ceilf(delay * 1000.0f) : 0;
+    // One extra tick because the current tick is already partially elapsed
+    TimerWheel::Node* node = timers_.add(timers_.now() + delay_ms + 1, callback);
+    arm_timer_fd();
+    return reinterpret_cast<EventLoopTimer*>(node);
 }
 
 bool EpollEventLoop::cancel_timer(EventLoopTimer* timer) {
-    FIBRE_LOG(E) << "not implemented"; // TODO: implement
-    return false;
+    if (!timer) {
+        FIBRE_LOG(E) << "invalid argument";
+        return false;
+    }
+
+    // The timer fd is left armed, a spurious wakeup is cheaper than a syscall
+    timers_.cancel(reinterpret_cast<TimerWheel::Node*>(timer));
+    return true;
+}
+
+uint64_t EpollEventLoop::get_time_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void EpollEventLoop::arm_timer_fd() {
+    uint64_t deadline = timers_.size() ? timers_.next_deadline() : 0;
+    if (deadline == timer_fd_deadline_ || (deadline > timer_fd_deadline_ && timer_fd_deadline_ > timers_.now())) {
+        return; // already armed for this or an earlier deadline
+    }
+
+    // A zero it_value disarms the timer
+    struct itimerspec spec = {};
+    if (deadline) {
+        spec.it_value.tv_sec = deadline / 1000;
+        spec.it_value.tv_nsec = (deadline % 1000) * 1000000;
+    }
+    if (timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &spec, nullptr) != 0) {
+        FIBRE_LOG(E) << "timerfd_settime() failed: " << sys_err();
+        return;
+    }
+    timer_fd_deadline_ = deadline;
+}
+
+void EpollEventLoop::run_timers(uint32_t) {
+    uint64_t n_expirations;
+    if (read(timer_fd_, &n_expirations, sizeof(n_expirations)) != sizeof(n_expirations)) {
+        // Spurious wakeup, e.g. the timer was rearmed in the meantime
+    }
+
+    timer_fd_deadline_ = 0;
+    timers_.advance(get_time_ms());
+    arm_timer_fd();
 }
 
 void EpollEventLoop::run_callbacks(uint32_t) {
@@ -191,14 +284,15 @@ void EpollEventLoop::run_callbacks(uint32_t) {
         FIBRE_LOG(E) << "failed to read from post file descriptor";
     }
 
-    std::vector<Callback<void>> pending_callbacks;
-
+    // Both vectors keep their capacity, so that steady traffic doesn't
+    // allocate
     {
         std::unique_lock<std::mutex> lock(pending_callbacks_mutex_);
-        std::swap(pending_callbacks, pending_callbacks_);
+        std::swap(running_callbacks_, pending_callbacks_);
     }
 
-    for (auto& cb: pending_callbacks) {
+    for (auto& cb: running_callbacks_) {
         cb.invoke();
     }
+    running_callbacks_.clear();
 }
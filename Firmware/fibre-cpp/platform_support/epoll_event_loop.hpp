@@ -9,6 +9,7 @@
 //#include <algorithm>
 
 #include <fibre/event_loop.hpp>
+#include "../timer_wheel.hpp"
 
 namespace fibre {
 
@@ -46,22 +47,31 @@ private:
     };
 
     void run_callbacks(uint32_t);
+    void run_timers(uint32_t);
+    void arm_timer_fd();
+    static uint64_t get_time_ms();
 
     int epoll_fd_ = -1;
     int post_fd_ = -1;
+    int timer_fd_ = -1; // drives timers_
     unsigned int iterations_ = 0;
 
     std::unordered_map<int, EventContext*> context_map_; // required to deregister callbacks
 
-    static const size_t max_triggered_events_ = 16; // max number of events that can be handled per iteration
+    static const size_t max_triggered_events_ = 128; // max number of events that can be handled per iteration
     int n_triggered_events_ = 0;
     struct epoll_event triggered_events_[max_triggered_events_];
 
     // List of callbacks that were submitted through post().
     std::vector<Callback<void>> pending_callbacks_;
+    std::vector<Callback<void>> running_callbacks_; // only used by run_callbacks()
 
     // Mutex to protect pending_callbacks_
     std::mutex pending_callbacks_mutex_;
+
+    // Timers started by call_later(), in milliseconds of CLOCK_MONOTONIC
+    TimerWheel timers_;
+    uint64_t timer_fd_deadline_ = 0; // 0 if disarmed
 };
 
 }
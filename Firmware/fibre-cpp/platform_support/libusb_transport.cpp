@@ -11,6 +11,7 @@
 
 #include <algorithm>
 #include <string.h>
+#include <stdio.h>
 
 #if !FIBRE_ALLOW_HEAP
 #  error "The libusb backend requires heap allocation."
@@ -29,6 +30,18 @@ constexpr unsigned int kBulkTimeoutMs = 10000;
 // need polling.
 constexpr unsigned int kPollingIntervalMs = 1000;
 
+// Polling interval for some time after an open device was lost, so that it is
+// found again quickly if it comes back (e.g. after a reboot). Also only
+// relevant for platforms without hotplug detection.
+constexpr unsigned int kReconnectPollingIntervalMs = 20;
+constexpr unsigned int kReconnectWindowMs = 5000;
+
+// Opening a device can fail for a short time after it arrived, until the OS
+// has finished setting it up (e.g. until udev applied the permissions on
+// Linux). Hotplug detection reports a device only once, so we retry.
+constexpr unsigned int kOpenRetryIntervalMs = 10;
+constexpr unsigned int kMaxOpenRetries = 100;
+
 /* LibusbDiscoverer ----------------------------------------------------------*/
 
 /**
@@ -177,6 +190,7 @@ bool LibusbDiscoverer::deinit(int stage) {
     if (stage > 0) {
         // TODO: we should probably deinit and close all connected channels
         for (auto& dev: known_devices_) {
+            cancel_open_retry(dev.second);
             libusb_unref_device(dev.second.dev);
         }
     }
@@ -328,7 +342,8 @@ int LibusbDiscoverer::on_hotplug(struct libusb_device *dev,
         // add empty placeholder to the list of known devices
         known_devices_[bus_number << 8 | dev_number] = {
             .dev = libusb_ref_device(dev),
-            .handle = nullptr
+            .handle = nullptr,
+            .parent = this
         };
 
         for (auto& subscription: subscriptions_) {
@@ -341,14 +356,24 @@ int LibusbDiscoverer::on_hotplug(struct libusb_device *dev,
         auto it = known_devices_.find(bus_number << 8 | dev_number);
 
         if (it != known_devices_.end()) {
+            cancel_open_retry(it->second);
+            if (it->second.handle) {
+                fast_polls_left_ = kReconnectWindowMs / kReconnectPollingIntervalMs;
+            }
+            // The last endpoint to finish its cancelled transfers closes the
+            // handle. The extra count keeps it open until all endpoints were
+            // asked to close.
+            ClosingHandle* closing = it->second.handle ? new ClosingHandle{it->second.handle,
+                it->second.ep_in.size() + it->second.ep_out.size() + 1} : nullptr;
+            Callback<void> on_closed = closing ? MEMBER_CB(closing, on_endpoint_closed) : Callback<void>{nullptr};
             for (auto& ep: it->second.ep_in) {
-                ep->deinit();
+                ep->deinit(on_closed);
             }
             for (auto& ep: it->second.ep_out) {
-                ep->deinit();
+                ep->deinit(on_closed);
             }
-            if (it->second.handle) {
-                libusb_close(it->second.handle);
+            if (closing) {
+                closing->on_endpoint_closed();
             }
 
             known_devices_.erase(it);
@@ -418,112 +443,216 @@ void LibusbDiscoverer::poll_devices_now() {
 
     // It's possible that the discoverer was deinited during this function.
     if (event_loop_) {
-        device_polling_timer_ = event_loop_->call_later(kPollingIntervalMs * 0.001f,
+        unsigned int interval_ms = fast_polls_left_ ? kReconnectPollingIntervalMs : kPollingIntervalMs;
+        fast_polls_left_ = fast_polls_left_ ? fast_polls_left_ - 1 : 0;
+        device_polling_timer_ = event_loop_->call_later(interval_ms * 0.001f,
             MEMBER_CB(this, poll_devices_now));
     }
 }
 
+// Identifies the port (not the device itself) and the type of a device
+static std::string get_location(struct libusb_device* device, const struct libusb_device_descriptor& dev_desc) {
+    uint8_t port_numbers[8]; // USB 3.0 allows a depth of 7
+    int n_ports = libusb_get_port_numbers(device, port_numbers, sizeof(port_numbers));
+    std::string location = std::to_string(libusb_get_bus_number(device));
+    for (int i = 0; i < n_ports; ++i) {
+        location += (i ? "." : "-") + std::to_string(port_numbers[i]);
+    }
+    char ids[12];
+    snprintf(ids, sizeof(ids), " %04x:%04x", dev_desc.idVendor, dev_desc.idProduct);
+    return location + ids;
+}
+
+bool LibusbDiscoverer::load_interfaces(struct libusb_device* device, std::vector<InterfaceInfo>* interfaces) {
+    struct libusb_config_descriptor* config_desc = nullptr;
+
+    if (libusb_get_active_config_descriptor(device, &config_desc) != LIBUSB_SUCCESS) {
+        FIBRE_LOG(E) << "Failed to get active config descriptor: " << sys_err();
+        return false;
+    }
+
+    for (uint8_t i = 0; i < config_desc->bNumInterfaces; ++i) {
+        for (int j = 0; j < config_desc->interface[i].num_altsetting; ++j) {
+            // TODO: probably we should only chose one alt setting
+            const struct libusb_interface_descriptor* intf_desc = &(config_desc->interface[i].altsetting[j]);
+            InterfaceInfo intf = {
+                .number = intf_desc->bInterfaceNumber,
+                .interface_class = intf_desc->bInterfaceClass,
+                .interface_subclass = intf_desc->bInterfaceSubClass,
+                .interface_protocol = intf_desc->bInterfaceProtocol,
+                .ep_in = 0,
+                .ep_in_max_packet_size = 0,
+                .ep_out = 0,
+                .ep_out_max_packet_size = 0
+            };
+
+            // Find one bulk IN and one bulk OUT endpoint
+            for (uint8_t k = 0; k < intf_desc->bNumEndpoints; ++k) {
+                const libusb_endpoint_descriptor* ep = &intf_desc->endpoint[k];
+                if ((ep->bmAttributes & 0x03) == LIBUSB_TRANSFER_TYPE_BULK
+                    && (ep->bEndpointAddress & 0x80) == LIBUSB_ENDPOINT_IN) {
+                    intf.ep_in = ep->bEndpointAddress;
+                    intf.ep_in_max_packet_size = ep->wMaxPacketSize;
+                } else if ((ep->bmAttributes & 0x03) == LIBUSB_TRANSFER_TYPE_BULK
+                           && (ep->bEndpointAddress & 0x80) == LIBUSB_ENDPOINT_OUT) {
+                    intf.ep_out = ep->bEndpointAddress;
+                    intf.ep_out_max_packet_size = ep->wMaxPacketSize;
+                }
+            }
+            interfaces->push_back(intf);
+        }
+    }
+
+    libusb_free_config_descriptor(config_desc);
+    return true;
+}
+
+/**
+ * @brief Opens the device and reads its serial number.
+ *
+ * With hotplug detection, a failed attempt is repeated a bit later by calling
+ * consider_device() for all subscriptions again. Without hotplug detection the
+ * next poll takes care of this.
+ */
+bool LibusbDiscoverer::open_device(Device& my_dev) {
+    int result = libusb_open(my_dev.dev, &my_dev.handle);
+    if (LIBUSB_SUCCESS != result) {
+        my_dev.handle = nullptr;
+        if (my_dev.open_retry_timer) {
+            // already scheduled
+        } else if (my_dev.n_open_retries < kMaxOpenRetries && libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG)) {
+            FIBRE_LOG(D) << "Could not open USB device yet: " << result;
+            my_dev.open_retry_timer = event_loop_->call_later(kOpenRetryIntervalMs * 0.001f,
+                MEMBER_CB(&my_dev, on_open_retry));
+        } else {
+            FIBRE_LOG(E) << "Could not open USB device: " << result;
+        }
+        return false;
+    }
+
+    struct libusb_device_descriptor dev_desc;
+    if (libusb_get_device_descriptor(my_dev.dev, &dev_desc) == LIBUSB_SUCCESS && dev_desc.iSerialNumber) {
+        unsigned char serial_number[64];
+        int length = libusb_get_string_descriptor_ascii(my_dev.handle, dev_desc.iSerialNumber, serial_number, sizeof(serial_number));
+        if (length > 0) {
+            my_dev.serial_number.assign(reinterpret_cast<char*>(serial_number), length);
+        }
+    }
+    return true;
+}
+
+void LibusbDiscoverer::on_open_retry(Device* my_dev) {
+    my_dev->open_retry_timer = nullptr;
+    my_dev->n_open_retries++;
+    for (auto& subscription: subscriptions_) {
+        consider_device(my_dev->dev, subscription);
+    }
+}
+
+void LibusbDiscoverer::cancel_open_retry(Device& my_dev) {
+    if (my_dev.open_retry_timer) {
+        event_loop_->cancel_timer(my_dev.open_retry_timer);
+        my_dev.open_retry_timer = nullptr;
+    }
+}
+
 void LibusbDiscoverer::consider_device(struct libusb_device *device, MyChannelDiscoveryContext* subscription) {
+    const InterfaceSpecs& specs = subscription->interface_specs;
     uint8_t bus_number = libusb_get_bus_number(device);
     uint8_t dev_number = libusb_get_device_address(device);
 
-    bool mismatch = (subscription->interface_specs.bus != -1 && bus_number != subscription->interface_specs.bus)
-                 || (subscription->interface_specs.address != -1 && dev_number != subscription->interface_specs.address);
+    bool mismatch = (specs.bus != -1 && bus_number != specs.bus)
+                 || (specs.address != -1 && dev_number != specs.address);
 
     if (mismatch) {
         return;
     }
 
-    if (subscription->interface_specs.vendor_id != -1 || subscription->interface_specs.product_id != -1) {
-        struct libusb_device_descriptor dev_desc;
-        int result = libusb_get_device_descriptor(device, &dev_desc);
-        if (result != LIBUSB_SUCCESS) {
-            FIBRE_LOG(W) << "Failed to get device descriptor: " << result;
-        }
+    struct libusb_device_descriptor dev_desc;
+    int result = libusb_get_device_descriptor(device, &dev_desc);
+    if (result != LIBUSB_SUCCESS) {
+        FIBRE_LOG(W) << "Failed to get device descriptor: " << result;
+        return;
+    }
 
-        mismatch = (subscription->interface_specs.vendor_id != -1 && dev_desc.idVendor != subscription->interface_specs.vendor_id)
-                || (subscription->interface_specs.product_id != -1 && dev_desc.idProduct != subscription->interface_specs.product_id);
+    mismatch = (specs.vendor_id != -1 && dev_desc.idVendor != specs.vendor_id)
+            || (specs.product_id != -1 && dev_desc.idProduct != specs.product_id);
 
-        if (mismatch) {
-            return;
-        }
+    if (mismatch) {
+        return;
     }
-    
-    struct libusb_config_descriptor* config_desc = nullptr;
-
-    if (libusb_get_active_config_descriptor(device, &config_desc) != LIBUSB_SUCCESS) {
-        FIBRE_LOG(E) << "Failed to get active config descriptor: " << sys_err();
-    } else {
-        for (uint8_t i = 0; i < config_desc->bNumInterfaces; ++i) {
-            for (int j = 0; j < config_desc->interface[i].num_altsetting; ++j) {
-                // TODO: probably we should only chose one alt setting
-                const struct libusb_interface_descriptor* intf_desc = &(config_desc->interface[i].altsetting[j]);
-
-                mismatch = (subscription->interface_specs.interface_class != -1 && intf_desc->bInterfaceClass != subscription->interface_specs.interface_class)
-                        || (subscription->interface_specs.interface_subclass != -1 && intf_desc->bInterfaceSubClass != subscription->interface_specs.interface_subclass)
-                        || (subscription->interface_specs.interface_protocol != -1 && intf_desc->bInterfaceProtocol != subscription->interface_specs.interface_protocol);
-                if (mismatch) {
-                    continue;
-                }
 
-                // We found a matching interface. Now find one bulk IN and one bulk OUT endpoint.
-                const libusb_endpoint_descriptor* libusb_ep_in = nullptr;
-                const libusb_endpoint_descriptor* libusb_ep_out = nullptr;
-                for (uint8_t k = 0; k < intf_desc->bNumEndpoints; ++k) {
-                    if ((intf_desc->endpoint[k].bmAttributes & 0x03) == LIBUSB_TRANSFER_TYPE_BULK
-                        && (intf_desc->endpoint[k].bEndpointAddress & 0x80) == LIBUSB_ENDPOINT_IN) {
-                        libusb_ep_in = &intf_desc->endpoint[k];
-                    } else if ((intf_desc->endpoint[k].bmAttributes & 0x03) == LIBUSB_TRANSFER_TYPE_BULK
-                               && (intf_desc->endpoint[k].bEndpointAddress & 0x80) == LIBUSB_ENDPOINT_OUT) {
-                        libusb_ep_out = &intf_desc->endpoint[k];
-                    }
-                }
+    // Use the interfaces of the device that was last opened on this port. The
+    // serial number is checked once the device is open.
+    std::string location = get_location(device, dev_desc);
+    auto cached = device_cache_.find(location);
+    std::vector<InterfaceInfo> interfaces;
+    if (cached != device_cache_.end()) {
+        interfaces = cached->second.interfaces;
+    } else if (!load_interfaces(device, &interfaces)) {
+        return;
+    }
 
-                Device& my_dev = known_devices_[bus_number << 8 | dev_number];
+    Device& my_dev = known_devices_[bus_number << 8 | dev_number];
 
-                // If the same device was already returned in a previous discovery
-                // then it will already be open.
+    for (const InterfaceInfo& intf: interfaces) {
+        mismatch = (specs.interface_class != -1 && intf.interface_class != specs.interface_class)
+                || (specs.interface_subclass != -1 && intf.interface_subclass != specs.interface_subclass)
+                || (specs.interface_protocol != -1 && intf.interface_protocol != specs.interface_protocol);
+        if (mismatch) {
+            continue;
+        }
 
-                if (!my_dev.handle) {
-                    int result = libusb_open(device, &my_dev.handle);
-                    if (LIBUSB_SUCCESS != result) {
-                        FIBRE_LOG(E) << "Could not open USB device: " << result;
-                        continue;
-                    }
-                }
+        // If the same device was already returned in a previous discovery
+        // then it will already be open.
 
-                int result = libusb_claim_interface(my_dev.handle, i);
-                if (LIBUSB_SUCCESS != result) {
-                    FIBRE_LOG(E) << "Could not claim interface " << i << " on USB device: " << result;
-                    continue;
+        if (!my_dev.handle) {
+            if (!open_device(my_dev)) {
+                return;
+            }
+            if (cached == device_cache_.end()) {
+                if (!my_dev.serial_number.empty()) {
+                    device_cache_[location] = {my_dev.serial_number, interfaces};
                 }
+            } else if (cached->second.serial_number != my_dev.serial_number) {
+                FIBRE_LOG(D) << "a different device is on port " << location << " now";
+                device_cache_.erase(cached);
+                consider_device(device, subscription);
+                return;
+            }
+        }
 
-                size_t mtu = SIZE_MAX;
+        result = libusb_claim_interface(my_dev.handle, intf.number);
+        if (LIBUSB_SUCCESS != result) {
+            FIBRE_LOG(E) << "Could not claim interface " << (int)intf.number << " on USB device: " << result;
+            continue;
+        }
 
-                LibusbBulkInEndpoint* ep_in = new LibusbBulkInEndpoint();
-                if (libusb_ep_in && ep_in->init(this, my_dev.handle, libusb_ep_in->bEndpointAddress)) {
-                    my_dev.ep_in.push_back(ep_in);
-                    mtu = std::min(mtu, (size_t)libusb_ep_in->wMaxPacketSize);
-                } else {
-                    delete ep_in;
-                    ep_in = nullptr;
-                }
+        size_t mtu = SIZE_MAX;
 
-                LibusbBulkOutEndpoint* ep_out = new LibusbBulkOutEndpoint();
-                if (libusb_ep_out && ep_out->init(this, my_dev.handle, libusb_ep_out->bEndpointAddress)) {
-                    my_dev.ep_out.push_back(ep_out);
-                    mtu = std::min(mtu, (size_t)libusb_ep_out->wMaxPacketSize);
-                } else {
-                    delete ep_out;
-                    ep_out = nullptr;
-                }
+        LibusbBulkInEndpoint* ep_in = new LibusbBulkInEndpoint();
+        if (intf.ep_in && ep_in->init(this, my_dev.handle, intf.ep_in, intf.ep_in_max_packet_size)) {
+            my_dev.ep_in.push_back(ep_in);
+            mtu = std::min(mtu, (size_t)intf.ep_in_max_packet_size);
+        } else {
+            delete ep_in;
+            ep_in = nullptr;
+        }
 
-                subscription->domain->add_channels({kFibreOk, ep_in, ep_out, mtu});
-            }
+        LibusbBulkOutEndpoint* ep_out = new LibusbBulkOutEndpoint();
+        if (intf.ep_out && ep_out->init(this, my_dev.handle, intf.ep_out)) {
+            my_dev.ep_out.push_back(ep_out);
+            mtu = std::min(mtu, (size_t)intf.ep_out_max_packet_size);
+        } else {
+            delete ep_out;
+            ep_out = nullptr;
         }
 
-        libusb_free_config_descriptor(config_desc);
-        config_desc = nullptr;
+        char ids[16];
+        snprintf(ids, sizeof(ids), "usb:%04x:%04x:", dev_desc.idVendor, dev_desc.idProduct);
+        std::string device_id = ids + my_dev.serial_number;
+        subscription->domain->add_channels({kFibreOk, ep_in, ep_out, mtu,
+            my_dev.serial_number.empty() ? nullptr : device_id.c_str()});
     }
 }
 
@@ -531,154 +660,289 @@ void LibusbDiscoverer::consider_device(struct libusb_device *device, MyChannelDi
 /* LibusbBulkEndpoint --------------------------------------------------------*/
 
 template<typename TRes>
-bool LibusbBulkEndpoint<TRes>::init(LibusbDiscoverer* parent, libusb_device_handle* handle, uint8_t endpoint_id) {
+bool LibusbBulkEndpoint<TRes>::init(LibusbDiscoverer* parent, libusb_device_handle* handle, uint8_t endpoint_id, size_t read_ahead_size) {
     parent_ = parent;
     handle_ = handle;
-    transfer_ = libusb_alloc_transfer(0);
     endpoint_id_ = endpoint_id;
+    read_ahead_size_ = read_ahead_size;
+
+    for (Slot& slot: slots_) {
+        slot.ep = this;
+        slot.transfer = libusb_alloc_transfer(0);
+        if (!slot.transfer) {
+            FIBRE_LOG(E) << "failed to allocate USB transfer";
+            return false;
+        }
+    }
+
+    if (read_ahead_size_) {
+        // No timeout: the transfers stay submitted until data arrives
+        for (Slot& slot: slots_) {
+            slot.buffer.resize(read_ahead_size_);
+            libusb_fill_bulk_transfer(slot.transfer, handle_, endpoint_id_,
+                slot.buffer.data(), slot.buffer.size(), nullptr, &slot, 0);
+            submit_transfer(&slot);
+        }
+    }
     return true;
 }
 
 template<typename TRes>
-bool LibusbBulkEndpoint<TRes>::deinit() {
-    if (completer_) {
-        FIBRE_LOG(E) << "Transfer on EP " << as_hex(endpoint_id_) << " still in progress. This is gonna be messy.";
+void LibusbBulkEndpoint<TRes>::deinit(Callback<void> on_closed) {
+    closing_ = true;
+    on_closed_ = on_closed;
+
+    if (read_completer_) {
+        read_completer_.invoke_and_clear({kStreamClosed, read_buffer_.begin()});
+    }
+    completed_.clear();
+
+    // Transfers that are still submitted are freed in on_transfer_finished()
+    // once libusb is done with them.
+    for (Slot& slot: slots_) {
+        if (slot.submitted) {
+            libusb_cancel_transfer(slot.transfer);
+        } else if (slot.transfer) {
+            libusb_free_transfer(slot.transfer);
+            slot.transfer = nullptr;
+        }
     }
+    maybe_finish_closing();
+}
 
-    libusb_free_transfer(transfer_);
-    transfer_ = nullptr;
-    return true;
+template<typename TRes>
+void LibusbBulkEndpoint<TRes>::maybe_finish_closing() {
+    for (Slot& slot: slots_) {
+        if (slot.transfer) {
+            return;
+        }
+    }
+    on_closed_.invoke_and_clear();
 }
 
 template<typename TRes>
 void LibusbBulkEndpoint<TRes>::start_transfer(bufptr_t buffer, TransferHandle* handle, Callback<void, TRes> completer) {
+    if (read_ahead_size_) {
+        if (handle) {
+            *handle = reinterpret_cast<TransferHandle>(this);
+        }
+        if (read_completer_) {
+            FIBRE_LOG(E) << "transfer already in progress";
+            completer.invoke({kStreamError, nullptr});
+            return;
+        }
+        read_buffer_ = buffer;
+        read_completer_ = completer;
+        deliver_read_ahead();
+        return;
+    }
+
+    Slot* slot = std::find_if(slots_, slots_ + kMaxTransfers,
+            [](Slot& s) { return !s.completer && !s.submitted; });
     if (handle) {
-        *handle = reinterpret_cast<TransferHandle>(this);
+        *handle = reinterpret_cast<TransferHandle>(slot);
     }
 
-    if (completer_) {
-        FIBRE_LOG(E) << "transfer already in progress";
+    if (slot == slots_ + kMaxTransfers) {
+        FIBRE_LOG(E) << "too many transfers in progress";
         completer.invoke({kStreamError, nullptr});
         return;
     }
 
-    if (!handle_) {
+    if (!handle_ || closing_) {
         FIBRE_LOG(E) << "device not open";
         completer.invoke({kStreamError, nullptr});
         return;
     }
 
-    auto direct_callback = [](struct libusb_transfer* transfer){
-        ((LibusbBulkEndpoint<TRes>*)transfer->user_data)->on_transfer_finished();
-    };
-
-    // This callback is used if we start our own libusb thread
-    // separate from the application's event loop thread
-    auto indirect_callback = [](struct libusb_transfer* transfer){
-        auto ep = (LibusbBulkEndpoint<TRes>*)transfer->user_data;
-        ep->parent_->event_loop_->post(MEMBER_CB(ep, on_transfer_finished));
-    };
-
     //FIBRE_LOG(D) << "transfer of size " << buffer.size();
-    libusb_fill_bulk_transfer(transfer_, handle_, endpoint_id_,
-        buffer.begin(), buffer.size(),
-        parent_->using_sparate_libusb_thread_ ? indirect_callback : direct_callback,
-        this, kBulkTimeoutMs);
-    
-    completer_ = completer;
-    submit_transfer();
+    libusb_fill_bulk_transfer(slot->transfer, handle_, endpoint_id_,
+        buffer.begin(), buffer.size(), nullptr, slot, kBulkTimeoutMs);
+
+    slot->completer = completer;
+    submit_transfer(slot);
 }
 
 template<typename TRes>
 void LibusbBulkEndpoint<TRes>::cancel_transfer(TransferHandle transfer_handle) {
-    if (!completer_) {
+    if (read_ahead_size_) {
+        // The read-ahead transfers keep running
+        if (!read_completer_) {
+            FIBRE_LOG(E) << "transfer not in progress";
+            return;
+        }
+        read_completer_.invoke_and_clear({kStreamCancelled, read_buffer_.begin()});
+        return;
+    }
+
+    Slot* slot = reinterpret_cast<Slot*>(transfer_handle);
+    if (slot < slots_ || slot >= slots_ + kMaxTransfers || !slot->completer) {
         FIBRE_LOG(E) << "transfer not in progress";
         return;
     }
 
-    libusb_cancel_transfer(transfer_);
+    libusb_cancel_transfer(slot->transfer);
 }
 
 template<typename TRes>
-void LibusbBulkEndpoint<TRes>::submit_transfer() {
-    int result = libusb_submit_transfer(transfer_);
+void LibusbBulkEndpoint<TRes>::submit_transfer(Slot* slot) {
+    auto direct_callback = [](struct libusb_transfer* transfer){
+        ((Slot*)transfer->user_data)->on_finished();
+    };
+
+    // This callback is used if we start our own libusb thread
+    // separate from the application's event loop thread
+    auto indirect_callback = [](struct libusb_transfer* transfer){
+        auto slot = (Slot*)transfer->user_data;
+        slot->ep->parent_->event_loop_->post(MEMBER_CB(slot, on_finished));
+    };
+
+    slot->transfer->callback = parent_->using_sparate_libusb_thread_ ? indirect_callback : direct_callback;
+
+    int result = libusb_submit_transfer(slot->transfer);
+    StreamStatus status;
     if (LIBUSB_SUCCESS == result) {
         // ok
         FIBRE_LOG(T) << "started USB transfer on EP " << as_hex(endpoint_id_);
+        slot->submitted = true;
+        return;
     } else if (LIBUSB_ERROR_NO_DEVICE == result) {
         FIBRE_LOG(W) << "couldn't start USB transfer on EP " << as_hex(endpoint_id_) << ": " << libusb_error_name(result);
-        completer_.invoke_and_clear({kStreamClosed, nullptr});
+        status = kStreamClosed;
     } else {
         FIBRE_LOG(W) << "couldn't start USB transfer on EP " << as_hex(endpoint_id_) << ": " << libusb_error_name(result);
-        completer_.invoke_and_clear({kStreamError, nullptr});
+        status = kStreamError;
+    }
+
+    if (read_ahead_size_) {
+        // Reported to the application on the next read. The transfer is
+        // retried after that.
+        slot->status = status;
+        slot->offset = 0;
+        slot->transfer->actual_length = 0;
+        completed_.push_back(slot);
+    } else {
+        slot->completer.invoke_and_clear({status, nullptr});
     }
 }
 
 template<typename TRes>
-void LibusbBulkEndpoint<TRes>::on_transfer_finished() {
-    // We ignore timeouts here and just retry. If the application wishes to have
-    // a timeout on the transfer it can just call cancel_transfer() after a while.
-    if (transfer_->status == LIBUSB_TRANSFER_TIMED_OUT) {
-        submit_transfer();
-        return;
-    }
-    
+StreamStatus LibusbBulkEndpoint<TRes>::get_status(Slot* slot) {
+    if (slot->transfer->status == LIBUSB_TRANSFER_COMPLETED) {
+        return kStreamOk;
+    } else if (slot->transfer->status == LIBUSB_TRANSFER_CANCELLED) {
+        return kStreamCancelled;
+    } else if (!handle_) {
+        return kStreamClosed; // another transfer already found that the device is gone
+    }
+
+    // The error that we get on device removal tends to be inaccurate.
+    // Sometimes it's LIBUSB_TRANSFER_STALL, sometimes
+    // LIBUSB_TRANSFER_ERROR. Therefore we just check if the device
+    // is still present to determine which error code to return.
+    // TODO: this detection doesn't really work. The device is still in the
+    // device list at this point when it just got unplugged. For now we
+    // just ignore transfer errors.
+
     libusb_device* dev = libusb_get_device(handle_);
+    bool found = false;
 
-    StreamStatus status;
+    libusb_device** list;
+    ssize_t n_devices = libusb_get_device_list(parent_->libusb_ctx_, &list);
 
-    if (transfer_->status == LIBUSB_TRANSFER_COMPLETED) {
-        status = kStreamOk;
-    } else if (transfer_->status == LIBUSB_TRANSFER_CANCELLED) {
-        status = kStreamCancelled;
-    } else {
-        // The error that we get on device removal tends to be inaccurate.
-        // Sometimes it's LIBUSB_TRANSFER_STALL, sometimes
-        // LIBUSB_TRANSFER_ERROR. Therefore we just check if the device
-        // is still present to determine which error code to return.
-        // TODO: this detection doesn't really work. The device is still in the
-        // device list at this point when it just got unplugged. For now we
-        // just ignore transfer errors.
-
-        bool found = false;
-
-        libusb_device** list;
-        ssize_t n_devices = libusb_get_device_list(parent_->libusb_ctx_, &list);
-
-        if (n_devices >= 0) {
-            for (size_t i = 0; i < (size_t)n_devices; ++i) {
-                if (list[i] == dev) {
-                    // found = true;
-                    break;
-                }
+    if (n_devices >= 0) {
+        for (size_t i = 0; i < (size_t)n_devices; ++i) {
+            if (list[i] == dev) {
+                // found = true;
+                break;
             }
-            libusb_free_device_list(list, 1);
         }
+        libusb_free_device_list(list, 1);
+    }
 
-        if (found) {
-            status = kStreamError;
-        } else {
-            FIBRE_LOG(D) << "device removed during transfer";
-            status = kStreamClosed;
-        }
+    if (found) {
+        return kStreamError;
+    } else {
+        FIBRE_LOG(D) << "device removed during transfer";
+        return kStreamClosed;
+    }
+}
+
+template<typename TRes>
+void LibusbBulkEndpoint<TRes>::on_transfer_finished(Slot* slot) {
+    slot->submitted = false;
+
+    if (closing_) {
+        libusb_free_transfer(slot->transfer);
+        slot->transfer = nullptr;
+        slot->completer.invoke_and_clear({kStreamClosed, nullptr});
+        maybe_finish_closing();
+        return;
+    }
+
+    // We ignore timeouts here and just retry. If the application wishes to have
+    // a timeout on the transfer it can just call cancel_transfer() after a while.
+    if (slot->transfer->status == LIBUSB_TRANSFER_TIMED_OUT) {
+        submit_transfer(slot);
+        return;
     }
 
+    libusb_device* dev = handle_ ? libusb_get_device(handle_) : nullptr;
+    StreamStatus status = get_status(slot);
+
     (status == kStreamError ? FIBRE_LOG(W) : FIBRE_LOG(T))
-        << "USB transfer on EP " << as_hex(endpoint_id_) << " finished with " << libusb_error_name(transfer_->status);
+        << "USB transfer on EP " << as_hex(endpoint_id_) << " finished with " << libusb_error_name(slot->transfer->status);
 
+    bool device_removed = status == kStreamClosed && handle_;
     if (status == kStreamClosed) {
         handle_ = nullptr; // Ensure that no new transfer is started
     }
 
-    uint8_t* end = std::max(transfer_->buffer + transfer_->actual_length, transfer_->buffer);
-    completer_.invoke_and_clear({status, end});
-    
+    if (read_ahead_size_) {
+        slot->status = status;
+        slot->offset = 0;
+        completed_.push_back(slot);
+        deliver_read_ahead();
+    } else {
+        uint8_t* end = std::max(slot->transfer->buffer + slot->transfer->actual_length, slot->transfer->buffer);
+        slot->completer.invoke_and_clear({status, end});
+    }
+
     // If libusb does hotplug detection itself then we don't need to handle
     // device removal here. Libusb will call the corresponding hotplug callback.
-    if (status == kStreamClosed && !parent_->hotplug_callback_handle_) {
+    if (device_removed && !parent_->hotplug_callback_handle_) {
         if (!parent_->using_sparate_libusb_thread_) {
             FIBRE_LOG(E) << "It's not a good idea to unref the device from within this callback. This will probably hang.";
         }
         parent_->on_hotplug(dev, LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT);
     }
 }
+
+template<typename TRes>
+void LibusbBulkEndpoint<TRes>::deliver_read_ahead() {
+    if (!read_completer_ || completed_.empty()) {
+        return;
+    }
+
+    Slot* slot = completed_.front();
+    size_t n_copy = 0;
+
+    if (slot->status == kStreamOk) {
+        size_t available = std::max(slot->transfer->actual_length, 0) - slot->offset;
+        n_copy = std::min(read_buffer_.size(), available);
+        memcpy(read_buffer_.begin(), slot->buffer.data() + slot->offset, n_copy);
+        slot->offset += n_copy;
+        if (n_copy < available) {
+            // The rest goes to the next read
+            read_completer_.invoke_and_clear({kStreamOk, read_buffer_.begin() + n_copy});
+            return;
+        }
+    }
+
+    completed_.pop_front();
+    StreamStatus status = slot->status;
+    if (handle_ && !closing_ && status != kStreamCancelled) {
+        submit_transfer(slot);
+    }
+    read_completer_.invoke_and_clear({status, read_buffer_.begin() + n_copy});
+}
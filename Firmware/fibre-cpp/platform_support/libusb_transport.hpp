@@ -8,7 +8,9 @@
 #include <libusb.h>
 #include <thread>
 #include <vector>
+#include <deque>
 #include <unordered_map>
+#include <string>
 
 namespace fibre {
 
@@ -45,11 +47,51 @@ private:
     friend class LibusbBulkEndpoint<ReadResult>;
     friend class LibusbBulkEndpoint<WriteResult>;
 
+    // The parts of the descriptors of an interface that consider_device() needs
+    struct InterfaceInfo {
+        uint8_t number;
+        uint8_t interface_class;
+        uint8_t interface_subclass;
+        uint8_t interface_protocol;
+        uint8_t ep_in; // 0 if the interface has no bulk IN endpoint
+        uint16_t ep_in_max_packet_size;
+        uint8_t ep_out; // 0 if the interface has no bulk OUT endpoint
+        uint16_t ep_out_max_packet_size;
+    };
+
+    // Interfaces of a device that was opened before. A device that comes back
+    // on the same port with the same serial number (e.g. after a reboot)
+    // doesn't need its config descriptor read and parsed again.
+    struct CachedDevice {
+        std::string serial_number;
+        std::vector<InterfaceInfo> interfaces;
+    };
+
     struct Device {
         struct libusb_device* dev;
         struct libusb_device_handle* handle;
         std::vector<LibusbBulkInEndpoint*> ep_in;
         std::vector<LibusbBulkOutEndpoint*> ep_out;
+        LibusbDiscoverer* parent;
+        std::string serial_number; // read once the device is open
+        EventLoopTimer* open_retry_timer;
+        unsigned n_open_retries;
+
+        void on_open_retry() { parent->on_open_retry(this); }
+    };
+
+    // Handle of a device that left. libusb must not close it before the
+    // cancelled transfers of its endpoints have finished.
+    struct ClosingHandle {
+        struct libusb_device_handle* handle;
+        size_t n_open_endpoints;
+
+        void on_endpoint_closed() {
+            if (--n_open_endpoints == 0) {
+                libusb_close(handle);
+                delete this;
+            }
+        }
     };
 
     bool deinit(int stage);
@@ -61,6 +103,10 @@ private:
     int on_hotplug(struct libusb_device *dev, libusb_hotplug_event event);
     void poll_devices_now();
     void consider_device(struct libusb_device *device, MyChannelDiscoveryContext* subscription);
+    static bool load_interfaces(struct libusb_device* device, std::vector<InterfaceInfo>* interfaces);
+    bool open_device(Device& my_dev);
+    void on_open_retry(Device* my_dev);
+    void cancel_open_retry(Device& my_dev);
 
     EventLoop* event_loop_ = nullptr;
     bool using_sparate_libusb_thread_; // true on Windows. Initialized in init()
@@ -71,28 +117,70 @@ private:
     EventLoopTimer* device_polling_timer_;
     EventLoopTimer* event_loop_timer_ = nullptr;
     std::unordered_map<uint16_t, Device> known_devices_; // key: bus_number << 8 | dev_number
+    std::unordered_map<std::string, CachedDevice> device_cache_; // key: see get_location()
+    unsigned fast_polls_left_ = 0; // polls at kReconnectPollingIntervalMs after an open device was lost
     std::vector<MyChannelDiscoveryContext*> subscriptions_;
 };
 
+/**
+ * @brief Bulk endpoint with a pool of kMaxTransfers libusb transfers.
+ *
+ * Without read-ahead, up to kMaxTransfers application transfers can be in
+ * flight at the same time.
+ *
+ * With read-ahead (used for IN endpoints) all transfers are kept submitted
+ * into internal buffers so that the device never waits for the host to
+ * resubmit. start_transfer() copies the data of one completed transfer (or
+ * the rest of it if the previous read didn't take all) into the application
+ * buffer. A transfer is only resubmitted after all its data was read.
+ */
 template<typename TRes>
 class LibusbBulkEndpoint {
 public:
-    bool init(LibusbDiscoverer* parent, struct libusb_device_handle* handle, uint8_t endpoint_id);
-    bool deinit();
+    bool init(LibusbDiscoverer* parent, struct libusb_device_handle* handle, uint8_t endpoint_id, size_t read_ahead_size = 0);
+
+    /**
+     * @brief Cancels all transfers. on_closed is invoked once libusb has
+     * reported all of them as finished, which may be right away.
+     */
+    void deinit(Callback<void> on_closed);
 
 protected:
     void start_transfer(bufptr_t buffer, TransferHandle* handle, Callback<void, TRes> completer);
     void cancel_transfer(TransferHandle transfer_handle);
 
 private:
-    void submit_transfer();
-    void on_transfer_finished();
+    static constexpr size_t kMaxTransfers = 4;
+
+    struct Slot {
+        LibusbBulkEndpoint* ep = nullptr;
+        struct libusb_transfer* transfer = nullptr;
+        Callback<void, TRes> completer = nullptr; // application transfer, not used with read-ahead
+        bool submitted = false;
+        std::vector<uint8_t> buffer; // read-ahead buffer
+        size_t offset = 0; // bytes of the completed read-ahead transfer that were read
+        StreamStatus status = kStreamOk; // result of the completed read-ahead transfer
+
+        void on_finished() { ep->on_transfer_finished(this); }
+    };
+
+    void submit_transfer(Slot* slot);
+    void on_transfer_finished(Slot* slot);
+    StreamStatus get_status(Slot* slot);
+    void deliver_read_ahead();
+    void maybe_finish_closing();
 
     LibusbDiscoverer* parent_ = nullptr;
     struct libusb_device_handle* handle_ = nullptr;
     uint8_t endpoint_id_ = 0;
-    struct libusb_transfer* transfer_ = nullptr;
-    Callback<void, TRes> completer_ = nullptr;
+    bool closing_ = false; // deinit() was called, transfers are freed as they finish
+    Callback<void> on_closed_ = nullptr; // of deinit(), invoked once all transfers are freed
+    Slot slots_[kMaxTransfers];
+
+    size_t read_ahead_size_ = 0; // 0 to disable read-ahead
+    std::deque<Slot*> completed_; // read-ahead transfers in the order they finished
+    bufptr_t read_buffer_; // application read waiting for read-ahead data
+    Callback<void, TRes> read_completer_ = nullptr;
 };
 
 class LibusbBulkInEndpoint final : public LibusbBulkEndpoint<ReadResult>, public AsyncStreamSource {
@@ -4,6 +4,7 @@
 #include "../print_utils.hpp"
 
 #include <errno.h>
+#include <string.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <sys/types.h>
@@ -163,11 +164,11 @@ bool fibre::start_connecting(EventLoop* event_loop, cbufptr_t addr, int type, in
         goto fail0;
     }
    
-    if (connect(context->socket_id, the_addr, addr.size()) == 0) {
-        if (errno != EINPROGRESS) {
-            FIBRE_LOG(E) << "connect() failed: " << sock_err();
-            goto fail1;
-        }
+    // Connection-oriented sockets usually return EINPROGRESS, connectionless
+    // sockets are connected immediately.
+    if (connect(context->socket_id, the_addr, addr.size()) != 0 && errno != EINPROGRESS) {
+        FIBRE_LOG(E) << "connect() failed: " << sock_err();
+        goto fail1;
     }
 
     if (!event_loop->register_event(context->socket_id, EPOLLOUT, MEMBER_CB(context, on_connection_complete))) {
@@ -272,6 +273,54 @@ void fibre::stop_listening(ConnectionContext* ctx) {
     stop_connecting(ctx); // same implementation
 }
 
+bool fibre::start_binding(EventLoop* event_loop, cbufptr_t addr, int type, int protocol, ConnectionContext** ctx, Callback<void, std::optional<socket_id_t>> on_connected) {
+    auto the_addr = reinterpret_cast<const struct sockaddr*>(addr.begin());
+    int flag = 1;
+
+    ConnectionContext* context = new ConnectionContext();
+    context->event_loop = event_loop;
+    context->socket_id = socket(the_addr->sa_family, type | SOCK_NONBLOCK, protocol);
+    context->callback = on_connected;
+
+    if (IS_INVALID_SOCKET(context->socket_id)) {
+        FIBRE_LOG(E) << "failed to open socket: " << sock_err();
+        goto fail0;
+    }
+
+    if (setsockopt(context->socket_id, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag))) {
+        FIBRE_LOG(E) << "failed to make socket reuse addresses: " << sock_err();
+        goto fail1;
+    }
+
+    if (bind(context->socket_id, the_addr, addr.size())) {
+        FIBRE_LOG(E) << "failed to bind socket: " << sock_err();
+        goto fail1;
+    }
+
+    // The socket is writable straight away so this completes on the next
+    // event loop iteration, same as a connection attempt.
+    if (!event_loop->register_event(context->socket_id, EPOLLOUT, MEMBER_CB(context, on_connection_complete))) {
+        FIBRE_LOG(E) << "failed to register event: " << sock_err();
+        goto fail1;
+    }
+
+    if (ctx) {
+        *ctx = context;
+    }
+
+    return true;
+
+fail1:
+    close(context->socket_id);
+fail0:
+    delete context;
+    return false;
+}
+
+void fibre::stop_binding(ConnectionContext* ctx) {
+    stop_connecting(ctx); // same implementation
+}
+
 void fibre::ConnectionContext::on_accept(uint32_t mask) {
     struct sockaddr_storage remote_addr;
     socklen_t slen = sizeof(remote_addr);
@@ -306,6 +355,16 @@ bool PosixSocket::init(EventLoop* event_loop, socket_id_t socket_id) {
     //    return false;
     //}
 
+    // Connected sockets keep their remote address. Unconnected datagram
+    // sockets reply to whoever sent the latest datagram.
+    remote_addr_len_ = sizeof(remote_addr_);
+    if (getpeername(socket_id, reinterpret_cast<struct sockaddr*>(&remote_addr_), &remote_addr_len_) == 0) {
+        is_connected_ = true;
+    } else {
+        remote_addr_len_ = 0;
+        is_connected_ = false;
+    }
+
     event_loop_ = event_loop;
     socket_id_ = socket_id;
     return true;
@@ -318,6 +377,12 @@ bool PosixSocket::deinit() {
     }
 
     bool result = true;
+    if (mask_ && !event_loop_->deregister_event(socket_id_)) {
+        FIBRE_LOG(E) << "failed to deregister socket event";
+        result = false;
+    }
+    mask_ = 0;
+
     if (::close(socket_id_)) {
         FIBRE_LOG(E) << "close() failed: " << sock_err();
         result = false;
@@ -395,10 +460,15 @@ std::optional<ReadResult> PosixSocket::read_sync(bufptr_t buffer) {
         FIBRE_LOG(W) << "empty buffer not permitted";
     }
 
-    socklen_t slen = sizeof(remote_addr_);
+    struct sockaddr_storage src_addr;
+    socklen_t slen = sizeof(src_addr);
     ssize_t n_received = recvfrom(socket_id_, buffer.begin(), buffer.size(),
-            MSG_DONTWAIT, reinterpret_cast<struct sockaddr *>(&remote_addr_), &slen);
-    
+            MSG_DONTWAIT, reinterpret_cast<struct sockaddr *>(&src_addr), &slen);
+    if (n_received > 0 && !is_connected_) {
+        remote_addr_ = src_addr;
+        remote_addr_len_ = slen;
+    }
+
     if (n_received < 0) {
         // If recvfrom returns -1 an errno is set to indicate the error.
         auto err = sock_err{};
@@ -429,8 +499,13 @@ std::optional<WriteResult> PosixSocket::write_sync(cbufptr_t buffer) {
         FIBRE_LOG(W) << "empty buffer not permitted";
     }
 
-    int n_sent = sendto(socket_id_, buffer.begin(), buffer.size(), MSG_DONTWAIT,
-            reinterpret_cast<struct sockaddr*>(&remote_addr_), sizeof(remote_addr_));
+    // The buffer is passed straight to the kernel without copying. Connected
+    // sockets must not be given a destination address.
+    ssize_t n_sent = is_connected_
+            ? send(socket_id_, buffer.begin(), buffer.size(), MSG_DONTWAIT | MSG_NOSIGNAL)
+            : sendto(socket_id_, buffer.begin(), buffer.size(), MSG_DONTWAIT | MSG_NOSIGNAL,
+                     remote_addr_len_ ? reinterpret_cast<struct sockaddr*>(&remote_addr_) : nullptr,
+                     remote_addr_len_);
     if (n_sent < 0) {
         // If sendto returns -1 an errno is set to indicate the error.
         auto err = sock_err{};
@@ -101,6 +101,19 @@ void stop_connecting(ConnectionContext* ctx);
 bool start_listening(EventLoop* event_loop, cbufptr_t addr, int type, int protocol, ConnectionContext** ctx, Callback<void, std::optional<socket_id_t>> on_connected);
 void stop_listening(ConnectionContext* ctx);
 
+/**
+ * @brief Opens a socket that is bound to the specified local address but not
+ * connected to any remote address. This is the connectionless counterpart of
+ * start_listening() and is meant for datagram sockets.
+ *
+ * The parameters are the same as for start_listening(), except that
+ * `on_connected` is called only once, as soon as the socket is ready. Data
+ * written to the socket goes to the origin of the most recently received
+ * datagram.
+ */
+bool start_binding(EventLoop* event_loop, cbufptr_t addr, int type, int protocol, ConnectionContext** ctx, Callback<void, std::optional<socket_id_t>> on_connected);
+void stop_binding(ConnectionContext* ctx);
+
 /**
  * @brief AsyncStreamSource and AsyncStreamSink based on a Posix or WinSock
  * socket ID.
@@ -154,7 +167,9 @@ private:
 
     int socket_id_ = INVALID_SOCKET;
     EventLoop* event_loop_ = nullptr;
-    struct sockaddr_storage remote_addr_ = {0}; // updated after each RX event
+    bool is_connected_ = false; // false for unconnected datagram sockets
+    struct sockaddr_storage remote_addr_ = {0}; // updated after each RX event if not connected
+    socklen_t remote_addr_len_ = 0; // 0 if remote_addr_ is not yet known
     uint32_t mask_ = 0; // current event subscription mask
     bufptr_t rx_buf_{}; // valid while there is an RX request pending
     cbufptr_t tx_buf_{}; // valid while there is a TX request pending
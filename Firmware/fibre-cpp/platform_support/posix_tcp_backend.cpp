@@ -5,6 +5,7 @@
 #include <fibre/fibre.hpp>
 #include <signal.h>
 #include <unistd.h>
+#include <netinet/tcp.h>
 #include <algorithm>
 #include <string.h>
 
@@ -95,7 +96,7 @@ void PosixTcpBackend::TcpChannelDiscoveryContext::on_found_address(std::optional
 
         if (!is_known) {
             AddrContext ctx = {.addr = vec};
-            if (parent->start_opening_connections(parent->event_loop_, *addr, SOCK_STREAM, IPPROTO_TCP, &ctx.connection_ctx, MEMBER_CB(this, on_connected))) {
+            if (parent->start_opening_connections(parent->event_loop_, *addr, parent->type_, parent->protocol_, &ctx.connection_ctx, MEMBER_CB(this, on_connected))) {
                 known_addresses.push_back(ctx);
             } else {
                 // TODO
@@ -118,9 +119,18 @@ void PosixTcpBackend::TcpChannelDiscoveryContext::on_found_address(std::optional
 
 void PosixTcpBackend::TcpChannelDiscoveryContext::on_connected(std::optional<socket_id_t> socket_id) {
     if (socket_id.has_value()) {
+        // The protocol sends small request/response packets and waits for the
+        // response, so Nagle's algorithm would only add latency. It would also
+        // merge packets that the remote side expects to receive one by one.
+        int flag = 1;
+        if (parent->protocol_ == IPPROTO_TCP
+                && setsockopt(*socket_id, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag)) != 0) {
+            FIBRE_LOG(W) << "failed to set TCP_NODELAY: " << sys_err();
+        }
+
         auto socket = new PosixSocket{}; // TODO: free
         if (socket->init(parent->event_loop_, *socket_id)) {
-            domain->add_channels({kFibreOk, socket, socket, SIZE_MAX});
+            domain->add_channels({kFibreOk, socket, socket, parent->mtu_});
             return;
         }
         delete socket;
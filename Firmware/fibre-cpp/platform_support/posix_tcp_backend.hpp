@@ -6,6 +6,8 @@
 #include <fibre/channel_discoverer.hpp>
 #include <string>
 #include <netdb.h>
+#include <sys/socket.h>
+#include <stdint.h>
 
 namespace fibre {
 
@@ -14,9 +16,16 @@ namespace fibre {
  * that is used to convert an address to one or more connected socket IDs.
  * The client uses the posix function `connect` to do so, while the server uses
  * the posix functions `listen` and `accept`.
+ *
+ * The UDP backends share the same implementation but open datagram sockets,
+ * so that each packet of the protocol maps to one datagram. This avoids
+ * head-of-line blocking when streaming setpoints over a lossy network.
  */
 class PosixTcpBackend : public ChannelDiscoverer {
 public:
+    PosixTcpBackend(int type = SOCK_STREAM, int protocol = IPPROTO_TCP, size_t mtu = SIZE_MAX)
+        : type_(type), protocol_(protocol), mtu_(mtu) {}
+
     bool init(EventLoop* event_loop);
     bool deinit();
 
@@ -49,6 +58,9 @@ private:
 
     EventLoop* event_loop_ = nullptr;
     size_t n_discoveries_ = 0;
+    int type_; // socket type, e.g. SOCK_STREAM
+    int protocol_; // e.g. IPPROTO_TCP
+    size_t mtu_; // MTU of the channels or SIZE_MAX for streams
 };
 
 class PosixTcpClientBackend : public PosixTcpBackend {
@@ -75,6 +87,37 @@ public:
     }
 };
 
+// Payload of one UDP datagram that fits into an Ethernet frame
+constexpr size_t kUdpMtu = 1472;
+
+class PosixUdpClientBackend : public PosixTcpBackend {
+public:
+    PosixUdpClientBackend() : PosixTcpBackend(SOCK_DGRAM, IPPROTO_UDP, kUdpMtu) {}
+
+    constexpr static const char* get_name() { return "udp-client"; }
+
+    bool start_opening_connections(EventLoop* event_loop, cbufptr_t addr, int type, int protocol, ConnectionContext** ctx, Callback<void, std::optional<socket_id_t>> on_connected) final {
+        return start_connecting(event_loop, addr, type, protocol, ctx, on_connected);
+    }
+    void cancel_opening_connections(ConnectionContext* ctx) final {
+        stop_connecting(ctx);
+    }
+};
+
+class PosixUdpServerBackend : public PosixTcpBackend {
+public:
+    PosixUdpServerBackend() : PosixTcpBackend(SOCK_DGRAM, IPPROTO_UDP, kUdpMtu) {}
+
+    constexpr static const char* get_name() { return "udp-server"; }
+
+    bool start_opening_connections(EventLoop* event_loop, cbufptr_t addr, int type, int protocol, ConnectionContext** ctx, Callback<void, std::optional<socket_id_t>> on_connected) final {
+        return start_binding(event_loop, addr, type, protocol, ctx, on_connected);
+    }
+    void cancel_opening_connections(ConnectionContext* ctx) final {
+        stop_binding(ctx);
+    }
+};
+
 }
 
 #endif // __FIBRE_POSIX_TCP_BACKEND_HPP
\ No newline at end of file
@@ -0,0 +1,430 @@
+#include "socket_can_backend.hpp"
+#include "../logging.hpp"
+#include <fibre/fibre.hpp>
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+
+DEFINE_LOG_TOPIC(CAN);
+USE_LOG_TOPIC(CAN);
+
+using namespace fibre;
+
+// CANSimple message IDs are (node_id << 5) | cmd_id
+constexpr unsigned int kNodeIdShift = 5;
+constexpr canid_t kCmdIdMask = 0x1f;
+constexpr canid_t kHeartbeatCmdId = 0x01; // CANSimple::MSG_ODRIVE_HEARTBEAT
+constexpr canid_t kFibreCmdId = 0x1f; // CANSimple::MSG_FIBRE
+
+// An ODrive is considered lost if it didn't send a heartbeat for this long.
+// The default heartbeat interval is 100ms.
+constexpr uint32_t kPresenceTimeoutMs = 3000;
+
+// Interval for reopening the socket if the interface is not available and for
+// checking the presence of the known ODrives.
+constexpr float kTimerInterval = 0.5f;
+
+static uint32_t now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+bool SocketCanBackend::init(EventLoop* event_loop) {
+    if (event_loop_) {
+        FIBRE_LOG(E) << "already initialized";
+        return false;
+    }
+    event_loop_ = event_loop;
+    return true;
+}
+
+bool SocketCanBackend::deinit() {
+    if (!event_loop_) {
+        FIBRE_LOG(E) << "not initialized";
+        return false;
+    }
+    if (n_discoveries_) {
+        FIBRE_LOG(W) << "some discoveries still ongoing";
+    }
+    event_loop_ = nullptr;
+    return true;
+}
+
+void SocketCanBackend::start_channel_discovery(Domain* domain, const char* specs, size_t specs_len, ChannelDiscoveryContext** handle) {
+    const char* interface_begin;
+    const char* interface_end;
+    int val;
+
+    if (!event_loop_) {
+        FIBRE_LOG(E) << "not initialized";
+        return; // TODO: error reporting
+    }
+
+    if (!try_parse_key(specs, specs + specs_len, "interface", &interface_begin, &interface_end)) {
+        FIBRE_LOG(E) << "no interface specified";
+        return; // TODO: error reporting
+    }
+
+    CanChannelDiscoveryContext* ctx = new CanChannelDiscoveryContext(); // deleted in stop_channel_discovery()
+    ctx->parent = this;
+    ctx->domain = domain;
+    ctx->interface_name = {interface_begin, interface_end};
+    if (try_parse_key(specs, specs + specs_len, "node_id", &val)) {
+        ctx->selected_node_id = val;
+    }
+    if (try_parse_key(specs, specs + specs_len, "response_node_id", &val)) {
+        ctx->selected_response_node_id = val;
+    }
+    if (try_parse_key(specs, specs + specs_len, "extended", &val)) {
+        ctx->is_extended = val;
+    }
+
+    n_discoveries_++;
+    if (handle) {
+        *handle = ctx;
+    }
+    ctx->on_timer(); // opens the socket
+}
+
+int SocketCanBackend::stop_channel_discovery(ChannelDiscoveryContext* handle) {
+    CanChannelDiscoveryContext* ctx = static_cast<CanChannelDiscoveryContext*>(handle);
+    if (!ctx) {
+        return -1;
+    }
+
+    if (ctx->timer) {
+        event_loop_->cancel_timer(ctx->timer);
+        ctx->timer = nullptr;
+    }
+    ctx->close_socket();
+    for (auto& it: ctx->nodes) {
+        delete it.second;
+    }
+    delete ctx;
+
+    n_discoveries_--;
+    return 0;
+}
+
+/* CanChannelDiscoveryContext ------------------------------------------------*/
+
+bool SocketCanBackend::CanChannelDiscoveryContext::open_socket() {
+    unsigned int if_index = if_nametoindex(interface_name.c_str());
+    if (!if_index) {
+        FIBRE_LOG(D) << "interface " << interface_name << " not found";
+        return false;
+    }
+
+    int sock = socket(PF_CAN, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, CAN_RAW);
+    if (sock < 0) {
+        FIBRE_LOG(E) << "failed to open CAN socket: " << sys_err();
+        return false;
+    }
+
+    // Only receive heartbeat and fibre frames of the selected ID length
+    canid_t flags = is_extended ? CAN_EFF_FLAG : 0;
+    struct can_filter filters[] = {
+        {kHeartbeatCmdId | flags, kCmdIdMask | CAN_EFF_FLAG | CAN_RTR_FLAG},
+        {kFibreCmdId | flags, kCmdIdMask | CAN_EFF_FLAG | CAN_RTR_FLAG},
+    };
+
+    struct sockaddr_can addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.can_family = AF_CAN;
+    addr.can_ifindex = if_index;
+
+    if (setsockopt(sock, SOL_CAN_RAW, CAN_RAW_FILTER, filters, sizeof(filters)) != 0
+            || bind(sock, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+        FIBRE_LOG(E) << "failed to set up CAN socket on " << interface_name << ": " << sys_err();
+        ::close(sock);
+        return false;
+    }
+
+    if (!parent->event_loop_->register_event(sock, EPOLLIN, MEMBER_CB(this, on_event))) {
+        FIBRE_LOG(E) << "failed to register CAN socket";
+        ::close(sock);
+        return false;
+    }
+
+    FIBRE_LOG(D) << "listening on " << interface_name;
+    socket_id = sock;
+    return true;
+}
+
+void SocketCanBackend::CanChannelDiscoveryContext::close_socket() {
+    for (auto& it: nodes) {
+        it.second->close();
+    }
+    if (socket_id >= 0) {
+        parent->event_loop_->deregister_event(socket_id);
+        ::close(socket_id);
+        socket_id = -1;
+    }
+}
+
+void SocketCanBackend::CanChannelDiscoveryContext::on_timer() {
+    timer = nullptr;
+
+    if (socket_id >= 0 || open_socket()) {
+        uint32_t now = now_ms();
+        for (auto& it: nodes) {
+            it.second->check_presence(now);
+        }
+    }
+
+    timer = parent->event_loop_->call_later(kTimerInterval, MEMBER_CB(this, on_timer));
+}
+
+void SocketCanBackend::CanChannelDiscoveryContext::on_event(uint32_t mask) {
+    struct can_frame frame;
+
+    for (;;) {
+        ssize_t n_received = read(socket_id, &frame, sizeof(frame));
+        if (n_received < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                // e.g. the interface went down. Reopened by on_timer().
+                FIBRE_LOG(W) << "CAN interface " << interface_name << " failed: " << sys_err();
+                close_socket();
+            }
+            return;
+        }
+        if (n_received != sizeof(frame) || frame.can_dlc > 8) {
+            continue;
+        }
+
+        uint32_t now = now_ms();
+        can_Message_t msg;
+        msg.id = frame.can_id & (is_extended ? CAN_EFF_MASK : CAN_SFF_MASK);
+        msg.isExt = is_extended;
+        msg.rtr = false;
+        msg.len = frame.can_dlc;
+        memcpy(msg.buf, frame.data, msg.len);
+
+        uint32_t sender = msg.id >> kNodeIdShift;
+        if ((msg.id & kCmdIdMask) == kHeartbeatCmdId) {
+            on_heartbeat(sender, now);
+            continue;
+        }
+
+        for (auto& it: nodes) {
+            if (it.second->response_node_id() == sender) {
+                it.second->on_frame(msg, now);
+                break;
+            }
+        }
+    }
+}
+
+void SocketCanBackend::CanChannelDiscoveryContext::on_heartbeat(uint32_t sender, uint32_t now) {
+    bool mismatch = (selected_node_id >= 0) ? (sender != (uint32_t)selected_node_id) : (sender % 2);
+    if (mismatch) {
+        return; // not axis0 of an ODrive that we're looking for
+    }
+
+    auto it = nodes.find(sender);
+    if (it == nodes.end()) {
+        uint32_t response_node_id = (selected_response_node_id >= 0) ? selected_response_node_id : sender + 1;
+        it = nodes.emplace(sender, new Node(this, sender, response_node_id)).first;
+    }
+    it->second->on_heartbeat(now);
+}
+
+bool SocketCanBackend::CanChannelDiscoveryContext::send(const can_Message_t& msg) {
+    if (socket_id < 0) {
+        return false;
+    }
+    struct can_frame frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.can_id = msg.id | (msg.isExt ? CAN_EFF_FLAG : 0);
+    frame.can_dlc = msg.len;
+    memcpy(frame.data, msg.buf, msg.len);
+    // Fails with ENOBUFS if the TX queue of the interface is full
+    return write(socket_id, &frame, sizeof(frame)) == sizeof(frame);
+}
+
+/* Node ----------------------------------------------------------------------*/
+
+SocketCanBackend::Node::~Node() {
+    close();
+    if (service_timer_) {
+        ctx_->parent->event_loop_->cancel_timer(service_timer_);
+        service_timer_ = nullptr;
+    }
+}
+
+void SocketCanBackend::Node::on_heartbeat(uint32_t now) {
+    last_seen_ = now;
+    if (!is_open_) {
+        open();
+    }
+}
+
+void SocketCanBackend::Node::on_frame(const can_Message_t& msg, uint32_t now) {
+    last_seen_ = now;
+    if (is_open_) {
+        link_.on_frame(msg, now);
+        service();
+    }
+}
+
+void SocketCanBackend::Node::check_presence(uint32_t now) {
+    if (is_open_ && now - last_seen_ > kPresenceTimeoutMs) {
+        FIBRE_LOG(D) << "lost ODrive with node ID " << node_id_ << " on " << ctx_->interface_name;
+        close();
+    }
+}
+
+void SocketCanBackend::Node::open() {
+    FIBRE_LOG(D) << "found ODrive with node ID " << node_id_ << " on " << ctx_->interface_name;
+    is_open_ = true;
+    link_ = CanSegmentedLink<kMtu>{};
+
+    char device_id[64];
+    snprintf(device_id, sizeof(device_id), "can:%s:%u", ctx_->interface_name.c_str(), (unsigned)node_id_);
+    ctx_->domain->add_channels({kFibreOk, this, this, kMtu, device_id});
+}
+
+void SocketCanBackend::Node::close() {
+    if (!is_open_) {
+        return;
+    }
+    is_open_ = false;
+    link_ = CanSegmentedLink<kMtu>{};
+
+    // The protocol cancels its write operation (if any) and stops
+    if (rx_completer_) {
+        uint8_t* rx_end = rx_buf_.begin();
+        rx_buf_ = {nullptr, nullptr};
+        rx_completer_.invoke_and_clear({kStreamClosed, rx_end});
+    }
+    if (tx_completer_) {
+        const uint8_t* tx_end = tx_buf_.begin();
+        tx_buf_ = {nullptr, nullptr};
+        tx_completer_.invoke_and_clear({kStreamClosed, tx_end});
+    }
+}
+
+void SocketCanBackend::Node::start_read(bufptr_t buffer, TransferHandle* handle, Callback<void, ReadResult> completer) {
+    if (handle) {
+        *handle = reinterpret_cast<TransferHandle>(this);
+    }
+    if (!is_open_) {
+        completer.invoke({kStreamClosed, buffer.begin()});
+        return;
+    }
+    if (rx_completer_) {
+        completer.invoke({kStreamError, buffer.begin()});
+        return;
+    }
+    rx_buf_ = buffer;
+    rx_completer_ = completer;
+    service(); // a packet may already be waiting
+}
+
+void SocketCanBackend::Node::cancel_read(TransferHandle transfer_handle) {
+    if (rx_completer_) {
+        uint8_t* rx_end = rx_buf_.begin();
+        rx_buf_ = {nullptr, nullptr};
+        rx_completer_.invoke_and_clear({kStreamCancelled, rx_end});
+    }
+}
+
+void SocketCanBackend::Node::start_write(cbufptr_t buffer, TransferHandle* handle, Callback<void, WriteResult> completer) {
+    if (handle) {
+        *handle = reinterpret_cast<TransferHandle>(this);
+    }
+    if (!is_open_ || tx_completer_ || !link_.tx_start(buffer.begin(), buffer.size(), now_ms())) {
+        completer.invoke({kStreamError, buffer.begin()});
+        return;
+    }
+    tx_buf_ = buffer;
+    tx_completer_ = completer;
+    service();
+}
+
+void SocketCanBackend::Node::cancel_write(TransferHandle transfer_handle) {
+    if (tx_completer_) {
+        // The receiver discards the incomplete packet after its timeout
+        link_.tx_abort();
+        const uint8_t* tx_end = tx_buf_.begin();
+        tx_buf_ = {nullptr, nullptr};
+        tx_completer_.invoke_and_clear({kStreamCancelled, tx_end});
+    }
+}
+
+void SocketCanBackend::Node::service() {
+    // The completers can start the next operation, which lands here again
+    if (in_service_) {
+        service_pending_ = true;
+        return;
+    }
+
+    if (service_timer_) {
+        ctx_->parent->event_loop_->cancel_timer(service_timer_);
+        service_timer_ = nullptr;
+    }
+
+    in_service_ = true;
+    do {
+        service_pending_ = false;
+        service_once();
+    } while (service_pending_);
+    in_service_ = false;
+}
+
+void SocketCanBackend::Node::service_once() {
+    uint32_t now = now_ms();
+
+    if (rx_completer_ && link_.rx_ready()) {
+        size_t length = std::min(link_.rx_length(), rx_buf_.size());
+        memcpy(rx_buf_.begin(), link_.rx_data(), length);
+        link_.rx_release();
+        uint8_t* rx_end = rx_buf_.begin() + length;
+        rx_buf_ = {nullptr, nullptr};
+        rx_completer_.invoke_and_clear({kStreamOk, rx_end});
+    }
+
+    can_Message_t msg;
+    msg.id = (node_id_ << kNodeIdShift) | kFibreCmdId;
+    msg.isExt = ctx_->is_extended;
+    msg.rtr = false;
+    while (link_.next_frame(&msg, now)) {
+        if (!ctx_->send(msg)) {
+            schedule_service(1); // TX queue full, retry
+            return;
+        }
+        link_.frame_sent(now);
+    }
+
+    auto state = link_.tx_state();
+    if (state == CanSegmentedLink<kMtu>::TX_DONE || state == CanSegmentedLink<kMtu>::TX_FAILED) {
+        link_.tx_reset();
+        const uint8_t* tx_end = state == CanSegmentedLink<kMtu>::TX_DONE ? tx_buf_.end() : tx_buf_.begin();
+        tx_buf_ = {nullptr, nullptr};
+        tx_completer_.invoke_and_clear({state == CanSegmentedLink<kMtu>::TX_DONE ? kStreamOk : kStreamError, tx_end});
+    } else if (state == CanSegmentedLink<kMtu>::TX_SENDING) {
+        schedule_service(1); // minimum gap between consecutive frames
+    } else if (state == CanSegmentedLink<kMtu>::TX_WAITING) {
+        schedule_service(CanSegmentedLink<kMtu>::TIMEOUT_MS); // flow control timeout
+    }
+}
+
+void SocketCanBackend::Node::on_service_timer() {
+    service_timer_ = nullptr;
+    service();
+}
+
+void SocketCanBackend::Node::schedule_service(uint32_t delay_ms) {
+    if (!service_timer_) {
+        service_timer_ = ctx_->parent->event_loop_->call_later(delay_ms * 0.001f, MEMBER_CB(this, on_service_timer));
+    }
+}
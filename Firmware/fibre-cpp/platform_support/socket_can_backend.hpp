@@ -0,0 +1,115 @@
+#ifndef __FIBRE_SOCKET_CAN_BACKEND_HPP
+#define __FIBRE_SOCKET_CAN_BACKEND_HPP
+
+#include <fibre/event_loop.hpp>
+#include <fibre/async_stream.hpp>
+#include <fibre/channel_discoverer.hpp>
+#include "../../communication/can/can_segmented.hpp"
+#include <string>
+#include <unordered_map>
+#include <stdint.h>
+
+namespace fibre {
+
+/**
+ * @brief Host side of the fibre transport over CAN (see CanFibre in
+ * Firmware/communication/can/can_fibre.hpp) on Linux SocketCAN interfaces.
+ *
+ * Requests go to the node ID of axis0 and responses come from the node ID of
+ * axis1 of the ODrive, both with the CANSimple command ID 0x1F. An ODrive is
+ * considered present while its axis0 sends heartbeat messages.
+ *
+ * Specs:
+ *  - "can:interface=can0" connects to every ODrive on can0 whose axis0 has an
+ *    even node ID N, assuming that axis1 has the node ID N + 1.
+ *  - "can:interface=can0,node_id=4,response_node_id=7" only connects to the
+ *    ODrive with these node IDs of axis0 and axis1. response_node_id defaults
+ *    to node_id + 1.
+ *  - "extended=1" selects 29 bit CAN IDs (see axis.config.can.is_extended).
+ */
+class SocketCanBackend : public ChannelDiscoverer {
+public:
+    constexpr static const char* get_name() { return "can"; }
+
+    bool init(EventLoop* event_loop);
+    bool deinit();
+
+    void start_channel_discovery(Domain* domain, const char* specs, size_t specs_len, ChannelDiscoveryContext** handle) final;
+    int stop_channel_discovery(ChannelDiscoveryContext* handle) final;
+
+private:
+    struct CanChannelDiscoveryContext;
+
+    // One ODrive on the bus. The channels are handed to the domain while the
+    // ODrive is present and closed when its heartbeat stops.
+    class Node final : public AsyncStreamSource, public AsyncStreamSink {
+    public:
+        static constexpr size_t kMtu = 128; // same as CanFibre::MTU
+
+        Node(CanChannelDiscoveryContext* ctx, uint32_t node_id, uint32_t response_node_id)
+            : ctx_(ctx), node_id_(node_id), response_node_id_(response_node_id) {}
+        ~Node();
+
+        void start_read(bufptr_t buffer, TransferHandle* handle, Callback<void, ReadResult> completer) final;
+        void cancel_read(TransferHandle transfer_handle) final;
+        void start_write(cbufptr_t buffer, TransferHandle* handle, Callback<void, WriteResult> completer) final;
+        void cancel_write(TransferHandle transfer_handle) final;
+
+        void on_heartbeat(uint32_t now);
+        void on_frame(const can_Message_t& msg, uint32_t now);
+        void check_presence(uint32_t now);
+        void close();
+
+        uint32_t response_node_id() const { return response_node_id_; }
+
+    private:
+        void open();
+        void service();
+        void service_once();
+        void on_service_timer();
+        void schedule_service(uint32_t delay_ms);
+
+        CanChannelDiscoveryContext* ctx_;
+        uint32_t node_id_;          // of axis0, receives the requests
+        uint32_t response_node_id_; // of axis1, sends the responses
+        bool is_open_ = false;      // handed to the domain and not closed yet
+        uint32_t last_seen_ = 0;    // [ms]
+        CanSegmentedLink<kMtu> link_;
+
+        bool in_service_ = false;
+        bool service_pending_ = false;
+        EventLoopTimer* service_timer_ = nullptr;
+
+        bufptr_t rx_buf_ = {nullptr, nullptr};
+        Callback<void, ReadResult> rx_completer_;
+        cbufptr_t tx_buf_ = {nullptr, nullptr};
+        Callback<void, WriteResult> tx_completer_;
+    };
+
+    struct CanChannelDiscoveryContext : ChannelDiscoveryContext {
+        SocketCanBackend* parent;
+        Domain* domain;
+        std::string interface_name;
+        bool is_extended = false;
+        int selected_node_id = -1; // -1 to connect to any ODrive
+        int selected_response_node_id = -1; // -1 for selected_node_id + 1
+
+        int socket_id = -1;
+        EventLoopTimer* timer = nullptr; // for reopening the socket or for the presence check
+        std::unordered_map<uint32_t, Node*> nodes; // key: node ID of axis0
+
+        bool open_socket();
+        void close_socket();
+        void on_timer();
+        void on_event(uint32_t mask);
+        void on_heartbeat(uint32_t sender, uint32_t now);
+        bool send(const can_Message_t& msg);
+    };
+
+    EventLoop* event_loop_ = nullptr;
+    size_t n_discoveries_ = 0;
+};
+
+}
+
+#endif // __FIBRE_SOCKET_CAN_BACKEND_HPP
@@ -0,0 +1,82 @@
+#ifndef __FIBRE_POOL_HPP
+#define __FIBRE_POOL_HPP
+
+#include "logging.hpp"
+#include <stddef.h>
+#include <new>
+#include <utility>
+#include <algorithm>
+
+namespace fibre {
+
+/**
+ * @brief Fixed-capacity pool of objects of type T.
+ *
+ * The N objects live inside the pool, so as long as no more than N objects
+ * are allocated at a time, alloc() and free() don't touch the heap. Beyond
+ * that the pool falls back to the heap instead of failing. This is counted in
+ * the PoolStats that are passed to the constructor (see logging.hpp).
+ *
+ * Not thread safe.
+ */
+template<typename T, size_t N>
+class Pool {
+public:
+    explicit Pool(PoolStats& stats) : stats_(stats) {
+        for (size_t i = N; i > 0; --i) {
+            slots_[i - 1].next = free_list_;
+            free_list_ = &slots_[i - 1];
+        }
+    }
+
+    Pool(const Pool&) = delete;
+    Pool& operator=(const Pool&) = delete;
+
+    template<typename... TArgs>
+    T* alloc(TArgs&&... args) {
+        void* ptr;
+        if (free_list_) {
+            ptr = free_list_->storage;
+            free_list_ = free_list_->next;
+        } else {
+            ptr = ::operator new(sizeof(T));
+            stats_.n_heap_allocs++;
+        }
+        stats_.n_allocs++;
+        stats_.in_use++;
+        stats_.max_in_use = std::max(stats_.max_in_use, stats_.in_use);
+        return new (ptr) T{std::forward<TArgs>(args)...};
+    }
+
+    // @brief Destroys an object that was returned by alloc() of this pool
+    void free(T* obj) {
+        obj->~T();
+        stats_.in_use--;
+        if (owns(obj)) {
+            Slot* slot = reinterpret_cast<Slot*>(obj);
+            slot->next = free_list_;
+            free_list_ = slot;
+        } else {
+            ::operator delete(obj);
+        }
+    }
+
+private:
+    union Slot {
+        Slot* next; // valid while the slot is free
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+    bool owns(const T* obj) const {
+        const Slot* slot = reinterpret_cast<const Slot*>(obj);
+        return slot >= slots_ && slot < slots_ + N;
+    }
+
+    PoolStats& stats_;
+    Slot slots_[N];
+    Slot* free_list_ = nullptr;
+};
+
+}
+
+#endif // __FIBRE_POOL_HPP
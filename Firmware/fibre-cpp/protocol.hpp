@@ -25,13 +25,26 @@ typedef struct {
 
 
 namespace fibre {
+// Endpoint ID of a request that contains several endpoint operations, see
+// batch_endpoint_handler(). The generated endpoint table stays below it.
+constexpr uint16_t BATCH_ENDPOINT_ID = 0x7fff;
+// Endpoint ID of a request that carries a chunk of a firmware image, see
+// firmware_update_handler().
+constexpr uint16_t FW_UPDATE_ENDPOINT_ID = 0x7ffd;
+
 // These symbols are defined in the autogenerated endpoints.hpp
 extern const unsigned char embedded_json[];
 extern const size_t embedded_json_length;
+extern const unsigned char embedded_json_compressed[];
+extern const size_t embedded_json_compressed_length;
 extern const uint16_t json_crc_;
 extern const uint32_t json_version_id_;
 bool endpoint_handler(int idx, cbufptr_t* input_buffer, bufptr_t* output_buffer);
 bool endpoint0_handler(cbufptr_t* input_buffer, bufptr_t* output_buffer);
+bool batch_endpoint_handler(cbufptr_t* input_buffer, bufptr_t* output_buffer);
+// Defined by the application
+bool firmware_update_handler(cbufptr_t* input_buffer, bufptr_t* output_buffer);
+bool is_property_endpoint(int idx);
 bool is_endpoint_ref_valid(endpoint_ref_t endpoint_ref);
 bool set_endpoint_from_float(endpoint_ref_t endpoint_ref, float value);
 }
@@ -260,6 +273,19 @@ template<typename T>
 bool set_from_float(float value, T* property) {
     return set_from_float_ex<T>(value, property, 0);
 }
+
+template<typename T, typename = std::enable_if_t<std::is_arithmetic<T>::value>>
+bool get_as_float_ex(T value, float* result, int) {
+    return *result = static_cast<float>(value), true;
+}
+template<typename T>
+bool get_as_float_ex(T value, float* result, ...) {
+    return false;
+}
+template<typename T>
+bool get_as_float(T value, float* result) {
+    return get_as_float_ex<T>(value, result, 0);
+}
 }
 
 
@@ -9,6 +9,8 @@ namespace fibre {
 template<size_t I>
 class BufferedStreamSink {
 public:
+    static constexpr size_t capacity = I - 1;
+
     BufferedStreamSink(AsyncStreamSink& sink) : sink_(sink) {}
 
     /**
@@ -21,10 +23,6 @@ public:
     void write(cbufptr_t buf) {
         size_t read_idx = read_idx_; // read_idx_ could change during this function
 
-        if ((read_idx + 1) % I == write_idx_) {
-            return;
-        }
-
         // We subtract 1 from the read index because we never want the write
         // pointer to catch up with the read pointer, cause then
         // `write_idx_ == read_idx_` could mean both "full" and "empty".
@@ -51,6 +49,11 @@ public:
         //}
     }
 
+    // Returns the number of bytes that the next write() can take
+    size_t get_free_space() const {
+        return (read_idx_ + I - write_idx_ - 1) % I;
+    }
+
     void maybe_start_async_write() {
         if (is_active_) {
             // nothing to do
@@ -0,0 +1,230 @@
+#ifndef __FIBRE_TIMER_WHEEL_HPP
+#define __FIBRE_TIMER_WHEEL_HPP
+
+#include <fibre/callback.hpp>
+#include <stdint.h>
+#include <stddef.h>
+#include <memory>
+#include <vector>
+#include <algorithm>
+
+namespace fibre {
+
+/**
+ * @brief Hierarchical timer wheel with kLevels levels of kSlots slots each.
+ *
+ * Time is counted in ticks (the event loop uses milliseconds). A timer that
+ * expires within kSlots ticks is in level 0, one that expires within kSlots^2
+ * ticks in level 1 and so on. When the time reaches a slot of a higher level,
+ * its timers are moved to the lower levels ("cascaded"). Timers further away
+ * than the range of the top level are cascaded more than once.
+ *
+ * add() and cancel() are O(1). Timer nodes are allocated in blocks and reused.
+ *
+ * Not thread safe.
+ */
+class TimerWheel {
+public:
+    static constexpr unsigned kSlotBits = 8;
+    static constexpr size_t kSlots = 1 << kSlotBits;
+    static constexpr unsigned kLevels = 4;
+
+    struct Node {
+        Node* prev;
+        Node* next;
+        uint64_t expiry; // [ticks]
+        uint8_t level;
+        Callback<void> callback;
+    };
+
+    TimerWheel() {
+        for (auto& level: slots_) {
+            for (Node& head: level) {
+                head.prev = head.next = &head;
+            }
+        }
+    }
+
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    // @brief Number of running timers
+    size_t size() const { return size_; }
+    uint64_t now() const { return now_; }
+
+    /**
+     * @brief Starts a timer that fires once advance() reaches `expiry`.
+     * An expiry in the past fires on the next tick.
+     */
+    Node* add(uint64_t expiry, Callback<void> callback) {
+        Node* node = alloc_node();
+        node->expiry = expiry > now_ ? expiry : now_ + 1;
+        node->callback = callback;
+        insert(node);
+        size_++;
+        return node;
+    }
+
+    // @brief Stops a timer. Must not be called once its callback was invoked.
+    void cancel(Node* node) {
+        unlink(node);
+        free_node(node);
+        size_--;
+    }
+
+    /**
+     * @brief Advances the time tick by tick up to `now` and invokes the
+     * callbacks of all timers that expire on the way.
+     *
+     * Callbacks may add and cancel timers.
+     */
+    void advance(uint64_t now) {
+        while (now_ < now) {
+            if (!size_) {
+                now_ = now; // nothing to do on the way
+                break;
+            }
+            if (!level_size_[0]) {
+                // Skip ahead to the next cascade
+                uint64_t next = next_deadline();
+                if (next - 1 > now_) {
+                    now_ = std::min(now, next - 1);
+                }
+                if (now_ >= now) {
+                    break;
+                }
+            }
+            now_++;
+
+            // Cascade the higher levels whose slot boundary was crossed
+            for (unsigned level = 1; level < kLevels; ++level) {
+                if (now_ & ((1ULL << (kSlotBits * level)) - 1)) {
+                    break;
+                }
+                cascade(level, slot_index(now_, level));
+            }
+
+            Node* head = &slots_[0][now_ & (kSlots - 1)];
+            while (head->next != head) {
+                Node* node = head->next;
+                unlink(node);
+                Callback<void> callback = node->callback;
+                free_node(node);
+                size_--;
+                callback.invoke();
+            }
+        }
+    }
+
+    /**
+     * @brief Returns the next tick at which advance() must be called. This is
+     * the expiry of the earliest timer or an earlier tick at which timers are
+     * cascaded. Only valid if size() > 0.
+     */
+    uint64_t next_deadline() const {
+        // Level 0 holds the timers until the end of the current window of
+        // kSlots ticks
+        for (uint64_t tick = now_ + 1; level_size_[0] && tick <= (now_ | (kSlots - 1)); ++tick) {
+            if (!is_empty(slots_[0][tick & (kSlots - 1)])) {
+                return tick;
+            }
+        }
+
+        uint64_t deadline = UINT64_MAX;
+        for (unsigned level = 1; level < kLevels; ++level) {
+            if (!level_size_[level]) {
+                continue;
+            }
+            unsigned shift = kSlotBits * level;
+            size_t current = slot_index(now_, level);
+            for (size_t i = 1; i <= kSlots; ++i) {
+                size_t slot = (current + i) & (kSlots - 1);
+                if (!is_empty(slots_[level][slot])) {
+                    // Tick at which this slot is cascaded
+                    uint64_t base = (now_ >> (shift + kSlotBits)) << (shift + kSlotBits);
+                    uint64_t tick = base + ((uint64_t)slot << shift);
+                    if (tick <= now_) {
+                        tick += 1ULL << (shift + kSlotBits); // next revolution
+                    }
+                    deadline = std::min(deadline, tick);
+                    break;
+                }
+            }
+        }
+        return deadline;
+    }
+
+private:
+    static constexpr size_t kBlockSize = 256; // nodes per allocation
+
+    static size_t slot_index(uint64_t tick, unsigned level) {
+        return (tick >> (kSlotBits * level)) & (kSlots - 1);
+    }
+
+    static bool is_empty(const Node& head) { return head.next == &head; }
+
+    void unlink(Node* node) {
+        node->prev->next = node->next;
+        node->next->prev = node->prev;
+        level_size_[node->level]--;
+    }
+
+    void insert(Node* node) {
+        // The level is given by the highest bit in which the expiry differs
+        // from now, so the timer is cascaded (or fires) exactly when the time
+        // reaches the slot.
+        uint64_t diff = node->expiry ^ now_;
+        unsigned level = 0;
+        while (level < kLevels - 1 && (diff >> (kSlotBits * (level + 1)))) {
+            level++;
+        }
+        Node* head = &slots_[level][slot_index(node->expiry, level)];
+        node->level = level;
+        level_size_[level]++;
+        node->next = head;
+        node->prev = head->prev;
+        head->prev->next = node;
+        head->prev = node;
+    }
+
+    void cascade(unsigned level, size_t slot) {
+        Node* head = &slots_[level][slot];
+        Node* node = head->next;
+        head->prev = head->next = head;
+        while (node != head) {
+            Node* next = node->next;
+            level_size_[level]--;
+            insert(node);
+            node = next;
+        }
+    }
+
+    Node* alloc_node() {
+        if (!free_list_) {
+            blocks_.emplace_back(new Node[kBlockSize]);
+            for (size_t i = 0; i < kBlockSize; ++i) {
+                free_node(&blocks_.back()[i]);
+            }
+        }
+        Node* node = free_list_;
+        free_list_ = node->next;
+        return node;
+    }
+
+    void free_node(Node* node) {
+        node->callback = nullptr;
+        node->next = free_list_;
+        free_list_ = node;
+    }
+
+    Node slots_[kLevels][kSlots]; // list heads
+    uint64_t now_ = 0;
+    size_t size_ = 0;
+    size_t level_size_[kLevels] = {};
+    std::vector<std::unique_ptr<Node[]>> blocks_;
+    Node* free_list_ = nullptr;
+};
+
+}
+
+#endif // __FIBRE_TIMER_WHEEL_HPP
@@ -0,0 +1,257 @@
+#!/usr/bin/env python3
+"""
+Loads a CAN bus with a configurable mix of CANSimple commands and measures
+how the ODrives on it keep up.
+
+It reports:
+ - Frame loss: responses to remote (get_*) frames that never arrived, and
+   cyclic frames (heartbeat, encoder estimates) that arrived less often than
+   configured.
+ - Send failures: frames that the host could not send, and if --usb is given,
+   the increase of can.tx_dropped and can.rx_dropped of the ODrive.
+ - Command-to-effect latency: Time from a Set_Input_Torque frame until the
+   Iq setpoint of the axis follows it, as seen in Get_Iq responses. Requires
+   the axis to be in closed loop torque control (see --arm). The resolution is
+   the round trip of one Get_Iq request.
+
+Example (1 Mbit, two nodes, velocity setpoints at 1kHz and encoder estimates
+requested at 100Hz, latency measured on node 0):
+
+    sudo ip link set can0 up type can bitrate 1000000
+    ./can_load_test.py --nodes 0 1 --mix set_input_vel:1000 get_encoder_estimates:100 \\
+        --encoder-rate-ms 10 --latency-node 0 --arm --usb
+"""
+
+import argparse
+import struct
+import threading
+import time
+import can
+import numpy as np
+
+from odrive.enums import *
+
+# CANSimple command IDs and formats of the data, see docs/can-protocol.rst.
+# Remote frames are sent for the get_* commands.
+commands = {
+    'heartbeat': (0x001, '<IBBBB'),
+    'get_motor_error': (0x003, '<Q'),
+    'get_encoder_error': (0x004, '<I'),
+    'set_axis_requested_state': (0x007, '<I'),
+    'get_encoder_estimates': (0x009, '<ff'),
+    'get_encoder_count': (0x00a, '<ii'),
+    'set_controller_modes': (0x00b, '<ii'),
+    'set_input_pos': (0x00c, '<fhh'),
+    'set_input_vel': (0x00d, '<ff'),
+    'set_input_torque': (0x00e, '<f'),
+    'get_iq': (0x014, '<ff'),
+    'get_bus_voltage_current': (0x017, '<ff'),
+}
+
+def arbitration_id(node_id, cmd_name):
+    return (node_id << 5) | commands[cmd_name][0]
+
+def make_message(node_id, cmd_name, *values):
+    cmd_id, fmt = commands[cmd_name]
+    if cmd_name.startswith('get_'):
+        return can.Message(arbitration_id=(node_id << 5) | cmd_id, is_extended_id=False,
+                           is_remote_frame=True, dlc=struct.calcsize(fmt))
+    if not len(values):
+        values = [0] * (len(fmt) - 1)
+    return can.Message(arbitration_id=(node_id << 5) | cmd_id, is_extended_id=False,
+                       data=struct.pack(fmt, *values))
+
+def percentiles(values):
+    if not len(values):
+        return "no samples"
+    values = np.array(values) * 1e6
+    return "min {:.0f}us, p50 {:.0f}us, p99 {:.0f}us, max {:.0f}us ({} samples)".format(
+        np.min(values), np.percentile(values, 50), np.percentile(values, 99), np.max(values), len(values))
+
+
+class Receiver():
+    """
+    Counts the received frames per arbitration ID and hands the Get_Iq
+    responses of one node to the latency measurement.
+    """
+    def __init__(self, bus, latency_node):
+        self.bus = bus
+        self.counts = {}
+        self.n_error_frames = 0
+        self.iq_cond = threading.Condition()
+        self.iq_responses = [] # (timestamp, iq_setpoint)
+        self.latency_id = None if latency_node is None else arbitration_id(latency_node, 'get_iq')
+        self._stop = threading.Event()
+        self._thread = threading.Thread(target=self._run, daemon=True)
+
+    def start(self):
+        self._thread.start()
+
+    def stop(self):
+        self._stop.set()
+        self._thread.join()
+
+    def _run(self):
+        while not self._stop.is_set():
+            msg = self.bus.recv(timeout=0.1)
+            if msg is None:
+                continue
+            if msg.is_error_frame:
+                self.n_error_frames += 1
+                continue
+            if msg.is_remote_frame:
+                continue
+            self.counts[msg.arbitration_id] = self.counts.get(msg.arbitration_id, 0) + 1
+            if msg.arbitration_id == self.latency_id:
+                iq_setpoint, iq_measured = struct.unpack('<ff', msg.data[:8])
+                with self.iq_cond:
+                    self.iq_responses.append((msg.timestamp, iq_setpoint))
+                    self.iq_cond.notify()
+
+
+def measure_latency(bus, receiver, node_id, torque, n_samples, timeout=0.1):
+    """
+    Alternates the torque setpoint of the node and polls Get_Iq until the Iq
+    setpoint changes sign. Returns the latencies [s] and the number of
+    failed send attempts.
+    """
+    latencies = []
+    n_send_failed = 0
+    poll = make_message(node_id, 'get_iq')
+    for i in range(n_samples):
+        setpoint = torque if i % 2 == 0 else -torque
+        with receiver.iq_cond:
+            receiver.iq_responses.clear()
+        try:
+            # Socket timestamps use the same clock as time.time()
+            t_sent = time.time()
+            bus.send(make_message(node_id, 'set_input_torque', setpoint))
+        except can.CanError:
+            n_send_failed += 1
+            continue
+
+        t_end = time.monotonic() + timeout
+        done = False
+        while not done and time.monotonic() < t_end:
+            try:
+                bus.send(poll)
+            except can.CanError:
+                n_send_failed += 1
+                continue
+            with receiver.iq_cond:
+                receiver.iq_cond.wait(0.01)
+                for t, iq_setpoint in receiver.iq_responses:
+                    if iq_setpoint * setpoint > 0 and t >= t_sent:
+                        latencies.append(t - t_sent)
+                        done = True
+                        break
+        time.sleep(0.002)
+    return latencies, n_send_failed
+
+
+def main():
+    parser = argparse.ArgumentParser(description='CAN bus load and latency test for ODrives running CANSimple.')
+    parser.add_argument('--channel', default='can0', help='socketcan interface')
+    parser.add_argument('--bitrate', type=int, default=1000000, help='must match the interface and can.config.baud_rate')
+    parser.add_argument('--nodes', type=int, nargs='+', default=[0], help='node IDs of the axes on the bus')
+    parser.add_argument('--mix', nargs='*', default=['set_input_vel:1000'],
+                        help='commands to flood each node with, as name:rate_hz. Known names: ' + ', '.join(sorted(commands.keys())))
+    parser.add_argument('--duration', type=float, default=10.0, help='[s] length of the load phase')
+    parser.add_argument('--heartbeat-rate-ms', type=int, default=100, help='configured rate of the heartbeat frames, 0 if disabled')
+    parser.add_argument('--encoder-rate-ms', type=int, default=10, help='configured rate of the encoder estimate frames, 0 if disabled')
+    parser.add_argument('--latency-node', type=int, default=None, help='node to measure the command-to-effect latency on')
+    parser.add_argument('--latency-samples', type=int, default=500)
+    parser.add_argument('--latency-torque', type=float, default=0.02, help='[Nm] amplitude of the alternating torque setpoint')
+    parser.add_argument('--arm', action='store_true', help='put the latency node into closed loop torque control first')
+    parser.add_argument('--usb', action='store_true',
+                        help='connect to the ODrive over USB to set the cyclic rates and read its drop counters')
+    args = parser.parse_args()
+
+    mix = []
+    for item in args.mix:
+        name, rate = item.split(':')
+        if not name in commands:
+            raise Exception("unknown command {}".format(name))
+        mix.append((name, float(rate)))
+
+    # With bit stuffing a frame with 8 data bytes takes about 130 bits and a
+    # remote frame about 50 bits. Each remote frame gets a response.
+    cyclic = {'heartbeat': args.heartbeat_rate_ms, 'get_encoder_estimates': args.encoder_rate_ms}
+    bits = sum(((50 + 130) if name.startswith('get_') else 130) * rate for name, rate in mix)
+    bits += sum(130 * 1000.0 / rate_ms for rate_ms in cyclic.values() if rate_ms)
+    bits *= len(args.nodes)
+    print("expected bus load: {:.0f}% of {} bit/s".format(bits / args.bitrate * 100, args.bitrate))
+
+    odrv = None
+    if args.usb:
+        import odrive
+        odrv = odrive.find_any()
+        for axis in [odrv.axis0, odrv.axis1]:
+            if axis.config.can.node_id in args.nodes:
+                axis.config.can.heartbeat_rate_ms = args.heartbeat_rate_ms
+                axis.config.can.encoder_rate_ms = args.encoder_rate_ms
+        tx_dropped, rx_dropped = odrv.can.tx_dropped, odrv.can.rx_dropped
+
+    bus = can.interface.Bus(bustype='socketcan', channel=args.channel, bitrate=args.bitrate)
+    receiver = Receiver(bus, args.latency_node)
+    receiver.start()
+
+    if args.arm and args.latency_node is not None:
+        bus.send(make_message(args.latency_node, 'set_controller_modes', CONTROL_MODE_TORQUE_CONTROL, INPUT_MODE_PASSTHROUGH))
+        bus.send(make_message(args.latency_node, 'set_input_torque', 0.0))
+        bus.send(make_message(args.latency_node, 'set_axis_requested_state', AXIS_STATE_CLOSED_LOOP_CONTROL))
+        time.sleep(0.5)
+
+    try:
+        # Load phase
+        counts_before = dict(receiver.counts)
+        tasks = []
+        for node_id in args.nodes:
+            for name, rate in mix:
+                tasks.append(bus.send_periodic(make_message(node_id, name), 1.0 / rate))
+        t_start = time.monotonic()
+
+        latencies, n_send_failed = ([], 0)
+        if args.latency_node is not None:
+            latencies, n_send_failed = measure_latency(bus, receiver, args.latency_node,
+                                                       args.latency_torque, args.latency_samples)
+        time.sleep(max(0.0, args.duration - (time.monotonic() - t_start)))
+        for task in tasks:
+            task.stop()
+        duration = time.monotonic() - t_start
+        time.sleep(0.1) # let the last responses arrive
+    finally:
+        if args.arm and args.latency_node is not None:
+            bus.send(make_message(args.latency_node, 'set_axis_requested_state', AXIS_STATE_IDLE))
+        receiver.stop()
+
+    print("load phase: {:.1f}s".format(duration))
+    for node_id in args.nodes:
+        print("node {}:".format(node_id))
+        def received(cmd_name):
+            k = arbitration_id(node_id, cmd_name)
+            return receiver.counts.get(k, 0) - counts_before.get(k, 0)
+        for name, rate in mix:
+            if name.startswith('get_'):
+                # The cyclic frames have the same ID as the responses
+                expected = int(rate * duration + (duration * 1000 / cyclic[name] if cyclic.get(name, 0) else 0))
+                print("  {}: {} of about {} responses ({:.1f}% lost)".format(
+                    name, received(name), expected, max(0, expected - received(name)) / max(expected, 1) * 100))
+        for name, rate_ms in cyclic.items():
+            if rate_ms and not any(n == name for n, r in mix):
+                expected = int(duration * 1000 / rate_ms)
+                print("  cyclic {}: {} of about {} frames ({:.1f}% lost)".format(
+                    name, received(name), expected, max(0, expected - received(name)) / max(expected, 1) * 100))
+
+    print("error frames: {}".format(receiver.n_error_frames))
+    print("failed sends on the host: {}".format(n_send_failed))
+    if odrv is not None:
+        print("ODrive can.tx_dropped: +{}, can.rx_dropped: +{}".format(
+            odrv.can.tx_dropped - tx_dropped, odrv.can.rx_dropped - rx_dropped))
+    if args.latency_node is not None:
+        print("command-to-effect latency on node {}: {}".format(args.latency_node, percentiles(latencies)))
+        if len(latencies) < args.latency_samples:
+            print("  {} samples timed out".format(args.latency_samples - len(latencies)))
+
+if __name__ == '__main__':
+    main()
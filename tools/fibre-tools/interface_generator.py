@@ -458,26 +458,32 @@ def map_to_fibre01_type(t):
         return 'float'
     return t['fullname']
 
-def generate_endpoint_for_property(prop, attr_bindto, idx):
+def generate_endpoint_for_property(prop, attr_bindto, idx, path=None):
     prop_intf = interfaces[prop['type'].fullname]
+    codec = map_to_fibre01_type(prop['type'].value_type)
 
     endpoint = {
         'id': idx,
         'function': prop_intf.functions['read' if prop['type'].mode == 'readonly' else 'exchange'],
         'in_bindings': OrderedDict([('obj', attr_bindto)]),
-        'out_bindings': OrderedDict()
+        'out_bindings': OrderedDict(),
+        'is_property': True,
+        'path': path, # dotted path from the root object, None for function arguments
+        'codec': codec,
+        'writable': prop['type'].mode != 'readonly'
     }
     endpoint_definition = {
         'name': prop['name'],
         'id': idx,
-        'type': map_to_fibre01_type(prop['type'].value_type),
+        'type': codec,
         'access': 'r' if prop['type'].mode == 'readonly' else 'rw',
     }
     return endpoint, endpoint_definition
 
-def generate_endpoint_table(intf, bindto, idx):
+def generate_endpoint_table(intf, bindto, idx, path=''):
     """
     Generates a Fibre v0.1 endpoint table for a given interface.
+    path is the dotted path of the object that implements intf.
     This will probably be deprecated in the future.
     The object must have no circular property types (i.e. A.b has type B and B.a has type A).
     """
@@ -491,12 +497,12 @@ def generate_endpoint_table(intf, bindto, idx):
         attr_bindto = intf.c_name + '::get_' + prop['name'] + '(' + bindto + ')'
         if len(property_value_type):
             # Special handling for Property<...> attributes: they resolve to one single endpoint
-            endpoint, endpoint_definition = generate_endpoint_for_property(prop, attr_bindto, idx + cnt)
+            endpoint, endpoint_definition = generate_endpoint_for_property(prop, attr_bindto, idx + cnt, path + k)
             endpoints.append(endpoint)
             endpoint_definitions.append(endpoint_definition)
             cnt += 1
         else:
-            inner_endpoints, inner_endpoint_definitions, inner_cnt = generate_endpoint_table(prop['type'], attr_bindto, idx + cnt)
+            inner_endpoints, inner_endpoint_definitions, inner_cnt = generate_endpoint_table(prop['type'], attr_bindto, idx + cnt, path + k + '.')
             endpoints += inner_endpoints
             endpoint_definitions.append({
                 'name': k,
@@ -559,6 +565,10 @@ group.add_argument("--outputs", type=str,
                     help="path pattern for the generated outputs. One output is generated for each interface. Use # as placeholder for the interface name.")
 parser.add_argument("--generate-endpoints", type=str, nargs='?',
                     help="if specified, an endpoint table will be generated and passed to the template for the specified interface")
+parser.add_argument("--config-sources", type=argparse.FileType('r', encoding='utf-8'), nargs='+',
+                    help="C++ headers with the config structs and the hand-written config field lists. If specified, the generator fails if a member of a config struct is on no field list")
+parser.add_argument("--config-struct", type=str, action='append', default=[],
+                    help="NAME=STRUCT: C++ struct of the config of interface NAME, if it isn't NAME::Config_t")
 args = parser.parse_args()
 
 if args.version:
@@ -644,13 +654,340 @@ for k, item in list(enums.items()):
             item['parent'] = parent
 
 
+PROTOCOL_VERSION = 1
+CANONICAL_CRC16_POLYNOMIAL = 0x3d65
+
+def calc_crc16(remainder, data):
+    """Same as calc_crc16<CANONICAL_CRC16_POLYNOMIAL>() in fibre-cpp/crc.hpp"""
+    for byte in data:
+        remainder ^= byte << 8
+        for _ in range(8):
+            remainder = ((remainder << 1) ^ CANONICAL_CRC16_POLYNOMIAL) if remainder & 0x8000 else (remainder << 1)
+            remainder &= 0xffff
+    return remainder
+
+def compress_json(data):
+    """
+    Compresses the embedded JSON with a simple LZ77 scheme that can be decoded
+    with a few lines of code (see decompress_json() in legacy_object_client.cpp).
+
+    The output starts with the uncompressed length (uint32 little endian),
+    followed by tokens. A token byte t < 0x80 is followed by t + 1 literal
+    bytes. A token byte t >= 0x80 is followed by a uint16 little endian
+    distance d and copies (t & 0x7f) + 3 bytes starting d bytes back.
+    """
+    MIN_MATCH, MAX_MATCH, MAX_DIST, MAX_LITERALS, MAX_CANDIDATES = 3, 130, 0xffff, 128, 32
+    out = bytearray(len(data).to_bytes(4, 'little'))
+    literals = bytearray()
+    candidates = {} # 3 byte prefix => positions where it occurred
+
+    def flush_literals():
+        for i in range(0, len(literals), MAX_LITERALS):
+            chunk = literals[i:i + MAX_LITERALS]
+            out.append(len(chunk) - 1)
+            out.extend(chunk)
+        literals.clear()
+
+    def remember(pos):
+        if pos + MIN_MATCH <= len(data):
+            candidates.setdefault(data[pos:pos + MIN_MATCH], []).append(pos)
+
+    pos = 0
+    while pos < len(data):
+        best_len, best_dist = 0, 0
+        for cand in reversed(candidates.get(data[pos:pos + MIN_MATCH], [])[-MAX_CANDIDATES:]):
+            if pos - cand > MAX_DIST:
+                break
+            length = 0
+            while length < MAX_MATCH and pos + length < len(data) and data[cand + length] == data[pos + length]:
+                length += 1
+            if length > best_len:
+                best_len, best_dist = length, pos - cand
+        if best_len >= MIN_MATCH:
+            flush_literals()
+            out.append(0x80 | (best_len - MIN_MATCH))
+            out.extend(best_dist.to_bytes(2, 'little'))
+            for i in range(pos, pos + best_len):
+                remember(i)
+            pos += best_len
+        else:
+            literals.append(data[pos])
+            remember(pos)
+            pos += 1
+    flush_literals()
+    return bytes(out)
+
+def hash_path(path):
+    """Same as fibre::hash_path() in fibre-cpp/include/fibre/introspection.hpp (32 bit FNV-1a)"""
+    h = 0x811c9dc5
+    for byte in path.encode('ascii'):
+        h = ((h ^ byte) * 0x01000193) & 0xffffffff
+    return h
+
+def mix_hash(h):
+    """Same as fibre::mix_hash() in fibre-cpp/include/fibre/introspection.hpp (MurmurHash3 finalizer)"""
+    h ^= h >> 16
+    h = (h * 0x85ebca6b) & 0xffffffff
+    h ^= h >> 13
+    h = (h * 0xc2b2ae35) & 0xffffffff
+    h ^= h >> 16
+    return h
+
+def path_hash_slot(h, seed, n_slots):
+    return mix_hash((h + seed * 0x9e3779b9) & 0xffffffff) % n_slots
+
+def generate_path_hash(endpoints):
+    """
+    Generates a minimal perfect hash table from the dotted paths of the property
+    endpoints to their endpoint IDs (hash and displace: the keys are distributed
+    into buckets of 4 on average and each bucket gets a seed that places all of
+    its keys into free slots).
+    Each slot stores the last name of the path and the object that contains the
+    property, so that a lookup can verify the path without storing it in full.
+    See get_property_by_path() in endpoints_template.j2.
+    """
+    properties = [(ep['path'], ep['id']) for ep in endpoints if ep.get('path')]
+    n_slots = len(properties)
+    n_buckets = max(1, (n_slots + 3) // 4)
+
+    objects = OrderedDict([('', {'name': '', 'parent': 0})]) # the root object is 0
+    def get_object(path):
+        if not path in objects:
+            parent, _, name = path.rpartition('.')
+            objects[path] = {'name': name, 'parent': get_object(parent)}
+        return list(objects.keys()).index(path)
+
+    buckets = [[] for _ in range(n_buckets)]
+    hashes = set()
+    for path, endpoint_id in properties:
+        h = hash_path(path)
+        if h in hashes:
+            raise Exception("hash collision of property paths at " + path)
+        hashes.add(h)
+        parent, _, name = path.rpartition('.')
+        buckets[mix_hash(h) % n_buckets].append((h, {'name': name, 'parent': get_object(parent), 'endpoint_id': endpoint_id}))
+
+    slots = [None] * n_slots
+    seeds = [0] * n_buckets
+    for b in sorted(range(n_buckets), key=lambda b: -len(buckets[b])):
+        for seed in range(0x10000):
+            candidates = [path_hash_slot(h, seed, n_slots) for h, _ in buckets[b]]
+            if len(set(candidates)) == len(candidates) and all(slots[i] is None for i in candidates):
+                break
+        else:
+            raise Exception("failed to generate the property path hash table")
+        seeds[b] = seed
+        for i, (_, slot) in zip(candidates, buckets[b]):
+            slots[i] = slot
+
+    return {'seeds': seeds, 'slots': slots, 'objects': list(objects.values())}
+
+host_c_types = {
+    'bool': 'bool', 'float': 'float',
+    'uint8': 'uint8_t', 'uint16': 'uint16_t', 'uint32': 'uint32_t', 'uint64': 'uint64_t',
+    'int8': 'int8_t', 'int16': 'int16_t', 'int32': 'int32_t', 'int64': 'int64_t',
+}
+
+cpp_keywords = {
+    'and', 'asm', 'auto', 'bool', 'break', 'case', 'catch', 'char', 'class', 'const', 'continue',
+    'default', 'delete', 'do', 'double', 'else', 'enum', 'explicit', 'export', 'extern', 'false',
+    'float', 'for', 'friend', 'goto', 'if', 'inline', 'int', 'long', 'namespace', 'new', 'not',
+    'operator', 'or', 'private', 'protected', 'public', 'register', 'return', 'short', 'signed',
+    'sizeof', 'static', 'struct', 'switch', 'template', 'this', 'throw', 'true', 'try', 'typedef',
+    'union', 'unsigned', 'using', 'virtual', 'void', 'volatile', 'while', 'xor',
+}
+
+def generate_host_properties(endpoints):
+    """
+    Arranges the property endpoints into a tree of objects by their dotted
+    paths, for the typed host client in host_client_template.j2. Properties
+    whose value has no fixed size C type (endpoint_ref) are left out. Names
+    that are C++ keywords get a trailing underscore.
+    """
+    root = {'name': '', 'objects': OrderedDict(), 'properties': []}
+    for ep in endpoints:
+        if not ep.get('path') or not ep['codec'] in host_c_types:
+            continue
+        names = [(n + '_' if n in cpp_keywords else n) for n in ep['path'].split('.')]
+        obj = root
+        for name in names[:-1]:
+            obj = obj['objects'].setdefault(name, {'name': name, 'objects': OrderedDict(), 'properties': []})
+        obj['properties'].append({'name': names[-1], 'id': ep['id'], 'c_type': host_c_types[ep['codec']],
+                                  'writable': ep['writable'], 'path': ep['path']})
+    return root
+
+def generate_config_fields():
+    """
+    Lists the fields of every `config` struct that can be stored field by
+    field, see ConfigManager::read_fields() in Firmware/MotorControl/nvm_config.hpp.
+    A field is identified by a tag, the CRC16 of its dotted path within the
+    config struct and its type name, so fields can be reordered, added or
+    removed without invalidating the other stored fields. Computed properties
+    (with a c_getter other than the member) are skipped.
+    """
+    def flatten(intf, path, c_path):
+        for k, prop in intf.get_all_attributes().items():
+            prop_intf = prop['type']
+            if isinstance(prop_intf, PropertyInterfaceElement):
+                if prop.get('c_getter', prop['c_name']) != prop['c_name']:
+                    continue
+                field_path = path + k
+                yield {
+                    'path': field_path,
+                    'c_path': c_path + prop['c_name'],
+                    'tag': calc_crc16(0, (field_path + ':' + prop_intf.value_type['fullname']).encode('ascii'))
+                }
+            else:
+                yield from flatten(prop_intf, path + k + '.', c_path + prop['c_name'] + '.')
+
+    result = []
+    for k, intf in interfaces.items():
+        if split_name(k)[0] == 'fibre' or not 'config' in intf.attributes:
+            continue
+        config = intf.attributes['config']
+        if isinstance(config['type'], PropertyInterfaceElement):
+            continue
+        fields = list(flatten(config['type'], '', ''))
+        tags = set()
+        for field in fields:
+            if field['tag'] in tags:
+                raise Exception("tag collision of config fields at " + k + ".config." + field['path'])
+            tags.add(field['tag'])
+        result.append({'name': to_pascal_case(k.replace('.', '_')) + 'ConfigFields', 'interface': intf, 'fields': fields})
+    return result
+
+def strip_cpp_comments(text):
+    """Removes comments and preprocessor lines"""
+    text = re.sub(r'//[^\n]*', '', re.sub(r'/\*.*?\*/', ' ', text, flags=re.S))
+    return re.sub(r'^[ \t]*#[^\n]*', '', text, flags=re.M)
+
+def find_cpp_block_end(text, start):
+    """Index of the brace that closes the one at text[start]"""
+    depth = 0
+    for i in range(start, len(text)):
+        depth += 1 if text[i] == '{' else -1 if text[i] == '}' else 0
+        if depth == 0:
+            return i
+    raise Exception("unbalanced braces")
+
+def find_cpp_struct(text, qualified_name):
+    """Body of the struct or class definition `Outer::Name`, or None"""
+    for name in qualified_name.split('::'):
+        m = re.search(r'(?<!enum\s)\b(?:struct|class)\s+' + re.escape(name) + r'\b[^;{()]*\{', text)
+        if m is None:
+            return None
+        text = text[m.end():find_cpp_block_end(text, m.end() - 1)]
+    return text
+
+def cpp_struct_members(body):
+    """
+    Yields (type, name) for every data member at the top level of a struct
+    body. Static members, references and pointers (links to the parent
+    object) are skipped, as are functions and nested type definitions.
+    """
+    stmt = ''
+    i = 0
+    while i < len(body):
+        if body[i] == '{':
+            end = find_cpp_block_end(body, i)
+            head = re.sub(r'\b(public|private|protected)\s*:', '', stmt).strip()
+            if re.match(r'(struct|class|union|enum)\b', head):
+                i, stmt = body.index(';', end) + 1, '' # nested type definition
+            elif re.search(r'(\)|\bconst|\boverride|\bnoexcept)$', head):
+                i, stmt = end + 1, '' # function body
+            else:
+                i, stmt = end + 1, stmt + body[i:end + 1] # brace initializer
+            continue
+        if body[i] != ';':
+            stmt += body[i]
+            i += 1
+            continue
+        i += 1
+        decl = re.sub(r'\b(public|private|protected)\s*:', '', stmt).strip()
+        stmt = ''
+        if not decl or re.match(r'(static|constexpr|using|typedef|friend|template|enum|struct|class|union)\b', decl):
+            continue
+        decl = re.split(r'[={]', decl, 1)[0]
+        if '(' in decl:
+            continue # function declaration
+        m = re.match(r'(.*?)([A-Za-z_]\w*)\s*$', re.sub(r'\[[^\]]*\]', '', decl), re.S)
+        if m and m.group(1).strip() and not re.search(r'[*&]', m.group(1)):
+            yield m.group(1).strip(), m.group(2)
+
+def check_config_structs(config_fields, source_files, struct_names):
+    """
+    Fails if a data member of a config struct is neither on the field list
+    generated from the YAML nor on the hand-written list that extends it. The
+    hand-written list of ODriveFooConfigFields is the struct FooConfigFields
+    in the sources, which calls visitor(config_field_tag(...), config.<member>).
+    Array indices are ignored, so `filters[0].q` covers `filters.q`.
+    """
+    text = '\n'.join(strip_cpp_comments(f.read()) for f in source_files)
+    normalize = lambda path: re.sub(r'\[[^\]]*\]', '', path)
+
+    missing = []
+    for config in config_fields:
+        name = split_name(config['interface'].fullname)[-1]
+        struct = struct_names.get(name, name + '::Config_t')
+        body = find_cpp_struct(text, struct)
+        if body is None:
+            raise Exception("config struct " + struct + " of " + config['interface'].fullname + " not found in the config sources")
+        scope = find_cpp_struct(text, struct.rsplit('::', 1)[0]) if '::' in struct else None
+
+        covered = set(normalize(field['c_path']) for field in config['fields'])
+        hand_list = find_cpp_struct(text, re.sub(r'^ODrive', '', config['name']))
+        if hand_list is not None:
+            covered |= set(normalize(path) for path in re.findall(r'visitor\(\s*config_field_tag\([^)]*\)\s*,\s*config\.([\w.\[\]]+)\s*\)', hand_list))
+
+        def check(body, prefix, types):
+            for member_type, member in cpp_struct_members(body):
+                path = prefix + member
+                if path in covered:
+                    continue
+                type_name = re.sub(r'<.*>', '', member_type).split()[-1]
+                nested = None
+                if '::' in type_name:
+                    nested = find_cpp_struct(text, type_name)
+                elif not type_name in types:
+                    nested = (scope is not None and find_cpp_struct(scope, type_name)) or find_cpp_struct(text, type_name)
+                if nested is not None:
+                    check(nested, path + '.', types + [type_name])
+                elif not any(c.startswith(path + '.') for c in covered):
+                    missing.append(struct + '.' + path)
+        check(body, '', [])
+
+    if missing:
+        raise Exception("config struct members on no field list (add them to odrive-interface.yaml or to a hand-written field list): " + ', '.join(missing))
+
+config_fields = generate_config_fields()
+if args.config_sources:
+    check_config_structs(config_fields, args.config_sources, dict(arg.split('=', 1) for arg in args.config_struct))
+
 if args.generate_endpoints:
     endpoints, embedded_endpoint_definitions, _ = generate_endpoint_table(interfaces[args.generate_endpoints], '&ep_root', 1) # TODO: make user-configurable
     embedded_endpoint_definitions = [{'name': '', 'id': 0, 'type': 'json', 'access': 'r'}] + embedded_endpoint_definitions
     endpoints = [{'id': 0, 'function': {'fullname': 'endpoint0_handler', 'in': {}, 'out': {}}, 'bindings': {}}] + endpoints
+    # The endpoint table in endpoints_template.j2 is indexed by ID
+    assert([ep['id'] for ep in endpoints] == list(range(len(endpoints))))
+    if max(ep['id'] for ep in endpoints) >= 0x7ffd:
+        raise Exception("too many endpoints: IDs 0x7ffd to 0x7fff are reserved for firmware updates, subscriptions and batch requests")
+    # Must match the to_c_string filter byte for byte
+    embedded_json = json.dumps(embedded_endpoint_definitions, separators=(',', ':')).encode('ascii')
+    json_crc = calc_crc16(PROTOCOL_VERSION, embedded_json)
+    json_version_id = (json_crc << 16) | calc_crc16(json_crc, embedded_json)
+    embedded_json_compressed = compress_json(embedded_json)
+    if args.verbose:
+        print("embedded JSON: {} bytes, compressed: {} bytes".format(len(embedded_json), len(embedded_json_compressed)))
+    path_hash = generate_path_hash(endpoints)
+    host_properties = generate_host_properties(endpoints)
 else:
     embedded_endpoint_definitions = None
     endpoints = None
+    json_crc = None
+    json_version_id = None
+    embedded_json_compressed = None
+    path_hash = None
+    host_properties = None
 
 
 # Render template
@@ -726,6 +1063,8 @@ env.filters['to_kebab_case'] = to_kebab_case
 env.filters['first'] = lambda x: next(iter(x))
 env.filters['skip_first'] = lambda x: list(x)[1:]
 env.filters['to_c_string'] = lambda x: '\n'.join(('"' + line.replace('"', '\\"') + '"') for line in json.dumps(x, separators=(',', ':')).replace('{"name"', '\n{"name"').split('\n'))
+env.filters['to_c_array'] = lambda x: '{\n' + '\n'.join('    ' + ''.join('0x{:02x},'.format(b) for b in x[i:i + 16]) for i in range(0, len(x), 16)) + '\n}'
+env.filters['to_hex'] = lambda x: '0x{:x}'.format(x)
 env.filters['tokenize'] = tokenize
 env.filters['html_escape'] = html_escape
 env.filters['diagonalize'] = lambda lst: [lst[:i + 1] for i in range(len(lst))]
@@ -739,7 +1078,14 @@ template_args = {
     'toplevel_interfaces': toplevel_interfaces,
     'userdata': userdata,
     'endpoints': endpoints,
-    'embedded_endpoint_definitions': embedded_endpoint_definitions
+    'embedded_endpoint_definitions': embedded_endpoint_definitions,
+    'embedded_json_compressed': embedded_json_compressed,
+    'json_crc': json_crc,
+    'json_version_id': json_version_id,
+    'path_hash': path_hash,
+    'host_properties': host_properties,
+    'root_interface': args.generate_endpoints,
+    'config_fields': config_fields
 }
 
 if not args.output is None:
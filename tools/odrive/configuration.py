@@ -17,20 +17,40 @@ def obj_to_path(root, obj):
                 return k + "." + subpath
     return None
 
-def get_dict(root, obj, is_config_object):
-    result = {}
+def get_config_properties(obj, path, is_config_object):
+    """
+    Returns a list of (path, property object) tuples for all configuration
+    properties in the subtree of obj.
+    """
+    result = []
 
     for k in dir(obj):
+        # Don't touch properties with a magic getter as that would read them
+        class_member = getattr(obj.__class__, k, None)
+        if isinstance(class_member, fibre.libfibre.RemoteAttribute) and class_member._magic_getter:
+            continue
         v = getattr(obj, k)
         if k.startswith('_') and k.endswith('_property') and is_config_object:
-            v = v.read()
-            if isinstance(v, fibre.libfibre.RemoteObject):
-                v = obj_to_path(root, v)
-            result[k[1:-9]] = v
+            result.append((path + [k[1:-9]], v))
         elif not k.startswith('_') and isinstance(v, fibre.libfibre.RemoteObject):
-            sub_dict = get_dict(root, v, (k == 'config') or is_config_object)
-            if sub_dict != {}:
-                result[k] = sub_dict
+            result += get_config_properties(v, path + [k], (k == 'config') or is_config_object)
+
+    return result
+
+def get_dict(root, obj, is_config_object):
+    properties = get_config_properties(obj, [], is_config_object)
+
+    # Read all values in one batch, this is much faster than one by one
+    values = fibre.libfibre.read_properties([prop for _, prop in properties])
+
+    result = {}
+    for (path, _), v in zip(properties, values):
+        if isinstance(v, fibre.libfibre.RemoteObject):
+            v = obj_to_path(root, v)
+        sub_dict = result
+        for k in path[:-1]:
+            sub_dict = sub_dict.setdefault(k, {})
+        sub_dict[path[-1]] = v
 
     return result
 
@@ -90,7 +110,15 @@ def restore_config(device, filename, logger):
         data = json.load(file)
 
     logger.info("Restoring configuration from {}...".format(filename))
-    errors = set_dict(device, "", data)
+    # Apply the values in one pass at the end (older firmware lacks this)
+    transaction = hasattr(device, 'begin_config_transaction')
+    if transaction:
+        device.begin_config_transaction()
+    try:
+        errors = set_dict(device, "", data)
+    finally:
+        if transaction:
+            device.commit_config_transaction()
 
     for error in errors:
         logger.info(error)
@@ -100,5 +128,5 @@ def restore_config(device, filename, logger):
     try:
         device.save_configuration()
     except fibre.libfibre.ObjectLostError:
-        pass # Saving configuration makes the device reboot
+        pass # The device reboots if the flash had to be erased
     logger.info("Configuration restored.")
@@ -22,12 +22,34 @@ GPIO_MODE_ENC1                           = 12
 GPIO_MODE_ENC2                           = 13
 GPIO_MODE_MECH_BRAKE                     = 14
 GPIO_MODE_STATUS                         = 15
+GPIO_MODE_STEP_COUNTER                   = 16
+GPIO_MODE_SYNC                           = 17
+
+# ODrive.SyncMode
+SYNC_MODE_DISABLED                       = 0
+SYNC_MODE_MASTER                         = 1
+SYNC_MODE_SLAVE                          = 2
 
 # ODrive.StreamProtocolType
 STREAM_PROTOCOL_TYPE_FIBRE               = 0
 STREAM_PROTOCOL_TYPE_ASCII               = 1
 STREAM_PROTOCOL_TYPE_STDOUT              = 2
 STREAM_PROTOCOL_TYPE_ASCII_AND_STDOUT    = 3
+STREAM_PROTOCOL_TYPE_SIMPLE              = 4
+STREAM_PROTOCOL_TYPE_FIBRE_COBS          = 5
+
+# ODrive.BenchmarkKernel
+BENCHMARK_KERNEL_SVM                     = 0
+BENCHMARK_KERNEL_FAST_ATAN2              = 1
+BENCHMARK_KERNEL_SIN                     = 2
+BENCHMARK_KERNEL_COS                     = 3
+BENCHMARK_KERNEL_SIN_COS                 = 4
+BENCHMARK_KERNEL_FOC                     = 5
+BENCHMARK_KERNEL_TRAP_PLAN               = 6
+BENCHMARK_KERNEL_TRAP_EVAL               = 7
+BENCHMARK_KERNEL_SCURVE_PLAN             = 8
+BENCHMARK_KERNEL_SCURVE_EVAL             = 9
+BENCHMARK_KERNEL_TRAP_TRACK              = 10
 
 # ODrive.Can.Protocol
 PROTOCOL_SIMPLE                          = 0x00000001
@@ -162,6 +184,8 @@ ENCODER_ERROR_ABS_SPI_TIMEOUT            = 0x00000040
 ENCODER_ERROR_ABS_SPI_COM_FAIL           = 0x00000080
 ENCODER_ERROR_ABS_SPI_NOT_READY          = 0x00000100
 ENCODER_ERROR_HALL_NOT_CALIBRATED_YET    = 0x00000200
+ENCODER_ERROR_INDEX_MISMATCH             = 0x00000400
+ENCODER_ERROR_HALL_EDGES_INCONSISTENT    = 0x00000800
 
 # ODrive.SensorlessEstimator.Error
 SENSORLESS_ESTIMATOR_ERROR_NONE          = 0x00000000
@@ -184,11 +208,19 @@ class GpioMode(enum.Enum):
     ENC2                                     = 13
     MECH_BRAKE                               = 14
     STATUS                                   = 15
+    STEP_COUNTER                             = 16
+    SYNC                                     = 17
+class SyncMode(enum.Enum):
+    DISABLED                                 = 0
+    MASTER                                   = 1
+    SLAVE                                    = 2
 class StreamProtocolType(enum.Enum):
     FIBRE                                    = 0
     ASCII                                    = 1
     STDOUT                                   = 2
     ASCII_AND_STDOUT                         = 3
+    SIMPLE                                   = 4
+    FIBRE_COBS                               = 5
 class CanProtocol(enum.IntFlag):
     SIMPLE                                   = 0x00000001
 class AxisState(enum.Enum):
@@ -311,6 +343,8 @@ class EncoderError(enum.IntFlag):
     ABS_SPI_COM_FAIL                         = 0x00000080
     ABS_SPI_NOT_READY                        = 0x00000100
     HALL_NOT_CALIBRATED_YET                  = 0x00000200
+    INDEX_MISMATCH                           = 0x00000400
+    HALL_EDGES_INCONSISTENT                  = 0x00000800
 class SensorlessEstimatorError(enum.IntFlag):
     NONE                                     = 0x00000000
     UNSTABLE_GAIN                            = 0x00000001
@@ -129,6 +129,21 @@ class LibFibreEventLoop(Structure):
         ("cancel_timer", CancelTimerSignature),
     ]
 
+class LibFibreCallBatchItem(Structure):
+    _fields_ = [
+        ("func", c_void_p),
+        ("tx_buf", c_void_p),
+        ("tx_len", c_size_t),
+        ("rx_buf", c_void_p),
+        ("rx_len", c_size_t),
+        ("status", c_int),
+        ("tx_end", c_void_p),
+        ("rx_end", c_void_p),
+    ]
+
+OnCallBatchCompletedSignature = CFUNCTYPE(None, c_void_p, POINTER(LibFibreCallBatchItem), c_size_t)
+OnPropertyUpdateSignature = CFUNCTYPE(None, c_void_p, c_void_p, c_void_p, c_size_t)
+
 libfibre_get_version = lib.libfibre_get_version
 libfibre_get_version.argtypes = []
 libfibre_get_version.restype = POINTER(LibFibreVersion)
@@ -173,6 +188,20 @@ libfibre_call = lib.libfibre_call
 libfibre_call.argtypes = [c_void_p, POINTER(c_void_p), c_int, c_void_p, c_size_t, c_void_p, c_size_t, POINTER(c_void_p), POINTER(c_void_p), OnCallCompletedSignature, c_void_p]
 libfibre_call.restype = c_int
 
+try:
+    libfibre_call_batch = lib.libfibre_call_batch
+    libfibre_call_batch.argtypes = [POINTER(LibFibreCallBatchItem), c_size_t, OnCallBatchCompletedSignature, c_void_p]
+    libfibre_call_batch.restype = c_int
+except AttributeError:
+    libfibre_call_batch = None # libfibre older than 0.1.5
+
+try:
+    libfibre_subscribe = lib.libfibre_subscribe
+    libfibre_subscribe.argtypes = [c_void_p, POINTER(c_void_p), POINTER(c_uint16), c_size_t, OnPropertyUpdateSignature, c_void_p]
+    libfibre_subscribe.restype = c_int
+except AttributeError:
+    libfibre_subscribe = None # libfibre older than 0.1.6
+
 libfibre_start_tx = lib.libfibre_start_tx
 libfibre_start_tx.argtypes = [c_void_p, c_char_p, c_size_t, OnTxCompletedSignature, c_void_p]
 libfibre_start_tx.restype = None
@@ -529,11 +558,29 @@ class RemoteFunction(object):
         self._outputs = outputs
         self._rx_size = sum(codec.get_length() for _, _, codec in self._outputs)
 
-    async def async_call(self, args, cancellation_token):
-        #print("making call on " + hex(args[0]._obj_handle))
+    def _serialize_inputs(self, args):
         tx_buf = bytes()
         for i, arg in enumerate(self._inputs):
             tx_buf += arg[2].serialize(self._libfibre, args[i])
+        return tx_buf
+
+    def _deserialize_outputs(self, rx_buf):
+        outputs = []
+        for arg in self._outputs:
+            arg_length = arg[2].get_length()
+            outputs.append(arg[2].deserialize(self._libfibre, rx_buf[:arg_length]))
+            rx_buf = rx_buf[arg_length:]
+
+        if len(outputs) == 0:
+            return
+        elif len(outputs) == 1:
+            return outputs[0]
+        else:
+            return tuple(outputs)
+
+    async def async_call(self, args, cancellation_token):
+        #print("making call on " + hex(args[0]._obj_handle))
+        tx_buf = self._serialize_inputs(args)
         rx_buf = bytes()
 
         agen = Call(self)
@@ -555,18 +602,7 @@ class RemoteFunction(object):
 
         assert(len(rx_buf) == self._rx_size)
 
-        outputs = []
-        for arg in self._outputs:
-            arg_length = arg[2].get_length()
-            outputs.append(arg[2].deserialize(self._libfibre, rx_buf[:arg_length]))
-            rx_buf = rx_buf[arg_length:]
-
-        if len(outputs) == 0:
-            return
-        elif len(outputs) == 1:
-            return outputs[0]
-        else:
-            return tuple(outputs)
+        return self._deserialize_outputs(rx_buf)
 
     def __call__(self, *args, cancellation_token = None):
         """
@@ -736,6 +772,50 @@ class RemoteObject(object):
         on_lost.set_result(True)
 
 
+def read_properties(properties):
+    """
+    Reads several properties with a single batch of calls and returns their
+    values in the same order. `properties` is a list of property objects, such
+    as `odrv0.axis0._requested_state_property`.
+
+    If this function is called from the Fibre thread then it is nonblocking and
+    returns an awaitable. If it is called from another thread then it blocks
+    until all values are read.
+    """
+    calls = [(prop.__class__.read, (prop,)) for prop in properties]
+
+    async def read_all():
+        return (await properties[0]._libfibre.call_batch(calls)) if len(calls) else []
+
+    if threading.current_thread() != libfibre_thread:
+        return run_coroutine_threadsafe(properties[0]._libfibre.loop, read_all) if len(calls) else []
+    return read_all()
+
+def subscribe(obj, properties, callback):
+    """
+    Asks the device `obj` (the root object, for instance `odrv0`) to send the
+    values of the given properties on its own instead of being polled. This
+    replaces the previous subscriptions of the device. An empty list ends all
+    of them.
+
+    `properties` is a list of (property, interval_ms) tuples, where a property
+    is for instance `odrv0.axis0.encoder._pos_estimate_property` and an
+    interval of 0 means that the value is sent whenever it changes.
+    `callback(property, value)` is invoked on the Fibre thread for every value
+    received, so it must not block.
+
+    Supported on the native USB interface and on CAN (the firmware doesn't
+    send subscribed values over UART or the USB CDC port). Requires libfibre
+    0.1.6.
+    """
+    async def subscribe_async():
+        await obj._libfibre.subscribe(obj, properties, callback)
+
+    if threading.current_thread() != libfibre_thread:
+        return run_coroutine_threadsafe(obj._libfibre.loop, subscribe_async)
+    return subscribe_async()
+
+
 class LibFibre():
     def __init__(self):
         self.loop = asyncio.get_event_loop()
@@ -755,6 +835,8 @@ class LibFibre():
         self.c_on_function_added = OnFunctionAddedSignature(self._on_function_added)
         self.c_on_function_removed = OnFunctionRemovedSignature(self._on_function_removed)
         self.c_on_call_completed = OnCallCompletedSignature(self._on_call_completed)
+        self.c_on_call_batch_completed = OnCallBatchCompletedSignature(self._on_call_batch_completed)
+        self.c_on_property_update = OnPropertyUpdateSignature(self._on_property_update)
         
         self.timer_map = {}
         self.eventfd_map = {}
@@ -762,6 +844,9 @@ class LibFibre():
         self.discovery_processes = {} # key: ID, value: python dict
         self._objects = {} # key: libfibre handle, value: python class
         self._calls = {} # key: libfibre handle, value: Call object
+        self._batches = {} # key: ID, value: future of a call_batch()
+        self._subscribers = {} # key: ID, value: callback of a subscribe()
+        self._subscriber_ids = {} # key: libfibre handle of the object passed to subscribe(), value: ID
 
         event_loop = LibFibreEventLoop()
         event_loop.post = self.c_post
@@ -901,6 +986,82 @@ class LibFibre():
 
         return kFibreBusy
 
+    def _on_call_batch_completed(self, ctx, items, n_items):
+        self._batches.pop(ctx).set_result(None)
+
+    async def call_batch(self, calls):
+        """
+        Invokes several remote functions at once and returns the list of their
+        results. `calls` is a list of (RemoteFunction, args) tuples.
+
+        All calls are handed to libfibre in one go so that they can be
+        pipelined, which is much faster than awaiting one call after the other.
+        Must be run on the Fibre thread.
+        """
+        if libfibre_call_batch is None:
+            return await asyncio.gather(*[func.async_call(args, None) for func, args in calls])
+
+        items = (LibFibreCallBatchItem * len(calls))()
+        buffers = [] # must stay alive until the batch completes
+        for item, (func, args) in zip(items, calls):
+            if (len(func._inputs) != len(args)):
+                raise TypeError("expected {} arguments but have {}".format(len(func._inputs), len(args)))
+            tx_buf = func._serialize_inputs(args)
+            rx_buf = create_string_buffer(func._rx_size)
+            buffers.append((tx_buf, rx_buf))
+            item.func = func._func_handle
+            item.tx_buf = cast(tx_buf, c_void_p)
+            item.tx_len = len(tx_buf)
+            item.rx_buf = addressof(rx_buf)
+            item.rx_len = func._rx_size
+
+        batch_id = insert_with_new_id(self._batches, self.loop.create_future())
+        status = libfibre_call_batch(items, len(calls), self.c_on_call_batch_completed, batch_id)
+        if status == kFibreBusy:
+            await self._batches[batch_id]
+        else:
+            self._batches.pop(batch_id)
+            if status != kFibreOk:
+                raise _get_exception(status)
+
+        results = []
+        for item, (func, args), (tx_buf, rx_buf) in zip(items, calls, buffers):
+            if item.status != kFibreClosed:
+                raise _get_exception(item.status)
+            assert((item.rx_end or 0) - addressof(rx_buf) == func._rx_size)
+            results.append(func._deserialize_outputs(rx_buf.raw))
+        return results
+
+    def _on_property_update(self, ctx, obj, value, length):
+        callback = self._subscribers.get(ctx, None)
+        prop = self._objects.get(obj, None)
+        if not callback is None and not prop is None:
+            callback(prop, prop.__class__.read._deserialize_outputs(string_at(value, length)))
+
+    async def subscribe(self, obj, properties, callback):
+        """
+        See subscribe(). Must be run on the Fibre thread.
+        """
+        if libfibre_subscribe is None:
+            raise Exception("libfibre is too old for subscriptions")
+
+        handles = (c_void_p * len(properties))(*[prop._obj_handle for prop, _ in properties])
+        intervals = (c_uint16 * len(properties))(*[interval_ms for _, interval_ms in properties])
+        subscriber_id = insert_with_new_id(self._subscribers, callback)
+        while True:
+            status = libfibre_subscribe(obj._obj_handle, handles, intervals, len(properties), self.c_on_property_update, subscriber_id)
+            if status != kFibreBusy:
+                break
+            await asyncio.sleep(0.01) # the previous request of this device is still in progress
+        if status != kFibreOk:
+            self._subscribers.pop(subscriber_id)
+            raise _get_exception(status)
+
+        # libfibre now reports the updates of this device with the new ID
+        old_id = self._subscriber_ids.get(obj._obj_handle, None)
+        self._subscriber_ids[obj._obj_handle] = subscriber_id
+        self._subscribers.pop(old_id, None)
+
 class Discovery():
     """
     All public members of this class are thread-safe.
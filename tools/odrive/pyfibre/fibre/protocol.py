@@ -199,6 +199,80 @@ class PacketFromStreamConverter(PacketSource):
             return packet[:-2]
 
 
+def cobs_encode(data):
+    """
+    Encodes data with consistent overhead byte stuffing (COBS), which replaces
+    all zero bytes. The delimiter is not included.
+    """
+    out = bytearray()
+    block = bytearray()
+    for byte in data:
+        if byte:
+            block.append(byte)
+        if not byte or len(block) == 254:
+            out.append(len(block) + 1)
+            out += block
+            block = bytearray()
+    out.append(len(block) + 1)
+    out += block
+    return bytes(out)
+
+def cobs_decode(data):
+    """
+    Decodes a COBS encoded frame without the delimiter. Returns None if the
+    frame is malformed.
+    """
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        i += 1
+        if code == 0 or i + code - 1 > len(data):
+            return None
+        out += data[i:i + code - 1]
+        i += code - 1
+        if code != 0xff and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+class CobsStreamToPacketSegmenter(StreamSink):
+    """
+    Like StreamToPacketSegmenter, for the COBS framing of the FibreCobs stream
+    protocol: each frame is the COBS encoding of the packet and its CRC16
+    (big endian), followed by a zero byte.
+    """
+    def __init__(self, output):
+        self._frame = bytearray()
+        self._output = output
+
+    def process_bytes(self, bytes):
+        for byte in bytes:
+            if byte:
+                self._frame.append(byte)
+                continue
+            packet = cobs_decode(self._frame)
+            self._frame = bytearray()
+            if packet and len(packet) >= 2 and calc_crc16(CRC16_INIT, packet) == 0:
+                self._output.process_packet(packet[:-2])
+
+class CobsStreamBasedPacketSink(PacketSink):
+    """
+    Like StreamBasedPacketSink, for the COBS framing of the FibreCobs stream
+    protocol.
+    """
+    def __init__(self, output):
+        self._output = output
+
+    def process_packet(self, packet):
+        if (len(packet) >= MAX_PACKET_SIZE):
+            raise NotImplementedError("packet larger than 127 currently not supported")
+
+        # append CRC in big endian
+        crc16 = calc_crc16(CRC16_INIT, packet)
+        frame = cobs_encode(bytes(packet) + struct.pack('>H', crc16))
+        self._output.process_bytes(frame + b'\x00')
+
+
 class Channel(PacketSink):
     # Choose these parameters to be sensible for a specific transport layer
     _resend_timeout = 5.0     # [s]
@@ -12,6 +12,7 @@ declare -a tests=('analog_input_test.py'
                   'pwm_input_test.py'
                   'sensor_test.py'
                   'step_dir_test.py'
+                  'timing_test.py'
                   'uart_ascii_test.py'
                   )
 summary=""
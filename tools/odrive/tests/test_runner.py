@@ -298,6 +298,7 @@ class ODriveComponent(Component):
     def save_config_and_reboot(self):
         try:
             self.handle.save_configuration()
+            self.handle.reboot()
         except fibre.ObjectLostError:
             pass # this is expected
         self.handle = None
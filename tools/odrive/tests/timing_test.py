@@ -0,0 +1,195 @@
+import test_runner
+
+import struct
+import can
+import time
+import threading
+
+from fibre.utils import Logger
+from odrive.enums import *
+from test_runner import *
+from can_test import command_set
+
+
+# Default timing budgets per board version [HCLK ticks]. A test rig can
+# override them per ODrive with a "timing-budget" entry of the same form.
+#  - control-loop-p99: Sum of the p99 of all task timers that run in the
+#    control loop interrupt. This is an upper bound of the p99 of the whole
+#    control loop.
+#  - timer-update-latency-p99: p99 of irq_latencies.timer_update
+#  - control-loop-latency-p99: p99 of irq_latencies.control_loop
+#  - control-loop-latency-jitter: p99 - p50 of irq_latencies.control_loop
+default_timing_budgets = {
+    'v3.': {
+        'control-loop-p99': 12000, # of the 21000 ticks of the 8kHz period
+        'timer-update-latency-p99': 200,
+        'control-loop-latency-p99': 1000,
+        'control-loop-latency-jitter': 500,
+    },
+}
+
+# Load profile
+can_input_period = 0.005 # [s] set_input_vel messages per axis
+can_encoder_rate_ms = 5 # cyclic encoder estimates per axis
+usb_poll_properties = ['vbus_voltage', 'ibus', 'axis0.encoder.pos_estimate', 'axis0.motor.current_control.Iq_measured']
+nominal_vel = 2.0 # [turn/s]
+measurement_duration = 10.0 # [s]
+
+def get_timing_budget(odrive: ODriveComponent):
+    budget = next((b for prefix, b in default_timing_budgets.items() if odrive.yaml['board-version'].startswith(prefix)), None)
+    if budget is None:
+        raise Exception("no timing budget for board version {}".format(odrive.yaml['board-version']))
+    return {**budget, **odrive.yaml.get('timing-budget', {})}
+
+def get_task_timers(obj):
+    """
+    Returns the TaskTimer objects in obj.task_times by name
+    """
+    return {k: getattr(obj.task_times, k) for k in dir(obj.task_times)
+            if not k.startswith('_') and hasattr(getattr(obj.task_times, k), 'p99')}
+
+def get_property(obj, path):
+    for name in path.split('.'):
+        obj = getattr(obj, name)
+    return obj
+
+
+class TestControlLoopTiming():
+    """
+    Runs all connected axes of an ODrive in closed loop velocity control while
+    they receive CAN and USB traffic and checks the control loop timing
+    against the budget of the board.
+    The histograms behind the percentiles are recorded in the firmware, so
+    this doesn't depend on the polling rate of the test host.
+    """
+
+    def get_test_cases(self, testrig: TestRig):
+        for odrive in testrig.get_components(ODriveComponent):
+            # One closed loop combo per axis
+            combos = {}
+            for axis, motor, encoder, tf in testrig.get_closed_loop_combos():
+                if axis.parent == odrive and not axis in combos:
+                    combos[axis] = (axis, motor, encoder, tf)
+            if not len(combos):
+                continue
+            combos = tuple(combos.values())
+            tf = TestFixture.all_of(*[tf for axis, motor, encoder, tf in combos])
+
+            can_interfaces = list(testrig.get_connected_components(odrive.can, CanInterfaceComponent))
+            if len(can_interfaces):
+                yield AnyTestCase(*[(odrive, combos, intf, TestFixture.all_of(tf, can_tf)) for intf, can_tf in can_interfaces])
+            else:
+                yield (odrive, combos, None, tf)
+
+    def run_test(self, odrive: ODriveComponent, combos: tuple, canbus: CanInterfaceComponent, logger: Logger):
+        budget = get_timing_budget(odrive)
+        axes = [axis_ctx for axis_ctx, motor_ctx, enc_ctx, tf in combos]
+
+        with SafeTerminator(logger, *axes):
+            if not canbus is None:
+                odrive.disable_mappings()
+                if odrive.yaml['board-version'].startswith("v3."):
+                    odrive.handle.config.gpio15_mode = GPIO_MODE_CAN_A
+                    odrive.handle.config.gpio16_mode = GPIO_MODE_CAN_A
+                odrive.handle.config.enable_can_a = True
+                for axis_ctx in axes:
+                    axis_ctx.handle.config.can.encoder_rate_ms = can_encoder_rate_ms
+                odrive.save_config_and_reboot()
+
+                # The offset calibration doesn't survive the reboot
+                for axis_ctx in axes:
+                    request_state(axis_ctx, AXIS_STATE_ENCODER_OFFSET_CALIBRATION)
+                time.sleep(9) # actual calibration takes 8 seconds
+                for axis_ctx in axes:
+                    test_assert_eq(axis_ctx.handle.current_state, AXIS_STATE_IDLE)
+                    test_assert_no_error(axis_ctx)
+            else:
+                logger.warn("no CAN interface connected, measuring without CAN traffic")
+
+            for axis_ctx in axes:
+                axis_ctx.handle.config.enable_watchdog = False
+                axis_ctx.handle.controller.config.control_mode = CONTROL_MODE_VELOCITY_CONTROL
+                axis_ctx.handle.controller.config.input_mode = INPUT_MODE_PASSTHROUGH
+                axis_ctx.handle.controller.config.vel_limit = nominal_vel * 2
+                axis_ctx.handle.controller.input_vel = 0
+                request_state(axis_ctx, AXIS_STATE_CLOSED_LOOP_CONTROL)
+
+            # Start the CAN load
+            periodic_tasks = []
+            if not canbus is None:
+                cmd_id = command_set['set_input_vel'][0]
+                for axis_ctx in axes:
+                    msg = can.Message(arbitration_id=((axis_ctx.handle.config.can.node_id << 5) | cmd_id),
+                                      extended_id=False, data=struct.pack('<ff', nominal_vel, 0.0))
+                    periodic_tasks.append(canbus.handle.send_periodic(msg, can_input_period))
+            else:
+                for axis_ctx in axes:
+                    axis_ctx.handle.controller.input_vel = nominal_vel
+
+            # Start the USB load
+            stop_usb_load = threading.Event()
+            usb_requests = [0]
+            def usb_load():
+                while not stop_usb_load.is_set():
+                    for path in usb_poll_properties:
+                        get_property(odrive.handle, path)
+                        usb_requests[0] += 1
+            usb_thread = threading.Thread(target=usb_load)
+            usb_thread.daemon = True
+            usb_thread.start()
+
+            try:
+                time.sleep(1.0) # let the load settle
+
+                timers = {'odrv.' + k: t for k, t in get_task_timers(odrive.handle).items()}
+                for axis_ctx in axes:
+                    timers.update({'axis{}.{}'.format(axis_ctx.num, k): t for k, t in get_task_timers(axis_ctx.handle).items()})
+                latencies = {k: getattr(odrive.handle.irq_latencies, k) for k in ['timer_update', 'control_loop']}
+
+                # dc_calib_wait is the idle time between the two stages
+                timers.pop('odrv.dc_calib_wait', None)
+                for t in list(timers.values()) + list(latencies.values()):
+                    t.reset()
+
+                time.sleep(measurement_duration)
+
+                test_assert_eq(odrive.handle.task_times.sampling.n_samples > 0, True)
+                p99 = {k: t.p99 for k, t in timers.items()}
+                lat = {k: (l.p50, l.p99, l.max) for k, l in latencies.items()}
+                for axis_ctx in axes:
+                    test_assert_no_error(axis_ctx)
+                    test_assert_eq(axis_ctx.handle.current_state, AXIS_STATE_CLOSED_LOOP_CONTROL)
+            finally:
+                stop_usb_load.set()
+                usb_thread.join()
+                for task in periodic_tasks:
+                    task.stop()
+                for axis_ctx in axes:
+                    axis_ctx.handle.requested_state = AXIS_STATE_IDLE
+
+            logger.debug("{} USB requests in {:.1f}s".format(usb_requests[0], measurement_duration + 1.0))
+            for k, v in sorted(p99.items(), key=lambda x: -x[1]):
+                logger.debug("  {}: p99 {}".format(k, v))
+            for k, (p50, p99_, max_) in lat.items():
+                logger.debug("  irq_latencies.{}: p50 {}, p99 {}, max {}".format(k, p50, p99_, max_))
+
+            control_loop_p99 = sum(p99.values())
+            results = {
+                'control-loop-p99': control_loop_p99,
+                'timer-update-latency-p99': lat['timer_update'][1],
+                'control-loop-latency-p99': lat['control_loop'][1],
+                'control-loop-latency-jitter': lat['control_loop'][1] - lat['control_loop'][0],
+            }
+            failed = ["{} = {} exceeds the budget of {}".format(k, v, budget[k]) for k, v in results.items() if v > budget[k]]
+            for k, v in results.items():
+                logger.debug("{}: {} (budget {})".format(k, v, budget[k]))
+            if len(failed):
+                raise TestFailed("; ".join(failed))
+
+
+tests = [
+    TestControlLoopTiming(),
+]
+
+if __name__ == '__main__':
+    test_runner.run(tests)
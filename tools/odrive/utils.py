@@ -126,12 +126,161 @@ def dump_errors(odrv, clear=False, printfunc = print):
     if clear:
         odrv.clear_errors()
 
-def oscilloscope_dump(odrv, num_vals, filename='oscilloscope.csv'):
+def dump_event_log(odrv, hclk = 168e6, printfunc = print):
+    """
+    Prints the error event log, oldest event first. Timestamps are in
+    seconds relative to the previous event of the same boot. hclk is the CPU
+    clock of the ODrive (168 MHz on ODrive v3), the timestamps wrap after
+    2^32 cycles.
+    """
+    prefixes = {
+        'SYSTEM': 'ODRIVE_ERROR_', 'CAN': 'CAN_ERROR_', 'AXIS': 'AXIS_ERROR_',
+        'MOTOR': 'MOTOR_ERROR_', 'ENCODER': 'ENCODER_ERROR_',
+        'CONTROLLER': 'CONTROLLER_ERROR_', 'SENSORLESS_ESTIMATOR': 'SENSORLESS_ESTIMATOR_ERROR_',
+        'HFI_ESTIMATOR': 'HFI_ESTIMATOR_ERROR_',
+    }
+    sources = {v: k[len('EVENT_SOURCE_'):] for k, v in odrive.enums.__dict__.items() if k.startswith('EVENT_SOURCE_')}
+    head = odrv.event_log_head
+    last_cycles = None
+    for index in range(max(head - 64, 0), head):
+        cycles, source, code = odrv.get_event(index)
+        if source == 0:
+            continue # overwritten
+        name = sources.get(source, str(source))
+        dt = '' if last_cycles is None else '+{:.6f}s'.format(((cycles - last_cycles) & 0xffffffff) / hclk)
+        last_cycles = cycles
+        if name == 'BOOT':
+            printfunc('{:6d} boot (reset flags 0x{:08X})'.format(index, code))
+            last_cycles = None
+            continue
+        prefix = prefixes.get(name.rstrip('01'), None)
+        errorcodes = {v: k for k, v in odrive.enums.__dict__.items() if prefix and k.startswith(prefix)}
+        flags = [errorcodes.get(1 << bit, '0x{:08X}'.format(1 << bit)) for bit in range(32) if code & (1 << bit)]
+        printfunc('{:6d} {:>12} {}: {}'.format(index, dt, name.lower(), ', '.join(flags)))
+
+def oscilloscope_dump(odrv, num_vals=None, filename='oscilloscope.csv'):
+    """
+    Writes one line per sample with one column per oscilloscope channel.
+    By default all captured samples are written.
+    """
+    n_channels = max(odrv.oscilloscope.n_channels, 1)
+    if num_vals is None:
+        num_vals = odrv.oscilloscope.n_samples
     with open(filename, 'w') as f:
         for x in range(num_vals):
-            f.write(str(odrv.oscilloscope.get_val(x)))
+            f.write(','.join(str(odrv.oscilloscope.get_val(x * n_channels + c)) for c in range(n_channels)))
             f.write('\n')
 
+def oscilloscope_dump_serial(port, n_channels, num_vals, filename='oscilloscope.csv',
+                             scale=None, baudrate=115200, window=4):
+    """
+    Same as oscilloscope_dump() but reads the capture with the bulk read
+    command of the ASCII protocol, which is much faster than one get_val()
+    call per value.
+    port is the serial port of the ODrive's USB CDC or UART interface.
+    n_channels and num_vals are odrv.oscilloscope.n_channels and
+    odrv.oscilloscope.n_samples.
+    With scale the values are transferred as 16 bit integers in units of
+    scale, which halves the transfer time.
+    window is the number of requests in flight. It is limited by the
+    ODrive's receive and transmit buffers.
+    """
+    import serial
+    import struct
+
+    n_channels = max(n_channels, 1)
+    total = num_vals * n_channels
+    chunk = 6 if scale is None else 12
+    suffix = '' if scale is None else ' {}'.format(scale)
+    starts = list(range(0, total, chunk))
+    vals = [float('nan')] * total
+
+    def parse(line):
+        index, _, data = line.strip().partition(' ')
+        index = int(index)
+        width = 8 if scale is None else 4
+        for i in range(len(data) // width):
+            raw = int(data[i * width:(i + 1) * width], 16)
+            if scale is None:
+                val = struct.unpack('<f', struct.pack('<I', raw))[0]
+            elif raw == 0x8000:
+                val = float('nan')
+            else:
+                val = (raw - 0x10000 if raw & 0x8000 else raw) * scale
+            vals[index + i] = val
+
+    with serial.Serial(port, baudrate, timeout=1) as ser:
+        ser.reset_input_buffer()
+        sent = 0
+        received = 0
+        while received < len(starts):
+            while sent < len(starts) and sent - received < window:
+                ser.write('o {}{}\n'.format(starts[sent], suffix).encode('ascii'))
+                sent += 1
+            line = ser.readline().decode('ascii')
+            if not line.endswith('\n'):
+                raise TimeoutError("no response to oscilloscope read")
+            parse(line)
+            received += 1
+
+    with open(filename, 'w') as f:
+        for x in range(num_vals):
+            f.write(','.join(str(vals[x * n_channels + c]) for c in range(n_channels)))
+            f.write('\n')
+
+def telemetry_record(filename, duration, serial_number=None):
+    """
+    Records the frames of odrv.telemetry from the native USB endpoint and
+    writes one line per sample with the sequence number of the frame followed
+    by one column per channel.
+    Frames of odrv.telemetry.start_capture() are instead written as they are,
+    each prefixed by its length as one byte, which is the trace format that
+    the firmware tests replay (see Firmware/MotorControl/control_capture.hpp).
+    Start the telemetry with odrivetool first and disconnect it, because only
+    one program can claim the USB interface. Frames that the ODrive dropped
+    show up as gaps in the sequence numbers, which are reported at the end.
+    """
+    import usb.core
+    import usb.util
+    import struct
+
+    dev = usb.core.find(idVendor=0x1209, idProduct=0x0D32,
+                        custom_match=lambda d: serial_number is None or usb.util.get_string(d, d.iSerialNumber) == serial_number)
+    if dev is None:
+        raise Exception("ODrive not found")
+    intf = usb.util.find_descriptor(dev.get_active_configuration(),
+                                    bInterfaceClass=0, bInterfaceSubClass=1)
+    if dev.is_kernel_driver_active(intf.bInterfaceNumber):
+        dev.detach_kernel_driver(intf.bInterfaceNumber)
+    usb.util.claim_interface(dev, intf.bInterfaceNumber)
+    ep = usb.util.find_descriptor(intf, bEndpointAddress=0x83)
+
+    n_gaps = 0
+    last_seq = None
+    t_end = time.monotonic() + duration
+    try:
+        with open(filename, 'wb') as f:
+            while time.monotonic() < t_end:
+                try:
+                    frame = bytes(ep.read(64, timeout=100))
+                except usb.core.USBTimeoutError:
+                    continue
+                if len(frame) < 6 or struct.unpack('<H', frame[0:2])[0] not in (0xff00, 0xff01):
+                    continue # response of the native protocol
+                tag, seq, n_channels, n_samples = struct.unpack('<HHBB', frame[0:6])
+                if last_seq is not None and seq != (last_seq + 1) & 0xffff:
+                    n_gaps += 1
+                last_seq = seq
+                if tag == 0xff01:
+                    f.write(bytes([len(frame)]) + frame)
+                    continue
+                vals = struct.unpack('<{}f'.format(n_channels * n_samples), frame[6:6 + 4 * n_channels * n_samples])
+                for i in range(n_samples):
+                    f.write((','.join([str(seq)] + [str(v) for v in vals[i * n_channels:(i + 1) * n_channels]]) + '\n').encode())
+    finally:
+        usb.util.release_interface(dev, intf.bInterfaceNumber)
+    print("{} gaps in the sequence numbers".format(n_gaps))
+
 data_rate = 200
 plot_rate = 10
 num_samples = 500
@@ -510,17 +659,33 @@ def dump_threads(odrv):
     if len(good_keys) > len(set(keys)):
         print("Warning: incomplete thread information for threads {}".format(set(keys) - good_keys))
 
-    print("| Name    | Stack Size [B] | Max Ever Stack Usage [B] | Prio |")
-    print("|---------|----------------|--------------------------|------|")
+    # CPU load and context switches are not available on older firmware
+    def load_str(k):
+        load = getattr(odrv.system_stats, "cpu_load_" + k, None)
+        return "-" if load is None else "{:.1f}%".format(load * 100)
+    def switches_str(k):
+        return str(getattr(odrv.system_stats, "context_switches_" + k, "-"))
+
+    print("| Name    | Stack Size [B] | Max Ever Stack Usage [B] | Prio |    CPU | Switches |")
+    print("|---------|----------------|--------------------------|------|--------|----------|")
     for k in sorted(good_keys):
         sz = getattr(odrv.system_stats, "stack_size_" + k)
         use = getattr(odrv.system_stats, "max_stack_usage_" + k)
-        print("| {} | {} | {} | {} |".format(
+        print("| {} | {} | {} | {} | {} | {} |".format(
             k.ljust(7),
             str(sz).rjust(14),
             "{} ({:.1f}%)".format(use, use / sz * 100).rjust(24),
-            str(getattr(odrv.system_stats, "prio_" + k)).rjust(4)
+            str(getattr(odrv.system_stats, "prio_" + k)).rjust(4),
+            load_str(k).rjust(6),
+            switches_str(k).rjust(8)
         ))
+    for k in ["idle", "other", "isr"]:
+        if hasattr(odrv.system_stats, "cpu_load_" + k):
+            print("| {} | {} | {} | {} | {} | {} |".format(
+                k.ljust(7), "".rjust(14), "".rjust(24), "".rjust(4),
+                load_str(k).rjust(6),
+                ("-" if k == "isr" else switches_str(k)).rjust(8)
+            ))
 
 
 def dump_dma(odrv):
@@ -631,3 +796,65 @@ def dump_timing(odrv, n_samples=100, path='/tmp/timings.png'):
         tick_label = [name for name, obj, start_times, lengths in timings], # labels
     )
     plt.savefig(path, bbox_inches='tight')
+
+def benchmark_kernels(odrv, n=1000, baseline=None, save=None, tolerance=0.05):
+    """
+    Measures the hot path kernels of the control loop on the ODrive and
+    compares them against a baseline.
+
+    The kernels listed in BenchmarkKernel run n times through
+    odrv.run_benchmark(). The components that work on the state of an axis
+    (encoder, controller, sensorless estimator, current controller) are taken
+    from the in-place task timers of axis0 instead, which are sampled n times.
+    All numbers are CPU cycles.
+
+    baseline: Path of a JSON file written by an earlier call with `save`.
+    A kernel whose mean grew by more than `tolerance` is reported as a
+    regression.
+    save: Path to store the results as a new baseline.
+    Returns True if there was no regression.
+    """
+    import json
+    import numpy as np
+
+    results = {}
+    kernels = {k[len('BENCHMARK_KERNEL_'):].lower(): v for k, v in odrive.enums.__dict__.items() if k.startswith('BENCHMARK_KERNEL_')}
+    for name, kernel in sorted(kernels.items(), key=lambda x: x[1]):
+        min_cycles, mean_cycles, max_cycles = odrv.run_benchmark(kernel, n)
+        results[name] = {'min': min_cycles, 'mean': mean_cycles, 'max': max_cycles}
+
+    timers = ['encoder_update', 'controller_update', 'sensorless_estimator_update', 'current_controller_update']
+    lengths = {k: [] for k in timers}
+    for i in range(n):
+        odrv.task_timers_armed = True # Trigger sample and wait for it to finish
+        while odrv.task_timers_armed: pass
+        for k in timers:
+            lengths[k].append(getattr(odrv.axis0.task_times, k).length)
+    for k in timers:
+        results['axis0.' + k] = {'min': int(np.min(lengths[k])), 'mean': int(np.mean(lengths[k])), 'max': int(np.max(lengths[k]))}
+
+    reference = {}
+    if baseline is not None:
+        with open(baseline) as fp:
+            reference = json.load(fp)
+
+    ok = True
+    print("| Kernel                            |   Min |  Mean |   Max | Baseline |")
+    print("|-----------------------------------|-------|-------|-------|----------|")
+    for name, r in results.items():
+        ref = reference.get(name, None)
+        ref_str = "-" if ref is None else str(ref['mean'])
+        if ref is not None and r['mean'] > ref['mean'] * (1 + tolerance):
+            ref_str += " !"
+            ok = False
+        print("| {} | {} | {} | {} | {} |".format(
+            name.ljust(33), str(r['min']).rjust(5), str(r['mean']).rjust(5),
+            str(r['max']).rjust(5), ref_str.rjust(8)))
+
+    if save is not None:
+        with open(save, 'w') as fp:
+            json.dump(results, fp, indent=2)
+
+    if not ok:
+        print("Regressions (!) above {:.0f}% of the baseline".format(tolerance * 100))
+    return ok
@@ -1,9 +1,10 @@
-
 from matplotlib import pyplot as plt
 import sys
 
+# One line per sample with one column per channel, as written by
+# odrive.utils.oscilloscope_dump()
 with open(sys.argv[1]) as f:
-    data = list(map(float, f))
+    data = [list(map(float, line.split(','))) for line in f if line.strip()]
 
 plt.plot(data)
-plt.show()
\ No newline at end of file
+plt.show()